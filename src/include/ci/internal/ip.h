@@ -823,6 +823,22 @@ extern int ci_tcp_zc_send(ci_netif* ni, ci_tcp_state* ts,
                           struct onload_zc_mmsg* msgs, int flags);
 struct onload_zc_recv_args;
 int ci_udp_zc_recv(ci_udp_iomsg_args* a, struct onload_zc_recv_args* args);
+struct onload_zc_iovec;
+extern int ci_tcp_zc_recv_lend(ci_netif* ni, ci_tcp_state* ts,
+                               struct onload_zc_iovec* iov, int iovlen,
+                               int flags) CI_HF;
+extern void ci_tcp_zc_recv_unlend(ci_netif* ni, ci_sock_cmn* s,
+                                  ci_ip_pkt_fmt* pkt) CI_HF;
+extern int ci_tcp_recv_detach_pkts(ci_netif* ni, ci_tcp_state* ts,
+                                   ci_ip_pkt_fmt** pkts, int max_pkts,
+                                   int max_bytes) CI_HF;
+extern int ci_tcp_sendmsg_pkts(ci_netif* ni, ci_tcp_state* ts,
+                               ci_ip_pkt_fmt** pkts, const int* lens, int n,
+                               int flags) CI_HF;
+extern int ci_tcp_sendmsg_locked(ci_netif* ni, ci_tcp_state* ts,
+                                 const void* buf, int len, int flags) CI_HF;
+extern int ci_tcp_recvmsg_locked(ci_netif* ni, ci_tcp_state* ts,
+                                 void* buf, int len) CI_HF;
 
 /* A special version of recvmsg to grab data from kernel stack when
  * doing zero-copy 
@@ -853,6 +869,22 @@ extern void ci_udp_state_free(ci_netif*, ci_udp_state*) CI_HF;
 extern int ci_udp_csum_correct(ci_ip_pkt_fmt* pkt, ci_udp_hdr* udp) CI_HF;
 
 extern void ci_udp_sendmsg_send_async_q(ci_netif*, ci_udp_state*) CI_HF;
+extern void ci_udp_tx_stage_drain(ci_netif*) CI_HF;
+#if CI_CFG_PIO
+struct oo_msg_template;
+struct onload_template_msg_update_iovec;
+extern int ci_udp_tmpl_alloc(ci_netif* ni, ci_udp_state* us,
+                             struct oo_msg_template** omt_pp,
+                             const struct iovec* initial_msg, int mlen,
+                             unsigned flags) CI_HF;
+extern int
+ci_udp_tmpl_update(ci_netif* ni, ci_udp_state* us,
+                   struct oo_msg_template* omt,
+                   const struct onload_template_msg_update_iovec* updates,
+                   int ulen, unsigned flags) CI_HF;
+extern int ci_udp_tmpl_abort(ci_netif* ni, ci_udp_state* us,
+                             struct oo_msg_template* omt) CI_HF;
+#endif
 extern void ci_udp_perform_deferred_socket_work(ci_netif*, ci_udp_state*)CI_HF;
 extern int ci_udp_try_to_free_pkts(ci_netif*, ci_udp_state*,
                                     int desperation) CI_HF;
@@ -877,6 +909,10 @@ extern int ci_pipe_zc_read(ci_netif* ni, struct oo_pipe* p, int len,
                            int flags, ci_pipe_zc_read_cb cb, void* ctx) CI_HF;
 extern int ci_pipe_zc_move(ci_netif* ni, struct oo_pipe* pipe_src,
                            struct oo_pipe* pipe_dest, int len, int flags) CI_HF;
+extern int ci_pipe_zc_send_tcp(ci_netif* ni, struct oo_pipe* p,
+                               ci_tcp_state* ts, int len, int flags) CI_HF;
+extern int ci_pipe_zc_recv_tcp(ci_netif* ni, struct oo_pipe* p,
+                               ci_tcp_state* ts, int len) CI_HF;
 extern int ci_pipe_zc_write(ci_netif* ni, struct oo_pipe* p,
                             struct ci_pipe_pkt_list* pkts,
                             int len, int flags) CI_HF;
@@ -1053,12 +1089,17 @@ extern int ci_pipe_list_to_iovec(ci_netif* ni, struct oo_pipe* p,
 #define tcp_snd_up(ts)   ((ts)->snd_up)
 
 #define tcp_rcv_nxt(ts)  (TS_TCP(ts)->tcp_ack_be32)
-#define tcp_rcv_usr(ts)  ((ts)->rcv_added - (ts)->rcv_delivered)
+/* Bytes the app can still read; excludes bytes lent by
+ * onload_zc_recv_lend(), which occupy the receive buffer until released.
+ */
+#define tcp_rcv_usr(ts)  ((ts)->rcv_added - (ts)->rcv_delivered - \
+                          (ts)->rcv_lent)
 #define tcp_rcv_up(ts)   ((ts)->rcv_up)
 #define tcp_rcv_wnd_advertised(ts)  ((ts)->rcv_wnd_advertised)
 #define tcp_rcv_wnd_right_edge_sent(ts)  ((ts)->rcv_wnd_right_edge_sent)
 #define tcp_rcv_wnd_current(ts) \
-    CI_MIN((ts)->rcv_window_max, (ts)->s.so.rcvbuf - tcp_rcv_usr(ts))
+    CI_MIN((ts)->rcv_window_max, \
+           (ts)->s.so.rcvbuf - ((ts)->rcv_added - (ts)->rcv_delivered))
 
 /* TCP packet urgent offset - named urgent offset
    to differantiate it from snd_up of the tcp state */
@@ -1165,7 +1206,8 @@ extern int ci_pipe_list_to_iovec(ci_netif* ni, struct oo_pipe* p,
   ((~ts->s.b.state & CI_TCP_STATE_SLOW_PATH)    &&      \
    ci_ip_queue_is_empty(&(ts)->rob)             &&      \
    tcp_rx_urg_fast_path(ts)                     &&      \
-   tcp_rcv_wnd_advertised(ts)                     )
+   tcp_rcv_wnd_advertised(ts)                   &&      \
+   (~(ts)->tcpflags & CI_TCPT_FLAG_ECN)           )
 
 /* is state in CI_TCP_STATE_TIMEOUT_ORPHAN and orphaned -
  * if so we timeout */
@@ -1342,7 +1384,13 @@ extern ci_tcp_state_synrecv* ci_tcp_listenq_lookup(ci_netif* netif,
 						   ci_tcp_socket_listen* tls,
 						   ciip_tcp_rx_pkt*) CI_HF;
 extern void ci_tcp_listenq_drop_oldest(ci_netif*, ci_tcp_socket_listen*) CI_HF;
+extern void ci_tcp_accept_prealloc_fill(ci_netif*) CI_HF;
+extern void ci_tcp_accept_prealloc_release(ci_netif*) CI_HF;
 extern int ci_tcp_listenq_drop_all(ci_netif*, ci_tcp_socket_listen*) CI_HF;
+#ifdef __ci_driver__
+extern void ci_tcp_synrecv_table_init(ci_tcp_synrecv_table*,
+                                      unsigned max_buckets) CI_HF;
+#endif
 
 extern int ci_tcp_listenq_try_promote(ci_netif*, ci_tcp_socket_listen*,
                                       ci_tcp_state_synrecv*,
@@ -1368,6 +1416,8 @@ extern const char* ci_tcp_congstate_str(unsigned state) CI_HF;
 extern void ci_tcp_handle_rx(ci_netif*, struct ci_netif_poll_state*,
                              ci_ip_pkt_fmt*, ci_tcp_hdr*, int ip_paylen) CI_HF;
 extern void ci_tcp_rx_deliver2(ci_tcp_state*,ci_netif*,ciip_tcp_rx_pkt*) CI_HF;
+extern void ci_tcp_rx_loopback_direct(ci_netif*, ci_tcp_state*,
+                                      ci_ip_pkt_fmt*) CI_HF;
 
 extern void ci_tcp_tx_change_mss(ci_netif*, ci_tcp_state*) CI_HF;
 extern void ci_tcp_enqueue_no_data(ci_tcp_state* ts, ci_netif* netif,
@@ -1494,6 +1544,12 @@ ci_netif_filter_hash(ci_netif* ni, unsigned laddr, unsigned lport,
                      unsigned raddr, unsigned rport,
                      unsigned protocol) CI_HF;
 
+/* Prefetches the buckets that ci_netif_filter_lookup() would probe first. */
+extern void
+ci_netif_filter_prefetch(ci_netif* ni, unsigned laddr, unsigned lport,
+                         unsigned raddr, unsigned rport,
+                         unsigned protocol) CI_HF;
+
 extern int
 ci_netif_filter_insert(ci_netif* netif, oo_sp sock_id, int af_space,
                        const ci_addr_t laddr, unsigned lport,
@@ -1512,8 +1568,9 @@ ci_netif_filter_remove(ci_netif* netif, oo_sp tcp_id, int af_space,
                        const ci_addr_t raddr, unsigned rport,
                        unsigned protocol) CI_HF;
 
-#define CI_NETIF_FILTER_ID_TO_SOCK_ID(ni, filter_id)            \
-  OO_SP_FROM_INT((ni), (ni)->filter_table->table[filter_id].id)
+#define CI_NETIF_FILTER_ID_TO_SOCK_ID(ni, filter_id)                    \
+  OO_SP_FROM_INT((ni),                                                  \
+                 CI_NETIF_FILTER_ENTRY((ni)->filter_table, (filter_id))->id)
 
 #ifndef __KERNEL__
 extern oo_sp ci_netif_active_wild_get(ci_netif* ni, unsigned laddr,
@@ -2216,6 +2273,32 @@ ci_inline ci_uint32 ci_ip_time_ticks2ms(ci_netif* ni, ci_iptime_t t) {
   return t;
 }
 
+/*! Round a time up to the granularity set by EF_TIMER_COALESCE_MS, so
+**  that coarse timers are expired together.
+**  \param ni   A pointer to the netif
+**  \param t    The time in ticks
+**  \return     The time t rounded up
+*/
+ci_inline ci_iptime_t ci_ip_time_coarse(ci_netif* ni, ci_iptime_t t)
+{
+  ci_uint32 mask = IPTIMER_STATE(ni)->coalesce_mask;
+  return (t + mask) & ~mask;
+}
+
+/*! Modify (or set) a coarse timer.  Nothing is done if the timer is
+**  already pending at the rounded time.
+*/
+ci_inline void ci_ip_timer_modify_coarse(ci_netif* ni, ci_ip_timer* ts,
+                                         ci_iptime_t t)
+{
+  t = ci_ip_time_coarse(ni, t);
+  if( ts->time == t && ci_ip_timer_pending(ni, ts) ) {
+    CITP_STATS_NETIF_INC(ni, timer_coalesced);
+    return;
+  }
+  ci_ip_timer_modify(ni, ts, t);
+}
+
 
 #if CI_CFG_TCP_METRICS
 ci_inline oo_metrics_tstamp oo_metrics_frc2tstamp(const ci_netif* ni,
@@ -2256,6 +2339,146 @@ ci_inline unsigned oo_metrics_intvl2us(const ci_netif* ni, oo_metrics_intvl i)
 #endif
 
 
+#if CI_CFG_LAT_HIST
+/**********************************************************************
+ * Latency histograms (EF_LATENCY_HIST).
+ */
+
+ci_inline unsigned ci_lat_hist_bucket(ci_uint32 ns)
+{
+  unsigned msb;
+  if( ns < (1u << CI_CFG_LAT_HIST_SUB_BITS) )
+    return ns;
+  msb = 31 - __builtin_clz(ns);
+  return ((msb - CI_CFG_LAT_HIST_SUB_BITS + 1) << CI_CFG_LAT_HIST_SUB_BITS) |
+    ((ns >> (msb - CI_CFG_LAT_HIST_SUB_BITS)) &
+     ((1u << CI_CFG_LAT_HIST_SUB_BITS) - 1));
+}
+
+
+/* Smallest value (in ns) that falls into bucket [b]. */
+ci_inline ci_uint32 ci_lat_hist_bucket_lo(unsigned b)
+{
+  unsigned msb;
+  if( b < (1u << CI_CFG_LAT_HIST_SUB_BITS) )
+    return b;
+  msb = (b >> CI_CFG_LAT_HIST_SUB_BITS) + CI_CFG_LAT_HIST_SUB_BITS - 1;
+  return (1u << msb) | ((b & ((1u << CI_CFG_LAT_HIST_SUB_BITS) - 1)) <<
+                        (msb - CI_CFG_LAT_HIST_SUB_BITS));
+}
+
+
+ci_inline void ci_lat_hist_add(ci_lat_hist* h, ci_uint32 ns)
+{
+  ++h->bucket[ci_lat_hist_bucket(ns)];
+  ++h->n;
+  h->sum_ns += ns;
+  if( ns > h->max_ns )
+    h->max_ns = ns;
+}
+
+
+/* Number of sockets with their own histograms.  The kernel must not trust
+ * the count in shared state.
+ */
+ci_inline unsigned ci_netif_lat_hist_n_socks(ci_netif* ni)
+{
+#ifdef __KERNEL__
+  return ni->lat_hist_n_socks;
+#else
+  return ni->state->lat_hist_n_socks;
+#endif
+}
+
+
+/* Records the interval from [start_frc] to [end_frc] in the stack's
+ * histogram [which], and in socket [sock]'s if it has one.
+ */
+ci_inline void ci_netif_lat_hist_record(ci_netif* ni, oo_sp sock, int which,
+                                        ci_uint64 start_frc,
+                                        ci_uint64 end_frc)
+{
+  ci_int64 ticks = (ci_int64) (end_frc - start_frc);
+  ci_uint64 ns;
+
+  /* frc may go backwards slightly when start and end were read on
+   * different cores.  Clamp so that the multiply cannot overflow.
+   */
+  if( ticks < 0 )
+    ticks = 0;
+  else if( ticks > (1ll << 40) )
+    ticks = 1ll << 40;
+  ns = ((ci_uint64) ticks * ni->state->lat_hist_ns_mult)
+    >> CI_LAT_HIST_FRC_SHIFT;
+  if( ns > 0xffffffffu )
+    ns = 0xffffffffu;
+
+  ci_lat_hist_add(&ni->state->lat_hist.h[which], (ci_uint32) ns);
+  if( OO_SP_NOT_NULL(sock) &&
+      (unsigned) OO_SP_TO_INT(sock) < ci_netif_lat_hist_n_socks(ni) )
+    ci_lat_hist_add(&ni->lat_hist_socks[OO_SP_TO_INT(sock)].h[which],
+                    (ci_uint32) ns);
+}
+
+
+/* Called when the application hands a packet to the stack for sending. */
+ci_inline void ci_netif_lat_hist_tx_stamp(ci_netif* ni, ci_ip_pkt_fmt* pkt)
+{
+  if(CI_UNLIKELY( NI_OPTS(ni).latency_hist )) {
+    ci_frc64(&pkt->tstamp_frc);
+    pkt->flags |= CI_PKT_FLAG_LAT_SENT;
+  }
+}
+
+
+ci_inline oo_sp ci_netif_lat_hist_tx_sock(ci_ip_pkt_fmt* pkt)
+{
+#if CI_CFG_UDP
+  if( pkt->flags & CI_PKT_FLAG_UDP )
+    return pkt->pf.udp.tx_sock_id;
+#endif
+  return pkt->pf.tcp_tx.lo.tx_sock;
+}
+
+
+/* Called as a packet stamped by ci_netif_lat_hist_tx_stamp() is passed to
+ * the NIC.  From here on [tstamp_frc] holds the doorbell time, which is
+ * also what onload_tcpdump wants.
+ */
+ci_inline void ci_netif_lat_hist_tx_doorbell(ci_netif* ni, ci_ip_pkt_fmt* pkt)
+{
+  ci_uint64 now;
+  if( pkt->flags & CI_PKT_FLAG_MSG_WARM )
+    return;
+  ci_frc64(&now);
+  ci_netif_lat_hist_record(ni, ci_netif_lat_hist_tx_sock(pkt),
+                           CI_LAT_HIST_TX_DOORBELL, pkt->tstamp_frc, now);
+  pkt->tstamp_frc = now;
+  pkt->flags = (pkt->flags & ~CI_PKT_FLAG_LAT_SENT) | CI_PKT_FLAG_LAT_DOORBELL;
+}
+
+
+ci_inline void ci_netif_lat_hist_rx(ci_netif* ni, oo_sp sock,
+                                    ci_ip_pkt_fmt* pkt)
+{
+  if(CI_UNLIKELY( NI_OPTS(ni).latency_hist ))
+    ci_netif_lat_hist_record(ni, sock, CI_LAT_HIST_RX_APP,
+                             pkt->tstamp_frc, ci_frc64_get());
+}
+
+
+ci_inline void ci_netif_lat_hist_sock_init(ci_netif* ni, oo_sp sock)
+{
+  if( (unsigned) OO_SP_TO_INT(sock) < ci_netif_lat_hist_n_socks(ni) )
+    memset(&ni->lat_hist_socks[OO_SP_TO_INT(sock)], 0,
+           sizeof(ni->lat_hist_socks[0]));
+}
+#else
+/* Used in __ci_netif_dmaq_insert_prep_pkt(), which can't have #if. */
+# define ci_netif_lat_hist_tx_doorbell(ni, pkt)  do{}while(0)
+#endif
+
+
 ci_inline const cicp_hwport_mask_t ci_netif_get_hwport_mask(ci_netif* ni)
 {
 #ifdef __KERNEL__
@@ -2592,11 +2815,22 @@ ci_inline ci_ip_pkt_fmt* ci_netif_pkt_alloc(ci_netif* ni, int flags) {
 }
 
 
-ci_inline int ci_netif_pkt_nonb_pool_is_empty(ci_netif* ni)
-{ return (ni->state->nonb_pkt_pool & 0xffffffff) == 0xffffffff; }
-
+/* The non-blocking pool is [nonb_pkt_pool] plus the per-thread
+ * [nonb_magazine]s.
+ */
 ci_inline int ci_netif_pkt_nonb_pool_not_empty(ci_netif* ni)
-{ return (ni->state->nonb_pkt_pool & 0xffffffff) != 0xffffffff; }
+{
+  int i;
+  if( (ni->state->nonb_pkt_pool & 0xffffffff) != 0xffffffff )
+    return 1;
+  for( i = 0; i < CI_CFG_PKT_NONB_MAGAZINES; ++i )
+    if( (ni->state->nonb_magazine[i].link & 0xffffffff) != 0xffffffff )
+      return 1;
+  return 0;
+}
+
+ci_inline int ci_netif_pkt_nonb_pool_is_empty(ci_netif* ni)
+{ return ! ci_netif_pkt_nonb_pool_not_empty(ni); }
 
 
 
@@ -2680,24 +2914,27 @@ ci_netif_pkt_tx_tcp_alloc(ci_netif* ni, ci_tcp_state* ts) {
 }
 
 
-ci_inline ci_ip_pkt_fmt* ci_netif_pkt_alloc_nonb(ci_netif* ni) 
+/* Pop a packet from a non-blocking list: [nonb_pkt_pool] or one of the
+ * [nonb_magazine]s.  The low 32 bits of [*pool] are the id of the head;
+ * the high 32 bits count pushes, to defeat ABA.
+ */
+ci_inline ci_ip_pkt_fmt* __ci_netif_pkt_nonb_pop(ci_netif* ni,
+                                                 volatile ci_uint64* pool)
 {
-  volatile ci_uint64 *nonb_pkt_pool_ptr;
   ci_uint64 link, new_link;
   unsigned id;
   ci_ip_pkt_fmt* pkt;
   oo_pkt_p pp;
 
-  nonb_pkt_pool_ptr = &(ni->state->nonb_pkt_pool);
  again:
   pkt = NULL;
-  link = *nonb_pkt_pool_ptr;
+  link = *pool;
   id = link & 0xffffffff;
   if( id != 0xffffffff ) {
     OO_PP_INIT(ni, pp, id);
     pkt = PKT(ni, pp);
     new_link = ((unsigned)OO_PP_ID(pkt->next)) | (link & 0xffffffff00000000llu);
-    if( ci_cas64u_fail(nonb_pkt_pool_ptr, link, new_link) )
+    if( ci_cas64u_fail(pool, link, new_link) )
       goto again;
     ci_assert_equal(pkt->refcount, 0);
     pkt->refcount = 1;
@@ -2707,20 +2944,68 @@ ci_inline ci_ip_pkt_fmt* ci_netif_pkt_alloc_nonb(ci_netif* ni)
 }
 
 
-ci_inline void ci_netif_pkt_free_nonb_list(ci_netif *ni, oo_pkt_p pkt_list,
-                                             ci_ip_pkt_fmt *pkt_list_tail) 
+ci_inline void __ci_netif_pkt_nonb_push(ci_netif* ni, volatile ci_uint64* pool,
+                                        oo_pkt_p pkt_list,
+                                        ci_ip_pkt_fmt* pkt_list_tail)
 {
-  volatile ci_uint64 *nonb_pkt_pool_ptr;
   ci_uint64 new_link, link;
 
-  nonb_pkt_pool_ptr = &(ni->state->nonb_pkt_pool);
   do {
     ci_assert_equal(pkt_list_tail->refcount, 0);
-    link = *nonb_pkt_pool_ptr;
+    link = *pool;
     OO_PP_INIT(ni, pkt_list_tail->next, link & 0xffffffff);
     new_link = ((unsigned)OO_PP_ID(pkt_list)) | 
       ((link + 0x0000000100000000llu) & 0xffffffff00000000llu);
-  } while( ci_cas64u_fail(nonb_pkt_pool_ptr, link, new_link) );
+  } while( ci_cas64u_fail(pool, link, new_link) );
+}
+
+
+/* Index of the calling thread's [nonb_magazine], or -1 if it has none (as
+ * in the kernel, which uses [nonb_pkt_pool] directly).
+ */
+#ifndef __KERNEL__
+extern int ci_netif_pkt_nonb_magazine_id(void) CI_HF;
+#else
+# define ci_netif_pkt_nonb_magazine_id()  (-1)
+#endif
+
+/* Take a packet from any magazine other than [not_mag].  Used when the
+ * caller's magazine and [nonb_pkt_pool] are both empty.
+ */
+extern ci_ip_pkt_fmt*
+ci_netif_pkt_alloc_nonb_steal(ci_netif* ni, int not_mag) CI_HF;
+
+
+/* Allocate from the non-blocking pool: from this thread's magazine if
+ * possible, then [nonb_pkt_pool], then other threads' magazines.  Returns
+ * NULL only if the whole pool is empty (modulo races).
+ */
+ci_inline ci_ip_pkt_fmt* ci_netif_pkt_alloc_nonb(ci_netif* ni) 
+{
+  int mag = ci_netif_pkt_nonb_magazine_id();
+  ci_ip_pkt_fmt* pkt;
+
+  if( mag >= 0 &&
+      (pkt = __ci_netif_pkt_nonb_pop(ni, &ni->state->nonb_magazine[mag].link)) )
+    return pkt;
+  if( (pkt = __ci_netif_pkt_nonb_pop(ni, &ni->state->nonb_pkt_pool)) )
+    return pkt;
+  return ci_netif_pkt_alloc_nonb_steal(ni, mag);
+}
+
+
+/* Return a list of packets to the non-blocking pool: to this thread's
+ * magazine, or to [nonb_pkt_pool] if it has none.
+ */
+ci_inline void ci_netif_pkt_free_nonb_list(ci_netif *ni, oo_pkt_p pkt_list,
+                                             ci_ip_pkt_fmt *pkt_list_tail) 
+{
+  int mag = ci_netif_pkt_nonb_magazine_id();
+  volatile ci_uint64* pool;
+
+  pool = mag >= 0 ? &ni->state->nonb_magazine[mag].link :
+                    &ni->state->nonb_pkt_pool;
+  __ci_netif_pkt_nonb_push(ni, pool, pkt_list, pkt_list_tail);
 }
 
 
@@ -3398,7 +3683,8 @@ ci_inline void ci_tcp_kalive_restart(ci_netif *netif, ci_tcp_state* ts,
              ts->s.b.state != CI_TCP_LISTEN );
 
   if( ts->s.s_flags & CI_SOCK_FLAG_KALIVE )
-    ci_ip_timer_modify(netif, &ts->kalive_tid, ci_tcp_time_now(netif) + t);
+    ci_ip_timer_modify_coarse(netif, &ts->kalive_tid,
+                              ci_tcp_time_now(netif) + t);
   else
     /*
      * ka_probes is not cleared somewhere, as soon as with disabled
@@ -3780,6 +4066,84 @@ ci_inline unsigned ci_tcp_losswnd(ci_tcp_state* ts) {
 }
 
 
+/* Pluggable congestion control.
+ *
+ * Reno (RFC5681 with RFC3465 ABC) is implemented inline on the ACK path by
+ * ci_tcp_opencwnd(), and sockets using it never call through this table.
+ * Other algorithms are selected per socket by [ts->c.cc_algo] (one of
+ * CI_TCP_CC_*, set from EF_TCP_CONGESTION or TCP_CONGESTION) and are
+ * implemented in tcp_cc.c.  Slow start is common to all algorithms.  Any
+ * hook may be NULL, in which case the Reno behaviour is used.
+ */
+typedef struct {
+  const char* name;
+  unsigned    flags;
+#define CI_TCP_CC_FLAG_ECN  0x1     /* negotiate ECN and send ECT(0) */
+
+  /* Reset per-algorithm state in [ts->cc]. */
+  void (*init)(ci_netif* ni, ci_tcp_state* ts);
+  /* An ACK covering [acked] bytes of new data has arrived.  Called before
+   * snd_una is advanced and before the congestion window is opened.
+   * [ece] is non-zero if the ACK had ECE set. */
+  void (*on_ack)(ci_netif* ni, ci_tcp_state* ts, unsigned acked, int ece);
+  /* Congestion avoidance: called instead of the Reno increase when
+   * cwnd >= ssthresh.  [ts->bytes_acked] holds bytes acked but not yet
+   * accounted for in cwnd. */
+  void (*cong_avoid)(ci_netif* ni, ci_tcp_state* ts);
+  /* Return the new ssthresh on loss.  [rto] is non-zero for a
+   * retransmit timeout, zero for fast recovery. */
+  unsigned (*ssthresh)(ci_netif* ni, ci_tcp_state* ts, int rto);
+  /* A new RTT sample [rtt] (in ticks) has been taken. */
+  void (*on_rtt_sample)(ci_netif* ni, ci_tcp_state* ts, unsigned rtt);
+} ci_tcp_cc_ops;
+
+extern const ci_tcp_cc_ops* const ci_tcp_cc_ops_tbl[CI_TCP_CC_N];
+
+/* Buffer size for a TCP_CONGESTION name, including the nul. */
+#define CI_TCP_CC_NAME_MAX  16
+
+/* Returns the CI_TCP_CC_* id for [name], or -ENOENT. */
+extern int ci_tcp_cc_find(const char* name) CI_HF;
+
+/* Reset congestion control state for a new connection or algorithm. */
+extern void ci_tcp_cc_init(ci_netif* ni, ci_tcp_state* ts) CI_HF;
+
+/* The ops for [algo].  Sockets keep their id in shared state and the
+ * kernel calls through the result, so anything out of range gets Reno.
+ * Callers must look the ops up once rather than re-reading the id. */
+ci_inline const ci_tcp_cc_ops* ci_tcp_cc_ops_get(unsigned algo)
+{
+  return ci_tcp_cc_ops_tbl[algo < CI_TCP_CC_N ? algo : CI_TCP_CC_RENO];
+}
+
+#define ci_tcp_cc(ts)  ci_tcp_cc_ops_get(OO_ACCESS_ONCE((ts)->c.cc_algo))
+
+ci_inline int ci_tcp_cc_wants_ecn(const ci_tcp_socket_cmn* c)
+{
+  return ci_tcp_cc_ops_get(c->cc_algo)->flags & CI_TCP_CC_FLAG_ECN;
+}
+
+/* New value for [ssthresh] after loss, according to the congestion control
+ * algorithm in use. */
+ci_inline unsigned ci_tcp_cc_ssthresh(ci_netif* ni, ci_tcp_state* ts,
+                                      int rto)
+{
+  const ci_tcp_cc_ops* cc;
+  if(CI_LIKELY( ts->c.cc_algo == CI_TCP_CC_RENO ||
+                (cc = ci_tcp_cc(ts))->ssthresh == NULL ))
+    return ci_tcp_losswnd(ts);
+  return cc->ssthresh(ni, ts, rto);
+}
+
+/* ECN has been agreed with the peer: mark our packets ECN-capable. */
+ci_inline void ci_tcp_ecn_enable(ci_tcp_state* ts)
+{
+  ts->tcpflags |= CI_TCPT_FLAG_ECN;
+  ts->s.pkt.ip.ip_tos = (ts->s.pkt.ip.ip_tos & ~CI_IP_TOS_ECN_MASK) |
+                        CI_IP_ECN_ECT0;
+}
+
+
 /* find effective MSS value based on smss, PMTU and MTU and optional user
  * value */
 ci_inline void ci_tcp_set_eff_mss(ci_netif* netif, ci_tcp_state* ts) {
@@ -3891,6 +4255,22 @@ ci_inline void ci_tcp_tx_pkt_set_end(ci_tcp_state* ts, ci_ip_pkt_fmt* pkt) {
 }
 
 
+/* Buckets to allocate for the SYN-RECV table: enough for [synrecv_max]
+ * entries at half load. */
+#define CI_TCP_SYNRECV_TABLE_MIN_BUCKETS  4
+ci_inline unsigned ci_tcp_synrecv_table_buckets(unsigned synrecv_max)
+{
+  unsigned n = (synrecv_max * 2 + CI_TCP_SYNRECV_BUCKET_WAYS - 1) /
+               CI_TCP_SYNRECV_BUCKET_WAYS;
+  return 1u << ci_log2_ge(n, ci_log2_le(CI_TCP_SYNRECV_TABLE_MIN_BUCKETS));
+}
+
+ci_inline unsigned ci_tcp_synrecv_table_bytes(unsigned max_buckets)
+{
+  return sizeof(ci_tcp_synrecv_table) +
+         sizeof(ci_tcp_synrecv_bucket) * (max_buckets - 1);
+}
+
 ci_inline int ci_tcp_listenq_max(ci_netif* ni)
 { return NI_OPTS(ni).tcp_backlog_max; }
 
@@ -4056,7 +4436,6 @@ static inline const char* ci_tcp_aux_type2str(int type)
 {
   switch(type) {
     case CI_TCP_AUX_TYPE_SYNRECV: return "syn-recv state";
-    case CI_TCP_AUX_TYPE_BUCKET:  return "syn-recv bucket";
     case CI_TCP_AUX_TYPE_EPOLL: return "epoll3 state";
     default: return "unknown";
   }
@@ -4074,12 +4453,6 @@ ci_inline ci_tcp_state_synrecv* ci_ni_aux_p2synrecv(ci_netif* ni, oo_p oop)
   ci_assert_equal(aux->type, CI_TCP_AUX_TYPE_SYNRECV);
   return &aux->u.synrecv;
 }
-ci_inline ci_tcp_listen_bucket* ci_ni_aux_p2bucket(ci_netif* ni, oo_p oop)
-{
-  ci_ni_aux_mem* aux = ci_ni_aux_p2aux(ni, oop);
-  ci_assert_equal(aux->type, CI_TCP_AUX_TYPE_BUCKET);
-  return &aux->u.bucket;
-}
 ci_inline ci_sb_epoll_state* ci_ni_aux_p2epoll(ci_netif* ni, oo_p oop)
 {
   ci_ni_aux_mem* aux = ci_ni_aux_p2aux(ni, oop);
@@ -4142,22 +4515,6 @@ ci_inline oo_p ci_ni_aux_alloc(ci_netif* ni, int type)
   return ret;
 }
 
-ci_inline oo_p ci_ni_aux_alloc_bucket(ci_netif* ni)
-{
-  ci_tcp_listen_bucket* bucket;
-  oo_p ret = ci_ni_aux_alloc(ni, CI_TCP_AUX_TYPE_BUCKET);
-  int i;
-
-  if( OO_P_IS_NULL(ret) ) {
-    CITP_STATS_NETIF(++ni->state->stats.aux_bucket_alloc_fails);
-    return ret;
-  }
-  bucket = ci_ni_aux_p2bucket(ni, ret);
-  for( i = 0; i < CI_TCP_LISTEN_BUCKET_SIZE; i++ )
-    bucket->bucket[i] = OO_P_NULL;
-  return ret;
-}
-
 ci_inline oo_p ci_tcp_synrecv2p(ci_netif* ni, ci_tcp_state_synrecv* tsr)
 {
   return ci_ni_aux2p(ni, CI_CONTAINER(ci_ni_aux_mem, u.synrecv, tsr));
@@ -4169,19 +4526,74 @@ ci_inline ci_tcp_state_synrecv* ci_tcp_link2synrecv(ci_ni_dllist_link* link) {
   return &CI_CONTAINER(ci_ni_aux_mem, link, link)->u.synrecv;
 }
 
-#define CI_READY_LIST_EACH(bitmask, tmp, i)            \
-  ci_assert_lt((bitmask), 1u << CI_CFG_N_READY_LISTS); \
-  for( tmp = (bitmask), i = ffs(tmp) - 1;              \
+#define CI_READY_LISTS_MASK \
+  ((ci_uint32) (((ci_uint64) 1 << CI_CFG_N_READY_LISTS) - 1))
+
+#define CI_READY_LIST_EACH(bitmask, tmp, i)                      \
+  ci_assert_equal((bitmask) & ~CI_READY_LISTS_MASK, 0);          \
+  for( tmp = (bitmask), i = ffs(tmp) - 1;                        \
        tmp != 0; tmp &= (tmp - 1), i = ffs(tmp) - 1 )
 
+/* Find the per-socket state for ready list [id], walking the chain of
+ * epoll aux buffers from [*epoll], which covers ready lists from [*base].
+ * [*epoll] and [*base] are updated, so that visiting the lists in ascending
+ * order (as CI_READY_LIST_EACH does) walks the chain only once.
+ *
+ * [id] and the chain are in shared state, and the kernel walks them too,
+ * so NULL is returned if [id] is out of range or the chain ends short of it.
+ */
+ci_inline oo_sb_epoll*
+ci_sb_epoll_seek(ci_netif* ni, ci_sb_epoll_state** epoll, unsigned* base,
+                 unsigned id)
+{
+  ci_assert_ge(id, *base);
+  if(CI_UNLIKELY( id >= CI_CFG_N_READY_LISTS ))
+    goto bad_chain;
+  while( id >= *base + CI_EPOLL_SETS_PER_AUX_BUF ) {
+    if(CI_UNLIKELY( OO_P_IS_NULL((*epoll)->next) ))
+      goto bad_chain;
+    *epoll = ci_ni_aux_p2epoll(ni, (*epoll)->next);
+    *base += CI_EPOLL_SETS_PER_AUX_BUF;
+  }
+  return &(*epoll)->e[id - *base];
+
+ bad_chain:
+  ci_netif_error_detected(ni, CI_NETIF_ERROR_EPOLL_CHAIN, __FUNCTION__);
+  return NULL;
+}
+
+/* Per-socket state for ready list [id].  The socket's epoll chain must
+ * already cover [id], which is the case if it is in that list.
+ */
+ci_inline oo_sb_epoll* ci_sb_epoll_get(ci_netif* ni, citp_waitable* w,
+                                       unsigned id)
+{
+  ci_sb_epoll_state* epoll = ci_ni_aux_p2epoll(ni, w->epoll);
+  unsigned base = 0;
+  return ci_sb_epoll_seek(ni, &epoll, &base, id);
+}
+
+/* Epoll aux buffer containing [lnk], which is the ready_link for list [id].
+ */
+ci_inline ci_sb_epoll_state*
+ci_sb_epoll_link2state(ci_ni_dllist_link* lnk, unsigned id)
+{
+  return CI_CONTAINER(ci_sb_epoll_state,
+                      e[id % CI_EPOLL_SETS_PER_AUX_BUF].ready_link, lnk);
+}
+
 ci_inline void
 ci_netif_put_on_post_poll_epoll(ci_netif* ni, citp_waitable* sb)
 {
   ci_sb_epoll_state* epoll = ci_ni_aux_p2epoll(ni, sb->epoll);
+  oo_sb_epoll* e;
   ci_uint32 tmp, i;
+  unsigned base = 0;
   CI_READY_LIST_EACH(sb->ready_lists_in_use, tmp, i) {
-    ci_ni_dllist_remove(ni, &epoll->e[i].ready_link);
-    ci_ni_dllist_put(ni, &ni->state->ready_lists[i], &epoll->e[i].ready_link);
+    if(CI_UNLIKELY( (e = ci_sb_epoll_seek(ni, &epoll, &base, i)) == NULL ))
+      break;
+    ci_ni_dllist_remove(ni, &e->ready_link);
+    ci_ni_dllist_put(ni, &ni->state->ready_lists[i], &e->ready_link);
   }
 }
 
@@ -4189,7 +4601,13 @@ ci_inline void
 citp_waitable_remove_from_epoll(ci_netif* ni, citp_waitable* w, int do_free)
 {
   ci_sb_epoll_state* epoll;
+  oo_sb_epoll* e;
   ci_uint32 tmp, i;
+  unsigned base = 0;
+  oo_p next;
+#ifdef __KERNEL__
+  int n = 0;
+#endif
 
   ci_assert(ci_netif_is_locked(ni));
   if( OO_PP_IS_NULL(w->epoll) ) {
@@ -4199,12 +4617,30 @@ citp_waitable_remove_from_epoll(ci_netif* ni, citp_waitable* w, int do_free)
 
   epoll = ci_ni_aux_p2epoll(ni, w->epoll);
   ci_assert_equal(epoll->sock_id, w->bufid);
-  CI_READY_LIST_EACH(w->ready_lists_in_use, tmp, i)
-    ci_ni_dllist_remove_safe(ni, &epoll->e[i].ready_link);
+  CI_READY_LIST_EACH(w->ready_lists_in_use, tmp, i) {
+    if(CI_UNLIKELY( (e = ci_sb_epoll_seek(ni, &epoll, &base, i)) == NULL ))
+      break;
+    ci_ni_dllist_remove_safe(ni, &e->ready_link);
+  }
   w->ready_lists_in_use = 0;
   if( do_free ) {
-    ci_ni_aux_free(ni, CI_CONTAINER(ci_ni_aux_mem, u.epoll, epoll));
+    epoll = ci_ni_aux_p2epoll(ni, w->epoll);
     w->epoll = OO_PP_NULL;
+    while( 1 ) {
+      next = epoll->next;
+      ci_sb_epoll_free(ni, epoll);
+      if( OO_P_IS_NULL(next) )
+        break;
+#ifdef __KERNEL__
+      if(CI_UNLIKELY( ++n * CI_EPOLL_SETS_PER_AUX_BUF >=
+                      CI_CFG_N_READY_LISTS )) {
+        ci_netif_error_detected(ni, CI_NETIF_ERROR_EPOLL_CHAIN,
+                                __FUNCTION__);
+        break;
+      }
+#endif
+      epoll = ci_ni_aux_p2epoll(ni, next);
+    }
   }
 }
 
@@ -4222,7 +4658,11 @@ ci_inline void ci_netif_poll_free_pkts(ci_netif* ni,
 {
   ci_ip_pkt_fmt* tail = CI_CONTAINER(ci_ip_pkt_fmt, next,
                                      ps->tx_pkt_free_list_insert);
-  ci_netif_pkt_free_nonb_list(ni, ps->tx_pkt_free_list, tail);
+  /* These are the poller's, not a socket thread's, so they go to the
+   * shared pool rather than the poller's magazine.
+   */
+  __ci_netif_pkt_nonb_push(ni, &ni->state->nonb_pkt_pool,
+                           ps->tx_pkt_free_list, tail);
   ni->state->n_async_pkts += ps->tx_pkt_free_list_n;
   CITP_STATS_NETIF_ADD(ni, pkt_nonb, ps->tx_pkt_free_list_n);
 }
@@ -4473,29 +4913,38 @@ ci_inline ci_uint16 oo_tcpdump_queue_len(ci_netif* ni)
   return ni->state->dump_write_i - ni->state->dump_read_i;
 }
 
+#if CI_CFG_TCPDUMP_RING
+/* Copy [pkt] into the capture ring, if it passes the ring's filter. */
+extern void oo_capture_ring_write(ci_netif* ni, ci_ip_pkt_fmt* pkt) CI_HF;
+#endif
+
+/* Is there room to dump another packet? */
+ci_inline int oo_tcpdump_has_space(ci_netif* ni)
+{
+#if CI_CFG_TCPDUMP_RING
+  /* The capture ring counts its own drops. */
+  if( ni->capture_ring != NULL )
+    return 1;
+#endif
+  if( oo_tcpdump_queue_len(ni) < CI_CFG_DUMPQUEUE_LEN - 1 )
+    return 1;
+  CITP_STATS_NETIF_INC(ni, tcpdump_missed);
+  return 0;
+}
+
 /* Should we dump this packet? */
 ci_inline int oo_tcpdump_check(ci_netif *ni, ci_ip_pkt_fmt *pkt, int intf_i)
 {
-  if( ni->state->dump_intf[intf_i] == OO_INTF_I_DUMP_ALL ) {
-    if( oo_tcpdump_queue_len(ni) < CI_CFG_DUMPQUEUE_LEN - 1 )
-      return 1;
-    else
-      CITP_STATS_NETIF_INC(ni, tcpdump_missed);
-  }
-  return 0;
+  return ni->state->dump_intf[intf_i] == OO_INTF_I_DUMP_ALL &&
+         oo_tcpdump_has_space(ni);
 }
 
 /* Should we dump this no_match */
 ci_inline int oo_tcpdump_check_no_match(ci_netif *ni, ci_ip_pkt_fmt *pkt,
                                         int intf_i)
 {
-  if( ni->state->dump_intf[intf_i] == OO_INTF_I_DUMP_NO_MATCH ) {
-    if( oo_tcpdump_queue_len(ni) < CI_CFG_DUMPQUEUE_LEN - 1 )
-      return 1;
-    else
-      CITP_STATS_NETIF_INC(ni, tcpdump_missed);
-  }
-  return 0;
+  return ni->state->dump_intf[intf_i] == OO_INTF_I_DUMP_NO_MATCH &&
+         oo_tcpdump_has_space(ni);
 }
 
 /* Release all the packets up to dump_read_i */
@@ -4510,6 +4959,13 @@ ci_inline void oo_tcpdump_dump_pkt(ci_netif *ni, ci_ip_pkt_fmt *pkt)
   if(CI_UNLIKELY( pkt->flags & CI_PKT_FLAG_MSG_WARM ))
     return;
 
+#if CI_CFG_TCPDUMP_RING
+  if( ni->capture_ring != NULL ) {
+    oo_capture_ring_write(ni, pkt);
+    return;
+  }
+#endif
+
   if( dq[write_i % CI_CFG_DUMPQUEUE_LEN] != OO_PP_NULL )
     oo_tcpdump_free_pkts(ni, write_i);
 
@@ -4525,6 +4981,113 @@ ci_inline void oo_tcpdump_dump_pkt(ci_netif *ni, ci_ip_pkt_fmt *pkt)
 #endif
 
 
+/*********************************************************************
+**************************** Statistics ring *************************
+*********************************************************************/
+#if CI_CFG_STATS_RING
+/* One field of ci_netif_stats, in the order used by the statistics ring. */
+struct oo_stats_field {
+  const char* name;
+  unsigned    ofs;
+  unsigned    size;
+  unsigned    is_count;   /* monotonic counter, rather than a level */
+};
+
+extern const struct oo_stats_field oo_stats_fields[];
+extern const unsigned oo_stats_n_fields;
+extern ci_uint32 oo_stats_schema_hash(void);
+
+#ifdef __KERNEL__
+extern void ci_netif_stats_ring_init(ci_netif* ni, ci_uint32 size,
+                                     unsigned khz) CI_HF;
+#endif
+extern void ci_netif_stats_ring_start(ci_netif* ni) CI_HF;
+extern void ci_netif_stats_ring_timeout(ci_netif* ni) CI_HF;
+
+#ifndef __KERNEL__
+/* Reconstructs the values of the fields from a stack's ring.  The ring
+ * may be overwritten under the reader's feet; when that happens the reader
+ * counts an overrun and resynchronises at the most recent key record.
+ */
+struct oo_stats_reader {
+  const struct oo_stats_ring* ring;
+  ci_uint64  pos;
+  ci_uint64  seq;
+  ci_uint64  frc;         /* timestamp of the current values */
+  ci_uint64* values;      /* oo_stats_n_fields entries */
+  void*      buf;
+  ci_uint32  buf_len;
+  int        synced;
+  unsigned   n_overruns;
+};
+
+extern int oo_stats_reader_init(struct oo_stats_reader* r,
+                                const struct oo_stats_ring* ring);
+extern void oo_stats_reader_fini(struct oo_stats_reader* r);
+/* Returns 1 if it advanced to the next record, 0 if there are none. */
+extern int oo_stats_reader_next(struct oo_stats_reader* r);
+/* Apply a key or delta record to [values]. */
+extern int oo_stats_rec_apply(const struct oo_stats_rec* rec,
+                              ci_uint64* values);
+#endif
+#endif
+
+
+/*********************************************************************
+************************** Adaptive spinning *************************
+*********************************************************************/
+#if CI_CFG_SPIN_ADAPT
+ci_inline void oo_spin_adapt_init(struct oo_spin_adapt* sa)
+{
+  memset(sa, 0, sizeof(*sa));
+  sa->budget = ~(ci_uint64) 0;
+}
+
+/* Adaptive state of socket [w], or NULL if EF_SPIN_ADAPT is off. */
+ci_inline struct oo_spin_adapt* oo_spin_adapt_sock(ci_netif* ni,
+                                                   citp_waitable* w)
+{
+  if( ni->spin_adapt == NULL )
+    return NULL;
+  return &ni->spin_adapt[W_ID(w)];
+}
+
+/* Adaptive state of epoll sets using ready list [ready_list]. */
+ci_inline struct oo_spin_adapt* oo_spin_adapt_ready_list(ci_netif* ni,
+                                                         int ready_list)
+{
+  if( ni->spin_adapt == NULL )
+    return NULL;
+  return &ni->spin_adapt[NI_OPTS(ni).max_ep_bufs + ready_list];
+}
+
+/* How long to spin before sleeping, when not adapting would spin for
+ * [max_spin] cycles.  Every OO_SPIN_ADAPT_PROBE-th wait spins for
+ * [max_spin] whatever the budget, to learn whether it should grow.
+ */
+ci_inline ci_uint64 oo_spin_adapt_budget(struct oo_spin_adapt* sa,
+                                         ci_uint64 max_spin)
+{
+  if( sa == NULL ||
+      sa->n_waits % OO_SPIN_ADAPT_PROBE == OO_SPIN_ADAPT_PROBE - 1 )
+    return max_spin;
+  return CI_MIN(sa->budget, max_spin);
+}
+
+/* Record a blocking wait of [wait] cycles that spun for (at most)
+ * oo_spin_adapt_budget(sa, max_spin) cycles.
+ */
+extern void oo_spin_adapt_wait_done(ci_netif* ni, struct oo_spin_adapt* sa,
+                                    ci_uint64 wait, ci_uint64 max_spin) CI_HF;
+extern void oo_spin_adapt_dump(ci_netif* ni, struct oo_spin_adapt* sa,
+                               const char* pf, oo_dump_log_fn_t logger,
+                               void* log_arg) CI_HF;
+#else
+#define oo_spin_adapt_sock(ni, w)                   NULL
+#define oo_spin_adapt_budget(sa, max_spin)          (max_spin)
+#endif
+
+
 #ifdef __KERNEL__
 /*********************************************************************
 **************************** OS socket status ************************
@@ -213,7 +213,7 @@
  */
 
 #define CI_TCP_SOCKET_FLAGS_FMT                                        \
-  "%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s"
+  "%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s%s"
 #define CI_TCP_SOCKET_FLAGS_PRI_ARG(ts)                                \
   ((ts)->tcpflags & CI_TCPT_FLAG_TSO    ? "TSO " :""),                 \
   ((ts)->tcpflags & CI_TCPT_FLAG_WSCL   ? "WSCL ":""),                 \
@@ -236,7 +236,9 @@
   ((ts)->tcpflags & CI_TCPT_FLAG_TOA              ? "TOA ":""),         \
   ((ts)->tcpflags & CI_TCPT_FLAG_TAIL_DROP_TIMING ? "TLP_TIMER ":""),   \
   ((ts)->tcpflags & CI_TCPT_FLAG_TAIL_DROP_MARKED ? "TLP_SENT ":""),    \
-  ((ts)->tcpflags & CI_TCPT_FLAG_FIN_PENDING      ? "FIN_PENDING ":"")
+  ((ts)->tcpflags & CI_TCPT_FLAG_FIN_PENDING      ? "FIN_PENDING ":""), \
+  ((ts)->tcpflags & CI_TCPT_FLAG_ECN_ECE          ? "ECN_ECE ":""),     \
+  ((ts)->tcpflags & CI_TCPT_FLAG_ECN_CWR          ? "ECN_CWR ":"")
 
 
 #define CI_SOCK_FLAGS_FMT \
@@ -389,12 +391,13 @@ extern unsigned ci_tp_log CI_HV;
   ((v) & CI_EPLOCK_NETIF_SOCKET_LIST     ? "DEFERRED ":"")
 
 
-#define CI_NETIF_ERRORS_FMT       "%s%s%s%s"
+#define CI_NETIF_ERRORS_FMT       "%s%s%s%s%s"
 #define CI_NETIF_ERRORS_PRI_ARG(errors)                         \
   ((errors) & CI_NETIF_ERROR_POST_POLL_LIST ? "PPL ":""),       \
   ((errors) & CI_NETIF_ERROR_LOOP_PKTS_LIST ? "LOOP ":""),      \
   ((errors) & CI_NETIF_ERROR_ASSERT         ? "ASS ":""),       \
-  ((errors) & CI_NETIF_ERROR_SYNRECV_TABLE  ? "SYNRECV ":"")
+  ((errors) & CI_NETIF_ERROR_SYNRECV_TABLE  ? "SYNRECV ":""),   \
+  ((errors) & CI_NETIF_ERROR_EPOLL_CHAIN    ? "EPOLL ":"")
 
 
 #define CI_NETIF_NIC_ERRORS_FMT       "%s"
@@ -101,6 +101,10 @@
 #define CI_IPTIME_BUCKETMASK  255
 #define CI_IPTIME_BUCKETBITS  8
 #define CI_IPTIME_WHEELSIZE   (CI_IPTIME_WHEELS*CI_IPTIME_BUCKETS)
+/* With EF_TIMER_MODE=1 every level but the top one is double-buffered:
+** the buckets in [wnext] hold the next rotation of the level.
+*/
+#define CI_IPTIME_WNEXTSIZE   ((CI_IPTIME_WHEELS-1)*CI_IPTIME_BUCKETS)
 
 
 /* ========= Field Protection ======== */
@@ -108,13 +112,18 @@
 ** only by the kernel - and never by the user mode we use this pseudo-type
 ** to identify it.  Some fields can only be compiled as "const" if the compile
 ** time option to force initilaiztion to occur in the kernel is set.
+**
+** User-level code that plays the part of the driver (test harnesses that
+** build a stack without one) may define CI_ULCONST to be empty first.
 */
 
+#ifndef CI_ULCONST
 #ifdef __KERNEL__
 #define CI_ULCONST 
 #else
 #define CI_ULCONST const
 #endif
+#endif
 
 /* ========= UDP ========== */
 /* Length of queue in each ep  ** MUST BE A POWER of 2 ** 
@@ -262,6 +271,7 @@ typedef union {
   struct {
     ci_uint32         base;       /* Offset of start of data from dma_start. */
     ci_uint32         pay_len;    /* This buffer's payload length. */
+    ci_uint32         end;        /* Offset of end of usable space. */
   } pipe;
 #endif
 } ci_ip_pkt_fmt_prefix;
@@ -372,10 +382,17 @@ struct ci_ip_pkt_fmt_s {
 #define CI_PKT_FLAG_MSG_WARM       0x0800  /* pkt with a TX timestamp    */
 #define CI_PKT_FLAG_TX_CTPIO       0x1000  /* attempted CTPIO send       */
 #define CI_PKT_FLAG_TX_PSH_ON_ACK  0x2000  /* set PSH and emit on ack    */
+#if CI_CFG_LAT_HIST
+#define CI_PKT_FLAG_LAT_SENT       0x4000  /* tstamp_frc is app send time */
+#define CI_PKT_FLAG_LAT_DOORBELL   0x8000  /* tstamp_frc is doorbell time */
+#else
+#define CI_PKT_FLAG_LAT_SENT       0
+#define CI_PKT_FLAG_LAT_DOORBELL   0
+#endif
 
 #define CI_PKT_FLAG_TX_MASK_ALLOWED                                     \
     (CI_PKT_FLAG_TX_MORE | CI_PKT_FLAG_TX_PSH | CI_PKT_FLAG_NONB_POOL | \
-     CI_PKT_FLAG_TX_PSH_ON_ACK)
+     CI_PKT_FLAG_TX_PSH_ON_ACK | CI_PKT_FLAG_LAT_SENT)
 
   ci_uint16             flags;
 
@@ -384,6 +401,7 @@ struct ci_ip_pkt_fmt_s {
    *   corresponding socket lock. */
 #define CI_PKT_RX_FLAG_RECV_Q_CONSUMED 0x01 /* recv_q: consumed    */
 #define CI_PKT_RX_FLAG_UDP_KEEP        0x02 /* recv_q: do not drop pkt  */
+#define CI_PKT_RX_FLAG_TCP_LENT        0x04 /* recv1: lent to the app   */
   ci_uint8              rx_flags;
 
   /*! Number of these buffers that are chained together using
@@ -524,20 +542,59 @@ typedef struct {
 ** ci_netif_filter_table_entry  ci_netif_filter_table
 **
 ** The filter table that demuxes packets to sockets.
+**
+** This is a bucketised cuckoo hash.  Entries are grouped into cache-line
+** sized buckets of CI_NETIF_FILTER_BUCKET_WAYS, and each bucket holds one
+** tag byte per way (zero when the way is free) so that a lookup can discard
+** non-matching ways with a single word compare before touching any socket
+** state.  Every key has two candidate buckets: the primary, selected by
+** onload_hash1(), and an alternate derived from the primary and the tag.
+** Because the alternate does not need the key, an insert into two full
+** buckets can make room by moving existing entries to their other bucket.
+**
+** Only if that fails (the table is nearly full, or there are more than
+** 2*WAYS entries with the same key) does an entry overflow: it is placed
+** by probing on from its alternate bucket in steps of onload_hash2(), and
+** [route_count] is incremented in each bucket it passes over.  Such
+** entries are flagged in [overflow] so that they are never moved.
+**
+** A filter id is (bucket << CI_NETIF_FILTER_BUCKET_SHIFT) | way, and
+** [table_size_mask] is the number of entries (not buckets) minus one.
 */
+#define CI_NETIF_FILTER_BUCKET_SHIFT  2
+#define CI_NETIF_FILTER_BUCKET_WAYS   (1u << CI_NETIF_FILTER_BUCKET_SHIFT)
+
+typedef struct {
+  ci_uint32 tags;         /* one byte per way, zero if the way is free */
+  ci_uint32 overflow;     /* 0x80 in the byte of each overflowed way */
+  ci_int32  route_count;  /* how many entries overflowed past this bucket? */
+} ci_netif_filter_bucket_hdr;
+
+
 typedef struct {
   ci_int32  id;
-  ci_int32  route_count;  /* how many lookups pass through this entry? */
   ci_uint32 laddr;
 } ci_netif_filter_table_entry;
 
 
 typedef struct {
-  CI_ULCONST unsigned         table_size_mask;
-  ci_netif_filter_table_entry table[1];
+  ci_netif_filter_bucket_hdr  hdr CI_ALIGN(CI_CACHE_LINE_SIZE);
+  ci_netif_filter_table_entry entry[CI_NETIF_FILTER_BUCKET_WAYS];
+} ci_netif_filter_table_bucket;
+
+
+typedef struct {
+  CI_ULCONST unsigned          table_size_mask;
+  ci_netif_filter_table_bucket bucket[1];
 } ci_netif_filter_table;
 
 
+/* Entry for filter id [id] in an IPv4 or IPv6 filter table. */
+#define CI_NETIF_FILTER_ENTRY(tbl, id)                                  \
+  (&(tbl)->bucket[(unsigned) (id) >> CI_NETIF_FILTER_BUCKET_SHIFT].     \
+    entry[(unsigned) (id) & (CI_NETIF_FILTER_BUCKET_WAYS - 1)])
+
+
 typedef struct {
   ci_uint32 laddr;
   ci_uint32 raddr;
@@ -554,16 +611,241 @@ typedef struct {
 #if CI_CFG_IPV6
 typedef struct {
   ci_int32  id;
-  ci_int32  route_count;
   ci_ip6_addr_t laddr;
 } ci_ip6_netif_filter_table_entry;
 
+typedef struct {
+  ci_netif_filter_bucket_hdr      hdr CI_ALIGN(CI_CACHE_LINE_SIZE);
+  ci_ip6_netif_filter_table_entry entry[CI_NETIF_FILTER_BUCKET_WAYS];
+} ci_ip6_netif_filter_table_bucket;
+
 typedef struct {
   CI_ULCONST unsigned table_size_mask;
-  ci_ip6_netif_filter_table_entry table[1];
+  ci_ip6_netif_filter_table_bucket bucket[1];
 } ci_ip6_netif_filter_table;
 #endif
 
+
+#if CI_CFG_UDP
+/*!
+** UDP TX staging rings (EF_UDP_TX_STAGE_RING).
+**
+** A thread that has filled a datagram but cannot get the stack lock
+** pushes it onto one of these rings, chosen per-thread so that producers
+** rarely share a ring, instead of queuing it on the socket's [tx_async_q]
+** (which needs a CAS on the lock word for every send).  The lock holder
+** drains the rings from ci_netif_unlock_slow_common(), prompted by
+** CI_EPLOCK_NETIF_UDP_TX_STAGED, which is set at most once per drain.
+**
+** Producers claim a slot by advancing [prod] and publish it by writing
+** [pkt_id]; the consumer stops at the first unpublished slot.
+*/
+typedef struct {
+  volatile ci_int32 pkt_id;     /* OO_PP_ID_NULL when free */
+  ci_int32          sock_id;
+} ci_udp_tx_stage_entry;
+
+typedef struct {
+  volatile ci_uint32 prod CI_ALIGN(CI_CACHE_LINE_SIZE);
+  volatile ci_uint32 cons CI_ALIGN(CI_CACHE_LINE_SIZE);
+} ci_udp_tx_stage_ring;
+
+typedef struct {
+  /* One bit per ring that may have entries to send. */
+  volatile ci_uint32   pending CI_ALIGN(CI_CACHE_LINE_SIZE);
+  ci_udp_tx_stage_ring ring[CI_CFG_UDP_TX_STAGE_RINGS];
+  /* Followed by [udp_tx_stage_mask + 1] entries for each ring. */
+} ci_udp_tx_stage;
+#endif
+
+
+#if CI_CFG_LAT_HIST
+/*!
+** Latency histograms (EF_LATENCY_HIST).
+**
+** Values are in nanoseconds.  Values below 2^CI_CFG_LAT_HIST_SUB_BITS each
+** have their own bucket; above that each power of two is split into
+** 2^CI_CFG_LAT_HIST_SUB_BITS equal sub-buckets, so the relative error of a
+** percentile read from the histogram is bounded regardless of magnitude.
+** See ci_lat_hist_bucket() and ci_lat_hist_bucket_lo().
+**
+** Histograms are updated without atomics, from the stack lock holder and
+** from threads receiving on a socket, so concurrent updates may
+** occasionally be lost.
+*/
+#define CI_LAT_HIST_BUCKETS \
+  ((32 - CI_CFG_LAT_HIST_SUB_BITS + 1) << CI_CFG_LAT_HIST_SUB_BITS)
+#define CI_LAT_HIST_FRC_SHIFT  20
+
+typedef struct {
+  ci_uint32             n;
+  ci_uint32             max_ns;
+  ci_uint64             sum_ns  CI_ALIGN(8);
+  ci_uint32             bucket[CI_LAT_HIST_BUCKETS];
+} ci_lat_hist;
+
+#define CI_LAT_HIST_RX_APP       0  /* RX event to delivery to the app */
+#define CI_LAT_HIST_TX_DOORBELL  1  /* app send to doorbell */
+#define CI_LAT_HIST_TX_COMPLETE  2  /* doorbell to TX completion */
+#define CI_LAT_HIST_N            3
+
+typedef struct {
+  ci_lat_hist           h[CI_LAT_HIST_N];
+} ci_lat_hists;
+#endif
+
+
+#if CI_CFG_TCPDUMP_RING
+/*!
+** Packet capture ring (EF_TCPDUMP_RING_SIZE).
+**
+** The stack appends an oo_capture_rec followed by the captured bytes of the
+** frame for each packet it dumps.  Records start on an
+** OO_CAPTURE_REC_ALIGN boundary and never wrap: when a record does not fit
+** before the end of the ring the stack writes an OO_CAPTURE_REC_F_PAD record
+** and starts again at offset 0.  A packet that finds too little free space
+** is counted in [n_dropped] and not captured; the stack never waits for the
+** reader.
+**
+** The reader (onload_tcpdump) owns [read_pos], [snaplen] and the filter.
+** The filter is a classic BPF program as produced by pcap_compile(), run
+** over the frame including its Ethernet header; a packet is captured if
+** the program returns non-zero, and the return value limits the captured
+** length.  [bpf_len] of 0 captures everything.  The program is checked as
+** it runs, so a corrupt one cannot harm the stack.
+*/
+struct oo_bpf_insn {
+  ci_uint16             code;
+  ci_uint8              jt;
+  ci_uint8              jf;
+  ci_uint32             k;
+};
+
+struct oo_capture_rec {
+  ci_uint32             rec_len;  /* offset of the next record */
+  ci_uint32             len;      /* length of the frame */
+  ci_uint32             caplen;   /* bytes of the frame that follow */
+#define OO_CAPTURE_REC_F_PAD    0x1  /* skip to the start of the ring */
+#define OO_CAPTURE_REC_F_TX     0x2
+#define OO_CAPTURE_REC_F_HW_TS  0x4  /* [hw_ts_ns] is valid */
+  ci_uint8              flags;
+  ci_uint8              intf_i;
+  ci_uint16             vlan;     /* pkt->vlan */
+  ci_uint64             frc;      /* pkt->tstamp_frc */
+  ci_uint64             hw_ts_ns; /* NIC timestamp, ns since the epoch */
+};
+#define OO_CAPTURE_REC_ALIGN   sizeof(struct oo_capture_rec)
+
+struct oo_capture_ring {
+  CI_ULCONST ci_uint32  size;     /* bytes of record space, 2^x */
+  ci_uint32             snaplen;
+  ci_uint32             bpf_len;
+  struct oo_bpf_insn    bpf[CI_CFG_TCPDUMP_BPF_MAX_INSNS];
+
+  volatile ci_uint64    read_pos  CI_ALIGN(CI_CACHE_LINE_SIZE);
+
+  volatile ci_uint64    write_pos CI_ALIGN(CI_CACHE_LINE_SIZE);
+  ci_uint64             n_captured;
+  ci_uint64             n_filtered;
+  ci_uint64             n_dropped;
+  /* Followed by [size] bytes of records at OO_CAPTURE_RING_DATA(). */
+};
+#define OO_CAPTURE_RING_HDR_LEN \
+  CI_ROUND_UP(sizeof(struct oo_capture_ring), CI_CACHE_LINE_SIZE)
+#define OO_CAPTURE_RING_DATA(r)  ((char*) (r) + OO_CAPTURE_RING_HDR_LEN)
+#endif
+
+
+#if CI_CFG_STATS_RING
+/*!
+** Statistics ring (EF_STATS_RING_SIZE).
+**
+** Every EF_STATS_RING_INTERVAL ms the stack appends an oo_stats_rec to the
+** ring.  A record is followed by [n_fields] entries, each two LEB128
+** varints: the field index, less one more than the previous entry's index,
+** and the zigzag-encoded change in the field since the previous record.  A
+** key record (OO_STATS_REC_F_KEY) has an entry for every field, giving its
+** value.  Fields are those of ci_netif_stats in stats_def.h order;
+** [schema_hash] identifies the list so that readers built against a
+** different one can refuse to decode it.
+**
+** The ring is overwritten as it wraps, so readers do not need to be
+** registered and never slow the stack.  The stack advances [reserve_pos]
+** before writing a record and [write_pos] once it is complete; a reader
+** that finds [reserve_pos] more than [size] beyond a record it has read was
+** overtaken, and resynchronises from [last_key_pos].
+*/
+#define OO_STATS_RING_MAGIC    0x4f535452  /* "OSTR" */
+#define OO_STATS_RING_VERSION  1
+
+struct oo_stats_rec {
+  ci_uint32             rec_len;  /* offset of the next record */
+#define OO_STATS_REC_F_PAD  0x1   /* skip to the start of the ring */
+#define OO_STATS_REC_F_KEY  0x2   /* values of all fields, not changes */
+  ci_uint16             flags;
+  ci_uint16             n_fields;
+  ci_uint32             data_len; /* bytes of entries that follow */
+  ci_uint32             reserved;
+  ci_uint64             seq;
+  ci_uint64             frc;
+};
+#define OO_STATS_REC_ALIGN  8
+
+/* Entries are at most two varints: 3 bytes of index and 10 of value. */
+#define OO_STATS_REC_MAX_LEN(n_fields)                               \
+  CI_ROUND_UP(sizeof(struct oo_stats_rec) + (n_fields) * 13,        \
+              OO_STATS_REC_ALIGN)
+
+struct oo_stats_ring {
+  CI_ULCONST ci_uint32  magic;
+  CI_ULCONST ci_uint32  version;
+  CI_ULCONST ci_uint32  schema_hash;
+  CI_ULCONST ci_uint32  n_fields;
+  CI_ULCONST ci_uint32  size;         /* bytes of record space, 2^x */
+  CI_ULCONST ci_uint32  interval_ms;
+  CI_ULCONST ci_uint32  khz;          /* frc ticks per ms */
+  ci_uint32             key_countdown;
+  ci_uint64             seq;
+  /* Values the last record was encoded against. */
+  ci_netif_stats        prev CI_ALIGN(8);
+
+  volatile ci_uint64    reserve_pos CI_ALIGN(CI_CACHE_LINE_SIZE);
+  volatile ci_uint64    write_pos;
+  volatile ci_uint64    last_key_pos;
+  /* Followed by [size] bytes of records at OO_STATS_RING_DATA(). */
+};
+#define OO_STATS_RING_HDR_LEN \
+  CI_ROUND_UP(sizeof(struct oo_stats_ring), CI_CACHE_LINE_SIZE)
+#define OO_STATS_RING_DATA(r)  ((char*) (r) + OO_STATS_RING_HDR_LEN)
+#endif
+
+#if CI_CFG_SPIN_ADAPT
+/* Adaptive spinning state for one socket, or one epoll ready list.
+**
+** [hist] counts recent blocking waits by duration: bucket 0 holds waits
+** shorter than 2^CI_CFG_SPIN_ADAPT_MIN_LOG2 cycles, bucket i waits of
+** [2^(MIN_LOG2+i-1), 2^(MIN_LOG2+i)) cycles, and the last bucket anything
+** longer.  Only waits that spun for the whole of EF_SPIN_USEC are counted,
+** which is one in every OO_SPIN_ADAPT_PROBE while the budget is shorter.
+** Counts are halved every OO_SPIN_ADAPT_DECAY samples so that the
+** histogram follows changes in the traffic.
+*/
+struct oo_spin_adapt {
+  ci_uint64 budget;         /* cycles to spin for; ~0 while learning */
+  ci_uint64 cycles_saved;   /* spinning avoided, relative to EF_SPIN_USEC */
+  ci_uint32 n_hit;          /* waits that ended while spinning */
+  ci_uint32 n_miss;         /* waits that spun and then slept */
+  ci_uint32 n_skip;         /* waits that slept without spinning */
+  ci_uint32 n_late;         /* slept, but EF_SPIN_USEC would have caught it */
+  ci_uint16 n_samples;
+  ci_uint16 n_waits;
+  ci_uint16 hist[CI_CFG_SPIN_ADAPT_BUCKETS];
+};
+#define OO_SPIN_ADAPT_DECAY   64
+#define OO_SPIN_ADAPT_UPDATE  16
+#define OO_SPIN_ADAPT_PROBE   16
+#endif
+
 /*!
 ** ci_netif_config
 **
@@ -704,6 +986,11 @@ typedef struct {
 
   /* bitmask of non-empty buckets in the lowest weel */
   ci_uint64 busy_mask[4] CI_ALIGN(8);
+
+  /* next rotation of wheels 0..2 (EF_TIMER_MODE=1 only) */
+  ci_ni_dllist_t  wnext[CI_IPTIME_WNEXTSIZE];
+  /* EF_TIMER_COALESCE_MS in ticks, rounded to a power of 2, minus 1 */
+  ci_uint32   coalesce_mask;
 } ci_ip_timer_state;
 
 
@@ -730,6 +1017,7 @@ typedef struct {
 # define CI_IP_TIMER_DEBUG_HOOK         0x9  /* Hook for timer debugging */
 # define CI_IP_TIMER_NETIF_STATS        0xa  /* netif statistics timer   */
 # define CI_IP_TIMER_TCP_CORK           0xb  /* TCP_CORK timer           */
+# define CI_IP_TIMER_NETIF_STATS_RING   0xc  /* netif statistics ring    */
 } ci_ip_timer;
 
 
@@ -759,6 +1047,7 @@ typedef struct {
 #if defined(CI_CFG_PKTS_AS_HUGE_PAGES)
   CI_ULCONST ci_int32   shm_id; /**< shared memory id for huge page  */
 #endif
+  CI_ULCONST ci_int32   numa_node; /**< node the buffers are on, or -1 */
 } oo_pktbuf_set;
 
 typedef struct {
@@ -880,8 +1169,10 @@ typedef struct {
 # define CI_EPLOCK_NETIF_KERNEL_PACKETS    0x0020000000000000ULL
   /* need to finish clearing ready lists */
 # define CI_EPLOCK_NETIF_FREE_READY_LIST   0x0008000000000000ULL
+  /* UDP TX staging rings have datagrams to send */
+# define CI_EPLOCK_NETIF_UDP_TX_STAGED     0x0040000000000000ULL
   /* mask for the above flags that must be handled before dropping lock */
-# define CI_EPLOCK_NETIF_UNLOCK_FLAGS      0xff38000000000000ULL
+# define CI_EPLOCK_NETIF_UNLOCK_FLAGS      0xff78000000000000ULL
 } ci_eplock_t;
 
 
@@ -1009,6 +1300,7 @@ struct ci_netif_state_s {
 # define CI_NETIF_ERROR_ASSERT              0x08
 /* 0x10 was CI_NETIF_ERROR_REMAP, which is now per-interface. */
 # define CI_NETIF_ERROR_SYNRECV_TABLE       0x20
+# define CI_NETIF_ERROR_EPOLL_CHAIN         0x40
 
   /* The bits of this field are used for eventq-primed flags. */
 
@@ -1098,6 +1390,15 @@ struct ci_netif_state_s {
   */
   ci_uint64             nonb_pkt_pool CI_ALIGN(8);
 
+  /* Per-thread caches of [nonb_pkt_pool], each on its own cache line and
+  ** in the same format.  Threads free to and allocate from their own
+  ** magazine first, so that they don't contend for [nonb_pkt_pool].  See
+  ** ci_netif_pkt_alloc_nonb().
+  */
+  struct {
+    ci_uint64           link CI_ALIGN(CI_CACHE_LINE_SIZE);
+  } nonb_magazine[CI_CFG_PKT_NONB_MAGAZINES];
+
   ci_netif_ipid_cb_t    ipid;
 
   /* Offset to the DMAQ descriptors Falcon only. */
@@ -1109,6 +1410,7 @@ struct ci_netif_state_s {
   CI_ULCONST ci_uint32  ip6_table_ofs;   /**< offset of IPv6 s/w filter table */
 #endif
   CI_ULCONST ci_uint32  seq_table_ofs;   /**< offset of seq no table */
+  CI_ULCONST ci_uint32  synrecv_table_ofs; /**< offset of SYN-RECV table */
   CI_ULCONST ci_uint32  buf_ofs;         /**< offset of packet metadata */
 
   ci_ip_timer_state     iptimer_state CI_ALIGN(8);
@@ -1135,6 +1437,12 @@ struct ci_netif_state_s {
   oo_sp                 free_eps_head;   /**< Endpoints free list */
   ci_int32              deferred_free_eps_head; /**< Endpoints that could be 
                                                    freed (atomic) */
+  oo_sp                 accept_prealloc_head; /**< Free endpoints reserved
+                                                 for promoted connections */
+  ci_uint32             n_accept_prealloc; /**< Length of above list */
+  ci_uint32             n_listeners;     /**< Sockets made to listen by
+                                            ci_tcp_listen(), which keep
+                                            the above reserve */
 
   /* Max number of ep bufs is CI_CFG_NETIF_MAX_ENDPOINTS_MAX */
   ci_uint32  max_ep_bufs;                /**< Upper limit of end points */
@@ -1154,9 +1462,8 @@ struct ci_netif_state_s {
   CI_ULCONST ci_uint32  ep_ofs;          /**< Offset to endpoints array */
   
 #define CI_TCP_AUX_TYPE_SYNRECV 0
-#define CI_TCP_AUX_TYPE_BUCKET  1
-#define CI_TCP_AUX_TYPE_EPOLL   2
-#define CI_TCP_AUX_TYPE_NUM     3
+#define CI_TCP_AUX_TYPE_EPOLL   1
+#define CI_TCP_AUX_TYPE_NUM     2
   oo_p                  free_aux_mem;    /**< Free list of synrecv bufs. */
   ci_uint32             n_free_aux_bufs; /**< Number of free aux bufs */
   ci_uint32             n_aux_bufs[CI_TCP_AUX_TYPE_NUM];
@@ -1250,6 +1557,7 @@ struct ci_netif_state_s {
 
   CI_ULCONST ci_int32   creation_numa_node;
   CI_ULCONST ci_int32   load_numa_node;
+  CI_ULCONST ci_int32   nic_numa_node;
   CI_ULCONST ci_uint32  packet_alloc_numa_nodes;
   CI_ULCONST ci_uint32  sock_alloc_numa_nodes;
   CI_ULCONST ci_uint32  interrupt_numa_nodes;
@@ -1273,6 +1581,43 @@ struct ci_netif_state_s {
   /* Number of entries in the table of previously-used sequence numbers. */
   CI_ULCONST ci_uint32  seq_table_entries_n;
 
+#if CI_CFG_UDP
+  /* UDP TX staging rings, or 0 if EF_UDP_TX_STAGE_RING=0. */
+  CI_ULCONST ci_uint32  udp_tx_stage_ofs;
+  CI_ULCONST ci_uint32  udp_tx_stage_mask;
+#endif
+
+#if CI_CFG_LAT_HIST
+  /* Per-socket latency histograms, indexed by socket id, for the first
+   * [lat_hist_n_socks] sockets (EF_LATENCY_HIST_SOCKETS).
+   */
+  CI_ULCONST ci_uint32  lat_hist_ofs;
+  CI_ULCONST ci_uint32  lat_hist_n_socks;
+  /* Multiplier converting frc ticks to ns, in 2^CI_LAT_HIST_FRC_SHIFT
+   * fixed point.
+   */
+  CI_ULCONST ci_uint32  lat_hist_ns_mult;
+  ci_lat_hists          lat_hist  CI_ALIGN(8);
+#endif
+
+#if CI_CFG_TCPDUMP_RING
+  /* Packet capture ring, or 0 if EF_TCPDUMP_RING_SIZE=0. */
+  CI_ULCONST ci_uint32  capture_ring_ofs;
+#endif
+
+#if CI_CFG_STATS_RING
+  /* Statistics ring, or 0 if EF_STATS_RING_SIZE=0. */
+  CI_ULCONST ci_uint32  stats_ring_ofs;
+  ci_ip_timer           stats_ring_tid CI_ALIGN(8);
+#endif
+
+#if CI_CFG_SPIN_ADAPT
+  /* Array of oo_spin_adapt, or 0 if EF_SPIN_ADAPT=0.  Entries are indexed
+   * by socket id, followed by one per ready list.
+   */
+  CI_ULCONST ci_uint32  spin_adapt_ofs;
+#endif
+
   CI_ULCONST ci_uint16  rss_instance;
   CI_ULCONST ci_uint16  cluster_size;
 
@@ -1519,12 +1864,11 @@ typedef struct {
   /* Epoll3 support:
    * - ready_lists_in_use should be updated under the stack lock only,
    *   and together with the corresponding ready_link only.
-   * - epoll is the pointer to aux buffer of CI_TCP_AUX_TYPE_EPOLL,
-   *   containing ci_sb_epoll_state.  The pointer must be set under the
-   *   stack lock.
-   * In theory, we can use a linked list of CI_TCP_AUX_TYPE_EPOLL states
-   * to support large value of CI_CFG_N_READY_LISTS, but it is not
-   * implemented yet.
+   * - epoll is the pointer to the first aux buffer of
+   *   CI_TCP_AUX_TYPE_EPOLL, containing ci_sb_epoll_state.  Further
+   *   buffers are chained from it when the socket is in a ready list
+   *   beyond the first CI_EPOLL_SETS_PER_AUX_BUF.  The pointers must be set
+   *   under the stack lock.
    */
   ci_uint32             ready_lists_in_use;
   oo_p                  epoll;
@@ -1908,6 +2252,7 @@ typedef struct {
   ci_uint32 n_tx_lock_snd;    /* locked to send                        */
   ci_uint32 n_tx_lock_cp;     /* locked to update control plane        */
   ci_uint32 n_tx_lock_defer;  /* deferred to lock holder               */
+  ci_uint32 n_tx_lock_staged; /* sent from a TX staging ring           */
   ci_uint32 n_tx_eagain;      /* send queue was full, returned EAGAIN  */
   ci_uint32 n_tx_spin;        /* send queue was full, did spin         */
   ci_uint32 n_tx_block;       /* send queue was full, did block        */
@@ -1916,6 +2261,9 @@ typedef struct {
   ci_uint32 n_tx_msg_confirm; /* onload send with MSG_CONFIRM          */
   ci_uint32 n_tx_os_late;     /* sent via OS, after copying            */
   ci_uint32 n_tx_unconnect_late; /* concurrent send and unconnect      */
+  ci_uint32 n_tx_tmpl_fast;   /* templated sends via PIO               */
+  ci_uint32 n_tx_tmpl_slow;   /* templated sends via normal send path  */
+  ci_uint32 n_tx_tmpl_active; /* templates currently allocated         */
 } ci_udp_socket_stats;
 
 
@@ -1979,6 +2327,9 @@ struct  ci_udp_state_s {
    */
   ci_uint32 tx_count;
 
+  /* List of allocated templated sends on this socket */
+  oo_pkt_p  tmpl_head;
+
   /* Cache for IP_PKTINFO  */
   struct {
     /* PKT info: */
@@ -2047,6 +2398,14 @@ struct oo_pipe {
   /* Maximum size of the pipe. It is not always enforced */
   ci_uint32 bufs_max;
 
+  /* Layout of newly-written buffers: payload is placed between these
+   * offsets from dma_start.  Normally the whole buffer, but once the pipe
+   * has been spliced to a TCP socket the payload is put where the socket
+   * would place one segment, so the buffers can be sent without copying.
+   */
+  ci_uint32 buf_base;
+  ci_uint32 buf_end;
+
 #define OO_PIPE_BUF_DEFAULT_BASE   CI_MEMBER_OFFSET(ci_ip_pkt_fmt, dma_start)
 #define OO_PIPE_BUF_MAX_SIZE       (CI_CFG_PKT_BUF_SIZE - \
                                     OO_PIPE_BUF_DEFAULT_BASE)
@@ -2126,8 +2485,9 @@ typedef struct {
 
   oo_sp                local_peer;/* id of the peer for lo connection    */
 
+  oo_sp                tls_id;    /* listening socket                    */
   ci_uint32            hash;        /* hash value for lookup table       */
-  oo_p                 bucket_link; /* link used in hash buckets         */
+  oo_p                 bucket_link; /* link in bucket's overflow chain   */
 
 #if CI_CFG_TCP_METRICS
   oo_metrics_tstamp    tstamp;
@@ -2151,19 +2511,60 @@ typedef struct oo_sb_epoll_s {
   ci_ni_dllist_link     ready_link;
   ci_user_ptr_t         eitem;
 } oo_sb_epoll;
+/* One aux buffer holds the state for CI_EPOLL_SETS_PER_AUX_BUF ready
+ * lists.  When there are more ready lists than that, the buffers are
+ * chained via [next]: the n-th buffer in the chain covers ready lists
+ * n*CI_EPOLL_SETS_PER_AUX_BUF and up.  Buffers are appended on demand under
+ * the stack lock, and are only freed together with the socket, so the chain
+ * may be walked without the lock.
+ */
 typedef struct ci_sb_epoll_state_s {
 #define CI_EPOLL_SETS_PER_AUX_BUF 4
   oo_sb_epoll e[CI_EPOLL_SETS_PER_AUX_BUF];
   oo_sp       sock_id;
+  oo_p        next;
 } ci_sb_epoll_state;
-CI_BUILD_ASSERT(CI_CFG_N_READY_LISTS <= CI_EPOLL_SETS_PER_AUX_BUF);
+#define CI_EPOLL_AUX_BUFS_PER_SOCK \
+  ((CI_CFG_N_READY_LISTS + CI_EPOLL_SETS_PER_AUX_BUF - 1) / \
+   CI_EPOLL_SETS_PER_AUX_BUF)
+/* ready_lists_in_use bitmasks are 32 bits wide. */
+CI_BUILD_ASSERT(CI_CFG_N_READY_LISTS <= 32);
+
+/*
+** SYN-RECV table.
+**
+** The synrecv states of all the listening sockets in a stack are found
+** through one table of cache-line sized buckets.  Each bucket has
+** CI_TCP_SYNRECV_BUCKET_WAYS ways, with a tag byte per way (zero when the
+** way is free) so that a lookup discards non-matching ways with a few word
+** compares before touching any synrecv state.  Entries that find their
+** bucket full are chained from [overflow] through
+** ci_tcp_state_synrecv::bucket_link.
+**
+** The table has room for [max_buckets] buckets, enough for
+** EF_TCP_SYNRECV_MAX entries at half load, but only [mask] + 1 + [split]
+** are in use.  It grows by linear hashing: whenever the load passes half,
+** bucket [split] is divided between itself and bucket [split] + [mask] + 1.
+** So there is never a rehash of the whole table.  The table does not
+** shrink.
+*/
+#define CI_TCP_SYNRECV_BUCKET_WAYS  12
+#define CI_TCP_SYNRECV_TAG_WORDS    (CI_TCP_SYNRECV_BUCKET_WAYS / 4)
 
-/* Hash table for synrecv embrionic connections. */
-#define CI_TCP_LISTEN_BUCKET_S    4
-#define CI_TCP_LISTEN_BUCKET_SIZE (1 << CI_TCP_LISTEN_BUCKET_S)
 typedef struct {
-  oo_p bucket[CI_TCP_LISTEN_BUCKET_SIZE];
-} ci_tcp_listen_bucket;
+  ci_uint32 tags[CI_TCP_SYNRECV_TAG_WORDS] CI_ALIGN(CI_CACHE_LINE_SIZE);
+                        /* one byte per way, zero if the way is free */
+  oo_p      overflow;   /* entries that did not fit, via bucket_link */
+  oo_p      entry[CI_TCP_SYNRECV_BUCKET_WAYS];
+} ci_tcp_synrecv_bucket;
+
+typedef struct {
+  CI_ULCONST ci_uint32  max_buckets;    /* a power of two */
+  ci_uint32             mask;           /* buckets before this round - 1 */
+  ci_uint32             split;          /* next bucket to split */
+  ci_uint32             n_entries;
+  ci_tcp_synrecv_bucket bucket[1];
+} ci_tcp_synrecv_table;
 
 /* This chunk of memory should be exactly cacheline in size. */
 #define CI_AUX_MEM_SIZE 128
@@ -2174,7 +2575,6 @@ typedef struct {
 
   union {
     ci_tcp_state_synrecv synrecv;
-    ci_tcp_listen_bucket bucket;
     ci_sb_epoll_state    epoll;
   } u;
 
@@ -2197,6 +2597,7 @@ typedef struct {
   ci_uint16            user_mss;            /* user-provided maximum MSS */
   ci_uint8             tcp_defer_accept;    /* TCP_DEFER_ACCEPT sockopt  */
 #define OO_TCP_DEFER_ACCEPT_OFF 0xff
+  ci_uint8             cc_algo;             /* TCP_CONGESTION: CI_TCP_CC_* */
 
 } ci_tcp_socket_cmn;
 
@@ -2328,6 +2729,14 @@ struct ci_tcp_state_s {
    * because packet allocation failed.  Must send FIN, really. */
 #define CI_TCPT_FLAG_FIN_PENDING        0x800000
 
+  /* ECN (RFC3168) receiver state: CE-marked data has been received and
+   * ECE must be echoed on every outgoing segment (until CWR is seen, or
+   * for DCTCP, until the CE state changes). */
+#define CI_TCPT_FLAG_ECN_ECE            0x1000000
+  /* ECN sender state: the congestion window has been reduced in response
+   * to ECE; set CWR on the next new data segment. */
+#define CI_TCPT_FLAG_ECN_CWR            0x2000000
+
   /* flags advertised on SYN */
 # define CI_TCPT_SYN_FLAGS \
         (CI_TCPT_FLAG_WSCL | CI_TCPT_FLAG_TSO | CI_TCPT_FLAG_SACK)
@@ -2409,6 +2818,9 @@ struct ci_tcp_state_s {
                                                    outgoing packet        */
   ci_uint32            rcv_added;   /* amount added to rx queue           */
   ci_uint32            rcv_delivered; /* amount removed from rx queue     */
+  ci_uint32            rcv_lent;    /* amount lent to the app by
+                                       onload_zc_recv_lend(), not yet
+                                       released; charged to rcvbuf      */
   ci_uint32            ack_trigger; /* rcv_delivered value which triggers
                                        next receive window update         */
 #if CI_CFG_BURST_CONTROL
@@ -2443,7 +2855,27 @@ struct ci_tcp_state_s {
   ci_uint32            cwnd_extra;  /* adjustments when congested         */
   ci_uint32            ssthresh;    /* slow-start threshold               */
   ci_uint32            bytes_acked; /* bytes acked but not yet added to cwnd */
-  
+
+  /* Per-algorithm congestion control state; see ci_tcp_cc_ops. */
+  union {
+    struct {
+      ci_uint32        w_max;       /* cwnd before last reduction         */
+      ci_uint32        w_last_max;  /* w_max before that (fast converge)  */
+      ci_uint32        k;           /* time to reach w_max (ms)           */
+      ci_uint32        origin;      /* cwnd at which the cubic is centred */
+      ci_iptime_t      epoch;       /* start of current CA epoch (0=none) */
+      ci_uint32        w_epoch;     /* cwnd at start of epoch             */
+      ci_iptime_t      delay_min;   /* minimum RTT sample (ticks)         */
+    } cubic;
+    struct {
+      ci_uint32        alpha;       /* fraction marked, scaled by 1024    */
+      ci_uint32        window_end;  /* end of current observation window  */
+      ci_uint32        acked;       /* bytes acked in this window         */
+      ci_uint32        acked_ce;    /* ... of which with ECE set          */
+      ci_uint32        cwr_seq;     /* no further reduction until acked   */
+    } dctcp;
+  } cc;
+
 #if CI_CFG_TCP_FASTSTART  
   ci_uint32            faststart_acks; /* Bytes to ack before leaving faststart */
 #endif
@@ -2627,9 +3059,6 @@ struct ci_tcp_socket_listen_s {
   ci_ni_dllist_t       listenq[CI_CFG_TCP_SYNACK_RETRANS_MAX + 1];
   /* index is the number of retransmit. */
 
-  oo_p                 bucket;      /* Hash table for listenq lookup */
-  ci_uint32            n_buckets;   /* Number of "buckets" allocated */
-
 #if CI_CFG_FD_CACHING
   ci_socket_cache_t    epcache;
   /* We remember which EPs were accepted from this listening socket.  This is
@@ -157,6 +157,22 @@ struct ci_netif_s {
 #endif
   ci_ni_dllist_t*      active_wild_table;
   ci_tcp_prev_seq_t*   seq_table;
+  ci_tcp_synrecv_table* synrecv_table;
+#if CI_CFG_UDP
+  ci_udp_tx_stage*     udp_tx_stage;
+#endif
+#if CI_CFG_LAT_HIST
+  ci_lat_hists*        lat_hist_socks;
+#endif
+#if CI_CFG_TCPDUMP_RING
+  struct oo_capture_ring* capture_ring;
+#endif
+#if CI_CFG_STATS_RING
+  struct oo_stats_ring* stats_ring;
+#endif
+#if CI_CFG_SPIN_ADAPT
+  struct oo_spin_adapt* spin_adapt;
+#endif
 
 
 #ifdef __ci_driver__
@@ -164,6 +180,22 @@ struct ci_netif_s {
   unsigned             pkt_sets_n;
   unsigned             pkt_sets_max;
   ci_uint32            ep_ofs;           /**< Copy from ci_netif_state_s */
+  unsigned             synrecv_table_buckets; /**< Trusted table size */
+#if CI_CFG_UDP
+  unsigned             udp_tx_stage_mask; /**< Trusted copy of state's */
+#endif
+#if CI_CFG_LAT_HIST
+  unsigned             lat_hist_n_socks;  /**< Trusted copy of state's */
+#endif
+#if CI_CFG_TCPDUMP_RING
+  ci_uint32            capture_ring_size; /**< Trusted copy of ring's */
+#endif
+#if CI_CFG_STATS_RING
+  /* Trusted copies of the stats ring's. */
+  ci_uint32            stats_ring_size;
+  ci_uint32            stats_ring_interval_ms;
+  ci_uint64            stats_ring_write_pos;
+#endif
 
   /*! Trusted per-socket state. */
   struct tcp_helper_endpoint_s**  ep_tbl;
@@ -42,6 +42,17 @@
         (&(IPTIMER_STATE((netif))->warray[(wheelno)*CI_IPTIME_BUCKETS + \
                                           IPTIMER_BUCKETNO((wheelno), (abs))]))
 
+/* get the bucket for a given wheelno and abs in the next rotation of the
+ * wheel (EF_TIMER_MODE=1 only) */
+#define IPTIMER_NEXT_BUCKET(netif, wheelno, abs)                \
+        (&(IPTIMER_STATE((netif))->wnext[(wheelno)*CI_IPTIME_BUCKETS + \
+                                          IPTIMER_BUCKETNO((wheelno), (abs))]))
+
+/* number of the rotation of wheel wheelno (< CI_IPTIME_WHEELS-1) that
+ * contains abs */
+#define IPTIMER_ROTATION(wheelno, abs)                          \
+        ((abs) >> (((wheelno)+1)*CI_IPTIME_BUCKETBITS))
+
 #define IPTIMER_WHEEL2_MASK (CI_IPTIME_BUCKETMASK << (CI_IPTIME_BUCKETBITS*3))
 #define IPTIMER_WHEEL1_MASK (IPTIMER_WHEEL2_MASK + \
                             (CI_IPTIME_BUCKETMASK << (CI_IPTIME_BUCKETBITS*2)))
@@ -99,6 +110,12 @@ extern void ci_ip_timer_state_init(ci_netif* netif, unsigned cpu_khz) CI_HF;
 */
 extern void ci_ip_timer_state_dump(ci_netif* ni) CI_HF;
 
+/*! Dump a summary of the timer engine and the distribution of pending
+**  timers by type and time to expiry
+**  \param netif  A pointer to the netif
+*/
+extern void ci_ip_timer_state_dump_summary(ci_netif* ni) CI_HF;
+
 CI_DEBUG(extern void ci_ip_timer_state_assert_valid(ci_netif*,
                                                     const char*, int) CI_HF;)
 
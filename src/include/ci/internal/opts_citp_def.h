@@ -213,6 +213,16 @@ CI_CFG_OPT("EF_FDTABLE_STRICT", fdtable_strict, ci_uint32,
  */
            1, , 0, 0, 1, yesno)
 
+CI_CFG_OPT("EF_FDTABLE_LOCKLESS", fdtable_lockless, ci_uint32,
+"When EF_FDS_MT_SAFE=0, look up file descriptors on the send and receive "
+"paths without atomic operations.  A thread publishes the descriptor it is "
+"using in a per-thread slot, and the release of a closed descriptor is "
+"deferred until no thread is using it.  This removes contention on the "
+"descriptor when many threads use it concurrently, at the cost of making "
+"close() more expensive.  It requires the membarrier() system call (Linux "
+"4.14 or later), and is disabled automatically if that is not available.",
+           1, , 1, 0, 1, yesno)
+
 CI_CFG_OPT("EF_LOG_TIMESTAMPS", log_timestamps, ci_uint32,
 "If enabled this will add a timestamp to every Onload output log entry. "
 "Timestamps are originated from the FRC counter.",
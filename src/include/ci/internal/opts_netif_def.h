@@ -289,6 +289,17 @@ CI_CFG_OPT("EF_UDP_SEND_UNLOCKED", udp_send_unlocked, ci_uint32,
 "concurrency when multiple threads are performing UDP sends.",
            1, , 1, 0, 1, yesno)
 # endif
+
+CI_CFG_OPT("EF_UDP_TX_STAGE_RING", udp_tx_stage_ring, ci_uint32,
+"Number of entries in each of the stack's per-thread UDP transmit staging "
+"rings.  When a thread sending a UDP datagram finds the stack lock held, it "
+"places the datagram on its staging ring without taking the lock, and the "
+"lock holder sends it before releasing the lock.  This reduces contention "
+"when many threads send small datagrams through the same stack.  The value "
+"is rounded up to a power of two.  0 disables the staging rings, in which "
+"case such datagrams are deferred to the lock holder via the socket.  Has "
+"no effect if EF_UDP_SEND_UNLOCKED=0.",
+           , , 0, 0, 4096, count)
 #endif
 
 CI_CFG_OPT("EF_UNCONFINE_SYN", unconfine_syn, ci_uint32,
@@ -363,6 +374,54 @@ CI_CFG_OPT("EF_TX_TIMESTAMPING", tx_timestamping, ci_uint32,
 " does not succeed;\n",
            2, , 0, 0, 3, count)
 
+#if CI_CFG_LAT_HIST
+CI_CFG_OPT("EF_LATENCY_HIST", latency_hist, ci_uint32,
+"Enables latency histograms for the stack.  When set, Onload records the "
+"time from a packet being received to its delivery to the application, the "
+"time from the application sending data to the packet being passed to the "
+"NIC, and the time from then until the NIC reports the send complete.  The "
+"histograms can be viewed with 'onload_stackdump latency_hist' and are "
+"exported by onload_remote_monitor.",
+           1, , 0, 0, 1, yesno)
+
+CI_CFG_OPT("EF_LATENCY_HIST_SOCKETS", latency_hist_sockets, ci_uint32,
+"When EF_LATENCY_HIST is enabled, also keep per-socket latency histograms "
+"for sockets with ids less than this value.  Each socket needs "
+"approximately 1.5KB of shared memory.",
+           , , 0, 0, 65536, count)
+#endif
+
+#if CI_CFG_TCPDUMP_RING
+CI_CFG_OPT("EF_TCPDUMP_RING_SIZE", tcpdump_ring_size, ci_uint32,
+"Size in bytes of the stack's packet capture ring.  When non-zero, "
+"onload_tcpdump receives packets through a shared ring of this size into "
+"which the stack copies each captured packet, rather than through a short "
+"queue of packet buffers, so that bursts are not lost.  onload_tcpdump can "
+"also install a filter that the stack applies before copying (see its "
+"--filter option).  Packets that find the ring full are dropped from the "
+"capture and counted.  The value is rounded up to a power of two of at "
+"least 256KB.  0 uses the packet buffer queue.",
+           , , 0, 0, 1073741824, count)
+#endif
+
+#if CI_CFG_STATS_RING
+CI_CFG_OPT("EF_STATS_RING_SIZE", stats_ring_size, ci_uint32,
+"Size in bytes of the stack's statistics ring.  When non-zero, the stack "
+"appends a binary snapshot of its statistics to a ring in shared memory "
+"every EF_STATS_RING_INTERVAL milliseconds.  Snapshots are delta-encoded, so "
+"only counters that have changed take space, with a complete snapshot at "
+"regular intervals.  onload_stats_collect reads the rings of many stacks "
+"cheaply enough to sample at this rate.  The value is rounded up to a power "
+"of two of at least 64KB.  0 disables the ring.",
+           , , 0, 0, 67108864, count)
+
+CI_CFG_OPT("EF_STATS_RING_INTERVAL", stats_ring_interval, ci_uint32,
+"Interval in milliseconds between snapshots written to the statistics ring "
+"(see EF_STATS_RING_SIZE).  Snapshots are taken by whichever thread is "
+"polling the stack, so an idle stack may take them less often.",
+           , , 10, 1, 60000, count)
+#endif
+
 CI_CFG_OPT("EF_TCP_TSOPT_MODE", tcp_tsopt_mode, ci_uint32,
 "Enable or disable per-stack TCP header timestamps (as defined in RFC 1323).  "
 "Overrides system setting ipv4.tcp_timestamps and EF_TCP_SYN_OPTS.  "
@@ -487,6 +546,16 @@ CI_CFG_OPT("EF_TCP_SYNCOOKIES", tcp_syncookies, ci_uint32,
 "Use TCP syncookies to protect from SYN flood attack",
            1, , 0, 0, 1, yesno)
 
+CI_CFG_OPT("EF_TCP_SEND_GSO_MAX", tcp_send_gso_max, ci_uint32,
+           "Sends larger than a few segments are segmented in software in "
+           "chunks of up to this many bytes: the packets for a whole chunk "
+           "are filled, given sequence numbers and headers together, and "
+           "handed to the NIC with a single doorbell.  Larger values reduce "
+           "the per-segment cost of bulk sends, at the expense of the time "
+           "before the first segment of a send reaches the wire.  Set to 0 "
+           "to fill packets in small batches as they are sent.",
+           , , 65536, 0, 1048576, count)
+
 CI_CFG_OPT("EF_TCP_SEND_NONBLOCK_NO_PACKETS_MODE", 
            tcp_nonblock_no_pkts_mode, ci_uint32,
            "This option controls how a non-blocking TCP send() call should "
@@ -632,6 +701,20 @@ CI_CFG_OPT("EF_TCP_CLIENT_LOOPBACK", tcp_client_loopback, ci_uint32,
            3, , CITP_TCP_LOOPBACK_OFF, 0, CITP_TCP_LOOPBACK_TO_NEWSTACK,
            oneof:no;samestack;toconn;tolist;nonew)
 
+CI_CFG_OPT("EF_TCP_LOOPBACK_DIRECT", tcp_loopback_direct, ci_uint32,
+"When set, data sent on an accelerated TCP loopback connection (see "
+"EF_TCP_SERVER_LOOPBACK and EF_TCP_CLIENT_LOOPBACK) is placed directly on "
+"the receive queue of the peer socket by the sender.  This skips the TCP "
+"receive processing and the stack poll that loopback segments otherwise "
+"go through, and the peer's acknowledgement is applied at the same time.\n"
+"Segments that need full processing (connection setup and teardown, "
+"urgent data, or anything sent while either end is not in the "
+"ESTABLISHED state or after a segment that took the normal path) still go "
+"the normal way, so this is transparent to applications.  The "
+"tcp_loopback_direct and tcp_loopback_direct_fallback statistics count "
+"the segments taking each path.",
+           1, , 0, 0, 1, yesno)
+
 #if CI_CFG_PKTS_AS_HUGE_PAGES
 CI_CFG_OPT("EF_USE_HUGE_PAGES", huge_pages, ci_uint32,
 "Control of whether huge pages are used for packet buffers:\n"
@@ -651,6 +734,19 @@ CI_CFG_OPT("EF_USE_HUGE_PAGES", huge_pages, ci_uint32,
            2, , 1, 0, 2, oneof:no;try;always)
 #endif
 
+#define CITP_PKT_NUMA_THREAD  0
+#define CITP_PKT_NUMA_NIC     1
+CI_CFG_OPT("EF_PACKET_NUMA_MODE", packet_numa_mode, ci_uint32,
+"Choose the NUMA node on which packet buffers are allocated:\n"
+"  0 - the node of the thread that causes the allocation;\n"
+"  1 - the node of the stack's first network interface (default).\n"
+"If the interface's node is not known, or memory on the chosen node is "
+"exhausted, buffers are allocated elsewhere.  The placement of huge pages "
+"(EF_USE_HUGE_PAGES) can't be chosen; it is recorded only.  The "
+"pkt_sets_numa_local and pkt_sets_numa_remote counters show how often "
+"the chosen node was used.",
+           1, , CITP_PKT_NUMA_NIC, 0, 1, oneof:thread;nic)
+
 CI_CFG_OPT("EF_COMPOUND_PAGES_MODE", compound_pages, ci_uint32,
 "Debug option, not suitable for normal use.\n"
 "For packet buffers, allocate system pages in the following way:\n"
@@ -722,7 +818,8 @@ CI_CFG_OPT("EF_TCP_SYN_OPTS", syn_opts, ci_uint32,
 "bit 0 (0x1) is set to 1 to enable PAWS and RTTM timestamps (RFC1323),\n"
 "bit 1 (0x2) is set to 1 to enable window scaling (RFC1323),\n"
 "bit 2 (0x4) is set to 1 to enable SACK (RFC2018),\n"
-"bit 3 (0x8) is set to 1 to enable ECN (RFC3128)."
+"bit 3 (0x8) is ignored: ECN (RFC3168) is negotiated only when the "
+"congestion control algorithm uses it (see EF_TCP_CONGESTION).\n"
 "Overridden by OS settings if they are available.",
            4, , CI_TCPT_SYN_FLAGS, MIN, MAX, bitmask)
 
@@ -742,6 +839,33 @@ CI_CFG_OPT("EF_TCP_FIN_TIMEOUT", fin_timeout, ci_uint32,
 "opening to send our FIN, etc).",
            8, , CI_CFG_TCP_FIN_TIMEOUT, MIN, MAX, time:sec /*?*/)
 
+CI_CFG_OPT("EF_TIMER_MODE", timer_mode, ci_uint32,
+"Selects the engine used to manage the stack's timers.  Possible values are:\n"
+"  0  -  classic hierarchical timer wheel (default)\n"
+"  1  -  incremental wheel: each level of the wheel is double-buffered, and "
+"timers are migrated to the level below a little at a time on each poll "
+"(see EF_TIMER_CASCADE_BUDGET), rather than all at once when a level wraps.  "
+"This bounds the work done in any single poll for stacks with very many "
+"connections.\n"
+"The distribution of pending timers can be viewed with "
+"'onload_stackdump timers'.",
+           1, , 0, 0, 1, oneof:classic;incremental)
+
+CI_CFG_OPT("EF_TIMER_CASCADE_BUDGET", timer_cascade_budget, ci_uint32,
+"When EF_TIMER_MODE=1, the maximum number of timers migrated between levels "
+"of the timer wheel by each poll of the stack.  Timers that have not been "
+"migrated when they are due are moved immediately, so this only affects how "
+"the work is spread.",
+           , , 64, 1, 65536, count)
+
+CI_CFG_OPT("EF_TIMER_COALESCE_MS", timer_coalesce_ms, ci_uint32,
+"Coalesce TCP keepalive timers and the expiry of connections in the "
+"TIME_WAIT and FIN_WAIT2 states to this granularity (rounded up to a power "
+"of two ticks).  Coarse timers are then expired in batches, and restarting "
+"a keepalive timer whose rounded expiry is unchanged costs nothing.  A value "
+"of 0 disables coalescing.",
+           , , 0, 0, 60000, time:msec)
+
 CI_CFG_OPT("EF_TCP_RX_LOG_FLAGS", tcp_rx_log_flags, ci_uint32,
 "Log received packets that have any of these flags set in the TCP header.  "
 "Only active when EF_TCP_RX_CHECKS is set.",
@@ -990,6 +1114,15 @@ CI_CFG_OPT("EF_EVS_PER_POLL", evs_per_poll, ci_uint32,
 "working set size (which harms cache efficiency).",
            , , 64, 0, 0x7fffffff, level)
 
+CI_CFG_OPT("EF_RX_BATCH", rx_batch, ci_uint32,
+"Sets the maximum number of received packets that are gathered from the "
+"event queue before being delivered.  The headers of all packets in a batch "
+"are prefetched, and their software filter lookups started, before any of "
+"them is processed, so memory latency for one packet overlaps with protocol "
+"processing of the others.  A value of 1 delivers each packet as soon as the "
+"next event has been read.",
+           , , CI_CFG_RX_BATCH_MAX, 1, CI_CFG_RX_BATCH_MAX, count)
+
 #if CI_CFG_PORT_STRIPING
 CI_CFG_OPT("EF_STRIPE_NETMASK", stripe_netmask_be32, ci_uint32,
 "Port striping is only negotiated with hosts whose IP address is on the same "
@@ -1007,6 +1140,25 @@ CI_CFG_OPT("EF_SPIN_USEC", spin_usec, ci_uint32,
            "" /* documented in opts_citp_def.h */,
            ,  poll_cycles, 0, MIN, MAX, time:usec)
 
+#if CI_CFG_SPIN_ADAPT
+CI_CFG_OPT("EF_SPIN_ADAPT", spin_adapt, ci_uint32,
+"Adapt the time spent spinning by blocking receive calls and epoll_wait() "
+"to the traffic.  Each socket (and each epoll set with a home stack) keeps "
+"a histogram of how long its blocking calls waited for data, and spins "
+"only for as long as is needed to catch EF_SPIN_ADAPT_PCT percent of "
+"arrivals, up to the limit set by EF_SPIN_USEC.  When even that limit "
+"would catch fewer than half that many, it does not spin at all.  While it "
+"spins for less than the limit, one call in 16 spins for the whole of it "
+"so that the histogram stays accurate.  Decisions "
+"and an estimate of the CPU time saved are shown by onload_stackdump.",
+           1, , 0, 0, 1, yesno)
+
+CI_CFG_OPT("EF_SPIN_ADAPT_PCT", spin_adapt_pct, ci_uint32,
+"Percentage of arrivals that EF_SPIN_ADAPT aims to catch while spinning, "
+"so that they are handled without the latency of a wakeup.",
+           , , 90, 1, 100, count)
+#endif
+
 CI_CFG_OPT("EF_BUZZ_USEC", buzz_usec, ci_uint32,
 "Sets the timeout in microseconds for lock buzzing options.  Set to zero to "
 "disable lock buzzing (spinning).  Will buzz forever if set to -1.  Also set "
@@ -1095,9 +1247,7 @@ CI_CFG_OPT("EF_PREALLOC_PACKETS", prealloc_packets, ci_int32,
 
 /* Max is currently 2^21 EPs.
  * We allocate ep in pages, EP_BUF_PER_PAGE=4 ep per page, so min is 4.
- * 7 synrecv states consume one endpoint, but we also use aux buffers for
- * listening buckets, so the real ratio is 3,5 synrecv state consumes on
- * endpoint. */
+ * 7 synrecv states consume one endpoint. */
 CI_CFG_OPT("EF_MAX_ENDPOINTS", max_ep_bufs, ci_uint32,
 "This option places an upper limit on the number of accelerated endpoints "
 "(sockets, pipes etc.) in an Onload stack.  This option should be set to a "
@@ -1108,7 +1258,7 @@ CI_CFG_OPT("EF_MAX_ENDPOINTS", max_ep_bufs, ci_uint32,
 "socket() and pipe() etc. are handed over to the kernel stack and so are not "
 "accelerated."
 "\n"
-"Note: ~4 syn-receive states consume one endpoint, see also "
+"Note: ~7 syn-receive states consume one endpoint, see also "
 "EF_TCP_SYNRECV_MAX.",
            , , CI_CFG_NETIF_MAX_ENDPOINTS, 4, CI_CFG_NETIF_MAX_ENDPOINTS_MAX,
            count)
@@ -1225,16 +1375,29 @@ CI_CFG_OPT("EF_TCP_BACKLOG_MAX", tcp_backlog_max, ci_uint32,
 "by /proc/sys/net/ipv4/tcp_max_syn_backlog.",
            , , CI_TCP_LISTENQ_MAX, MIN, MAX, bincount)
 
-/* The number we really use is tcp_synrecv_max*2 - it is the maximum
- * number of aux buffers, assuming that synrrecv state can use one half of
- * them and listening bucktes use another half. */
+/* This is the maximum number of synrecv aux buffers, and also sizes the
+ * stack's SYN-RECV table (ci_tcp_synrecv_table). */
 CI_CFG_OPT("EF_TCP_SYNRECV_MAX", tcp_synrecv_max, ci_uint32,
 "Places an upper limit on the number of embryonic (half-open) connections in "
 "an Onload stack; see also EF_TCP_BACKLOG_MAX.  By default, "
-"EF_TCP_SYNRECV_MAX = 4 * EF_TCP_BACKLOG_MAX.",
+"EF_TCP_SYNRECV_MAX = 4 * EF_TCP_BACKLOG_MAX.  The table used to find "
+"embryonic connections is sized for this many, and so uses up to about "
+"EF_TCP_SYNRECV_MAX * 22 bytes of the stack's shared memory.",
            , , CI_TCP_LISTENQ_MAX * CI_CFG_ASSUME_LISTEN_SOCKS,
            MIN, CI_CFG_NETIF_MAX_ENDPOINTS_MAX, bincount)
 
+CI_CFG_OPT("EF_TCP_ACCEPT_PREALLOC", tcp_accept_prealloc, ci_uint32,
+"Keeps this many endpoints allocated in reserve for connections accepted "
+"by listening sockets in the stack.  A half-open connection that completes "
+"its handshake takes an endpoint from the reserve, so a burst of incoming "
+"connections does not have to wait while the stack is grown.  The reserve "
+"is filled by listen(), and topped up by accept() and onload_accept_batch() "
+"once they have handed over the connections they were asked for.\n"
+"Reserved endpoints count towards EF_MAX_ENDPOINTS and cannot be used for "
+"other sockets.  The accept_prealloc_used and accept_prealloc_empty "
+"statistics show how often the reserve was used and found empty.",
+           , , 0, 0, CI_CFG_NETIF_MAX_ENDPOINTS_MAX, count)
+
 CI_CFG_OPT("EF_TCP_INITIAL_CWND", initial_cwnd, ci_int32,
 "Sets the initial size of the congestion window (in bytes) for TCP "
 "connections. Some care is needed as, for example, setting smaller than the "
@@ -1261,6 +1424,20 @@ CI_CFG_OPT("EF_TCP_MIN_CWND", min_cwnd, ci_int32,
 "WARNING: Modifying this option may violate the TCP protocol.",
            ,  , 0, 0, SMAX, count)
 
+#define CI_TCP_CC_RENO   0
+#define CI_TCP_CC_CUBIC  1
+#define CI_TCP_CC_DCTCP  2
+#define CI_TCP_CC_N      3
+CI_CFG_OPT("EF_TCP_CONGESTION", tcp_cong_algo, ci_uint32,
+"Selects the default congestion control algorithm for TCP sockets.  It may "
+"be changed per socket with the TCP_CONGESTION socket option.\n"
+"reno  - NewReno with appropriate byte counting (RFC5681, RFC3465).\n"
+"cubic - CUBIC (RFC8312).\n"
+"dctcp - Data Center TCP (RFC8257).  ECN is negotiated with the peer and "
+"outgoing packets are marked ECN-capable.  Only suitable for networks "
+"whose switches apply ECN marking at a shallow queue threshold.",
+           2, , CI_TCP_CC_RENO, 0, 2, oneof:reno;cubic;dctcp)
+
 #if CI_CFG_TCP_FASTSTART
 CI_CFG_OPT("EF_TCP_FASTSTART_INIT", tcp_faststart_init, ci_uint32,
 "The FASTSTART feature prevents Onload from delaying ACKs during times when "
@@ -67,6 +67,21 @@ OO_STAT("Number of RX events handled.  Not always 1:1 with number of "
 OO_STAT("Number of TX events handled.  Not always 1:1 with number of "
         "packets sent - batching is done at higher rates.",
         ci_uint32, tx_evs, count)
+OO_STAT("Number of UDP datagrams queued on a TX staging ring because the "
+        "stack lock was held (see EF_UDP_TX_STAGE_RING).",
+        ci_uint32, udp_tx_staged, count)
+OO_STAT("Number of times a UDP TX staging ring was full, so the sender had "
+        "to take the stack lock.",
+        ci_uint32, udp_tx_stage_full, count)
+OO_STAT("Number of times the lock holder drained the UDP TX staging rings.",
+        ci_uint32, udp_tx_stage_drains, count)
+OO_STAT("Number of times more than one received packet was delivered as a "
+        "batch, with headers and software filters prefetched ahead of "
+        "protocol processing (see EF_RX_BATCH).",
+        ci_uint32, rx_batches, count)
+OO_STAT("Number of packets delivered in batches.  rx_batch_pkts / rx_batches "
+        "is the mean batch size.",
+        ci_uint32, rx_batch_pkts, count)
 OO_STAT("Number of times periodic timer has polled for events.  Indicates "
         "your application has not made accelerated calls for a long period.",
         ci_uint32, periodic_polls, count)
@@ -77,6 +92,17 @@ OO_STAT("Number of network events handled by periodic timer.  Indicates your "
 OO_STAT("Number of times periodic timer could not get the stack lock.  "
         "Not severe.",
         ci_uint32, periodic_lock_contends, count)
+OO_STAT("Number of timers moved between levels of the timer wheel when a "
+        "level wrapped.  With EF_TIMER_MODE=1 this should be small relative "
+        "to timer_cascade_incr; if not, consider raising "
+        "EF_TIMER_CASCADE_BUDGET.",
+        ci_uint32, timer_cascade_wrap, count)
+OO_STAT("Number of timers migrated between levels of the timer wheel ahead "
+        "of time by EF_TIMER_MODE=1.",
+        ci_uint32, timer_cascade_incr, count)
+OO_STAT("Number of timer restarts avoided because the coalesced expiry time "
+        "was unchanged (see EF_TIMER_COALESCE_MS).",
+        ci_uint32, timer_coalesced, count)
 OO_STAT("Number of interrupts.  Expected if interrupt driven; otherwise "
         "suggests timeout of one kind or another.",
         ci_uint32, interrupts, count)
@@ -169,6 +195,18 @@ OO_STAT("Indicates that we've reclaimed from the pkt_nonb (e.g. due to "
         "memory pressure; but may be just contention with the ring refill "
         "path).  Check for memory_pressure.",
         ci_uint32, pkt_nonb_steal, count)
+OO_STAT("Times a thread took a packet buffer from another thread's nonb "
+        "magazine because its own and the shared nonb pool were empty.  "
+        "High rates mean packets are freed on different threads from those "
+        "that allocate them.",
+        ci_uint32, pkt_nonb_magazine_steal, count)
+OO_STAT("Packet sets allocated on the NUMA node chosen by "
+        "EF_PACKET_NUMA_MODE.",
+        ci_uint32, pkt_sets_numa_local, count)
+OO_STAT("Packet sets allocated on a different NUMA node from that chosen by "
+        "EF_PACKET_NUMA_MODE (e.g. because that node had no free memory, or "
+        "with huge pages, whose placement we can't choose).",
+        ci_uint32, pkt_sets_numa_remote, count)
 OO_STAT("Times we've woken threads waiting for free packet buffers.  Can "
         "occur during memory_pressure.",
         ci_uint32, pkt_wakes, count)
@@ -240,6 +278,12 @@ OO_STAT("Multicast loop-back send was dropped due to RX packet buffer limit.",
         ci_uint32, udp_send_mcast_loop_drop, count)
 OO_STAT("Number of active opens that reached established.",
         ci_uint32, active_opens, count)
+OO_STAT("Number of TCP loopback segments placed directly on the receive "
+        "queue of the peer socket (see EF_TCP_LOOPBACK_DIRECT).",
+        ci_uint32, tcp_loopback_direct, count)
+OO_STAT("Number of TCP loopback segments that could not be placed directly "
+        "and took the normal loopback path (see EF_TCP_LOOPBACK_DIRECT).",
+        ci_uint32, tcp_loopback_direct_fallback, count)
 OO_STAT(HANDOVER_DESCRIPTION(socket),
         ci_uint32, tcp_handover_socket, count)
 OO_STAT(HANDOVER_DESCRIPTION(bind) 
@@ -283,11 +327,18 @@ OO_STAT("Rolling mean of number of hops in recent inserts to the software "
         ci_uint32, table_mean_hops, val)
 OO_STAT("Number of entries in software-filter hash table.",
         ci_uint32, table_n_entries, val)
-OO_STAT("Number of slots occupied in software-filter hash table.",
-        ci_uint32, table_n_slots, val)
+OO_STAT("Number of software-filter hash table buckets that have overflowed "
+        "into another bucket.",
+        ci_uint32, table_n_overflowed, val)
 OO_STAT("Number of retransmit timeouts, across all TCP sockets that stack "
         "has had.",
         ci_uint32, tcp_rtos, count)
+OO_STAT("Number of times a TCP socket using ECN saw the CE marking of "
+        "received data change (each causes an immediate ACK).",
+        ci_uint32, tcp_ecn_ce_changes, count)
+OO_STAT("Number of congestion window reductions in response to ECN echo, "
+        "across all TCP sockets using DCTCP.",
+        ci_uint32, tcp_ecn_cwnd_reductions, count)
 #if CI_CFG_TAIL_DROP_PROBE
 OO_STAT("Number of tail-drop probes sent from retransmit queue.",
         ci_uint32, tail_drop_probe_retrans, count)
@@ -426,10 +477,22 @@ OO_STAT("Number of times accept() was accelerated.",
         ci_uint32, ul_accepts, count)
 OO_STAT("Number of times accept() returned EAGAIN.",
         ci_uint32, accept_eagain, count)
+OO_STAT("Number of connections given their fds in batches by "
+        "onload_accept_batch().",
+        ci_uint32, accept_batch_attach, count)
+OO_STAT("Number of promoted connections that took an endpoint from the "
+        "reserve (see EF_TCP_ACCEPT_PREALLOC).",
+        ci_uint32, accept_prealloc_used, count)
+OO_STAT("Number of promoted connections that found the endpoint reserve "
+        "empty and allocated an endpoint (see EF_TCP_ACCEPT_PREALLOC).",
+        ci_uint32, accept_prealloc_empty, count)
 OO_STAT("Number of failed aux-buffer allocations.",
         ci_uint32, aux_alloc_fails, count)
-OO_STAT("Number of failed bucket-aux-buffer allocations.",
-        ci_uint32, aux_bucket_alloc_fails, count)
+OO_STAT("Number of synrecv states that found their SYN-RECV table bucket "
+        "full and were chained from it.",
+        ci_uint32, synrecv_table_overflow, count)
+OO_STAT("Number of SYN-RECV table buckets split as the table grew.",
+        ci_uint32, synrecv_table_splits, count)
 OO_STAT("Times that accept() was called, but as a result of the "
         "TCP_DEFER_ACCEPT socket option (on the listening socket), we do not "
         "promote a half-opened connection from listen to accept queue until "
@@ -440,6 +503,15 @@ OO_STAT("Number of times we have sent a pure ACK packet.  Indicates that we "
         ci_uint32, acks_sent, count)
 OO_STAT("Number of TCP window updates sent.",
         ci_uint32, wnd_updates_sent, count)
+OO_STAT("Number of TCP receive buffers lent to the application by "
+        "onload_zc_recv_lend().",
+        ci_uint32, tcp_zc_lent_pkts, count)
+OO_STAT("Number of pipe buffers moved onto a TCP send queue by splice() "
+        "instead of being copied.",
+        ci_uint32, tcp_splice_tx_pkts, count)
+OO_STAT("Number of TCP receive buffers moved into a pipe by splice() "
+        "instead of being copied.",
+        ci_uint32, tcp_splice_rx_pkts, count)
 OO_STAT("This means that Onload received a packet, and had to do something "
         "other than just put it onto the receive queue.  Usually just "
         "(indicates TCP where we have to update state machinery, reset "
@@ -512,6 +584,10 @@ OO_STAT("Indicates that you're sending faster than we can push packets on to "
         ci_uint32, tx_dma_max, val)
 OO_STAT("Number of TX DMA doorbells.",
         ci_uint32, tx_dma_doorbells, count)
+OO_STAT("Number of batches of packets filled by TCP send() that were larger "
+        "than the default batch, because the send was large enough to "
+        "segment in software (see EF_TCP_SEND_GSO_MAX).",
+        ci_uint32, tcp_send_gso_batches, count)
 OO_STAT("Number of sends that failed due to alien (i.e. Non-SFC) route.",
         ci_uint32, tx_discard_alien_route, count)
 OO_STAT("Unable to allocate more packet buffers.  It's possible that this is "
@@ -567,6 +643,9 @@ OO_STAT("We've been asked to free up a UDP socket (i.e. nothing references "
 OO_STAT("We've run out of space in the filter table; on the host.  "
         "Try increasing EF_MAX_ENDPOINTS",
         ci_uint32, sw_filter_insert_table_full, count)
+OO_STAT("Number of software-filter table entries moved to their other "
+        "bucket to make room for a new entry.",
+        ci_uint32, sw_filter_insert_moves, count)
 #if CI_CFG_PIO
 OO_STAT("Number of times PIO has been used to send a packet",
         ci_uint32, pio_pkts, count)
@@ -624,6 +703,23 @@ OO_STAT("Number of loops x sockets spent in epoll_wait() busy-waiting, "
         "with EF_UL_EPOLL=2",
         ci_uint64, spin_epoll_kernel, count)
 #endif
+#if CI_CFG_SPIN_ADAPT
+OO_STAT("Number of blocking waits that ended while spinning, with "
+        "EF_SPIN_ADAPT.",
+        ci_uint32, spin_adapt_hit, count)
+OO_STAT("Number of blocking waits that spun for the adaptive budget and then "
+        "slept, with EF_SPIN_ADAPT.",
+        ci_uint32, spin_adapt_miss, count)
+OO_STAT("Number of blocking waits that slept without spinning, with "
+        "EF_SPIN_ADAPT.",
+        ci_uint32, spin_adapt_skip, count)
+OO_STAT("Number of blocking waits that slept, with EF_SPIN_ADAPT, which "
+        "spinning for EF_SPIN_USEC would have caught.",
+        ci_uint32, spin_adapt_late, count)
+OO_STAT("Cycles not spent spinning with EF_SPIN_ADAPT, compared with "
+        "spinning for EF_SPIN_USEC.",
+        ci_uint64, spin_adapt_cycles_saved, count)
+#endif
 #if CI_CFG_FD_CACHING
 OO_STAT("Number of sockets cached over lifetime of the stack",
         ci_uint32, sockcache_cached, count)
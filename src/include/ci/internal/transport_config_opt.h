@@ -95,6 +95,16 @@
  */
 #define CI_CFG_UDP_SEND_UNLOCK_OPT      1
 
+/* Number of UDP TX staging rings per stack (EF_UDP_TX_STAGE_RING).  Threads
+ * are spread over them; must be no more than 32.
+ */
+#define CI_CFG_UDP_TX_STAGE_RINGS       16
+
+/* Number of per-thread caches ("magazines") of the non-blocking packet
+ * pool.  Threads are spread over them round-robin.
+ */
+#define CI_CFG_PKT_NONB_MAGAZINES       8
+
 /* Debug aids.  Off by default, as some add lots of overhead. */
 #ifndef CI_CFG_RANDOM_DROP
 #define CI_CFG_RANDOM_DROP		0
@@ -234,6 +244,10 @@
 /* How many RX descriptors to push at a time. */
 #define CI_CFG_RX_DESC_BATCH		16
 
+/* Maximum number of received packets gathered before delivery (EF_RX_BATCH).
+ * Bounds the per-poll state on the stack. */
+#define CI_CFG_RX_BATCH_MAX		32
+
 /* How many packets to fill on TX path before pushing them out. */
 #define CI_CFG_TCP_TX_BATCH		8
 
@@ -612,6 +626,15 @@
 #if CI_CFG_TCPDUMP
 /* Dump queue length, should be 2^x, x <= 16 */
 #define CI_CFG_DUMPQUEUE_LEN 128
+
+/* Set to 1 to build in the capture ring enabled by EF_TCPDUMP_RING_SIZE:
+ * packets are copied into a shared byte ring, optionally through a
+ * classic BPF filter run in the stack, instead of being held in
+ * dump_queue.
+ */
+#define CI_CFG_TCPDUMP_RING 1
+/* Max length of the in-stack filter program. */
+#define CI_CFG_TCPDUMP_BPF_MAX_INSNS 512
 #endif /* CI_CFG_TCPDUMP */
 
 
@@ -679,8 +702,11 @@
  */
 #define CI_CFG_SEPARATE_UDP_RXQ 0
 
-/* How many epolls sets will have a ready list maintained by the stack */
-#define CI_CFG_EPOLL1_SETS_PER_STACK 4
+/* How many epolls sets will have a ready list maintained by the stack.
+ * Limited to 32 by the width of the ready list bitmasks; the per-socket
+ * state is allocated only for the lists the socket is actually in.
+ */
+#define CI_CFG_EPOLL1_SETS_PER_STACK 32
 /* How many ready lists are maintained */
 #define CI_CFG_N_READY_LISTS CI_CFG_EPOLL1_SETS_PER_STACK
 
@@ -705,6 +731,32 @@
 #define CI_CFG_PROC_DELAY_BUCKETS       20
 #define CI_CFG_PROC_DELAY_NS_SHIFT      10
 
+/* Set to 1 to build in the latency histograms enabled by EF_LATENCY_HIST.
+ * Buckets are log2-spaced, each octave being split into
+ * 2^CI_CFG_LAT_HIST_SUB_BITS linear sub-buckets.
+ */
+#define CI_CFG_LAT_HIST                 1
+#define CI_CFG_LAT_HIST_SUB_BITS        2
+
+/* Set to 1 to build in the statistics ring enabled by EF_STATS_RING_SIZE:
+ * the stack periodically appends delta-encoded snapshots of its
+ * ci_netif_stats to a ring in shared state.  A full snapshot is written
+ * every CI_CFG_STATS_RING_KEY_INTERVAL records so that readers can
+ * (re)synchronise.  Needs CI_CFG_STATS_NETIF.
+ */
+#define CI_CFG_STATS_RING               CI_CFG_STATS_NETIF
+#define CI_CFG_STATS_RING_KEY_INTERVAL  64
+
+/* Set to 1 to build in adaptive spinning (EF_SPIN_ADAPT): blocking receives
+ * and epoll_wait() learn the distribution of their wait times, and choose
+ * how long to spin so as to catch a target fraction of arrivals without
+ * sleeping.  Wait times are kept in CI_CFG_SPIN_ADAPT_BUCKETS log2 buckets,
+ * the first covering waits up to 2^CI_CFG_SPIN_ADAPT_MIN_LOG2 cycles.
+ */
+#define CI_CFG_SPIN_ADAPT               1
+#define CI_CFG_SPIN_ADAPT_BUCKETS       14
+#define CI_CFG_SPIN_ADAPT_MIN_LOG2      10
+
 
 /* Include "extra" transport_config_opt to allow build-time profiles */
 #include TRANSPORT_CONFIG_OPT_HDR
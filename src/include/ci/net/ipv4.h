@@ -199,6 +199,13 @@ ci_inline ci_uint32 ci_ip_mask2prefix(ci_uint32 mask_he32)
 /*! type of service */
 typedef ci_uint8 ci_ip_tos_t;
 
+/*! ECN field of the type of service byte (RFC3168) */
+#define CI_IP_TOS_ECN_MASK  0x3
+#define CI_IP_ECN_NOT_ECT   0x0
+#define CI_IP_ECN_ECT1      0x1
+#define CI_IP_ECN_ECT0      0x2
+#define CI_IP_ECN_CE        0x3
+
 
 /**********************************************************************
  ** TCP
@@ -38,6 +38,9 @@
 /*! Comment? */
 extern int ci_cpu_features_check(int verbose);
 
+/*! Returns non-zero if the CPU (and OS) support [feature], which is one of
+** "pclmul", "avx2", "avx512f" or "avx512bw".
+*/
 extern int ci_cpu_has_feature(char* feature);
 
 #endif  /* __CI_TOOLS_CPU_FEATURES_H__ */
@@ -280,6 +280,38 @@ extern unsigned ci_ip_csum_copy_asm(void* dest, const void* src,
 				    int n, unsigned sum) CI_HF;
 
 
+/****************************************************************************
+ * Vectorised functions
+ ***************************************************************************/
+
+#ifndef __KERNEL__
+
+#define CI_IP_CSUM_ISA_C       0
+#define CI_IP_CSUM_ISA_AVX2    1
+#define CI_IP_CSUM_ISA_AVX512  2
+#define CI_IP_CSUM_ISA_MAX     CI_IP_CSUM_ISA_AVX512
+
+  /*! Select the implementation used by ci_ip_csum_vec() and
+  ** ci_ip_csum_copy_vec().  [isa] is one of CI_IP_CSUM_ISA_* or -1 to pick
+  ** the best one supported by this CPU, which is what happens on first
+  ** use.  Returns the ISA selected, or -ENOTSUP.
+  */
+extern int ci_ip_csum_isa_select(int isa) CI_HF;
+
+  /*! Returns the CI_IP_CSUM_ISA_* in use. */
+extern int ci_ip_csum_isa(void) CI_HF;
+
+  /*! As ci_ip_csum_aligned(), using AVX2 or AVX-512 where available. */
+extern unsigned ci_ip_csum_vec(unsigned sum, const void* buf, int n) CI_HF;
+
+  /*! As ci_ip_csum_copy_aligned(), using AVX2 or AVX-512 where available.
+  */
+extern unsigned ci_ip_csum_copy_vec(void* dest, const void* src,
+                                    int n, unsigned sum) CI_HF;
+
+#endif
+
+
 /****************************************************************************
  * Other functions
  ***************************************************************************/
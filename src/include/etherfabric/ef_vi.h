@@ -583,6 +583,8 @@ enum ef_vi_arch {
   EF_VI_ARCH_FALCON,
   /** 7000 and 8000-series NICs */
   EF_VI_ARCH_EF10,
+  /** Software emulation, selected with EF_VI_SOFT (no NIC required) */
+  EF_VI_ARCH_SOFT,
 };
 
 /*! \brief State of TX descriptor ring
@@ -704,6 +704,35 @@ extern int
 onload_get_tcp_info(int fd, struct onload_tcp_info* info, int* len_in_out);
 
 
+/**********************************************************************
+ * onload_accept_batch: accept several connections in one call
+ *
+ * Accepts up to n connections on the listening socket fd, as if by
+ * calling accept4(fd, ents[i].addr, &ents[i].addrlen, flags) for each
+ * entry in turn.  The fd of each accepted connection is stored in
+ * ents[i].fd, and its peer address in ents[i].addr (if not NULL).
+ *
+ * The call waits for the first connection as accept() would, respecting
+ * O_NONBLOCK and SO_RCVTIMEO on fd.  It then returns as many further
+ * connections as are ready, without waiting.  Onload takes the ready
+ * connections off the accept queue and creates their fds together, which
+ * is cheaper than one accept() each.
+ *
+ * Returns the number of connections accepted, or -1 with errno set as by
+ * accept4() if there were none.  If fd is not an accelerated TCP socket
+ * (or Onload is not in use), at most one connection is returned per call.
+ */
+struct onload_accept_entry {
+  struct sockaddr* addr;     /* IN: buffer for peer address, or NULL */
+  socklen_t        addrlen;  /* IN: size of addr; OUT: size of address */
+  int              fd;       /* OUT: the accepted connection */
+};
+
+extern int
+onload_accept_batch(int fd, struct onload_accept_entry* ents, int n,
+                    int flags);
+
+
 /**********************************************************************
  * onload_socket_nonaccel: create a non-accelerated socket
  *
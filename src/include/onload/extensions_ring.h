@@ -0,0 +1,217 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions are
+** met:
+**
+** * Redistributions of source code must retain the above copyright notice,
+**   this list of conditions and the following disclaimer.
+**
+** * Redistributions in binary form must reproduce the above copyright
+**   notice, this list of conditions and the following disclaimer in the
+**   documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+** IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+** TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+** PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+** HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+** SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+** TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+** PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+** LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+** NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+** SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_HEADER >
+**  \brief  Onload submission/completion ring API
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+#ifndef __ONLOAD_RING_H__
+#define __ONLOAD_RING_H__
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h> // for struct sockaddr, socklen_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The ring API lets an application queue many send, receive and accept
+ * operations in a submission queue (SQ) held in its own memory, hand them
+ * to Onload in one call, and collect the results from a completion queue
+ * (CQ).  Entry to the Onload library is done once per batch.  Sends and
+ * receives on Onload TCP sockets are done under one hold of the stack
+ * lock, taken after polling the stack once, for as long as the batch stays
+ * in one stack.  The fd table lookup and, for receives, the socket lock
+ * are shared by consecutive operations on the same fd, so sorting a batch
+ * by stack and then by fd gives the most benefit.  Other operations are
+ * issued one at a time, as the equivalent calls would be.
+ *
+ * Operations never block.  A receive or accept that has nothing to return
+ * yet, or a send that cannot make progress, is left in the SQ and retried
+ * by the next onload_ring_submit() call, so an application normally just
+ * calls onload_ring_submit() from its event loop.  Operations of the same
+ * type on one fd complete in the order they were queued, even when they
+ * are interleaved with operations on other fds.
+ *
+ * A ring must only be used by one thread at a time.
+ */
+
+
+/******************************************************************************
+ * Data structures
+ ******************************************************************************/
+
+enum onload_ring_op {
+  ONLOAD_RING_OP_NOP    = 0,
+  ONLOAD_RING_OP_SEND   = 1,  /* send(fd, buf, len, flags)               */
+  ONLOAD_RING_OP_RECV   = 2,  /* recv(fd, buf, len, flags)               */
+  ONLOAD_RING_OP_ACCEPT = 3,  /* accept4(fd, addr, addrlen, flags)       */
+};
+
+/* Submission queue entry */
+struct onload_ring_sqe {
+  uint64_t          user_data; /* Copied to the completion                */
+  int               fd;
+  uint16_t          opcode;    /* enum onload_ring_op                     */
+  uint16_t          reserved;  /* Must be zero                            */
+  int               flags;     /* MSG_* for send/recv, SOCK_* for accept  */
+  void*             buf;
+  size_t            len;
+  struct sockaddr*  addr;      /* Peer address for accept, may be NULL    */
+  socklen_t*        addrlen;
+};
+
+/* Completion queue entry */
+struct onload_ring_cqe {
+  uint64_t          user_data;
+  int               res;       /* Bytes, new fd for accept, or -errno     */
+  unsigned          flags;     /* Not currently used                      */
+};
+
+/* The queues are indexed by free-running counters; the number of entries
+ * in each queue must be a power of two.  The application advances sq_tail
+ * and cq_head.  onload_ring_submit() advances cq_tail, and removes the
+ * entries it completes from the SQ by moving the ones still queued up to
+ * sq_head and pulling sq_tail back to match.
+ */
+struct onload_ring {
+  struct onload_ring_sqe* sqes;
+  unsigned                sq_mask;
+  unsigned                sq_head;
+  unsigned                sq_tail;
+
+  struct onload_ring_cqe* cqes;
+  unsigned                cq_mask;
+  unsigned                cq_head;
+  unsigned                cq_tail;
+};
+
+
+/******************************************************************************
+ * Ring management
+ ******************************************************************************/
+
+/* Initialise [ring] to use the arrays [sqes] and [cqes], which must have
+ * [sq_entries] and [cq_entries] members respectively.  Both must be powers
+ * of two.  Returns zero on success, or -EINVAL.
+ */
+static inline int
+onload_ring_init(struct onload_ring* ring,
+                 struct onload_ring_sqe* sqes, unsigned sq_entries,
+                 struct onload_ring_cqe* cqes, unsigned cq_entries)
+{
+  if( sq_entries == 0 || (sq_entries & (sq_entries - 1)) ||
+      cq_entries == 0 || (cq_entries & (cq_entries - 1)) )
+    return -EINVAL;
+  ring->sqes = sqes;
+  ring->sq_mask = sq_entries - 1;
+  ring->sq_head = ring->sq_tail = 0;
+  ring->cqes = cqes;
+  ring->cq_mask = cq_entries - 1;
+  ring->cq_head = ring->cq_tail = 0;
+  return 0;
+}
+
+/* Returns the next free SQ entry, or NULL if the SQ is full.  The entry
+ * is queued by onload_ring_sqe_push() once it has been filled in.
+ */
+static inline struct onload_ring_sqe*
+onload_ring_get_sqe(struct onload_ring* ring)
+{
+  if( ring->sq_tail - ring->sq_head > ring->sq_mask )
+    return NULL;
+  return &ring->sqes[ring->sq_tail & ring->sq_mask];
+}
+
+static inline void onload_ring_sqe_push(struct onload_ring* ring)
+{
+  ++ring->sq_tail;
+}
+
+/* Returns the oldest unconsumed completion, or NULL if there are none.
+ * It is consumed by onload_ring_cqe_seen().
+ */
+static inline struct onload_ring_cqe*
+onload_ring_peek_cqe(struct onload_ring* ring)
+{
+  if( ring->cq_head == ring->cq_tail )
+    return NULL;
+  return &ring->cqes[ring->cq_head & ring->cq_mask];
+}
+
+static inline void onload_ring_cqe_seen(struct onload_ring* ring)
+{
+  ++ring->cq_head;
+}
+
+
+/******************************************************************************
+ * Submission
+ ******************************************************************************/
+
+/* Process the operations queued in the SQ, adding a CQ entry for each one
+ * that completes.  Processing stops early if the CQ fills up.
+ *
+ * Returns the number of completions added to the CQ, which may be zero,
+ * or <0 to indicate an error.  Errors from individual operations are
+ * reported in their CQ entries.
+ *
+ * Listening sockets used with ONLOAD_RING_OP_ACCEPT must be non-blocking
+ * if they are not accelerated by Onload.  [flags] is not currently used
+ * and must be zero.
+ */
+extern int onload_ring_submit(struct onload_ring* ring, unsigned flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ONLOAD_RING_H__ */
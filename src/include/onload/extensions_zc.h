@@ -65,7 +65,7 @@ extern "C" {
 #endif
 
 /* TODO :
- *  - Zero-copy UDP-TX and TCP-RX
+ *  - Zero-copy UDP-TX
  *  - allow application to signal that fd table checks aren't necessary
  *  - forwarding: zero-copy receive into a buffer, app can then do a
  *    zero-copy send on the same buffer.
@@ -133,6 +133,14 @@ enum onload_zc_buffer_type_flags {
  *
  * Returns zero on success, or <0 to indicate an error
  *
+ * Templated sends are supported on TCP sockets and on connected UDP
+ * sockets.  A UDP template holds a single datagram, which must fit in one
+ * IP packet on the current route, and cannot be used with loopback or
+ * multicast destinations.  The IP and UDP checksums are computed by the
+ * NIC, so updates only need to patch the payload.  If the datagram cannot
+ * be sent through its PIO region it is sent through the normal send path,
+ * which does not block.
+ *
  * These functions can only be used with accelerated sockets (those
  * being handled by Onload).  If a socket has been handed over to the
  * kernel stack (e.g. because it has been bound to an address that is
@@ -151,6 +159,9 @@ extern int onload_zc_alloc_buffers(int fd, struct onload_zc_iovec* iovecs,
  * each received datagram needs to be freed this way; the rest are
  * freed automatically as they are internally chained from the first.
  *
+ * Buffers lent by onload_zc_recv_lend() must be released this way, on
+ * the socket that lent them.
+ *
  * Returns zero on success, or <0 to indicate an error
  */
 
@@ -292,6 +303,44 @@ extern int onload_zc_recv(int fd, struct onload_zc_recv_args *args);
 extern int onload_recvmsg_kernel(int fd, struct msghdr *msg, int flags);
 
 
+/* onload_zc_recv_lend is a pull-style alternative to onload_zc_recv()
+ * for TCP sockets.  Rather than calling back for each message it fills
+ * in up to iovecs_len iovecs, one per received packet, each pointing
+ * directly at the data in Onload's packet buffer.  The application can
+ * parse the data in place and then release the buffers, in bulk if it
+ * wishes, with onload_zc_release_buffers() using iovecs[i].buf.
+ *
+ * Until released, lent buffers count against the socket's receive
+ * buffer (SO_RCVBUF), so the advertised TCP window shrinks and the
+ * sender is flow-controlled as if the data had not been read.  The
+ * window re-opens as buffers are released.  Applications should
+ * therefore release buffers promptly.  Buffers can still be released
+ * after the connection has been reset or shut down, but must all be
+ * released before the socket is closed.  The data in each buffer is in
+ * stream order; buffers may be released in any order.
+ *
+ * flags can take ONLOAD_MSG_DONTWAIT to indicate that the call
+ * shouldn't block.  Timeouts and spinning are as for recv().
+ *
+ * Returns the number of iovecs filled in (at least one), 0 if the peer
+ * has shut down the connection and all data has been read, or <0 to
+ * indicate an error.  Returns -EAGAIN if there is no data and either
+ * ONLOAD_MSG_DONTWAIT is set or the socket is non-blocking.  Data that
+ * follows TCP urgent data (with SO_OOBINLINE off) is not lent; in that
+ * case -ENOTEMPTY is returned and recv() should be used to read it.
+ *
+ * This function can only be used with accelerated TCP sockets.  It
+ * returns -EOPNOTSUPP for UDP sockets, and -ESOCKTNOSUPPORT for sockets
+ * handed over to the kernel stack.
+ */
+
+/* Mask for supported onload_zc_recv_lend() flags */
+#define ONLOAD_ZC_RECV_LEND_FLAGS_MASK (ONLOAD_MSG_DONTWAIT)
+
+extern int onload_zc_recv_lend(int fd, struct onload_zc_iovec* iovecs,
+                               int iovecs_len, int flags);
+
+
 /* onload_zc_send will send each of the messages supplied in the msgs
  * array using the fd from struct onload_zc_mmsg.  Each message
  * consists of an array of buffers (msgs[i].msg.iov[j].iov_base,
@@ -78,6 +78,24 @@ ci_inline unsigned onload_hash2(int af,
          ^ (lport << 16 | rport) ^ protocol) | 1u;
 }
 
+/* Tag stored alongside each filter-table entry.  The multiply spreads the
+ * port bits of hash2 into the top byte, which is otherwise dominated by the
+ * addresses, and the top bit is forced so that a tag is never zero. */
+ci_inline unsigned onload_hash_tag(unsigned hash2)
+{
+  return ((hash2 * 0x9e3779b1u) >> 25) | 0x80u;
+}
+
+/* Compares each byte of [tags] against [tag] in parallel.  Returns a mask
+ * with bit 7 of each matching byte set and all other bits clear.  Unlike
+ * the usual "has zero byte" trick there are no false positives, so a tag
+ * of zero can be used to find free ways. */
+ci_inline ci_uint32 onload_hash_tag_match(ci_uint32 tags, unsigned tag)
+{
+  ci_uint32 v = tags ^ (tag * 0x01010101u);
+  return ~(((v & 0x7f7f7f7fu) + 0x7f7f7f7fu) | v | 0x7f7f7f7fu);
+}
+
 /* This variant of onload_hash2() has a better distribution when the
  * low bits of the addresses are zero, such as when they've been
  * masked off because the prefix length is less than 32. */
@@ -113,6 +113,12 @@ ci_inline int oo_iobufset_get_shmid(struct oo_buffer_pages *pages)
 }
 #endif
 
+/*! NUMA node on which the pages were allocated. */
+ci_inline int oo_iobufset_pages_numa_node(struct oo_buffer_pages *pages)
+{
+  return page_to_nid(pages->pages[0]);
+}
+
 /*! Find memory address in buffer offset. */
 ci_inline void *oo_iobufset_ptr(struct oo_buffer_pages *pages, int offset)
 {
@@ -166,6 +172,9 @@ ci_inline void o_iobufset_resource_ref(struct oo_iobufset *iobrs)
  *
  * \param order      page order to allocate
  * \param flags      see OO_IOBUFSET_FLAG_*, in/out
+ * \param numa_node  node to allocate on if possible, or -1 for the
+ *                   current node (huge pages are not placed: they come
+ *                   from wherever the shm allocation puts them)
  * \param pages_out  pointer to return the allocated pages
  *
  * \return           status code; if non-zero, pages_out is unchanged
@@ -175,7 +184,7 @@ ci_inline void o_iobufset_resource_ref(struct oo_iobufset *iobrs)
  * EFHW_NIC_PAGE_SIZE != PAGE_SIZE, as on PPC.
  */
 extern int
-oo_iobufset_pages_alloc(int nic_order, int *flags,
+oo_iobufset_pages_alloc(int nic_order, int *flags, int numa_node,
                         struct oo_buffer_pages **pages_out);
 extern void oo_iobufset_pages_release(struct oo_buffer_pages *);
 
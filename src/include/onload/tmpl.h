@@ -37,6 +37,7 @@ struct oo_msg_template {
 
 
 extern void ci_tcp_tmpl_free_all(ci_netif* ni, ci_tcp_state* ts);
+extern void ci_udp_tmpl_free_all(ci_netif* ni, ci_udp_state* us);
 extern void ci_tcp_tmpl_handle_nic_reset(ci_netif* ni);
 
 
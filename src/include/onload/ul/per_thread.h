@@ -31,6 +31,8 @@
 #include <onload/ul/stackname.h>
 
 
+struct citp_fdtable_hazard;
+
 struct oo_per_thread {
   ci_netif_config_opts*      thread_local_netif_opts;
   int                        initialised;
@@ -41,6 +43,9 @@ struct oo_per_thread {
   struct oo_timesync         timesync;
   unsigned                   spinstate; 
   int                        in_vfork_child;
+  unsigned                   udp_tx_stage_ring; /* index + 1, or 0 */
+  unsigned                   pkt_nonb_magazine; /* index + 1, or 0 */
+  struct citp_fdtable_hazard* fdtable_hazard;
 };
 
 
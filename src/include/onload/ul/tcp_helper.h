@@ -47,6 +47,14 @@ ci_tcp_helper_sock_attach_to_existing_file(ci_fd_t stack_fd, oo_sp ep_id);
 /*! Allocate fd for accepted tcp socket ep_id */
 extern int ci_tcp_helper_tcp_accept_sock_attach(ci_fd_t stack_fd, oo_sp ep_id,
                                                int type);
+/*! Number of accepted tcp sockets given fds by one call of
+ * ci_tcp_helper_tcp_accept_sock_attach_batch() */
+#define OO_ACCEPT_BATCH_MAX  32
+/*! Allocate fds for up to OO_ACCEPT_BATCH_MAX accepted tcp sockets */
+extern int ci_tcp_helper_tcp_accept_sock_attach_batch(ci_fd_t stack_fd,
+                                                      const oo_sp* ep_ids,
+                                                      int* fds, int n,
+                                                      int type);
 extern int ci_tcp_helper_pipe_attach(ci_fd_t stack_fd, oo_sp ep_id,
                                      int flags, int fds[2]);
 
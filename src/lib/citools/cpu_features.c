@@ -188,6 +188,56 @@ get_cpuid(int op, int *eax, int *ebx, int *ecx, int *edx)
                         : "a" (op));
 }
 
+ci_inline void
+get_cpuid_count(int op, int sub, int *eax, int *ebx, int *ecx, int *edx)
+{
+  __asm__ __volatile__ ("cpuid\n\t"
+                        : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+                        : "a" (op), "c" (sub));
+}
+
+/* Register state enabled by the OS.  Only valid if CPUID reports OSXSAVE. */
+ci_inline ci_uint64 get_xcr0(void)
+{
+  ci_uint32 lo, hi;
+  /* xgetbv, spelt out for old assemblers */
+  __asm__ __volatile__ (".byte 0x0f, 0x01, 0xd0"
+                        : "=a" (lo), "=d" (hi) : "c" (0));
+  return ((ci_uint64) hi << 32) | lo;
+}
+
+#define XCR0_SSE_AVX    0x06ull  /* XMM and YMM state */
+#define XCR0_AVX512     0xe0ull  /* opmask, ZMM0-15 upper, ZMM16-31 */
+
+/* AVX2 and AVX-512 are only usable if the OS saves the wider registers on
+ * context switch, as well as the CPU implementing them. */
+static int cpu_has_avx_feature(int ecx1, const char* feature)
+{
+  int eax, ebx, ecx, edx;
+  ci_uint64 xcr0;
+
+  if( ! (ecx1 & (1 << 27)) )  /* OSXSAVE */
+    return 0;
+  xcr0 = get_xcr0();
+  if( (xcr0 & XCR0_SSE_AVX) != XCR0_SSE_AVX )
+    return 0;
+
+  get_cpuid(0, &eax, &ebx, &ecx, &edx);
+  if( eax < 7 )
+    return 0;
+  get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+
+  if( ! strcmp(feature, "avx2") )
+    return ebx & (1 << 5);
+  if( (xcr0 & XCR0_AVX512) != XCR0_AVX512 )
+    return 0;
+  if( ! strcmp(feature, "avx512f") )
+    return ebx & (1 << 16);
+  if( ! strcmp(feature, "avx512bw") )
+    return ebx & (1 << 30);
+  return 0;
+}
+
 #else
 
 /*****************************************************************************
@@ -213,6 +263,10 @@ int ci_cpu_has_feature(char* feature)
 
   if( ! strcmp(feature, "pclmul") )
     return ecx & 0x00000002;
+# if defined(__x86_64__)
+  if( ! strncmp(feature, "avx", 3) )
+    return cpu_has_avx_feature(ecx, feature);
+# endif
 #endif
 
   /* Not supported on platforms that don't implement the CPUID instruction */
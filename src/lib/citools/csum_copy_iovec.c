@@ -34,6 +34,12 @@ typedef union {
   char       c[2];
 } ci_uint16_bytes;
 
+#ifdef __KERNEL__
+# define csum_copy  ci_ip_csum_copy_aligned
+#else
+# define csum_copy  ci_ip_csum_copy_vec
+#endif
+
 /* copy an iovec to a destination buffer. 
 ** The dest_unalign flag, denotes whether the first byte of the
 ** dest buffer is aligned for checksumming purposes
@@ -54,7 +60,7 @@ int ci_ip_csum_copy_iovec(void* dest, int dest_len, int dest_unalign,
     n = CI_ALIGN_BACK( CI_IOVEC_LEN(&src->io), 2);
     if( n > dest_len ) n = dest_len;
 
-    sum = ci_ip_csum_copy_aligned(dest, CI_IOVEC_BASE(&src->io), n, sum); 
+    sum = csum_copy(dest, CI_IOVEC_BASE(&src->io), n, sum);
     dest_len -= n;
     total += n;
 
@@ -38,6 +38,13 @@ unsigned ci_ip_csum_partial(unsigned sum, const volatile void* in_buf,
   ci_assert(in_buf || bytes == 0);
   ci_assert(bytes >= 0);
 
+#ifndef __KERNEL__
+  /* Callers may go on to add to the result without carry, so keep it
+   * to 17 bits as the loop below would. */
+  if( bytes >= 64 )
+    return ci_ip_csum_fold(ci_ip_csum_vec(sum, (const void*) in_buf, bytes));
+#endif
+
   while( bytes > 1 ) {
     sum += *buf++;
     bytes -= 2;
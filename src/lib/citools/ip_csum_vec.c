@@ -0,0 +1,292 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Vectorised Internet checksum, with and without copy.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/*! \cidoxg_lib_citools */
+
+#include "citools_internal.h"
+#include <ci/tools/cpu_features.h>
+
+
+/* The Internet checksum of a buffer can be computed by summing it as 32-bit
+ * words into a wider accumulator and folding the carries back in at the
+ * end.  The AVX2 and AVX-512 kernels below do this by zero-extending each
+ * 32-bit word to 64 bits and accumulating in vector registers, so there is
+ * no carry chain between lanes.  Data is loaded (and stored) unaligned.
+ *
+ * Anything shorter than a vector, and the tail of a buffer, is handled by
+ * the C routines in ipcsum.h.  Short buffers never reach the vector code,
+ * as the cost of setting up and reducing the accumulators dominates.
+ */
+#define CSUM_VEC_MIN  128
+
+
+#if defined(CI_HAVE_X86INTRIN) && defined(__x86_64__) && \
+    defined(__GNUC__) && __GNUC__ >= 5
+# define CSUM_HAVE_VEC  1
+# include <x86intrin.h>
+#else
+# define CSUM_HAVE_VEC  0
+#endif
+
+
+/* Fold a 64-bit sum of 32-bit words into a 32-bit partial checksum. */
+ci_inline unsigned csum_fold64(ci_uint64 acc, unsigned sum)
+{
+  acc = (acc & 0xffffffffu) + (acc >> 32);
+  acc = (acc & 0xffffffffu) + (acc >> 32);
+  ci_add_carry32(sum, (ci_uint32) acc);
+  return sum;
+}
+
+
+#if CSUM_HAVE_VEC
+
+#define CSUM_AVX2    __attribute__((target("avx2"), always_inline))
+#define CSUM_AVX512  __attribute__((target("avx512f"), always_inline))
+
+
+CSUM_AVX2 static inline __m256i
+csum_avx2_add(__m256i acc, __m256i v)
+{
+  __m256i zero = _mm256_setzero_si256();
+  acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(v, zero));
+  return _mm256_add_epi64(acc, _mm256_unpackhi_epi32(v, zero));
+}
+
+
+CSUM_AVX2 static inline unsigned
+csum_avx2(void* dest, const void* src, int n, unsigned sum, int copy)
+{
+  const char* s = src;
+  char* d = dest;
+  __m256i acc0 = _mm256_setzero_si256();
+  __m256i acc1 = _mm256_setzero_si256();
+  __m256i v0, v1;
+  __m128i a;
+
+  for( ; n >= 64; n -= 64, s += 64 ) {
+    v0 = _mm256_loadu_si256((const __m256i*) s);
+    v1 = _mm256_loadu_si256((const __m256i*) (s + 32));
+    if( copy ) {
+      _mm256_storeu_si256((__m256i*) d, v0);
+      _mm256_storeu_si256((__m256i*) (d + 32), v1);
+      d += 64;
+    }
+    acc0 = csum_avx2_add(acc0, v0);
+    acc1 = csum_avx2_add(acc1, v1);
+  }
+  if( n >= 32 ) {
+    v0 = _mm256_loadu_si256((const __m256i*) s);
+    if( copy ) {
+      _mm256_storeu_si256((__m256i*) d, v0);
+      d += 32;
+    }
+    acc0 = csum_avx2_add(acc0, v0);
+    n -= 32;
+    s += 32;
+  }
+
+  acc0 = _mm256_add_epi64(acc0, acc1);
+  a = _mm_add_epi64(_mm256_castsi256_si128(acc0),
+                    _mm256_extracti128_si256(acc0, 1));
+  a = _mm_add_epi64(a, _mm_unpackhi_epi64(a, a));
+  sum = csum_fold64((ci_uint64) _mm_cvtsi128_si64(a), sum);
+
+  if( copy )
+    return ci_ip_csum_copy_aligned_c(d, s, n, sum);
+  return ci_ip_csum_aligned_c(s, n, sum);
+}
+
+
+CSUM_AVX512 static inline __m512i
+csum_avx512_add(__m512i acc, __m512i v)
+{
+  __m512i zero = _mm512_setzero_si512();
+  acc = _mm512_add_epi64(acc, _mm512_unpacklo_epi32(v, zero));
+  return _mm512_add_epi64(acc, _mm512_unpackhi_epi32(v, zero));
+}
+
+
+CSUM_AVX512 static inline unsigned
+csum_avx512(void* dest, const void* src, int n, unsigned sum, int copy)
+{
+  const char* s = src;
+  char* d = dest;
+  __m512i acc0 = _mm512_setzero_si512();
+  __m512i acc1 = _mm512_setzero_si512();
+  __m512i v0, v1;
+
+  for( ; n >= 128; n -= 128, s += 128 ) {
+    v0 = _mm512_loadu_si512((const void*) s);
+    v1 = _mm512_loadu_si512((const void*) (s + 64));
+    if( copy ) {
+      _mm512_storeu_si512((void*) d, v0);
+      _mm512_storeu_si512((void*) (d + 64), v1);
+      d += 128;
+    }
+    acc0 = csum_avx512_add(acc0, v0);
+    acc1 = csum_avx512_add(acc1, v1);
+  }
+
+  acc0 = _mm512_add_epi64(acc0, acc1);
+  sum = csum_fold64((ci_uint64) _mm512_reduce_add_epi64(acc0), sum);
+
+  /* Less than 128 bytes left. */
+  return csum_avx2(copy ? d : NULL, s, n, sum, copy);
+}
+
+
+/* Out-of-line instances of the kernels, for the dispatch table. */
+
+__attribute__((target("avx2"))) static unsigned
+csum_avx2_nocopy(unsigned sum, const void* buf, int n)
+{ return csum_avx2(NULL, buf, n, sum, 0); }
+
+__attribute__((target("avx2"))) static unsigned
+csum_avx2_copy(void* dest, const void* src, int n, unsigned sum)
+{ return csum_avx2(dest, src, n, sum, 1); }
+
+__attribute__((target("avx512f"))) static unsigned
+csum_avx512_nocopy(unsigned sum, const void* buf, int n)
+{ return csum_avx512(NULL, buf, n, sum, 0); }
+
+__attribute__((target("avx512f"))) static unsigned
+csum_avx512_copy(void* dest, const void* src, int n, unsigned sum)
+{ return csum_avx512(dest, src, n, sum, 1); }
+
+#endif /* CSUM_HAVE_VEC */
+
+
+static unsigned csum_c_nocopy(unsigned sum, const void* buf, int n)
+{ return ci_ip_csum_aligned_c(buf, n, sum); }
+
+static unsigned csum_c_copy(void* dest, const void* src, int n, unsigned sum)
+{ return ci_ip_csum_copy_aligned_c(dest, src, n, sum); }
+
+
+static unsigned csum_resolve_nocopy(unsigned sum, const void* buf, int n);
+static unsigned csum_resolve_copy(void* dest, const void* src, int n,
+                                  unsigned sum);
+
+static struct {
+  unsigned (*csum)(unsigned sum, const void* buf, int n);
+  unsigned (*csum_copy)(void* dest, const void* src, int n, unsigned sum);
+  int isa;
+} csum_vec = { csum_resolve_nocopy, csum_resolve_copy, -1 };
+
+
+static int csum_isa_supported(int isa)
+{
+  switch( isa ) {
+  case CI_IP_CSUM_ISA_C:
+    return 1;
+#if CSUM_HAVE_VEC
+  case CI_IP_CSUM_ISA_AVX2:
+    return ci_cpu_has_feature("avx2") != 0;
+  case CI_IP_CSUM_ISA_AVX512:
+    return ci_cpu_has_feature("avx512f") != 0;
+#endif
+  default:
+    return 0;
+  }
+}
+
+
+int ci_ip_csum_isa_select(int isa)
+{
+  if( isa < 0 ) {
+    for( isa = CI_IP_CSUM_ISA_MAX; isa > CI_IP_CSUM_ISA_C; --isa )
+      if( csum_isa_supported(isa) )
+        break;
+  }
+  else if( ! csum_isa_supported(isa) ) {
+    return -ENOTSUP;
+  }
+
+  switch( isa ) {
+#if CSUM_HAVE_VEC
+  case CI_IP_CSUM_ISA_AVX2:
+    csum_vec.csum = csum_avx2_nocopy;
+    csum_vec.csum_copy = csum_avx2_copy;
+    break;
+  case CI_IP_CSUM_ISA_AVX512:
+    csum_vec.csum = csum_avx512_nocopy;
+    csum_vec.csum_copy = csum_avx512_copy;
+    break;
+#endif
+  default:
+    csum_vec.csum = csum_c_nocopy;
+    csum_vec.csum_copy = csum_c_copy;
+    break;
+  }
+  csum_vec.isa = isa;
+  return isa;
+}
+
+
+int ci_ip_csum_isa(void)
+{
+  if( csum_vec.isa < 0 )
+    ci_ip_csum_isa_select(-1);
+  return csum_vec.isa;
+}
+
+
+static unsigned csum_resolve_nocopy(unsigned sum, const void* buf, int n)
+{
+  ci_ip_csum_isa_select(-1);
+  return csum_vec.csum(sum, buf, n);
+}
+
+
+static unsigned csum_resolve_copy(void* dest, const void* src, int n,
+                                  unsigned sum)
+{
+  ci_ip_csum_isa_select(-1);
+  return csum_vec.csum_copy(dest, src, n, sum);
+}
+
+
+unsigned ci_ip_csum_vec(unsigned sum, const void* buf, int n)
+{
+  ci_assert(buf || n == 0);
+  ci_assert_ge(n, 0);
+
+  if( n < CSUM_VEC_MIN )
+    return ci_ip_csum_aligned_c(buf, n, sum);
+  return csum_vec.csum(sum, buf, n);
+}
+
+
+unsigned ci_ip_csum_copy_vec(void* dest, const void* src, int n, unsigned sum)
+{
+  ci_assert(dest || n == 0);
+  ci_assert(src  || n == 0);
+  ci_assert_ge(n, 0);
+
+  if( n < CSUM_VEC_MIN )
+    return ci_ip_csum_copy_aligned_c(dest, src, n, sum);
+  return csum_vec.csum_copy(dest, src, n, sum);
+}
+
+/*! \cidoxg_end */
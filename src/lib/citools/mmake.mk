@@ -46,6 +46,7 @@ LIB_SRCS	+= drv_log_fn.c memleak_debug.c
 LIB_SRCS	+= drv_thread.c
 else
 LIB_SRCS	+= cithread.c get_cpu_khz.c log_fn.c log_file.c
+LIB_SRCS	+= ip_csum_vec.c
 ifneq ($(ONLOAD_ONLY),1)
 LIB_SRCS	+= rbmw_parse.c \
 		rbmw_simulator.c \
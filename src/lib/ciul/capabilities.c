@@ -89,6 +89,10 @@ __ef_vi_capabilities_get(ef_driver_handle handle, int ifindex, int pd_id,
   /* Can't specify a PD and an ifindex. */
   EF_VI_ASSERT(pd_id < 0 || ifindex < 0);
 
+  /* A soft VI has none of the optional hardware features. */
+  if( ef_vi_soft_link_name() != NULL )
+    return -EOPNOTSUPP;
+
   if( cap < EF_VI_CAP_MAX ) {
     op.cap_in.ifindex = ifindex;
     if( ifindex < 0 ) {
@@ -300,6 +300,9 @@ int ef_pd_alloc_by_name(ef_pd* pd, ef_driver_handle pd_dh,
   if( flags & EF_PD_VF )
     flags |= EF_PD_PHYS_MODE;
 
+  if( ef_vi_soft_link_name() != NULL )
+    return ef_vi_soft_pd_alloc(pd, -1, flags);
+
   pd->pd_intf_name = malloc(IF_NAMESIZE);
   if( pd->pd_intf_name == NULL ) {
     LOGVV(ef_log("%s: malloc failed", __FUNCTION__));
@@ -265,6 +265,24 @@ extern void ef10_ef_eventq_timer_zero(ef_vi*);
 
 extern int ef_pd_cluster_free(ef_pd*, ef_driver_handle);
 
+#ifndef __KERNEL__
+/* Software emulated VI: see soft_vi.c. */
+struct ef_memreg;
+struct timeval;
+extern const char* ef_vi_soft_link_name(void);
+extern int ef_vi_is_soft(const ef_vi*);
+extern void soft_vi_init(ef_vi*) EF_VI_HF;
+extern int ef_vi_soft_pd_alloc(ef_pd*, int ifindex, enum ef_pd_flags);
+extern int ef_vi_soft_memreg_alloc(struct ef_memreg*, void* p_mem,
+                                   size_t len_bytes);
+extern int ef_vi_soft_alloc(ef_vi*, int evq_capacity, int rxq_capacity,
+                            int txq_capacity, ef_vi* evq, enum ef_vi_flags);
+extern int ef_vi_soft_free(ef_vi*);
+extern int ef_vi_soft_get_mac(ef_vi*, void* mac_out);
+extern int ef_vi_soft_eventq_has_many_events(const ef_vi*, int look_ahead);
+extern int ef_vi_soft_eventq_wait(ef_vi*, const struct timeval* timeout);
+#endif
+
 extern void ef_vi_packed_stream_update_credit(ef_vi* vi);
 
 extern void ef_vi_set_intf_ver(char* intf_ver, size_t len);
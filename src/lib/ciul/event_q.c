@@ -44,6 +44,9 @@ int ef_eventq_wait(ef_vi* evq, ef_driver_handle fd,
   */
   ci_resource_op_t  op;
 
+  if( ef_vi_is_soft(evq) )
+    return ef_vi_soft_eventq_wait(evq, timeout);
+
   op.op = CI_RSOP_EVENTQ_WAIT;
   op.id = efch_make_resource_id(evq->vi_resource_id);
   if( timeout ){
@@ -327,6 +327,10 @@ int falcon_ef_eventq_poll(ef_vi* evq, ef_event* evs, int evs_len)
 
 int ef_eventq_has_event(const ef_vi* vi)
 {
+#ifndef __KERNEL__
+  if( ef_vi_is_soft(vi) )
+    return ef_vi_soft_eventq_has_many_events(vi, 0);
+#endif
   EF_VI_ASSERT(vi->evq_base);
   return EF_VI_IS_EVENT(EF_VI_EVENT_PTR(vi, 0));
 }
@@ -335,6 +339,10 @@ int ef_eventq_has_event(const ef_vi* vi)
 int ef_eventq_has_many_events(const ef_vi* vi, int look_ahead)
 {
   EF_VI_BUG_ON(look_ahead < 0);
+#ifndef __KERNEL__
+  if( ef_vi_is_soft(vi) )
+    return ef_vi_soft_eventq_has_many_events(vi, look_ahead);
+#endif
   return EF_VI_IS_EVENT(EF_VI_EVENT_PTR(vi, look_ahead));
 }
 
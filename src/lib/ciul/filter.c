@@ -447,6 +447,9 @@ static int ef_filter_del(ef_driver_handle dh, int resource_id,
 int ef_vi_filter_add(ef_vi *vi, ef_driver_handle dh, const ef_filter_spec *fs,
 		     ef_filter_cookie *filter_cookie_out)
 {
+  /* A soft link is point-to-point, so every frame is delivered. */
+  if( ef_vi_is_soft(vi) )
+    return 0;
   if( ! vi->vi_clustered ) {
     if( fs->type & EF_FILTER_IP6 )
       return ef_filter_add_ip6(dh, vi->vi_resource_id,
@@ -464,6 +467,8 @@ int ef_vi_filter_add(ef_vi *vi, ef_driver_handle dh, const ef_filter_spec *fs,
 int ef_vi_filter_del(ef_vi *vi, ef_driver_handle dh,
 		     ef_filter_cookie *filter_cookie)
 {
+  if( ef_vi_is_soft(vi) )
+    return 0;
   if( ! vi->vi_clustered )
     return ef_filter_del(dh, vi->vi_resource_id, filter_cookie);
   return 0;
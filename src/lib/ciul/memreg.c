@@ -77,6 +77,9 @@ int ef_memreg_alloc(ef_memreg* mr, ef_driver_handle mr_dh,
   size_t sys_len = p_mem_sys_end - p_mem_sys_base;
   size_t n_nic_pages = sys_len >> EFHW_NIC_PAGE_SHIFT;
 
+  if( ef_vi_soft_link_name() != NULL )
+    return ef_vi_soft_memreg_alloc(mr, p_mem, len_bytes);
+
   mr->mr_dma_addrs_base = malloc(n_nic_pages * sizeof(mr->mr_dma_addrs[0]));
   if( mr->mr_dma_addrs_base == NULL )
     return -ENOMEM;
@@ -43,7 +43,8 @@ LIB_SRCS	+=		\
 		vi_discard.c	\
 		checksum.c	\
 		capabilities.c	\
-		ctpio.c
+		ctpio.c		\
+		soft_vi.c
 
 # librt is needed on old glibc, e.g. on RHEL 6
 MMAKE_DIR_LINKFLAGS	:= $(MMAKE_DIR_LINKFLAGS) -lrt
@@ -52,6 +52,9 @@ static int __ef_pd_alloc(ef_pd* pd, ef_driver_handle pd_dh,
   if( flags & EF_PD_VF )
     flags |= EF_PD_PHYS_MODE;
 
+  if( ef_vi_soft_link_name() != NULL )
+    return ef_vi_soft_pd_alloc(pd, ifindex, flags);
+
   memset(&ra, 0, sizeof(ra));
   ef_vi_set_intf_ver(ra.intf_ver, sizeof(ra.intf_ver));
   ra.ra_type = EFRM_RESOURCE_PD;
@@ -367,6 +367,9 @@ int __ef_vi_alloc(ef_vi* vi, ef_driver_handle vi_dh,
 
   if( pd_or_vi_set_dh < 0 )
     return -EINVAL;
+  if( ef_vi_soft_link_name() != NULL )
+    return ef_vi_soft_alloc(vi, evq_capacity, rxq_capacity, txq_capacity,
+                            evq, vi_flags);
   if( (vi_flags & EF_VI_TX_ALT) && (vi_flags & EF_VI_TX_TIMESTAMPS) ) {
     LOGVV(ef_log("%s: ERROR: EF_VI_TX_ALT and EF_VI_TX_TIMESTAMPS not "
                  "supported together", __func__));
@@ -634,6 +637,9 @@ int ef_vi_free(ef_vi* ep, ef_driver_handle fd)
 {
   int rc;
 
+  if( ef_vi_is_soft(ep) )
+    return ef_vi_soft_free(ep);
+
   if( ep->vi_ctpio_mmap_ptr != NULL ) {
     rc = ci_resource_munmap(fd, ep->vi_ctpio_mmap_ptr, CTPIO_MMAP_LEN);
     if( rc < 0 ) {
@@ -676,6 +682,9 @@ unsigned ef_vi_mtu(ef_vi* vi, ef_driver_handle fd)
   ci_resource_op_t op;
   int rc;
 
+  if( ef_vi_is_soft(vi) )
+    return 1500;
+
   op.op = CI_RSOP_VI_GET_MTU;
   op.id = efch_make_resource_id(vi->vi_resource_id);
   rc = ci_resource_op(fd, &op);
@@ -690,6 +699,9 @@ int ef_vi_get_mac(ef_vi* vi, ef_driver_handle dh, void* mac_out)
   ci_resource_op_t op;
   int rc;
 
+  if( ef_vi_is_soft(vi) )
+    return ef_vi_soft_get_mac(vi, mac_out);
+
   op.op = CI_RSOP_VI_GET_MAC;
   op.id = efch_make_resource_id(vi->vi_resource_id);
   rc = ci_resource_op(dh, &op);
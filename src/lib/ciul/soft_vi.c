@@ -0,0 +1,714 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This library is free software; you can redistribute it and/or
+** modify it under the terms of version 2.1 of the GNU Lesser General Public
+** License as published by the Free Software Foundation.
+**
+** This library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+** Lesser General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Software emulated VI, for use without a Solarflare adapter.
+**   \date  2019/06/10
+**    \cop  (c) Solarflare Communications Inc.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* A soft VI implements the ef_vi ops table entirely in software.  It is
+ * selected by setting EF_VI_SOFT=<link-name> in the environment, in which
+ * case ef_driver_open(), ef_pd_alloc(), ef_memreg_alloc() and
+ * ef_vi_alloc_from_pd() do not talk to the driver at all.
+ *
+ * Two VIs attach to a "link", which is a POSIX shared memory object
+ * holding one frame ring per direction.  The VIs can be in the same
+ * process or in different processes, so eg. "eflatency ping" and
+ * "eflatency pong" can be run against each other on a machine without a
+ * Solarflare adapter.
+ *
+ * In a soft PD the ef_addr of registered memory is just its virtual
+ * address, so the "NIC" can copy frames to and from packet buffers
+ * directly.  Transmit copies the frame onto the link when the doorbell is
+ * rung; receive copies frames off the link into posted buffers when the
+ * event queue is polled.  The link is lossless: when the peer's ring is
+ * full, transmit descriptors stay pending until there is space.
+ */
+
+#include "ef_vi_internal.h"
+#include "logging.h"
+#include <etherfabric/memreg.h>
+#include <ci/efhw/common.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+
+#define SOFT_LINK_MAGIC       0x5f7e11c0
+#define SOFT_WIRE_SLOTS       512
+#define SOFT_SLOT_BYTES       2048
+#define SOFT_FRAME_MAX        (SOFT_SLOT_BYTES - sizeof(uint32_t))
+#define SOFT_TX_DESC_CONT     0x1
+
+
+typedef struct {
+  uint32_t  len;
+  uint8_t   data[SOFT_FRAME_MAX];
+} soft_slot;
+
+
+/* One direction of a link: single producer, single consumer. */
+typedef struct {
+  volatile uint32_t  added;
+  uint8_t            pad0[EF_VI_DMA_ALIGN - sizeof(uint32_t)];
+  volatile uint32_t  removed;
+  uint8_t            pad1[EF_VI_DMA_ALIGN - sizeof(uint32_t)];
+  soft_slot          slots[SOFT_WIRE_SLOTS];
+} soft_wire;
+
+
+/* Layout of the shared memory object.  wire[i] carries frames to port i. */
+typedef struct {
+  uint32_t           magic;
+  volatile uint32_t  ports_used;
+  uint8_t            pad0[EF_VI_DMA_ALIGN - 2 * sizeof(uint32_t)];
+  soft_wire          wire[2];
+} soft_link;
+
+
+typedef struct {
+  ef_addr   addr;
+  uint32_t  len;
+  uint32_t  flags;
+} soft_tx_desc;
+
+
+/* Private per-VI state.  Hangs off [vi->io], which is otherwise unused by
+ * a soft VI as there are no registers.
+ */
+typedef struct {
+  soft_link*  link;
+  char        link_name[NAME_MAX];
+  int         port;
+  soft_wire*  tx_wire;
+  soft_wire*  rx_wire;
+  /* TX descriptors consumed by the "NIC", and how many of those we've
+   * reported completion for.
+   */
+  uint32_t    tx_done;
+  uint32_t    tx_reported;
+  uint8_t     mac[6];
+  /* RX then TX descriptor rings, in one allocation. */
+  char*       rings;
+} soft_port;
+
+
+#define SOFT_PORT(vi)  ((soft_port*) (vi)->io)
+
+
+const char* ef_vi_soft_link_name(void)
+{
+  const char* s = getenv("EF_VI_SOFT");
+  return (s != NULL && *s != '\0') ? s : NULL;
+}
+
+
+int ef_vi_is_soft(const ef_vi* vi)
+{
+  return vi->nic_type.arch == EF_VI_ARCH_SOFT;
+}
+
+
+/**********************************************************************
+ * Link attach/detach.
+ */
+
+static int soft_link_attach(soft_port* sp, const char* name)
+{
+  soft_link* link;
+  const char* s;
+  int fd, port, rc;
+
+  snprintf(sp->link_name, sizeof(sp->link_name), "/ef_vi_soft_%s", name);
+  fd = shm_open(sp->link_name, O_RDWR | O_CREAT, 0600);
+  if( fd < 0 ) {
+    LOGVV(ef_log("%s: shm_open(%s) failed (%d)", __FUNCTION__,
+                 sp->link_name, errno));
+    return -errno;
+  }
+  if( ftruncate(fd, sizeof(soft_link)) < 0 ) {
+    rc = -errno;
+    close(fd);
+    return rc;
+  }
+  link = mmap(NULL, sizeof(soft_link), PROT_READ | PROT_WRITE, MAP_SHARED,
+              fd, 0);
+  rc = -errno;
+  close(fd);
+  if( link == MAP_FAILED )
+    return rc;
+
+  /* A freshly created object is zero filled, so magic doubles as the
+   * "initialised" flag.  Ring indices start at zero either way.
+   */
+  __sync_bool_compare_and_swap(&link->magic, 0, SOFT_LINK_MAGIC);
+  if( link->magic != SOFT_LINK_MAGIC ) {
+    munmap(link, sizeof(soft_link));
+    return -EINVAL;
+  }
+
+  if( (s = getenv("EF_VI_SOFT_PORT")) != NULL ) {
+    port = atoi(s);
+    if( (port != 0 && port != 1) ||
+        (__sync_fetch_and_or(&link->ports_used, 1u << port) & (1u << port)) )
+      port = -1;
+  }
+  else {
+    for( port = 0; port < 2; ++port )
+      if( ! (__sync_fetch_and_or(&link->ports_used, 1u << port) &
+             (1u << port)) )
+        break;
+    if( port == 2 )
+      port = -1;
+  }
+  if( port < 0 ) {
+    LOGVV(ef_log("%s: no free port on link %s", __FUNCTION__, name));
+    munmap(link, sizeof(soft_link));
+    return -EBUSY;
+  }
+
+  sp->link = link;
+  sp->port = port;
+  sp->rx_wire = &link->wire[port];
+  sp->tx_wire = &link->wire[!port];
+  /* Locally administered MAC that identifies the port. */
+  sp->mac[0] = 0x02;
+  sp->mac[1] = 0x00;
+  sp->mac[2] = 0x53;
+  sp->mac[3] = 0x0f;
+  sp->mac[4] = 0x7e;
+  sp->mac[5] = port + 1;
+  return 0;
+}
+
+
+static void soft_link_detach(soft_port* sp)
+{
+  uint32_t bit = 1u << sp->port;
+  if( (__sync_fetch_and_and(&sp->link->ports_used, ~bit) & ~bit) == 0 )
+    shm_unlink(sp->link_name);
+  munmap(sp->link, sizeof(soft_link));
+}
+
+
+/**********************************************************************
+ * The "hardware".
+ */
+
+ef_vi_inline void* soft_addr_to_ptr(ef_addr addr)
+{
+  return (void*) (uintptr_t) addr;
+}
+
+
+/* Move frames described by pushed TX descriptors onto the wire.  Stops
+ * when the peer's ring is full.
+ */
+static void soft_tx_process(ef_vi* vi)
+{
+  soft_port* sp = SOFT_PORT(vi);
+  soft_wire* w = sp->tx_wire;
+  ef_vi_txq* q = &vi->vi_txq;
+  ef_vi_txq_state* qs = &vi->ep_state->txq;
+  soft_tx_desc* dp;
+  soft_slot* slot;
+  uint32_t di, len;
+
+  while( sp->tx_done != qs->previous ) {
+    if( w->added - w->removed >= SOFT_WIRE_SLOTS )
+      break;
+    slot = &w->slots[w->added & (SOFT_WIRE_SLOTS - 1)];
+    len = 0;
+    di = sp->tx_done;
+    do {
+      dp = (soft_tx_desc*) q->descriptors + (di & q->mask);
+      if( len + dp->len <= SOFT_FRAME_MAX )
+        memcpy(slot->data + len, soft_addr_to_ptr(dp->addr), dp->len);
+      len += dp->len;
+      ++di;
+    } while( dp->flags & SOFT_TX_DESC_CONT );
+    sp->tx_done = di;
+    if( len > SOFT_FRAME_MAX ) {
+      /* Too big for the link: the frame is dropped, just as an
+       * oversized frame would be dropped by the MAC.
+       */
+      LOGVV(ef_log("%s: dropped %u byte frame", __FUNCTION__, len));
+      continue;
+    }
+    slot->len = len;
+    wmb();
+    ++w->added;
+  }
+}
+
+
+static int soft_rx_frames_ready(const ef_vi* vi)
+{
+  soft_wire* w = SOFT_PORT(vi)->rx_wire;
+  const ef_vi_rxq_state* qs = &vi->ep_state->rxq;
+  uint32_t frames = w->added - w->removed;
+  uint32_t bufs = qs->posted - qs->removed;
+  if( ! vi->vi_rxq.mask )
+    return 0;
+  return frames < bufs ? frames : bufs;
+}
+
+
+static int soft_rx_event(ef_vi* vi, int q_label, ef_event* ev_out)
+{
+  soft_wire* w = SOFT_PORT(vi)->rx_wire;
+  ef_vi_rxq* q = &vi->vi_rxq;
+  ef_vi_rxq_state* qs = &vi->ep_state->rxq;
+  soft_slot* slot;
+  uint32_t di, len, space;
+  ef_addr* dp;
+
+  smp_rmb();
+  slot = &w->slots[w->removed & (SOFT_WIRE_SLOTS - 1)];
+  di = qs->removed & q->mask;
+  dp = (ef_addr*) q->descriptors + di;
+  len = slot->len;
+  space = vi->rx_buffer_len - vi->rx_prefix_len;
+
+  ev_out->rx.q_id = q_label;
+  ev_out->rx.rq_id = q->ids[di];
+  ev_out->rx.flags = EF_EVENT_FLAG_SOP;
+  if( len <= space ) {
+    ev_out->rx.type = EF_EVENT_TYPE_RX;
+    ev_out->rx.len = len + vi->rx_prefix_len;
+    memcpy((char*) soft_addr_to_ptr(*dp) + vi->rx_prefix_len,
+           slot->data, len);
+  }
+  else {
+    ev_out->rx_discard.type = EF_EVENT_TYPE_RX_DISCARD;
+    ev_out->rx_discard.len = vi->rx_buffer_len;
+    ev_out->rx_discard.subtype = EF_EVENT_RX_DISCARD_TRUNC;
+    memcpy((char*) soft_addr_to_ptr(*dp) + vi->rx_prefix_len,
+           slot->data, space);
+  }
+  q->ids[di] = EF_REQUEST_ID_MASK;
+  ++qs->removed;
+
+  /* Must finish reading the slot before handing it back to the sender.
+   * The hand-back is a store, so a read barrier does not order it.
+   */
+  smp_mb();
+  ++w->removed;
+  return 1;
+}
+
+
+static int soft_tx_event(ef_vi* vi, int q_label, ef_event* ev_out)
+{
+  soft_port* sp = SOFT_PORT(vi);
+  uint32_t n = sp->tx_done - sp->tx_reported;
+
+  /* ef_vi_transmit_unbundle() requires completions to be batched. */
+  if( n > EF_VI_TRANSMIT_BATCH )
+    n = EF_VI_TRANSMIT_BATCH;
+  sp->tx_reported += n;
+  ev_out->tx.type = EF_EVENT_TYPE_TX;
+  ev_out->tx.q_id = q_label;
+  ev_out->tx.flags = 0;
+  ev_out->tx.desc_id = sp->tx_reported & vi->vi_txq.mask;
+  return 1;
+}
+
+
+static int soft_ef_eventq_poll(ef_vi* evq, ef_event* evs, int evs_len)
+{
+  int i, n_evs = 0;
+
+  for( i = 0; i < evq->vi_qs_n && n_evs < evs_len; ++i ) {
+    ef_vi* vi = evq->vi_qs[i];
+    if( vi->vi_txq.mask ) {
+      soft_tx_process(vi);
+      if( SOFT_PORT(vi)->tx_done != SOFT_PORT(vi)->tx_reported )
+        n_evs += soft_tx_event(vi, i, &evs[n_evs]);
+    }
+    while( n_evs < evs_len && soft_rx_frames_ready(vi) )
+      n_evs += soft_rx_event(vi, i, &evs[n_evs]);
+  }
+
+  evq->ep_state->evq.evq_ptr += n_evs * EF_VI_EV_SIZE;
+  return n_evs;
+}
+
+
+int ef_vi_soft_eventq_has_many_events(const ef_vi* evq, int look_ahead)
+{
+  int i, n = 0;
+
+  for( i = 0; i < evq->vi_qs_n; ++i ) {
+    ef_vi* vi = evq->vi_qs[i];
+    soft_port* sp = SOFT_PORT(vi);
+    /* Only frames that have made it onto the wire are completions.  A
+     * frame held back by a full wire is not, or a caller waiting for
+     * events would be woken to find none.
+     */
+    if( vi->vi_txq.mask ) {
+      soft_tx_process(vi);
+      if( sp->tx_done != sp->tx_reported )
+        ++n;
+    }
+    n += soft_rx_frames_ready(vi);
+  }
+  return n > look_ahead;
+}
+
+
+int ef_vi_soft_eventq_wait(ef_vi* evq, const struct timeval* timeout)
+{
+  struct timeval now, end;
+
+  if( timeout != NULL ) {
+    gettimeofday(&end, NULL);
+    timeradd(&end, timeout, &end);
+  }
+  while( ! ef_vi_soft_eventq_has_many_events(evq, 0) ) {
+    if( timeout != NULL && (timeout->tv_sec || timeout->tv_usec) ) {
+      gettimeofday(&now, NULL);
+      if( timercmp(&now, &end, >=) )
+        return -ETIMEDOUT;
+    }
+    sched_yield();
+  }
+  return 0;
+}
+
+
+/**********************************************************************
+ * ef_vi ops.
+ */
+
+static int soft_ef_vi_transmitv_init(ef_vi* vi, const ef_iovec* iov,
+                                     int iov_len, ef_request_id dma_id)
+{
+  ef_vi_txq* q = &vi->vi_txq;
+  ef_vi_txq_state* qs = &vi->ep_state->txq;
+  soft_tx_desc* dp;
+  unsigned di = 0;
+  int i;
+
+  EF_VI_BUG_ON(iov_len <= 0);
+  EF_VI_BUG_ON(iov == NULL);
+  EF_VI_BUG_ON((dma_id & EF_REQUEST_ID_MASK) != dma_id);
+
+  if( qs->added - qs->removed + iov_len > q->mask )
+    return -EAGAIN;
+
+  for( i = 0; i < iov_len; ++i ) {
+    di = qs->added++ & q->mask;
+    dp = (soft_tx_desc*) q->descriptors + di;
+    dp->addr = iov[i].iov_base;
+    dp->len = iov[i].iov_len;
+    dp->flags = (i == iov_len - 1) ? 0 : SOFT_TX_DESC_CONT;
+  }
+
+  EF_VI_BUG_ON(q->ids[di] != EF_REQUEST_ID_MASK);
+  q->ids[di] = dma_id;
+  return 0;
+}
+
+
+static void soft_ef_vi_transmit_push(ef_vi* vi)
+{
+  vi->ep_state->txq.previous = vi->ep_state->txq.added;
+  soft_tx_process(vi);
+}
+
+
+static int soft_ef_vi_transmit(ef_vi* vi, ef_addr base, int len,
+                               ef_request_id dma_id)
+{
+  ef_iovec iov = { base, len };
+  int rc = soft_ef_vi_transmitv_init(vi, &iov, 1, dma_id);
+  if( rc == 0 )
+    soft_ef_vi_transmit_push(vi);
+  return rc;
+}
+
+
+static int soft_ef_vi_transmitv(ef_vi* vi, const ef_iovec* iov, int iov_len,
+                                ef_request_id dma_id)
+{
+  int rc = soft_ef_vi_transmitv_init(vi, iov, iov_len, dma_id);
+  if( rc == 0 )
+    soft_ef_vi_transmit_push(vi);
+  return rc;
+}
+
+
+static int soft_ef_vi_transmit_pio(ef_vi* vi, int offset, int len,
+                                   ef_request_id dma_id)
+{
+  return -EOPNOTSUPP;
+}
+
+
+static int soft_ef_vi_transmit_copy_pio(ef_vi* vi, int offset,
+                                        const void* src_buf, int len,
+                                        ef_request_id dma_id)
+{
+  return -EOPNOTSUPP;
+}
+
+
+static void soft_ef_vi_transmit_pio_warm(ef_vi* vi)
+{
+}
+
+
+static void soft_ef_vi_transmit_copy_pio_warm(ef_vi* vi, int pio_offset,
+                                              const void* src_buf, int len)
+{
+}
+
+
+static void soft_ef_vi_transmitv_ctpio(ef_vi* vi, size_t frame_len,
+                                       const struct iovec* iov, int iovcnt,
+                                       unsigned threshold)
+{
+  /* We return an error in ef_vi_transmit_ctpio_fallback(). */
+}
+
+
+static int soft_ef_vi_transmit_alt_op(ef_vi* vi, unsigned alt_id)
+{
+  return -EOPNOTSUPP;
+}
+
+
+static int soft_ef_vi_transmit_alt_select_default(ef_vi* vi)
+{
+  return -EOPNOTSUPP;
+}
+
+
+static int soft_ef_vi_receive_init(ef_vi* vi, ef_addr addr,
+                                   ef_request_id dma_id)
+{
+  ef_vi_rxq* q = &vi->vi_rxq;
+  ef_vi_rxq_state* qs = &vi->ep_state->rxq;
+  unsigned di;
+
+  if( ef_vi_receive_space(vi) ) {
+    di = qs->added++ & q->mask;
+    EF_VI_BUG_ON(q->ids[di] != EF_REQUEST_ID_MASK);
+    q->ids[di] = dma_id;
+    ((ef_addr*) q->descriptors)[di] = addr;
+    return 0;
+  }
+  return -EAGAIN;
+}
+
+
+static void soft_ef_vi_receive_push(ef_vi* vi)
+{
+  vi->ep_state->rxq.posted = vi->ep_state->rxq.added;
+}
+
+
+static void soft_ef_eventq_prime(ef_vi* vi)
+{
+}
+
+
+static void soft_ef_eventq_timer_op(ef_vi* vi, unsigned v)
+{
+}
+
+
+static void soft_ef_eventq_timer_clear(ef_vi* vi)
+{
+}
+
+
+void soft_vi_init(ef_vi* vi)
+{
+  vi->rx_buffer_len = 2048 - 256;
+  vi->rx_discard_mask = 0;
+
+  vi->ops.transmit               = soft_ef_vi_transmit;
+  vi->ops.transmitv              = soft_ef_vi_transmitv;
+  vi->ops.transmitv_init         = soft_ef_vi_transmitv_init;
+  vi->ops.transmit_push          = soft_ef_vi_transmit_push;
+  vi->ops.transmit_pio           = soft_ef_vi_transmit_pio;
+  vi->ops.transmit_copy_pio      = soft_ef_vi_transmit_copy_pio;
+  vi->ops.transmit_pio_warm      = soft_ef_vi_transmit_pio_warm;
+  vi->ops.transmit_copy_pio_warm = soft_ef_vi_transmit_copy_pio_warm;
+  vi->ops.transmitv_ctpio        = soft_ef_vi_transmitv_ctpio;
+  vi->ops.transmit_alt_select    = soft_ef_vi_transmit_alt_op;
+  vi->ops.transmit_alt_select_default = soft_ef_vi_transmit_alt_select_default;
+  vi->ops.transmit_alt_stop      = soft_ef_vi_transmit_alt_op;
+  vi->ops.transmit_alt_go        = soft_ef_vi_transmit_alt_op;
+  vi->ops.transmit_alt_discard   = soft_ef_vi_transmit_alt_op;
+  vi->ops.receive_init           = soft_ef_vi_receive_init;
+  vi->ops.receive_push           = soft_ef_vi_receive_push;
+  vi->ops.eventq_poll            = soft_ef_eventq_poll;
+  vi->ops.eventq_prime           = soft_ef_eventq_prime;
+  vi->ops.eventq_timer_prime     = soft_ef_eventq_timer_op;
+  vi->ops.eventq_timer_run       = soft_ef_eventq_timer_op;
+  vi->ops.eventq_timer_clear     = soft_ef_eventq_timer_clear;
+  vi->ops.eventq_timer_zero      = soft_ef_eventq_timer_clear;
+}
+
+
+/**********************************************************************
+ * Resource allocation.
+ */
+
+int ef_vi_soft_pd_alloc(ef_pd* pd, int ifindex, enum ef_pd_flags flags)
+{
+  if( flags & (EF_PD_VF | EF_PD_PHYS_MODE | EF_PD_RX_PACKED_STREAM) )
+    return -EOPNOTSUPP;
+
+  memset(pd, 0, sizeof(*pd));
+  pd->pd_flags = flags;
+  pd->pd_resource_id = 0;
+  pd->pd_intf_name = strdup(ef_vi_soft_link_name());
+  if( pd->pd_intf_name == NULL )
+    return -ENOMEM;
+  pd->pd_cluster_name = NULL;
+  pd->pd_cluster_sock = -1;
+  pd->pd_cluster_dh = 0;
+  pd->pd_cluster_viset_resource_id = 0;
+  return 0;
+}
+
+
+int ef_vi_soft_memreg_alloc(ef_memreg* mr, void* p_mem, size_t len_bytes)
+{
+  size_t i, n_nic_pages;
+
+  n_nic_pages = (len_bytes + EFHW_NIC_PAGE_SIZE - 1) >> EFHW_NIC_PAGE_SHIFT;
+  mr->mr_dma_addrs_base = malloc(n_nic_pages * sizeof(mr->mr_dma_addrs[0]));
+  if( mr->mr_dma_addrs_base == NULL )
+    return -ENOMEM;
+  for( i = 0; i < n_nic_pages; ++i )
+    mr->mr_dma_addrs_base[i] =
+      (uintptr_t) p_mem + (i << EFHW_NIC_PAGE_SHIFT);
+  mr->mr_dma_addrs = mr->mr_dma_addrs_base;
+  return 0;
+}
+
+
+int ef_vi_soft_alloc(ef_vi* vi, int evq_capacity, int rxq_capacity,
+                     int txq_capacity, ef_vi* evq, enum ef_vi_flags vi_flags)
+{
+  ef_vi_state* state;
+  soft_port* sp;
+  char* rings;
+  uint32_t* ids;
+  int rc;
+
+  if( vi_flags & (EF_VI_RX_PACKED_STREAM | EF_VI_RX_EVENT_MERGE |
+                  EF_VI_RX_TIMESTAMPS | EF_VI_TX_TIMESTAMPS |
+                  EF_VI_TX_ALT | EF_VI_TX_CTPIO |
+                  EF_VI_TX_PHYS_ADDR | EF_VI_RX_PHYS_ADDR) ) {
+    LOGVV(ef_log("%s: ERROR: flags %x not supported by soft VI",
+                 __FUNCTION__, vi_flags));
+    return -EOPNOTSUPP;
+  }
+
+  if( evq != NULL && evq->vi_qs_n == EF_VI_MAX_QS )
+    return -EBUSY;
+  if( evq_capacity < 0 )
+    evq_capacity = 1024;
+  if( rxq_capacity < 0 )
+    rxq_capacity = 512;
+  if( txq_capacity < 0 )
+    txq_capacity = 512;
+  if( (rxq_capacity && ! EF_VI_IS_POW2(rxq_capacity)) ||
+      (txq_capacity && ! EF_VI_IS_POW2(txq_capacity)) )
+    return -EINVAL;
+
+  rc = -ENOMEM;
+  sp = calloc(1, sizeof(*sp));
+  if( sp == NULL )
+    goto fail1;
+  state = malloc(ef_vi_calc_state_bytes(rxq_capacity, txq_capacity));
+  if( state == NULL )
+    goto fail2;
+  rings = malloc(rxq_capacity * sizeof(ef_addr) +
+                 txq_capacity * sizeof(soft_tx_desc));
+  if( rings == NULL )
+    goto fail3;
+  if( (rc = soft_link_attach(sp, ef_vi_soft_link_name())) < 0 )
+    goto fail4;
+  sp->rings = rings;
+
+  ids = (void*) (state + 1);
+  ef_vi_init(vi, EF_VI_ARCH_SOFT, 'S', 0, vi_flags, 0, state);
+  ef_vi_init_out_flags(vi, 0);
+  ef_vi_init_io(vi, (char*) sp);
+  /* There is no event ring: events are synthesised when polled.  We
+   * still record a capacity so that ef_eventq_capacity() is sensible.
+   */
+  if( evq == NULL )
+    ef_vi_init_evq(vi, evq_capacity, NULL);
+  if( rxq_capacity ) {
+    ef_vi_init_rxq(vi, rxq_capacity, rings, ids, 0);
+    rings += rxq_capacity * sizeof(ef_addr);
+    ids += rxq_capacity;
+  }
+  if( txq_capacity )
+    ef_vi_init_txq(vi, txq_capacity, rings, ids);
+  vi->vi_i = sp->port;
+  ef_vi_init_state(vi);
+  rc = ef_vi_add_queue(evq != NULL ? evq : vi, vi);
+  EF_VI_BUG_ON(evq == NULL && rc != 0);
+  return rc;
+
+ fail4:
+  free(rings);
+ fail3:
+  free(state);
+ fail2:
+  free(sp);
+ fail1:
+  return rc;
+}
+
+
+int ef_vi_soft_free(ef_vi* vi)
+{
+  soft_port* sp = SOFT_PORT(vi);
+  soft_link_detach(sp);
+  free(sp->rings);
+  free(sp);
+  free(vi->ep_state);
+  EF_VI_DEBUG(memset(vi, 0, sizeof(*vi)));
+  return 0;
+}
+
+
+int ef_vi_soft_get_mac(ef_vi* vi, void* mac_out)
+{
+  memcpy(mac_out, SOFT_PORT(vi)->mac, 6);
+  return 0;
+}
+
+/*! \cidoxg_end */
@@ -101,6 +101,7 @@ typedef uint64_t ef_vi_dma_addr_t;
 #  define mmiowb()    do{}while(0)
 #  define dma_wmb()   __asm__ __volatile__("": : :"memory")
 #  define smp_rmb()   __asm__ __volatile__("lfence": : :"memory")
+#  define smp_mb()    __asm__ __volatile__("mfence": : :"memory")
 
 # elif defined(__PPC__)
 #  define wmb()       __asm__ __volatile__("sync" : : :"memory")
@@ -108,6 +109,7 @@ typedef uint64_t ef_vi_dma_addr_t;
 #  define mmiowb()    __asm__ __volatile__("sync" : : :"memory")
 #  define dma_wmb()   __asm__ __volatile__("sync" : : :"memory")
 #  define smp_rmb()   __asm__ __volatile__("lwsync": : :"memory")
+#  define smp_mb()    __asm__ __volatile__("sync": : :"memory")
 
 # elif defined(__aarch64__)
 #  define wmb()      __asm__ __volatile__ ("dsb st" : : : "memory")
@@ -115,6 +117,7 @@ typedef uint64_t ef_vi_dma_addr_t;
 #  define mmiowb()    do{}while(0)
 #  define dma_wmb()   __asm__ __volatile__ ("dsb oshst" : : : "memory")
 #  define smp_rmb()  __asm__ __volatile__ ("dmb ishld" : : : "memory")
+#  define smp_mb()   __asm__ __volatile__ ("dmb ish" : : : "memory")
 
 
 # else
@@ -203,6 +203,8 @@ static int rx_desc_bytes(struct ef_vi* vi)
     return (vi->vi_flags & EF_VI_RX_PHYS_ADDR) ? 8 : 4;
   case EF_VI_ARCH_EF10:
     return 8;
+  case EF_VI_ARCH_SOFT:
+    return 8;
   default:
     EF_VI_BUG_ON(1);
     return 8;
@@ -217,6 +219,8 @@ static int tx_desc_bytes(struct ef_vi* vi)
     return 8;
   case EF_VI_ARCH_EF10:
     return 8;
+  case EF_VI_ARCH_SOFT:
+    return 16;
   default:
     EF_VI_BUG_ON(1);
     return 8;
@@ -266,6 +270,11 @@ int ef_vi_init(struct ef_vi* vi, int arch, int variant, int revision,
   case EF_VI_ARCH_EF10:
     ef10_vi_init(vi);
     break;
+#ifndef __KERNEL__
+  case EF_VI_ARCH_SOFT:
+    soft_vi_init(vi);
+    break;
+#endif
   default:
     return -EINVAL;
   }
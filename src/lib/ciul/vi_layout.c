@@ -109,6 +109,10 @@ int ef_vi_receive_query_layout(ef_vi* vi,
     return falcon_query_layout(vi, ef_vi_layout_out, len_out);
   case EF_VI_ARCH_EF10:
     return ef10_query_layout(vi, ef_vi_layout_out, len_out);
+  case EF_VI_ARCH_SOFT:
+    *ef_vi_layout_out = &layout_no_prefix;
+    *len_out = 1;
+    return 0;
   default:
     EF_VI_BUG_ON(1);
     return -EINVAL;
@@ -31,6 +31,8 @@
 int ef_vi_prime(ef_vi* vi, ef_driver_handle dh, unsigned current_ptr)
 {
   ci_resource_prime_op_t  op;
+  if( ef_vi_is_soft(vi) )
+    return 0;
   op.crp_id = efch_make_resource_id(vi->vi_resource_id);
   op.crp_current_ptr = current_ptr;
   return ci_resource_prime(dh, &op);
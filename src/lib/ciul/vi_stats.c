@@ -84,6 +84,8 @@ ef_vi_stats_query_layout(ef_vi* vi,
     return falcon_query_layout(vi, layout_out);
   case EF_VI_ARCH_EF10:
     return ef10_query_layout(vi, layout_out);
+  case EF_VI_ARCH_SOFT:
+    return -EINVAL;
   default:
     EF_VI_BUG_ON(1);
     return -EINVAL;
@@ -117,6 +119,8 @@ ef_vi_stats_query(ef_vi* vi, ef_driver_handle dh, void* data, int do_reset)
     return falcon_query(vi, dh, data, do_reset);
   case EF_VI_ARCH_EF10:
     return ef10_query(vi, dh, data, do_reset);
+  case EF_VI_ARCH_SOFT:
+    return -EINVAL;
   default:
     EF_VI_BUG_ON(1);
     return -EINVAL;
@@ -97,6 +97,74 @@ cp_fwd_find_row(struct cp_mibs* mib, struct cp_fwd_key* key)
   return __cp_fwd_find_row(mib, key, key);
 }
 
+/* Lookup hints for __cp_fwd_find_match().
+ *
+ * The fwd table is laid out by the cplane server, so we can not index it
+ * by prefix.  Instead each client (each process, and the kernel) keeps a
+ * direct-mapped table from the lookup key to the row that last matched
+ * it, and a short list of the prefix pairs that matched most recently.
+ * With many distinct prefixes in the table this turns the common lookup
+ * into a hint read plus one row read, and a lookup for a new destination
+ * usually finds its route on the first probe.
+ *
+ * No locking is needed: a hint is only a guess, and is used only if
+ * cp_fwd_key_match() says the row matches the key, just as for a row
+ * found by probing.  The caller checks the row version as before.  A
+ * hint left by another cplane instance is equally safe.  Concurrent
+ * updates may lose a hint or duplicate an MRU entry, which costs only a
+ * few probes.
+ */
+#define CP_FWD_HINT_N    4096
+#define CP_FWD_PREF_MRU  4
+
+static cicp_mac_rowid_t cp_fwd_hint[CP_FWD_HINT_N];
+
+/* (dst_pref + 1) << 8 | src_pref, or 0 if unused */
+static ci_uint16 cp_fwd_pref_mru[CP_FWD_PREF_MRU];
+
+#define CP_FWD_PREF_PAIR(src_pref, dst_pref) \
+  ((ci_uint16) (((dst_pref) + 1) << 8 | (src_pref)))
+
+static inline cicp_mac_rowid_t*
+cp_fwd_hint_slot(struct cp_fwd_key* key)
+{
+  return &cp_fwd_hint[onload_hash1(AF_INET, CP_FWD_HINT_N - 1,
+                                   &key->dst, key->ifindex,
+                                   &key->src, key->tos,
+                                   key->flag & CP_FWD_KEY_TRANSPARENT)];
+}
+
+static inline int/*bool*/
+cp_fwd_hint_matches(struct cp_mibs* mib, cicp_mac_rowid_t id,
+                    struct cp_fwd_key* key)
+{
+  return CICP_MAC_ROWID_IS_VALID(id) && id <= mib->dim->fwd_mask &&
+         cp_fwd_key_match(cp_get_fwd_by_id(mib, id), key);
+}
+
+static void cp_fwd_pref_mru_touch(ci_uint16 pair)
+{
+  int i;
+
+  if( cp_fwd_pref_mru[0] == pair )
+    return;
+  for( i = 1; i < CP_FWD_PREF_MRU - 1; ++i )
+    if( cp_fwd_pref_mru[i] == pair )
+      break;
+  for( ; i > 0; --i )
+    cp_fwd_pref_mru[i] = cp_fwd_pref_mru[i - 1];
+  cp_fwd_pref_mru[0] = pair;
+}
+
+static inline cicp_mac_rowid_t
+cp_fwd_find_pref(struct cp_mibs* mib, struct cp_fwd_key* key,
+                 struct cp_fwd_key* k, ci_uint8 src_pref, ci_uint8 dst_pref)
+{
+  k->dst = key->dst & cp_prefixlen2bitmask(dst_pref);
+  k->src = key->src & cp_prefixlen2bitmask(src_pref);
+  return __cp_fwd_find_row(mib, k, key);
+}
+
 cicp_mac_rowid_t
 __cp_fwd_find_match(struct cp_mibs* mib, struct cp_fwd_key* key,
                     ci_uint64 src_prefs_in, ci_uint64 dst_prefs)
@@ -104,30 +172,77 @@ __cp_fwd_find_match(struct cp_mibs* mib, struct cp_fwd_key* key,
   ci_uint64 src_prefs;
   ci_uint8 src_pref, dst_pref;
   struct cp_fwd_key k = *key;
+  cicp_mac_rowid_t* hint = cp_fwd_hint_slot(key);
+  cicp_mac_rowid_t hint_id = OO_ACCESS_ONCE(*hint);
+  cicp_mac_rowid_t id;
+  ci_uint16 pair, tried[CP_FWD_PREF_MRU];
+  int i, n_tried = 0;
+
+  if( ! cp_fwd_hint_matches(mib, hint_id, key) )
+    hint_id = CICP_MAC_ROWID_BAD;
 
   /* We must check entries with large destination prefixes (/32 for IPv4)
    * first to ensure we get correct PMTU information.  All other prefixes
    * are equally good.
    */
+  if( hint_id != CICP_MAC_ROWID_BAD &&
+      cp_get_fwd_by_id(mib, hint_id)->key_ext.dst_prefix == 32 )
+    return hint_id;
+  if( dst_prefs & (1ull << 32) ) {
+    dst_pref = 32;
+    for( src_prefs = src_prefs_in;
+         src_prefs != 0;
+         src_prefs &= ~(1ull << src_pref) ) {
+      src_pref = cp_get_largest_prefix(src_prefs);
+      id = cp_fwd_find_pref(mib, key, &k, src_pref, dst_pref);
+      if( id != CICP_ROWID_BAD )
+        goto found;
+    }
+    dst_prefs &= ~(1ull << 32);
+  }
+  if( hint_id != CICP_MAC_ROWID_BAD )
+    return hint_id;
+
+  for( i = 0; i < CP_FWD_PREF_MRU; ++i ) {
+    pair = OO_ACCESS_ONCE(cp_fwd_pref_mru[i]);
+    if( pair == 0 )
+      break;
+    dst_pref = (pair >> 8) - 1;
+    src_pref = pair & 0xff;
+    if( ! ((dst_prefs >> dst_pref) & (src_prefs_in >> src_pref) & 1) )
+      continue;
+    tried[n_tried++] = pair;
+    id = cp_fwd_find_pref(mib, key, &k, src_pref, dst_pref);
+    if( id != CICP_ROWID_BAD )
+      goto found;
+  }
+
   for( ; dst_prefs != 0; dst_prefs &= ~(1ull << dst_pref) ) {
     dst_pref = cp_get_largest_prefix(dst_prefs);
-    k.dst = key->dst & cp_prefixlen2bitmask(dst_pref);
 
     for( src_prefs = src_prefs_in;
          src_prefs != 0;
          src_prefs &= ~(1ull << src_pref) ) {
-      cicp_mac_rowid_t id;
-
       src_pref = cp_get_largest_prefix(src_prefs);
-      k.src = key->src & cp_prefixlen2bitmask(src_pref);
-
-      id = __cp_fwd_find_row(mib, &k, key);
+      pair = CP_FWD_PREF_PAIR(src_pref, dst_pref);
+      for( i = 0; i < n_tried; ++i )
+        if( tried[i] == pair )
+          break;
+      if( i < n_tried )
+        continue;
+
+      id = cp_fwd_find_pref(mib, key, &k, src_pref, dst_pref);
       if( id != CICP_ROWID_BAD )
-        return id;
+        goto found;
     }
   }
 
   return CICP_ROWID_BAD;
+
+ found:
+  *hint = id;
+  cp_fwd_pref_mru_touch(CP_FWD_PREF_PAIR(src_pref, dst_pref));
+  return id;
 }
 
 
@@ -249,7 +249,7 @@ static void oo_iobufset_free_pages(struct oo_buffer_pages *pages)
 
 static int oo_bufpage_alloc(struct oo_buffer_pages **pages_out,
                             int user_order, int low_order,
-                            int *flags, int gfp_flag)
+                            int *flags, int gfp_flag, int numa_node)
 {
   int i;
   struct oo_buffer_pages *pages;
@@ -307,7 +307,7 @@ static int oo_bufpage_alloc(struct oo_buffer_pages **pages_out,
   }
 
   for( i = 0; i < n_bufs; ++i ) {
-    pages->pages[i] = alloc_pages_node(numa_node_id(), gfp_flag, low_order);
+    pages->pages[i] = alloc_pages_node(numa_node, gfp_flag, low_order);
     if( pages->pages[i] == NULL ) {
       OO_DEBUG_VERB(ci_log("%s: failed to allocate page (i=%u) "
                            "user_order=%d page_order=%d",
@@ -332,7 +332,7 @@ void oo_iobufset_pages_release(struct oo_buffer_pages *pages)
 }
 
 int
-oo_iobufset_pages_alloc(int nic_order, int *flags,
+oo_iobufset_pages_alloc(int nic_order, int *flags, int numa_node,
                         struct oo_buffer_pages **pages_out)
 {
   int rc;
@@ -341,10 +341,14 @@ oo_iobufset_pages_alloc(int nic_order, int *flags,
 
   ci_assert(pages_out);
 
+  if( numa_node < 0 )
+    numa_node = numa_node_id();
+
 #if CI_CFG_PKTS_AS_HUGE_PAGES
   if( *flags & OO_IOBUFSET_FLAG_HUGE_PAGE_FORCE ) {
 # ifdef OO_DO_HUGE_PAGES
-    rc = oo_bufpage_alloc(pages_out, order, order, flags, gfp_flag);
+    rc = oo_bufpage_alloc(pages_out, order, order, flags, gfp_flag,
+                          numa_node);
 # else
     rc = -ENOMEM;
 # endif
@@ -371,7 +375,8 @@ oo_iobufset_pages_alloc(int nic_order, int *flags,
        * x86: 9(hugepage),8,4,0
        * ppc: 4(max,=9nic),3(=8nic),0(=5nic)
        */
-      rc = oo_bufpage_alloc(pages_out, order, low_order, flags, gfp_flag);
+      rc = oo_bufpage_alloc(pages_out, order, low_order, flags, gfp_flag,
+                            numa_node);
       if( rc == 0 || low_order == 0 )
         break;
       low_order -= 3;
@@ -382,11 +387,14 @@ oo_iobufset_pages_alloc(int nic_order, int *flags,
     rc = -ENOMEM;
     if( *flags & (OO_IOBUFSET_FLAG_HUGE_PAGE_TRY |
                  OO_IOBUFSET_FLAG_HUGE_PAGE_FORCE) )
-      rc = oo_bufpage_alloc(pages_out, order, order, flags, gfp_flag);
+      rc = oo_bufpage_alloc(pages_out, order, order, flags, gfp_flag,
+                            numa_node);
     if( rc != 0 )
-      rc = oo_bufpage_alloc(pages_out, order, 0, flags, gfp_flag);
+      rc = oo_bufpage_alloc(pages_out, order, 0, flags, gfp_flag,
+                            numa_node);
 #else
-    rc = oo_bufpage_alloc(pages_out, order, 0, flags, gfp_flag);
+    rc = oo_bufpage_alloc(pages_out, order, 0, flags, gfp_flag,
+                          numa_node);
 #endif
   }
 
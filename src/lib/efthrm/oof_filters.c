@@ -255,6 +255,29 @@ oof_hw_filter_update_hwport_masks(struct oof_manager* fm, int protocol,
 }
 
 
+/* H/w filter operations cannot be done in atomic context, so are done with
+ * [fm_inner_lock] dropped.  While that is so the lists of sockets may be
+ * mid-update, so we tell oof_socket_add_shared() and
+ * oof_socket_del_shared() to keep away.
+ */
+static void oof_hw_op_begin(struct oof_manager* fm)
+{
+  ci_assert(spin_is_locked(&fm->fm_inner_lock));
+  ci_assert(mutex_is_locked(&fm->fm_outer_lock));
+  ci_assert_equal(fm->fm_hw_op_in_progress, 0);
+  fm->fm_hw_op_in_progress = 1;
+  spin_unlock_bh(&fm->fm_inner_lock);
+}
+
+
+static void oof_hw_op_end(struct oof_manager* fm)
+{
+  spin_lock_bh(&fm->fm_inner_lock);
+  ci_assert_equal(fm->fm_hw_op_in_progress, 1);
+  fm->fm_hw_op_in_progress = 0;
+}
+
+
 static int __oof_hw_filter_set(struct oof_manager* fm,
                                struct oof_socket* skf,
                                struct oo_hw_filter* oofilter,
@@ -295,7 +318,7 @@ static int __oof_hw_filter_set(struct oof_manager* fm,
   old_oofilter = *oofilter;
   oo_hw_filter_init2(oofilter, trs, thc);
 
-  spin_unlock_bh(&fm->fm_inner_lock);
+  oof_hw_op_begin(fm);
   ci_assert(!in_atomic());
   oo_hw_filter_clear(&old_oofilter);
 
@@ -305,7 +328,7 @@ static int __oof_hw_filter_set(struct oof_manager* fm,
                         hwport_mask | drop_hwports_mask,
                         drop_hwports_mask,
                         src_flags);
-  spin_lock_bh(&fm->fm_inner_lock);
+  oof_hw_op_end(fm);
 
   if( rc == 0 ) {
     IPF_LOG(FSK_FMT "FILTER "QUIN_FMT"%s", caller, SK_PRI_ARGS(skf),
@@ -345,10 +368,10 @@ static void oof_hw_filter_clear_hwports(struct oof_manager* fm,
     return;
   }
 
-  spin_unlock_bh(&fm->fm_inner_lock);
+  oof_hw_op_begin(fm);
   ci_assert(!in_atomic());
   oo_hw_filter_clear_hwports(oofilter, hwport_mask, 0);
-  spin_lock_bh(&fm->fm_inner_lock);
+  oof_hw_op_end(fm);
 }
 
 
@@ -423,7 +446,7 @@ static int oof_hw_filter_update(struct oof_manager* fm,
   ci_assert(spin_is_locked(&fm->fm_inner_lock));
   ci_assert(mutex_is_locked(&fm->fm_outer_lock));
 
-  spin_unlock_bh(&fm->fm_inner_lock);
+  oof_hw_op_begin(fm);
   ci_assert(!in_atomic());
   oof_hw_filter_update_hwport_masks(fm, protocol, oofilter->thc != NULL,
                                     &hwport_mask, &drop_hwports_mask);
@@ -431,7 +454,7 @@ static int oof_hw_filter_update(struct oof_manager* fm,
                            fm->fm_hwports_vlan_filters & hwport_mask,
                            hwport_mask | drop_hwports_mask, drop_hwports_mask,
                            src_flags);
-  spin_lock_bh(&fm->fm_inner_lock);
+  oof_hw_op_end(fm);
   return rc;
 }
 
@@ -951,7 +974,10 @@ oof_socket_insert_probe(ci_dllist* list, struct oof_socket* skf,
 static int
 lp_hash(int protocol, int lport)
 {
-  return (protocol + lport) & OOF_LOCAL_PORT_TBL_MASK;
+  /* [lport] is in network order: hash in host order so that the low bits
+   * of sequential (e.g. ephemeral) ports are spread across the table.
+   */
+  return (protocol + CI_BSWAP_BE16(lport)) & OOF_LOCAL_PORT_TBL_MASK;
 }
 
 
@@ -970,10 +996,18 @@ oof_manager_alloc(unsigned local_addr_max, void* owner_private)
     ci_free(fm);
     return NULL;
   }
+  fm->fm_local_ports = ci_vmalloc(OOF_LOCAL_PORT_TBL_SIZE *
+                                  sizeof(fm->fm_local_ports[0]));
+  if( fm->fm_local_ports == NULL ) {
+    ci_free(fm->fm_local_addrs);
+    ci_free(fm);
+    return NULL;
+  }
 
   fm->fm_owner_private = owner_private;
   spin_lock_init(&fm->fm_inner_lock);
   mutex_init(&fm->fm_outer_lock);
+  fm->fm_hw_op_in_progress = 0;
   spin_lock_init(&fm->fm_cplane_updates_lock);
   fm->fm_local_addr_n = 0;
   fm->fm_local_addr_max = local_addr_max;
@@ -1029,6 +1063,7 @@ oof_manager_free(struct oof_manager* fm)
     oof_local_interface_details_free(fm, lid);
 
   mutex_destroy(&fm->fm_outer_lock);
+  ci_vfree(fm->fm_local_ports);
   ci_free(fm->fm_local_addrs);
   ci_free(fm);
 }
@@ -2474,6 +2509,64 @@ int oof_socket_can_update_stack(struct oof_manager* fm, struct oof_socket* skf,
 }
 
 
+/* Full-match sockets accepted from a listening socket usually share the
+ * listener's wild filter, so need only a s/w filter and an update to the
+ * count of sharers.  That needs only [fm_inner_lock], so at high connection
+ * rates we do it without [fm_outer_lock], which would otherwise serialise
+ * the add with all h/w filter operations.  We cannot do this while a h/w
+ * filter operation has dropped [fm_inner_lock], nor if it would need any
+ * fix-up of the wild filter: those cases go the usual way.
+ *
+ * Returns true if the socket has been added.
+ */
+static int
+oof_socket_add_shared(struct oof_manager* fm, struct oof_socket* skf,
+                      int protocol, int af_space, ci_addr_t laddr, int lport,
+                      ci_addr_t raddr, int rport)
+{
+  struct oof_local_port* lp;
+  struct oof_local_port_addr* lpa;
+  int la_i, added = 0;
+
+  if( IS_AF_SPACE_IP6(af_space) || lport == 0 || rport == 0 ||
+      ! CI_IPX_ADDR_CMP_ANY(laddr) || ! CI_IPX_ADDR_CMP_ANY(raddr) )
+    return 0;
+
+  spin_lock_bh(&fm->fm_inner_lock);
+  if( fm->fm_hw_op_in_progress || skf->sf_local_port != NULL ||
+      ci_dllist_not_empty(&skf->sf_mcast_memberships) )
+    goto out;
+  if( (lp = oof_local_port_find(fm, protocol, lport)) == NULL ||
+      (la_i = oof_manager_addr_find(fm, laddr)) < 0 )
+    goto out;
+  lpa = &lp->lp_addr[la_i];
+  if( ! oof_local_port_addr_valid(fm, lpa) ||
+      ! oof_socket_can_share_hw_filter(skf, &lpa->lpa_filter) )
+    goto out;
+
+  skf->sf_flags = 0;
+  skf->af_space = af_space;
+  skf->sf_laddr = laddr;
+  skf->sf_raddr = raddr;
+  skf->sf_rport = rport;
+  skf->sf_local_port = lp;
+  if( oof_socket_add_full_sw(skf) != 0 ) {
+    skf->sf_local_port = NULL;
+    goto out;
+  }
+  ++lp->lp_refs;
+  ++lpa->lpa_n_full_sharers;
+  ++fm->fm_local_addrs[la_i].la_sockets;
+  ci_dllist_push(&lpa->lpa_full_socks, &skf->sf_lp_link);
+  IPF_LOG(FSK_FMT "SHARE "SK_ADDR_FMT, FSK_PRI_ARGS(skf), SK_ADDR_ARGS(skf));
+  added = 1;
+
+ out:
+  spin_unlock_bh(&fm->fm_inner_lock);
+  return added;
+}
+
+
 /* Adds a socket or arms a dummy socket
  *
  * Before new socket is added some checks are done:
@@ -2511,6 +2604,13 @@ oof_socket_add(struct oof_manager* fm, struct oof_socket* skf,
   int do_arm_only;
   int inc_laddr_ref = 1;
 
+  if( thc_out != NULL )
+    *thc_out = NULL;
+  if( flags == 0 &&
+      oof_socket_add_shared(fm, skf, protocol, af_space,
+                            laddr, lport, raddr, rport) )
+    return 0;
+
   mutex_lock(&fm->fm_outer_lock);
   spin_lock_bh(&fm->fm_inner_lock);
 
@@ -2531,9 +2631,6 @@ oof_socket_add(struct oof_manager* fm, struct oof_socket* skf,
   ci_assert(lp == NULL || oof_socket_is_dummy(skf));
   ci_assert(dummy || ! no_stack);
 
-  if( thc_out != NULL )
-    *thc_out = NULL;
-
   rc = -EINVAL;
   if( IS_AF_SPACE_IP6(af_space) && protocol != IPPROTO_UDP )
     goto just_unlock;
@@ -2870,6 +2967,68 @@ oof_socket_del_wild(struct oof_manager* fm, struct oof_socket* skf)
 }
 
 
+/* Counterpart of oof_socket_add_shared(): removes a full-match socket
+ * that is sharing a wild filter which is still wanted by a wild socket in
+ * the same stack, so that no fix-up of h/w filters is needed.
+ *
+ * Returns true if the socket has been removed.
+ */
+static int
+oof_socket_del_shared(struct oof_manager* fm, struct oof_socket* skf)
+{
+  struct oof_local_port* lp;
+  struct oof_local_port_addr* lpa;
+  struct oof_local_addr* la;
+  struct oof_socket* wild_skf;
+  int la_i, removed = 0;
+
+  spin_lock_bh(&fm->fm_inner_lock);
+  lp = skf->sf_local_port;
+  if( fm->fm_hw_op_in_progress || lp == NULL ||
+      (skf->sf_flags & ~OOF_SOCKET_SW_FILTER_WAS_REMOVED) != 0 ||
+      ci_dllist_not_empty(&skf->sf_mcast_memberships) ||
+      ! CI_IPX_ADDR_CMP_ANY(skf->sf_laddr) ||
+      ! CI_IPX_ADDR_CMP_ANY(skf->sf_raddr) ||
+      CI_IPX_IS_MULTICAST(skf->sf_laddr) ||
+      ! oo_hw_filter_is_empty(&skf->sf_full_match_filter) ||
+      lp->lp_refs < 2 )
+    goto out;
+  la_i = oof_manager_addr_find(fm, skf->sf_laddr);
+  ci_assert(la_i >= 0 && la_i < fm->fm_local_addr_n);
+  lpa = &lp->lp_addr[la_i];
+  la = &fm->fm_local_addrs[la_i];
+  if( ! oof_local_port_addr_valid(fm, lpa) ||
+      ! oof_socket_can_share_hw_filter(skf, &lpa->lpa_filter) ||
+      (la->la_sockets < 2 && ci_dllist_is_empty(&la->la_active_ifs)) )
+    goto out;
+  /* Without a wild socket still using the filter, removing a sharer may
+   * need the filter to be freed or moved.
+   */
+  wild_skf = oof_wild_socket(lp, lpa);
+  if( wild_skf == NULL ||
+      ! oof_socket_can_share_hw_filter(wild_skf, &lpa->lpa_filter) )
+    goto out;
+
+  IPF_LOG(FSK_FMT IPX_QUIN_FMT, FSK_PRI_ARGS(skf),
+          IPX_QUIN_ARGS(lp->lp_protocol, AF_IP(skf->sf_laddr),
+                        lp->lp_lport, AF_IP(skf->sf_raddr), skf->sf_rport));
+  oof_socket_remove_from_list(skf);
+  oof_socket_del_full_sw(skf, 1);
+  ci_assert(lpa->lpa_n_full_sharers > 0);
+  --lpa->lpa_n_full_sharers;
+  ci_assert(la->la_sockets > 0);
+  --la->la_sockets;
+  --lp->lp_refs;
+  skf->sf_local_port = NULL;
+  skf->sf_flags = 0;
+  removed = 1;
+
+ out:
+  spin_unlock_bh(&fm->fm_inner_lock);
+  return removed;
+}
+
+
 void
 oof_socket_del(struct oof_manager* fm, struct oof_socket* skf)
 {
@@ -2880,6 +3039,9 @@ oof_socket_del(struct oof_manager* fm, struct oof_socket* skf)
   int la_i;
   int dummy;
 
+  if( oof_socket_del_shared(fm, skf) )
+    return;
+
   ci_dllist_init(&mcast_filters);
 
   mutex_lock(&fm->fm_outer_lock);
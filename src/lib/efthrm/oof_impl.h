@@ -24,7 +24,11 @@
 
 #include "oof_tproxy_ipproto.h"
 
-#define OOF_LOCAL_PORT_TBL_SIZE      16
+/* Hash table of [oof_local_port]s.  Every connected socket with its own
+ * ephemeral port has an [oof_local_port], so this needs to be large enough
+ * to keep the chains short with tens of thousands of connections.
+ */
+#define OOF_LOCAL_PORT_TBL_SIZE      4096
 #define OOF_LOCAL_PORT_TBL_MASK      (OOF_LOCAL_PORT_TBL_SIZE - 1)
 
 struct tcp_helper_resource_s;
@@ -166,6 +170,15 @@ struct oof_manager {
    */
   struct mutex fm_outer_lock;
 
+  /* Non-zero while the holder of [fm_outer_lock] has dropped
+   * [fm_inner_lock] to perform a h/w filter operation.  Sockets that only
+   * share an existing wild filter can be added and removed while holding
+   * just [fm_inner_lock], but not while such an operation is in progress.
+   *
+   * Protected by [fm_inner_lock].
+   */
+  int          fm_hw_op_in_progress;
+
   /* The name is misleading - it really protects fm_hwports_* fields */
   spinlock_t   fm_cplane_updates_lock;
 
@@ -174,7 +187,8 @@ struct oof_manager {
   /* Size of fm_local_addrs array */
   int          fm_local_addr_max;
 
-  ci_dllist    fm_local_ports[OOF_LOCAL_PORT_TBL_SIZE];
+  /* Array of OOF_LOCAL_PORT_TBL_SIZE lists of [oof_local_port]s. */
+  ci_dllist*   fm_local_ports;
 
   struct oof_local_addr* fm_local_addrs;
 
@@ -262,7 +262,7 @@ oof_cb_sw_filter_lookup(struct tcp_helper_resource_s* stack,
   tbl_idx = ci_netif_filter_lookup(ni, laddr, lport, raddr, rport, protocol);
   if( tbl_idx < 0 )
     return NULL;
-  sock_id = ni->filter_table->table[tbl_idx].id;
+  sock_id = CI_NETIF_FILTER_ENTRY(ni->filter_table, tbl_idx)->id;
   if( ! IS_VALID_SOCK_ID(ni, sock_id) ) {
     OO_DEBUG_ERR(ci_log("%s: ERROR: %d %s "IPPORT_FMT" "IPPORT_FMT,
                         __FUNCTION__, NI_ID(ni), FMT_PROTOCOL(protocol),
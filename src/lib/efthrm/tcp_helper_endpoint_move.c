@@ -137,17 +137,26 @@ static int efab_file_move_supported_udp(ci_netif *ni, ci_udp_state *us,
   if( ci_udp_recv_q_not_empty(&us->recv_q) ||
       us->zc_kernel_datagram != OO_PP_ID_NULL ||
       us->zc_kernel_datagram_count != 0 ||
-      us->tx_count != 0 || us->tx_async_q != CI_ILL_END ) {
+      us->tx_count != 0 || us->tx_async_q != CI_ILL_END ||
+      oo_atomic_read(&us->tx_async_q_level) != 0 ) {
     if( do_assert ) {
       ci_assert(! ci_udp_recv_q_not_empty(&us->recv_q));
       ci_assert_equal(us->zc_kernel_datagram, OO_PP_ID_NULL);
       ci_assert_equal(us->zc_kernel_datagram_count, 0);
       ci_assert_equal(us->tx_count, 0);
       ci_assert_equal(us->tx_async_q, CI_ILL_END);
+      ci_assert_equal(oo_atomic_read(&us->tx_async_q_level), 0);
     }
     return false;
   }
 
+  /* Sockets with allocated templates are not supported */
+  if( OO_PP_NOT_NULL(us->tmpl_head) ) {
+    if( do_assert )
+      ci_assert(OO_PP_IS_NULL(us->tmpl_head));
+    return false;
+  }
+
   return true;
 }
 
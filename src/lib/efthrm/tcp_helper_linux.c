@@ -1242,15 +1242,20 @@ efab_os_wakeup_epoll3_locked(tcp_helper_resource_t* trs,
                              citp_waitable* sb)
 {
   ci_sb_epoll_state* epoll;
-  ci_uint8 i, tmp;
+  oo_sb_epoll* e;
+  ci_uint32 i, tmp;
+  unsigned base = 0;
 
   ci_assert(OO_PP_NOT_NULL(sb->epoll));
   epoll = ci_ni_aux_p2epoll(&trs->netif, sb->epoll);
 
   CI_READY_LIST_EACH(sb->ready_lists_in_use, tmp, i) {
-    ci_ni_dllist_remove(&trs->netif, &epoll->e[i].ready_link);
+    e = ci_sb_epoll_seek(&trs->netif, &epoll, &base, i);
+    if( e == NULL )
+      break;
+    ci_ni_dllist_remove(&trs->netif, &e->ready_link);
     ci_ni_dllist_put(&trs->netif, &trs->netif.state->ready_lists[i],
-                   &epoll->e[i].ready_link);
+                   &e->ready_link);
     ci_waitable_wakeup_all(&trs->ready_list_waitqs[i]);
   }
 
@@ -1325,7 +1330,7 @@ static void efab_os_wakeup_event(tcp_helper_endpoint_t *ep,
        * flag though until we've got the work ready to do, ie queued it on
        * the os ready list.
        */
-      ci_uint8 i, tmp;
+      ci_uint32 i, tmp;
 
       spin_lock_irqsave(&trs->os_ready_list_lock, flags);
       CI_READY_LIST_EACH(s->b.ready_lists_in_use, tmp, i) {
@@ -213,7 +213,7 @@ oo_trusted_lock_drop(tcp_helper_resource_t* trs, int in_dl_context)
   unsigned l, new_l;
   ci_uint64 sl_flags;
   ci_netif* ni = &trs->netif;
-  int i, tmp;
+  ci_uint32 i, tmp;
 
  again:
   l = trs->trusted_lock;
@@ -1546,6 +1546,9 @@ static int allocate_vis(tcp_helper_resource_t* trs,
   if( ! NI_OPTS(ni).tx_push )
     base_ef_vi_flags |= EF_VI_TX_PUSH_DISABLE;
 
+  /* Set from the first interface whose node is known, below. */
+  ns->nic_numa_node = -1;
+
   OO_STACK_FOR_EACH_INTF_I(ni, intf_i) {
     trs->nic[intf_i].thn_vi_rs = NULL;
     trs->nic[intf_i].thn_vi_mmap_bytes = 0;
@@ -1656,6 +1659,8 @@ static int allocate_vis(tcp_helper_resource_t* trs,
 #endif
     dev = efrm_vi_get_pci_dev(trs_nic->thn_vi_rs);
     strncpy(nsn->pci_dev, pci_name(dev), sizeof(nsn->pci_dev));
+    if( ns->nic_numa_node < 0 )
+      ns->nic_numa_node = dev_to_node(&dev->dev);
     pci_dev_put(dev);
     nsn->pci_dev[sizeof(nsn->pci_dev) - 1] = '\0';
     nsn->vi_instance =
@@ -1985,7 +1990,7 @@ allocate_netif_resources(ci_resource_onload_alloc_t* alloc,
 {
   ci_netif* ni = &trs->netif;
   ci_netif_state* ns;
-  int i, sz, rc, no_table_entries, no_active_wild_pools;
+  int i, sz, rc, no_table_entries, no_table_buckets, no_active_wild_pools;
   int no_active_wild_table_entries;
   int no_seq_table_entries;
   unsigned vi_state_bytes;
@@ -1993,9 +1998,26 @@ allocate_netif_resources(ci_resource_onload_alloc_t* alloc,
   unsigned pio_bufs_ofs = 0;
 #endif
   ci_uint32 filter_table_size;
+  ci_uint32 synrecv_table_buckets, synrecv_table_size;
 #if CI_CFG_IPV6
   ci_uint32 ip6_filter_table_size;
 #endif
+#if CI_CFG_UDP
+  ci_uint32 udp_tx_stage_entries = 0, udp_tx_stage_size = 0;
+#endif
+#if CI_CFG_LAT_HIST
+  ci_uint32 lat_hist_size = 0;
+#endif
+#if CI_CFG_TCPDUMP_RING
+  ci_uint32 capture_ring_size = 0;
+#endif
+#if CI_CFG_STATS_RING
+  ci_uint32 stats_ring_size = 0;
+#endif
+#if CI_CFG_SPIN_ADAPT
+  ci_uint32 spin_adapt_size = 0;
+#endif
+  ci_uint32 tail_ofs;
 
   OO_DEBUG_SHM(ci_log("%s:", __func__));
 
@@ -2067,11 +2089,16 @@ allocate_netif_resources(ci_resource_onload_alloc_t* alloc,
     no_active_wild_table_entries = 0;
   }
 
+  /* The filter tables are arrays of cache-line aligned buckets, and need
+   * at least two of them. */
+  no_table_buckets = CI_MAX(CI_ROUND_UP(no_table_entries,
+                                        CI_NETIF_FILTER_BUCKET_WAYS) >>
+                            CI_NETIF_FILTER_BUCKET_SHIFT, 2);
   filter_table_size = sizeof(ci_netif_filter_table) +
-    sizeof(ci_netif_filter_table_entry) * (no_table_entries - 1);
+    sizeof(ci_netif_filter_table_bucket) * (no_table_buckets - 1);
 #if CI_CFG_IPV6
   ip6_filter_table_size = sizeof(ci_ip6_netif_filter_table) +
-    sizeof(ci_ip6_netif_filter_table_entry) * (no_table_entries - 1);
+    sizeof(ci_ip6_netif_filter_table_bucket) * (no_table_buckets - 1);
 #endif
 
   /* allocate shmbuf for netif state */
@@ -2080,12 +2107,58 @@ allocate_netif_resources(ci_resource_onload_alloc_t* alloc,
     sizeof(oo_pktbuf_manager) + sizeof(oo_pktbuf_set) * ni->pkt_sets_max +
     sizeof(ci_ni_dllist_t) * no_active_wild_table_entries *
                              no_active_wild_pools +
-    sizeof(ci_tcp_prev_seq_t) * no_seq_table_entries + filter_table_size;
+    sizeof(ci_tcp_prev_seq_t) * no_seq_table_entries +
+    CI_CACHE_LINE_SIZE + filter_table_size;
 
 #if CI_CFG_IPV6
   sz += ip6_filter_table_size;
 #endif
 
+  synrecv_table_buckets =
+    ci_tcp_synrecv_table_buckets(NI_OPTS(ni).tcp_synrecv_max);
+  synrecv_table_size = ci_tcp_synrecv_table_bytes(synrecv_table_buckets);
+  sz += CI_CACHE_LINE_SIZE + synrecv_table_size;
+
+#if CI_CFG_UDP
+  if( NI_OPTS(ni).udp_tx_stage_ring != 0 ) {
+    /* At least a cache line of entries per ring. */
+    udp_tx_stage_entries = 1u << ci_log2_ge(NI_OPTS(ni).udp_tx_stage_ring, 3);
+    udp_tx_stage_size = sizeof(ci_udp_tx_stage) +
+      sizeof(ci_udp_tx_stage_entry) * udp_tx_stage_entries *
+      CI_CFG_UDP_TX_STAGE_RINGS;
+    sz += CI_CACHE_LINE_SIZE + udp_tx_stage_size;
+  }
+#endif
+
+#if CI_CFG_LAT_HIST
+  if( NI_OPTS(ni).latency_hist ) {
+    lat_hist_size = sizeof(ci_lat_hists) * NI_OPTS(ni).latency_hist_sockets;
+    sz += CI_CACHE_LINE_SIZE + lat_hist_size;
+  }
+#endif
+
+#if CI_CFG_TCPDUMP_RING
+  if( NI_OPTS(ni).tcpdump_ring_size != 0 ) {
+    capture_ring_size = 1u << ci_log2_ge(NI_OPTS(ni).tcpdump_ring_size, 18);
+    sz += CI_CACHE_LINE_SIZE + OO_CAPTURE_RING_HDR_LEN + capture_ring_size;
+  }
+#endif
+
+#if CI_CFG_STATS_RING
+  if( NI_OPTS(ni).stats_ring_size != 0 ) {
+    stats_ring_size = 1u << ci_log2_ge(NI_OPTS(ni).stats_ring_size, 16);
+    sz += CI_CACHE_LINE_SIZE + OO_STATS_RING_HDR_LEN + stats_ring_size;
+  }
+#endif
+
+#if CI_CFG_SPIN_ADAPT
+  if( NI_OPTS(ni).spin_adapt ) {
+    spin_adapt_size = (NI_OPTS(ni).max_ep_bufs + CI_CFG_N_READY_LISTS) *
+                      sizeof(struct oo_spin_adapt);
+    sz += CI_CACHE_LINE_SIZE + spin_adapt_size;
+  }
+#endif
+
 #if CI_CFG_PIO
   /* Allocate shmbuf for pio regions.  We haven't tried to allocate
    * PIOs yet and we don't know how many ef10s we have.  So just
@@ -2150,18 +2223,96 @@ allocate_netif_resources(ci_resource_onload_alloc_t* alloc,
                                              ns->active_wild_table_entries_n *
                                              ns->active_wild_pools_n);
   ns->seq_table_entries_n = no_seq_table_entries;
-  ns->table_ofs = ns->seq_table_ofs +
-                  (sizeof(ci_tcp_prev_seq_t) * ns->seq_table_entries_n);
+  ns->table_ofs = CI_ROUND_UP(ns->seq_table_ofs +
+                              (sizeof(ci_tcp_prev_seq_t) *
+                               ns->seq_table_entries_n),
+                              CI_CACHE_LINE_SIZE);
   ns->vi_state_bytes = vi_state_bytes;
 
 #if CI_CFG_IPV6
   ns->ip6_table_ofs = ns->table_ofs + filter_table_size;
 #endif
 
+  tail_ofs = ns->table_ofs + filter_table_size;
+#if CI_CFG_IPV6
+  tail_ofs += ip6_filter_table_size;
+#endif
+
+  ns->synrecv_table_ofs = CI_ROUND_UP(tail_ofs, CI_CACHE_LINE_SIZE);
+  tail_ofs = ns->synrecv_table_ofs + synrecv_table_size;
+  ni->synrecv_table_buckets = synrecv_table_buckets;
+
+  /* Optional regions follow the SYN-RECV table. */
+
+#if CI_CFG_UDP
+  ni->udp_tx_stage = NULL;
+  if( udp_tx_stage_size != 0 ) {
+    ci_udp_tx_stage_entry* e;
+    ns->udp_tx_stage_ofs = CI_ROUND_UP(tail_ofs, CI_CACHE_LINE_SIZE);
+    tail_ofs = ns->udp_tx_stage_ofs + udp_tx_stage_size;
+    ns->udp_tx_stage_mask = udp_tx_stage_entries - 1;
+    ni->udp_tx_stage_mask = udp_tx_stage_entries - 1;
+    ni->udp_tx_stage = (void*) ((char*) ns + ns->udp_tx_stage_ofs);
+    e = (ci_udp_tx_stage_entry*) (ni->udp_tx_stage + 1);
+    for( i = 0; i < (int) udp_tx_stage_entries * CI_CFG_UDP_TX_STAGE_RINGS;
+         ++i )
+      e[i].pkt_id = OO_PP_ID_NULL;
+  }
+#endif
+
+#if CI_CFG_LAT_HIST
+  ni->lat_hist_socks = NULL;
+  ni->lat_hist_n_socks = 0;
+  if( lat_hist_size != 0 ) {
+    ns->lat_hist_ofs = CI_ROUND_UP(tail_ofs, CI_CACHE_LINE_SIZE);
+    tail_ofs = ns->lat_hist_ofs + lat_hist_size;
+    ns->lat_hist_n_socks = NI_OPTS(ni).latency_hist_sockets;
+    ni->lat_hist_n_socks = ns->lat_hist_n_socks;
+    ni->lat_hist_socks = (void*) ((char*) ns + ns->lat_hist_ofs);
+  }
+#endif
+
+#if CI_CFG_TCPDUMP_RING
+  ni->capture_ring = NULL;
+  ni->capture_ring_size = capture_ring_size;
+  if( capture_ring_size != 0 ) {
+    ns->capture_ring_ofs = CI_ROUND_UP(tail_ofs, CI_CACHE_LINE_SIZE);
+    tail_ofs = ns->capture_ring_ofs + OO_CAPTURE_RING_HDR_LEN +
+               capture_ring_size;
+    ni->capture_ring = (void*) ((char*) ns + ns->capture_ring_ofs);
+    memset(ni->capture_ring, 0, OO_CAPTURE_RING_HDR_LEN);
+    ni->capture_ring->size = capture_ring_size;
+    ni->capture_ring->snaplen = 0xffff;
+  }
+#endif
+
+#if CI_CFG_STATS_RING
+  ni->stats_ring = NULL;
+  if( stats_ring_size != 0 ) {
+    ns->stats_ring_ofs = CI_ROUND_UP(tail_ofs, CI_CACHE_LINE_SIZE);
+    tail_ofs = ns->stats_ring_ofs + OO_STATS_RING_HDR_LEN + stats_ring_size;
+    ni->stats_ring = (void*) ((char*) ns + ns->stats_ring_ofs);
+    ci_netif_stats_ring_init(ni, stats_ring_size, oo_timesync_cpu_khz);
+  }
+#endif
+
+#if CI_CFG_SPIN_ADAPT
+  ni->spin_adapt = NULL;
+  if( spin_adapt_size != 0 ) {
+    unsigned i;
+    ns->spin_adapt_ofs = CI_ROUND_UP(tail_ofs, CI_CACHE_LINE_SIZE);
+    tail_ofs = ns->spin_adapt_ofs + spin_adapt_size;
+    ni->spin_adapt = (void*) ((char*) ns + ns->spin_adapt_ofs);
+    for( i = 0; i < NI_OPTS(ni).max_ep_bufs + CI_CFG_N_READY_LISTS; ++i )
+      oo_spin_adapt_init(&ni->spin_adapt[i]);
+  }
+#endif
+
   ni->packets = (void*) ((char*) ns + ns->buf_ofs);
   ni->active_wild_table = (void*) ((char*) ns + ns->active_wild_ofs);
   ni->seq_table = (void*) ((char*) ns + ns->seq_table_ofs);
   ni->filter_table = (void*) ((char*) ns + ns->table_ofs);
+  ni->synrecv_table = (void*) ((char*) ns + ns->synrecv_table_ofs);
 
 #if CI_CFG_IPV6
   ni->ip6_filter_table = (void*) ((char*) ns + ns->ip6_table_ofs);
@@ -2176,8 +2327,8 @@ allocate_netif_resources(ci_resource_onload_alloc_t* alloc,
   ni->state->n_free_aux_bufs = 0;
   memset(ni->state->n_aux_bufs, 0, sizeof(ni->state->n_aux_bufs));
   ns->max_aux_bufs[CI_TCP_AUX_TYPE_SYNRECV] = ni->opts.tcp_synrecv_max;
-  ns->max_aux_bufs[CI_TCP_AUX_TYPE_BUCKET] = ni->opts.max_ep_bufs;
-  ns->max_aux_bufs[CI_TCP_AUX_TYPE_EPOLL] = ni->opts.max_ep_bufs;
+  ns->max_aux_bufs[CI_TCP_AUX_TYPE_EPOLL] =
+    ni->opts.max_ep_bufs * CI_EPOLL_AUX_BUFS_PER_SOCK;
 
   /* The shared netif-state buffer and EP buffers are part of the mem mmap */
   trs->mem_mmap_bytes += ns->netif_mmap_bytes;
@@ -3955,6 +4106,11 @@ int tcp_helper_rm_alloc(ci_resource_onload_alloc_t* alloc,
     tcp_helper_alloc_list_to_aw_pool(rs, 0, ephemeral_ports);
   }
 
+#if CI_CFG_STATS_RING
+  if( ni->stats_ring != NULL )
+    ci_netif_stats_ring_start(ni);
+#endif
+
   efab_tcp_helper_netif_unlock(rs, 0);
 
   efab_notify_stacklist_change(rs);
@@ -5559,6 +5715,17 @@ efab_tcp_helper_no_more_bufs(tcp_helper_resource_t* trs)
 }
 
 
+/* The node we would like packet buffers on (see EF_PACKET_NUMA_MODE), or
+ * -1 for the current node.
+ */
+static int efab_tcp_helper_pkt_numa_node(ci_netif* ni)
+{
+  if( NI_OPTS(ni).packet_numa_mode == CITP_PKT_NUMA_NIC )
+    return ni->state->nic_numa_node;
+  return -1;
+}
+
+
 static int 
 efab_tcp_helper_iobufset_alloc(tcp_helper_resource_t* trs,
                                struct oo_iobufset** all_out,
@@ -5604,7 +5771,8 @@ efab_tcp_helper_iobufset_alloc(tcp_helper_resource_t* trs,
 #endif
   }
 #endif
-  rc = oo_iobufset_pages_alloc(HW_PAGES_PER_SET_S, &flags, &pages);
+  rc = oo_iobufset_pages_alloc(HW_PAGES_PER_SET_S, &flags,
+                               efab_tcp_helper_pkt_numa_node(ni), &pages);
   if( rc != 0 )
     return rc;
 #if CI_CFG_PKTS_AS_HUGE_PAGES
@@ -5660,7 +5828,7 @@ efab_tcp_helper_more_bufs(tcp_helper_resource_t* trs)
   uint64_t *hw_addrs;
   ci_irqlock_state_t lock_flags;
   ci_netif* ni = &trs->netif;
-  int i, rc, bufset_id, intf_i;
+  int i, rc, bufset_id, intf_i, want_node;
 
   ci_assert(ci_netif_is_locked(ni));
 
@@ -5768,6 +5936,14 @@ efab_tcp_helper_more_bufs(tcp_helper_resource_t* trs)
 #else
   ni->packets->set[bufset_id].shm_id = -1;
 #endif
+  ni->packets->set[bufset_id].numa_node = oo_iobufset_pages_numa_node(pages);
+  want_node = efab_tcp_helper_pkt_numa_node(ni);
+  if( want_node < 0 )
+    want_node = numa_node_id();
+  if( ni->packets->set[bufset_id].numa_node == want_node )
+    CITP_STATS_NETIF_INC(ni, pkt_sets_numa_local);
+  else
+    CITP_STATS_NETIF_INC(ni, pkt_sets_numa_remote);
   ni->packets->n_free += PKTS_PER_SET;
 
   /* Initialise the new buffers. */
@@ -5797,7 +5973,8 @@ efab_tcp_helper_more_bufs(tcp_helper_resource_t* trs)
   }
   ci_free(hw_addrs);
 
-  trs->netif.state->packet_alloc_numa_nodes |= 1 << numa_node_id();
+  trs->netif.state->packet_alloc_numa_nodes |=
+    1 << ni->packets->set[bufset_id].numa_node;
   CHECK_FREEPKTS(ni);
   return 0;
 }
@@ -6828,7 +7005,7 @@ get_os_ready_list(tcp_helper_resource_t* thr, int ready_list)
   tcp_helper_endpoint_t* ep;
   ci_dllink* lnk;
   citp_waitable* w;
-  ci_sb_epoll_state* epoll;
+  oo_sb_epoll* e;
   unsigned long lock_flags;
 
   spin_lock_irqsave(&thr->os_ready_list_lock, lock_flags);
@@ -6842,13 +7019,14 @@ get_os_ready_list(tcp_helper_resource_t* thr, int ready_list)
     /* The waitable was put to the os_ready_list without the stack lock,
      * and the epoll membership can be abandoned now. */
     if( OO_PP_IS_NULL(w->epoll) ||
-        ! (w->ready_lists_in_use & 1 << ready_list) )
+        ! (w->ready_lists_in_use & 1u << ready_list) )
       continue;
 
-    epoll = ci_ni_aux_p2epoll(ni, w->epoll);
-    ci_ni_dllist_remove(ni, &epoll->e[ready_list].ready_link);
+    if( (e = ci_sb_epoll_get(ni, w, ready_list)) == NULL )
+      continue;
+    ci_ni_dllist_remove(ni, &e->ready_link);
     ci_ni_dllist_put(ni, &ni->state->ready_lists[ready_list],
-                     &epoll->e[ready_list].ready_link);
+                     &e->ready_link);
   }
   spin_unlock_irqrestore(&thr->os_ready_list_lock, lock_flags);
 }
@@ -38,10 +38,13 @@
 *//*
 \**************************************************************************/
 
+#define _GNU_SOURCE /* for accept4() */
 #include <errno.h>
+#include <sys/socket.h>
 
 #include <onload/extensions.h>
 #include <onload/extensions_zc.h>
+#include <onload/extensions_ring.h>
 
 unsigned int onload_ext_version[] = 
   {ONLOAD_EXT_VERSION_MAJOR,
@@ -134,6 +137,13 @@ int onload_zc_recv(int fd, struct onload_zc_recv_args* args)
   return -ENOSYS;
 }
 
+__attribute__((weak))
+int onload_zc_recv_lend(int fd, struct onload_zc_iovec* iovecs,
+                        int iovecs_len, int flags)
+{
+  return -ENOSYS;
+}
+
 __attribute__((weak))
 int onload_zc_send(struct onload_zc_mmsg* msgs, int mlen, int flags)
 {
@@ -176,6 +186,14 @@ int onload_msg_template_abort(int fd, onload_template_handle handle)
 
 /**************************************************************************/
 
+__attribute__((weak))
+int onload_ring_submit(struct onload_ring* ring, unsigned flags)
+{
+  return -ENOSYS;
+}
+
+/**************************************************************************/
+
 __attribute__((weak))
 int onload_recvmsg_kernel(int fd, struct msghdr* msg, int flags)
 {
@@ -267,6 +285,19 @@ onload_get_tcp_info(int fd, struct onload_tcp_info* info, int* len_in_out)
   return -1;
 }
 
+__attribute__((weak))
+int
+onload_accept_batch(int fd, struct onload_accept_entry* ents, int n,
+                    int flags)
+{
+  if( n <= 0 ) {
+    errno = EINVAL;
+    return -1;
+  }
+  ents[0].fd = accept4(fd, ents[0].addr, &ents[0].addrlen, flags);
+  return ents[0].fd < 0 ? -1 : 1;
+}
+
 __attribute__((weak))
 int
 onload_socket_nonaccel(int domain, int type, int protocol)
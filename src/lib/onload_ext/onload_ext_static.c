@@ -41,6 +41,7 @@
 #define _GNU_SOURCE
 #include <onload/extensions.h>
 #include <onload/extensions_zc.h>
+#include <onload/extensions_ring.h>
 #include <dlfcn.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -178,6 +179,10 @@ wrap(int, onload_zc_release_buffers, (int fd, onload_zc_handle* bufs,
 wrap(int, onload_zc_recv, (int fd, struct onload_zc_recv_args* args),
      (fd, args), -ENOSYS)
 
+wrap(int, onload_zc_recv_lend, (int fd, struct onload_zc_iovec* iovecs,
+                                int iovecs_len, int flags),
+     (fd, iovecs, iovecs_len, flags), -ENOSYS)
+
 wrap(int, onload_zc_send, (struct onload_zc_mmsg* msgs, int mlen, int flags),
      (msgs, mlen, flags), -ENOSYS)
 
@@ -201,6 +206,9 @@ wrap(int, onload_msg_template_update,
 wrap(int, onload_msg_template_abort, (int fd, onload_template_handle handle),
      (fd, handle), -ENOSYS)
 
+wrap(int, onload_ring_submit, (struct onload_ring* ring, unsigned flags),
+     (ring, flags), -ENOSYS)
+
 wrap(int, onload_recvmsg_kernel, (int fd, struct msghdr* msg, int flags),
      (fd, msg, flags), -ENOSYS)
 
@@ -237,6 +245,21 @@ wrap_with_errno(int, onload_get_tcp_info,
                 (int fd, struct onload_tcp_info* info, int* len),
                 (fd, info, len), -1, EINVAL)
 
+static int onload_accept_batch_one(int fd, struct onload_accept_entry* ents,
+                                   int n, int flags)
+{
+  if( n <= 0 ) {
+    errno = EINVAL;
+    return -1;
+  }
+  ents[0].fd = accept4(fd, ents[0].addr, &ents[0].addrlen, flags);
+  return ents[0].fd < 0 ? -1 : 1;
+}
+
+wrap_with_fn(int, onload_accept_batch,
+             (int fd, struct onload_accept_entry* ents, int n, int flags),
+             (fd, ents, n, flags), onload_accept_batch_one)
+
 wrap_with_fn(int, onload_socket_nonaccel,
              (int domain, int type, int protocol),
              (domain, type, protocol), socket)
@@ -0,0 +1,417 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Packet capture ring for onload_tcpdump, with in-stack filter.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/*! \cidoxg_lib_transport_ip */
+
+#include "ip_internal.h"
+
+#if CI_CFG_TCPDUMP_RING
+
+
+/* A frame being captured: the first buffer, plus the rest of the chain for
+ * the (rare) scatter case.
+ */
+struct oo_capture_frame {
+  ci_netif*             ni;
+  ci_ip_pkt_fmt*        pkt;
+  const ci_uint8*       p0;
+  unsigned              len0;  /* bytes in the first buffer */
+  unsigned              len;   /* bytes in the frame */
+};
+
+
+/* Copy [n] bytes from offset [off] in the frame.  Returns the number of
+ * bytes copied, which is less than [n] only if the chain is short.
+ */
+static unsigned oo_capture_frame_copy(const struct oo_capture_frame* f,
+                                      unsigned off, void* dst, unsigned n)
+{
+  ci_ip_pkt_fmt* frag = f->pkt;
+  const ci_uint8* p = f->p0;
+  unsigned buf_len = f->len0;
+  int n_buffers = f->pkt->n_buffers;
+  unsigned done = 0;
+
+  while( 1 ) {
+    if( off < buf_len ) {
+      unsigned n_copy = CI_MIN(n - done, buf_len - off);
+      memcpy((char*) dst + done, p + off, n_copy);
+      done += n_copy;
+      off = 0;
+    }
+    else {
+      off -= buf_len;
+    }
+    if( done == n || --n_buffers <= 0 || OO_PP_IS_NULL(frag->frag_next) )
+      break;
+    frag = PKT_CHK_NNL(f->ni, frag->frag_next);
+    p = frag->dma_start;
+    buf_len = CI_MAX(frag->buf_len, 0);
+  }
+  return done;
+}
+
+
+/**********************************************************************
+ * Classic BPF
+ *
+ * Programs come from the reader through shared memory, so nothing about
+ * them is trusted: jumps are checked against the end of the program,
+ * scratch memory indices are masked and the loop is bounded by the number
+ * of instructions (jumps only go forward).  Loads outside the frame and
+ * division by zero reject the packet, as in the kernel's interpreter.
+ */
+
+#define OO_BPF_CLASS(c)   ((c) & 0x07)
+#define OO_BPF_LD         0x00
+#define OO_BPF_LDX        0x01
+#define OO_BPF_ST         0x02
+#define OO_BPF_STX        0x03
+#define OO_BPF_ALU        0x04
+#define OO_BPF_JMP        0x05
+#define OO_BPF_RET        0x06
+#define OO_BPF_MISC       0x07
+
+#define OO_BPF_SIZE(c)    ((c) & 0x18)
+#define OO_BPF_W          0x00
+#define OO_BPF_H          0x08
+#define OO_BPF_B          0x10
+
+#define OO_BPF_MODE(c)    ((c) & 0xe0)
+#define OO_BPF_IMM        0x00
+#define OO_BPF_ABS        0x20
+#define OO_BPF_IND        0x40
+#define OO_BPF_MEM        0x60
+#define OO_BPF_LEN        0x80
+#define OO_BPF_MSH        0xa0
+
+#define OO_BPF_OP(c)      ((c) & 0xf0)
+#define OO_BPF_ADD        0x00
+#define OO_BPF_SUB        0x10
+#define OO_BPF_MUL        0x20
+#define OO_BPF_DIV        0x30
+#define OO_BPF_OR         0x40
+#define OO_BPF_AND        0x50
+#define OO_BPF_LSH        0x60
+#define OO_BPF_RSH        0x70
+#define OO_BPF_NEG        0x80
+#define OO_BPF_MOD        0x90
+#define OO_BPF_XOR        0xa0
+
+#define OO_BPF_JA         0x00
+#define OO_BPF_JEQ        0x10
+#define OO_BPF_JGT        0x20
+#define OO_BPF_JGE        0x30
+#define OO_BPF_JSET       0x40
+
+#define OO_BPF_SRC(c)     ((c) & 0x08)
+#define OO_BPF_K          0x00
+#define OO_BPF_X          0x08
+
+#define OO_BPF_RVAL(c)    ((c) & 0x18)
+#define OO_BPF_A          0x10
+
+#define OO_BPF_MISCOP(c)  ((c) & 0xf8)
+#define OO_BPF_TAX        0x00
+#define OO_BPF_TXA        0x80
+
+#define OO_BPF_MEMWORDS   16
+
+
+static int oo_bpf_load(const struct oo_capture_frame* f, ci_uint32 off,
+                       unsigned size, ci_uint32* val_out)
+{
+  ci_uint8 tmp[4] = { 0 };
+  const ci_uint8* p;
+
+  if( off >= f->len || size > f->len - off )
+    return 0;
+  if(CI_LIKELY( off + size <= f->len0 )) {
+    p = f->p0 + off;
+  }
+  else {
+    oo_capture_frame_copy(f, off, tmp, size);
+    p = tmp;
+  }
+
+  switch( size ) {
+  case 4:
+    *val_out = ((ci_uint32) p[0] << 24) | ((ci_uint32) p[1] << 16) |
+               ((ci_uint32) p[2] << 8) | p[3];
+    break;
+  case 2:
+    *val_out = ((ci_uint32) p[0] << 8) | p[1];
+    break;
+  default:
+    *val_out = p[0];
+    break;
+  }
+  return 1;
+}
+
+
+/* Run [prog] over the frame.  Returns the number of bytes to capture, or 0
+ * to reject the frame.
+ */
+static ci_uint32 oo_bpf_run(const struct oo_bpf_insn* prog, unsigned n_insns,
+                            const struct oo_capture_frame* f)
+{
+  ci_uint32 mem[OO_BPF_MEMWORDS];
+  ci_uint32 a = 0, x = 0, k, v;
+  unsigned pc, size;
+
+  for( pc = 0; pc < n_insns; ++pc ) {
+    const struct oo_bpf_insn* insn = &prog[pc];
+    ci_uint16 code = insn->code;
+    k = insn->k;
+
+    switch( OO_BPF_CLASS(code) ) {
+    case OO_BPF_LD:
+    case OO_BPF_LDX:
+      switch( OO_BPF_MODE(code) ) {
+      case OO_BPF_IMM:
+        v = k;
+        break;
+      case OO_BPF_LEN:
+        v = f->len;
+        break;
+      case OO_BPF_MEM:
+        v = mem[k & (OO_BPF_MEMWORDS - 1)];
+        break;
+      case OO_BPF_ABS:
+      case OO_BPF_IND:
+        if( OO_BPF_CLASS(code) != OO_BPF_LD )
+          return 0;
+        size = OO_BPF_SIZE(code) == OO_BPF_W ? 4 :
+               OO_BPF_SIZE(code) == OO_BPF_H ? 2 : 1;
+        if( OO_BPF_MODE(code) == OO_BPF_IND )
+          k += x;
+        if( ! oo_bpf_load(f, k, size, &v) )
+          return 0;
+        break;
+      case OO_BPF_MSH:
+        /* ldxb 4*([k]&0xf): the IP header length. */
+        if( ! oo_bpf_load(f, k, 1, &v) )
+          return 0;
+        v = (v & 0xf) << 2;
+        break;
+      default:
+        return 0;
+      }
+      if( OO_BPF_CLASS(code) == OO_BPF_LD )
+        a = v;
+      else
+        x = v;
+      break;
+
+    case OO_BPF_ST:
+      mem[k & (OO_BPF_MEMWORDS - 1)] = a;
+      break;
+    case OO_BPF_STX:
+      mem[k & (OO_BPF_MEMWORDS - 1)] = x;
+      break;
+
+    case OO_BPF_ALU:
+      v = OO_BPF_SRC(code) == OO_BPF_X ? x : k;
+      switch( OO_BPF_OP(code) ) {
+      case OO_BPF_ADD:  a += v;  break;
+      case OO_BPF_SUB:  a -= v;  break;
+      case OO_BPF_MUL:  a *= v;  break;
+      case OO_BPF_OR:   a |= v;  break;
+      case OO_BPF_AND:  a &= v;  break;
+      case OO_BPF_XOR:  a ^= v;  break;
+      case OO_BPF_LSH:  a = v < 32 ? a << v : 0;  break;
+      case OO_BPF_RSH:  a = v < 32 ? a >> v : 0;  break;
+      case OO_BPF_NEG:  a = -a;  break;
+      case OO_BPF_DIV:
+        if( v == 0 )
+          return 0;
+        a /= v;
+        break;
+      case OO_BPF_MOD:
+        if( v == 0 )
+          return 0;
+        a %= v;
+        break;
+      default:
+        return 0;
+      }
+      break;
+
+    case OO_BPF_JMP:
+      if( OO_BPF_OP(code) == OO_BPF_JA ) {
+        if( k >= n_insns - pc - 1 )
+          return 0;
+        pc += k;
+        break;
+      }
+      v = OO_BPF_SRC(code) == OO_BPF_X ? x : k;
+      switch( OO_BPF_OP(code) ) {
+      case OO_BPF_JEQ:   v = a == v;        break;
+      case OO_BPF_JGT:   v = a > v;         break;
+      case OO_BPF_JGE:   v = a >= v;        break;
+      case OO_BPF_JSET:  v = (a & v) != 0;  break;
+      default:
+        return 0;
+      }
+      k = v ? insn->jt : insn->jf;
+      if( k >= n_insns - pc - 1 )
+        return 0;
+      pc += k;
+      break;
+
+    case OO_BPF_RET:
+      switch( OO_BPF_RVAL(code) ) {
+      case OO_BPF_K:  return k;
+      case OO_BPF_X:  return x;
+      case OO_BPF_A:  return a;
+      default:        return 0;
+      }
+
+    case OO_BPF_MISC:
+      if( OO_BPF_MISCOP(code) == OO_BPF_TAX )
+        x = a;
+      else
+        a = x;
+      break;
+    }
+  }
+
+  /* Fell off the end of the program. */
+  return 0;
+}
+
+
+/**********************************************************************
+ * Capture ring writer
+ */
+
+static ci_uint64 oo_capture_hw_ts_ns(ci_netif* ni, ci_ip_pkt_fmt* pkt)
+{
+#if CI_CFG_TIMESTAMPING
+  /* The RX prefix is still intact at the points where received packets are
+   * dumped.  There is no TX timestamp until the send completes, so TX
+   * packets are stamped from the frc only.
+   */
+  if( (pkt->flags & CI_PKT_FLAG_RX) &&
+      (unsigned) pkt->intf_i < CI_CFG_MAX_INTERFACES ) {
+    ci_netif_state_nic_t* nsn = &ni->state->nic[pkt->intf_i];
+    struct timespec stamp;
+    unsigned sync_flags;
+
+    if( (nsn->oo_vi_flags & OO_VI_FLAGS_RX_HW_TS_EN) &&
+        ef_vi_receive_get_timestamp_with_sync_flags
+          (&ni->nic_hw[pkt->intf_i].vi, PKT_START(pkt) - nsn->rx_prefix_len,
+           &stamp, &sync_flags) == 0 &&
+        stamp.tv_sec != 0 )
+      return (ci_uint64) stamp.tv_sec * 1000000000u + stamp.tv_nsec;
+  }
+#endif
+  return 0;
+}
+
+
+/* The ring's [size] is in shared state, so the kernel uses its own copy. */
+ci_inline ci_uint32 oo_capture_ring_size(ci_netif* ni)
+{
+#ifdef __KERNEL__
+  return ni->capture_ring_size;
+#else
+  return ni->capture_ring->size;
+#endif
+}
+
+
+void oo_capture_ring_write(ci_netif* ni, ci_ip_pkt_fmt* pkt)
+{
+  struct oo_capture_ring* ring = ni->capture_ring;
+  struct oo_capture_frame f;
+  struct oo_capture_rec* rec;
+  ci_uint64 write_pos = ring->write_pos;
+  ci_uint32 size = oo_capture_ring_size(ni);
+  unsigned bpf_len, caplen, rec_len, ofs, pad;
+
+  ci_assert(ci_netif_is_locked(ni));
+  ci_assert(CI_IS_POW2(size));
+#ifdef __KERNEL__
+  /* Keep the record header within the ring whatever [write_pos] says. */
+  write_pos &= ~(ci_uint64) (OO_CAPTURE_REC_ALIGN - 1);
+#endif
+
+  f.ni = ni;
+  f.pkt = pkt;
+  f.p0 = (const ci_uint8*) oo_ether_hdr(pkt);
+  f.len = CI_MAX(pkt->pay_len, 0);
+  f.len0 = pkt->n_buffers > 1 ? CI_MIN(CI_MAX(pkt->buf_len, 0), f.len) : f.len;
+
+  caplen = f.len;
+  bpf_len = OO_ACCESS_ONCE(ring->bpf_len);
+  if( bpf_len != 0 ) {
+    caplen = oo_bpf_run(ring->bpf,
+                        CI_MIN(bpf_len, CI_CFG_TCPDUMP_BPF_MAX_INSNS), &f);
+    if( caplen == 0 ) {
+      ++ring->n_filtered;
+      return;
+    }
+    caplen = CI_MIN(caplen, f.len);
+  }
+  caplen = CI_MIN(caplen, OO_ACCESS_ONCE(ring->snaplen));
+  caplen = CI_MIN(caplen, 0xffff);
+
+  rec_len = CI_ROUND_UP(sizeof(*rec) + caplen, OO_CAPTURE_REC_ALIGN);
+  ofs = write_pos & (size - 1);
+  pad = rec_len > size - ofs ? size - ofs : 0;
+  if( write_pos + pad + rec_len - OO_ACCESS_ONCE(ring->read_pos) > size ) {
+    ++ring->n_dropped;
+    CITP_STATS_NETIF_INC(ni, tcpdump_missed);
+    return;
+  }
+
+  if( pad != 0 ) {
+    rec = (struct oo_capture_rec*) (OO_CAPTURE_RING_DATA(ring) + ofs);
+    rec->rec_len = pad;
+    rec->flags = OO_CAPTURE_REC_F_PAD;
+    write_pos += pad;
+    ofs = 0;
+  }
+
+  rec = (struct oo_capture_rec*) (OO_CAPTURE_RING_DATA(ring) + ofs);
+  rec->caplen = oo_capture_frame_copy(&f, 0, rec + 1, caplen);
+  rec->rec_len = rec_len;
+  rec->len = f.len;
+  rec->flags = (pkt->flags & CI_PKT_FLAG_RX) ? 0 : OO_CAPTURE_REC_F_TX;
+  rec->intf_i = pkt->intf_i;
+  rec->vlan = pkt->vlan;
+  rec->frc = pkt->tstamp_frc;
+  rec->hw_ts_ns = oo_capture_hw_ts_ns(ni, pkt);
+  if( rec->hw_ts_ns != 0 )
+    rec->flags |= OO_CAPTURE_REC_F_HW_TS;
+
+  /* Record must be visible before the reader sees the new position. */
+  ci_wmb();
+  ring->write_pos = write_pos + rec_len;
+  ++ring->n_captured;
+}
+
+#endif /* CI_CFG_TCPDUMP_RING */
+/*! \cidoxg_end */
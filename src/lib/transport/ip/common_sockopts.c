@@ -728,7 +728,12 @@ int ci_set_sol_ip( ci_netif* netif, ci_sock_cmn* s,
     }
     val = CI_MIN(val, CI_IP_MAX_TOS);
     s->cp.ip_tos = (ci_uint8)val;
-    s->pkt.ip.ip_tos = (ci_uint8)val;
+    if( s->b.state & CI_TCP_STATE_TCP )
+      /* Keep the ECT codepoint set by ci_tcp_ecn_enable(). */
+      s->pkt.ip.ip_tos = (ci_uint8)val |
+                         (s->pkt.ip.ip_tos & CI_IP_TOS_ECN_MASK);
+    else
+      s->pkt.ip.ip_tos = (ci_uint8)val;
     if( s->b.state == CI_TCP_STATE_UDP )
       SOCK_TO_UDP(s)->ephemeral_pkt.ip.ip_tos = (ci_uint8)val;
 
@@ -1384,6 +1389,12 @@ int ci_setsockopt_os_fail_ignore(ci_netif* ni, ci_sock_cmn* s, int err,
   if( level == SOL_SOCKET && optname == ONLOAD_SO_BUSY_POLL &&
            optlen >= sizeof(int) ) 
     return 1;
+#ifdef TCP_CONGESTION
+  /* We implement congestion control algorithms that the kernel may not. */
+  else if( (s->b.state & CI_TCP_STATE_TCP) && level == IPPROTO_TCP &&
+           optname == TCP_CONGESTION && err == ENOENT )
+    return 1;
+#endif
 #if CI_CFG_TIMESTAMPING
   else if( (s->b.state & CI_TCP_STATE_TCP) && level == SOL_SOCKET &&
            ( optname == SO_TIMESTAMP || optname == SO_TIMESTAMPNS ||
@@ -108,10 +108,14 @@ ci_inline unsigned ip_pkt_dump_len(unsigned len) {
 */
 ci_inline void ci_tcp_update_rtt(ci_netif* netif, ci_tcp_state* ts, int m)
 {
+  const ci_tcp_cc_ops* cc;
+  unsigned sample;
+
   /* ?? Jacobson's algorithm assumes a signed number which might not
   ** be the same as ci_iptime_t, hmmm... what to do? */
   ci_assert_ge(m, 0);
   m = CI_MAX(1, m);
+  sample = m;
 
   if( CI_LIKELY(ts->sa) ) {
     /* See Jacobson's SIGCOMM 88 algorithm to calculate (2.3) of
@@ -133,6 +137,10 @@ ci_inline void ci_tcp_update_rtt(ci_netif* netif, ci_tcp_state* ts, int m)
 
   ci_tcp_rto_bound(netif, ts);
 
+  if(CI_UNLIKELY( ts->c.cc_algo != CI_TCP_CC_RENO &&
+                  (cc = ci_tcp_cc(ts))->on_rtt_sample != NULL ))
+    cc->on_rtt_sample(netif, ts, sample);
+
   CI_IP_SOCK_STATS_VAL_RTT_SRTT_RTO( ts, ts->sv >> 2, ts->sa >> 3, ts->rto );
   LOG_TR(ci_log("TCP RX %d UPDATE RTT sa=%u sv=%u SRTT=%u RTTVAR=%u RTO=%u",
 	        S_FMT(ts), ts->sa, ts->sv,
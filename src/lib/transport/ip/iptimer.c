@@ -47,6 +47,10 @@
 #define ADDR2TIMER(ni, id)					\
   LINK2TIMER((ci_ni_dllist_link*) CI_NETIF_PTR((ni), (id)))
 
+/* With EF_TIMER_MODE=1, the maximum delay (in ticks) before we are polled
+ * again while timers remain to be migrated between wheels. */
+#define IPTIMER_INCR_STRIDE  4
+
 
 #if CI_CFG_IP_TIMER_DEBUG
 
@@ -67,10 +71,21 @@ void (*ci_ip_timer_debug_fn)(ci_netif*, int, int) = ci_ip_timer_debug;
 ** wheel. See scheme 7 of "Hashed and Hierarchical Timing Wheels:
 ** Efficient Data Structures for Implementing a Timer Facility" Feb
 ** '96, Varghese and Lauck.
+**
+** In the classic mode (EF_TIMER_MODE=0) each bucket of wheel N holds the
+** timers for one rotation of wheel N-1, and these are all moved down
+** ("cascaded") when wheel N-1 wraps.  With many connections a single
+** cascade can move tens of thousands of timers in one poll.
+**
+** EF_TIMER_MODE=1 keeps a second copy of wheels 0-2 ([wnext]) holding the
+** next rotation of each.  A timer lives on the lowest wheel whose current
+** or next rotation contains it.  The bucket on wheel N+1 holding the next
+** rotation of wheel N can then be emptied into [wnext] a few timers at a
+** time on each poll (EF_TIMER_CASCADE_BUDGET), well before it is needed.
+** When a wheel wraps, its [wnext] buckets become current, and anything not
+** yet migrated is cascaded immediately.
 */
 
-#ifdef __KERNEL__ 
-
 static int shift_for_gran(ci_uint32 G, unsigned khz) 
 { 
   unsigned tmp;
@@ -106,7 +121,11 @@ static int shift_for_gran(ci_uint32 G, unsigned khz)
 }
 
 
-/* initialise the iptimer scheduler */
+/* initialise the iptimer scheduler
+**
+** Called by the driver when the stack is created, and at user level by
+** test harnesses that build a stack without the driver.
+*/
 void ci_ip_timer_state_init(ci_netif* netif, unsigned cpu_khz)
 {
   ci_ip_timer_state* ipts = IPTIMER_STATE(netif);
@@ -148,6 +167,14 @@ void ci_ip_timer_state_init(ci_netif* netif, unsigned cpu_khz)
   ci_assert_gt(ipts->ci_ip_time_ms2tick_fxp, 1ull<<31);
   ci_assert_le(ipts->ci_ip_time_ms2tick_fxp, 1ull<<32);
 
+  ipts->coalesce_mask = 0;
+  if( NI_OPTS(netif).timer_coalesce_ms ) {
+    ci_iptime_t ticks = ci_ip_time_ms2ticks(netif,
+                                            NI_OPTS(netif).timer_coalesce_ms);
+    while( ipts->coalesce_mask + 1 < ticks )
+      ipts->coalesce_mask = (ipts->coalesce_mask << 1) | 1;
+  }
+
   /* set module specific time constants dependent on frc2tick */
   ci_tcp_timer_init(netif);
 
@@ -160,8 +187,140 @@ void ci_ip_timer_state_init(ci_netif* netif, unsigned cpu_khz)
     ci_ni_dllist_init(netif, &ipts->warray[i],
 		      oo_ptr_to_statep(netif, &ipts->warray[i]),
                       "timw");
+  for( i=0; i < CI_IPTIME_WNEXTSIZE; i++)
+    ci_ni_dllist_init(netif, &ipts->wnext[i],
+		      oo_ptr_to_statep(netif, &ipts->wnext[i]),
+                      "timn");
+}
+
+
+/* EF_TIMER_MODE=1: insert a timer onto the lowest wheel whose current or
+** next rotation contains its expiry time.
+*/
+static void ci_ip_timer_incr_insert(ci_netif* netif, ci_ip_timer* ts)
+{
+  ci_iptime_t stime = IPTIMER_STATE(netif)->sched_ticks;
+  ci_iptime_t d;
+  ci_ni_dllist_t* bucket;
+  int w;
+
+  bucket = IPTIMER_BUCKET(netif, CI_IPTIME_WHEELS - 1, ts->time);
+  for( w = 0; w < CI_IPTIME_WHEELS - 1; w++ ) {
+    d = IPTIMER_ROTATION(w, ts->time) - IPTIMER_ROTATION(w, stime);
+    d &= (ci_iptime_t) -1 >> ((w + 1) * CI_IPTIME_BUCKETBITS);
+    if( d == 0 ) {
+      bucket = IPTIMER_BUCKET(netif, w, ts->time);
+      if( w == 0 )
+        __ci_timer_busy_set(netif, ts->time);
+      break;
+    }
+    if( d == 1 ) {
+      bucket = IPTIMER_NEXT_BUCKET(netif, w, ts->time);
+      break;
+    }
+  }
+
+  ci_ni_dllist_push_tail(netif, bucket, &ts->link);
+  ci_assert(ci_ip_timer_is_link_valid(netif, ts));
+}
+
+
+/* EF_TIMER_MODE=1: the bucket on wheel [wheelno]+1 that holds the timers
+** in rotation [rot] of wheel [wheelno].  [rot] must be the current or the
+** next rotation.
+*/
+static ci_ni_dllist_t*
+ci_ip_timer_incr_src(ci_netif* netif, int wheelno, ci_iptime_t rot)
+{
+  ci_iptime_t stime = IPTIMER_STATE(netif)->sched_ticks;
+  ci_iptime_t t = rot << ((wheelno + 1) * CI_IPTIME_BUCKETBITS);
+
+  if( wheelno + 1 == CI_IPTIME_WHEELS - 1 ||
+      IPTIMER_ROTATION(wheelno + 1, t) == IPTIMER_ROTATION(wheelno + 1, stime) )
+    return IPTIMER_BUCKET(netif, wheelno + 1, t);
+  return IPTIMER_NEXT_BUCKET(netif, wheelno + 1, t);
+}
+
+
+/* EF_TIMER_MODE=1: move up to [budget] timers out of [src] onto the lowest
+** wheel they belong in.  Returns the number of timers moved.
+*/
+static int ci_ip_timer_incr_drain(ci_netif* netif, ci_ni_dllist_t* src,
+                                  int budget)
+{
+  ci_ni_dllist_link* link;
+  int n = 0;
+
+  while( n < budget && (link = ci_ni_dllist_try_pop(netif, src)) ) {
+    ci_ip_timer_incr_insert(netif, LINK2TIMER(link));
+    ++n;
+  }
+  return n;
+}
+
+
+/* EF_TIMER_MODE=1: called as [stime] reaches the end of a rotation of
+** wheel 0.  The next rotation of each wheel that has wrapped becomes
+** current, then any timers that we did not manage to migrate early are
+** cascaded.
+*/
+static void ci_ip_timer_incr_wrap(ci_netif* netif, ci_iptime_t stime)
+{
+  ci_ip_timer_state* ipts = IPTIMER_STATE(netif);
+  ci_ni_dllist_t* next;
+  ci_ni_dllist_t* cur;
+  int top, w, b, n = 0;
+
+  ci_assert_equal(IPTIMER_BUCKETNO(0, stime), 0);
+
+  /* highest wheel that has wrapped */
+  for( top = 0; top < CI_IPTIME_WHEELS - 2; top++ )
+    if( IPTIMER_BUCKETNO(top + 1, stime) != 0 )
+      break;
+
+  for( w = 0; w <= top; w++ )
+    for( b = 0; b < CI_IPTIME_BUCKETS; b++ ) {
+      next = &ipts->wnext[w * CI_IPTIME_BUCKETS + b];
+      if( ci_ni_dllist_is_empty(netif, next) )
+        continue;
+      cur = &ipts->warray[w * CI_IPTIME_BUCKETS + b];
+      ci_assert(ci_ni_dllist_is_empty(netif, cur));
+      ci_ni_dllist_rehome(netif, cur, next);
+      if( w == 0 )
+        __ci_timer_busy_set(netif, stime + b);
+    }
+
+  for( w = top; w >= 0; w-- )
+    n += ci_ip_timer_incr_drain(netif,
+                                ci_ip_timer_incr_src(netif, w,
+                                       IPTIMER_ROTATION(w, stime)),
+                                INT_MAX);
+
+  CITP_STATS_NETIF_ADD(netif, timer_cascade_wrap, n);
+}
+
+
+/* EF_TIMER_MODE=1: migrate timers for the next rotation of each wheel,
+** lowest wheel first, within the per-poll budget.  Returns non-zero if
+** there is more to do.
+*/
+static int ci_ip_timer_incr_migrate(ci_netif* netif)
+{
+  ci_iptime_t stime = IPTIMER_STATE(netif)->sched_ticks;
+  int budget = NI_OPTS(netif).timer_cascade_budget;
+  ci_ni_dllist_t* src;
+  int w, n;
+
+  for( w = 0; w < CI_IPTIME_WHEELS - 1; w++ ) {
+    src = ci_ip_timer_incr_src(netif, w, IPTIMER_ROTATION(w, stime) + 1);
+    n = ci_ip_timer_incr_drain(netif, src, budget);
+    CITP_STATS_NETIF_ADD(netif, timer_cascade_incr, n);
+    budget -= n;
+    if( budget == 0 )
+      return 1;
+  }
+  return 0;
 }
-#endif /* __KERNEL */
 
 
 /* insert a non-pending timer into the scheduler */
@@ -178,6 +337,12 @@ void __ci_ip_timer_set(ci_netif *netif, ci_ip_timer *ts, ci_iptime_t t)
   if( TIME_LT(t, IPTIMER_STATE(netif)->closest_timer) )
     IPTIMER_STATE(netif)->closest_timer = t;
 
+  if( NI_OPTS(netif).timer_mode ) {
+    ci_ip_timer_incr_insert(netif, ts);
+    DETAILED_CHECK_TIMERS(netif);
+    return;
+  }
+
   /* Previous error in this code was to choose wheel based on time delta 
    * before timer fires (ts->time - stime). This is bogus as the timer wheels
    * work like a clock and we need to find wheel based on the absolute time
@@ -289,6 +454,7 @@ static int ci_ip_timer_cascadewheel(ci_netif* netif, int wheelno,
 
     if( wheelno == 1 )
       __ci_timer_busy_set(netif, ts->time);
+    CITP_STATS_NETIF_INC(netif, timer_cascade_wrap);
   }
   return changed;
 }
@@ -325,6 +491,11 @@ static void ci_ip_timer_docallback(ci_netif *netif, ci_ip_timer* ts)
   case CI_IP_TIMER_NETIF_TIMEOUT:
     ci_netif_timeout_state(netif);
     break;
+#if CI_CFG_STATS_RING
+  case CI_IP_TIMER_NETIF_STATS_RING:
+    ci_netif_stats_ring_timeout(netif);
+    break;
+#endif
   case CI_IP_TIMER_PMTU_DISCOVER:
     ci_pmtu_timeout_pmtu(netif, SP_TO_TCP(netif, ts->param1));
     break;
@@ -353,6 +524,8 @@ static void ci_ip_timer_docallback(ci_netif *netif, ci_ip_timer* ts)
   }  
 }
 
+static void ci_ip_timer_closest_update(ci_netif* netif, int incr);
+
 /* run any pending timers */
 void ci_ip_timer_poll(ci_netif *netif) {
   ci_ip_timer_state* ipts = IPTIMER_STATE(netif); 
@@ -361,6 +534,8 @@ void ci_ip_timer_poll(ci_netif *netif) {
   ci_iptime_t rtime;
   ci_ni_dllist_link* link;
   int changed = 0;
+  int incr = NI_OPTS(netif).timer_mode;
+  int incr_more = 0;
 
   /* The caller is expected to ensure that the current time is sufficiently
   ** up-to-date.
@@ -373,6 +548,13 @@ void ci_ip_timer_poll(ci_netif *netif) {
   ci_assert( ci_ni_dllist_is_valid(netif, &ipts->fire_list.l) );
   ci_assert( ci_ni_dllist_is_empty(netif, &ipts->fire_list));
 
+  if( incr && TIME_LT(*stime, rtime) ) {
+    /* Spread the work of cascading over the polls that advance time.  This
+     * is done before the new ticks are processed so that anything moved
+     * onto the lower wheels is due at or after them. */
+    incr_more = ci_ip_timer_incr_migrate(netif);
+  }
+
   while( TIME_LT(*stime, rtime) ) {
 
     DETAILED_CHECK_TIMERS(netif);
@@ -380,8 +562,14 @@ void ci_ip_timer_poll(ci_netif *netif) {
     /* advance the schedulers view of time */
     (*stime)++;
 
+    if( incr ) {
+      if( IPTIMER_BUCKETNO(0, *stime) == 0 ) {
+        ci_ip_timer_incr_wrap(netif, *stime);
+        changed = 1;
+      }
+    }
     /* cascade through wheels if reached end of current wheel */
-    if(IPTIMER_BUCKETNO(0, *stime) == 0) {
+    else if(IPTIMER_BUCKETNO(0, *stime) == 0) {
       if(IPTIMER_BUCKETNO(1, *stime) == 0) {
 	if(IPTIMER_BUCKETNO(2, *stime) == 0) {
 	  ci_ip_timer_cascadewheel(netif, 3, *stime);
@@ -430,41 +618,57 @@ void ci_ip_timer_poll(ci_netif *netif) {
   ci_assert( ci_ni_dllist_is_valid(netif, &ipts->fire_list.l) );
   ci_assert( ci_ni_dllist_is_empty(netif, &ipts->fire_list));
 
-  /* What is our next timer?
-   * Let's update if our previous "closest" timer have already been
-   * handled, or we have cascaded some more timers into wheel0. */
-  if( TIME_GE(ipts->sched_ticks, ipts->closest_timer) || changed  ) {
-    /* we peek into the first wheel only */
-    ci_iptime_t base = ipts->sched_ticks & IPTIMER_WHEEL0_MASK;
-    ci_iptime_t b = ipts->sched_ticks - base;
-    int i = b/64;
-
-    /* All the lower bits have been already unset in the bitmask: */
-    ci_assert_nflags(ipts->busy_mask[i], (1ULL << (b%64)) - 1);
-
-    /* We peek into the wheel0 */
-    for( ; i < 4; i++ ) {
-      if( ipts->busy_mask[i] != 0 ) {
-        ipts->closest_timer = base + i*64 + ci_ffs64(ipts->busy_mask[i]) - 1;
-        return;
-      }
-    }
+  if( TIME_GE(ipts->sched_ticks, ipts->closest_timer) || changed  )
+    ci_ip_timer_closest_update(netif, incr);
+
+  /* If there is migration left to do, make sure we are polled again soon
+   * even when the stack is otherwise idle. */
+  if( incr_more &&
+      TIME_GT(ipts->closest_timer, ipts->sched_ticks + IPTIMER_INCR_STRIDE) )
+    ipts->closest_timer = ipts->sched_ticks + IPTIMER_INCR_STRIDE;
+}
 
-    /* Next timer is not closer that the start of wheel1.  We'll cascade it
-     * and determine the closest_timer correctly after cascading.  */
-    ipts->closest_timer = base + CI_IPTIME_BUCKETS;
-
-    /* But if the first bucket in wheel1 is empty, we can push the
-     * closest_timer even further.  We are guaranteed to cascade at least
-     * once during this time frame, so we'll get better estimation when
-     * this value becomes limiting (we call linux_tcp_timer_do() every
-     * 90ms, which is smaller than CI_IPTIME_BUCKETS=250 ticks. */
-    if( ci_ni_dllist_is_empty(netif,
-                              IPTIMER_BUCKET(netif, 1,
-                                             base + CI_IPTIME_BUCKETS) ) ) {
-      ipts->closest_timer += CI_IPTIME_BUCKETS;
+
+/* What is our next timer?
+ * Called if our previous "closest" timer has already been handled, or we
+ * have cascaded some more timers into wheel0. */
+static void ci_ip_timer_closest_update(ci_netif* netif, int incr)
+{
+  ci_ip_timer_state* ipts = IPTIMER_STATE(netif);
+  /* we peek into the first wheel only */
+  ci_iptime_t base = ipts->sched_ticks & IPTIMER_WHEEL0_MASK;
+  ci_iptime_t b = ipts->sched_ticks - base;
+  int i = b/64;
+
+  /* All the lower bits have been already unset in the bitmask: */
+  ci_assert_nflags(ipts->busy_mask[i], (1ULL << (b%64)) - 1);
+
+  /* We peek into the wheel0 */
+  for( ; i < 4; i++ ) {
+    if( ipts->busy_mask[i] != 0 ) {
+      ipts->closest_timer = base + i*64 + ci_ffs64(ipts->busy_mask[i]) - 1;
+      return;
     }
   }
+
+  /* Next timer is not closer that the start of wheel1.  We'll cascade it
+   * and determine the closest_timer correctly after cascading.  */
+  ipts->closest_timer = base + CI_IPTIME_BUCKETS;
+
+  /* But if the first bucket in wheel1 is empty, we can push the
+   * closest_timer even further.  We are guaranteed to cascade at least
+   * once during this time frame, so we'll get better estimation when
+   * this value becomes limiting (we call linux_tcp_timer_do() every
+   * 90ms, which is smaller than CI_IPTIME_BUCKETS=250 ticks.
+   *
+   * With EF_TIMER_MODE=1 the next rotation of wheel0 is in [wnext] and
+   * may already be populated, so we don't do this. */
+  if( ! incr &&
+      ci_ni_dllist_is_empty(netif,
+                            IPTIMER_BUCKET(netif, 1,
+                                           base + CI_IPTIME_BUCKETS) ) ) {
+    ipts->closest_timer += CI_IPTIME_BUCKETS;
+  }
 }
 
 
@@ -477,7 +681,7 @@ void ci_ip_timer_state_assert_valid(ci_netif* ni, const char* file, int line)
   ci_ni_dllist_t* bucket;
   ci_ni_dllist_link* l;
   ci_iptime_t stime, wheel_base, max_time, min_time;
-  int a1, a2, a3, w, b, bit_shift;
+  int a1, a2, a3, w, b, bit_shift, next;
 
   /* shifting a 32 bit integer left or right 32 bits has undefined results 
    * (i.e. not 0 which is required). Therefore I now use an array of mask 
@@ -490,11 +694,15 @@ void ci_ip_timer_state_assert_valid(ci_netif* ni, const char* file, int line)
   ipts = IPTIMER_STATE(ni);
   stime = ipts->sched_ticks;
   
-  /* for each wheel */
-  for(w=0; w < CI_IPTIME_WHEELS; w++) {
+  /* for each wheel, and with EF_TIMER_MODE=1 the next rotation of each
+   * wheel but the top one */
+  for(next=0; next <= !!NI_OPTS(ni).timer_mode; next++)
+  for(w=0; w < CI_IPTIME_WHEELS - next; w++) {
 
     /* base time of wheel */
     wheel_base = stime & wheel_mask[w];
+    if( next )
+      wheel_base += 1u << (CI_IPTIME_BUCKETBITS*(w+1));
     /* for each bucket in wheel */
     for (b=0; b < CI_IPTIME_BUCKETS; b++) {
 
@@ -503,15 +711,18 @@ void ci_ip_timer_state_assert_valid(ci_netif* ni, const char* file, int line)
       min_time = wheel_base + (b << bit_shift);
       max_time = min_time   + (1 << bit_shift);
 
-      bucket = &ipts->warray[w*CI_IPTIME_BUCKETS + b];
+      if( next )
+        bucket = &ipts->wnext[w*CI_IPTIME_BUCKETS + b];
+      else
+        bucket = &ipts->warray[w*CI_IPTIME_BUCKETS + b];
 
       /* check list looks valid */
       if ( ci_ni_dllist_start(ni, bucket) == ci_ni_dllist_end(ni, bucket) ) {
         ci_assert( ci_ni_dllist_is_empty(ni, bucket) );
-        if( w == 0 )
+        if( w == 0 && ! next )
           ci_assert_nflags(ipts->busy_mask[b/64], (1ULL << (b%64)));
       }
-      else if( w == 0 )
+      else if( w == 0 && ! next )
         ci_assert_flags(ipts->busy_mask[b/64], (1ULL << (b%64)));
 
 
@@ -535,7 +746,8 @@ void ci_ip_timer_state_assert_valid(ci_netif* ni, const char* file, int line)
 
         /* if any of the checks fail then print out timer details */
         if (!a1 || !a2 || !a3) {
-          ci_log("%s: [w=0x%x/b=0x%x] stime=0x%x", __FUNCTION__, w, b, stime);
+          ci_log("%s: [w=0x%x/b=0x%x%s] stime=0x%x", __FUNCTION__, w, b,
+                 next ? " next" : "", stime);
           ci_log("    --> t=0x%x, min=0x%x, max=0x%x", ts->time, min_time, max_time);
           ci_log("    [%s line=%d]", file, line);
         }
@@ -549,11 +761,11 @@ void ci_ip_timer_state_assert_valid(ci_netif* ni, const char* file, int line)
 #endif
 
 #ifdef DUMP_TIMER_SUPPORT 
-static const char* ci_ip_timer_dump(const ci_ip_timer* ts)
+static const char* ci_ip_timer_fn_name(int fn)
 {
   const char* timer_name;
 
-  switch( ts->fn ) {
+  switch( fn ) {
     #undef MAKECASE
     #define MAKECASE(id, name) case id: timer_name = name; break;
 
@@ -564,6 +776,9 @@ static const char* ci_ip_timer_dump(const ci_ip_timer* ts)
     MAKECASE(CI_IP_TIMER_TCP_LISTEN,   "listen")
     MAKECASE(CI_IP_TIMER_TCP_CORK,     "cork")
     MAKECASE(CI_IP_TIMER_NETIF_TIMEOUT, "netif")
+#if CI_CFG_STATS_RING
+    MAKECASE(CI_IP_TIMER_NETIF_STATS_RING, "ni-stats-ring")
+#endif
     MAKECASE(CI_IP_TIMER_PMTU_DISCOVER, "pmtu")
 #if CI_CFG_SUPPORT_STATS_COLLECTION
     MAKECASE(CI_IP_TIMER_TCP_STATS,     "tcp-stats")
@@ -581,6 +796,12 @@ static const char* ci_ip_timer_dump(const ci_ip_timer* ts)
 }
 
 
+static const char* ci_ip_timer_dump(const ci_ip_timer* ts)
+{
+  return ci_ip_timer_fn_name(ts->fn);
+}
+
+
 void ci_ip_timer_state_dump(ci_netif* ni)
 {
   ci_ip_timer_state* ipts;
@@ -588,7 +809,7 @@ void ci_ip_timer_state_dump(ci_netif* ni)
   ci_ni_dllist_t* bucket;
   ci_ni_dllist_link* l;
   ci_iptime_t stime, wheel_base, max_time, min_time;
-  int w, b, bit_shift;
+  int w, b, bit_shift, next;
 
   /* shifting a 32 bit integer left or right 32 bits has undefined results 
    * (i.e. not 0 which is required). Therefore I now use an array of mask 
@@ -602,11 +823,15 @@ void ci_ip_timer_state_dump(ci_netif* ni)
   stime = ipts->sched_ticks;
 
   ci_log("%s: time is 0x%x", __FUNCTION__, stime);
-  /* for each wheel */
-  for(w=0; w < CI_IPTIME_WHEELS; w++) {
+  /* for each wheel, and with EF_TIMER_MODE=1 the next rotation of each
+   * wheel but the top one */
+  for(next=0; next <= !!NI_OPTS(ni).timer_mode; next++)
+  for(w=0; w < CI_IPTIME_WHEELS - next; w++) {
 
     /* base time of wheel */
     wheel_base = stime & wheel_mask[w];
+    if( next )
+      wheel_base += 1u << (CI_IPTIME_BUCKETBITS*(w+1));
     /* for each bucket in wheel */
     for (b=0; b < CI_IPTIME_BUCKETS; b++) {
 
@@ -615,7 +840,10 @@ void ci_ip_timer_state_dump(ci_netif* ni)
       min_time = wheel_base + (b << bit_shift);
       max_time = min_time   + (1 << bit_shift);
 
-      bucket = &ipts->warray[w*CI_IPTIME_BUCKETS + b];
+      if( next )
+        bucket = &ipts->wnext[w*CI_IPTIME_BUCKETS + b];
+      else
+        bucket = &ipts->warray[w*CI_IPTIME_BUCKETS + b];
 
       /* check buckets that should be empty are! */
       if ( TIME_LE(min_time, stime) && !ci_ni_dllist_is_empty(ni, bucket) )
@@ -630,8 +858,9 @@ void ci_ip_timer_state_dump(ci_netif* ni)
         /* get timer */  
         ts = LINK2TIMER(l);
 
-        ci_log(" ts = 0x%x %s  w:%d, b:%d, [0x%x->0x%x]",
-               ts->time, ci_ip_timer_dump(ts), w, b, min_time, max_time);
+        ci_log(" ts = 0x%x %s  w:%d%s, b:%d, [0x%x->0x%x]",
+               ts->time, ci_ip_timer_dump(ts), w, next ? "n" : "", b,
+               min_time, max_time);
         if ( TIME_LE(ts->time, stime) )
           ci_log("    ERROR: timer before current time");
         if ( !(TIME_LT(ts->time, max_time) && TIME_GE(ts->time, min_time)) )
@@ -641,6 +870,88 @@ void ci_ip_timer_state_dump(ci_netif* ni)
   }
   ci_log("----------------------");
 }
+
+
+#ifndef __KERNEL__
+
+#define IPTIMER_DUMP_FN_MAX    (CI_IP_TIMER_TCP_CORK + 1)
+#define IPTIMER_DUMP_LOG2_MAX  32
+
+static void ci_ip_timer_count_bucket(ci_netif* ni, ci_ni_dllist_t* bucket,
+                                     unsigned* n_bucket, unsigned* n_fn,
+                                     unsigned (*hist)[IPTIMER_DUMP_LOG2_MAX])
+{
+  ci_iptime_t stime = IPTIMER_STATE(ni)->sched_ticks;
+  ci_ni_dllist_link* l;
+  ci_ip_timer* ts;
+  unsigned delta;
+  int fn, i;
+
+  for( l = ci_ni_dllist_start(ni, bucket);
+       l != ci_ni_dllist_end(ni, bucket);
+       ci_ni_dllist_iter(ni, l) ) {
+    ts = LINK2TIMER(l);
+    fn = ts->fn < IPTIMER_DUMP_FN_MAX ? ts->fn : 0;
+    delta = ts->time - stime;
+    for( i = 0; i < IPTIMER_DUMP_LOG2_MAX - 1 && (delta >> i) > 1; ++i )
+      ;
+    ++*n_bucket;
+    ++n_fn[fn];
+    ++hist[fn][i];
+  }
+}
+
+
+void ci_ip_timer_state_dump_summary(ci_netif* ni)
+{
+  ci_ip_timer_state* ipts = IPTIMER_STATE(ni);
+  unsigned n_cur[CI_IPTIME_WHEELS], n_next[CI_IPTIME_WHEELS];
+  unsigned n_fn[IPTIMER_DUMP_FN_MAX];
+  unsigned hist[IPTIMER_DUMP_FN_MAX][IPTIMER_DUMP_LOG2_MAX];
+  int incr = NI_OPTS(ni).timer_mode;
+  int w, b, fn, i;
+
+  memset(n_cur, 0, sizeof(n_cur));
+  memset(n_next, 0, sizeof(n_next));
+  memset(n_fn, 0, sizeof(n_fn));
+  memset(hist, 0, sizeof(hist));
+
+  for( w = 0; w < CI_IPTIME_WHEELS; w++ )
+    for( b = 0; b < CI_IPTIME_BUCKETS; b++ ) {
+      ci_ip_timer_count_bucket(ni, &ipts->warray[w*CI_IPTIME_BUCKETS + b],
+                               &n_cur[w], n_fn, hist);
+      if( incr && w < CI_IPTIME_WHEELS - 1 )
+        ci_ip_timer_count_bucket(ni, &ipts->wnext[w*CI_IPTIME_BUCKETS + b],
+                                 &n_next[w], n_fn, hist);
+    }
+
+  ci_log("timers: mode=%s now=0x%x closest=+%d coalesce=%u ticks",
+         incr ? "incremental" : "classic", ipts->sched_ticks,
+         (int) (ipts->closest_timer - ipts->sched_ticks),
+         ipts->coalesce_mask + 1);
+  ci_log("  %-6s %10s %10s", "wheel", "current", "next");
+  for( w = 0; w < CI_IPTIME_WHEELS; w++ )
+    if( incr && w < CI_IPTIME_WHEELS - 1 )
+      ci_log("  %-6d %10u %10u", w, n_cur[w], n_next[w]);
+    else
+      ci_log("  %-6d %10u %10s", w, n_cur[w], "-");
+
+  ci_log("  expiry distribution (ticks from now: count)");
+  for( fn = 0; fn < IPTIMER_DUMP_FN_MAX; fn++ ) {
+    char buf[256];
+    int len = 0;
+    if( n_fn[fn] == 0 )
+      continue;
+    for( i = 0; i < IPTIMER_DUMP_LOG2_MAX; i++ )
+      if( hist[fn][i] && len < (int) sizeof(buf) )
+        len += snprintf(buf + len, sizeof(buf) - len, " <%u:%u",
+                        1u << (i < 31 ? i + 1 : 31), hist[fn][i]);
+    ci_log("  %-10s %8u %s", ci_ip_timer_fn_name(fn), n_fn[fn],
+           len ? buf + 1 : "");
+  }
+}
+
+#endif /* __KERNEL__ */
 #endif
 
 
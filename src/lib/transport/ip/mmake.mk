@@ -16,6 +16,7 @@ LIB_SRCS	:=		\
 		tcp_tx.c	\
 		tcp_tx_reformat.c \
 		tcp_timer.c	\
+		tcp_cc.c	\
 		tcp_close.c	\
 		tcp_init_shared.c \
 		pmtu.c		\
@@ -53,6 +54,9 @@ LIB_SRCS	:=		\
 		active_wild.c	\
 		l3xudp_encap.c \
 		tcp_metrics.c \
+		capture_ring.c	\
+		stats_ring.c	\
+		spin_adapt.c	\
 
 ifneq ($(DRIVER),1)
 LIB_SRCS	+=		\
@@ -247,10 +247,11 @@ void ci_netif_timeout_restart(ci_netif *ni, ci_tcp_state *ts)
 
   /* take it off the list */
   ci_netif_timeout_remove(ni, ts);
-  /* store time to leave TIMEWAIT state */
-  ts->t_last_sent = ci_ip_time_now(ni) +
+  /* store time to leave TIMEWAIT state, coalesced with its neighbours so
+   * that the timeout timer reaps them in batches */
+  ts->t_last_sent = ci_ip_time_coarse(ni, ci_ip_time_now(ni) +
       ( is_tw ?
-        NI_CONF(ni).tconst_2msl_time : NI_CONF(ni).tconst_fin_timeout );
+        NI_CONF(ni).tconst_2msl_time : NI_CONF(ni).tconst_fin_timeout ));
   /* add to list */
   ci_netif_timeout_add(
                 ni, ts,
@@ -1015,7 +1016,8 @@ ci_uint64 ci_netif_unlock_slow_common(ci_netif* ni, ci_uint64 lock_val)
 {
   const ci_uint64 ALL_HANDLED_FLAGS = CI_EPLOCK_NETIF_IS_PKT_WAITER |
                                       CI_EPLOCK_NETIF_NEED_POLL |
-                                      CI_EPLOCK_NETIF_MERGE_ATOMIC_COUNTERS;
+                                      CI_EPLOCK_NETIF_MERGE_ATOMIC_COUNTERS |
+                                      CI_EPLOCK_NETIF_UDP_TX_STAGED;
   ci_uint64 set_flags = 0;
 
   /* Do this first, because ci_netif_purge_deferred_socket_list() acts on the
@@ -1040,6 +1042,11 @@ ci_uint64 ci_netif_unlock_slow_common(ci_netif* ni, ci_uint64 lock_val)
     }
   }
 
+#if CI_CFG_UDP
+  if( lock_val & CI_EPLOCK_NETIF_UDP_TX_STAGED )
+    ci_udp_tx_stage_drain(ni);
+#endif
+
   if( lock_val & CI_EPLOCK_NETIF_NEED_POLL ) {
     CITP_STATS_NETIF(++ni->state->stats.deferred_polls);
     ci_netif_poll(ni);
@@ -1191,7 +1198,7 @@ int ci_netif_get_ready_list(ci_netif* ni)
   do {
     if( !((ni->state->ready_lists_in_use >> i) & 1) ) {
       ni->state->ready_list_pid[i] = getpid();
-      ni->state->ready_lists_in_use |= 1 << i;
+      ni->state->ready_lists_in_use |= 1u << i;
       break;
     }
   } while( ++i < CI_CFG_N_READY_LISTS );
@@ -1206,11 +1213,10 @@ ci_netif_put_ready_list_one(ci_netif* ni, ci_ni_dllist_t* list, int id)
 {
   while( ci_ni_dllist_not_empty(ni, list) ) {
     ci_ni_dllist_link* lnk = ci_ni_dllist_pop(ni, list);
-    ci_sb_epoll_state* epoll = CI_CONTAINER(ci_sb_epoll_state,
-                                            e[id].ready_link, lnk);
+    ci_sb_epoll_state* epoll = ci_sb_epoll_link2state(lnk, id);
 
     ci_ni_dllist_self_link(ni, lnk);
-    SP_TO_WAITABLE(ni, epoll->sock_id)->ready_lists_in_use &=~ (1 << id);
+    SP_TO_WAITABLE(ni, epoll->sock_id)->ready_lists_in_use &=~ (1u << id);
   }
 }
 
@@ -1218,7 +1224,7 @@ static void ci_netif_put_ready_list_locked(ci_netif* ni, int id)
 {
   ci_netif_put_ready_list_one(ni, &ni->state->ready_lists[id], id);
   ci_netif_put_ready_list_one(ni, &ni->state->unready_lists[id], id);
-  ni->state->ready_lists_in_use &= ~(1 << id);
+  ni->state->ready_lists_in_use &= ~(1u << id);
   ni->state->ready_list_pid[id] = 0;
 }
 
@@ -1237,7 +1243,7 @@ void ci_netif_free_ready_lists(ci_netif* ni)
 void ci_netif_put_ready_list(ci_netif* ni, int id)
 {
 
-  ci_assert(ni->state->ready_lists_in_use & (1 << id));
+  ci_assert(ni->state->ready_lists_in_use & (1u << id));
 
 #ifdef __KERNEL__
   ci_assert(current);
@@ -1574,7 +1580,9 @@ static oo_sp __ci_netif_active_wild_pool_get(ci_netif* ni, int aw_pool,
                                 sock_protocol(&aw->s));
 
     if( rc >= 0 ) {
-      ci_sock_cmn* s = ID_TO_SOCK(ni, ni->filter_table->table[rc].id);
+      ci_sock_cmn* s = ID_TO_SOCK(ni,
+                                  CI_NETIF_FILTER_ENTRY(ni->filter_table,
+                                                        rc)->id);
       if( s->b.state == CI_TCP_TIME_WAIT ) {
         ci_uint32 seq;
         /* This 4-tuple is in use as TIME_WAIT, but it is safe to re-use
@@ -119,6 +119,18 @@ static void ci_netif_state_assert_valid(ci_netif* ni,
     sockp = w->wt_next;
   }
 
+  /* Check the reserve of free endpoints for accepted connections. */
+  n = 0;
+  for( sockp = nis->accept_prealloc_head; OO_SP_NOT_NULL(sockp); ) {
+    verify(IS_VALID_SOCK_P(ni, sockp));
+    w = SP_TO_WAITABLE(ni, sockp);
+    verify(w);
+    verify(w->state == CI_TCP_STATE_FREE);
+    verify(++n <= (int) nis->n_ep_bufs);
+    sockp = w->wt_next;
+  }
+  verify(n == (int) nis->n_accept_prealloc);
+
   for( lnk = ci_ni_dllist_start(ni, &ni->state->post_poll_list);
        lnk != ci_ni_dllist_end(ni, &ni->state->post_poll_list); ) {
     w = CI_CONTAINER(citp_waitable, post_poll_link, lnk);
@@ -292,7 +304,8 @@ static void ci_netif_dump_pkt_summary(ci_netif* ni, oo_dump_log_fn_t logger,
          ni->packets->sets_n);
 
   for( i = 0; i < ni->packets->sets_n; i++ ) {
-    logger(log_arg, "  pkt_set[%d]: free=%d%s", i, ni->packets->set[i].n_free,
+    logger(log_arg, "  pkt_set[%d]: free=%d node=%d%s", i,
+           ni->packets->set[i].n_free, ni->packets->set[i].numa_node,
            i == ni->packets->id ? " current" : "");
   }
 
@@ -383,7 +396,7 @@ void ci_netif_pkt_dump_all(ci_netif* ni)
     /* Can't do this race free, but what the heck.  (Actually we could, but
      * we'd have to grab the whole list).
      */
-    int no_nonb=0, next;
+    int no_nonb=0, next, i, n;
     ci_ip_pkt_fmt* nonb_pkt;
     oo_pkt_p pp;
 
@@ -395,6 +408,20 @@ void ci_netif_pkt_dump_all(ci_netif* ni)
       next = OO_PP_ID(nonb_pkt->next);
     }
     log("   free_nonb=%d nonb_pkt_pool=%"CI_PRIx64, no_nonb, ns->nonb_pkt_pool);
+
+    for( i = 0; i < CI_CFG_PKT_NONB_MAGAZINES; ++i ) {
+      n = 0;
+      next = ns->nonb_magazine[i].link & 0xffffffff;
+      while( next != 0xffffffff ) {
+        OO_PP_INIT(ni, pp, next);
+        nonb_pkt = PKT(ni, pp);
+        n++;
+        next = OO_PP_ID(nonb_pkt->next);
+      }
+      if( n != 0 )
+        log("   nonb_magazine[%d]: free=%d link=%"CI_PRIx64, i, n,
+            ns->nonb_magazine[i].link);
+    }
   }
 }
 
@@ -565,8 +592,8 @@ void ci_netif_dump_extra(ci_netif* ni)
   log("  hwport_to_intf_i=%s intf_i_to_hwport=%s", hp2i, i2hp);
   log("  uk_intf_ver=%s", OO_UK_INTF_VER);
   log("  deferred count %d/%d", ns->defer_work_count, NI_OPTS(ni).defer_work_limit);
-  log("  numa nodes: creation=%d load=%d",
-      ns->creation_numa_node, ns->load_numa_node);
+  log("  numa nodes: creation=%d load=%d nic=%d",
+      ns->creation_numa_node, ns->load_numa_node, ns->nic_numa_node);
   log("  numa node masks: packet alloc=%x sock alloc=%x interrupt=%x",
       ns->packet_alloc_numa_nodes, ns->sock_alloc_numa_nodes,
       ns->interrupt_numa_nodes);
@@ -797,15 +824,19 @@ void ci_netif_dump_to_logger(ci_netif* ni, oo_dump_log_fn_t logger,
   }
 #endif
 
-  logger(log_arg, "  sock_bufs: max=%u n_allocated=%u",
-         NI_OPTS(ni).max_ep_bufs, ns->n_ep_bufs);
-  /* aux buffers number is limited by tcp_synrecv_max*2 */
+  logger(log_arg, "  sock_bufs: max=%u n_allocated=%u accept_prealloc=%u",
+         NI_OPTS(ni).max_ep_bufs, ns->n_ep_bufs, ns->n_accept_prealloc);
+  /* synrecv aux buffers number is limited by tcp_synrecv_max */
   logger(log_arg, "  aux_bufs: free=%u",
          ns->n_free_aux_bufs);
   for( i = 0; i < CI_TCP_AUX_TYPE_NUM; i++ ) {
     logger(log_arg, "  aux_bufs[%s]: n=%d max=%d",
            ci_tcp_aux_type2str(i), ns->n_aux_bufs[i], ns->max_aux_bufs[i]);
   }
+  logger(log_arg, "  synrecv_table: n=%u buckets=%u max_buckets=%u",
+         ni->synrecv_table->n_entries,
+         ni->synrecv_table->mask + 1 + ni->synrecv_table->split,
+         ni->synrecv_table->max_buckets);
   ci_netif_dump_pkt_summary(ni, logger, log_arg);
 
 
@@ -829,6 +860,43 @@ void ci_netif_dump_to_logger(ci_netif* ni, oo_dump_log_fn_t logger,
       logger(log_arg, "  tcpdump: %d/%d packets in queue (wr=%u rd=%u)",
              (int)(ci_uint16) (dwi - dri), CI_CFG_DUMPQUEUE_LEN, dwi, dri);
   }
+#if CI_CFG_TCPDUMP_RING
+  if( ni->capture_ring != NULL ) {
+    struct oo_capture_ring* ring = ni->capture_ring;
+    logger(log_arg, "  capture ring: size=%u used=%u filter=%u insns "
+           "captured=%"CI_PRIu64" filtered=%"CI_PRIu64" dropped=%"CI_PRIu64,
+           ring->size, (unsigned) (ring->write_pos - ring->read_pos),
+           ring->bpf_len, ring->n_captured, ring->n_filtered,
+           ring->n_dropped);
+  }
+#endif
+#if CI_CFG_STATS_RING
+  if( ni->stats_ring != NULL ) {
+    struct oo_stats_ring* ring = ni->stats_ring;
+    logger(log_arg, "  stats ring: size=%u interval=%ums fields=%u "
+           "records=%"CI_PRIu64" written=%"CI_PRIu64" timer=%s",
+           ring->size, ring->interval_ms, ring->n_fields, ring->seq,
+           ring->write_pos,
+           ci_ip_timer_pending(ni, &ns->stats_ring_tid) ? "armed" : "idle");
+  }
+#endif
+#if CI_CFG_SPIN_ADAPT
+  if( ni->spin_adapt != NULL ) {
+    int i;
+    logger(log_arg, "  spin adapt: pct=%u hit=%u miss=%u skip=%u late=%u "
+           "saved=%uus", NI_OPTS(ni).spin_adapt_pct,
+           ns->stats.spin_adapt_hit, ns->stats.spin_adapt_miss,
+           ns->stats.spin_adapt_skip, ns->stats.spin_adapt_late,
+           oo_cycles64_to_usec(ni, ns->stats.spin_adapt_cycles_saved));
+    for( i = 0; i < CI_CFG_N_READY_LISTS; ++i ) {
+      struct oo_spin_adapt* sa = oo_spin_adapt_ready_list(ni, i);
+      if( sa->n_hit + sa->n_miss + sa->n_skip == 0 )
+        continue;
+      logger(log_arg, "  ready list %d:", i);
+      oo_spin_adapt_dump(ni, sa, "  ", logger, log_arg);
+    }
+  }
+#endif
 
 #if CI_CFG_FD_CACHING
   logger(log_arg, "  active cache: hit=%d avail=%d cache=%s pending=%s",
@@ -841,7 +909,7 @@ void ci_netif_dump_to_logger(ci_netif* ni, oo_dump_log_fn_t logger,
          ci_ni_dllist_is_empty(ni, &ns->passive_scalable_cache.pending) ? "EMPTY":"yes");
 #endif
   {
-    int i, tmp;
+    ci_uint32 i, tmp;
     CI_READY_LIST_EACH(ns->ready_lists_in_use, tmp, i)
       logger(log_arg, "  readylist: id=%d pid=%d ready=%s unready=%s flags=%x", i,
            ns->ready_list_pid[i],
@@ -71,6 +71,12 @@ struct oo_rx_future {
 struct oo_rx_state {
   /* Full packet in order, once reception of scattered packet is completed. */
   ci_ip_pkt_fmt* rx_pkt;
+  /* Complete packets harvested from the event queue whose headers have been
+   * prefetched, waiting to be demuxed and delivered (see rx_batch_flush()).
+   */
+  ci_ip_pkt_fmt* batch[CI_CFG_RX_BATCH_MAX];
+  int            batch_n;
+  int            batch_max;
   /* Last fragment received, chained to previous fragments via frag_next */
   ci_ip_pkt_fmt* frag_pkt;
   /* Without RX Merge: A running total of bytes received for this packet
@@ -959,6 +965,107 @@ drop:
 }
 
 
+/* RX delivery is pipelined in three stages so that the cache misses for one
+ * packet overlap with protocol processing of the packets ahead of it:
+ *
+ *  1) ci_netif_poll_evq() harvests events and prefetches the packet buffer
+ *     of each completed packet (rx_pkt_prefetch());
+ *  2) once a batch is complete, the (now cached) headers of every packet are
+ *     parsed and the filter table buckets they will hit are prefetched
+ *     (rx_pkt_prefetch_filter());
+ *  3) the packets are demuxed and delivered in order (handle_rx_pkt()).
+ *
+ * The batch is flushed when full (EF_RX_BATCH), before any event that may
+ * itself deliver a packet, and when the event queue has been drained, so
+ * packets are never reordered.
+ */
+ci_inline void rx_pkt_prefetch(ci_ip_pkt_fmt* pkt)
+{
+  ci_prefetch(pkt);
+  ci_prefetch(pkt->dma_start);
+  ci_prefetch(pkt->dma_start + CI_CACHE_LINE_SIZE);
+}
+
+
+static void rx_pkt_prefetch_filter(ci_netif* ni, ci_ip_pkt_fmt* pkt)
+{
+  ci_ip4_hdr* ip;
+
+  if( *((ci_uint16*)oo_l3_hdr(pkt) - 1) != CI_ETHERTYPE_IP )
+    return;
+  ip = oo_ip_hdr(pkt);
+  /* Only the first fragment carries the ports.  The contents may be garbage
+   * for a runt frame, but we're only computing prefetch addresses.
+   */
+  if( ip->ip_frag_off_be16 & CI_IP4_OFFSET_MASK )
+    return;
+
+  if( ip->ip_protocol == IPPROTO_TCP ) {
+    ci_tcp_hdr* tcp = (ci_tcp_hdr*) ((char*) ip + CI_IP4_IHL(ip));
+    ci_netif_filter_prefetch(ni, ip->ip_daddr_be32, tcp->tcp_dest_be16,
+                             ip->ip_saddr_be32, tcp->tcp_source_be16,
+                             IPPROTO_TCP);
+  }
+#if CI_CFG_UDP
+  else if( ip->ip_protocol == IPPROTO_UDP ) {
+    /* ci_udp_handle_rx() nearly always falls through to the wildcard
+     * lookup, so warm both. */
+    ci_udp_hdr* udp = (ci_udp_hdr*) ((char*) ip + CI_IP4_IHL(ip));
+    ci_netif_filter_prefetch(ni, ip->ip_daddr_be32, udp->udp_dest_be16,
+                             ip->ip_saddr_be32, udp->udp_source_be16,
+                             IPPROTO_UDP);
+    ci_netif_filter_prefetch(ni, ip->ip_daddr_be32, udp->udp_dest_be16,
+                             0, 0, IPPROTO_UDP);
+  }
+#endif
+}
+
+
+static void rx_batch_flush(ci_netif* ni, struct ci_netif_poll_state* ps,
+                           struct oo_rx_state* s)
+{
+  int i, n;
+
+  if( s->rx_pkt != NULL ) {
+    s->batch[s->batch_n++] = s->rx_pkt;
+    s->rx_pkt = NULL;
+  }
+  n = s->batch_n;
+  if( n == 0 )
+    return;
+  s->batch_n = 0;
+
+  if( n > 1 ) {
+    CITP_STATS_NETIF_INC(ni, rx_batches);
+    CITP_STATS_NETIF_ADD(ni, rx_batch_pkts, n);
+    for( i = 0; i < n; ++i ) {
+      ci_parse_rx_vlan(s->batch[i]);
+      rx_pkt_prefetch_filter(ni, s->batch[i]);
+    }
+    for( i = 0; i < n; ++i )
+      handle_rx_pkt(ni, ps, s->batch[i]);
+  }
+  else {
+    /* Nothing to overlap with, so don't bother computing the hashes. */
+    ci_parse_rx_vlan(s->batch[0]);
+    handle_rx_pkt(ni, ps, s->batch[0]);
+  }
+}
+
+
+/* Queue the previously completed packet (if any) for delivery. */
+ci_inline void rx_batch_stage(ci_netif* ni, struct ci_netif_poll_state* ps,
+                              struct oo_rx_state* s)
+{
+  if( s->rx_pkt != NULL ) {
+    s->batch[s->batch_n++] = s->rx_pkt;
+    s->rx_pkt = NULL;
+    if( s->batch_n >= s->batch_max )
+      rx_batch_flush(ni, ps, s);
+  }
+}
+
+
 static void handle_rx_no_desc_trunc(ci_netif* ni,
                                     struct ci_netif_poll_state* ps,
                                     int intf_i,
@@ -967,11 +1074,7 @@ static void handle_rx_no_desc_trunc(ci_netif* ni,
   LOG_U(log(LPF "[%d] intf %d RX_NO_DESC_TRUNC "EF_EVENT_FMT,
             NI_ID(ni), intf_i, EF_EVENT_PRI_ARG(ev)));
 
-  if( s->rx_pkt != NULL ) {
-    ci_parse_rx_vlan(s->rx_pkt);
-    handle_rx_pkt(ni, ps, s->rx_pkt);
-    s->rx_pkt = NULL;
-  }
+  rx_batch_flush(ni, ps, s);
   ci_assert(s->frag_pkt != NULL);
   if( s->frag_pkt != NULL ) {  /* belt and braces! */
     ci_netif_pkt_release_rx_1ref(ni, s->frag_pkt);
@@ -992,11 +1095,7 @@ static void __handle_rx_discard(ci_netif* ni, struct ci_netif_poll_state* ps,
             NI_ID(ni), intf_i,
             (int) discard_type, EF_EVENT_PRI_ARG(ev)));
 
-  if( s->rx_pkt != NULL ) {
-    ci_parse_rx_vlan(s->rx_pkt);
-    handle_rx_pkt(ni, ps, s->rx_pkt);
-    s->rx_pkt = NULL;
-  }
+  rx_batch_flush(ni, ps, s);
 
   /* For now bin any fragments as (i) they would only be useful in the
    * CSUM_BAD case; (ii) the hardware is probably right about the
@@ -1102,7 +1201,7 @@ static void process_post_poll_list(ci_netif* ni)
   ci_ni_dllist_link* lnk;
   int i, need_wake = 0;
   citp_waitable* sb;
-  int lists_need_wake = 0;
+  ci_uint32 lists_need_wake = 0;
 
   (void) i;  /* prevent warning; effectively unused at userlevel */
 
@@ -1167,7 +1266,7 @@ static void process_post_poll_list(ci_netif* ni)
   CHECK_NI(ni);
 
   /* Shouldn't have had a wake for a list we don't think exists */
-  ci_assert_equal(lists_need_wake & ~((1 << CI_CFG_N_READY_LISTS)-1), 0);
+  ci_assert_equal(lists_need_wake & ~CI_READY_LISTS_MASK, 0);
 
 #ifndef __KERNEL__
   /* See if any of the ready lists need a wake.  We only bother checking if
@@ -1190,7 +1289,7 @@ static void process_post_poll_list(ci_netif* ni)
   /* Check whether any ready lists associated with a set need to be woken.
    */
   CI_READY_LIST_EACH(lists_need_wake, lists_need_wake, i) {
-    if( (lists_need_wake & (1 << i)) &&
+    if( (lists_need_wake & (1u << i)) &&
         (ni->state->ready_list_flags[i] & CI_NI_READY_LIST_FLAG_WAKE) )
       efab_tcp_helper_ready_list_wakeup(netif2tcp_helper_resource(ni), i);
   }
@@ -1324,6 +1423,17 @@ ci_inline void __ci_netif_tx_pkt_complete(ci_netif* ni,
   }
 #endif
 
+#if CI_CFG_LAT_HIST
+  if( pkt->flags & CI_PKT_FLAG_LAT_DOORBELL ) {
+    /* No completion time to record if the NIC is being reset. */
+    if( ev != NULL )
+      ci_netif_lat_hist_record(ni, ci_netif_lat_hist_tx_sock(pkt),
+                               CI_LAT_HIST_TX_COMPLETE, pkt->tstamp_frc,
+                               ci_frc64_get());
+    pkt->flags &= ~CI_PKT_FLAG_LAT_DOORBELL;
+  }
+#endif
+
   pkt->flags &=~ CI_PKT_FLAG_TX_PENDING;
 #if CI_CFG_UDP
   if( pkt->flags & CI_PKT_FLAG_UDP )
@@ -1357,6 +1467,9 @@ static int ci_netif_poll_evq(ci_netif* ni, struct ci_netif_poll_state* ps,
 
   s.frag_pkt = NULL;
   s.frag_bytes = 0;  /*??*/
+  s.rx_pkt = NULL;
+  s.batch_n = 0;
+  s.batch_max = CI_MIN(NI_OPTS(ni).rx_batch, CI_CFG_RX_BATCH_MAX);
 
   if( OO_PP_NOT_NULL(ni->state->nic[intf_i].rx_frags) ) {
     pkt = PKT_CHK(ni, ni->state->nic[intf_i].rx_frags);
@@ -1375,20 +1488,15 @@ static int ci_netif_poll_evq(ci_netif* ni, struct ci_netif_poll_state* ps,
       break;
 
 have_events:
-    s.rx_pkt = NULL;
     for( i = 0; i < n_evs; ++i ) {
       /* Look for RX events first to minimise latency. */
       if( EF_EVENT_TYPE(ev[i]) == EF_EVENT_TYPE_RX ) {
         CITP_STATS_NETIF_INC(ni, rx_evs);
         OO_PP_INIT(ni, pp, EF_EVENT_RX_RQ_ID(ev[i]));
         pkt = PKT_CHK(ni, pp);
-        ci_prefetch_ppc(pkt->dma_start);
-        ci_prefetch_ppc(pkt);
+        rx_pkt_prefetch(pkt);
         ci_assert_equal(pkt->intf_i, intf_i);
-        if( s.rx_pkt != NULL ) {
-          ci_parse_rx_vlan(s.rx_pkt);
-          handle_rx_pkt(ni, ps, s.rx_pkt);
-        }
+        rx_batch_stage(ni, ps, &s);
         if( (ev[i].rx.flags & (EF_EVENT_FLAG_SOP | EF_EVENT_FLAG_CONT))
                                                        == EF_EVENT_FLAG_SOP ) {
           /* Whole packet in a single buffer. */
@@ -1431,13 +1539,9 @@ have_events:
         for( j = 0; j < n_ids; ++j ) {
           OO_PP_INIT(ni, pp, ids[j]);
           pkt = PKT_CHK(ni, pp);
-          ci_prefetch_ppc(pkt->dma_start);
-          ci_prefetch_ppc(pkt);
+          rx_pkt_prefetch(pkt);
           ci_assert_equal(pkt->intf_i, intf_i);
-          if( s.rx_pkt != NULL ) {
-            ci_parse_rx_vlan(s.rx_pkt);
-            handle_rx_pkt(ni, ps, s.rx_pkt);
-          }
+          rx_batch_stage(ni, ps, &s);
           if( (ev[i].rx_multi.flags & (EF_EVENT_FLAG_SOP | EF_EVENT_FLAG_CONT))
                == EF_EVENT_FLAG_SOP ) {
             /* Whole packet in a single buffer. */
@@ -1492,6 +1596,7 @@ have_events:
 
       else if( EF_EVENT_TYPE(ev[i]) == EF_EVENT_TYPE_OFLOW ) {
         LOG_E(CI_RLLOG(1, LPF "***** EVENT QUEUE OVERFLOW *****"));
+        rx_batch_flush(ni, ps, &s);
         return 0;
       }
 
@@ -1515,14 +1620,14 @@ have_events:
     }
 #endif
 
-    if( s.rx_pkt != NULL ) {
-      ci_parse_rx_vlan(s.rx_pkt);
-      handle_rx_pkt(ni, ps, s.rx_pkt);
-    }
-
+    /* The last packet completed stays in [s.rx_pkt] until the next RX
+     * event, so that the batch can span calls to ef_eventq_poll().
+     */
     total_evs += n_evs;
   } while( total_evs < NI_OPTS(ni).evs_per_poll );
 
+  rx_batch_flush(ni, ps, &s);
+
   /* If we've drained the TXQ, we can start trying CTPIO again. */
   if( completed_tx && ef_vi_transmit_fill_level(&ni->nic_hw[intf_i].vi) == 0 )
     ci_netif_ctpio_resume(ni, intf_i);
@@ -105,6 +105,8 @@ void ci_netif_state_init(ci_netif* ni, int cpu_khz, const char* name)
   /* Pool of packet buffers for transmit. */
   assert_zero(nis->n_async_pkts);
   nis->nonb_pkt_pool = CI_ILL_END;
+  for( i = 0; i < CI_CFG_PKT_NONB_MAGAZINES; ++i )
+    nis->nonb_magazine[i].link = CI_ILL_END;
 
   /* Endpoint lookup table.
    * - table must be a power of two in size
@@ -115,11 +117,14 @@ void ci_netif_state_init(ci_netif* ni, int cpu_khz, const char* name)
    * Fixme: max_ep_bufs includes some space for aux buffers.
    */
   ci_netif_filter_init(ni->filter_table,
-                       ci_log2_le(NI_OPTS(ni).max_ep_bufs) + 1);
+                       CI_MAX(ci_log2_le(NI_OPTS(ni).max_ep_bufs) + 1,
+                              CI_NETIF_FILTER_BUCKET_SHIFT + 1));
 #if CI_CFG_IPV6
   ci_ip6_netif_filter_init(ni->ip6_filter_table,
-                           ci_log2_le(NI_OPTS(ni).max_ep_bufs) + 1);
+                           CI_MAX(ci_log2_le(NI_OPTS(ni).max_ep_bufs) + 1,
+                                  CI_NETIF_FILTER_BUCKET_SHIFT + 1));
 #endif
+  ci_tcp_synrecv_table_init(ni->synrecv_table, ni->synrecv_table_buckets);
 
   ci_ni_dllist_init(ni, &nis->timeout_q[OO_TIMEOUT_Q_TIMEWAIT], 
                     oo_ptr_to_statep(ni, &nis->timeout_q[OO_TIMEOUT_Q_TIMEWAIT]),
@@ -134,6 +139,14 @@ void ci_netif_state_init(ci_netif* ni, int cpu_khz, const char* name)
   nis->timeout_tid.param1 = OO_SP_NULL;
   nis->timeout_tid.fn = CI_IP_TIMER_NETIF_TIMEOUT;
 
+#if CI_CFG_STATS_RING
+  ci_ip_timer_init(ni, &nis->stats_ring_tid,
+                   oo_ptr_to_statep(ni, &nis->stats_ring_tid),
+                   "srng");
+  nis->stats_ring_tid.param1 = OO_SP_NULL;
+  nis->stats_ring_tid.fn = CI_IP_TIMER_NETIF_STATS_RING;
+#endif
+
 #if CI_CFG_SUPPORT_STATS_COLLECTION
   ci_ip_timer_init(ni, &nis->stats_tid,
                    oo_ptr_to_statep(ni, &nis->stats_tid),
@@ -151,6 +164,9 @@ void ci_netif_state_init(ci_netif* ni, int cpu_khz, const char* name)
 
   nis->free_eps_head = OO_SP_NULL;
   nis->deferred_free_eps_head = CI_ILL_END;
+  nis->accept_prealloc_head = OO_SP_NULL;
+  nis->n_accept_prealloc = 0;
+  nis->n_listeners = 0;
   assert_zero(nis->n_ep_bufs);
   nis->max_ep_bufs = NI_OPTS(ni).max_ep_bufs;
 
@@ -180,6 +196,10 @@ void ci_netif_state_init(ci_netif* ni, int cpu_khz, const char* name)
   nis->kernel_packets_cycles =
             __oo_usec_to_cycles64(cpu_khz,
                                   NI_OPTS(ni).kernel_packets_timer_usec);
+#if CI_CFG_LAT_HIST
+  nis->lat_hist_ns_mult =
+    (ci_uint32) ((1000000ull << CI_LAT_HIST_FRC_SHIFT) / cpu_khz);
+#endif
 
   ci_ip_timer_state_init(ni, cpu_khz);
   nis->last_spin_poll_frc = IPTIMER_STATE(ni)->frc;
@@ -831,6 +851,13 @@ void ci_netif_config_opts_getenv(ci_netif_config_opts* opts)
       opts->int_driven = 0;
   }
 
+#if CI_CFG_SPIN_ADAPT
+  if( (s = getenv("EF_SPIN_ADAPT")) )
+    opts->spin_adapt = atoi(s);
+  if( (s = getenv("EF_SPIN_ADAPT_PCT")) )
+    opts->spin_adapt_pct = atoi(s);
+#endif
+
   if( (s = getenv("EF_INT_DRIVEN")) )
     opts->int_driven = atoi(s);
   if( opts->int_driven )
@@ -901,10 +928,18 @@ void ci_netif_config_opts_getenv(ci_netif_config_opts* opts)
 #endif
   if( (s = getenv("EF_EVS_PER_POLL")) )
     opts->evs_per_poll = atoi(s);
+  if( (s = getenv("EF_RX_BATCH")) )
+    opts->rx_batch = atoi(s);
   if( (s = getenv("EF_TCP_TCONST_MSL")) )
     opts->msl_seconds = atoi(s);
   if( (s = getenv("EF_TCP_FIN_TIMEOUT")) )
     opts->fin_timeout = atoi(s);
+  if( (s = getenv("EF_TIMER_MODE")) )
+    opts->timer_mode = atoi(s);
+  if( (s = getenv("EF_TIMER_CASCADE_BUDGET")) )
+    opts->timer_cascade_budget = atoi(s);
+  if( (s = getenv("EF_TIMER_COALESCE_MS")) )
+    opts->timer_coalesce_ms = atoi(s);
   if( (s = getenv("EF_TCP_ADV_WIN_SCALE_MAX")) )
     opts->tcp_adv_win_scale_max = atoi(s);
 
@@ -960,6 +995,8 @@ void ci_netif_config_opts_getenv(ci_netif_config_opts* opts)
     opts->huge_pages = 0;
   }
 #endif
+  if ( (s = getenv("EF_PACKET_NUMA_MODE")) )
+    opts->packet_numa_mode = atoi(s);
   if ( (s = getenv("EF_COMPOUND_PAGES_MODE")) )
     opts->compound_pages = atoi(s);
   if ( (s = getenv("EF_RXQ_SIZE")) )
@@ -1039,6 +1076,8 @@ void ci_netif_config_opts_getenv(ci_netif_config_opts* opts)
     opts->rst_delayed_conn = atoi(s);
   if( (s = getenv("EF_TCP_SNDBUF_MODE")) )
     opts->tcp_sndbuf_mode = atoi(s);
+  if( (s = getenv("EF_TCP_SEND_GSO_MAX")) )
+    opts->tcp_send_gso_max = atoi(s);
   if( (s = getenv("EF_TCP_SEND_NONBLOCK_NO_PACKETS_MODE")) )
     opts->tcp_nonblock_no_pkts_mode = atoi(s);
   if( (s = getenv("EF_TCP_RCVBUF_STRICT")) )
@@ -1069,6 +1108,8 @@ void ci_netif_config_opts_getenv(ci_netif_config_opts* opts)
   if( (s = getenv("EF_UDP_SEND_UNLOCKED")) )
     opts->udp_send_unlocked = atoi(s);
 #endif
+  if( (s = getenv("EF_UDP_TX_STAGE_RING")) )
+    opts->udp_tx_stage_ring = atoi(s);
   if( (s = getenv("EF_UDP_SEND_NONBLOCK_NO_PACKETS_MODE")) )
     opts->udp_nonblock_no_pkts_mode = atoi(s);
   if( (s = getenv("EF_UNCONFINE_SYN")) )
@@ -1090,6 +1131,8 @@ void ci_netif_config_opts_getenv(ci_netif_config_opts* opts)
     opts->tcp_server_loopback = atoi(s);
   if( (s = getenv("EF_TCP_CLIENT_LOOPBACK")) )
     opts->tcp_client_loopback = atoi(s);
+  if( (s = getenv("EF_TCP_LOOPBACK_DIRECT")) )
+    opts->tcp_loopback_direct = atoi(s);
   /* Forbid impossible combination of loopback options */
   if( opts->tcp_server_loopback == CITP_TCP_LOOPBACK_OFF &&
       opts->tcp_client_loopback == CITP_TCP_LOOPBACK_SAMESTACK )
@@ -1190,14 +1233,22 @@ void ci_netif_config_opts_getenv(ci_netif_config_opts* opts)
   if ( (s = getenv("EF_TCP_SYNRECV_MAX")) ) {
     opts->tcp_synrecv_max = atoi(s);
   }
-  /* Number of aux buffers is tcp_synrecv_max * 2.
-   * Number of ep buffers which can be used by aux bufs is
-   * tcp_synrecv_max * 2 / 7.
+  if ( (s = getenv("EF_TCP_ACCEPT_PREALLOC")) )
+    opts->tcp_accept_prealloc = atoi(s);
+  if( opts->tcp_accept_prealloc > opts->max_ep_bufs / 2 ) {
+    CONFIG_LOG(opts, CONFIG_WARNINGS, "EF_TCP_ACCEPT_PREALLOC=%d reduced to "
+               "%d (half of EF_MAX_ENDPOINTS=%d)", opts->tcp_accept_prealloc,
+               opts->max_ep_bufs / 2, opts->max_ep_bufs);
+    opts->tcp_accept_prealloc = opts->max_ep_bufs / 2;
+  }
+  /* Number of synrecv aux buffers is tcp_synrecv_max.
+   * Number of ep buffers which can be used by them is
+   * tcp_synrecv_max / 7.
    * And we need some space for real endpoints. */
-  if( opts->tcp_synrecv_max * 4 > opts->max_ep_bufs * 7 ) {
+  if( opts->tcp_synrecv_max * 2 > opts->max_ep_bufs * 7 ) {
     CONFIG_LOG(opts, CONFIG_WARNINGS, "%s: EF_TCP_SYNRECV_MAX=%d and "
                "EF_MAX_ENDPOINTS=%d are inconsistent.",
-               opts->tcp_synrecv_max * 2 > opts->max_ep_bufs * 7 ?
+               opts->tcp_synrecv_max > opts->max_ep_bufs * 7 ?
                "ERROR" : "WARNING",
                opts->tcp_synrecv_max, opts->max_ep_bufs);
     if( getenv("EF_TCP_SYNRECV_MAX") == NULL ) {
@@ -1220,6 +1271,9 @@ void ci_netif_config_opts_getenv(ci_netif_config_opts* opts)
     opts->loss_min_cwnd = atoi(s);
   if ( (s = getenv("EF_TCP_MIN_CWND")) )
     opts->min_cwnd = atoi(s);
+
+  static const char* const cc_opts[] = { "reno", "cubic", "dctcp", 0 };
+  opts->tcp_cong_algo = parse_enum(opts, "EF_TCP_CONGESTION", cc_opts, "reno");
 #if CI_CFG_TCP_FASTSTART
   if ( (s = getenv("EF_TCP_FASTSTART_INIT")) )
     opts->tcp_faststart_init = atoi(s);
@@ -1295,6 +1349,22 @@ void ci_netif_config_opts_getenv(ci_netif_config_opts* opts)
 
   if( (s = getenv("EF_TX_TIMESTAMPING")) )
     opts->tx_timestamping = atoi(s);
+#if CI_CFG_LAT_HIST
+  if( (s = getenv("EF_LATENCY_HIST")) )
+    opts->latency_hist = atoi(s);
+  if( (s = getenv("EF_LATENCY_HIST_SOCKETS")) )
+    opts->latency_hist_sockets = atoi(s);
+#endif
+#if CI_CFG_TCPDUMP_RING
+  if( (s = getenv("EF_TCPDUMP_RING_SIZE")) )
+    opts->tcpdump_ring_size = atoi(s);
+#endif
+#if CI_CFG_STATS_RING
+  if( (s = getenv("EF_STATS_RING_SIZE")) )
+    opts->stats_ring_size = atoi(s);
+  if( (s = getenv("EF_STATS_RING_INTERVAL")) )
+    opts->stats_ring_interval = atoi(s);
+#endif
 
   if( (s = getenv("EF_TIMESTAMPING_REPORTING")) )
     opts->timestamping_reporting = atoi(s);
@@ -1809,9 +1879,33 @@ static void netif_tcp_helper_build2(ci_netif* ni)
     (ci_tcp_prev_seq_t*) ((char*) ni->state + ni->state->seq_table_ofs);
   ni->filter_table =
     (ci_netif_filter_table*) ((char*) ni->state + ni->state->table_ofs);
+  ni->synrecv_table =
+    (ci_tcp_synrecv_table*) ((char*) ni->state +
+                             ni->state->synrecv_table_ofs);
 #if CI_CFG_IPV6
   ni->ip6_filter_table =
     (ci_ip6_netif_filter_table*) ((char*) ni->state + ni->state->ip6_table_ofs);
+#endif
+#if CI_CFG_UDP
+  ni->udp_tx_stage = ni->state->udp_tx_stage_ofs == 0 ? NULL :
+    (ci_udp_tx_stage*) ((char*) ni->state + ni->state->udp_tx_stage_ofs);
+#endif
+#if CI_CFG_LAT_HIST
+  ni->lat_hist_socks = ni->state->lat_hist_ofs == 0 ? NULL :
+    (ci_lat_hists*) ((char*) ni->state + ni->state->lat_hist_ofs);
+#endif
+#if CI_CFG_TCPDUMP_RING
+  ni->capture_ring = ni->state->capture_ring_ofs == 0 ? NULL :
+    (struct oo_capture_ring*) ((char*) ni->state +
+                               ni->state->capture_ring_ofs);
+#endif
+#if CI_CFG_STATS_RING
+  ni->stats_ring = ni->state->stats_ring_ofs == 0 ? NULL :
+    (struct oo_stats_ring*) ((char*) ni->state + ni->state->stats_ring_ofs);
+#endif
+#if CI_CFG_SPIN_ADAPT
+  ni->spin_adapt = ni->state->spin_adapt_ofs == 0 ? NULL :
+    (struct oo_spin_adapt*) ((char*) ni->state + ni->state->spin_adapt_ofs);
 #endif
   ni->packets = (oo_pktbuf_manager*) ((char*) ni->state + ni->state->buf_ofs);
 }
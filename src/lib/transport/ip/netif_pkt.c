@@ -27,6 +27,7 @@
 
 #if !defined(__KERNEL__)
 #include <onload/mmap.h>
+#include <onload/ul/per_thread.h>
 #include <sys/shm.h>
 
 pthread_mutex_t citp_pkt_map_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -96,9 +97,44 @@ ci_ip_pkt_fmt* __ci_netif_pkt(ci_netif* ni, unsigned id)
   return pkt;
 }
 
+
+static ci_uint32 ci_netif_pkt_nonb_magazine_next;
+
+/* Threads are dealt out to magazines round-robin on first use, as for the
+ * UDP TX staging rings.
+ */
+int ci_netif_pkt_nonb_magazine_id(void)
+{
+  struct oo_per_thread* pt = __oo_per_thread_get();
+  ci_uint32 id;
+
+  if(CI_UNLIKELY( pt->pkt_nonb_magazine == 0 )) {
+    do
+      id = ci_netif_pkt_nonb_magazine_next;
+    while( ci_cas32u_fail(&ci_netif_pkt_nonb_magazine_next, id, id + 1) );
+    pt->pkt_nonb_magazine = id % CI_CFG_PKT_NONB_MAGAZINES + 1;
+  }
+  return pt->pkt_nonb_magazine - 1;
+}
+
 #endif
 
 
+ci_ip_pkt_fmt* ci_netif_pkt_alloc_nonb_steal(ci_netif* ni, int not_mag)
+{
+  ci_ip_pkt_fmt* pkt;
+  int i;
+
+  for( i = 0; i < CI_CFG_PKT_NONB_MAGAZINES; ++i )
+    if( i != not_mag &&
+        (pkt = __ci_netif_pkt_nonb_pop(ni, &ni->state->nonb_magazine[i].link)) ) {
+      CITP_STATS_NETIF_INC(ni, pkt_nonb_magazine_steal);
+      return pkt;
+    }
+  return NULL;
+}
+
+
 int ci_netif_pktset_best(ci_netif* ni)
 {
   int i, ret = -1, n_free = 0;
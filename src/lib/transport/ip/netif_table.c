@@ -35,47 +35,57 @@
 int ci_netif_filter_lookup(ci_netif* netif, unsigned laddr, unsigned lport,
 			   unsigned raddr, unsigned rport, unsigned protocol)
 {
-  unsigned hash1, hash2 = 0;
+  unsigned bucket_i, bucket2, hash2, tag;
   ci_netif_filter_table* tbl;
-  unsigned first;
+  ci_netif_filter_table_bucket* bucket;
+  unsigned bucket_mask;
+  ci_uint32 match;
+  int hops;
 
   ci_assert(netif);
   ci_assert(ci_netif_is_locked(netif));
   ci_assert(netif->filter_table);
 
   tbl = netif->filter_table;
-  hash1 = onload_hash1(AF_INET, tbl->table_size_mask, &laddr, lport,
-                       &raddr, rport, protocol);
-  first = hash1;
+  bucket_mask = FILTER_BUCKET_MASK(tbl);
+  bucket_i = FILTER_BUCKET_FIRST(onload_hash1(AF_INET, tbl->table_size_mask,
+                                              &laddr, lport, &raddr, rport,
+                                              protocol));
+  hash2 = onload_hash2(AF_INET, &laddr, lport, &raddr, rport, protocol);
+  tag = onload_hash_tag(hash2);
+  bucket2 = ci_netif_filter_alt_bucket(bucket_i, tag, bucket_mask);
 
-  LOG_NV(log("tbl_lookup: %s %s:%u->%s:%u hash=%u:%u at=%u",
+  LOG_NV(log("tbl_lookup: %s %s:%u->%s:%u bucket=%u:%u:%u tag=%02x",
 	     CI_IP_PROTOCOL_STR(protocol),
 	     ip_addr_str(laddr), (unsigned) CI_BSWAP_BE16(lport),
 	     ip_addr_str(raddr), (unsigned) CI_BSWAP_BE16(rport),
-	     first, onload_hash2(AF_INET, &laddr, lport, &raddr, rport, protocol),
-	     hash1));
-
-  while( 1 ) {
-    int id = tbl->table[hash1].id;
-    if( CI_LIKELY(id >= 0) ) {
-      ci_sock_cmn* s = ID_TO_SOCK(netif, id);
-      if( ((laddr    - tbl->table[hash1].laddr) |
-	   (lport    - sock_lport_be16(s)     ) |
-	   (raddr    - sock_raddr_be32(s)     ) |
-	   (rport    - sock_rport_be16(s)     ) |
-	   (protocol - sock_protocol(s)       )) == 0 )
-      	return hash1;
+	     bucket_i, bucket2, hash2, tag));
+
+  for( hops = 0; ; ++hops ) {
+    bucket = &tbl->bucket[bucket_i];
+    match = onload_hash_tag_match(bucket->hdr.tags, tag);
+    while( match ) {
+      int way = ci_netif_filter_next_way(&match);
+      ci_sock_cmn* s = ID_TO_SOCK(netif, bucket->entry[way].id);
+      if( ((laddr    - bucket->entry[way].laddr) |
+	   (lport    - sock_lport_be16(s)      ) |
+	   (raddr    - sock_raddr_be32(s)      ) |
+	   (rport    - sock_rport_be16(s)      ) |
+	   (protocol - sock_protocol(s)        )) == 0 )
+        return FILTER_ID(bucket_i, way);
+    }
+    if( hops == 0 ) {
+      bucket_i = bucket2;
+      continue;
     }
-    if( id == EMPTY )  break;
-    /* We defer calculating hash2 until it's needed, just to make the fast
-     * case that little bit faster. */
-    if( hash1 == first )
-      hash2 = onload_hash2(AF_INET, &laddr, lport, &raddr, rport, protocol);
-    hash1 = (hash1 + hash2) & tbl->table_size_mask;
-    if( hash1 == first ) {
-      LOG_E(ci_log(FN_FMT "ERROR: LOOP %s:%u->%s:%u hash=%u:%u",
+    /* Nothing has overflowed past the alternate bucket (the usual case),
+     * or past this point in the overflow chain. */
+    if( CI_LIKELY(bucket->hdr.route_count == 0) )  break;
+    bucket_i = (bucket_i + hash2) & bucket_mask;
+    if( bucket_i == bucket2 ) {
+      LOG_E(ci_log(FN_FMT "ERROR: LOOP %s:%u->%s:%u bucket=%u:%u",
                    FN_PRI_ARGS(netif), ip_addr_str(laddr), lport,
-		   ip_addr_str(raddr), rport, hash1, hash2));
+		   ip_addr_str(raddr), rport, bucket_i, hash2));
       return -ELOOP;
     }
   }
@@ -101,6 +111,24 @@ ci_netif_filter_hash(ci_netif* ni, unsigned laddr, unsigned lport,
 }
 
 
+void
+ci_netif_filter_prefetch(ci_netif* ni, unsigned laddr, unsigned lport,
+                         unsigned raddr, unsigned rport, unsigned protocol)
+{
+  ci_netif_filter_table* tbl = ni->filter_table;
+  unsigned bucket_i, tag;
+
+  bucket_i = FILTER_BUCKET_FIRST(onload_hash1(AF_INET, tbl->table_size_mask,
+                                              &laddr, lport, &raddr, rport,
+                                              protocol));
+  tag = onload_hash_tag(onload_hash2(AF_INET, &laddr, lport, &raddr, rport,
+                                     protocol));
+  ci_prefetch(&tbl->bucket[bucket_i]);
+  ci_prefetch(&tbl->bucket[ci_netif_filter_alt_bucket(bucket_i, tag,
+                                                    FILTER_BUCKET_MASK(tbl))]);
+}
+
+
 ci_inline int ci_sock_intf_check(ci_netif* ni, ci_sock_cmn* s,
                                  int intf_i, int vlan)
 {
@@ -122,9 +150,9 @@ for_each_match_common(ci_netif* ni,
 #if CI_CFG_IPV6
   ci_ip6_netif_filter_table* ip6_tbl = NULL;
 #endif
-  unsigned hash1, hash2 = 0;
-  unsigned first, table_size_mask;
-  int af;
+  unsigned bucket_i, bucket2, hash2, tag;
+  unsigned table_size_mask, bucket_mask;
+  int af, hops;
   void *laddr_ptr, *raddr_ptr;
 
   tbl = ni->filter_table;
@@ -148,53 +176,64 @@ for_each_match_common(ci_netif* ni,
 
   if( hash_out != NULL )
     *hash_out = onload_hash3(af, laddr_ptr, lport, raddr_ptr, rport, protocol);
-  hash1 = onload_hash1(af, table_size_mask, laddr_ptr, lport,
-                       raddr_ptr, rport, protocol);
-  first = hash1;
-
-  LOG_NV(log("%s: %s " IPX_PORT_FMT "->" IPX_PORT_FMT " hash=%u:%u at=%u",
-             __FUNCTION__, CI_IP_PROTOCOL_STR(protocol),
+  bucket_mask = table_size_mask >> CI_NETIF_FILTER_BUCKET_SHIFT;
+  bucket_i = FILTER_BUCKET_FIRST(onload_hash1(af, table_size_mask, laddr_ptr,
+                                              lport, raddr_ptr, rport,
+                                              protocol));
+  hash2 = onload_hash2(af, laddr_ptr, lport, raddr_ptr, rport, protocol);
+  tag = onload_hash_tag(hash2);
+  bucket2 = ci_netif_filter_alt_bucket(bucket_i, tag, bucket_mask);
+
+  LOG_NV(log("%s: %s " IPX_PORT_FMT "->" IPX_PORT_FMT " bucket=%u:%u:%u "
+             "tag=%02x", __FUNCTION__, CI_IP_PROTOCOL_STR(protocol),
 	     IPX_ARG(AF_IP(laddr)), (unsigned) CI_BSWAP_BE16(lport),
 	     IPX_ARG(AF_IP(raddr)), (unsigned) CI_BSWAP_BE16(rport),
-	     first, onload_hash2(af, laddr_ptr, lport, raddr_ptr, rport, protocol),
-	     hash1));
+	     bucket_i, bucket2, hash2, tag));
 
-  while( 1 ) {
-    int id;
+  for( hops = 0; ; ++hops ) {
+    const ci_netif_filter_bucket_hdr* hdr;
+    ci_uint32 match;
 
 #if CI_CFG_IPV6
     if ( af == AF_INET6 ) {
-      id = ip6_tbl->table[hash1].id;
+      hdr = &ip6_tbl->bucket[bucket_i].hdr;
     }
     else
 #endif
     {
-      id = tbl->table[hash1].id;
+      hdr = &tbl->bucket[bucket_i].hdr;
     }
-    if(CI_LIKELY( id >= 0 )) {
+
+    match = ci_netif_filter_match_ways(hdr, tag, hops);
+    while( match ) {
+      int way = ci_netif_filter_next_way(&match);
       int is_match = 0;
+      ci_sock_cmn* s;
 
-      ci_sock_cmn* s = ID_TO_SOCK(ni, id);
 #if CI_CFG_IPV6
       if ( af == AF_INET6 ) {
-        if( !memcmp(laddr.ip6, ip6_tbl->table[hash1].laddr, sizeof(ci_ip6_addr_t)) &&
+        ci_ip6_netif_filter_table_entry* entry =
+          &ip6_tbl->bucket[bucket_i].entry[way];
+        s = ID_TO_SOCK(ni, entry->id);
+        if( !memcmp(laddr.ip6, entry->laddr, sizeof(ci_ip6_addr_t)) &&
             !memcmp(raddr.ip6, sock_ip6_raddr(s), sizeof(ci_ip6_addr_t)) &&
             lport == sock_lport_be16(s) && rport == sock_rport_be16(s) &&
             protocol == sock_protocol(s)) {
           is_match = 1;
 
           LOG_NV(ci_log("match %s: %s " IPX_PORT_FMT "->"
-                        IPX_PORT_FMT " hash=%u:%u at=%u",
+                        IPX_PORT_FMT " bucket=%u:%u at=%d",
                         __FUNCTION__, CI_IP_PROTOCOL_STR(protocol),
                         IPX_ARG(AF_IP(laddr)), (unsigned) CI_BSWAP_BE16(lport),
                         IPX_ARG(AF_IP(raddr)), (unsigned) CI_BSWAP_BE16(rport),
-                        first, onload_hash2(af, laddr_ptr, lport, raddr_ptr,
-                        rport, protocol), hash1));
+                        bucket2, hash2, FILTER_ID(bucket_i, way)));
         }
       } else
 #endif
       {
-        if( ((laddr.ip4 - tbl->table[hash1].laddr) |
+        ci_netif_filter_table_entry* entry = &tbl->bucket[bucket_i].entry[way];
+        s = ID_TO_SOCK(ni, entry->id);
+        if( ((laddr.ip4 - entry->laddr         ) |
             (lport      - sock_lport_be16(s)     ) |
             (raddr.ip4  - sock_raddr_be32(s)     ) |
             (rport      - sock_rport_be16(s)     ) |
@@ -206,18 +245,19 @@ for_each_match_common(ci_netif* ni,
         if( callback(s, callback_arg) != 0 )
           return 1;
     }
-    else if( id == EMPTY )
+
+    if( hops == 0 ) {
+      bucket_i = bucket2;
+      continue;
+    }
+    if( hdr->route_count == 0 )
       break;
-    /* We defer calculating hash2 until it's needed, just to make the fast
-    ** case that little bit faster. */
-    if( hash1 == first )
-      hash2 = onload_hash2(af, laddr_ptr, lport, raddr_ptr, rport, protocol);
-    hash1 = (hash1 + hash2) & table_size_mask;
-    if( hash1 == first ) {
+    bucket_i = (bucket_i + hash2) & bucket_mask;
+    if( bucket_i == bucket2 ) {
       LOG_NV(ci_log(FN_FMT "ITERATE FULL " IPX_PORT_FMT "->"
-                    IPX_PORT_FMT " hash=%u:%u",
+                    IPX_PORT_FMT " bucket=%u:%u",
                     FN_PRI_ARGS(ni), IPX_ARG(AF_IP(laddr)), lport,
-                    IPX_ARG(AF_IP(raddr)), rport, hash1, hash2));
+                    IPX_ARG(AF_IP(raddr)), rport, bucket_i, hash2));
       break;
     }
   }
@@ -252,6 +292,114 @@ ci_netif_filter_for_each_match_ip6(ci_netif* ni,
 }
 
 
+#define FILTER_MOVE_SEARCH_MAX  64
+
+/* Searches breadth-first for a sequence of moves, each taking an entry to
+ * its other bucket, that frees a way in [bucket1] or [bucket2].  On success
+ * [path] holds the slots involved, starting with the one that is freed in
+ * [bucket1] or [bucket2] and ending with a slot that is currently free.
+ * Returns the length of [path], or zero if no short enough sequence exists.
+ */
+int
+ci_netif_filter_find_moves(char* buckets, size_t bucket_size,
+                           unsigned bucket_mask, unsigned bucket1,
+                           unsigned bucket2, ci_netif_filter_slot* path)
+{
+  struct {
+    ci_netif_filter_slot slot;
+    int                  parent;
+  } node[FILTER_MOVE_SEARCH_MAX];
+  const ci_netif_filter_bucket_hdr* hdr;
+  unsigned roots[2] = { bucket1, bucket2 };
+  unsigned alt;
+  ci_uint32 ways;
+  int head, tail = 0, i, j, n;
+
+  /* Entries that have overflowed are not in either of their own buckets, so
+   * cannot be moved. */
+  for( i = 0; i < 2; ++i ) {
+    hdr = FILTER_BUCKET_HDR(buckets, bucket_size, roots[i]);
+    ways = ~hdr->overflow & FILTER_WAYS_ALL;
+    while( ways ) {
+      node[tail].slot.bucket_i = roots[i];
+      node[tail].slot.way = ci_netif_filter_next_way(&ways);
+      node[tail].parent = -1;
+      ++tail;
+    }
+  }
+
+  for( head = 0; head < tail; ++head ) {
+    hdr = FILTER_BUCKET_HDR(buckets, bucket_size, node[head].slot.bucket_i);
+    alt = ci_netif_filter_alt_bucket(node[head].slot.bucket_i,
+                                     FILTER_TAG(hdr, node[head].slot.way),
+                                     bucket_mask);
+    hdr = FILTER_BUCKET_HDR(buckets, bucket_size, alt);
+
+    ways = onload_hash_tag_match(hdr->tags, 0);
+    if( ways ) {
+      n = 1;
+      for( i = head; i >= 0; i = node[i].parent )
+        ++n;
+      ci_assert_le(n, FILTER_MOVE_PATH_MAX);
+      path[n - 1].bucket_i = alt;
+      path[n - 1].way = ci_netif_filter_next_way(&ways);
+      for( i = head, j = n - 2; i >= 0; i = node[i].parent, --j )
+        path[j] = node[i].slot;
+      return n;
+    }
+
+    ways = ~hdr->overflow & FILTER_WAYS_ALL;
+    while( ways && tail < FILTER_MOVE_SEARCH_MAX ) {
+      int way = ci_netif_filter_next_way(&ways);
+      /* A slot must not appear twice in a path, or the moves would leave
+       * it occupied. */
+      for( i = head; i >= 0; i = node[i].parent )
+        if( node[i].slot.bucket_i == alt && node[i].slot.way == way )
+          break;
+      if( i >= 0 )
+        continue;
+      node[tail].slot.bucket_i = alt;
+      node[tail].slot.way = way;
+      node[tail].parent = head;
+      ++tail;
+    }
+  }
+
+  return 0;
+}
+
+
+/* Carries out the moves found by ci_netif_filter_find_moves(), leaving
+ * [path[0]] free.  Moves are done from the end of the path so that every
+ * entry remains in one of its own buckets throughout.
+ */
+void
+ci_netif_filter_do_moves(char* buckets, size_t bucket_size,
+                         size_t entry_ofs, size_t entry_size,
+                         const ci_netif_filter_slot* path, int path_len)
+{
+  ci_netif_filter_bucket_hdr *src, *dst;
+  int i;
+
+  CI_BUILD_ASSERT(CI_MEMBER_OFFSET(ci_netif_filter_table_entry, id) == 0);
+#if CI_CFG_IPV6
+  CI_BUILD_ASSERT(CI_MEMBER_OFFSET(ci_ip6_netif_filter_table_entry, id) == 0);
+#endif
+
+  for( i = path_len - 2; i >= 0; --i ) {
+    src = FILTER_BUCKET_HDR(buckets, bucket_size, path[i].bucket_i);
+    dst = FILTER_BUCKET_HDR(buckets, bucket_size, path[i + 1].bucket_i);
+    ci_assert_equal(FILTER_TAG(dst, path[i + 1].way), 0);
+    memcpy((char*) dst + entry_ofs + path[i + 1].way * entry_size,
+           (char*) src + entry_ofs + path[i].way * entry_size, entry_size);
+    dst->tags = ci_netif_filter_set_tag(dst->tags, path[i + 1].way,
+                                        FILTER_TAG(src, path[i].way));
+    src->tags = ci_netif_filter_set_tag(src->tags, path[i].way, 0);
+    *(ci_int32*) ((char*) src + entry_ofs + path[i].way * entry_size) = EMPTY;
+  }
+}
+
+
 /* Insert for either TCP or UDP */
 static int
 ci_ip4_netif_filter_insert(ci_netif_filter_table* tbl,
@@ -260,60 +408,88 @@ ci_ip4_netif_filter_insert(ci_netif_filter_table* tbl,
                            unsigned raddr, unsigned rport,
                            unsigned protocol)
 {
+  ci_netif_filter_table_bucket* bucket;
   ci_netif_filter_table_entry* entry;
-  unsigned hash1, hash2;
-#if !defined(NDEBUG) || CI_CFG_STATS_NETIF
-  unsigned hops = 1;
-#endif
-  unsigned first;
-
-  hash1 = onload_hash1(AF_INET, tbl->table_size_mask, &laddr, lport,
-                       &raddr, rport, protocol);
+  ci_netif_filter_slot path[FILTER_MOVE_PATH_MAX];
+  unsigned bucket_i, bucket1, bucket2, hash2, tag, i;
+  unsigned bucket_mask;
+  ci_uint32 free_ways;
+  int way, path_len, overflow = 0;
+  unsigned hops;
+
+  bucket_mask = FILTER_BUCKET_MASK(tbl);
+  bucket1 = FILTER_BUCKET_FIRST(onload_hash1(AF_INET, tbl->table_size_mask,
+                                             &laddr, lport, &raddr, rport,
+                                             protocol));
   hash2 = onload_hash2(AF_INET, &laddr, lport, &raddr, rport, protocol);
-  first = hash1;
+  tag = onload_hash_tag(hash2);
+  bucket2 = ci_netif_filter_alt_bucket(bucket1, tag, bucket_mask);
 
-  /* Find a free slot. */
-  while( 1 ) {
-    entry = &tbl->table[hash1];
-    if( entry->id < 0 )  break;
-
-    ++entry->route_count;
-#if !defined(NDEBUG) || CI_CFG_STATS_NETIF
-    ++hops;
-#endif
+  if( (free_ways = onload_hash_tag_match(tbl->bucket[bucket1].hdr.tags,
+                                         0)) ) {
+    bucket_i = bucket1;
+    hops = 1;
+  }
+  else if( (free_ways = onload_hash_tag_match(tbl->bucket[bucket2].hdr.tags,
+                                              0)) ) {
+    bucket_i = bucket2;
+    hops = 2;
+  }
+  else if( (path_len = ci_netif_filter_find_moves(FILTER_BUCKETS(tbl),
+                                                  bucket_mask, bucket1,
+                                                  bucket2, path)) ) {
+    ci_netif_filter_do_moves(FILTER_BUCKETS(tbl), FILTER_ENTRIES(tbl),
+                             path, path_len);
+    CITP_STATS_NETIF_ADD(netif, sw_filter_insert_moves, path_len - 1);
+    bucket_i = path[0].bucket_i;
+    free_ways = FILTER_WAY_BIT(path[0].way);
+    hops = bucket_i == bucket1 ? 1 : 2;
+  }
+  else {
+    /* Both buckets are full of entries that cannot be moved, so probe on
+     * from the alternate bucket for a free way. */
+    bucket_i = bucket2;
+    hops = 2;
+    do {
+      bucket_i = (bucket_i + hash2) & bucket_mask;
+      ++hops;
+      if( bucket_i == bucket2 ) {
+        ci_sock_cmn *s = SP_TO_SOCK_CMN(netif, tcp_id);
+        if( ! (s->s_flags & CI_SOCK_FLAG_SW_FILTER_FULL) ) {
+          LOG_E(ci_log(FN_FMT "%d FULL %s %s:%u->%s:%u hops=%u",
+                       FN_PRI_ARGS(netif),
+                       OO_SP_FMT(tcp_id), CI_IP_PROTOCOL_STR(protocol),
+                       ip_addr_str(laddr), (unsigned) CI_BSWAP_BE16(lport),
+                       ip_addr_str(raddr), (unsigned) CI_BSWAP_BE16(rport),
+                       hops));
+          s->s_flags |= CI_SOCK_FLAG_SW_FILTER_FULL;
+        }
 
-    /* A socket can only have multiple entries in the filter table if each
-     * entry has a different [laddr].
-     */
-    ci_assert(
-      !((entry->id == OO_SP_TO_INT(tcp_id)) && (laddr == entry->laddr)) );
-
-    hash1 = (hash1 + hash2) & tbl->table_size_mask;
-
-    if( hash1 == first ) {
-      ci_sock_cmn *s = SP_TO_SOCK_CMN(netif, tcp_id);
-      if( ! (s->s_flags & CI_SOCK_FLAG_SW_FILTER_FULL) ) {
-        LOG_E(ci_log(FN_FMT "%d FULL %s %s:%u->%s:%u hops=%u",
-                     FN_PRI_ARGS(netif),
-                     OO_SP_FMT(tcp_id), CI_IP_PROTOCOL_STR(protocol),
-                     ip_addr_str(laddr), (unsigned) CI_BSWAP_BE16(lport),
-                     ip_addr_str(raddr), (unsigned) CI_BSWAP_BE16(rport),
-                     hops));
-        s->s_flags |= CI_SOCK_FLAG_SW_FILTER_FULL;
+        CITP_STATS_NETIF_INC(netif, sw_filter_insert_table_full);
+        return -ENOBUFS;
       }
-
-      CITP_STATS_NETIF_INC(netif, sw_filter_insert_table_full);
-      return -ENOBUFS;
-    }
+      free_ways = onload_hash_tag_match(tbl->bucket[bucket_i].hdr.tags, 0);
+    } while( ! free_ways );
+
+    /* Lookups give up at the first bucket in the chain that nothing has
+     * overflowed past, so mark each one that we skipped. */
+    for( i = bucket2; i != bucket_i; i = (i + hash2) & bucket_mask )
+      if( tbl->bucket[i].hdr.route_count++ == 0 )
+        CITP_STATS_NETIF(++netif->state->stats.table_n_overflowed);
+    overflow = 1;
   }
 
+  bucket = &tbl->bucket[bucket_i];
+  way = ci_netif_filter_next_way(&free_ways);
+  entry = &bucket->entry[way];
+
   /* Now insert the new entry. */
-  LOG_TC(ci_log(FN_FMT "%d INSERT %s %s:%u->%s:%u hash=%u:%u at=%u "
-    "over=%d hops=%u", FN_PRI_ARGS(netif), OO_SP_FMT(tcp_id),
+  LOG_TC(ci_log(FN_FMT "%d INSERT %s %s:%u->%s:%u bucket=%u:%u:%u at=%d "
+    "tag=%02x hops=%u", FN_PRI_ARGS(netif), OO_SP_FMT(tcp_id),
                 CI_IP_PROTOCOL_STR(protocol),
     ip_addr_str(laddr), (unsigned) CI_BSWAP_BE16(lport),
     ip_addr_str(raddr), (unsigned) CI_BSWAP_BE16(rport),
-    first, hash2, hash1, entry->id, hops));
+    bucket1, bucket2, hash2, FILTER_ID(bucket_i, way), tag, hops));
 
 #if CI_CFG_STATS_NETIF
   if( hops > netif->state->stats.table_max_hops )
@@ -324,48 +500,45 @@ ci_ip4_netif_filter_insert(ci_netif_filter_table* tbl,
   netif->state->stats.table_mean_hops =
     (netif->state->stats.table_mean_hops * 9 + hops) / 10;
 
-  if( entry->id == EMPTY )
-    ++netif->state->stats.table_n_slots;
   ++netif->state->stats.table_n_entries;
 #endif
 
   entry->id = OO_SP_TO_INT(tcp_id);
   entry->laddr = laddr;
+  bucket->hdr.tags = ci_netif_filter_set_tag(bucket->hdr.tags, way, tag);
+  if( overflow )
+    bucket->hdr.overflow |= FILTER_WAY_BIT(way);
   return 0;
 }
 
 
 static void
 __ci_ip4_netif_filter_remove(ci_netif_filter_table* tbl, ci_netif* ni,
-                             unsigned hash1, unsigned hash2,
-                             int hops, unsigned last_tbl_i)
+                             unsigned bucket2, unsigned hash2,
+                             int hops, unsigned last_bucket_i, int way)
 {
-  ci_netif_filter_table_entry* entry;
-  unsigned tbl_i;
+  ci_netif_filter_table_bucket* bucket;
+  unsigned bucket_i, bucket_mask;
   int i;
 
-  tbl_i = hash1;
-  for( i = 0; i < hops; ++i ) {
-    entry = &tbl->table[tbl_i];
-    ci_assert(entry->id != EMPTY);
-    ci_assert(entry->route_count > 0);
-    if( --entry->route_count == 0 && entry->id == TOMBSTONE ) {
-      CITP_STATS_NETIF(--ni->state->stats.table_n_slots);
-      entry->id = EMPTY;
-    }
-    tbl_i = (tbl_i + hash2) & tbl->table_size_mask;
+  /* An entry found at [hops] >= 2 is in the overflow chain, and every
+   * bucket in the chain before it has counted it. */
+  bucket_mask = FILTER_BUCKET_MASK(tbl);
+  bucket_i = bucket2;
+  for( i = 1; i < hops; ++i ) {
+    bucket = &tbl->bucket[bucket_i];
+    ci_assert_gt(bucket->hdr.route_count, 0);
+    if( --bucket->hdr.route_count == 0 )
+      CITP_STATS_NETIF(--ni->state->stats.table_n_overflowed);
+    bucket_i = (bucket_i + hash2) & bucket_mask;
   }
-  ci_assert(tbl_i == last_tbl_i);
+  ci_assert(hops < 2 || bucket_i == last_bucket_i);
 
   CITP_STATS_NETIF(--ni->state->stats.table_n_entries);
-  entry = &tbl->table[tbl_i];
-  if( entry->route_count == 0 ) {
-    CITP_STATS_NETIF(--ni->state->stats.table_n_slots);
-    entry->id = EMPTY;
-  }
-  else {
-    entry->id = TOMBSTONE;
-  }
+  bucket = &tbl->bucket[last_bucket_i];
+  bucket->entry[way].id = EMPTY;
+  bucket->hdr.tags = ci_netif_filter_set_tag(bucket->hdr.tags, way, 0);
+  bucket->hdr.overflow &= ~FILTER_WAY_BIT(way);
 }
 
 
@@ -376,10 +549,12 @@ ci_ip4_netif_filter_remove(ci_netif_filter_table* tbl,
                            unsigned raddr, unsigned rport,
                            unsigned protocol)
 {
-  ci_netif_filter_table_entry* entry;
-  unsigned hash1, hash2, tbl_i;
-  int hops = 0;
-  unsigned first;
+  ci_netif_filter_table_bucket* bucket;
+  unsigned bucket_i, bucket2, hash2, tag;
+  unsigned bucket_mask;
+  ci_uint32 match;
+  int hops;
+  int way;
 
   ci_assert(ci_netif_is_locked(netif)
 #ifdef __KERNEL__
@@ -390,34 +565,42 @@ ci_ip4_netif_filter_remove(ci_netif_filter_table* tbl,
 #endif
             );
 
-  hash1 = onload_hash1(AF_INET, tbl->table_size_mask, &laddr, lport,
-                       &raddr, rport, protocol);
+  bucket_mask = FILTER_BUCKET_MASK(tbl);
+  bucket_i = FILTER_BUCKET_FIRST(onload_hash1(AF_INET, tbl->table_size_mask,
+                                              &laddr, lport, &raddr, rport,
+                                              protocol));
   hash2 = onload_hash2(AF_INET, &laddr, lport, &raddr, rport, protocol);
-  first = hash1;
+  tag = onload_hash_tag(hash2);
+  bucket2 = ci_netif_filter_alt_bucket(bucket_i, tag, bucket_mask);
 
-  LOG_TC(ci_log("%s: [%d:%d] REMOVE %s %s:%u->%s:%u hash=%u:%u",
+  LOG_TC(ci_log("%s: [%d:%d] REMOVE %s %s:%u->%s:%u bucket=%u:%u:%u",
                 __FUNCTION__, NI_ID(netif), OO_SP_FMT(sock_p),
                 CI_IP_PROTOCOL_STR(protocol),
     ip_addr_str(laddr), (unsigned) CI_BSWAP_BE16(lport),
     ip_addr_str(raddr), (unsigned) CI_BSWAP_BE16(rport),
-    hash1, hash2));
-
-  tbl_i = hash1;
-  while( 1 ) {
-    entry = &tbl->table[tbl_i];
-    if( entry->id == OO_SP_TO_INT(sock_p) ) {
-      if( laddr == entry->laddr )
-        break;
+    bucket_i, bucket2, hash2));
+
+  for( hops = 0; ; ++hops ) {
+    bucket = &tbl->bucket[bucket_i];
+    match = ci_netif_filter_match_ways(&bucket->hdr, tag, hops);
+    while( match ) {
+      way = ci_netif_filter_next_way(&match);
+      if( bucket->entry[way].id == OO_SP_TO_INT(sock_p) &&
+          bucket->entry[way].laddr == laddr )
+        goto found;
     }
-    else if( entry->id == EMPTY ) {
+    if( hops == 0 ) {
+      bucket_i = bucket2;
+      continue;
+    }
+    if( bucket->hdr.route_count == 0 ) {
       /* We allow multiple removes of the same filter -- helps avoid some
        * complexity in the filter module.
        */
       return;
     }
-    tbl_i = (tbl_i + hash2) & tbl->table_size_mask;
-    ++hops;
-    if( tbl_i == first ) {
+    bucket_i = (bucket_i + hash2) & bucket_mask;
+    if( bucket_i == bucket2 ) {
       LOG_E(ci_log(FN_FMT "ERROR: LOOP [%d] %s %s:%u->%s:%u",
                    FN_PRI_ARGS(netif), OO_SP_FMT(sock_p),
                    CI_IP_PROTOCOL_STR(protocol),
@@ -427,7 +610,9 @@ ci_ip4_netif_filter_remove(ci_netif_filter_table* tbl,
     }
   }
 
-  __ci_ip4_netif_filter_remove(tbl, netif, hash1, hash2, hops, tbl_i);
+ found:
+  __ci_ip4_netif_filter_remove(tbl, netif, bucket2, hash2, hops, bucket_i,
+                               way);
 }
 
 int
@@ -503,19 +688,24 @@ ci_netif_filter_remove(ci_netif* netif, oo_sp sock_p, int af_space,
 
 void ci_netif_filter_init(ci_netif_filter_table* tbl, int size_lg2)
 {
-  unsigned i;
+  unsigned i, way;
   unsigned size = ci_pow2(size_lg2);
 
   ci_assert(tbl);
-  ci_assert_gt(size_lg2, 0);
+  /* Need at least two buckets for each entry to have two choices. */
+  ci_assert_gt(size_lg2, CI_NETIF_FILTER_BUCKET_SHIFT);
   ci_assert_le(size_lg2, 32);
 
   tbl->table_size_mask = size - 1;
 
-  for( i = 0; i < size; ++i ) {
-    tbl->table[i].id = EMPTY;
-    tbl->table[i].route_count = 0;
-    tbl->table[i].laddr = 0;
+  for( i = 0; i < (size >> CI_NETIF_FILTER_BUCKET_SHIFT); ++i ) {
+    tbl->bucket[i].hdr.tags = 0;
+    tbl->bucket[i].hdr.overflow = 0;
+    tbl->bucket[i].hdr.route_count = 0;
+    for( way = 0; way < CI_NETIF_FILTER_BUCKET_WAYS; ++way ) {
+      tbl->bucket[i].entry[way].id = EMPTY;
+      tbl->bucket[i].entry[way].laddr = 0;
+    }
   }
 }
 
@@ -535,7 +725,8 @@ ci_sock_cmn* __ci_netif_filter_lookup(ci_netif* netif, unsigned laddr,
 	     rc));    
 
   if(CI_LIKELY( rc >= 0 ))
-    return ID_TO_SOCK(netif, netif->filter_table->table[rc].id);
+    return ID_TO_SOCK(netif,
+                      CI_NETIF_FILTER_ENTRY(netif->filter_table, rc)->id);
 
   /* try wildcard lookup */
   raddr = rport = 0;
@@ -546,7 +737,8 @@ ci_sock_cmn* __ci_netif_filter_lookup(ci_netif* netif, unsigned laddr,
 	    rc));
 
   if(CI_LIKELY( rc >= 0 ))
-    return ID_TO_SOCK(netif, netif->filter_table->table[rc].id);
+    return ID_TO_SOCK(netif,
+                      CI_NETIF_FILTER_ENTRY(netif->filter_table, rc)->id);
  
   return 0;
 }
@@ -575,17 +767,18 @@ void ci_netif_filter_dump(ci_netif* ni)
 
   log("++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
 #if CI_CFG_STATS_NETIF
-  log(FN_FMT "size=%d n_entries=%i n_slots=%i max=%i mean=%i", FN_PRI_ARGS(ni),
-      tbl->table_size_mask + 1, ni->state->stats.table_n_entries,
-      ni->state->stats.table_n_slots, ni->state->stats.table_max_hops,
-      ni->state->stats.table_mean_hops);
+  log(FN_FMT "size=%d n_entries=%i n_overflowed=%i max=%i mean=%i",
+      FN_PRI_ARGS(ni), tbl->table_size_mask + 1,
+      ni->state->stats.table_n_entries, ni->state->stats.table_n_overflowed,
+      ni->state->stats.table_max_hops, ni->state->stats.table_mean_hops);
 #endif
 
   for( i = 0; i <= tbl->table_size_mask; ++i ) {
-    id = tbl->table[i].id;
-    if( CI_LIKELY(id >= 0) ) {
+    id = CI_NETIF_FILTER_ENTRY(tbl, i)->id;
+    if( FILTER_TAG(&tbl->bucket[i >> CI_NETIF_FILTER_BUCKET_SHIFT].hdr,
+                   i & (CI_NETIF_FILTER_BUCKET_WAYS - 1)) != 0 ) {
       ci_sock_cmn* s = ID_TO_SOCK(ni, id);
-      unsigned laddr = tbl->table[i].laddr;
+      unsigned laddr = CI_NETIF_FILTER_ENTRY(tbl, i)->laddr;
       int lport = sock_lport_be16(s);
       unsigned raddr = sock_raddr_be32(s);
       int rport = sock_rport_be16(s);
@@ -595,9 +788,11 @@ void ci_netif_filter_dump(ci_netif* ni)
       unsigned hash2 = onload_hash2(AF_INET, &laddr, lport, &raddr, rport, protocol);
       log("%010d id=%-10d rt_ct=%d %s "CI_IP_PRINTF_FORMAT":%d "
           CI_IP_PRINTF_FORMAT":%d %010d:%010d",
-	  i, id, tbl->table[i].route_count, CI_IP_PROTOCOL_STR(protocol),
+	  i, id, tbl->bucket[i >> CI_NETIF_FILTER_BUCKET_SHIFT].hdr.route_count,
+          CI_IP_PROTOCOL_STR(protocol),
           CI_IP_PRINTF_ARGS(&laddr), CI_BSWAP_BE16(lport),
-	  CI_IP_PRINTF_ARGS(&raddr), CI_BSWAP_BE16(rport), hash1, hash2);
+	  CI_IP_PRINTF_ARGS(&raddr), CI_BSWAP_BE16(rport),
+          FILTER_BUCKET_FIRST(hash1), hash2);
     }
   }
 #if CI_CFG_IPV6
@@ -20,9 +20,98 @@
 #define LPFU "udp_table: "
 
 
-#define TOMBSTONE  -1
 #define EMPTY      -2
 
+
+#define FILTER_BUCKET_MASK(tbl) \
+  ((tbl)->table_size_mask >> CI_NETIF_FILTER_BUCKET_SHIFT)
+
+#define FILTER_BUCKET_FIRST(hash1)  ((hash1) >> CI_NETIF_FILTER_BUCKET_SHIFT)
+
+#define FILTER_ID(bucket_i, way) \
+  ((int) (((bucket_i) << CI_NETIF_FILTER_BUCKET_SHIFT) | (way)))
+
+/* Bit 7 of each way's byte, as returned by onload_hash_tag_match(). */
+#define FILTER_WAYS_ALL  0x80808080u
+#define FILTER_WAY_BIT(way)  (0x80u << ((way) * 8))
+
+#define FILTER_TAG(hdr, way)  (((hdr)->tags >> ((way) * 8)) & 0xff)
+
+
+/* The other candidate bucket for an entry with [tag] in [bucket_i].  This
+ * is an involution, so it maps the alternate back to the primary, and it
+ * never returns [bucket_i] itself because the table always has at least
+ * two buckets.
+ */
+ci_inline unsigned ci_netif_filter_alt_bucket(unsigned bucket_i, unsigned tag,
+                                              unsigned bucket_mask)
+{
+  return bucket_i ^ (((tag * 0x5bd1e995u) | 1u) & bucket_mask);
+}
+
+
+/* Pops the lowest way from a mask returned by onload_hash_tag_match(). */
+ci_inline int ci_netif_filter_next_way(ci_uint32* match)
+{
+  int way = (ci_ffs64(*match) >> 3) - 1;
+  *match &= *match - 1;
+  return way;
+}
+
+
+ci_inline ci_uint32 ci_netif_filter_set_tag(ci_uint32 tags, int way,
+                                            unsigned tag)
+{
+  return (tags & ~(0xffu << (way * 8))) | (tag << (way * 8));
+}
+
+
+/* Matching ways in the [hops]th bucket of a probe sequence.  The first two
+ * buckets are the entry's own, and later ones are the overflow chain.
+ * Only entries that belong at this point in the sequence are returned, so
+ * that no entry is seen twice if the chain passes through the primary.
+ */
+ci_inline ci_uint32
+ci_netif_filter_match_ways(const ci_netif_filter_bucket_hdr* hdr,
+                           unsigned tag, int hops)
+{
+  ci_uint32 match = onload_hash_tag_match(hdr->tags, tag);
+  return hops < 2 ? match & ~hdr->overflow : match & hdr->overflow;
+}
+
+
+/* A slot in the table, as used to describe a sequence of cuckoo moves. */
+typedef struct {
+  unsigned bucket_i;
+  int      way;
+} ci_netif_filter_slot;
+
+#define FILTER_MOVE_PATH_MAX  8
+
+/* Layout of an IPv4 or IPv6 table, for the helpers below. */
+#define FILTER_BUCKETS(tbl) \
+  (char*) (tbl)->bucket, sizeof((tbl)->bucket[0])
+
+#define FILTER_ENTRIES(tbl)                                       \
+  CI_MEMBER_OFFSET(__typeof__((tbl)->bucket[0]), entry),          \
+  sizeof((tbl)->bucket[0].entry[0])
+
+#define FILTER_BUCKET_HDR(buckets, bucket_size, bucket_i)               \
+  ((ci_netif_filter_bucket_hdr*) ((buckets) +                           \
+                                  (size_t) (bucket_i) * (bucket_size)))
+
+extern int
+ci_netif_filter_find_moves(char* buckets, size_t bucket_size,
+                           unsigned bucket_mask, unsigned bucket1,
+                           unsigned bucket2,
+                           ci_netif_filter_slot* path) CI_HF;
+
+extern void
+ci_netif_filter_do_moves(char* buckets, size_t bucket_size,
+                         size_t entry_ofs, size_t entry_size,
+                         const ci_netif_filter_slot* path,
+                         int path_len) CI_HF;
+
 #if CI_CFG_IPV6
 int
 ci_ip6_netif_filter_insert(ci_ip6_netif_filter_table* tbl,
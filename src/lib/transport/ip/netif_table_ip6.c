@@ -27,95 +27,125 @@ ci_ip6_netif_filter_insert(ci_ip6_netif_filter_table* tbl,
                            const ci_addr_t raddr, unsigned rport,
                            unsigned protocol)
 {
+  ci_ip6_netif_filter_table_bucket* bucket;
   ci_ip6_netif_filter_table_entry* entry;
-  unsigned hash1, hash2;
-#if !defined(NDEBUG) || CI_CFG_STATS_NETIF
-  unsigned hops = 1;
-#endif
-  unsigned first, table_size_mask;
+  ci_netif_filter_slot path[FILTER_MOVE_PATH_MAX];
+  unsigned bucket_i, bucket1, bucket2, hash2, tag, i;
+  unsigned bucket_mask;
+  ci_uint32 free_ways;
+  int way, path_len, overflow = 0;
+  unsigned hops;
   char laddr_str[CI_INET6_ADDRSTRLEN], raddr_str[CI_INET6_ADDRSTRLEN];
   int af = AF_INET6;
 
   ci_assert(netif);
   ci_assert(ci_netif_is_locked(netif));
 
-  table_size_mask = tbl->table_size_mask;
+  bucket_mask = FILTER_BUCKET_MASK(tbl);
 
   ci_get_ip_str(laddr, laddr_str, sizeof(laddr_str));
   ci_get_ip_str(raddr, raddr_str, sizeof(raddr_str));
 
-  hash1 = onload_hash1(af, table_size_mask, laddr.ip6, lport,
-                       raddr.ip6, rport, protocol);
+  bucket1 = FILTER_BUCKET_FIRST(onload_hash1(af, tbl->table_size_mask,
+                                             laddr.ip6, lport, raddr.ip6,
+                                             rport, protocol));
   hash2 = onload_hash2(af, laddr.ip6, lport, raddr.ip6, rport, protocol);
-  first = hash1;
-
-  /* Find a free slot. */
-  while( 1 ) {
-    entry = &tbl->table[hash1];
-    if( entry->id < 0 )  break;
-
-    ++entry->route_count;
-#if !defined(NDEBUG) || CI_CFG_STATS_NETIF
-    ++hops;
-#endif
+  tag = onload_hash_tag(hash2);
+  bucket2 = ci_netif_filter_alt_bucket(bucket1, tag, bucket_mask);
 
-    hash1 = (hash1 + hash2) & table_size_mask;
-
-    if( hash1 == first ) {
-      ci_sock_cmn *s = SP_TO_SOCK_CMN(netif, tcp_id);
-      if( ! (s->s_flags & CI_SOCK_FLAG_SW_FILTER_FULL) ) {
-        LOG_E(ci_log(FN_FMT "%d FULL %s %s:%u->%s:%u hops=%u",
-                     FN_PRI_ARGS(netif),
-                     OO_SP_FMT(tcp_id), CI_IP_PROTOCOL_STR(protocol),
-                     laddr_str, (unsigned) CI_BSWAP_BE16(lport),
-                     raddr_str, (unsigned) CI_BSWAP_BE16(rport),
-                     hops));
-        s->s_flags |= CI_SOCK_FLAG_SW_FILTER_FULL;
+  if( (free_ways = onload_hash_tag_match(tbl->bucket[bucket1].hdr.tags,
+                                         0)) ) {
+    bucket_i = bucket1;
+    hops = 1;
+  }
+  else if( (free_ways = onload_hash_tag_match(tbl->bucket[bucket2].hdr.tags,
+                                              0)) ) {
+    bucket_i = bucket2;
+    hops = 2;
+  }
+  else if( (path_len = ci_netif_filter_find_moves(FILTER_BUCKETS(tbl),
+                                                  bucket_mask, bucket1,
+                                                  bucket2, path)) ) {
+    ci_netif_filter_do_moves(FILTER_BUCKETS(tbl), FILTER_ENTRIES(tbl),
+                             path, path_len);
+    CITP_STATS_NETIF_ADD(netif, sw_filter_insert_moves, path_len - 1);
+    bucket_i = path[0].bucket_i;
+    free_ways = FILTER_WAY_BIT(path[0].way);
+    hops = bucket_i == bucket1 ? 1 : 2;
+  }
+  else {
+    bucket_i = bucket2;
+    hops = 2;
+    do {
+      bucket_i = (bucket_i + hash2) & bucket_mask;
+      ++hops;
+      if( bucket_i == bucket2 ) {
+        ci_sock_cmn *s = SP_TO_SOCK_CMN(netif, tcp_id);
+        if( ! (s->s_flags & CI_SOCK_FLAG_SW_FILTER_FULL) ) {
+          LOG_E(ci_log(FN_FMT "%d FULL %s %s:%u->%s:%u hops=%u",
+                       FN_PRI_ARGS(netif),
+                       OO_SP_FMT(tcp_id), CI_IP_PROTOCOL_STR(protocol),
+                       laddr_str, (unsigned) CI_BSWAP_BE16(lport),
+                       raddr_str, (unsigned) CI_BSWAP_BE16(rport),
+                       hops));
+          s->s_flags |= CI_SOCK_FLAG_SW_FILTER_FULL;
+        }
+
+        CITP_STATS_NETIF_INC(netif, sw_filter_insert_table_full);
+        return -ENOBUFS;
       }
+      free_ways = onload_hash_tag_match(tbl->bucket[bucket_i].hdr.tags, 0);
+    } while( ! free_ways );
 
-      CITP_STATS_NETIF_INC(netif, sw_filter_insert_table_full);
-      return -ENOBUFS;
-    }
+    for( i = bucket2; i != bucket_i; i = (i + hash2) & bucket_mask )
+      ++tbl->bucket[i].hdr.route_count;
+    overflow = 1;
   }
 
+  bucket = &tbl->bucket[bucket_i];
+  way = ci_netif_filter_next_way(&free_ways);
+  entry = &bucket->entry[way];
+
   /* Now insert the new entry. */
-  LOG_TC(ci_log(FN_FMT "%d INSERT %s %s:%u->%s:%u hash=%u:%u at=%u "
-		"over=%d hops=%u", FN_PRI_ARGS(netif), OO_SP_FMT(tcp_id),
+  LOG_TC(ci_log(FN_FMT "%d INSERT %s %s:%u->%s:%u bucket=%u:%u:%u at=%d "
+		"tag=%02x hops=%u", FN_PRI_ARGS(netif), OO_SP_FMT(tcp_id),
                 CI_IP_PROTOCOL_STR(protocol),
 		laddr_str, (unsigned) CI_BSWAP_BE16(lport),
 		raddr_str, (unsigned) CI_BSWAP_BE16(rport),
-		first, hash2, hash1, entry->id, hops));
+		bucket1, bucket2, hash2, FILTER_ID(bucket_i, way), tag, hops));
 
   entry->id = OO_SP_TO_INT(tcp_id);
   memcpy(entry->laddr, laddr.ip6, sizeof(entry->laddr));
+  bucket->hdr.tags = ci_netif_filter_set_tag(bucket->hdr.tags, way, tag);
+  if( overflow )
+    bucket->hdr.overflow |= FILTER_WAY_BIT(way);
   return 0;
 }
 
 static void
 __ci_ip6_netif_filter_remove(ci_ip6_netif_filter_table* tbl,
-                             unsigned hash1, unsigned hash2,
-                             int hops, unsigned last_tbl_i)
+                             unsigned bucket2, unsigned hash2,
+                             int hops, unsigned last_bucket_i, int way)
 {
-  ci_ip6_netif_filter_table_entry* entry;
-  unsigned tbl_i, table_size_mask;
+  ci_ip6_netif_filter_table_bucket* bucket;
+  unsigned bucket_i, bucket_mask;
   int i;
 
-  table_size_mask = tbl->table_size_mask;
+  bucket_mask = FILTER_BUCKET_MASK(tbl);
 
-  tbl_i = hash1;
-  for( i = 0; i < hops; ++i ) {
-    entry = &tbl->table[tbl_i];
-    ci_assert(entry->id != EMPTY);
-    ci_assert(entry->route_count > 0);
-    if( --entry->route_count == 0 && entry->id == TOMBSTONE ) {
-      entry->id = EMPTY;
-    }
-    tbl_i = (tbl_i + hash2) & table_size_mask;
+  bucket_i = bucket2;
+  for( i = 1; i < hops; ++i ) {
+    bucket = &tbl->bucket[bucket_i];
+    ci_assert_gt(bucket->hdr.route_count, 0);
+    --bucket->hdr.route_count;
+    bucket_i = (bucket_i + hash2) & bucket_mask;
   }
-  ci_assert(tbl_i == last_tbl_i);
+  ci_assert(hops < 2 || bucket_i == last_bucket_i);
 
-  entry = &tbl->table[tbl_i];
-  entry->id = ( entry->route_count == 0 ) ? EMPTY : TOMBSTONE;
+  bucket = &tbl->bucket[last_bucket_i];
+  bucket->entry[way].id = EMPTY;
+  bucket->hdr.tags = ci_netif_filter_set_tag(bucket->hdr.tags, way, 0);
+  bucket->hdr.overflow &= ~FILTER_WAY_BIT(way);
 }
 
 void
@@ -125,10 +155,12 @@ ci_ip6_netif_filter_remove(ci_ip6_netif_filter_table* tbl,
                            const ci_addr_t raddr, unsigned rport,
                            unsigned protocol)
 {
-  ci_ip6_netif_filter_table_entry* entry;
-  unsigned hash1, hash2, tbl_i;
-  int hops = 0, af = AF_INET6;
-  unsigned first, table_size_mask;
+  ci_ip6_netif_filter_table_bucket* bucket;
+  unsigned bucket_i, bucket2, hash2, tag;
+  int hops, af = AF_INET6;
+  unsigned bucket_mask;
+  ci_uint32 match;
+  int way;
   char laddr_str[CI_INET6_ADDRSTRLEN], raddr_str[CI_INET6_ADDRSTRLEN];
 
   ci_assert(ci_netif_is_locked(netif)
@@ -140,39 +172,47 @@ ci_ip6_netif_filter_remove(ci_ip6_netif_filter_table* tbl,
 #endif
             );
 
-  table_size_mask = tbl->table_size_mask;
+  bucket_mask = FILTER_BUCKET_MASK(tbl);
 
-  hash1 = onload_hash1(af, table_size_mask, laddr.ip6, lport,
-                       raddr.ip6, rport, protocol);
+  bucket_i = FILTER_BUCKET_FIRST(onload_hash1(af, tbl->table_size_mask,
+                                              laddr.ip6, lport, raddr.ip6,
+                                              rport, protocol));
   hash2 = onload_hash2(af, laddr.ip6, lport, raddr.ip6, rport, protocol);
-  first = hash1;
+  tag = onload_hash_tag(hash2);
+  bucket2 = ci_netif_filter_alt_bucket(bucket_i, tag, bucket_mask);
 
   ci_get_ip_str(laddr, laddr_str, sizeof(laddr_str));
   ci_get_ip_str(raddr, raddr_str, sizeof(raddr_str));
 
-  LOG_TC(ci_log("%s: [%d:%d] REMOVE %s %s:%u->%s:%u hash=%u:%u",
+  LOG_TC(ci_log("%s: [%d:%d] REMOVE %s %s:%u->%s:%u bucket=%u:%u:%u",
                 __FUNCTION__, NI_ID(netif), OO_SP_FMT(sock_p),
                 CI_IP_PROTOCOL_STR(protocol),
 		            laddr_str, (unsigned) CI_BSWAP_BE16(lport),
 		            raddr_str, (unsigned) CI_BSWAP_BE16(rport),
-		            hash1, hash2));
-
-  tbl_i = hash1;
-  while( 1 ) {
-    entry = &tbl->table[tbl_i];
-    if( entry->id == OO_SP_TO_INT(sock_p) ) {
-      if( !memcmp(laddr.ip6, entry->laddr, sizeof(entry->laddr)) )
-        break;
+		            bucket_i, bucket2, hash2));
+
+  for( hops = 0; ; ++hops ) {
+    bucket = &tbl->bucket[bucket_i];
+    match = ci_netif_filter_match_ways(&bucket->hdr, tag, hops);
+    while( match ) {
+      way = ci_netif_filter_next_way(&match);
+      if( bucket->entry[way].id == OO_SP_TO_INT(sock_p) &&
+          !memcmp(laddr.ip6, bucket->entry[way].laddr,
+                  sizeof(bucket->entry[way].laddr)) )
+        goto found;
     }
-    else if( entry->id == EMPTY ) {
+    if( hops == 0 ) {
+      bucket_i = bucket2;
+      continue;
+    }
+    if( bucket->hdr.route_count == 0 ) {
       /* We allow multiple removes of the same filter -- helps avoid some
        * complexity in the filter module.
        */
       return;
     }
-    tbl_i = (tbl_i + hash2) & table_size_mask;
-    ++hops;
-    if( tbl_i == first ) {
+    bucket_i = (bucket_i + hash2) & bucket_mask;
+    if( bucket_i == bucket2 ) {
       LOG_E(ci_log(FN_FMT "ERROR: LOOP [%d] %s %s:%u->%s:%u",
                    FN_PRI_ARGS(netif), OO_SP_FMT(sock_p),
                    CI_IP_PROTOCOL_STR(protocol),
@@ -182,26 +222,32 @@ ci_ip6_netif_filter_remove(ci_ip6_netif_filter_table* tbl,
     }
   }
 
-  __ci_ip6_netif_filter_remove(tbl, hash1, hash2, hops, tbl_i);
+ found:
+  __ci_ip6_netif_filter_remove(tbl, bucket2, hash2, hops, bucket_i, way);
 }
 
 #ifdef __ci_driver__
 
 void ci_ip6_netif_filter_init(ci_ip6_netif_filter_table* tbl, int size_lg2)
 {
-  unsigned i;
+  unsigned i, way;
   unsigned size = ci_pow2(size_lg2);
 
   ci_assert(tbl);
-  ci_assert_gt(size_lg2, 0);
+  ci_assert_gt(size_lg2, CI_NETIF_FILTER_BUCKET_SHIFT);
   ci_assert_le(size_lg2, 32);
 
   tbl->table_size_mask = size - 1;
 
-  for( i = 0; i < size; ++i ) {
-    tbl->table[i].id = EMPTY;
-    tbl->table[i].route_count = 0;
-    memset(tbl->table[i].laddr, 0, sizeof(tbl->table[i].laddr));
+  for( i = 0; i < (size >> CI_NETIF_FILTER_BUCKET_SHIFT); ++i ) {
+    tbl->bucket[i].hdr.tags = 0;
+    tbl->bucket[i].hdr.overflow = 0;
+    tbl->bucket[i].hdr.route_count = 0;
+    for( way = 0; way < CI_NETIF_FILTER_BUCKET_WAYS; ++way ) {
+      tbl->bucket[i].entry[way].id = EMPTY;
+      memset(tbl->bucket[i].entry[way].laddr, 0,
+             sizeof(tbl->bucket[i].entry[way].laddr));
+    }
   }
 }
 
@@ -217,10 +263,11 @@ void ci_ip6_netif_filter_dump(ci_netif* ni)
   ip6_tbl = ni->ip6_filter_table;
 
   for( i = 0; i <= ip6_tbl->table_size_mask; ++i ) {
-    id = ip6_tbl->table[i].id;
-    if( CI_LIKELY(id >= 0) ) {
+    id = CI_NETIF_FILTER_ENTRY(ip6_tbl, i)->id;
+    if( FILTER_TAG(&ip6_tbl->bucket[i >> CI_NETIF_FILTER_BUCKET_SHIFT].hdr,
+                   i & (CI_NETIF_FILTER_BUCKET_WAYS - 1)) != 0 ) {
       ci_sock_cmn* s = ID_TO_SOCK(ni, id);
-      ci_ip6_addr_t *laddr_ip6 = &ip6_tbl->table[i].laddr;
+      ci_ip6_addr_t *laddr_ip6 = &CI_NETIF_FILTER_ENTRY(ip6_tbl, i)->laddr;
       int lport = sock_lport_be16(s);
       ci_ip6_addr_t *raddr_ip6 = &sock_ip6_raddr(s);
       int rport = sock_rport_be16(s);
@@ -236,9 +283,11 @@ void ci_ip6_netif_filter_dump(ci_netif* ni)
       memcpy(raddr.ip6, raddr_ip6, sizeof(raddr.ip6));
 
       log("%010d id=%-10d rt_ct=%d %s %s:%d %s:%d %010u:%010u",
-          i, id, ip6_tbl->table[i].route_count, CI_IP_PROTOCOL_STR(protocol),
-          AF_IP(laddr), CI_BSWAP_BE16(lport), AF_IP(raddr),
-          CI_BSWAP_BE16(rport), hash1, hash2);
+          i, id,
+          ip6_tbl->bucket[i >> CI_NETIF_FILTER_BUCKET_SHIFT].hdr.route_count,
+          CI_IP_PROTOCOL_STR(protocol), AF_IP(laddr), CI_BSWAP_BE16(lport),
+          AF_IP(raddr), CI_BSWAP_BE16(rport), FILTER_BUCKET_FIRST(hash1),
+          hash2);
     }
   }
 }
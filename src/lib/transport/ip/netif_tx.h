@@ -178,6 +178,8 @@ ci_inline void ci_netif_dmaq_and_vi_for_pkt(ci_netif* ni, ci_ip_pkt_fmt* pkt,
     (pkt)->flags |= CI_PKT_FLAG_TX_PENDING;                             \
     ++(ni)->state->nic[(pkt)->intf_i].tx_dmaq_insert_seq;               \
     (ni)->state->nic[(pkt)->intf_i].tx_bytes_added+=TX_PKT_LEN(pkt);    \
+    if( (pkt)->flags & CI_PKT_FLAG_LAT_SENT )                           \
+      ci_netif_lat_hist_tx_doorbell((ni), (pkt));                       \
     if( oo_tcpdump_check(ni, pkt, (pkt)->intf_i) ) {                    \
       ci_frc64(&((pkt)->tstamp_frc));                                   \
       oo_tcpdump_dump_pkt(ni, pkt);                                     \
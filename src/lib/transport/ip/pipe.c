@@ -66,8 +66,9 @@ void pipe_dump(ci_netif* ni, struct oo_pipe* p)
       ci_ip_pkt_fmt* pkt = PKT_CHK(ni, p->pipe_bufs.pp);
       int bufs_num = 0;
       do {
-        ci_log("  [%d:%d] pkt %d base=%d pay_len=%d", p->b.bufid, bufs_num,
-               OO_PKT_P(pkt), pkt->pf.pipe.base, pkt->pf.pipe.pay_len);
+        ci_log("  [%d:%d] pkt %d base=%d pay_len=%d end=%d", p->b.bufid,
+               bufs_num, OO_PKT_P(pkt), pkt->pf.pipe.base,
+               pkt->pf.pipe.pay_len, pkt->pf.pipe.end);
         pkt = PKT_CHK(ni, pkt->next);
       } while( OO_PKT_P(pkt) != p->pipe_bufs.pp &&
                ++bufs_num < 2 * p->bufs_num );
@@ -202,7 +203,7 @@ ci_inline ci_uint8* pipe_get_point(ci_netif* ni, struct oo_pipe *p,
                                    ci_ip_pkt_fmt* pkt, ci_uint32 offset)
 {
   ci_assert(p);
-  ci_assert_lt(offset, OO_PIPE_BUF_MAX_SIZE - pkt->pf.pipe.base);
+  ci_assert_lt(offset, pkt->pf.pipe.end - pkt->pf.pipe.base);
 
   return pkt->dma_start + pkt->pf.pipe.base + offset;
 }
@@ -214,8 +215,9 @@ ci_inline ci_uint8* pipe_get_point(ci_netif* ni, struct oo_pipe *p,
  */
 ci_inline ci_uint32 oo_pipe_buf_space(ci_ip_pkt_fmt* pkt)
 {
-  ci_assert_le(pkt->pf.pipe.base + pkt->pf.pipe.pay_len, OO_PIPE_BUF_MAX_SIZE);
-  return OO_PIPE_BUF_MAX_SIZE - (pkt->pf.pipe.base + pkt->pf.pipe.pay_len);
+  ci_assert_le(pkt->pf.pipe.end, OO_PIPE_BUF_MAX_SIZE);
+  ci_assert_le(pkt->pf.pipe.base + pkt->pf.pipe.pay_len, pkt->pf.pipe.end);
+  return pkt->pf.pipe.end - (pkt->pf.pipe.base + pkt->pf.pipe.pay_len);
 }
 
 
@@ -533,8 +535,9 @@ static int oo_pipe_wait_write(ci_netif* ni, struct oo_pipe* p, int flags,
 /* Called before writing into a logically empty pipe buffer. */
 ci_inline void oo_pipe_buf_write_init(struct oo_pipe* p, ci_ip_pkt_fmt* pkt)
 {
-  pkt->pf.pipe.base = 0;
+  pkt->pf.pipe.base = p->buf_base;
   pkt->pf.pipe.pay_len = 0;
+  pkt->pf.pipe.end = p->buf_end;
 }
 
 
@@ -1613,14 +1616,16 @@ __oo_pipe_zc_copy_last_buffer(ci_netif* ni, struct oo_pipe* pipe_src,
 
     pkt_dest = PKT_CHK(ni, pipe_dest->write_ptr.pp);
     oo_pipe_buf_write_init(pipe_dest, pkt_dest);
+    /* The destination's buffers are smaller than the source's if it has
+     * been spliced to a TCP socket, so this one may not take the rest. */
+    len = CI_MIN(len, (int) oo_pipe_buf_space(pkt_dest));
     write_point = pipe_get_point(ni, pipe_dest, pkt_dest, 0);
     do_copy_write(write_point, read_point, len);
     pkt_dest->pf.pipe.pay_len = len;
     bytes_copied += len;
 
-    /* As we're copying only a portion of the buffer here, we know that the
-     * destination buffer is not full and so we never need to set pp_wait. */
-    ci_assert_gt(oo_pipe_buf_space(pkt_dest), 0);
+    if( oo_pipe_buf_space(pkt_dest) == 0 && pkt_dest->next == pp_dest_read )
+      pipe_dest->write_ptr.pp_wait = pkt_dest->next;
   }
 
   return bytes_copied;
@@ -1752,6 +1757,161 @@ int ci_pipe_zc_move(ci_netif* ni, struct oo_pipe* pipe_src,
                               oo_pipe_zc_move_cb, &ctx);
 }
 
+
+/* Splicing between a pipe and a TCP socket in the same stack moves packet
+ * buffers from one to the other where it can.  Buffers sent from a pipe
+ * must have their payload exactly where the socket would put one segment,
+ * so once a pipe has been spliced to a socket the buffers written to it are
+ * laid out that way (at some cost in pipe capacity).  Anything that cannot
+ * be moved is left for the caller to copy.
+ */
+#define OO_PIPE_TCP_SPLICE_BATCH 64
+
+struct oo_pipe_zc_send_tcp_ctx {
+  ci_tcp_state* ts;
+};
+
+
+static int
+oo_pipe_zc_send_tcp_cb(void* c, ci_netif* ni, struct oo_pipe* p, int flags,
+                       ci_ip_pkt_fmt* head, int bytes_available, int read_len,
+                       ci_ip_pkt_fmt** next_pkt_out, int* next_pkt_payload_out,
+                       int* n_pkts_out)
+{
+  struct oo_pipe_zc_send_tcp_ctx* ctx = c;
+  ci_tcp_state* ts = ctx->ts;
+  ci_ip_pkt_fmt* pkts[OO_PIPE_TCP_SPLICE_BATCH];
+  int lens[OO_PIPE_TCP_SPLICE_BATCH];
+  ci_uint32 base = ETH_HLEN + ts->outgoing_hdrs_len;
+  int eff_mss = tcp_eff_mss(ts);
+  int bytes_can_move = CI_MIN(bytes_available, read_len);
+  int max_pkts, n = 0, bytes = 0;
+  ci_ip_pkt_fmt* pkt = head;
+
+  ci_assert(ci_netif_is_locked(ni));
+  ci_assert_equal(OO_PKT_P(head), p->read_ptr.pp);
+
+  *next_pkt_out = head;
+  *next_pkt_payload_out = 0;
+  *n_pkts_out = 0;
+
+  /* A partly-read buffer cannot be moved, and nor can anything be sent
+   * until the connection is established. */
+  if( p->read_ptr.offset != 0 || ts->s.tx_errno ||
+      ! (ts->s.b.state & CI_TCP_STATE_SYNCHRONISED) )
+    return 0;
+
+  max_pkts = CI_MIN(ci_tcp_tx_send_space(ni, ts), OO_PIPE_TCP_SPLICE_BATCH);
+  max_pkts = CI_MIN(max_pkts, (int) p->bufs_num);
+  while( n < max_pkts ) {
+    int pay_len = pkt->pf.pipe.pay_len;
+    if( pay_len == 0 || pay_len > bytes_can_move - bytes ||
+        pay_len > eff_mss || pkt->pf.pipe.base != base )
+      break;
+    ci_assert_equal(pkt->refcount, 1);
+    pkts[n] = pkt;
+    lens[n++] = pay_len;
+    bytes += pay_len;
+    pkt = PKT_CHK(ni, oo_pipe_next_buf(p, pkt));
+  }
+  if( n == 0 )
+    return 0;
+
+  LOG_PIPE("%s[%u]: moving %d buffers (%d bytes) to "NT_FMT, __FUNCTION__,
+           p->b.bufid, n, bytes, NT_PRI_ARGS(ni, ts));
+  *next_pkt_out = pkt;
+  *n_pkts_out = n;
+  ci_tcp_sendmsg_pkts(ni, ts, pkts, lens, n, flags);
+  CITP_STATS_NETIF_ADD(ni, tcp_splice_tx_pkts, n);
+  return bytes;
+}
+
+
+/* Splice up to [len] bytes from [p] to [ts] by moving whole buffers onto
+ * its send queue.  Blocks (unless MSG_DONTWAIT) only while the pipe is
+ * empty.  Returns the number of bytes moved, zero at end-of-file or if the
+ * data at the read pointer cannot be moved (the caller should copy it), or
+ * -1 with errno set.
+ */
+int ci_pipe_zc_send_tcp(ci_netif* ni, struct oo_pipe* p, ci_tcp_state* ts,
+                        int len, int flags)
+{
+  struct oo_pipe_zc_send_tcp_ctx ctx = {
+    .ts = ts,
+  };
+  ci_uint32 base = ETH_HLEN + ts->outgoing_hdrs_len;
+  ci_uint32 end = base + tcp_eff_mss(ts);
+
+  if( (p->buf_base != base || p->buf_end != end) &&
+      (ts->s.b.state & CI_TCP_STATE_SYNCHRONISED) &&
+      end <= OO_PIPE_BUF_MAX_SIZE &&
+      tcp_eff_mss(ts) > PIPE_TO_PIPE_SPLICE_COPY_THRESHOLD ) {
+    ci_netif_lock(ni);
+    p->buf_base = base;
+    p->buf_end = end;
+    ci_netif_unlock(ni);
+  }
+
+  return oo_pipe_zc_read_bare(ni, p, len, flags,
+                              OO_PIPE_ZC_READ_BARE_FLAG_LOCK_STACK |
+                              OO_PIPE_ZC_READ_BARE_FLAG_REMOVE_BUFFERS,
+                              oo_pipe_zc_send_tcp_cb, &ctx);
+}
+
+
+/* Splice up to [len] bytes from the receive queue of [ts] to [p] by moving
+ * whole receive buffers into the pipe.  Never blocks.  Returns the number
+ * of bytes moved, or zero if nothing could be moved (the caller should
+ * copy instead).
+ */
+int ci_pipe_zc_recv_tcp(ci_netif* ni, struct oo_pipe* p, ci_tcp_state* ts,
+                        int len)
+{
+  ci_ip_pkt_fmt* pkts[OO_PIPE_TCP_SPLICE_BATCH];
+  struct ci_pipe_pkt_list list = {};
+  int i, n, buf_space, bytes = 0;
+
+  if( ci_sock_lock(ni, &ts->s.b) != 0 )
+    return 0;
+  ci_netif_lock(ni);
+
+  /* Leave the reporting of a closed pipe to the copying path. */
+  if( p->aflags & (CI_PFD_AFLAG_CLOSED << CI_PFD_AFLAG_READER_SHIFT) )
+    goto out;
+
+  if( p->bufs_num >= p->bufs_max )
+    oo_pipe_reap_empty_buffers(ni, p, 0, NULL);
+  buf_space = (int) p->bufs_max - (int) p->bufs_num;
+  if( buf_space <= 0 )
+    goto out;
+
+  n = ci_tcp_recv_detach_pkts(ni, ts, pkts,
+                              CI_MIN(buf_space, OO_PIPE_TCP_SPLICE_BATCH),
+                              len);
+  for( i = 0; i < n; ++i ) {
+    ci_ip_pkt_fmt* pkt = pkts[i];
+    pkt->pf.pipe.base =
+      (ci_uint8*) oo_offbuf_ptr(&pkt->buf) - pkt->dma_start;
+    pkt->pf.pipe.pay_len = oo_offbuf_left(&pkt->buf);
+    pkt->pf.pipe.end = pkt->pf.pipe.base + pkt->pf.pipe.pay_len;
+    bytes += pkt->pf.pipe.pay_len;
+    oo_pipe_pkt_list_push(&list, pkt);
+  }
+  if( n > 0 ) {
+    LOG_PIPE("%s[%u]: moved %d buffers (%d bytes) from "NT_FMT, __FUNCTION__,
+             p->b.bufid, n, bytes, NT_PRI_ARGS(ni, ts));
+    oo_pipe_insert_buffers(ni, p, &list);
+    ci_wmb();
+    p->bytes_added += bytes;
+    __oo_pipe_wake_peer(ni, p, CI_SB_FLAG_WAKE_RX);
+  }
+
+ out:
+  ci_netif_unlock(ni);
+  ci_sock_unlock(ni, &ts->s.b);
+  return bytes;
+}
+
 #endif
 
 
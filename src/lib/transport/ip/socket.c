@@ -111,6 +111,10 @@ void ci_sock_cmn_init(ci_netif* ni, ci_sock_cmn* s, int can_poison)
   /* Not functionally necessary, but avoids garbage addresses in stackdump. */
   sock_laddr_be32(s) = sock_raddr_be32(s) = 0;
   sock_lport_be16(s) = sock_rport_be16(s) = 0;
+
+#if CI_CFG_LAT_HIST
+  ci_netif_lat_hist_sock_init(ni, SC_SP(s));
+#endif
 }
 
 
@@ -0,0 +1,165 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Adaptive spinning: choose spin budgets from observed waits.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/*! \cidoxg_lib_transport_ip */
+
+#include "ip_internal.h"
+
+#if CI_CFG_SPIN_ADAPT
+
+#define N_BUCKETS  CI_CFG_SPIN_ADAPT_BUCKETS
+#define MIN_LOG2   CI_CFG_SPIN_ADAPT_MIN_LOG2
+
+
+ci_inline unsigned oo_spin_adapt_bucket(ci_uint64 wait)
+{
+  ci_uint64 w = wait >> MIN_LOG2;
+  if( w == 0 )
+    return 0;
+  if( w >= (1u << (N_BUCKETS - 2)) )
+    return N_BUCKETS - 1;
+  return ci_log2_le((unsigned long) w) + 1;
+}
+
+
+/* Longest wait counted in bucket [b] (other than the last). */
+ci_inline ci_uint64 oo_spin_adapt_bucket_max(unsigned b)
+{
+  return (ci_uint64) 1 << (MIN_LOG2 + b);
+}
+
+
+/* Choose the shortest budget that would have caught EF_SPIN_ADAPT_PCT
+ * percent of the waits in the histogram.  If spinning for [max_spin]
+ * would not do that, then spin for [max_spin] only if it would catch at
+ * least half as many: otherwise the spinning mostly burns CPU.
+ */
+static void oo_spin_adapt_update(ci_netif* ni, struct oo_spin_adapt* sa,
+                                 ci_uint64 max_spin)
+{
+  unsigned pct = NI_OPTS(ni).spin_adapt_pct;
+  unsigned b, total = 0, caught = 0;
+
+  for( b = 0; b < N_BUCKETS; ++b )
+    total += sa->hist[b];
+
+  for( b = 0; b < N_BUCKETS - 1; ++b ) {
+    if( oo_spin_adapt_bucket_max(b) > max_spin )
+      break;
+    caught += sa->hist[b];
+    if( caught * 100 >= total * pct ) {
+      sa->budget = oo_spin_adapt_bucket_max(b);
+      goto out;
+    }
+  }
+  if( caught * 200 >= total * pct )
+    sa->budget = ~(ci_uint64) 0;
+  else
+    sa->budget = 0;
+
+ out:
+  if( sa->n_samples >= OO_SPIN_ADAPT_DECAY ) {
+    for( b = 0; b < N_BUCKETS; ++b )
+      sa->hist[b] >>= 1;
+    sa->n_samples = 0;
+  }
+}
+
+
+/* Updates are not atomic: when several threads block on the same socket
+ * concurrently we may lose a sample, which does no harm.
+ */
+void oo_spin_adapt_wait_done(ci_netif* ni, struct oo_spin_adapt* sa,
+                             ci_uint64 wait, ci_uint64 max_spin)
+{
+  ci_uint64 budget = oo_spin_adapt_budget(sa, max_spin);
+  ci_uint64 saved;
+
+  if( wait <= budget ) {
+    ++sa->n_hit;
+    CITP_STATS_NETIF_INC(ni, spin_adapt_hit);
+    saved = 0;
+  }
+  else {
+    if( budget == 0 ) {
+      ++sa->n_skip;
+      CITP_STATS_NETIF_INC(ni, spin_adapt_skip);
+    }
+    else {
+      ++sa->n_miss;
+      CITP_STATS_NETIF_INC(ni, spin_adapt_miss);
+    }
+    if( wait <= max_spin ) {
+      ++sa->n_late;
+      CITP_STATS_NETIF_INC(ni, spin_adapt_late);
+      saved = wait - budget;
+    }
+    else {
+      saved = max_spin - budget;
+    }
+  }
+  sa->cycles_saved += saved;
+  CITP_STATS_NETIF_ADD(ni, spin_adapt_cycles_saved, saved);
+
+  /* A wait that slept after a shorter spin includes the time taken to
+   * wake up, which may be longer than [max_spin] even when the data came
+   * soon after the spin ended, and one that did not is counted only
+   * because it was short.  Either would bias the histogram.
+   */
+  ++sa->n_waits;
+  if( budget < max_spin )
+    return;
+  ++sa->hist[oo_spin_adapt_bucket(wait)];
+  if( ++sa->n_samples % OO_SPIN_ADAPT_UPDATE == 0 )
+    oo_spin_adapt_update(ni, sa, max_spin);
+}
+
+
+void oo_spin_adapt_dump(ci_netif* ni, struct oo_spin_adapt* sa,
+                        const char* pf, oo_dump_log_fn_t logger,
+                        void* log_arg)
+{
+  char hist[N_BUCKETS * 6 + 1];
+  unsigned saved_us = oo_cycles64_to_usec(ni, sa->cycles_saved);
+  int b, n = 0;
+
+  if( sa->n_hit + sa->n_miss + sa->n_skip == 0 )
+    return;
+  for( b = 0; b < N_BUCKETS; ++b )
+    n += snprintf(hist + n, sizeof(hist) - n, "%s%u", b ? "," : "",
+                  sa->hist[b]);
+
+  if( sa->budget == ~(ci_uint64) 0 )
+    logger(log_arg, "%s  spin_adapt: budget=max hit=%u miss=%u skip=%u "
+           "late=%u saved=%uus", pf, sa->n_hit, sa->n_miss,
+           sa->n_skip, sa->n_late, saved_us);
+  else
+    logger(log_arg, "%s  spin_adapt: budget=%"CI_PRIu64"cycles hit=%u "
+           "miss=%u skip=%u late=%u saved=%uus", pf, sa->budget,
+           sa->n_hit, sa->n_miss, sa->n_skip, sa->n_late, saved_us);
+  logger(log_arg, "%s  spin_adapt: waits by 2^n cycles from n=%d: %s",
+         pf, MIN_LOG2, hist);
+}
+
+#endif /* CI_CFG_SPIN_ADAPT */
+/*! \cidoxg_end */
@@ -0,0 +1,421 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Binary statistics ring: writer and reader.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/*! \cidoxg_lib_transport_ip */
+
+#include "ip_internal.h"
+
+#if CI_CFG_STATS_RING
+
+
+#define OO_STATS_KIND_count       1
+#define OO_STATS_KIND_count_zero  1
+#define OO_STATS_KIND_val         0
+
+const struct oo_stats_field oo_stats_fields[] = {
+#undef OO_STAT
+#define OO_STAT(desc, type, name, kind)                         \
+  { #name, CI_MEMBER_OFFSET(ci_netif_stats, name), sizeof(type), \
+    OO_STATS_KIND_##kind },
+#include <ci/internal/stats_def.h>
+#undef OO_STAT
+};
+
+const unsigned oo_stats_n_fields =
+  sizeof(oo_stats_fields) / sizeof(oo_stats_fields[0]);
+
+
+/* FNV-1a over the names and sizes of the fields. */
+ci_uint32 oo_stats_schema_hash(void)
+{
+  ci_uint32 h = 2166136261u;
+  const char* p;
+  unsigned i;
+
+  for( i = 0; i < oo_stats_n_fields; ++i ) {
+    for( p = oo_stats_fields[i].name; *p != '\0'; ++p )
+      h = (h ^ (ci_uint8) *p) * 16777619u;
+    h = (h ^ oo_stats_fields[i].size) * 16777619u;
+  }
+  return h;
+}
+
+
+ci_inline ci_uint64 oo_stats_field_get(const ci_netif_stats* s, unsigned i)
+{
+  const char* p = (const char*) s + oo_stats_fields[i].ofs;
+  if( oo_stats_fields[i].size == sizeof(ci_uint64) )
+    return *(const ci_uint64*) p;
+  return *(const ci_uint32*) p;
+}
+
+
+ci_inline ci_uint8* oo_stats_put_varint(ci_uint8* p, ci_uint64 v)
+{
+  while( v >= 0x80 ) {
+    *p++ = (ci_uint8) v | 0x80;
+    v >>= 7;
+  }
+  *p++ = (ci_uint8) v;
+  return p;
+}
+
+
+ci_inline ci_uint64 oo_stats_zigzag(ci_int64 v)
+{
+  return ((ci_uint64) v << 1) ^ (ci_uint64) (v >> 63);
+}
+
+
+/**********************************************************************
+ * Writer
+ */
+
+#ifdef __KERNEL__
+void ci_netif_stats_ring_init(ci_netif* ni, ci_uint32 size, unsigned khz)
+{
+  struct oo_stats_ring* ring = ni->stats_ring;
+
+  memset(ring, 0, OO_STATS_RING_HDR_LEN);
+  ring->magic = OO_STATS_RING_MAGIC;
+  ring->version = OO_STATS_RING_VERSION;
+  ring->schema_hash = oo_stats_schema_hash();
+  ring->n_fields = oo_stats_n_fields;
+  ring->size = size;
+  ring->interval_ms = NI_OPTS(ni).stats_ring_interval;
+  ring->khz = khz;
+
+  ni->stats_ring_size = size;
+  ni->stats_ring_interval_ms = ring->interval_ms;
+  ni->stats_ring_write_pos = 0;
+}
+#endif
+
+
+/* The ring header is in shared state, so the kernel uses its own copies of
+ * the fields that steer the writer.
+ */
+ci_inline ci_uint32 oo_stats_ring_size(ci_netif* ni)
+{
+#ifdef __KERNEL__
+  return ni->stats_ring_size;
+#else
+  return ni->stats_ring->size;
+#endif
+}
+
+
+ci_inline ci_uint32 oo_stats_ring_interval_ms(ci_netif* ni)
+{
+#ifdef __KERNEL__
+  return ni->stats_ring_interval_ms;
+#else
+  return ni->stats_ring->interval_ms;
+#endif
+}
+
+
+/* Where the next record goes.  At user-level that is the ring's
+ * [write_pos].  The kernel starts from where it last wrote, but follows
+ * [write_pos] forwards over records appended at user-level since then.
+ */
+ci_inline ci_uint64 oo_stats_ring_write_pos(ci_netif* ni)
+{
+  ci_uint64 pos = ni->stats_ring->write_pos;
+#ifdef __KERNEL__
+  pos &= ~(ci_uint64) (OO_STATS_REC_ALIGN - 1);
+  if( pos < ni->stats_ring_write_pos )
+    pos = ni->stats_ring_write_pos;
+#endif
+  return pos;
+}
+
+
+void ci_netif_stats_ring_start(ci_netif* ni)
+{
+  ci_assert(ci_netif_is_locked(ni));
+  ci_ip_timer_set(ni, &ni->state->stats_ring_tid,
+                  ci_ip_time_now(ni) +
+                  ci_ip_time_ms2ticks(ni, oo_stats_ring_interval_ms(ni)));
+}
+
+
+static void ci_netif_stats_ring_append(ci_netif* ni)
+{
+  struct oo_stats_ring* ring = ni->stats_ring;
+  const ci_netif_stats* cur = &ni->state->stats;
+  struct oo_stats_rec* rec;
+  ci_uint64 pos = oo_stats_ring_write_pos(ni);
+  ci_uint32 size = oo_stats_ring_size(ni);
+  ci_uint32 max_len = OO_STATS_REC_MAX_LEN(oo_stats_n_fields);
+  ci_uint32 ofs = pos & (size - 1);
+  ci_uint8 *start, *p;
+  int key = ring->key_countdown == 0;
+  unsigned i, last_i = 0, n = 0;
+
+  ci_assert(CI_IS_POW2(size));
+  ci_assert_ge(size, max_len);
+
+  /* Records do not wrap.  Reserve the worst case before writing anything,
+   * so that readers can tell whether we may have overwritten them.
+   */
+  if( size - ofs < max_len ) {
+    rec = (struct oo_stats_rec*) (OO_STATS_RING_DATA(ring) + ofs);
+    ring->reserve_pos = pos + (size - ofs) + max_len;
+    ci_wmb();
+    rec->rec_len = size - ofs;
+    rec->flags = OO_STATS_REC_F_PAD;
+    pos += size - ofs;
+    ofs = 0;
+  }
+  else {
+    ring->reserve_pos = pos + max_len;
+    ci_wmb();
+  }
+
+  rec = (struct oo_stats_rec*) (OO_STATS_RING_DATA(ring) + ofs);
+  start = p = (ci_uint8*) (rec + 1);
+  for( i = 0; i < oo_stats_n_fields; ++i ) {
+    ci_uint64 v = oo_stats_field_get(cur, i);
+    ci_uint64 prev = oo_stats_field_get(&ring->prev, i);
+    ci_int64 d;
+
+    if( ! key && v == prev )
+      continue;
+    if( key )
+      d = (ci_int64) v;
+    else if( oo_stats_fields[i].size == sizeof(ci_uint32) )
+      d = (ci_int32) (ci_uint32) (v - prev);
+    else
+      d = (ci_int64) (v - prev);
+    p = oo_stats_put_varint(p, i - last_i);
+    p = oo_stats_put_varint(p, oo_stats_zigzag(d));
+    last_i = i + 1;
+    ++n;
+  }
+  memcpy(&ring->prev, cur, sizeof(ring->prev));
+
+  rec->data_len = p - start;
+  rec->rec_len = CI_ROUND_UP(sizeof(*rec) + rec->data_len,
+                             OO_STATS_REC_ALIGN);
+  rec->flags = key ? OO_STATS_REC_F_KEY : 0;
+  rec->n_fields = n;
+  rec->reserved = 0;
+  rec->seq = ring->seq++;
+  ci_frc64(&rec->frc);
+
+  ring->key_countdown = key ? CI_CFG_STATS_RING_KEY_INTERVAL - 1 :
+                              ring->key_countdown - 1;
+  ci_wmb();
+  if( key )
+    ring->last_key_pos = pos;
+  pos += CI_ROUND_UP(sizeof(*rec) + (p - start), OO_STATS_REC_ALIGN);
+  ring->write_pos = pos;
+#ifdef __KERNEL__
+  ni->stats_ring_write_pos = pos;
+#endif
+}
+
+
+void ci_netif_stats_ring_timeout(ci_netif* ni)
+{
+  ci_assert(ci_netif_is_locked(ni));
+  ci_assert(ni->stats_ring != NULL);
+  ci_netif_stats_ring_append(ni);
+  ci_netif_stats_ring_start(ni);
+}
+
+
+/**********************************************************************
+ * Reader
+ */
+
+#ifndef __KERNEL__
+
+static const ci_uint8* oo_stats_get_varint(const ci_uint8* p,
+                                           const ci_uint8* end,
+                                           ci_uint64* v_out)
+{
+  ci_uint64 v = 0;
+  int shift;
+
+  for( shift = 0; p < end && shift < 64; shift += 7 ) {
+    v |= (ci_uint64) (*p & 0x7f) << shift;
+    if( (*p++ & 0x80) == 0 ) {
+      *v_out = v;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+
+int oo_stats_rec_apply(const struct oo_stats_rec* rec, ci_uint64* values)
+{
+  const ci_uint8* p = (const ci_uint8*) (rec + 1);
+  const ci_uint8* end = p + rec->data_len;
+  ci_uint64 gap, zz;
+  ci_int64 d;
+  unsigned i = 0, n;
+
+  for( n = 0; n < rec->n_fields; ++n ) {
+    if( (p = oo_stats_get_varint(p, end, &gap)) == NULL ||
+        (p = oo_stats_get_varint(p, end, &zz)) == NULL ||
+        gap >= oo_stats_n_fields - i )
+      return -EPROTO;
+    i += gap;
+    d = (ci_int64) (zz >> 1) ^ -(ci_int64) (zz & 1);
+    if( rec->flags & OO_STATS_REC_F_KEY )
+      values[i] = d;
+    else if( oo_stats_fields[i].size == sizeof(ci_uint32) )
+      values[i] = (ci_uint32) (values[i] + d);
+    else
+      values[i] += d;
+    ++i;
+  }
+  return 0;
+}
+
+
+int oo_stats_reader_init(struct oo_stats_reader* r,
+                         const struct oo_stats_ring* ring)
+{
+  if( ring->magic != OO_STATS_RING_MAGIC ||
+      ring->version != OO_STATS_RING_VERSION ||
+      ring->n_fields != oo_stats_n_fields ||
+      ring->schema_hash != oo_stats_schema_hash() )
+    return -EPROTO;
+
+  memset(r, 0, sizeof(*r));
+  r->ring = ring;
+  r->buf_len = OO_STATS_REC_MAX_LEN(oo_stats_n_fields);
+  r->buf = malloc(r->buf_len);
+  r->values = calloc(oo_stats_n_fields, sizeof(r->values[0]));
+  if( r->buf == NULL || r->values == NULL ) {
+    oo_stats_reader_fini(r);
+    return -ENOMEM;
+  }
+  return 0;
+}
+
+
+void oo_stats_reader_fini(struct oo_stats_reader* r)
+{
+  free(r->buf);
+  free(r->values);
+  r->buf = NULL;
+  r->values = NULL;
+}
+
+
+/* Copy the record at [pos] into the reader's buffer.  Returns 1 on
+ * success, 0 if there is no complete record there yet, and -1 if the
+ * writer has overtaken us.
+ */
+static int oo_stats_reader_copy(struct oo_stats_reader* r, ci_uint64 pos)
+{
+  const struct oo_stats_ring* ring = r->ring;
+  const struct oo_stats_rec* rec;
+  ci_uint32 ofs = pos & (ring->size - 1);
+  ci_uint32 len;
+
+  if( pos >= ring->write_pos )
+    return 0;
+  ci_rmb();
+  rec = (const struct oo_stats_rec*) (OO_STATS_RING_DATA(ring) + ofs);
+  /* Anything we read here may be torn, so bound the copy by the buffer
+   * and the end of the ring, and validate only once the lap check has
+   * passed.
+   */
+  len = OO_ACCESS_ONCE(rec->rec_len);
+  len = CI_MIN(CI_MAX(len, (ci_uint32) OO_STATS_REC_ALIGN), r->buf_len);
+  len = CI_MIN(len, ring->size - ofs);
+  memcpy(r->buf, rec, len);
+  ci_rmb();
+  if( ring->reserve_pos - pos > ring->size )
+    return -1;
+
+  rec = r->buf;
+  if( rec->rec_len < OO_STATS_REC_ALIGN ||
+      rec->rec_len % OO_STATS_REC_ALIGN != 0 || rec->rec_len > ring->size - ofs )
+    return -1;
+  if( (rec->flags & OO_STATS_REC_F_PAD) == 0 &&
+      (rec->rec_len > len || rec->rec_len < sizeof(*rec) ||
+       sizeof(*rec) + rec->data_len > rec->rec_len) )
+    return -1;
+  return 1;
+}
+
+
+int oo_stats_reader_next(struct oo_stats_reader* r)
+{
+  const struct oo_stats_ring* ring = r->ring;
+  const struct oo_stats_rec* rec = r->buf;
+  int rc;
+
+  while( 1 ) {
+    if( ! r->synced ) {
+      /* Start, or start again, from the latest key record. */
+      if( ring->write_pos == 0 )
+        return 0;
+      r->pos = ring->last_key_pos;
+    }
+    rc = oo_stats_reader_copy(r, r->pos);
+    if( rc == 0 )
+      return 0;
+    if( rc < 0 ) {
+      /* If even the latest key record has gone then wait for the next. */
+      if( ! r->synced )
+        return 0;
+      ++r->n_overruns;
+      r->synced = 0;
+      continue;
+    }
+    r->pos += rec->rec_len;
+    if( rec->flags & OO_STATS_REC_F_PAD )
+      continue;
+    if( ! r->synced ) {
+      if( (rec->flags & OO_STATS_REC_F_KEY) == 0 )
+        continue;
+      r->synced = 1;
+    }
+    else if( rec->seq != r->seq + 1 ) {
+      /* Lost records: the deltas no longer apply. */
+      ++r->n_overruns;
+      r->synced = 0;
+      continue;
+    }
+    if( oo_stats_rec_apply(rec, r->values) != 0 ) {
+      ++r->n_overruns;
+      r->synced = 0;
+      continue;
+    }
+    r->seq = rec->seq;
+    r->frc = rec->frc;
+    return 1;
+  }
+}
+
+#endif /* __KERNEL__ */
+#endif /* CI_CFG_STATS_RING */
+/*! \cidoxg_end */
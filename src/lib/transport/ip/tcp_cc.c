@@ -0,0 +1,276 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  TCP congestion control algorithms: CUBIC and DCTCP.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/*! \cidoxg_lib_transport_ip */
+
+#include "ip_internal.h"
+
+#define LPF "TCP CC "
+
+
+/**********************************************************************
+ * CUBIC (RFC8312)
+ *
+ * Window sizes are kept in bytes, as for the rest of the stack, and time
+ * in milliseconds.  The cubic function is
+ *
+ *   W(t) = C * (t - K)^3 + origin
+ *
+ * with C = 0.4 segments/s^3.  The window is grown towards W(t + delay_min)
+ * by adding one segment each time cwnd * mss / (target - cwnd) bytes have
+ * been acked, so that it reaches the target in roughly one RTT.
+ */
+
+/* beta = 0.7 */
+#define CUBIC_BETA_NUM      7
+#define CUBIC_BETA_DEN      10
+/* Reno-friendly increase per RTT: 3 * (1 - beta) / (1 + beta) = 9/17 */
+#define CUBIC_AIMD_NUM      9
+#define CUBIC_AIMD_DEN      17
+/* K = cbrt((origin - cwnd) / C) seconds; scale to ms^3 with 1/C = 2.5. */
+#define CUBIC_K_SCALE       2500000000ull
+/* Bound on |t - K| so that its cube fits in 64 bits (about 17 minutes). */
+#define CUBIC_T_MAX_MS      (1 << 20)
+
+
+/* Integer cube root, rounded down. */
+static ci_uint32 cc_cbrt(ci_uint64 x)
+{
+  ci_uint64 y = 0, b;
+  int s;
+
+  for( s = 63; s >= 0; s -= 3 ) {
+    y <<= 1;
+    b = 3 * y * (y + 1) + 1;
+    if( (x >> s) >= b ) {
+      x -= b << s;
+      ++y;
+    }
+  }
+  return (ci_uint32) y;
+}
+
+
+static unsigned cubic_ssthresh(ci_netif* ni, ci_tcp_state* ts, int rto)
+{
+  ci_uint32 w = ci_tcp_inflight(ts);
+
+  /* Start a new epoch when we next get to congestion avoidance. */
+  ts->cc.cubic.epoch = 0;
+
+  /* Fast convergence: if we've been reduced before reaching the previous
+   * maximum then another flow is probably competing for bandwidth, so
+   * give some up. */
+  if( w < ts->cc.cubic.w_last_max )
+    ts->cc.cubic.w_max = (ci_uint64) w * (CUBIC_BETA_DEN + CUBIC_BETA_NUM) /
+                         (2 * CUBIC_BETA_DEN);
+  else
+    ts->cc.cubic.w_max = w;
+  ts->cc.cubic.w_last_max = w;
+
+  return CI_MAX((ci_uint64) w * CUBIC_BETA_NUM / CUBIC_BETA_DEN,
+                tcp_eff_mss(ts) << 1u);
+}
+
+
+static void cubic_cong_avoid(ci_netif* ni, ci_tcp_state* ts)
+{
+  unsigned mss = tcp_eff_mss(ts);
+  ci_iptime_t now = ci_tcp_time_now(ni);
+  ci_uint32 t, d, srtt, cnt, n;
+  ci_uint64 target, offs, w_est;
+
+  if( ts->cc.cubic.epoch == 0 ) {
+    ts->cc.cubic.epoch = now | 1;
+    ts->cc.cubic.w_epoch = ts->cwnd;
+    if( ts->cwnd < ts->cc.cubic.w_max ) {
+      ts->cc.cubic.k = cc_cbrt((ci_uint64) (ts->cc.cubic.w_max - ts->cwnd) *
+                               CUBIC_K_SCALE / mss);
+      ts->cc.cubic.origin = ts->cc.cubic.w_max;
+    }
+    else {
+      ts->cc.cubic.k = 0;
+      ts->cc.cubic.origin = ts->cwnd;
+    }
+  }
+
+  /* Aim for where the curve will be one (minimum) RTT from now. */
+  t = ci_ip_time_ticks2ms(ni, now - ts->cc.cubic.epoch +
+                              ts->cc.cubic.delay_min);
+  d = t >= ts->cc.cubic.k ? t - ts->cc.cubic.k : ts->cc.cubic.k - t;
+  d = CI_MIN(d, CUBIC_T_MAX_MS);
+  offs = (ci_uint64) d * d * d / 1000000 * mss / 2500;
+  if( t >= ts->cc.cubic.k )
+    target = ts->cc.cubic.origin + offs;
+  else
+    target = offs < ts->cc.cubic.origin ? ts->cc.cubic.origin - offs : 0;
+
+  /* Don't grow more slowly than Reno would (RFC8312 section 4.2). */
+  srtt = CI_MAX(ci_ip_time_ticks2ms(ni, tcp_srtt(ts)), 1);
+  w_est = ts->cc.cubic.w_epoch +
+          (ci_uint64) t * mss * CUBIC_AIMD_NUM / (CUBIC_AIMD_DEN * srtt);
+  target = CI_MAX(target, w_est);
+
+  /* ...nor by more than half the window per RTT. */
+  target = CI_MIN(target, (ci_uint64) ts->cwnd + (ts->cwnd >> 1u));
+
+  LOG_TV(log(LPF "%d CUBIC: cwnd=%u target=%u t=%u k=%u origin=%u",
+             S_FMT(ts), ts->cwnd, (unsigned) target, t, ts->cc.cubic.k,
+             ts->cc.cubic.origin));
+
+  if( target <= ts->cwnd ) {
+    /* On (or above) the curve: hold.  Don't let acked bytes pile up for a
+     * burst of increases later. */
+    ts->bytes_acked = CI_MIN(ts->bytes_acked, ts->cwnd);
+    return;
+  }
+
+  cnt = (ci_uint64) ts->cwnd * mss / (target - ts->cwnd);
+  cnt = CI_MAX(cnt, 1);
+  if( ts->bytes_acked >= cnt ) {
+    n = ts->bytes_acked / cnt;
+    ts->cwnd += n * mss;
+    ts->bytes_acked -= n * cnt;
+  }
+}
+
+
+static void cubic_on_rtt_sample(ci_netif* ni, ci_tcp_state* ts, unsigned rtt)
+{
+  if( ts->cc.cubic.delay_min == 0 || rtt < ts->cc.cubic.delay_min )
+    ts->cc.cubic.delay_min = rtt;
+}
+
+
+/**********************************************************************
+ * DCTCP (RFC8257)
+ *
+ * The receiver echoes the CE marking of each data segment in ECE (see
+ * ci_tcp_rx_ecn()).  Once per window of data the sender updates its
+ * estimate of the fraction of marked bytes:
+ *
+ *   alpha = (1 - g) * alpha + g * F
+ *
+ * and, if any marks were seen, reduces cwnd by a factor of (1 - alpha/2).
+ * Loss is handled as for Reno.
+ */
+
+#define DCTCP_ALPHA_SHIFT   10      /* alpha is scaled by 1024 */
+#define DCTCP_G_SHIFT       4       /* g = 1/16 */
+
+
+static void dctcp_init(ci_netif* ni, ci_tcp_state* ts)
+{
+  /* Be conservative until we've seen a window's worth of marks. */
+  ts->cc.dctcp.alpha = 1u << DCTCP_ALPHA_SHIFT;
+  ts->cc.dctcp.window_end = tcp_snd_nxt(ts);
+  ts->cc.dctcp.cwr_seq = tcp_snd_una(ts);
+}
+
+
+static void dctcp_on_ack(ci_netif* ni, ci_tcp_state* ts, unsigned acked,
+                         int ece)
+{
+  ci_uint32 una = tcp_snd_una(ts) + acked;
+  ci_uint32 f, cwnd;
+
+  ts->cc.dctcp.acked += acked;
+  if( ece )
+    ts->cc.dctcp.acked_ce += acked;
+
+  if( SEQ_GE(una, ts->cc.dctcp.window_end) ) {
+    f = 0;
+    if( ts->cc.dctcp.acked_ce != 0 )
+      f = ((ci_uint64) ts->cc.dctcp.acked_ce << DCTCP_ALPHA_SHIFT) /
+          ts->cc.dctcp.acked;
+    ts->cc.dctcp.alpha += (f >> DCTCP_G_SHIFT) -
+                          (ts->cc.dctcp.alpha >> DCTCP_G_SHIFT);
+    ts->cc.dctcp.window_end = tcp_snd_nxt(ts);
+    ts->cc.dctcp.acked = ts->cc.dctcp.acked_ce = 0;
+  }
+
+  /* React to marks at most once per window, and leave loss recovery to
+   * do its own thing. */
+  if( ece && SEQ_GE(una, ts->cc.dctcp.cwr_seq) &&
+      ts->congstate == CI_TCP_CONG_OPEN ) {
+    cwnd = ts->cwnd - (ci_uint32) (((ci_uint64) ts->cwnd * ts->cc.dctcp.alpha)
+                                   >> (DCTCP_ALPHA_SHIFT + 1));
+    cwnd = CI_MAX(cwnd, tcp_eff_mss(ts) << 1u);
+    cwnd = CI_MAX(cwnd, NI_OPTS(ni).min_cwnd);
+    LOG_TV(log(LPF "%d DCTCP: alpha=%u cwnd=%u->%u", S_FMT(ts),
+               ts->cc.dctcp.alpha, ts->cwnd, cwnd));
+    ts->cwnd = ts->ssthresh = cwnd;
+    ts->bytes_acked = 0;
+    ts->cc.dctcp.cwr_seq = tcp_snd_nxt(ts);
+    ts->tcpflags |= CI_TCPT_FLAG_ECN_CWR;
+    CITP_STATS_NETIF_INC(ni, tcp_ecn_cwnd_reductions);
+  }
+}
+
+
+/**********************************************************************/
+
+static const ci_tcp_cc_ops ci_tcp_cc_reno = {
+  .name = "reno",
+};
+
+static const ci_tcp_cc_ops ci_tcp_cc_cubic = {
+  .name = "cubic",
+  .cong_avoid = cubic_cong_avoid,
+  .ssthresh = cubic_ssthresh,
+  .on_rtt_sample = cubic_on_rtt_sample,
+};
+
+static const ci_tcp_cc_ops ci_tcp_cc_dctcp = {
+  .name = "dctcp",
+  .flags = CI_TCP_CC_FLAG_ECN,
+  .init = dctcp_init,
+  .on_ack = dctcp_on_ack,
+};
+
+const ci_tcp_cc_ops* const ci_tcp_cc_ops_tbl[CI_TCP_CC_N] = {
+  [CI_TCP_CC_RENO] = &ci_tcp_cc_reno,
+  [CI_TCP_CC_CUBIC] = &ci_tcp_cc_cubic,
+  [CI_TCP_CC_DCTCP] = &ci_tcp_cc_dctcp,
+};
+
+
+int ci_tcp_cc_find(const char* name)
+{
+  int i;
+  for( i = 0; i < CI_TCP_CC_N; ++i )
+    if( ! strcmp(name, ci_tcp_cc_ops_tbl[i]->name) )
+      return i;
+  return -ENOENT;
+}
+
+
+void ci_tcp_cc_init(ci_netif* ni, ci_tcp_state* ts)
+{
+  const ci_tcp_cc_ops* cc = ci_tcp_cc(ts);
+  memset(&ts->cc, 0, sizeof(ts->cc));
+  if( cc->init != NULL )
+    cc->init(ni, ts);
+}
+
+/*! \cidoxg_end */
@@ -51,6 +51,11 @@ void __ci_tcp_listen_to_normal(ci_netif* netif, ci_tcp_socket_listen* tls)
     ci_ip_timer_clear(netif, &tls->listenq_tid);
   ci_ni_dllist_remove_safe(netif, &tls->s.b.post_poll_link);
   ci_tcp_state_reinit(netif, &wo->tcp);
+
+  /* The reserve is shared by all of the stack's listeners. */
+  ci_assert_gt(netif->state->n_listeners, 0);
+  if( --netif->state->n_listeners == 0 )
+    ci_tcp_accept_prealloc_release(netif);
 }
 
 
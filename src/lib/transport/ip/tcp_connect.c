@@ -1041,9 +1041,15 @@ static int ci_tcp_connect_ul_start(ci_netif *ni, ci_tcp_state* ts, ci_fd_t fd,
 
   /* Must be after initialising snd_una. */
   ci_tcp_clear_rtt_timing(ts);
-  ci_tcp_set_flags(ts, CI_TCP_FLAG_SYN);
+  ci_tcp_cc_init(ni, ts);
   ts->tcpflags &=~ CI_TCPT_FLAG_OPT_MASK;
-  ts->tcpflags |= NI_OPTS(ni).syn_opts;
+  ts->tcpflags |= NI_OPTS(ni).syn_opts & ~CI_TCPT_FLAG_ECN;
+  /* ECN-setup SYN (RFC3168 section 6.1.1); ECN is enabled if the SYN-ACK
+   * agrees. */
+  if( ci_tcp_cc_wants_ecn(&ts->c) )
+    ci_tcp_set_flags(ts, CI_TCP_FLAG_SYN | CI_TCP_FLAG_ECE | CI_TCP_FLAG_CWR);
+  else
+    ci_tcp_set_flags(ts, CI_TCP_FLAG_SYN);
 
   if( (ts->tcpflags & CI_TCPT_FLAG_WSCL) ) {
     if( NI_OPTS(ni).tcp_rcvbuf_mode == 1 )
@@ -1497,12 +1503,6 @@ int ci_tcp_listen_init(ci_netif *ni, ci_tcp_socket_listen *tls)
   tls->n_listenq = 0;
   tls->n_listenq_new = 0;
 
-  /* Allocate and initialise the listen bucket */
-  tls->bucket = ci_ni_aux_alloc_bucket(ni);
-  if( OO_P_IS_NULL(tls->bucket) )
-    return -ENOBUFS;
-  tls->n_buckets = 1;
-
   /* Initialise the listenQ. */
   for( i = 0; i <= CI_CFG_TCP_SYNACK_RETRANS_MAX; ++i ) {
     sp = TS_OFF(ni, tls);
@@ -2018,6 +2018,7 @@ int ci_tcp_listen(citp_socket* ep, ci_fd_t fd, int backlog)
 
   ci_tcp_set_slow_state(netif, ts, CI_TCP_LISTEN);
   tls = SOCK_TO_TCP_LISTEN(&ts->s);
+  ++netif->state->n_listeners;
 
   tcp_raddr_be32(tls) = 0u;
   tcp_rport_be16(tls) = 0u;
@@ -2120,6 +2121,7 @@ int ci_tcp_listen(citp_socket* ep, ci_fd_t fd, int backlog)
     ci_tcp_ep_clear_filters(netif, S_SP(tls), 0);
     goto post_listen_fail;
   }
+  ci_tcp_accept_prealloc_fill(netif);
   ci_netif_unlock(ep->netif);
   return 0;
 
@@ -260,7 +260,7 @@ static void ci_tcp_state_recv_assert_valid(ci_netif* ni, ci_tcp_state* ts,
   if( ts->s.b.state & CI_TCP_STATE_ACCEPT_DATA )
     verify(SEQ_EQ(tcp_rcv_nxt(ts), ts->rcv_added));
 
-  seq = ts->rcv_delivered;
+  seq = ts->rcv_delivered + ts->rcv_lent;
 
   /* Iterate over both recv1 and recv2. */
   q = &ts->recv1;
@@ -688,12 +688,12 @@ void ci_tcp_socket_listen_dump(ci_netif* ni, ci_tcp_socket_listen* tls,
 {
   ci_tcp_socket_cmn_dump(ni, &tls->c, pf, logger, log_arg);
 
-  logger(log_arg, "%s  listenq: max=%d n=%d new=%d buckets=%d", pf, 
-         ci_tcp_listenq_max(ni), tls->n_listenq, tls->n_listenq_new,
-         tls->n_buckets);
+  logger(log_arg, "%s  listenq: max=%d n=%d new=%d", pf,
+         ci_tcp_listenq_max(ni), tls->n_listenq, tls->n_listenq_new);
   logger(log_arg, "%s  acceptq: max=%d n=%d accepted=%d", pf,
          tls->acceptq_max, ci_tcp_acceptq_n(tls), tls->acceptq_n_out);
-  logger(log_arg, "%s  defer_accept=%d", pf, tls->c.tcp_defer_accept);
+  logger(log_arg, "%s  defer_accept=%d congestion=%s", pf,
+         tls->c.tcp_defer_accept, ci_tcp_cc_ops_get(tls->c.cc_algo)->name);
 #if CI_CFG_FD_CACHING
   logger(log_arg, "%s  sockcache: n=%d sock_n=%d cache=%s pending=%s connected=%s",
          pf, ni->state->passive_cache_avail_stack, tls->cache_avail_sock,
@@ -787,6 +787,24 @@ void ci_tcp_state_dump(ci_netif* ni, ci_tcp_state* ts,
   logger(log_arg, "%s  snd: cwnd=%d+%d used=%d ssthresh=%d bytes_acked=%d %s",
          pf, ts->cwnd, ts->cwnd_extra, tcp_cwnd_used(ts),
          ts->ssthresh, ts->bytes_acked, congstate_str(ts));
+  switch( ts->c.cc_algo ) {
+  case CI_TCP_CC_CUBIC:
+    logger(log_arg, "%s  cc: cubic w_max=%u w_last_max=%u k=%ums "
+           "origin=%u epoch=%u delay_min=%u", pf, ts->cc.cubic.w_max,
+           ts->cc.cubic.w_last_max, ts->cc.cubic.k, ts->cc.cubic.origin,
+           ts->cc.cubic.epoch, ts->cc.cubic.delay_min);
+    break;
+  case CI_TCP_CC_DCTCP:
+    logger(log_arg, "%s  cc: dctcp alpha=%u/1024 acked=%u ce=%u%s%s%s", pf,
+           ts->cc.dctcp.alpha, ts->cc.dctcp.acked, ts->cc.dctcp.acked_ce,
+           (ts->tcpflags & CI_TCPT_FLAG_ECN) ? " ECN":"",
+           (ts->tcpflags & CI_TCPT_FLAG_ECN_ECE) ? " ECE":"",
+           (ts->tcpflags & CI_TCPT_FLAG_ECN_CWR) ? " CWR":"");
+    break;
+  default:
+    logger(log_arg, "%s  cc: %s", pf, ci_tcp_cc(ts)->name);
+    break;
+  }
   logger(log_arg, "%s  snd: timed_seq %x timed_ts %x",
          pf, ts->timed_seq, ts->timed_ts);
   logger(log_arg, "%s  snd: sndbuf_pkts=%d "OOF_IPCACHE_STATE" "
@@ -810,9 +828,9 @@ void ci_tcp_state_dump(ci_netif* ni, ci_tcp_state* ts,
          stats.rx_isn, tcp_rcv_up(ts), tcp_urg_data(ts),
          TS_QUEUE_RX(ts) == &ts->recv1 ? "recv1" : "recv2");
   logger(log_arg, "%s  rcv: bytes=%d tot_pkts=%" PRIx64
-                  " rob_pkts=%d q_pkts=%d+%d usr=%d",
+                  " rob_pkts=%d q_pkts=%d+%d usr=%d lent=%u",
          pf, ts->rcv_added - stats.rx_isn, stats.rx_pkts, ts->rob.num,
-         ts->recv1.num, ts->recv2.num, tcp_rcv_usr(ts));
+         ts->recv1.num, ts->recv2.num, tcp_rcv_usr(ts), ts->rcv_lent);
 
   logger(log_arg,
          "%s  eff_mss=%d smss=%d amss=%d  used_bufs=%d wscl s=%d r=%d",
@@ -308,6 +308,35 @@ int ci_tcp_helper_tcp_accept_sock_attach(ci_fd_t stack_fd, oo_sp ep_id,
   return op.fd;
 }
 
+
+/* Returns the number of fds created, which are the first entries of
+ * [fds], or a negative error code if there were none.  Each endpoint
+ * still costs one OO_IOC_TCP_ACCEPT_SOCK_ATTACH, but the dup2 lock is
+ * taken once for the batch.
+ */
+int ci_tcp_helper_tcp_accept_sock_attach_batch(ci_fd_t stack_fd,
+                                               const oo_sp* ep_ids, int* fds,
+                                               int n, int type)
+{
+  int i, rc = 0;
+  oo_tcp_accept_sock_attach_t op;
+
+  ci_assert_gt(n, 0);
+  ci_assert_le(n, OO_ACCEPT_BATCH_MAX);
+
+  oo_rwlock_lock_read(&citp_dup2_lock);
+  for( i = 0; i < n; ++i ) {
+    op.ep_id = ep_ids[i];
+    op.type = type;
+    if( (rc = oo_resource_op(stack_fd, OO_IOC_TCP_ACCEPT_SOCK_ATTACH,
+                             &op)) < 0 )
+      break;
+    fds[i] = op.fd;
+  }
+  oo_rwlock_unlock_read (&citp_dup2_lock);
+  return i > 0 ? i : rc;
+}
+
 #if CI_CFG_USERSPACE_PIPE
 int ci_tcp_helper_pipe_attach(ci_fd_t stack_fd, oo_sp ep_id,
                               int flags, int fds[2])
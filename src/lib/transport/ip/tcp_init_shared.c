@@ -148,6 +148,7 @@ void ci_tcp_state_tcb_reinit_minimal(ci_netif* netif, ci_tcp_state* ts)
   ts->cwnd_extra = 0;
   ts->dup_acks = 0;
   ts->bytes_acked = 0;
+  memset(&ts->cc, 0, sizeof(ts->cc));
 
   /* ts->eff_mss is not cleared as might be used without lock on send path */
   ts->ssthresh = 0;
@@ -197,12 +198,13 @@ static void ci_tcp_state_tcb_reinit(ci_netif* netif, ci_tcp_state* ts,
 
   ci_tcp_fast_path_disable(ts);
 
-  ts->tcpflags = NI_OPTS(netif).syn_opts;
+  ts->tcpflags = NI_OPTS(netif).syn_opts & ~CI_TCPT_FLAG_ECN;
 
   ts->outgoing_hdrs_len = sizeof(ci_ip4_hdr) + sizeof(ci_tcp_hdr);
   if( ts->tcpflags & CI_TCPT_FLAG_TSO )  ts->outgoing_hdrs_len += 12;
   ts->incoming_tcp_hdr_len = (ci_uint8)sizeof(ci_tcp_hdr);
   ts->c.tcp_defer_accept = OO_TCP_DEFER_ACCEPT_OFF;
+  ts->c.cc_algo = NI_OPTS(netif).tcp_cong_algo;
 
   ci_tcp_state_connected_opts_init(netif, ts);
 
@@ -222,6 +224,7 @@ static void ci_tcp_state_tcb_reinit(ci_netif* netif, ci_tcp_state* ts,
   /* receive window */
   tcp_rcv_wnd_right_edge_sent(ts) = tcp_rcv_wnd_advertised(ts) = 0;
   ts->rcv_added = ts->rcv_delivered = tcp_rcv_nxt(ts) = 0;
+  ts->rcv_lent = 0;
   tcp_rcv_up(ts) = SEQ_SUB(tcp_rcv_nxt(ts), 1);
 
   /* setup header length */
@@ -27,6 +27,9 @@
 /*! \cidoxg_lib_transport_ip */
 
 #include "ip_internal.h"
+#ifndef __KERNEL__
+#include <onload/extensions_zc.h>
+#endif
 
 
 #define LPF "TCP RECV "
@@ -117,19 +120,12 @@ int ci_tcp_send_wnd_update(ci_netif* ni, ci_tcp_state* ts, int sock_locked)
 }
 
 
-/* This is called after we've pulled a certain amount of data from the
-** receive queue, and sends a window update if appropriate.
+/* Sends a window update if appropriate, else resets [ack_trigger].  Caller
+** must hold the netif lock.
 */
-static void ci_tcp_recvmsg_send_wnd_update(ci_netif* ni, ci_tcp_state* ts)
+static void __ci_tcp_recvmsg_send_wnd_update(ci_netif* ni, ci_tcp_state* ts)
 {
-  if( ! ci_netif_trylock(ni) ) {
-    ci_bit_set(&ts->s.s_aflags, CI_SOCK_AFLAG_NEED_ACK_BIT);
-    if( ! ci_netif_lock_or_defer_work(ni, &ts->s.b) )
-      return;
-    ci_bit_clear(&ts->s.s_aflags, CI_SOCK_AFLAG_NEED_ACK_BIT);
-  }
-
-  CHECK_TS(ni, ts);
+  ci_assert(ci_netif_is_locked(ni));
 
   LOG_TR(log(LNTS_FMT "ack_trigger=%x c/w rcv_delivered=%x "
              "rcv_added=%u buff=%u wnd_rhs=%x current=%u",
@@ -138,7 +134,7 @@ static void ci_tcp_recvmsg_send_wnd_update(ci_netif* ni, ci_tcp_state* ts)
              tcp_rcv_wnd_right_edge_sent(ts),
              tcp_rcv_wnd_current(ts)));
 
-  if( ts->s.b.state & CI_TCP_STATE_NOT_CONNECTED )  goto out;
+  if( ts->s.b.state & CI_TCP_STATE_NOT_CONNECTED )  return;
 
   /* Free-up some receive buffers now we have the netif lock. */
   ci_tcp_rx_reap_rxq_bufs(ni, ts);
@@ -161,8 +157,23 @@ static void ci_tcp_recvmsg_send_wnd_update(ci_netif* ni, ci_tcp_state* ts)
       + ci_tcp_ack_trigger_delta(ts)
       - SEQ_SUB(ts->rcv_delivered + ts->rcv_window_max,
                 tcp_rcv_wnd_right_edge_sent(ts));
+}
 
- out:
+
+/* This is called after we've pulled a certain amount of data from the
+** receive queue, and sends a window update if appropriate.
+*/
+static void ci_tcp_recvmsg_send_wnd_update(ci_netif* ni, ci_tcp_state* ts)
+{
+  if( ! ci_netif_trylock(ni) ) {
+    ci_bit_set(&ts->s.s_aflags, CI_SOCK_AFLAG_NEED_ACK_BIT);
+    if( ! ci_netif_lock_or_defer_work(ni, &ts->s.b) )
+      return;
+    ci_bit_clear(&ts->s.s_aflags, CI_SOCK_AFLAG_NEED_ACK_BIT);
+  }
+
+  CHECK_TS(ni, ts);
+  __ci_tcp_recvmsg_send_wnd_update(ni, ts);
   CHECK_TS(ni, ts);
 
   ci_netif_unlock(ni);
@@ -249,8 +260,12 @@ ci_tcp_recvmsg_get_nopeek(int peek_off, ci_tcp_state *ts, ci_netif *netif,
     ci_tcp_rcvbuf_drs(netif, ts);
   if( oo_offbuf_left(&(*pkt)->buf) == 0 ) {
     /* We've emptied the current packet. */
-    if( CI_UNLIKELY(SEQ_LE(ts->ack_trigger, ts->rcv_delivered)) )
-      ci_tcp_recvmsg_send_wnd_update(netif, ts);
+    if( CI_UNLIKELY(SEQ_LE(ts->ack_trigger, ts->rcv_delivered)) ) {
+      if( rinf->stack_locked )
+        __ci_tcp_recvmsg_send_wnd_update(netif, ts);
+      else
+        ci_tcp_recvmsg_send_wnd_update(netif, ts);
+    }
     if( total == max_bytes || OO_PP_IS_NULL((*pkt)->next) )
       /* We've emptied the receive queue. Return non-zero to report this
        * to the calling function, so that it can return appropriately. */
@@ -315,6 +330,10 @@ ci_tcp_recvmsg_get(struct tcp_recv_info *rinf)
    * if zero bytes received so far. */
   if( rinf->rc == 0 ) {
     rinf->timestamp = pkt->tstamp_frc;
+#if CI_CFG_LAT_HIST
+    if( ! (rinf->a->flags & MSG_PEEK) )
+      ci_netif_lat_hist_rx(netif, S_SP(ts), pkt);
+#endif
 #if CI_CFG_TIMESTAMPING
     rinf->hw_timestamp.tv_sec = pkt->pf.tcp_rx.rx_hw_stamp.tv_sec;
     rinf->hw_timestamp.tv_nsec = pkt->pf.tcp_rx.rx_hw_stamp.tv_nsec;
@@ -411,7 +430,8 @@ static int ci_tcp_recvmsg_spin(ci_netif* ni, ci_tcp_state* ts,
 #ifndef __KERNEL__
   citp_signal_info* si = citp_signal_get_specific_inited();
 #endif
-  ci_uint64 max_spin = ts->s.b.spin_cycles;
+  ci_uint64 max_spin = oo_spin_adapt_budget(oo_spin_adapt_sock(ni, &ts->s.b),
+                                            ts->s.b.spin_cycles);
   int rc, spin_limit_by_so = 0, intf_i = ts->s.pkt.intf_i;
 
   /* Cache the next expected packet buffer to save work within the loop.
@@ -549,6 +569,9 @@ int ci_tcp_recvmsg(const ci_tcp_recvmsg_args* a)
   int                   flags = a->flags;
   ci_uint64             start_frc = 0; /* suppress compiler warning */
   unsigned              tcp_recv_spin = 0;
+#if CI_CFG_SPIN_ADAPT
+  int                   spin_adapt = 0;
+#endif
   ci_uint32             timeout = ts->s.so.rcvtimeo_msec;
   struct tcp_recv_info  rinf;
 
@@ -682,6 +705,10 @@ int ci_tcp_recvmsg(const ci_tcp_recvmsg_args* a)
   if( tcp_recv_spin ) {
     int rc2;
 
+#if CI_CFG_SPIN_ADAPT
+    /* Time this wait, so that we learn how long to spin for. */
+    spin_adapt = ni->spin_adapt != NULL;
+#endif
     if( (rc2 = ci_tcp_recvmsg_spin(ni, ts, start_frc)) ) {
       if( rc2 < 0 ) {
         /* -ERESTARTSYS, -EINTR or -EAGAIN */
@@ -850,6 +877,11 @@ int ci_tcp_recvmsg(const ci_tcp_recvmsg_args* a)
   goto unlock_out;
 
  success_unlock_out:
+#if CI_CFG_SPIN_ADAPT
+  if( spin_adapt )
+    oo_spin_adapt_wait_done(ni, oo_spin_adapt_sock(ni, &ts->s.b),
+                            ci_frc64_get() - start_frc, ts->s.b.spin_cycles);
+#endif
 #ifndef __KERNEL__
   ci_tcp_recv_fill_msgname(ts, (struct sockaddr*) a->msg->msg_name,
                            &a->msg->msg_namelen);  /*!\TODO fixme remove cast*/
@@ -1374,4 +1406,319 @@ static int ci_tcp_recvmsg_recv2(struct tcp_recv_info *rinf)
 }
 
 
+
+#ifndef __KERNEL__
+/* Lend the app up to [iovlen] packets from recv1, one iovec per packet
+** covering all of its unread data.  Lent data is consumed as far as the
+** receive queue is concerned, but counts against rcvbuf (via rcv_lent)
+** until ci_tcp_zc_recv_unlend() returns it.  Both locks must be held.
+** Returns the number of iovecs filled.
+*/
+static int ci_tcp_zc_recv_lend_pkts(ci_netif* ni, ci_tcp_state* ts,
+                                    struct onload_zc_iovec* iov, int iovlen)
+{
+  ci_ip_pkt_fmt* pkt;
+  int i, n;
+
+  ci_assert(ci_netif_is_locked(ni));
+  ci_assert(ci_sock_is_locked(ni, &ts->s.b));
+
+  if( tcp_rcv_usr(ts) <= 0 || OO_PP_IS_NULL(ts->recv1_extract) )
+    return 0;
+
+  pkt = PKT_CHK_NNL(ni, ts->recv1_extract);
+  for( i = 0; i < iovlen; ++i ) {
+    if( oo_offbuf_is_empty(&pkt->buf) ) {
+      if( OO_PP_IS_NULL(pkt->next) )
+        break;
+      ts->recv1_extract = pkt->next;
+      pkt = PKT_CHK_NNL(ni, ts->recv1_extract);
+      ci_assert(oo_offbuf_not_empty(&pkt->buf));
+    }
+    PKT_TCP_RX_BUF_ASSERT_VALID(ni, pkt);
+    ci_assert_nflags(pkt->rx_flags, CI_PKT_RX_FLAG_TCP_LENT);
+#if CI_CFG_LAT_HIST
+    if( i == 0 )
+      ci_netif_lat_hist_rx(ni, S_SP(ts), pkt);
+#endif
+
+    /* The payload length and loopback receiver are not needed once the
+     * packet is on recv1, so they record how much we lent, and to whom,
+     * for ci_tcp_zc_recv_unlend().
+     */
+    n = oo_offbuf_left(&pkt->buf);
+    ci_netif_pkt_hold(ni, pkt);
+    pkt->rx_flags |= CI_PKT_RX_FLAG_TCP_LENT;
+    pkt->pf.tcp_rx.pay_len = n;
+    pkt->pf.tcp_rx.lo.rx_sock = S_SP(ts);
+    iov[i].iov_base = oo_offbuf_ptr(&pkt->buf);
+    iov[i].iov_len = n;
+    iov[i].buf = (onload_zc_handle) pkt;
+    iov[i].iov_flags = 0;
+    oo_offbuf_advance(&pkt->buf, n);
+    ts->rcv_lent += n;
+  }
+
+  if( i )
+    CITP_STATS_NETIF_ADD(ni, tcp_zc_lent_pkts, i);
+  return i;
+}
+
+
+/* Pull-style zero-copy receive: see onload_zc_recv_lend().  Waits (as
+** recv() would, honouring spinning and SO_RCVTIMEO) until there is data
+** to lend unless ONLOAD_MSG_DONTWAIT is given.
+**
+** Returns the number of iovecs filled, 0 at end-of-stream, or -ve error.
+** Data after the urgent mark (recv2) is not lent: -ENOTEMPTY tells the app
+** to read it with recv().
+*/
+int ci_tcp_zc_recv_lend(ci_netif* ni, ci_tcp_state* ts,
+                        struct onload_zc_iovec* iov, int iovlen, int flags)
+{
+  ci_uint32 timeout = ts->s.so.rcvtimeo_msec;
+  ci_uint64 start_frc, sleep_seq;
+  unsigned tcp_recv_spin;
+  int rc, have_polled = 0;
+
+  if( iovlen <= 0 )
+    return -EINVAL;
+
+  rc = ci_sock_lock(ni, &ts->s.b);
+  if(CI_UNLIKELY( rc != 0 ))
+    return rc;
+
+  if( ts->s.b.state == CI_TCP_LISTEN ) {
+    rc = -ENOTCONN;
+    goto unlock_out;
+  }
+
+  tcp_recv_spin =
+    oo_per_thread_get()->spinstate & (1 << ONLOAD_SPIN_TCP_RECV);
+  ci_frc64(&start_frc);
+
+  while( 1 ) {
+    if( (rc = ci_netif_lock(ni)) != 0 )
+      goto unlock_out;
+    if( ! have_polled && tcp_rcv_usr(ts) == 0 && ci_netif_may_poll(ni) &&
+        ci_netif_need_poll_spinning(ni, start_frc) ) {
+      /* Bring the receive queue up-to-date before deciding to wait. */
+      ci_netif_poll_n(ni, NI_OPTS(ni).evs_per_poll);
+      have_polled = 1;
+    }
+    rc = ci_tcp_zc_recv_lend_pkts(ni, ts, iov, iovlen);
+    ci_netif_unlock(ni);
+    if( rc > 0 )
+      goto unlock_out;
+
+    if( tcp_rcv_usr(ts) ) {
+      rc = -ENOTEMPTY;
+      goto unlock_out;
+    }
+    if( TCP_RX_DONE(ts) )
+      goto rx_done;
+    if( flags & ONLOAD_MSG_DONTWAIT ) {
+      rc = -EAGAIN;
+      goto unlock_out;
+    }
+
+    if( tcp_recv_spin ) {
+      if( (rc = ci_tcp_recvmsg_spin(ni, ts, start_frc)) != 0 ) {
+        if( rc < 0 )
+          goto unlock_out;
+        continue;
+      }
+      tcp_recv_spin = 0;
+      if( timeout ) {
+        ci_uint32 spin_ms = NI_OPTS(ni).spin_usec >> 10;
+        if( spin_ms < timeout )
+          timeout -= spin_ms;
+        else {
+          rc = -EAGAIN;
+          goto unlock_out;
+        }
+      }
+    }
+
+    sleep_seq = ts->s.b.sleep_seq.all;
+    ci_rmb();
+    if( tcp_rcv_usr(ts) || TCP_RX_DONE(ts) )
+      continue;
+
+    /* This drops the socket lock, and returns unlocked. */
+    rc = ci_sock_sleep(ni, &ts->s.b, CI_SB_FLAG_WAKE_RX,
+                       CI_SLEEP_SOCK_LOCKED | CI_SLEEP_SOCK_RQ,
+                       sleep_seq, &timeout);
+    if( rc == 0 )
+      rc = ci_sock_lock(ni, &ts->s.b);
+    if( rc < 0 )
+      return rc;
+    have_polled = 0;
+  }
+
+ rx_done:
+  /* As for recv(): no error if the connection was properly shut down. */
+  rc = 0;
+  if( ! (ts->tcpflags & CI_TCPT_FLAG_FIN_RECEIVED) ) {
+    if( ts->s.so_error )
+      rc = -ci_get_so_error(&ts->s);
+    else
+      rc = -TCP_RX_ERRNO(ts);
+  }
+ unlock_out:
+  ci_sock_unlock(ni, &ts->s.b);
+  return rc;
+}
+
+
+/* Return a packet lent by ci_tcp_zc_recv_lend() from socket [s], drop
+** our reference to it and send a window update if returning it has opened
+** the window enough.  If the connection has been closed since the packet
+** was lent, its accounting has been reset and only the reference remains
+** to be dropped.  Both locks must be held.
+*/
+void ci_tcp_zc_recv_unlend(ci_netif* ni, ci_sock_cmn* s, ci_ip_pkt_fmt* pkt)
+{
+  int n = pkt->pf.tcp_rx.pay_len;
+  ci_tcp_state* ts;
+
+  ci_assert(ci_netif_is_locked(ni));
+  ci_assert(ci_sock_is_locked(ni, &s->b));
+  ci_assert_flags(pkt->rx_flags, CI_PKT_RX_FLAG_TCP_LENT);
+  ci_assert(OO_SP_EQ(pkt->pf.tcp_rx.lo.rx_sock, SC_SP(s)));
+
+  pkt->rx_flags &=~ CI_PKT_RX_FLAG_TCP_LENT;
+  if( ! (s->b.state & CI_TCP_STATE_TCP_CONN) ||
+      (ci_uint32) n > (ts = SOCK_TO_TCP(s))->rcv_lent ) {
+    ci_netif_pkt_release_rx(ni, pkt);
+    return;
+  }
+
+  ts->rcv_lent -= n;
+  ts->rcv_delivered += n;
+  ci_netif_pkt_release_rx(ni, pkt);
+
+  if( NI_OPTS(ni).tcp_rcvbuf_mode == 1 )
+    ci_tcp_rcvbuf_drs(ni, ts);
+  if( SEQ_LE(ts->ack_trigger, ts->rcv_delivered) )
+    __ci_tcp_recvmsg_send_wnd_update(ni, ts);
+}
+
+
+/* Take buffers off the head of the receive queue so that their payload can
+** be handed on without copying, as when splicing to a pipe.  Takes up to
+** [max_pkts] buffers holding at most [max_bytes] in total, stopping at the
+** first one that is shared, lent or chained.  Nothing is taken while
+** urgent data is pending.  The buffers are consumed as if read, and are
+** returned cleaned with pkt->buf still describing the unread payload.
+** Both locks must be held.  Returns the number of buffers put in [pkts].
+*/
+int ci_tcp_recv_detach_pkts(ci_netif* ni, ci_tcp_state* ts,
+                            ci_ip_pkt_fmt** pkts, int max_pkts, int max_bytes)
+{
+  ci_ip_pkt_fmt* pkt;
+  int n_pkts = 0, bytes = 0, n;
+
+  ci_assert(ci_netif_is_locked(ni));
+  ci_assert(ci_sock_is_locked(ni, &ts->s.b));
+
+  if( TS_QUEUE_RX(ts) != &ts->recv1 ||
+      (tcp_urg_data(ts) & (CI_TCP_URG_COMING | CI_TCP_URG_PTR_VALID)) )
+    return 0;
+
+  ci_tcp_rx_reap_rxq_bufs(ni, ts);
+  while( n_pkts < max_pkts && OO_PP_NOT_NULL(ts->recv1_extract) ) {
+    pkt = PKT_CHK(ni, ts->recv1_extract);
+    ci_assert(OO_PP_EQ(ts->recv1.head, ts->recv1_extract));
+    n = oo_offbuf_left(&pkt->buf);
+    if( n == 0 ) {
+      if( OO_PP_IS_NULL(pkt->next) )
+        break;
+      ts->recv1_extract = pkt->next;
+      ci_tcp_rx_reap_rxq_bufs(ni, ts);
+      continue;
+    }
+    if( n > max_bytes - bytes || pkt->refcount != 1 || pkt->n_buffers != 1 ||
+        (pkt->rx_flags & CI_PKT_RX_FLAG_TCP_LENT) )
+      break;
+    PKT_TCP_RX_BUF_ASSERT_VALID(ni, pkt);
+
+    ts->recv1_extract = ts->recv1.head = pkt->next;
+    ci_tcp_rx_buf_adjust(ni, ts, &ts->recv1, -1);
+    --ts->recv1.num;
+    ts->rcv_delivered += n;
+    bytes += n;
+
+    /* The buffer is no longer accounted as a receive buffer. */
+    ci_assert_flags(pkt->flags, CI_PKT_FLAG_RX);
+    --ni->state->n_rx_pkts;
+    __ci_netif_pkt_clean(pkt);
+    pkts[n_pkts++] = pkt;
+  }
+
+  if( n_pkts == 0 )
+    return 0;
+  if( NI_OPTS(ni).tcp_rcvbuf_mode == 1 )
+    ci_tcp_rcvbuf_drs(ni, ts);
+  if( SEQ_LE(ts->ack_trigger, ts->rcv_delivered) )
+    __ci_tcp_recvmsg_send_wnd_update(ni, ts);
+  CITP_STATS_NETIF_ADD(ni, tcp_splice_rx_pkts, n_pkts);
+  return n_pkts;
+}
+
+
+/* Copy up to [len] bytes from the receive queue to [buf], for a caller
+** that holds both locks and so cannot use ci_tcp_recvmsg().  Never blocks
+** and does not poll: the caller is expected to have done so.  Returns the
+** number of bytes copied, 0 at end of stream, -EAGAIN if there is nothing
+** to read, or another -errno.  Returns -EOPNOTSUPP if the receive needs
+** ci_tcp_recvmsg(), which it does until the connection is established and
+** while urgent data is pending.
+*/
+int ci_tcp_recvmsg_locked(ci_netif* ni, ci_tcp_state* ts, void* buf, int len)
+{
+  ci_tcp_recvmsg_args a;
+  struct tcp_recv_info rinf;
+  struct iovec iov;
+
+  ci_assert(ci_netif_is_locked(ni));
+  ci_assert(ci_sock_is_locked(ni, &ts->s.b));
+
+  if( ! (ts->s.b.state & CI_TCP_STATE_SYNCHRONISED) ||
+      TS_QUEUE_RX(ts) != &ts->recv1 ||
+      (tcp_urg_data(ts) & (CI_TCP_URG_COMING | CI_TCP_URG_PTR_VALID)) )
+    return -EOPNOTSUPP;
+  if( len <= 0 )
+    return 0;
+
+  iov.iov_base = buf;
+  iov.iov_len = len;
+  ci_tcp_recvmsg_args_init(&a, ni, ts, NULL, 0);
+  rinf.stack_locked = 1;
+  rinf.a = &a;
+  rinf.rc = 0;
+  rinf.msg_flags = 0;
+  ci_iovec_ptr_init_nz(&rinf.piov, &iov, 1);
+  rinf.rc = ci_tcp_recvmsg_get(&rinf);
+
+  if( rinf.rc == 0 ) {
+    if( ! TCP_RX_DONE(ts) )
+      rinf.rc = -EAGAIN;
+    else if( ts->tcpflags & CI_TCPT_FLAG_FIN_RECEIVED )
+      rinf.rc = 0;
+    else if( ts->s.so_error )
+      rinf.rc = -ci_get_so_error(&ts->s);
+    else
+      rinf.rc = -TCP_RX_ERRNO(ts);
+  }
+
+  /* As ci_tcp_recvmsg() does on the way out. */
+  if( ((ts->s.b.state & CI_TCP_STATE_RECVD_FIN) && tcp_rcv_usr(ts) == 0) ||
+      ni->state->mem_pressure )
+    ci_tcp_rx_reap_rxq_bufs_socklocked(ni, ts);
+  return rinf.rc;
+}
+#endif
+
+
 /*! \cidoxg_end */
@@ -649,11 +649,37 @@ ci_inline unsigned ci_tcp_paws_check(ci_netif* netif, ci_uint32 tsval,
 }
 
 
+/* Reno congestion avoidance. */
+ci_inline void ci_tcp_cong_avoid_reno(ci_netif *ni, ci_tcp_state* ts)
+{
+  /* Hack - Increase less aggresively on small round trip times */
+#if CI_CFG_CONG_AVOID_SCALE_BACK
+  unsigned tmp = NI_OPTS(ni).cong_avoid_scale_back >> tcp_srtt(ts);
+  unsigned cwnd_scaled = CI_MAX(1, tmp) * ts->cwnd;
+#else
+  unsigned cwnd_scaled = ts->cwnd;
+#endif
+  /* Congestion avoidance.  RFC3465 says: increase the congestion window
+  ** by one segment each RTT.  i.e. wait for bytes_acked to be > cwnd
+  ** (which takes one RTT), then reset bytes_acked by subtracting the
+  ** cwnd from it, and add one segment to cwnd.
+  */
+  LOG_TV(log(LPF "%d OPENCWND: CA eff_mss=%u bytes_acked=%u cwnd=%u",
+             S_FMT(ts), tcp_eff_mss(ts), ts->bytes_acked, ts->cwnd));
+  if( ts->bytes_acked >= cwnd_scaled ) {
+    ts->bytes_acked -= cwnd_scaled;
+    ts->cwnd += tcp_eff_mss(ts);
+  }
+}
+
+
 /* function to open the congestion window following the
 ** reception of an ack for new data. Implements RFC3465 (ABC)
 */
 ci_inline void ci_tcp_opencwnd(ci_netif *ni, ci_tcp_state* ts)
 {
+  const ci_tcp_cc_ops* cc;
+
 #if CI_CFG_CONG_AVOID_NOTIFIED
   /* If congestion has been notified (but no loss detected yet)
      gradually scale the cwnd back */
@@ -664,24 +690,11 @@ ci_inline void ci_tcp_opencwnd(ci_netif *ni, ci_tcp_state* ts)
   else
 #endif
   if( ts->cwnd >= ts->ssthresh ) {
-    /* Hack - Increase less aggresively on small round trip times */
-#if CI_CFG_CONG_AVOID_SCALE_BACK
-    unsigned tmp = NI_OPTS(ni).cong_avoid_scale_back >> tcp_srtt(ts);
-    unsigned cwnd_scaled = CI_MAX(1, tmp) * ts->cwnd;
-#else
-    unsigned cwnd_scaled = ts->cwnd;
-#endif
-    /* Congestion avoidance.  RFC3465 says: increase the congestion window
-    ** by one segment each RTT.  i.e. wait for bytes_acked to be > cwnd
-    ** (which takes one RTT), then reset bytes_acked by subtracting the
-    ** cwnd from it, and add one segment to cwnd.
-    */
-    LOG_TV(log(LPF "%d OPENCWND: CA eff_mss=%u bytes_acked=%u cwnd=%u",
-               S_FMT(ts), tcp_eff_mss(ts), ts->bytes_acked, ts->cwnd));
-    if( ts->bytes_acked >= cwnd_scaled ) {
-      ts->bytes_acked -= cwnd_scaled;
-      ts->cwnd += tcp_eff_mss(ts);
-    }
+    if(CI_UNLIKELY( ts->c.cc_algo != CI_TCP_CC_RENO &&
+                    (cc = ci_tcp_cc(ts))->cong_avoid != NULL ))
+      cc->cong_avoid(ni, ts);
+    else
+      ci_tcp_cong_avoid_reno(ni, ts);
   }
   else {
     /* Slow-start. */
@@ -716,7 +729,7 @@ ci_inline void ci_tcp_opencwnd(ci_netif *ni, ci_tcp_state* ts)
 
 static void ci_tcp_reset_cwnd_on_loss(ci_netif* ni, ci_tcp_state* ts)
 {
-  ts->ssthresh = ci_tcp_losswnd(ts);
+  ts->ssthresh = ci_tcp_cc_ssthresh(ni, ts, 0);
   ts->cwnd = ts->ssthresh + ci_tcp_base_dupack_thresh(ts) * tcp_eff_mss(ts);
   ts->cwnd = CI_MAX(ts->cwnd, NI_OPTS(ni).loss_min_cwnd);
   ts->cwnd = CI_MAX(ts->cwnd, NI_OPTS(ni).min_cwnd);
@@ -1437,6 +1450,7 @@ static void ci_tcp_rx_handle_ack(ci_tcp_state* ts, ci_netif* netif,
 				 ciip_tcp_rx_pkt* rxp)
 {
   ci_ip_pkt_fmt* pkt = rxp->pkt;
+  const ci_tcp_cc_ops* cc;
   int snd_max_different;
 
   /* NB. Do not assert that ACK flag is set here, because it might not be!
@@ -1482,6 +1496,13 @@ static void ci_tcp_rx_handle_ack(ci_tcp_state* ts, ci_netif* netif,
       ci_tcp_update_rtt(netif, ts, ci_tcp_time_now(netif) - ts->timed_ts);
     }
 
+    if(CI_UNLIKELY( ts->c.cc_algo != CI_TCP_CC_RENO &&
+                    (cc = ci_tcp_cc(ts))->on_ack != NULL ))
+      /* ECE on a SYN-ACK is ECN negotiation, not a congestion mark. */
+      cc->on_ack(netif, ts, acked,
+                 (rxp->tcp->tcp_flags & (CI_TCP_FLAG_ECE | CI_TCP_FLAG_SYN))
+                 == CI_TCP_FLAG_ECE);
+
     /* Open the congestion window. */
     ts->bytes_acked += acked;
     ci_tcp_opencwnd(netif, ts);
@@ -1880,6 +1901,62 @@ ci_inline int ci_tcp_rx_deliver_to_recvq(ci_tcp_state* ts, ci_netif* netif,
 }
 
 
+/* Deliver a data segment sent on a loopback connection straight to the
+ * receive queue of [ts], instead of via the loopback queue and
+ * ci_tcp_handle_rx(): see EF_TCP_LOOPBACK_DIRECT.  The sender has checked
+ * that [pkt] carries only in-order data, and that [ts] is established.
+ * Acknowledging the data is left to the sender.
+ */
+void ci_tcp_rx_loopback_direct(ci_netif* ni, ci_tcp_state* ts,
+                               ci_ip_pkt_fmt* pkt)
+{
+  ci_tcp_hdr* tcp = PKT_TCP_HDR(pkt);
+  ci_uint8* opt = CI_TCP_HDR_OPTS(tcp);
+  ci_uint32 seq = pkt->pf.tcp_tx.start_seq;
+  ci_uint32 end_seq = pkt->pf.tcp_tx.end_seq;
+
+  ci_assert(ci_netif_is_locked(ni));
+  ci_assert_equal(ts->s.b.state, CI_TCP_ESTABLISHED);
+  ci_assert(SEQ_EQ(seq, tcp_rcv_nxt(ts)));
+  ci_assert(SEQ_LT(seq, end_seq));
+  ci_assert_equal(tcp->tcp_flags & ~(CI_TCP_FLAG_ACK | CI_TCP_FLAG_PSH), 0);
+  ci_assert(ci_ip_queue_is_empty(&ts->rob));
+
+  LOG_NR(ci_log(N_FMT "loopback direct pkt %d: %d->%d", N_PRI_ARGS(ni),
+                OO_PKT_FMT(pkt), OO_SP_FMT(pkt->pf.tcp_tx.lo.tx_sock),
+                OO_SP_FMT(pkt->pf.tcp_tx.lo.rx_sock)));
+
+  pkt->intf_i = OO_INTF_I_LOOPBACK;
+  pkt->flags &= CI_PKT_FLAG_NONB_POOL;
+  pkt->tstamp_frc = IPTIMER_STATE(ni)->frc;
+  pkt->next = OO_PP_NULL;
+  if( oo_tcpdump_check(ni, pkt, OO_INTF_I_LOOPBACK) ) {
+    oo_offbuf_init(&pkt->buf, PKT_START(pkt), pkt->buf_len);
+    oo_tcpdump_dump_pkt(ni, pkt);
+  }
+
+  /* As the receive fast path: for the keepalive timer, and the timestamp
+   * to echo.  The sender puts the timestamp option first if it uses one.
+   */
+  ts->t_last_recv_payload = ci_tcp_time_now(ni);
+  if( (ts->tcpflags & CI_TCPT_FLAG_TSO) &&
+      CI_TCP_HDR_OPT_LEN(tcp) >= 12 && *(ci_uint32*) opt == CI_TCP_TSO_WORD )
+    ci_tcp_tso_update(ni, ts, seq, end_seq,
+                      CI_BSWAP_BE32(*(ci_uint32*) &opt[4]));
+
+  /* tcp_tx.start_seq aliases tcp_rx.window, so we read it above. */
+  pkt->pf.tcp_rx.end_seq = end_seq;
+  pkt->pf.tcp_rx.window = CI_BSWAP_BE16(tcp->tcp_window_be16);
+  pkt->pf.tcp_rx.pay_len = SEQ_SUB(end_seq, seq);
+  oo_offbuf_init(&pkt->buf, CI_TCP_PAYLOAD(tcp), pkt->pf.tcp_rx.pay_len);
+
+  CI_TCP_STATS_INC_IN_SEGS(ni);
+  CITP_STATS_NETIF_INC(ni, tcp_loopback_direct);
+  ci_tcp_rx_enqueue_packet(ni, ts, pkt);
+  ci_tcp_wake_possibly_not_in_poll(ni, ts, CI_SB_FLAG_WAKE_RX);
+}
+
+
 void ci_tcp_rx_deliver2(ci_tcp_state* ts, ci_netif* netif,
 			ciip_tcp_rx_pkt* rxp)
 {
@@ -2606,6 +2683,7 @@ static void handle_rx_listen(ci_netif* netif, ci_tcp_socket_listen* tls,
                                     ci_tcp_listenq_max(netif)) / 4 &&
         (ci_tcp_acceptq_n(tls) >= tls->acceptq_max ||
          (OO_SP_IS_NULL(netif->state->free_eps_head) &&
+          OO_SP_IS_NULL(netif->state->accept_prealloc_head) &&
           netif->state->n_ep_bufs == netif->state->max_ep_bufs
           /*&& ci_ni_dllist_is_empty(netif, &netif->state->timeout_q)*/)) ) {
       CITP_STATS_NETIF(++netif->state->stats.syn_drop_busy);
@@ -2864,6 +2942,10 @@ static void handle_rx_listen(ci_netif* netif, ci_tcp_socket_listen* tls,
       tsr->tcpopts.flags &=~ CI_TCPT_FLAG_STRIPE;
     tsr->tcpopts.flags &= NI_OPTS(netif).syn_opts | CI_TCPT_FLAG_STRIPE;
   }
+  /* ECN-setup SYN has both ECE and CWR (RFC3168 section 6.1.1). */
+  if( (tcp->tcp_flags & (CI_TCP_FLAG_ECE | CI_TCP_FLAG_CWR)) ==
+      (CI_TCP_FLAG_ECE | CI_TCP_FLAG_CWR) && ci_tcp_cc_wants_ecn(&tls->c) )
+    tsr->tcpopts.flags |= CI_TCPT_FLAG_ECN;
 
   /* setup synrecv state */
   tsr->l_addr = ip->ip_daddr_be32;
@@ -3023,6 +3105,11 @@ static int handle_syn_sent_opts(ci_netif* netif, ci_tcp_state* ts,
     ts->tcpflags &=~ CI_TCPT_FLAG_SACK;
   if( !(tcpopts.flags & CI_TCPT_FLAG_STRIPE) )
     ts->tcpflags &=~ CI_TCPT_FLAG_STRIPE;
+  /* ECN-setup SYN-ACK has ECE but not CWR (RFC3168 section 6.1.1). */
+  if( (TS_TCP(ts)->tcp_flags & CI_TCP_FLAG_ECE) &&
+      (rxp->tcp->tcp_flags & (CI_TCP_FLAG_ECE | CI_TCP_FLAG_CWR)) ==
+      CI_TCP_FLAG_ECE )
+    ci_tcp_ecn_enable(ts);
 
   ts->outgoing_hdrs_len = sizeof(ci_ip4_hdr) + sizeof(ci_tcp_hdr) + optlen;
   ci_tcp_set_hdr_len(ts, sizeof(ci_tcp_hdr) + optlen);
@@ -3659,6 +3746,30 @@ static void handle_unacceptable_seq(ci_netif* netif, ci_tcp_state* ts,
 }
 
 
+/* ECN receiver.  We echo the CE state of the most recently received data
+ * segment in ECE, and ACK immediately whenever that state changes, so that
+ * the sender can count marked bytes exactly (RFC8257 section 3.2).  ECN is
+ * only negotiated for congestion control algorithms that want it, which
+ * currently means DCTCP.
+ */
+static void ci_tcp_rx_ecn(ci_netif* netif, ci_tcp_state* ts,
+                          ciip_tcp_rx_pkt* rxp)
+{
+  int ce;
+
+  if( rxp->pkt->pf.tcp_rx.pay_len == 0 )
+    return;
+  ce = (oo_ip_hdr(rxp->pkt)->ip_tos & CI_IP_TOS_ECN_MASK) == CI_IP_ECN_CE;
+  if( ce == !!(ts->tcpflags & CI_TCPT_FLAG_ECN_ECE) )
+    return;
+
+  LOG_TV(log(LNT_FMT "ECN CE %s", LNT_PRI_ARGS(netif, ts), ce ? "on":"off"));
+  ts->tcpflags ^= CI_TCPT_FLAG_ECN_ECE;
+  TCP_FORCE_ACK(ts);
+  CITP_STATS_NETIF_INC(netif, tcp_ecn_ce_changes);
+}
+
+
 static void handle_rx_slow(ci_tcp_state* ts, ci_netif* netif,
 			   ciip_tcp_rx_pkt* rxp)
 {
@@ -3693,10 +3804,12 @@ static void handle_rx_slow(ci_tcp_state* ts, ci_netif* netif,
   if(CI_UNLIKELY( tcp->tcp_flags & CI_TCP_FLAG_RST ))
     goto handle_rst;
 
-  /*! \TODO We don't support ECN yet. */
-  LOG_TR(if( tcp->tcp_flags & (CI_TCP_FLAG_ECE|CI_TCP_FLAG_CWR) )
-           log(LNT_FMT "ECN flags=%x not implemented (ignored)",
-               LNT_PRI_ARGS(netif, ts), (unsigned) tcp->tcp_flags));
+  if( ts->tcpflags & CI_TCPT_FLAG_ECN )
+    ci_tcp_rx_ecn(netif, ts, rxp);
+  else
+    LOG_TR(if( tcp->tcp_flags & (CI_TCP_FLAG_ECE|CI_TCP_FLAG_CWR) )
+             log(LNT_FMT "ECN flags=%x without ECN (ignored)",
+                 LNT_PRI_ARGS(netif, ts), (unsigned) tcp->tcp_flags));
 
   ci_assert_equal(oo_ip_hdr(pkt)->ip_saddr_be32, ts->s.pkt.ip.ip_daddr_be32);
   ci_assert_equal(oo_ip_hdr(pkt)->ip_daddr_be32, ts->s.pkt.ip.ip_saddr_be32);
@@ -243,6 +243,10 @@ int ci_tcp_sendmsg_fill_pkt(ci_netif* ni, ci_tcp_state* ts,
   ** the prequeue to the send queue in any case.
   */
   pkt->pf.tcp_tx.end_seq = n;
+#if CI_CFG_LAT_HIST
+  pkt->pf.tcp_tx.lo.tx_sock = S_SP(ts);
+  ci_netif_lat_hist_tx_stamp(ni, pkt);
+#endif
 
   ci_assert_equal(TX_PKT_LEN(pkt),
                   oo_offbuf_ptr(&pkt->buf) - PKT_START(pkt));
@@ -396,10 +400,10 @@ static struct oo_msg_template* ci_tcp_tmpl_pkt_to_omt(ci_ip_pkt_fmt* pkt)
 }
 
 
-static void __ci_tcp_tmpl_handle_nic_reset(ci_netif* ni, ci_tcp_state* ts)
+static void __ci_tcp_tmpl_handle_nic_reset(ci_netif* ni, oo_pkt_p* head)
 {
   oo_pkt_p* pp;
-  for( pp = &ts->tmpl_head; OO_PP_NOT_NULL(*pp); ) {
+  for( pp = head; OO_PP_NOT_NULL(*pp); ) {
     ci_ip_pkt_fmt* tmpl = PKT_CHK(ni, *pp);
     if( tmpl->pio_addr >= 0 ) {
       if( ni->state->nic[tmpl->intf_i].oo_vi_flags & OO_VI_FLAGS_PIO_EN ) {
@@ -419,7 +423,8 @@ static void __ci_tcp_tmpl_handle_nic_reset(ci_netif* ni, ci_tcp_state* ts)
 
 
 /* Iterate over all the sockets on this netif to handle ongoing
- * templated sends that can be impacted due to the NIC reset.
+ * templated sends that can be impacted due to the NIC reset.  UDP
+ * templates are kept in the same form, so they are handled here too.
  */
 void ci_tcp_tmpl_handle_nic_reset(ci_netif* ni)
 {
@@ -431,7 +436,12 @@ void ci_tcp_tmpl_handle_nic_reset(ci_netif* ni)
     if( (w->state & CI_TCP_STATE_TCP_CONN) || w->state == CI_TCP_CLOSED ) {
       ci_tcp_state* ts = &wo->tcp;
       if( OO_PP_NOT_NULL(ts->tmpl_head) )
-        __ci_tcp_tmpl_handle_nic_reset(ni, ts);
+        __ci_tcp_tmpl_handle_nic_reset(ni, &ts->tmpl_head);
+    }
+    else if( w->state == CI_TCP_STATE_UDP ) {
+      ci_udp_state* us = &wo->udp;
+      if( OO_PP_NOT_NULL(us->tmpl_head) )
+        __ci_tcp_tmpl_handle_nic_reset(ni, &us->tmpl_head);
     }
   }
 }
@@ -1798,14 +1808,23 @@ ci_tcp_send_alloc_pkts(ci_netif* ni, ci_tcp_state* ts,
                        struct tcp_send_info* sinf, int got)
 {
   ci_ip_pkt_fmt* pkt;
-  int rc;
+  int rc, max_pkts = CI_CFG_TCP_TX_BATCH;
 
   ci_assert_gt(sinf->total_unsent, 0);
   ci_assert_gt(sinf->sendq_credit, 0);
 
+  /* Segment large sends in one go, so that the whole chunk goes through
+   * ci_tcp_sendmsg_enqueue() and ci_tcp_tx_advance() together and is
+   * pushed to the NIC with one doorbell.
+   */
+  if( sinf->total_unsent > CI_CFG_TCP_TX_BATCH * ts->eff_mss &&
+      NI_OPTS(ni).tcp_send_gso_max / ts->eff_mss > CI_CFG_TCP_TX_BATCH )
+    max_pkts = NI_OPTS(ni).tcp_send_gso_max / ts->eff_mss;
+
   sinf->n_needed = ci_tcp_tx_n_pkts_needed(ts->eff_mss, sinf->total_unsent, 
-                                          CI_CFG_TCP_TX_BATCH,
-                                          sinf->sendq_credit);
+                                          max_pkts, sinf->sendq_credit);
+  if( sinf->n_needed > CI_CFG_TCP_TX_BATCH )
+    CITP_STATS_NETIF_INC(ni, tcp_send_gso_batches);
   rc = sinf->n_needed;
   sinf->fill_list = 0;
   sinf->fill_list_bytes = 0;
@@ -2527,6 +2546,104 @@ int ci_tcp_zc_send(ci_netif* ni, ci_tcp_state* ts, struct onload_zc_mmsg* msg,
 }
 
 
+/* Queue [n] packet buffers whose payloads, of [lens[i]] bytes, already sit
+ * directly after the headers, as they would for buffers from
+ * onload_zc_alloc_buffers().  This lets a pipe hand its buffers to the
+ * socket without copying.  The netif lock must be held, the connection
+ * must be synchronised with no tx_errno, and [n] must not exceed
+ * ci_tcp_tx_send_space().  Returns the number of bytes queued.
+ */
+int ci_tcp_sendmsg_pkts(ci_netif* ni, ci_tcp_state* ts, ci_ip_pkt_fmt** pkts,
+                        const int* lens, int n, int flags)
+{
+  ci_ip_pkt_fmt* fill_list = NULL;
+  unsigned eff_mss = tcp_eff_mss(ts);
+  int i, bytes = 0;
+
+  ci_assert(ci_netif_is_locked(ni));
+  ci_assert(ts->s.b.state & CI_TCP_STATE_SYNCHRONISED);
+  ci_assert_equal(ts->s.tx_errno, 0);
+  ci_assert_gt(n, 0);
+  ci_assert_le(n, ci_tcp_tx_send_space(ni, ts));
+
+  for( i = 0; i < n; ++i ) {
+    ci_ip_pkt_fmt* pkt = pkts[i];
+    ci_assert_gt(lens[i], 0);
+    ci_assert_le(lens[i], eff_mss);
+    ci_assert_equal(pkt->refcount, 1);
+
+    ci_tcp_tx_pkt_init(pkt, ts->outgoing_hdrs_len, eff_mss);
+    pkt->buf_len += lens[i];
+    pkt->pay_len += lens[i];
+    oo_offbuf_advance(&pkt->buf, lens[i]);
+    pkt->pf.tcp_tx.end_seq = lens[i];
+    ci_assert_equal(TX_PKT_LEN(pkt), oo_offbuf_ptr(&pkt->buf) - PKT_START(pkt));
+
+    CI_USER_PTR_SET(pkt->pf.tcp_tx.next, fill_list);
+    fill_list = pkt;
+    bytes += lens[i];
+  }
+
+  if( (flags & MSG_MORE) || (ts->s.s_aflags & CI_SOCK_AFLAG_CORK) ) {
+    fill_list->flags |= CI_PKT_FLAG_TX_MORE;
+    fill_list->flags &=~ CI_PKT_FLAG_TX_PSH_ON_ACK;
+  }
+
+  /* ci_tcp_sendmsg_enqueue() expects these to have been counted as handed
+   * out to the app, as onload_zc_alloc_buffers() does. */
+  ni->state->n_async_pkts += n;
+  ts->send_in += ci_tcp_sendmsg_enqueue(ni, ts, fill_list, bytes, &ts->send);
+
+  if( fill_list->flags & CI_PKT_FLAG_TX_MORE )
+    TX_PKT_TCP(fill_list)->tcp_flags = CI_TCP_FLAG_ACK;
+  else
+    TX_PKT_TCP(fill_list)->tcp_flags = CI_TCP_FLAG_PSH | CI_TCP_FLAG_ACK;
+  ci_tcp_tx_advance_nagle(ni, ts);
+  return bytes;
+}
+
+
+/* Copy up to [len] bytes from [buf] onto the send queue, for a caller that
+ * holds the netif lock and so cannot use ci_tcp_sendmsg().  Never blocks:
+ * queues as much as the send buffer and free packet buffers allow.
+ * Returns the number of bytes queued or -EAGAIN if none could be.  Returns
+ * -EOPNOTSUPP if the send needs ci_tcp_sendmsg(), which it does unless the
+ * connection is established without error and [flags] asks for no more
+ * than MSG_MORE.
+ */
+int ci_tcp_sendmsg_locked(ci_netif* ni, ci_tcp_state* ts, const void* buf,
+                          int len, int flags)
+{
+  ci_ip_pkt_fmt* pkts[CI_CFG_TCP_TX_BATCH];
+  int lens[CI_CFG_TCP_TX_BATCH];
+  int eff_mss = tcp_eff_mss(ts);
+  int max_pkts, n, bytes = 0;
+  ci_ip_pkt_fmt* pkt;
+
+  ci_assert(ci_netif_is_locked(ni));
+
+  if( len <= 0 || ts->snd_delegated || ts->s.tx_errno ||
+      ! (ts->s.b.state & CI_TCP_STATE_SYNCHRONISED) ||
+      (flags & ~(MSG_DONTWAIT | MSG_NOSIGNAL | MSG_MORE)) )
+    return -EOPNOTSUPP;
+
+  max_pkts = CI_MIN(ci_tcp_tx_send_space(ni, ts), CI_CFG_TCP_TX_BATCH);
+  for( n = 0; n < max_pkts && bytes < len; ++n ) {
+    if( (pkt = ci_netif_pkt_tx_tcp_alloc(ni, ts)) == NULL )
+      break;
+    /* Where ci_tcp_sendmsg_pkts() will find it, as for a pipe buffer. */
+    lens[n] = CI_MIN(len - bytes, eff_mss);
+    memcpy(pkt->dma_start + ETH_HLEN + ts->outgoing_hdrs_len,
+           (const char*) buf + bytes, lens[n]);
+    pkts[n] = pkt;
+    bytes += lens[n];
+  }
+  if( n == 0 )
+    return -EAGAIN;
+  return ci_tcp_sendmsg_pkts(ni, ts, pkts, lens, n, flags);
+}
+
+
 static int ci_tcp_ds_get_arp(ci_netif* ni, ci_tcp_state* ts)
 {
   int i;
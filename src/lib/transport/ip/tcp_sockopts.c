@@ -214,6 +214,17 @@ int ci_get_sol_tcp(ci_netif* netif, ci_sock_cmn* s, int optname, void *optval,
         u = ci_tcp_is_in_faststart(SOCK_TO_TCP(s));
       goto u_out;
     }
+#ifdef TCP_CONGESTION
+  case TCP_CONGESTION:
+    {
+      /* As Linux: the name, nul-padded to CI_TCP_CC_NAME_MAX. */
+      char name[CI_TCP_CC_NAME_MAX];
+      memset(name, 0, sizeof(name));
+      strncpy(name, ci_tcp_cc_ops_get(c->cc_algo)->name, sizeof(name) - 1);
+      return ci_getsockopt_final(optval, optlen, IPPROTO_TCP,
+                                 name, sizeof(name));
+    }
+#endif
   default:
 #ifndef __KERNEL__
     LOG_TC( log(LPF "getsockopt: unimplemented or bad option: %i", 
@@ -459,6 +470,28 @@ static int ci_tcp_setsockopt_lk(citp_socket* ep, ci_fd_t fd, int level,
         }
       }
       break;
+#ifdef TCP_CONGESTION
+    case TCP_CONGESTION:
+      {
+        char name[CI_TCP_CC_NAME_MAX];
+        int algo;
+
+        memcpy(name, optval, CI_MIN(optlen, sizeof(name) - 1));
+        name[CI_MIN(optlen, sizeof(name) - 1)] = '\0';
+        if( (algo = ci_tcp_cc_find(name)) < 0 ) {
+          LOG_TC(log("%s: "NSS_FMT" TCP_CONGESTION '%s' not supported",
+                     __FUNCTION__, NSS_PRI_ARGS(netif, s), name));
+          RET_WITH_ERRNO(-algo);
+        }
+        c->cc_algo = algo;
+        /* ECN is agreed at connection setup, so on an established
+         * connection a change only takes effect for window growth and
+         * response to loss. */
+        if( s->b.state & CI_TCP_STATE_TCP_CONN )
+          ci_tcp_cc_init(netif, SOCK_TO_TCP(s));
+      }
+      break;
+#endif
     default:
       LOG_TC(log("%s: "NSS_FMT" option %i unimplemented (ENOPROTOOPT)", 
                  __FUNCTION__, NSS_PRI_ARGS(netif,s), optname));
@@ -28,6 +28,7 @@
 
 #include "ip_internal.h"
 #include "tcp_rx.h"
+#include <onload/hash.h>
 
 
 #define LPF "TCP SYNRECV "
@@ -39,261 +40,336 @@
   ip_addr_str(tsr->r_addr), CI_BSWAP_BE16(tsr->r_port)
 
 #ifdef __KERNEL__
-/* We do not expect per-bucket list to be longer than a few members.
- * However, we must not break things if attacker managed to make a lot of
- * connection with the same hash (and the hash used here is not
+/* We do not expect a bucket's overflow chain to be longer than a few
+ * members.  However, we must not break things if attacker managed to make
+ * a lot of connections with the same hash (and the hash used here is not
  * cryptographically strong).
  * Finally, we must impose some limit to avoid malicious userland from
  * making kernel spin in the loop undefinetly long. */
-#define CI_LISTENQ_BUCKET_LIST_LIMIT(ni) NI_OPTS(ni).tcp_backlog_max
+#define CI_SYNRECV_OVERFLOW_LIMIT(ni) NI_OPTS(ni).tcp_synrecv_max
 #endif
 
-/* tcp_backlog_max <= 2^4:
- *      max level is 0 (2^4 different lists)
- * tcp_backlog_max <= 2^8:
- *      max level is 1 (2^8 different lists if no hash collisions happen)
- * tcp_backlog_max <= 2^12 = 4096:
- *      max level is 2.
- */
-#define CI_LISTENQ_BUCKET_MAX_DEPTH(ni) \
-    ((ci_log2_le(NI_OPTS(ni).tcp_backlog_max) - 1) / 4)
+#define CI_SYNRECV_TAGS_USED  0x80808080u
+
 
-ci_inline int ci_tcp_listenq_hash2idx(ci_uint32 hash, int level)
+ci_inline unsigned ci_tcp_synrecv_table_max(ci_netif* ni)
 {
-  return (hash >> (CI_TCP_LISTEN_BUCKET_S * level)) &
-      ((1 << CI_TCP_LISTEN_BUCKET_S) - 1);
+#ifdef __KERNEL__
+  return ni->synrecv_table_buckets;
+#else
+  return ni->synrecv_table->max_buckets;
+#endif
 }
 
+ci_inline unsigned ci_tcp_synrecv_table_n_buckets(ci_tcp_synrecv_table* tbl)
+{
+  return tbl->mask + 1 + tbl->split;
+}
 
-static int
-ci_tcp_listenq_bucket_drop(ci_netif* ni, ci_tcp_listen_bucket* bucket)
+/* Pops the lowest way from a mask of tag bytes. */
+ci_inline int ci_tcp_synrecv_next_way(ci_uint32* match)
 {
-  ci_ni_aux_mem* aux;
-  int idx;
-  oo_p tsr_p;
-  ci_tcp_state_synrecv* tsr;
-  int ret = 0;
-
-  for( idx = 0; idx < CI_TCP_LISTEN_BUCKET_SIZE; idx++ ) {
-    if( OO_P_IS_NULL(bucket->bucket[idx]) )
-      continue;
-    aux = ci_ni_aux_p2aux(ni, bucket->bucket[idx]);
-    if( aux->type == CI_TCP_AUX_TYPE_BUCKET )
-      ret += ci_tcp_listenq_bucket_drop(ni, &aux->u.bucket);
-    else {
-      tsr_p = bucket->bucket[idx];
-      do {
-        tsr = &ci_ni_aux_p2aux(ni, tsr_p)->u.synrecv;
-        tsr_p = tsr->bucket_link;
-        if( OO_SP_IS_NULL(tsr->local_peer) )
-          ci_ni_dllist_remove(ni, ci_tcp_synrecv2link(tsr));
-        /* RFC 793 tells us to send FIN and move to FIN-WAIT1 state.
-         * However, Linux (and probably everybody else) does not do it. */
-        ci_tcp_synrecv_free(ni, tsr);
-        ret++;
-      } while( OO_P_NOT_NULL(tsr_p) );
-    }
-  }
-  ci_ni_aux_free(ni, CI_CONTAINER(ci_ni_aux_mem, u.bucket, bucket));
+  int way = (ci_ffs64(*match) >> 3) - 1;
+  *match &= *match - 1;
+  return way;
+}
 
-  return ret;
+ci_inline void ci_tcp_synrecv_set_tag(ci_tcp_synrecv_bucket* bucket,
+                                      int way, unsigned tag)
+{
+  ci_uint32* tags = &bucket->tags[way >> 2];
+  int shift = (way & 3) * 8;
+  *tags = (*tags & ~(0xffu << shift)) | (tag << shift);
 }
 
 
-static void
-ci_tcp_listenq_bucket_insert(ci_netif* ni, ci_tcp_socket_listen* tls,
-                             ci_tcp_listen_bucket* bucket,
-                             ci_tcp_state_synrecv* tsr, int level)
+/* The bucket for [hash].  Returns NULL if the table is corrupted. */
+static ci_tcp_synrecv_bucket*
+ci_tcp_synrecv_bucket_get(ci_netif* ni, ci_uint32 hash)
 {
-  ci_ni_aux_mem* aux;
-  int idx = ci_tcp_listenq_hash2idx(tsr->hash, level);
-  oo_p tsr_p = ci_tcp_synrecv2p(ni, tsr);
+  ci_tcp_synrecv_table* tbl = ni->synrecv_table;
+  unsigned i = hash & tbl->mask;
+
+  if( i < tbl->split )
+    i = hash & (tbl->mask * 2 + 1);
 #ifdef __KERNEL__
-  int i = 0;
+  if(CI_UNLIKELY( i >= ci_tcp_synrecv_table_max(ni) )) {
+    ci_netif_error_detected(ni, CI_NETIF_ERROR_SYNRECV_TABLE,
+                            __FUNCTION__);
+    return NULL;
+  }
 #endif
-  oo_p nbucket;
+  return &tbl->bucket[i];
+}
 
-  LOG_TV(ci_log("%s([%d] level=%d "TSR_FMT")", __func__,
-                NI_ID(ni), level, TSR_ARGS(tsr)));
 
-  if( OO_P_IS_NULL(bucket->bucket[idx]) ) {
-    bucket->bucket[idx] = tsr_p;
-    return;
+/* Put [tsr] into a free way of [bucket], or else onto its overflow chain.
+ * Returns true if it went onto the chain. */
+static int ci_tcp_synrecv_bucket_put(ci_netif* ni,
+                                     ci_tcp_synrecv_bucket* bucket,
+                                     ci_tcp_state_synrecv* tsr, oo_p tsr_p)
+{
+  ci_uint32 free;
+  int w, way;
+
+  for( w = 0; w < CI_TCP_SYNRECV_TAG_WORDS; ++w ) {
+    free = onload_hash_tag_match(bucket->tags[w], 0);
+    if( free != 0 ) {
+      way = w * 4 + ci_tcp_synrecv_next_way(&free);
+      bucket->entry[way] = tsr_p;
+      ci_tcp_synrecv_set_tag(bucket, way, onload_hash_tag(tsr->hash));
+      return 0;
+    }
   }
+  tsr->bucket_link = bucket->overflow;
+  bucket->overflow = tsr_p;
+  return 1;
+}
+
+
+/* Empty [way] of [bucket], refilling it from the overflow chain. */
+static void ci_tcp_synrecv_bucket_clear(ci_netif* ni,
+                                        ci_tcp_synrecv_bucket* bucket,
+                                        int way)
+{
+  ci_tcp_state_synrecv* tsr;
 
-  level++;
-  aux = ci_ni_aux_p2aux(ni, bucket->bucket[idx]);
-  if( aux->type == CI_TCP_AUX_TYPE_BUCKET ) {
-    ci_tcp_listenq_bucket_insert(ni, tls, &aux->u.bucket, tsr, level);
+  --ni->synrecv_table->n_entries;
+  if( OO_P_IS_NULL(bucket->overflow) ) {
+    ci_tcp_synrecv_set_tag(bucket, way, 0);
     return;
   }
+  tsr = ci_ni_aux_p2synrecv(ni, bucket->overflow);
+  bucket->entry[way] = bucket->overflow;
+  bucket->overflow = tsr->bucket_link;
+  tsr->bucket_link = OO_P_NULL;
+  ci_tcp_synrecv_set_tag(bucket, way, onload_hash_tag(tsr->hash));
+}
 
-  /* So, this bucket contains of a list of other synrecv states.  We add
-   * our trs to this list and try to improve things by allocating
-   * next-level bucket. */
-  tsr->bucket_link = bucket->bucket[idx];
-  bucket->bucket[idx] = tsr_p;
 
-  if( level > CI_LISTENQ_BUCKET_MAX_DEPTH(ni) )
-    return;
+/* Divide bucket [split] between itself and its image in the next round,
+ * according to the next bit of each entry's hash.
+ */
+static void ci_tcp_synrecv_table_split(ci_netif* ni)
+{
+  ci_tcp_synrecv_table* tbl = ni->synrecv_table;
+  ci_uint32 high = tbl->mask + 1;
+  ci_uint32 split = tbl->split;
+  ci_tcp_synrecv_bucket* from;
+  ci_tcp_synrecv_bucket* to;
+  ci_tcp_state_synrecv* tsr;
+  ci_uint32 used;
+  oo_p tsr_p, next;
+  int w, way;
+#ifdef __KERNEL__
+  int i = 0;
 
-  nbucket = ci_ni_aux_alloc_bucket(ni);
-  if( OO_P_IS_NULL(nbucket) )
+  /* Both come from shared state, so check each before using it. */
+  if( split >= high || high > ci_tcp_synrecv_table_max(ni) / 2 ) {
+    ci_netif_error_detected(ni, CI_NETIF_ERROR_SYNRECV_TABLE,
+                            __FUNCTION__);
     return;
-  bucket->bucket[idx] = nbucket;
-  bucket = ci_ni_aux_p2bucket(ni, nbucket);
-  tls->n_buckets++;
+  }
+#endif
+
+  from = &tbl->bucket[split];
+  to = &tbl->bucket[split + high];
+  ci_assert_equal(to->tags[0] | to->tags[1] | to->tags[2], 0);
+  ci_assert(OO_P_IS_NULL(to->overflow));
+
+  for( w = 0; w < CI_TCP_SYNRECV_TAG_WORDS; ++w ) {
+    used = from->tags[w] & CI_SYNRECV_TAGS_USED;
+    while( used ) {
+      way = w * 4 + ci_tcp_synrecv_next_way(&used);
+      tsr = ci_ni_aux_p2synrecv(ni, from->entry[way]);
+      if( tsr->hash & high ) {
+        ci_tcp_synrecv_bucket_put(ni, to, tsr, from->entry[way]);
+        ci_tcp_synrecv_set_tag(from, way, 0);
+      }
+    }
+  }
 
+  /* Re-place the chained entries, now that there may be room for them. */
+  tsr_p = from->overflow;
+  from->overflow = OO_P_NULL;
   while( OO_P_NOT_NULL(tsr_p) ) {
-    tsr = &ci_ni_aux_p2aux(ni, tsr_p)->u.synrecv;
+    tsr = ci_ni_aux_p2synrecv(ni, tsr_p);
+    next = tsr->bucket_link;
+    tsr->bucket_link = OO_P_NULL;
+    ci_tcp_synrecv_bucket_put(ni, (tsr->hash & high) ? to : from, tsr, tsr_p);
+    tsr_p = next;
 #ifdef __KERNEL__
-    if( i++ > CI_LISTENQ_BUCKET_LIST_LIMIT(ni) ) {
-      ci_tcp_listenq_bucket_insert(ni, tls, bucket, tsr, level);
+    if( i++ > CI_SYNRECV_OVERFLOW_LIMIT(ni) ) {
       ci_netif_error_detected(ni, CI_NETIF_ERROR_SYNRECV_TABLE,
                               __FUNCTION__);
-      return;
+      break;
     }
 #endif
-    tsr_p = tsr->bucket_link;
-    tsr->bucket_link = OO_P_NULL;
-    ci_tcp_listenq_bucket_insert(ni, tls, bucket, tsr, level);
   }
+
+  if( ++split == high ) {
+    tbl->mask = high * 2 - 1;
+    split = 0;
+  }
+  tbl->split = split;
+  CITP_STATS_NETIF(++ni->state->stats.synrecv_table_splits);
 }
 
-/* Return 1 if the bucket is empty now */
-static int
-ci_tcp_listenq_bucket_remove(ci_netif* ni, ci_tcp_socket_listen* tls,
-                             ci_tcp_listen_bucket* bucket,
-                             ci_tcp_state_synrecv* tsr, int level)
+
+static void
+ci_tcp_synrecv_table_insert(ci_netif* ni, ci_tcp_state_synrecv* tsr)
 {
-  ci_ni_aux_mem* aux;
-  int idx = ci_tcp_listenq_hash2idx(tsr->hash, level);
-  oo_p tsr_p = ci_tcp_synrecv2p(ni, tsr);
+  ci_tcp_synrecv_table* tbl = ni->synrecv_table;
+  ci_tcp_synrecv_bucket* bucket;
+  unsigned n_buckets;
 
-  /* Fixme: we remove empty buckets only.  In theory, it may be useful to
-   * remove a bucket with one non-empty list, but it maked code more
-   * complicated. */
-  int empty = 0;
-#ifdef __KERNEL__
-  int i = 0;
+  LOG_TV(ci_log("%s([%d] "TSR_FMT")", __func__, NI_ID(ni), TSR_ARGS(tsr)));
+
+  bucket = ci_tcp_synrecv_bucket_get(ni, tsr->hash);
+  if( bucket == NULL )
+    return;
+  if( ci_tcp_synrecv_bucket_put(ni, bucket, tsr, ci_tcp_synrecv2p(ni, tsr)) )
+    CITP_STATS_NETIF(++ni->state->stats.synrecv_table_overflow);
+  ++tbl->n_entries;
+
+  /* Grow by one bucket whenever the table is more than half full. */
+  n_buckets = ci_tcp_synrecv_table_n_buckets(tbl);
+  if( tbl->n_entries * 2 > n_buckets * CI_TCP_SYNRECV_BUCKET_WAYS &&
+      n_buckets < ci_tcp_synrecv_table_max(ni) )
+    ci_tcp_synrecv_table_split(ni);
+}
 
-  if( level > CI_LISTENQ_BUCKET_MAX_DEPTH(ni) ) {
-    ci_netif_error_detected(ni, CI_NETIF_ERROR_SYNRECV_TABLE, __FUNCTION__);
-    return 0;
-  }
-#endif
 
-  LOG_TV(ci_log("%s([%d] level=%d "TSR_FMT")", __func__,
-                NI_ID(ni), level, TSR_ARGS(tsr)));
-  ci_assert( OO_P_NOT_NULL(bucket->bucket[idx]) );
+static void
+ci_tcp_synrecv_table_remove(ci_netif* ni, ci_tcp_state_synrecv* tsr)
+{
+  ci_tcp_synrecv_bucket* bucket;
+  oo_p tsr_p = ci_tcp_synrecv2p(ni, tsr);
+  oo_p* link;
+  ci_uint32 match;
+  int w, way;
 #ifdef __KERNEL__
-  if( OO_P_IS_NULL(bucket->bucket[idx]) ) {
-    ci_netif_error_detected(ni, CI_NETIF_ERROR_SYNRECV_TABLE,
-                            __FUNCTION__);
-    return 0;
-  }
+  int i = 0;
 #endif
 
-  level++;
-  aux = ci_ni_aux_p2aux(ni, bucket->bucket[idx]);
-  if( aux->type == CI_TCP_AUX_TYPE_BUCKET ) {
-    empty = ci_tcp_listenq_bucket_remove(ni, tls, &aux->u.bucket, tsr, level);
-    if( empty ) {
-      bucket->bucket[idx] = OO_P_NULL;
-      ci_ni_aux_free(ni, aux);
-      tls->n_buckets--;
+  LOG_TV(ci_log("%s([%d] "TSR_FMT")", __func__, NI_ID(ni), TSR_ARGS(tsr)));
+
+  bucket = ci_tcp_synrecv_bucket_get(ni, tsr->hash);
+  if( bucket == NULL )
+    return;
+
+  for( w = 0; w < CI_TCP_SYNRECV_TAG_WORDS; ++w ) {
+    match = onload_hash_tag_match(bucket->tags[w],
+                                  onload_hash_tag(tsr->hash));
+    while( match ) {
+      way = w * 4 + ci_tcp_synrecv_next_way(&match);
+      if( OO_P_EQ(bucket->entry[way], tsr_p) ) {
+        ci_tcp_synrecv_bucket_clear(ni, bucket, way);
+        return;
+      }
     }
   }
-  else {
-    if( bucket->bucket[idx] == tsr_p ) {
-      bucket->bucket[idx] = tsr->bucket_link;
-      empty = OO_P_IS_NULL(bucket->bucket[idx]);
+
+  for( link = &bucket->overflow; OO_P_NOT_NULL(*link);
+       link = &ci_ni_aux_p2synrecv(ni, *link)->bucket_link ) {
+    if( OO_P_EQ(*link, tsr_p) ) {
+      *link = tsr->bucket_link;
+      tsr->bucket_link = OO_P_NULL;
+      --ni->synrecv_table->n_entries;
+      return;
     }
-    else {
-      ci_tcp_state_synrecv* prev = &aux->u.synrecv;
-      while( prev->bucket_link != tsr_p ) {
-        aux = ci_ni_aux_p2aux(ni, prev->bucket_link);
-        prev = &aux->u.synrecv;
 #ifdef __KERNEL__
-        if( i++ > CI_LISTENQ_BUCKET_LIST_LIMIT(ni) ) {
-          ci_netif_error_detected(ni, CI_NETIF_ERROR_SYNRECV_TABLE,
-                                  __FUNCTION__);
-          return 0;
-        }
+    if( i++ > CI_SYNRECV_OVERFLOW_LIMIT(ni) )
+      break;
 #endif
-      }
-      prev->bucket_link = tsr->bucket_link;
-    }
   }
 
-  if( empty ) {
-    int i;
-    for( i = 0; i < CI_TCP_LISTEN_BUCKET_SIZE; i++ )
-      if( OO_P_NOT_NULL(bucket->bucket[i]) )
-        return 0;
-    return 1;
-  }
-  return 0;
+  ci_assert(0);
+#ifdef __KERNEL__
+  ci_netif_error_detected(ni, CI_NETIF_ERROR_SYNRECV_TABLE, __FUNCTION__);
+#endif
 }
 
+
 static ci_tcp_state_synrecv*
-ci_tcp_listenq_bucket_lookup(ci_netif* ni, ci_tcp_listen_bucket* bucket,
-                             ciip_tcp_rx_pkt* rxp,
-                             int level)
+ci_tcp_synrecv_table_lookup(ci_netif* ni, ci_tcp_socket_listen* tls,
+                            ciip_tcp_rx_pkt* rxp)
 {
-  ci_ni_aux_mem* aux;
-  int idx = ci_tcp_listenq_hash2idx(rxp->hash, level);
+  ci_tcp_synrecv_bucket* bucket;
   ci_tcp_state_synrecv* tsr;
-  unsigned saddr, daddr, sport;
+  unsigned saddr, daddr, sport, tag;
+  ci_uint32 match;
+  oo_p tsr_p;
+  int w, way;
 #ifdef __KERNEL__
   int i = 0;
-
-  if( level > CI_LISTENQ_BUCKET_MAX_DEPTH(ni) ) {
-    ci_netif_error_detected(ni, CI_NETIF_ERROR_SYNRECV_TABLE,
-                            __FUNCTION__);
-    return 0;
-  }
 #endif
 
-  LOG_TV(ci_log("%s([%d] level=%d hash:%x l:%s r:%s:%d)", __func__,
-                NI_ID(ni), level, rxp->hash,
+  LOG_TV(ci_log("%s([%d] hash:%x l:%s r:%s:%d)", __func__,
+                NI_ID(ni), rxp->hash,
                 ip_addr_str(oo_ip_hdr(rxp->pkt)->ip_daddr_be32),
                 ip_addr_str(oo_ip_hdr(rxp->pkt)->ip_saddr_be32),
                 CI_BSWAP_BE16(rxp->tcp->tcp_source_be16)));
-  if( OO_P_IS_NULL(bucket->bucket[idx]) )
-    return NULL;
 
-  level++;
-  aux = ci_ni_aux_p2aux(ni, bucket->bucket[idx]);
-  if( aux->type == CI_TCP_AUX_TYPE_BUCKET )
-    return ci_tcp_listenq_bucket_lookup(ni, &aux->u.bucket, rxp, level);
+  bucket = ci_tcp_synrecv_bucket_get(ni, rxp->hash);
+  if( bucket == NULL )
+    return NULL;
 
   saddr = oo_ip_hdr(rxp->pkt)->ip_saddr_be32;
   daddr = oo_ip_hdr(rxp->pkt)->ip_daddr_be32;
   sport = rxp->tcp->tcp_source_be16;
+  tag = onload_hash_tag(rxp->hash);
+
+  for( w = 0; w < CI_TCP_SYNRECV_TAG_WORDS; ++w ) {
+    match = onload_hash_tag_match(bucket->tags[w], tag);
+    while( match ) {
+      way = w * 4 + ci_tcp_synrecv_next_way(&match);
+      tsr = ci_ni_aux_p2synrecv(ni, bucket->entry[way]);
+      if( ! ((saddr - tsr->r_addr) | (daddr - tsr->l_addr) |
+             (sport - tsr->r_port)) && OO_SP_EQ(tsr->tls_id, S_SP(tls)) )
+        return tsr;
+    }
+  }
 
-  tsr = &aux->u.synrecv;
-  do {
+  for( tsr_p = bucket->overflow; OO_P_NOT_NULL(tsr_p);
+       tsr_p = tsr->bucket_link ) {
+    tsr = ci_ni_aux_p2synrecv(ni, tsr_p);
     if( ! ((saddr - tsr->r_addr) | (daddr - tsr->l_addr) |
-           (sport - tsr->r_port)) )
+           (sport - tsr->r_port)) && OO_SP_EQ(tsr->tls_id, S_SP(tls)) )
       return tsr;
-    if( OO_P_IS_NULL(tsr->bucket_link) )
-      return NULL;
-    aux = ci_ni_aux_p2aux(ni, tsr->bucket_link);
-    tsr = &aux->u.synrecv;
 #ifdef __KERNEL__
-    if( i++ > CI_LISTENQ_BUCKET_LIST_LIMIT(ni) ) {
+    if( i++ > CI_SYNRECV_OVERFLOW_LIMIT(ni) ) {
       ci_netif_error_detected(ni, CI_NETIF_ERROR_SYNRECV_TABLE,
                               __FUNCTION__);
       return NULL;
     }
 #endif
-  } while(1);
+  }
 
-  /* unreachable */
   return NULL;
 }
 
+
+#ifdef __ci_driver__
+void ci_tcp_synrecv_table_init(ci_tcp_synrecv_table* tbl,
+                               unsigned max_buckets)
+{
+  unsigned i;
+
+  ci_assert(CI_IS_POW2(max_buckets));
+  ci_assert_ge(max_buckets, CI_TCP_SYNRECV_TABLE_MIN_BUCKETS);
+
+  tbl->max_buckets = max_buckets;
+  tbl->mask = CI_TCP_SYNRECV_TABLE_MIN_BUCKETS - 1;
+  tbl->split = 0;
+  tbl->n_entries = 0;
+  for( i = 0; i < max_buckets; ++i ) {
+    memset(tbl->bucket[i].tags, 0, sizeof(tbl->bucket[i].tags));
+    tbl->bucket[i].overflow = OO_P_NULL;
+  }
+}
+#endif
+
 static void
 ci_tcp_listen_timer_set(ci_netif* ni, ci_tcp_socket_listen* tls,
                         ci_iptime_t timeout)
@@ -315,11 +391,81 @@ ci_tcp_listen_timer_set(ci_netif* ni, ci_tcp_socket_listen* tls,
 }
 
 
+static void ci_tcp_listenq_drop_one(ci_netif* ni, ci_tcp_state_synrecv* tsr)
+{
+  if( OO_SP_IS_NULL(tsr->local_peer) )
+    ci_ni_dllist_remove(ni, ci_tcp_synrecv2link(tsr));
+  /* RFC 793 tells us to send FIN and move to FIN-WAIT1 state.
+   * However, Linux (and probably everybody else) does not do it. */
+  ci_tcp_synrecv_free(ni, tsr);
+}
+
 int ci_tcp_listenq_drop_all(ci_netif* ni, ci_tcp_socket_listen* tls)
 {
-  return
-      ci_tcp_listenq_bucket_drop(ni,
-                                 ci_ni_aux_p2bucket(ni, tls->bucket));
+  ci_tcp_synrecv_table* tbl = ni->synrecv_table;
+  ci_tcp_synrecv_bucket* bucket;
+  ci_tcp_state_synrecv* tsr;
+  unsigned i, n_buckets;
+  oo_p* link;
+  int way, ret = 0;
+#ifdef __KERNEL__
+  int n;
+#endif
+
+  /* The table is shared by all the listening sockets in the stack, so it
+   * is searched for this one's entries, stopping once all n_listenq have
+   * been found. */
+  n_buckets = CI_MIN(ci_tcp_synrecv_table_n_buckets(tbl),
+                     ci_tcp_synrecv_table_max(ni));
+  for( i = 0; i < n_buckets && ret < tls->n_listenq; ++i ) {
+    bucket = &tbl->bucket[i];
+#ifdef __KERNEL__
+    n = 0;
+#endif
+    for( way = 0; way < CI_TCP_SYNRECV_BUCKET_WAYS; ) {
+      if( ((bucket->tags[way >> 2] >> ((way & 3) * 8)) & 0xff) == 0 ) {
+        ++way;
+        continue;
+      }
+      tsr = ci_ni_aux_p2synrecv(ni, bucket->entry[way]);
+      if( ! OO_SP_EQ(tsr->tls_id, S_SP(tls)) ) {
+        ++way;
+        continue;
+      }
+      /* This may refill [way] from the overflow chain, so look again. */
+      ci_tcp_synrecv_bucket_clear(ni, bucket, way);
+      ci_tcp_listenq_drop_one(ni, tsr);
+      ++ret;
+#ifdef __KERNEL__
+      if( n++ > CI_SYNRECV_OVERFLOW_LIMIT(ni) ) {
+        ci_netif_error_detected(ni, CI_NETIF_ERROR_SYNRECV_TABLE,
+                                __FUNCTION__);
+        return ret;
+      }
+#endif
+    }
+    for( link = &bucket->overflow; OO_P_NOT_NULL(*link); ) {
+#ifdef __KERNEL__
+      if( n++ > CI_SYNRECV_OVERFLOW_LIMIT(ni) ) {
+        ci_netif_error_detected(ni, CI_NETIF_ERROR_SYNRECV_TABLE,
+                                __FUNCTION__);
+        return ret;
+      }
+#endif
+      tsr = ci_ni_aux_p2synrecv(ni, *link);
+      if( OO_SP_EQ(tsr->tls_id, S_SP(tls)) ) {
+        *link = tsr->bucket_link;
+        --tbl->n_entries;
+        ci_tcp_listenq_drop_one(ni, tsr);
+        ++ret;
+      }
+      else {
+        link = &tsr->bucket_link;
+      }
+    }
+  }
+
+  return ret;
 }
 
 void ci_tcp_listenq_insert(ci_netif* ni, ci_tcp_socket_listen* tls,
@@ -329,9 +475,8 @@ void ci_tcp_listenq_insert(ci_netif* ni, ci_tcp_socket_listen* tls,
 
   tls->n_listenq++;
 
-  ci_tcp_listenq_bucket_insert(ni, tls,
-                               ci_ni_aux_p2bucket(ni, tls->bucket),
-                               tsr, 0);
+  tsr->tls_id = S_SP(tls);
+  ci_tcp_synrecv_table_insert(ni, tsr);
 
   if( OO_SP_NOT_NULL(tsr->local_peer) )
     return;
@@ -354,9 +499,7 @@ void ci_tcp_listenq_remove(ci_netif* ni, ci_tcp_socket_listen* tls,
   ci_assert(tsr);
   ci_assert(tls);
 
-  ci_tcp_listenq_bucket_remove(ni, tls,
-                               ci_ni_aux_p2bucket(ni, tls->bucket),
-                               tsr, 0);
+  ci_tcp_synrecv_table_remove(ni, tsr);
   if( OO_SP_IS_NULL(tsr->local_peer) ) {
     ci_ni_dllist_remove(ni, ci_tcp_synrecv2link(tsr));
 
@@ -393,9 +536,7 @@ ci_tcp_listenq_lookup(ci_netif* netif, ci_tcp_socket_listen* tls,
 {
   ci_tcp_state_synrecv* tsr;
 
-  tsr = ci_tcp_listenq_bucket_lookup(
-                        netif, ci_ni_aux_p2bucket(netif, tls->bucket),
-                        rxp, 0);
+  tsr = ci_tcp_synrecv_table_lookup(netif, tls, rxp);
   if( tsr == NULL ) {
     LOG_TV(log(LPF "no match for %s:%d->%s:%d",
                ip_addr_str(oo_ip_hdr(rxp->pkt)->ip_saddr_be32),
@@ -425,6 +566,84 @@ void ci_tcp_listenq_drop_oldest(ci_netif* ni, ci_tcp_socket_listen* tls)
 }
 
 
+/* Top up the stack's reserve of endpoints for promoted connections to
+ * EF_TCP_ACCEPT_PREALLOC.  This may have to grow the stack, so it is called
+ * from listen() and accept() rather than when connections are promoted.
+ */
+void ci_tcp_accept_prealloc_fill(ci_netif* ni)
+{
+  ci_netif_state* nis = ni->state;
+  citp_waitable_obj* wo;
+
+  ci_assert(ci_netif_is_locked(ni));
+
+  while( nis->n_accept_prealloc < NI_OPTS(ni).tcp_accept_prealloc ) {
+    /* Do not reap TIME_WAIT connections just to fill the reserve, as
+     * citp_waitable_obj_alloc() would when it finds no free endpoints.
+     */
+    if( OO_SP_IS_NULL(nis->free_eps_head) &&
+        nis->deferred_free_eps_head == CI_ILL_END ) {
+      if( nis->n_ep_bufs >= nis->max_ep_bufs )
+        break;
+      ci_tcp_helper_more_socks(ni);
+      if( OO_SP_IS_NULL(nis->free_eps_head) )
+        break;
+    }
+    wo = citp_waitable_obj_alloc(ni);
+    if( wo == NULL )
+      break;
+    wo->waitable.wt_next = nis->accept_prealloc_head;
+    nis->accept_prealloc_head = W_SP(&wo->waitable);
+    ++nis->n_accept_prealloc;
+  }
+}
+
+
+/* Return the reserve to the free list.  Called when the stack's last
+ * listening socket goes away; the reserve is refilled by the next listen().
+ */
+void ci_tcp_accept_prealloc_release(ci_netif* ni)
+{
+  ci_netif_state* nis = ni->state;
+  citp_waitable* w;
+
+  ci_assert(ci_netif_is_locked(ni));
+
+  while( OO_SP_NOT_NULL(nis->accept_prealloc_head) ) {
+    w = SP_TO_WAITABLE(ni, nis->accept_prealloc_head);
+    ci_assert_equal(w->state, CI_TCP_STATE_FREE);
+    nis->accept_prealloc_head = w->wt_next;
+    w->wt_next = nis->free_eps_head;
+    nis->free_eps_head = W_SP(w);
+    --nis->n_accept_prealloc;
+  }
+  ci_assert_equal(nis->n_accept_prealloc, 0);
+}
+
+
+static ci_tcp_state* ci_tcp_accept_prealloc_get(ci_netif* ni)
+{
+  ci_netif_state* nis = ni->state;
+  citp_waitable_obj* wo;
+
+  if( OO_SP_IS_NULL(nis->accept_prealloc_head) ) {
+    if( NI_OPTS(ni).tcp_accept_prealloc != 0 )
+      CITP_STATS_NETIF(++nis->stats.accept_prealloc_empty);
+    return NULL;
+  }
+
+  wo = SP_TO_WAITABLE_OBJ(ni, nis->accept_prealloc_head);
+  ci_assert_equal(wo->waitable.state, CI_TCP_STATE_FREE);
+  nis->accept_prealloc_head = wo->waitable.wt_next;
+  CI_DEBUG(wo->waitable.wt_next = OO_SP_NULL);
+  --nis->n_accept_prealloc;
+  CITP_STATS_NETIF(++nis->stats.accept_prealloc_used);
+
+  ci_tcp_state_init(ni, &wo->tcp, 0);
+  return &wo->tcp;
+}
+
+
 ci_inline ci_tcp_state*
 get_ts_from_cache(ci_netif *netif, 
                   ci_tcp_state_synrecv* tsr, 
@@ -541,6 +760,8 @@ static void ci_tcp_inherit_options(ci_netif* ni, ci_sock_cmn* s,
   ts->c.t_ka_intvl         = c->t_ka_intvl;
   ts->c.t_ka_intvl_in_secs = c->t_ka_intvl_in_secs;
   ts->c.ka_probe_th        = c->ka_probe_th;
+  /* TCP_CONGESTION */
+  ts->c.cc_algo            = c->cc_algo;
   ci_ip_hdr_init_fixed(&ts->s.pkt.ip, IPPROTO_TCP,
                         s->pkt.ip.ip_ttl,
                         s->pkt.ip.ip_tos);
@@ -637,8 +858,10 @@ int ci_tcp_listenq_try_promote(ci_netif* netif, ci_tcp_socket_listen* tls,
      * from the cache of EPs if any are available
      */
     ts = get_ts_from_cache (netif, tsr, tls); 
+    if( !ts )
+      ts = ci_tcp_accept_prealloc_get(netif);
     if( !ts ) {
-      /* None on cache; try allocating a new ts */
+      /* None on cache or in reserve; try allocating a new ts */
       ts = ci_tcp_get_state_buf(netif);
 #if CI_CFG_FD_CACHING
       if( ts == NULL ) {
@@ -802,7 +1025,6 @@ int ci_tcp_listenq_try_promote(ci_netif* netif, ci_tcp_socket_listen* tls,
     ts->timed_ts = tsr->timest;
     /* SACK has nothing to be done. */
 
-    /* ?? ECN */
     ci_tcp_set_hdr_len(ts, (ts->outgoing_hdrs_len - sizeof(ci_ip4_hdr)));
 
     ts->smss = tsr->tcpopts.smss;
@@ -824,6 +1046,13 @@ int ci_tcp_listenq_try_promote(ci_netif* netif, ci_tcp_socket_listen* tls,
      */
     ci_tcp_inherit_accept_options(netif, tls, ts, "SYN RECV (LISTENQ PROMOTE)");
 
+    /* Congestion control is inherited from the listener, and ECN was
+     * agreed in the handshake iff it asked for it.  The IP header template
+     * has just been reset from the listener, so set ECT after that. */
+    ci_tcp_cc_init(netif, ts);
+    if( ts->tcpflags & CI_TCPT_FLAG_ECN )
+      ci_tcp_ecn_enable(ts);
+
     /* NB. Must have already set peer (which we have). */
     ci_tcp_set_established_state(netif, ts);
     CITP_STATS_NETIF(++netif->state->stats.synrecv2established);
@@ -646,7 +646,7 @@ void ci_tcp_timeout_rto(ci_netif* netif, ci_tcp_state* ts)
       ts->ssthresh = CI_MAX(x, y);
     }
     else
-      ts->ssthresh = ci_tcp_losswnd(ts);
+      ts->ssthresh = ci_tcp_cc_ssthresh(netif, ts, 1);
 
     ts->congstate = CI_TCP_CONG_RTO;
     ts->cwnd_extra = 0;
@@ -196,16 +196,57 @@ static void ci_ip_tcp_list_to_dmaq_striping(ci_netif* ni, ci_tcp_state* ts,
 }
 #endif
 
+/* Returns the peer of [ts] if data sent now may be placed directly on the
+ * peer's receive queue (see EF_TCP_LOOPBACK_DIRECT), else NULL.  Anything
+ * still on the loopback queue might be for the peer, and must be
+ * delivered first.
+ */
+static ci_tcp_state* ci_tcp_loopback_direct_peer(ci_netif* ni,
+                                                 ci_tcp_state* ts)
+{
+  ci_tcp_state* peer;
+
+  if( ! NI_OPTS(ni).tcp_loopback_direct ||
+      OO_SP_IS_NULL(ts->local_peer) ||
+      OO_PP_NOT_NULL(ni->state->looppkts) ||
+      ts->s.b.state != CI_TCP_ESTABLISHED )
+    return NULL;
+  if( ID_TO_WAITABLE(ni, ts->local_peer)->state != CI_TCP_ESTABLISHED )
+    return NULL;
+  peer = ID_TO_TCP(ni, ts->local_peer);
+  if( ! OO_SP_EQ(peer->local_peer, S_SP(ts)) ||
+      ci_ip_queue_not_empty(&peer->rob) )
+    return NULL;
+  return peer;
+}
+
+
+/* Can [pkt] be placed directly on the receive queue of [peer]? */
+ci_inline int ci_tcp_loopback_direct_ok(ci_tcp_state* peer,
+                                        ci_ip_pkt_fmt* pkt)
+{
+  ci_tcp_hdr* tcp = TX_PKT_TCP(pkt);
+  return (tcp->tcp_flags & ~(CI_TCP_FLAG_ACK | CI_TCP_FLAG_PSH)) == 0 &&
+         SEQ_EQ(pkt->pf.tcp_tx.start_seq, tcp_rcv_nxt(peer)) &&
+         SEQ_LT(pkt->pf.tcp_tx.start_seq, pkt->pf.tcp_tx.end_seq) &&
+         SEQ_LE(pkt->pf.tcp_tx.end_seq, tcp_rcv_wnd_right_edge_sent(peer));
+}
+
+
 static void ci_ip_send_tcp_list_loopback(ci_netif* ni, ci_tcp_state* ts,
                                          oo_pkt_p head_id,
                                          ci_ip_pkt_fmt* tail_pkt)
 {
   ci_ip_pkt_fmt* pkt;
   oo_pkt_p pp;
+  ci_tcp_state* peer;
+  ci_tcp_state* acked_by = NULL;
   
   ci_assert(ci_netif_is_locked(ni));
   ci_assert(ts->s.pkt.flags & CI_IP_CACHE_IS_LOCALROUTE);
 
+  peer = ci_tcp_loopback_direct_peer(ni, ts);
+
   pp = head_id;
   do {
     pkt = PKT_CHK(ni, pp);
@@ -216,6 +257,18 @@ static void ci_ip_send_tcp_list_loopback(ci_netif* ni, ci_tcp_state* ts,
       ci_netif_pkt_release(ni, pkt);
       continue;
     }
+    if( peer != NULL ) {
+      if( ci_tcp_loopback_direct_ok(peer, pkt) ) {
+        ci_tcp_rx_loopback_direct(ni, peer, pkt);
+        acked_by = peer;
+        continue;
+      }
+      /* This and all later segments must go in order via the loopback
+       * queue. */
+      peer = NULL;
+    }
+    if( NI_OPTS(ni).tcp_loopback_direct )
+      CITP_STATS_NETIF_INC(ni, tcp_loopback_direct_fallback);
     pkt->next = ni->state->looppkts;
     ni->state->looppkts = OO_PKT_ID(pkt);
     ni->state->n_looppkts++;
@@ -232,7 +285,12 @@ static void ci_ip_send_tcp_list_loopback(ci_netif* ni, ci_tcp_state* ts,
      * Loopback in-packet ACK value is ignored - deliver it now! */
     if( SEQ_LE(ts->ack_trigger, ts->rcv_delivered) )
       ci_tcp_send_ack_loopback(ni, ts);
-    if( !ni->state->in_poll )
+    /* The peer has taken the segments placed directly: ACK them. */
+    if( acked_by != NULL ) {
+      ci_tcp_delack_clear(ni, acked_by);
+      ci_tcp_send_ack_loopback(ni, acked_by);
+    }
+    if( !ni->state->in_poll && OO_PP_NOT_NULL(ni->state->looppkts) )
       ci_netif_poll(ni);
   }
 }
@@ -812,6 +870,10 @@ int ci_tcp_synrecv_send(ci_netif* netif, ci_tcp_socket_listen* tls,
   thdr->tcp_seq_be32    = CI_BSWAP_BE32(seq);
   thdr->tcp_ack_be32    = CI_BSWAP_BE32(tsr->rcv_nxt);
   thdr->tcp_flags       = tcp_flags;
+  /* ECN-setup SYN-ACK (RFC3168 section 6.1.1) */
+  if( (tcp_flags & CI_TCP_FLAG_SYN) &&
+      (tsr->tcpopts.flags & CI_TCPT_FLAG_ECN) )
+    thdr->tcp_flags |= CI_TCP_FLAG_ECE;
 
   /* options */
   opt = CI_TCP_HDR_OPTS(thdr);
@@ -1323,6 +1385,8 @@ void ci_tcp_tx_advance_to(ci_netif* ni, ci_tcp_state* ts,
 {
   ci_ip_pkt_queue* sendq = &ts->send;
   ci_ip_pkt_fmt* last_pkt = NULL;
+  ci_ip_pkt_fmt* tmpl = NULL;
+  ci_uint32 ack_be32 = CI_BSWAP_BE32(tcp_rcv_nxt(ts));
   oo_pkt_p id = sendq->head;
   int sent_num = 0;
 
@@ -1371,17 +1435,23 @@ void ci_tcp_tx_advance_to(ci_netif* ni, ci_tcp_state* ts,
     }
 #endif
 
-    /* Update window (with silly window avoidance).  FIXME: No need to do
-     * this each time around the loop.
+    /* Apart from the sequence number, IP length and ID, the headers are
+     * the same for every data segment in this burst.  So update the window
+     * (with silly window avoidance) and place the TCP options into the
+     * first one, and copy them to the rest.
      *
-     * We don't want to do this when sending a syn, as we don't scale that
-     * window so must calculate it differently.
+     * We don't want to update the window when sending a syn, as we don't
+     * scale that window so must calculate it differently.
      */
-    if( CI_LIKELY(!(tcp->tcp_flags & CI_TCP_FLAG_SYN)) )
+    if(CI_UNLIKELY( tcp->tcp_flags & CI_TCP_FLAG_SYN ))
+      ci_tcp_tx_finish(ni, ts, pkt);
+    else if( tmpl == NULL ) {
       ci_tcp_calc_rcv_wnd(ts, "tx_advance");
-
-    /* place TCP options into outgoing packet */
-    ci_tcp_tx_finish(ni, ts, pkt);
+      ci_tcp_tx_finish(ni, ts, pkt);
+      tmpl = pkt;
+    }
+    else
+      ci_tcp_tx_finish_burst(ni, ts, pkt, tmpl);
 
     /* Finish-off the IP header.  We increment the ID field for payload
      * segments because some old versions of Linux GRO require incrementing
@@ -1395,7 +1465,7 @@ void ci_tcp_tx_advance_to(ci_netif* ni, ci_tcp_state* ts,
     ci_tcp_tx_set_urg_ptr(ts, ni, tcp);
 
     /* Finish-off the TCP header (using latest ack and window). */
-    tcp->tcp_ack_be32 = CI_BSWAP_BE32(tcp_rcv_nxt(ts));
+    tcp->tcp_ack_be32 = ack_be32;
     tcp->tcp_window_be16 = TS_TCP(ts)->tcp_window_be16;
     ci_tcp_tx_maybe_do_striping(pkt, ts);
 
@@ -1922,6 +1992,8 @@ void ci_tcp_send_ack_rx(ci_netif* netif, ci_tcp_state* ts, ci_ip_pkt_fmt* pkt,
   }
 
   tcp->tcp_flags = CI_TCP_FLAG_ACK;
+  if( ts->tcpflags & CI_TCPT_FLAG_ECN_ECE )
+    tcp->tcp_flags |= CI_TCP_FLAG_ECE;
   /* SACK option may change pre-computed header length. */
   CI_TCP_HDR_SET_LEN(tcp, sizeof(ci_tcp_hdr) + optlen);
 
@@ -34,7 +34,7 @@ ci_inline int ci_tcp_tx_opt_tso(ci_uint8** opt,
 /* finish off a transmitted data segment by:
 **   - snarfing a timestamp for RTT measurement
 **   - timestamps
-** could be a place to deal with ECN.
+**   - ECN echo and congestion window reduced flags
 ** We could not deal with outgoing SACK here, because it will change packet
 ** length.
 */
@@ -74,10 +74,47 @@ ci_inline void ci_tcp_tx_finish(ci_netif* netif, ci_tcp_state* ts,
     }
   }
 
+  /* ECE/CWR may have been set on an earlier transmission of this segment,
+   * so always recompute them. */
+  if( CI_UNLIKELY(ts->tcpflags & CI_TCPT_FLAG_ECN) &&
+      ! (tcp->tcp_flags & CI_TCP_FLAG_SYN) ) {
+    tcp->tcp_flags &= ~(CI_TCP_FLAG_ECE | CI_TCP_FLAG_CWR);
+    if( ts->tcpflags & CI_TCPT_FLAG_ECN_ECE )
+      tcp->tcp_flags |= CI_TCP_FLAG_ECE;
+    if( ts->tcpflags & CI_TCPT_FLAG_ECN_CWR ) {
+      tcp->tcp_flags |= CI_TCP_FLAG_CWR;
+      ts->tcpflags &= ~CI_TCPT_FLAG_ECN_CWR;
+    }
+  }
+
   tcp->tcp_seq_be32 = CI_BSWAP_BE32(seq);
 }
 
 
+/* Finish off a data segment that is being sent in the same burst as
+** [tmpl], which has been finished by ci_tcp_tx_finish().  Nothing the
+** options depend on changes during a burst, and RTT timing and faststart
+** only act on the first segment, so the options can be copied.  ECN flags
+** must be worked out for each segment.
+*/
+ci_inline void ci_tcp_tx_finish_burst(ci_netif* netif, ci_tcp_state* ts,
+                                      ci_ip_pkt_fmt* pkt,
+                                      ci_ip_pkt_fmt* tmpl)
+{
+  ci_tcp_hdr* tcp = TX_PKT_TCP(pkt);
+
+  if(CI_UNLIKELY( (ts->tcpflags & (CI_TCPT_FLAG_TSO | CI_TCPT_FLAG_ECN)) !=
+                  CI_TCPT_FLAG_TSO )) {
+    ci_tcp_tx_finish(netif, ts, pkt);
+    return;
+  }
+  ci_assert_equal(CI_TCP_HDR_OPT_LEN(tcp),
+                  CI_TCP_HDR_OPT_LEN(TX_PKT_TCP(tmpl)));
+  memcpy(CI_TCP_HDR_OPTS(tcp), CI_TCP_HDR_OPTS(TX_PKT_TCP(tmpl)), 12);
+  tcp->tcp_seq_be32 = CI_BSWAP_BE32(pkt->pf.tcp_tx.start_seq);
+}
+
+
 ci_inline void ci_tcp_ip_hdr_init(ci_ip4_hdr* ip, unsigned len)
 {
   ci_assert_equal(CI_IP4_IHL(ip), sizeof(ci_ip4_hdr));
@@ -109,7 +146,8 @@ ci_inline void __ci_tcp_calc_rcv_wnd(ci_tcp_state* ts, int advance)
    * we have pending rob data. Small advances of window will undermine
    * duplicate ACKs (turning them into plain window updates).
    */
-  delta = (tcp_rcv_usr(ts) || OO_PP_NOT_NULL(ts->rob.head)) ? ts->amss : 0;
+  delta = (tcp_rcv_usr(ts) || ts->rcv_lent || OO_PP_NOT_NULL(ts->rob.head)) ?
+          ts->amss : 0;
 
   if( advance &&
       CI_LIKELY( SEQ_GE(new_rhs, ts->rcv_wnd_right_edge_sent + delta) ) ) {
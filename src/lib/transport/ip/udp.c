@@ -97,6 +97,7 @@ static void ci_udp_state_init(ci_netif* netif, ci_udp_state* us)
   us->tx_async_q = CI_ILL_END;
   oo_atomic_set(&us->tx_async_q_level, 0);
   us->tx_count = 0;
+  us->tmpl_head = OO_PP_NULL;
   us->udpflags = CI_UDPF_MCAST_LOOP;
   us->ip_pktinfo_cache.intf_i = -1;
   us->stamp = 0;
@@ -308,12 +309,13 @@ void ci_udp_state_dump(ci_netif* ni, ci_udp_state* us, const char* pf,
          n_tx_onload, uss.n_tx_os, percent(uss.n_tx_os, tx_total));
   logger(log_arg,
          "%s  snd: LOCK cp=%u(%u%%) pkt=%u(%u%%) snd=%u(%u%%) poll=%u(%u%%) "
-         "defer=%u(%u%%)", pf,
+         "defer=%u(%u%%) staged=%u(%u%%)", pf,
          uss.n_tx_lock_cp,  percent(uss.n_tx_lock_cp,  n_tx_onload),
          uss.n_tx_lock_pkt,  percent(uss.n_tx_lock_pkt,  n_tx_onload),
          uss.n_tx_lock_snd,  percent(uss.n_tx_lock_snd,  n_tx_onload),
          uss.n_tx_lock_poll, percent(uss.n_tx_lock_poll, n_tx_onload),
-         uss.n_tx_lock_defer, percent(uss.n_tx_lock_defer, n_tx_onload));
+         uss.n_tx_lock_defer, percent(uss.n_tx_lock_defer, n_tx_onload),
+         uss.n_tx_lock_staged, percent(uss.n_tx_lock_staged, n_tx_onload));
 
   logger(log_arg, "%s  snd: MCAST if=%d src="OOF_IP4" ttl=%d", pf,
          us->s.cp.ip_multicast_if,
@@ -353,6 +355,9 @@ void ci_udp_state_dump(ci_netif* ni, ci_udp_state* us, const char* pf,
          "%s  snd: os_slow=%d os_late=%d unconnect_late=%d nomac=%u(%u%%)", pf,
          uss.n_tx_os_slow, uss.n_tx_os_late, uss.n_tx_unconnect_late,
          uss.n_tx_cp_no_mac, percent(uss.n_tx_cp_no_mac, tx_total));
+  if( uss.n_tx_tmpl_fast | uss.n_tx_tmpl_slow | uss.n_tx_tmpl_active )
+    logger(log_arg, "%s  snd: tmpl: send_fast=%u send_slow=%u active=%u", pf,
+           uss.n_tx_tmpl_fast, uss.n_tx_tmpl_slow, uss.n_tx_tmpl_active);
 }
 
 /*! \cidoxg_end */
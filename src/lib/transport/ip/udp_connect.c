@@ -29,6 +29,7 @@
 
 #include "ip_internal.h"
 #include <onload/common.h>
+#include <onload/tmpl.h>
 
 #ifdef ONLOAD_OFE
 #include "ofe/onload.h"
@@ -785,6 +786,11 @@ void ci_udp_all_fds_gone(ci_netif* netif, oo_sp sock_id, int do_free)
     us->zc_kernel_datagram_count = 0;
   }
 
+#if CI_CFG_PIO
+  /* Free up any associated templated sends */
+  ci_udp_tmpl_free_all(netif, us);
+#endif
+
   /* Only free state if no outstanding tx packets: otherwise it'll get
    * freed by the tx completion event.
    */
@@ -42,6 +42,10 @@ void ci_udp_state_free(ci_netif* ni, ci_udp_state* us)
   ci_udp_recv_q_drop(ni, &us->timestamp_q);
 #endif
 
+  /* Datagrams on the TX staging rings refer to the socket. */
+  if( oo_atomic_read(&us->tx_async_q_level) != 0 )
+    ci_udp_tx_stage_drain(ni);
+
   citp_waitable_obj_free(ni, &us->s.b);
 }
 
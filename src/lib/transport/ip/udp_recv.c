@@ -392,6 +392,9 @@ static int ci_udp_recvmsg_get(ci_udp_recv_info* rinf, ci_iovec_ptr* piov)
 # endif
 #endif
 
+#if CI_CFG_LAT_HIST
+      ci_netif_lat_hist_rx(ni, S_SP(us), pkt);
+#endif
       ci_udp_recv_q_deliver(ni, &us->recv_q, pkt);
     }
     us->udpflags |= CI_UDPF_LAST_RECV_ON;
@@ -649,6 +652,9 @@ struct recvmsg_spinstate {
   ci_uint64 max_spin;
   int do_spin;
   int spin_limit_by_so;
+#if CI_CFG_SPIN_ADAPT
+  struct oo_spin_adapt* adapt;  /* non-NULL to learn from this wait */
+#endif
   ci_uint32 timeout;
   uint32_t poison;
   const volatile uint32_t* future;
@@ -855,8 +861,15 @@ ci_udp_recvmsg_common(ci_udp_recv_info *rinf)
 
  check_ul_recv_q:
   rc = ci_udp_recvmsg_get(rinf, &piov);
-  if( rc >= 0 )
+  if( rc >= 0 ) {
+#if CI_CFG_SPIN_ADAPT
+    if( spin_state.adapt != NULL )
+      oo_spin_adapt_wait_done(ni, spin_state.adapt,
+                              ci_frc64_get() - spin_state.start_frc,
+                              us->s.b.spin_cycles);
+#endif
     goto out;
+  }
 
   /* User-level receive queue is empty. */
 
@@ -917,7 +930,12 @@ ci_udp_recvmsg_common(ci_udp_recv_info *rinf)
       spin_state.poison = CI_PKT_RX_POISON;
       spin_state.future = NULL;
       spin_state.schedule_frc = spin_state.start_frc;
-      spin_state.max_spin = us->s.b.spin_cycles;
+#if CI_CFG_SPIN_ADAPT
+      spin_state.adapt = oo_spin_adapt_sock(ni, &us->s.b);
+#endif
+      spin_state.max_spin =
+        oo_spin_adapt_budget(oo_spin_adapt_sock(ni, &us->s.b),
+                             us->s.b.spin_cycles);
       if( us->s.so.rcvtimeo_msec ) {
         ci_uint64 max_so_spin = (ci_uint64)us->s.so.rcvtimeo_msec *
             IPTIMER_STATE(ni)->khz;
@@ -1300,6 +1318,9 @@ int ci_udp_zc_recv(ci_udp_iomsg_args* a, struct onload_zc_recv_args* args)
 
       us->stamp = pkt->tstamp_frc;
       us->udpflags |= CI_UDPF_LAST_RECV_ON;
+#if CI_CFG_LAT_HIST
+      ci_netif_lat_hist_rx(ni, S_SP(us), pkt);
+#endif
     
       cb_flags = CI_IP_IS_MULTICAST(oo_ip_hdr(pkt)->ip_daddr_be32) ? 
         ONLOAD_ZC_MSG_SHARED : 0;
@@ -1439,7 +1460,9 @@ int ci_udp_zc_recv(ci_udp_iomsg_args* a, struct onload_zc_recv_args* args)
   
     if( spin_state.do_spin ) {
       spin_state.si = citp_signal_get_specific_inited();
-      spin_state.max_spin = us->s.b.spin_cycles;
+      spin_state.max_spin =
+        oo_spin_adapt_budget(oo_spin_adapt_sock(ni, &us->s.b),
+                             us->s.b.spin_cycles);
       spin_state.poison = CI_PKT_RX_POISON;
       spin_state.future = NULL;
 
@@ -33,6 +33,12 @@
 #include <onload/osfile.h>
 #include <onload/pkt_filler.h>
 #include <onload/sleep.h>
+#include <onload/tmpl.h>
+#include <ci/internal/pio_buddy.h>
+
+#ifndef __KERNEL__
+#include <onload/extensions_zc.h>
+#endif
 
 #ifdef ONLOAD_OFE
 #include "ofe/onload.h"
@@ -900,6 +906,191 @@ static void ci_udp_sendmsg_async_q_enqueue(ci_netif* ni, ci_udp_state* us,
 }
 
 
+/* The kernel must not trust the ring size in shared state. */
+ci_inline unsigned ci_udp_tx_stage_mask(ci_netif* ni)
+{
+#ifdef __KERNEL__
+  return ni->udp_tx_stage_mask;
+#else
+  return ni->state->udp_tx_stage_mask;
+#endif
+}
+
+#define UDP_TX_STAGE_ENTRIES(ni, ring_i)                          \
+  ((ci_udp_tx_stage_entry*) ((ni)->udp_tx_stage + 1) +            \
+   (ring_i) * (ci_udp_tx_stage_mask(ni) + 1))
+
+
+static void ci_udp_tx_stage_drain_ring(ci_netif* ni, int ring_i)
+{
+  ci_udp_tx_stage_ring* r = &ni->udp_tx_stage->ring[ring_i];
+  ci_udp_tx_stage_entry* entries = UDP_TX_STAGE_ENTRIES(ni, ring_i);
+  unsigned mask = ci_udp_tx_stage_mask(ni);
+  ci_uint32 cons = r->cons;
+#ifdef __KERNEL__
+  /* [prod] is written by senders, so bound the walk by the ring size and
+   * leave anything more for the next drain. */
+  unsigned n = 0;
+#endif
+  ci_udp_tx_stage_entry* e;
+  ci_ip_pkt_fmt* pkt;
+  ci_udp_state* us;
+  oo_pkt_p pp;
+  ci_int32 pkt_id, sock_id;
+  int flags;
+
+  while( cons != r->prod ) {
+#ifdef __KERNEL__
+    if(CI_UNLIKELY( n++ > mask )) {
+      ci_atomic32_or(&ni->udp_tx_stage->pending, 1u << ring_i);
+      break;
+    }
+#endif
+    e = &entries[cons & mask];
+    /* A sender has claimed this slot but not yet filled it in.  It will
+     * prompt another drain once it has. */
+    if( (pkt_id = e->pkt_id) == OO_PP_ID_NULL )
+      break;
+    ci_rmb();
+    sock_id = e->sock_id;
+    e->pkt_id = OO_PP_ID_NULL;
+    ci_wmb();
+    r->cons = ++cons;
+
+    OO_PP_INIT(ni, pp, pkt_id);
+#ifdef __KERNEL__
+    if(CI_UNLIKELY( ! IS_VALID_PKT_ID(ni, pp) ||
+                    ! IS_VALID_SOCK_ID(ni, sock_id) ||
+                    SP_TO_WAITABLE(ni, OO_SP_FROM_INT(ni, sock_id))->state !=
+                      CI_TCP_STATE_UDP )) {
+      ci_netif_error_detected(ni, CI_NETIF_ERROR_UDP_SEND_PKTS_LIST,
+                              __FUNCTION__);
+      break;
+    }
+#endif
+    pkt = PKT_CHK(ni, pp);
+    us = SP_TO_UDP(ni, OO_SP_FROM_INT(ni, sock_id));
+    oo_atomic_add(&us->tx_async_q_level,
+                  -ci_udp_tx_datagram_level(ni, pkt, CI_TRUE));
+    if( pkt->flags & CI_PKT_FLAG_MSG_CONFIRM )
+      flags = MSG_CONFIRM;
+    else
+      flags = 0;
+    ++us->stats.n_tx_lock_staged;
+    CITP_STATS_NETIF_INC(ni, udp_tx_staged);
+    ci_udp_sendmsg_send(ni, us, pkt, flags, NULL);
+    ci_netif_pkt_release(ni, pkt);
+  }
+}
+
+
+void ci_udp_tx_stage_drain(ci_netif* ni)
+{
+  ci_uint32 pending;
+
+  ci_assert(ci_netif_is_locked(ni));
+
+  if( ni->udp_tx_stage == NULL ||
+      (pending = ci_xchg32(&ni->udp_tx_stage->pending, 0) &
+                 ((1u << CI_CFG_UDP_TX_STAGE_RINGS) - 1)) == 0 )
+    return;
+
+  CITP_STATS_NETIF_INC(ni, udp_tx_stage_drains);
+  do {
+    ci_udp_tx_stage_drain_ring(ni, ci_ffs64(pending) - 1);
+    pending &= pending - 1;
+  } while( pending );
+}
+
+
+#ifndef __KERNEL__
+static ci_uint32 ci_udp_tx_stage_ring_next;
+
+/* Threads are dealt out to rings round-robin on their first staged send,
+ * so with no more threads than rings each has a ring to itself.
+ */
+ci_inline int ci_udp_tx_stage_ring_id(void)
+{
+  struct oo_per_thread* pt = __oo_per_thread_get();
+  ci_uint32 id;
+
+  if(CI_UNLIKELY( pt->udp_tx_stage_ring == 0 )) {
+    do
+      id = ci_udp_tx_stage_ring_next;
+    while( ci_cas32u_fail(&ci_udp_tx_stage_ring_next, id, id + 1) );
+    pt->udp_tx_stage_ring = id % CI_CFG_UDP_TX_STAGE_RINGS + 1;
+  }
+  return pt->udp_tx_stage_ring - 1;
+}
+
+
+/* Queue a filled datagram on this thread's staging ring for the lock
+ * holder to send.  Returns -ENOBUFS if the ring is full.
+ */
+static int ci_udp_tx_stage_enqueue(ci_netif* ni, ci_udp_state* us,
+                                   ci_ip_pkt_fmt* pkt, int flags)
+{
+  ci_udp_tx_stage* st = ni->udp_tx_stage;
+  int ring_i = ci_udp_tx_stage_ring_id();
+  ci_udp_tx_stage_ring* r = &st->ring[ring_i];
+  unsigned mask = ni->state->udp_tx_stage_mask;
+  ci_udp_tx_stage_entry* e;
+  ci_uint32 prod;
+
+  do {
+    prod = r->prod;
+    if( prod - r->cons > mask )
+      return -ENOBUFS;
+  } while( ci_cas32u_fail(&r->prod, prod, prod + 1) );
+
+  if( flags & MSG_CONFIRM )
+    pkt->flags |= CI_PKT_FLAG_MSG_CONFIRM;
+  oo_atomic_add(&us->tx_async_q_level,
+                ci_udp_tx_datagram_level(ni, pkt, CI_FALSE));
+
+  e = &UDP_TX_STAGE_ENTRIES(ni, ring_i)[prod & mask];
+  e->sock_id = S_ID(us);
+  ci_wmb();
+  e->pkt_id = OO_PKT_ID(pkt);
+
+  /* The entry must be visible before we look at [pending] and the lock:
+   * either we see that the lock holder has yet to drain this ring, or it
+   * will see our entry.
+   */
+  ci_mb();
+  if( ! (st->pending & (1u << ring_i)) )
+    ci_atomic32_or(&st->pending, 1u << ring_i);
+  if( ef_eplock_lock_or_set_flag(&ni->state->lock,
+                                 CI_EPLOCK_NETIF_UDP_TX_STAGED) ) {
+    /* The lock holder went away, so send it ourselves. */
+    ci_udp_tx_stage_drain(ni);
+    ci_netif_unlock(ni);
+  }
+  return 0;
+}
+
+
+static void ci_udp_sendmsg_stage(ci_netif* ni, ci_udp_state* us,
+                                 ci_ip_pkt_fmt* pkt, int flags,
+                                 struct udp_send_info* sinf)
+{
+  if(CI_LIKELY( ci_udp_tx_stage_enqueue(ni, us, pkt, flags) == 0 ))
+    return;
+
+  /* Ring is full.  Wait for the lock rather than use [tx_async_q], which
+   * could overtake datagrams already on the ring.
+   */
+  ci_netif_lock(ni);
+  CITP_STATS_NETIF_INC(ni, udp_tx_stage_full);
+  ++us->stats.n_tx_lock_snd;
+  ci_udp_tx_stage_drain(ni);
+  ci_udp_sendmsg_send(ni, us, pkt, flags, sinf);
+  ci_netif_pkt_release(ni, pkt);
+  ci_netif_unlock(ni);
+}
+#endif
+
+
 #ifndef __KERNEL__
 /* Check if provided address struct/content is OK for us. */
 static int ci_udp_name_is_ok(ci_udp_state* us, const struct msghdr* msg)
@@ -1147,6 +1338,9 @@ int ci_udp_sendmsg_fill(ci_netif* ni, ci_udp_state* us,
   if( rc != 0 )
     return rc;
   oo_tx_pkt_layout_init(first_pkt);
+#if CI_CFG_LAT_HIST
+  ci_netif_lat_hist_tx_stamp(ni, first_pkt);
+#endif
 
   ip_id = NEXT_IP_ID(ni);
   ip_id = CI_BSWAP_BE16(ip_id);
@@ -1369,6 +1563,11 @@ void ci_udp_sendmsg_onload(ci_netif* ni, ci_udp_state* us,
       ci_netif_unlock(ni);
       sinf->stack_locked = 0;
     }
+#ifndef __KERNEL__
+    else if( ni->udp_tx_stage != NULL ) {
+      ci_udp_sendmsg_stage(ni, us, pf.pkt, flags, sinf);
+    }
+#endif
     else {
       ci_udp_sendmsg_async_q_enqueue(ni, us, pf.pkt, flags);
     }
@@ -1630,4 +1829,457 @@ int ci_udp_sendmsg(ci_udp_iomsg_args *a,
     RET_WITH_ERRNO(-rc);
 }
 
+#if CI_CFG_PIO
+
+/* A UDP template is a single unfragmented datagram built in one packet
+ * buffer, with the template handle stored at the end of the buffer.  The
+ * template holds the buffer's only reference and counts towards
+ * [n_async_pkts] until it is sent or freed.
+ */
+static int ci_udp_tmpl_offset(void)
+{
+  return CI_CFG_PKT_BUF_SIZE - sizeof(struct oo_msg_template);
+}
+
+
+static struct oo_msg_template* ci_udp_tmpl_pkt_to_omt(ci_ip_pkt_fmt* pkt)
+{
+  return (void*) ((char*) pkt + ci_udp_tmpl_offset());
+}
+
+
+static void ci_udp_tmpl_free_pio(ci_netif* ni, ci_ip_pkt_fmt* tmpl)
+{
+  if( tmpl->pio_addr >= 0 ) {
+    ci_pio_buddy_free(ni, &ni->state->nic[tmpl->intf_i].pio_buddy,
+                      tmpl->pio_addr, tmpl->pio_order);
+    tmpl->pio_addr = -1;
+  }
+}
+
+
+/* Remove this template from the socket's template list.
+ */
+static void ci_udp_tmpl_remove(ci_netif* ni, ci_udp_state* us,
+                               ci_ip_pkt_fmt* tmpl)
+{
+  struct oo_msg_template* omt = ci_udp_tmpl_pkt_to_omt(tmpl);
+  oo_pkt_p* pp;
+
+  for( pp = &us->tmpl_head; *pp != OO_PKT_P(tmpl); )
+    pp = &(PKT_CHK(ni, *pp)->next);
+  *pp = tmpl->next;
+  /* [next] links IP fragments once the datagram is handed to the send
+   * path. */
+  tmpl->next = OO_PP_NULL;
+  --us->stats.n_tx_tmpl_active;
+  omt->oomt_sock_id = OO_SP_NULL;
+}
+
+
+/* Free a template.  Must be called with the stack lock held.
+ */
+static void ci_udp_tmpl_free(ci_netif* ni, ci_udp_state* us,
+                             ci_ip_pkt_fmt* tmpl)
+{
+  ci_assert(ci_netif_is_locked(ni));
+
+  ci_udp_tmpl_free_pio(ni, tmpl);
+  ci_udp_tmpl_remove(ni, us, tmpl);
+  --ni->state->n_async_pkts;
+  ci_netif_pkt_release_1ref(ni, tmpl);
+}
+
+
+/* Frees all of the socket's templates.
+ *
+ * Must be called with the stack lock held.
+ */
+void ci_udp_tmpl_free_all(ci_netif* ni, ci_udp_state* us)
+{
+  ci_assert(ci_netif_is_locked(ni));
+  while( OO_PP_NOT_NULL(us->tmpl_head) )
+    ci_udp_tmpl_free(ni, us, PKT_CHK(ni, us->tmpl_head));
+}
+
+
+#ifndef __KERNEL__
+
+static ci_ip_pkt_fmt* ci_udp_tmpl_omt_to_pkt(struct oo_msg_template* omt)
+{
+  return (void*) ((char*) omt - ci_udp_tmpl_offset());
+}
+
+
+ci_inline char* ci_udp_tmpl_payload(ci_ip_pkt_fmt* pkt)
+{
+  return (char*) (TX_PKT_UDP(pkt) + 1);
+}
+
+
+ci_inline int ci_udp_tmpl_payload_len(ci_ip_pkt_fmt* pkt)
+{
+  return CI_BSWAP_BE16(TX_PKT_UDP(pkt)->udp_len_be16) - sizeof(ci_udp_hdr);
+}
+
+
+/* Send a template through the normal connected send path.  Used when the
+ * datagram cannot go straight out through its PIO region, for example
+ * because it has none or the TXQ is busy.  Ownership of the buffer passes
+ * to the send path.  Returns 0 or -errno.
+ */
+static int ci_udp_tmpl_normal_send(ci_netif* ni, ci_udp_state* us,
+                                   ci_ip_pkt_fmt* pkt)
+{
+  struct udp_send_info sinf;
+
+  ci_assert(ci_netif_is_locked(ni));
+
+  ci_udp_tmpl_free_pio(ni, pkt);
+  ci_udp_tmpl_remove(ni, us, pkt);
+
+  /* A zero destination is how ci_udp_sendmsg_send() recognises a
+   * connected send.
+   */
+  oo_tx_ip_hdr(pkt)->ip_daddr_be32 = 0;
+  oo_tx_ip_hdr(pkt)->ip_id_be16 = CI_BSWAP_BE16(NEXT_IP_ID(ni));
+
+  sinf.rc = 0;
+  sinf.used_ipcache = 0;
+  sinf.stack_locked = 1;
+  ++us->stats.n_tx_tmpl_slow;
+
+  /* This refcount is used later by ci_netif_send() */
+  ci_netif_pkt_hold(ni, pkt);
+  ci_udp_sendmsg_send(ni, us, pkt, 0, &sinf);
+  ci_netif_pkt_release(ni, pkt);
+  return sinf.rc;
+}
+
+
+int ci_udp_tmpl_alloc(ci_netif* ni, ci_udp_state* us,
+                      struct oo_msg_template** omt_pp,
+                      const struct iovec* initial_msg, int mlen, unsigned flags)
+{
+  ci_ip_cached_hdrs* ipcache = &us->s.pkt;
+  ci_netif_state_nic_t* nsn;
+  struct oo_msg_template* omt;
+  ci_ip_pkt_fmt* pkt;
+  ci_ip4_hdr* ip;
+  size_t total_len = 0;
+  int i, max_payload, rc = 0;
+  char* payload;
+
+#if defined(__powerpc64__)
+  LOG_U(ci_log("%s: This API is not supported on PowerPC yet.", __FUNCTION__));
+  return -ENOSYS;
+#endif
+
+  if(CI_UNLIKELY( flags & ~ONLOAD_TEMPLATE_FLAGS_PIO_RETRY )) {
+    LOG_E(ci_log("%s: called with unsupported flags=%x", __FUNCTION__, flags));
+    return -EINVAL;
+  }
+
+  ci_netif_lock(ni);
+
+  /* A template carries its destination in its headers, so only connected
+   * sockets are handled.
+   */
+  if(CI_UNLIKELY( udp_raddr_be32(us) == 0 || udp_lport_be16(us) == 0 )) {
+    LOG_U(ci_log("%s: "NT_FMT"not connected", __FUNCTION__,
+                 NT_PRI_ARGS(ni, us)));
+    rc = -ENOTCONN;
+    goto out;
+  }
+
+  if(CI_UNLIKELY( ! oo_cp_verinfo_is_valid(ni->cplane,
+                                           &ipcache->mac_integrity) )) {
+    ++us->stats.n_tx_cp_c_lookup;
+    cicp_user_retrieve(ni, ipcache, &us->s.cp);
+  }
+  switch( ipcache->status ) {
+  case retrrc_success:
+    break;
+  case retrrc_nomac:
+    /* The MAC in the template will be wrong, but tmpl_update() checks
+     * the control plane again before sending through PIO.
+     */
+    break;
+  default:
+    LOG_U(ci_log("%s: route is not via an accelerated interface "
+                 "(status=%d)", __FUNCTION__, ipcache->status));
+    rc = -EOPNOTSUPP;
+    goto out;
+  }
+  if( (ipcache->flags & CI_IP_CACHE_IS_LOCALROUTE) ||
+      CI_IP_IS_MULTICAST(ipcache->ip.ip_daddr_be32) ) {
+    LOG_U(ci_log("%s: templated sends not supported to loopback or "
+                 "multicast destinations", __FUNCTION__));
+    rc = -EOPNOTSUPP;
+    goto out;
+  }
+
+  nsn = &ni->state->nic[ipcache->intf_i];
+
+  for( i = 0; i < mlen; ++i ) {
+#ifndef NDEBUG
+    if( initial_msg[i].iov_base == NULL ) {
+      rc = -EFAULT;
+      goto out;
+    }
+#endif
+    total_len += initial_msg[i].iov_len;
+  }
+
+  /* The datagram must go out in a single IP packet which fits in both
+   * the PIO region and the packet buffer, with the template handle at the
+   * end of the buffer.  Room is left for a VLAN tag in case the route
+   * changes.
+   */
+  max_payload = CI_MIN(nsn->pio_io_len,
+                       CI_CFG_PKT_BUF_SIZE -
+                       CI_MEMBER_OFFSET(ci_ip_pkt_fmt, dma_start) -
+                       (int) sizeof(struct oo_msg_template));
+  max_payload -= ETH_HLEN + ETH_VLAN_HLEN;
+  max_payload = CI_MIN(max_payload, ipcache->mtu);
+  max_payload -= sizeof(ci_ip4_hdr) + sizeof(ci_udp_hdr);
+  if( max_payload < 0 || total_len > max_payload ) {
+    rc = -E2BIG;
+    goto out;
+  }
+
+  if( (pkt = ci_netif_pkt_tx_tcp_alloc(ni, NULL)) == NULL ) {
+    rc = -EBUSY;
+    goto out;
+  }
+  ++ni->state->n_async_pkts;
+  oo_tx_pkt_layout_init(pkt);
+
+  ci_assert_equal(pkt->pio_addr, -1);
+  pkt->intf_i = ipcache->intf_i;
+  pkt->pio_order = ci_log2_ge(ETH_HLEN + ETH_VLAN_HLEN + sizeof(ci_ip4_hdr) +
+                              sizeof(ci_udp_hdr) + total_len,
+                              CI_CFG_MIN_PIO_BLOCK_ORDER);
+  pkt->pio_addr = ci_pio_buddy_alloc(ni, &nsn->pio_buddy, pkt->pio_order);
+  if( pkt->pio_addr < 0 ) {
+    pkt->pio_addr = -1;
+    if( ! (flags & ONLOAD_TEMPLATE_FLAGS_PIO_RETRY) ) {
+      ci_netif_pkt_release_1ref(ni, pkt);
+      --ni->state->n_async_pkts;
+      rc = -ENOMEM;
+      goto out;
+    }
+  }
+
+  /* Build the datagram as ci_udp_sendmsg_fill() would.  The IP ID is
+   * filled in at send time.  The IP and UDP checksums are left to the
+   * NIC.
+   */
+  udp_init(us, pkt, total_len);
+  TX_PKT_UDP(pkt)->udp_dest_be16 = udp_rport_be16(us);
+  ip = eth_ip_init(ni, us, pkt);
+  ip->ip_tot_len_be16 = CI_BSWAP_BE16((ci_uint16) (sizeof(ci_ip4_hdr) +
+                                                   sizeof(ci_udp_hdr) +
+                                                   total_len));
+  if( ! (us->s.s_flags & (CI_SOCK_FLAG_ALWAYS_DF | CI_SOCK_FLAG_PMTU_DO)) )
+    ip->ip_frag_off_be16 = 0;
+  ip->ip_id_be16 = 0;
+  ip->ip_saddr_be32 = ipcache->ip_saddr.ip4;
+  ip->ip_daddr_be32 = ipcache->ip.ip_daddr_be32;
+  ip->ip_ttl = ipcache->ip.ip_ttl;
+
+  payload = ci_udp_tmpl_payload(pkt);
+  for( i = 0; i < mlen; ++i ) {
+    memcpy(payload, initial_msg[i].iov_base, initial_msg[i].iov_len);
+    payload += initial_msg[i].iov_len;
+  }
+  pkt->buf_len = pkt->pay_len = payload - PKT_START(pkt);
+  pkt->pf.udp.tx_length = total_len + sizeof(ci_udp_hdr) +
+    sizeof(ci_ip4_hdr) + sizeof(ci_ether_hdr);
+  ci_ip_set_mac_and_port(ni, ipcache, pkt);
+
+  omt = ci_udp_tmpl_pkt_to_omt(pkt);
+  *omt_pp = omt;
+  omt->oomt_sock_id = S_SP(us);
+  pkt->next = us->tmpl_head;
+  us->tmpl_head = OO_PKT_P(pkt);
+
+  if( pkt->pio_addr >= 0 ) {
+    rc = ef_pio_memcpy(&ni->nic_hw[pkt->intf_i].vi, PKT_START(pkt),
+                       pkt->pio_addr, pkt->buf_len);
+    ci_assert_equal(rc, 0);
+  }
+
+  ++us->stats.n_tx_tmpl_active;
+
+ out:
+  ci_netif_unlock(ni);
+  return rc;
+}
+
+
+int
+ci_udp_tmpl_update(ci_netif* ni, ci_udp_state* us,
+                   struct oo_msg_template* omt,
+                   const struct onload_template_msg_update_iovec* updates,
+                   int ulen, unsigned flags)
+{
+  ci_ip_cached_hdrs* ipcache = &us->s.pkt;
+  ci_ip_pkt_fmt* pkt;
+  ef_vi* vi;
+  int i, rc = 0, payload_off, payload_len, ether_hdr_size;
+
+  /* This is needed to ensure that an app written to a later version of the
+   * API gets an error if they try to use a flag we don't understand.
+   */
+  if(CI_UNLIKELY( flags & ~(ONLOAD_TEMPLATE_FLAGS_SEND_NOW |
+                            ONLOAD_TEMPLATE_FLAGS_DONTWAIT) )) {
+    LOG_E(ci_log("%s: called with unsupported flags=%x", __FUNCTION__, flags));
+    return -EINVAL;
+  }
+
+  ci_netif_lock(ni);
+
+  /* Check that the template is this socket's before touching the buffer
+   * it sits in.
+   */
+  if(CI_UNLIKELY( omt->oomt_sock_id != S_SP(us) )) {
+    rc = -EINVAL;
+    goto out;
+  }
+  pkt = ci_udp_tmpl_omt_to_pkt(omt);
+  vi = &ni->nic_hw[pkt->intf_i].vi;
+
+  if(CI_UNLIKELY( us->s.so_error )) {
+    rc = -ci_get_so_error(&us->s);
+    if( rc < 0 ) {
+      ci_udp_tmpl_free(ni, us, pkt);
+      goto out;
+    }
+  }
+  if(CI_UNLIKELY( us->s.tx_errno )) {
+    rc = -us->s.tx_errno;
+    ci_udp_tmpl_free(ni, us, pkt);
+    goto out;
+  }
+
+  if(CI_UNLIKELY( pkt->pio_addr == -1 &&
+                  ! (flags & ONLOAD_TEMPLATE_FLAGS_SEND_NOW) )) {
+    pkt->pio_addr =
+      ci_pio_buddy_alloc(ni, &ni->state->nic[pkt->intf_i].pio_buddy,
+                         pkt->pio_order);
+    if( pkt->pio_addr >= 0 ) {
+      rc = ef_pio_memcpy(vi, PKT_START(pkt), pkt->pio_addr, pkt->buf_len);
+      ci_assert_equal(rc, 0);
+    }
+    else {
+      pkt->pio_addr = -1;
+    }
+  }
+
+  /* Apply requested updates to the packet buffer and the PIO region.
+   */
+  payload_off = ci_udp_tmpl_payload(pkt) - PKT_START(pkt);
+  payload_len = ci_udp_tmpl_payload_len(pkt);
+  for( i = 0; i < ulen; ++i ) {
+    if( updates[i].otmu_len == 0 ||
+        updates[i].otmu_offset < 0 ||
+#ifndef NDEBUG
+        updates[i].otmu_base == NULL ||
+#endif
+        updates[i].otmu_offset + updates[i].otmu_len > payload_len ) {
+      rc = -EINVAL;
+      goto out;
+    }
+    if( pkt->pio_addr != -1 ) {
+      rc = ef_pio_memcpy(vi, updates[i].otmu_base,
+                         pkt->pio_addr + payload_off + updates[i].otmu_offset,
+                         updates[i].otmu_len);
+      ci_assert_equal(rc, 0);
+    }
+    memcpy(ci_udp_tmpl_payload(pkt) + updates[i].otmu_offset,
+           updates[i].otmu_base, updates[i].otmu_len);
+  }
+  rc = 0;
+
+  if( ! (flags & ONLOAD_TEMPLATE_FLAGS_SEND_NOW) )
+    goto out;
+
+  /* Datagrams queued by earlier sends on this socket must go first. */
+  if( oo_atomic_read(&us->tx_async_q_level) != 0 ) {
+    ci_udp_sendmsg_send_async_q(ni, us);
+    ci_udp_tx_stage_drain(ni);
+  }
+
+  if(CI_UNLIKELY( ! oo_cp_verinfo_is_valid(ni->cplane,
+                                           &ipcache->mac_integrity) )) {
+    ++us->stats.n_tx_cp_c_lookup;
+    cicp_user_retrieve(ni, ipcache, &us->s.cp);
+  }
+
+  if( pkt->pio_addr >= 0 && udp_raddr_be32(us) != 0 &&
+      ipcache->status == retrrc_success &&
+      ipcache->intf_i == pkt->intf_i && ipcache->ip.ip_ttl != 0 &&
+      ! CI_IP_IS_MULTICAST(ipcache->ip.ip_daddr_be32) &&
+      oo_pktq_is_empty(ci_netif_dmaq(ni, pkt->intf_i)) &&
+      ef_vi_transmit_space(vi) > 0 ) {
+    /* Refresh the headers from the socket, which may have been
+     * reconnected or had its route change, and push them to the PIO
+     * region.  If the route gained or lost a VLAN tag the frame has moved
+     * within the region, so copy all of it.
+     */
+    ether_hdr_size = oo_tx_ether_hdr_size(pkt);
+    oo_tx_ip_hdr(pkt)->ip_id_be16 = CI_BSWAP_BE16(NEXT_IP_ID(ni));
+    TX_PKT_UDP(pkt)->udp_dest_be16 = udp_rport_be16(us);
+    prep_send_pkt(ni, us, pkt, ipcache);
+    if( oo_tx_ether_hdr_size(pkt) == ether_hdr_size )
+      rc = ef_pio_memcpy(vi, PKT_START(pkt), pkt->pio_addr,
+                         ci_udp_tmpl_payload(pkt) - PKT_START(pkt));
+    else
+      rc = ef_pio_memcpy(vi, PKT_START(pkt), pkt->pio_addr, pkt->buf_len);
+    ci_assert_equal(rc, 0);
+
+    /* The template's reference passes to the TX path, and the PIO region
+     * is freed on TX completion.
+     */
+    ci_udp_tmpl_remove(ni, us, pkt);
+    __ci_netif_dmaq_insert_prep_pkt(ni, pkt);
+
+    /* This cannot fail as we already checked that there is space in
+     * the TXQ */
+    rc = ef_vi_transmit_pio(vi, pkt->pio_addr, pkt->pay_len, OO_PKT_ID(pkt));
+    ci_assert_equal(rc, 0);
+    ++us->stats.n_tx_tmpl_fast;
+    CITP_STATS_NETIF_INC(ni, pio_pkts);
+  }
+  else {
+    rc = ci_udp_tmpl_normal_send(ni, us, pkt);
+  }
+
+ out:
+  ci_netif_unlock(ni);
+  return rc;
+}
+
+
+int ci_udp_tmpl_abort(ci_netif* ni, ci_udp_state* us,
+                      struct oo_msg_template* omt)
+{
+  ci_ip_pkt_fmt* tmpl = ci_udp_tmpl_omt_to_pkt(omt);
+  int rc = 0;
+  ci_netif_lock(ni);
+  if( omt->oomt_sock_id != S_SP(us) ) {
+    rc = -EINVAL;
+    goto out;
+  }
+  ci_udp_tmpl_free(ni, us, tmpl);
+ out:
+  ci_netif_unlock(ni);
+  return rc;
+}
+
+#endif /* __KERNEL__ */
+#endif /* CI_CFG_PIO */
+
+
 /*! \cidoxg_end */
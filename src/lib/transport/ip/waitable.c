@@ -36,6 +36,10 @@ void citp_waitable_reinit(ci_netif* ni, citp_waitable* w)
   w->sleep_seq.all = 0;
   w->sigown = 0;
   w->spin_cycles = ni->state->sock_spin_cycles;
+#if CI_CFG_SPIN_ADAPT
+  if( ni->spin_adapt != NULL )
+    oo_spin_adapt_init(oo_spin_adapt_sock(ni, w));
+#endif
 }
 
 
@@ -383,6 +387,10 @@ static void citp_waitable_dump2(ci_netif* ni, citp_waitable* w, const char* pf,
   else
     logger(log_arg, "%s  ul_poll: %"CI_PRIu64" spin cycles %u usec", pf,
          w->spin_cycles, oo_cycles64_to_usec(ni, w->spin_cycles));
+#if CI_CFG_SPIN_ADAPT
+  if( ni->spin_adapt != NULL )
+    oo_spin_adapt_dump(ni, oo_spin_adapt_sock(ni, w), pf, logger, log_arg);
+#endif
 }
 
 
@@ -471,12 +479,15 @@ citp_waitable_wake_epoll3_not_in_poll(ci_netif* ni, citp_waitable* sb)
    */
   if( sb->ready_lists_in_use != 0 ) {
     ci_sb_epoll_state* epoll = ci_ni_aux_p2epoll(ni, sb->epoll);
+    oo_sb_epoll* e;
     ci_uint32 tmp, i;
+    unsigned base = 0;
 
     CI_READY_LIST_EACH(sb->ready_lists_in_use, tmp, i) {
-      ci_ni_dllist_remove(ni, &epoll->e[i].ready_link);
-      ci_ni_dllist_put(ni, &ni->state->ready_lists[i],
-                       &epoll->e[i].ready_link);
+      if(CI_UNLIKELY( (e = ci_sb_epoll_seek(ni, &epoll, &base, i)) == NULL ))
+        break;
+      ci_ni_dllist_remove(ni, &e->ready_link);
+      ci_ni_dllist_put(ni, &ni->state->ready_lists[i], &e->ready_link);
 
       /* Wake the ready list too, if that's requested it. */
       if( ni->state->ready_list_flags[i] & CI_NI_READY_LIST_FLAG_WAKE )
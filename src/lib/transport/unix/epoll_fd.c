@@ -221,33 +221,66 @@ citp_epoll_set_home_stack(struct citp_epoll_fd* ep, ci_netif* ni)
   }
 }
 
-static int citp_epoll_sb_state_alloc(citp_socket* sock)
+static void citp_epoll_sb_state_init(ci_netif* ni, oo_p sp, oo_sp sock_id)
 {
-  oo_p sp;
-  ci_sb_epoll_state* epoll;
+  ci_sb_epoll_state* epoll = ci_ni_aux_p2epoll(ni, sp);
   int i;
 
-  if( OO_PP_NOT_NULL(sock->s->b.epoll) )
-    return 0;
+  epoll->sock_id = sock_id;
+  epoll->next = OO_P_NULL;
+  OO_P_ADD(sp, CI_MEMBER_OFFSET(ci_ni_aux_mem, u.epoll));
+  for( i = 0; i < CI_EPOLL_SETS_PER_AUX_BUF; i++ ) {
+    ci_ni_dllist_link_init(ni, &epoll->e[i].ready_link, sp, "rll");
+    ci_ni_dllist_self_link(ni, &epoll->e[i].ready_link);
+    OO_P_ADD(sp, sizeof(oo_sb_epoll));
+  }
+}
 
-  ci_netif_lock(sock->netif);
-  sp = ci_ni_aux_alloc(sock->netif, CI_TCP_AUX_TYPE_EPOLL);
-  if( OO_PP_NOT_NULL(sp) ) {
-    sock->s->b.epoll = sp;
-    epoll = ci_ni_aux_p2epoll(sock->netif, sp);
-    epoll->sock_id = sock->s->b.bufid;
-    OO_P_ADD(sp, CI_MEMBER_OFFSET(ci_ni_aux_mem, u.epoll));
-    for( i = 0; i < CI_EPOLL_SETS_PER_AUX_BUF; i++ ) {
-      ci_ni_dllist_link_init(sock->netif, &epoll->e[i].ready_link, sp, "rll");
-      ci_ni_dllist_self_link(sock->netif, &epoll->e[i].ready_link);
-      OO_P_ADD(sp, sizeof(oo_sb_epoll));
+/* Make sure the socket has epoll state covering [ready_list] (or just the
+ * first aux buffer if [ready_list] is not known yet), extending its chain
+ * of aux buffers as needed.
+ */
+static int citp_epoll_sb_state_alloc(citp_socket* sock, int ready_list)
+{
+  ci_netif* ni = sock->netif;
+  oo_p* slot;
+  oo_p sp = OO_P_NULL;
+  int base;
+
+  if( ready_list < 0 )
+    ready_list = 0;
+
+  /* The chain only grows while the socket is alive, so it is safe to check
+   * it without the lock. */
+  for( slot = &sock->s->b.epoll, base = 0; OO_P_NOT_NULL(*slot);
+       slot = &ci_ni_aux_p2epoll(ni, *slot)->next,
+       base += CI_EPOLL_SETS_PER_AUX_BUF )
+    if( ready_list < base + CI_EPOLL_SETS_PER_AUX_BUF )
+      return 0;
+
+  ci_netif_lock(ni);
+  for( slot = &sock->s->b.epoll, base = 0; ;
+       slot = &ci_ni_aux_p2epoll(ni, *slot)->next,
+       base += CI_EPOLL_SETS_PER_AUX_BUF ) {
+    if( OO_P_IS_NULL(*slot) ) {
+      sp = ci_ni_aux_alloc(ni, CI_TCP_AUX_TYPE_EPOLL);
+      if( OO_P_IS_NULL(sp) )
+        break;
+      citp_epoll_sb_state_init(ni, sp, sock->s->b.bufid);
+      ci_wmb();
+      *slot = sp;
+    }
+    if( ready_list < base + CI_EPOLL_SETS_PER_AUX_BUF ) {
+      sp = *slot;
+      break;
     }
   }
-  ci_netif_unlock(sock->netif);
-  if( OO_PP_IS_NULL(sp) ) {
-    Log_POLL(ci_log("%s: failed to allocate epoll state for [%d:%d]", __func__,
-                    NI_ID(sock->netif), sock->s->b.bufid));
-    CITP_STATS_NETIF_INC(sock->netif, epoll_sb_state_alloc_failed);
+  ci_netif_unlock(ni);
+  if( OO_P_IS_NULL(sp) ) {
+    Log_POLL(ci_log("%s: failed to allocate epoll state for [%d:%d] "
+                    "ready list %d", __func__,
+                    NI_ID(ni), sock->s->b.bufid, ready_list));
+    CITP_STATS_NETIF_INC(ni, epoll_sb_state_alloc_failed);
     return -1;
   }
   return 0;
@@ -257,25 +290,23 @@ static void citp_epoll_sb_state_set(struct citp_epoll_member* eitem,
                                     struct citp_epoll_fd* ep,
                                     citp_socket* sock)
 {
-  ci_sb_epoll_state* epoll;
+  oo_sb_epoll* e;
   ci_assert(OO_PP_NOT_NULL(sock->s->b.epoll));
 
-  epoll = ci_ni_aux_p2epoll(sock->netif, sock->s->b.epoll);
+  e = ci_sb_epoll_get(sock->netif, &sock->s->b, ep->ready_list);
   /* This epoll set owns the ready list id, so it must be free in the
    * socket */
-  ci_assert_nflags(sock->s->b.ready_lists_in_use, 1 << ep->ready_list);
-  ci_assert(
-    ci_ni_dllist_is_self_linked(ep->home_stack,
-                                &epoll->e[ep->ready_list].ready_link));
+  ci_assert_nflags(sock->s->b.ready_lists_in_use, 1u << ep->ready_list);
+  ci_assert(ci_ni_dllist_is_self_linked(ep->home_stack, &e->ready_link));
 
-  CI_USER_PTR_SET(epoll->e[ep->ready_list].eitem, eitem);
+  CI_USER_PTR_SET(e->eitem, eitem);
 
   /* Tell others that we are in the list */
   ci_netif_lock(ep->home_stack);
-  sock->s->b.ready_lists_in_use |= 1 << ep->ready_list;
+  sock->s->b.ready_lists_in_use |= 1u << ep->ready_list;
   ci_ni_dllist_put(ep->home_stack,
                    &ep->home_stack->state->unready_lists[ep->ready_list],
-                   &epoll->e[ep->ready_list].ready_link);
+                   &e->ready_link);
   ci_netif_unlock(ep->home_stack);
 }
 
@@ -311,11 +342,12 @@ citp_epoll_try_promote_to_home(struct citp_epoll_member* eitem,
     return;
 
   sock = fdi_to_socket(fdi);
-  if( citp_epoll_sb_state_alloc(sock) != 0 )
+  if( citp_epoll_sb_state_alloc(sock, ep->ready_list) != 0 )
     return;
   if( ep->home_stack == NULL )
     citp_epoll_set_home_stack(ep, sock->netif);
-  if( sock->netif == ep->home_stack )
+  if( sock->netif == ep->home_stack &&
+      citp_epoll_sb_state_alloc(sock, ep->ready_list) == 0 )
     citp_epoll_promote_to_home(eitem, fdi, sock, ep);
 }
 
@@ -377,12 +409,12 @@ static void citp_remove_home_member(struct citp_epoll_fd* epoll_fd,
 
   /* It is possible that we've already removed this epoll state; in this
    * case no cleanup in the shared state is needed. */
-  if( sock->s->b.ready_lists_in_use & (1 << eitem->ready_list_id) ) {
+  if( sock->s->b.ready_lists_in_use & (1u << eitem->ready_list_id) ) {
     ci_netif_lock(ni);
-    if( sock->s->b.ready_lists_in_use & (1 << eitem->ready_list_id) ) {
-      ci_sb_epoll_state* epoll = ci_ni_aux_p2epoll(ni, sock->s->b.epoll);
-      sock->s->b.ready_lists_in_use &=~ (1 << eitem->ready_list_id);
-      ci_ni_dllist_remove_safe(ni, &epoll->e[eitem->ready_list_id].ready_link);
+    if( sock->s->b.ready_lists_in_use & (1u << eitem->ready_list_id) ) {
+      oo_sb_epoll* e = ci_sb_epoll_get(ni, &sock->s->b, eitem->ready_list_id);
+      sock->s->b.ready_lists_in_use &=~ (1u << eitem->ready_list_id);
+      ci_ni_dllist_remove_safe(ni, &e->ready_link);
     }
     ci_netif_unlock(ni);
   }
@@ -719,7 +751,7 @@ citp_epoll_find(struct citp_epoll_fd* ep, const citp_fdinfo* fd_fdi,
 {
   citp_socket* sock;
   struct citp_epoll_member* eitem_next;
-  ci_sb_epoll_state* epoll;
+  oo_sb_epoll* e;
 
   /* We don't know how long ago the fdi was aquired - although we know it's
    * still valid because we hold a reference.  All sorts of things could have
@@ -745,12 +777,12 @@ citp_epoll_find(struct citp_epoll_fd* ep, const citp_fdinfo* fd_fdi,
     goto out;
   if( OO_PP_IS_NULL(sock->s->b.epoll) )
     goto out;
-  epoll = ci_ni_aux_p2epoll(sock->netif, sock->s->b.epoll);
-  if( (sock->s->b.ready_lists_in_use & (1 << ep->ready_list)) == 0 )
+  if( (sock->s->b.ready_lists_in_use & (1u << ep->ready_list)) == 0 )
     goto out;
+  e = ci_sb_epoll_get(sock->netif, &sock->s->b, ep->ready_list);
 
   oo_wqlock_lock(&ep->dead_stack_lock);
-  *eitem_out = CI_USER_PTR_GET(epoll->e[ep->ready_list].eitem);
+  *eitem_out = CI_USER_PTR_GET(e->eitem);
   oo_wqlock_unlock(&ep->dead_stack_lock, NULL);
   ci_assert(eitem_out);
 
@@ -928,7 +960,7 @@ static int citp_epoll_ctl_onload_add_new(struct citp_epoll_member** eitem_out,
    * guaranteed to be in any way optimal anyway.
    */
   if( (CITP_OPTS.ul_epoll == 3) && CI_UNLIKELY(!ep->home_stack) && sock &&
-       citp_epoll_sb_state_alloc(sock) == 0 ) {
+       citp_epoll_sb_state_alloc(sock, ep->ready_list) == 0 ) {
     citp_epoll_set_home_stack(ep, ni);
   }
 
@@ -936,7 +968,8 @@ static int citp_epoll_ctl_onload_add_new(struct citp_epoll_member** eitem_out,
    * If so we can add it to our cool sockets list, if not we'll do it the old
    * school way.
    */
-  if( ep->home_stack == ni && citp_epoll_sb_state_alloc(sock) == 0 ) {
+  if( ep->home_stack == ni &&
+      citp_epoll_sb_state_alloc(sock, ep->ready_list) == 0 ) {
     citp_epoll_ctl_onload_add_home(*eitem_out, ep, sock, fd_fdi, epoll_fd,
                                    epoll_fd_seq);
     *sync_kernel = 0;
@@ -1526,15 +1559,13 @@ static void citp_epoll_get_ready_list(struct oo_ul_epoll_state*
     ci_netif_lock(ni);
   lnk = ci_ni_dllist_start(ni, ready_list);
   while (lnk != ci_ni_dllist_end(ni, ready_list)) {
-    ci_sb_epoll_state* epoll;
-    epoll = CI_CONTAINER(ci_sb_epoll_state,
-                         e[eps->ep->ready_list].ready_link, lnk);
+    oo_sb_epoll* e = CI_CONTAINER(oo_sb_epoll, ready_link, lnk);
 
-    eitem = CI_USER_PTR_GET(epoll->e[eps->ep->ready_list].eitem);
+    eitem = CI_USER_PTR_GET(e->eitem);
     ci_ni_dllist_iter(ni, lnk);
-    ci_ni_dllist_remove(ni, &epoll->e[eps->ep->ready_list].ready_link);
+    ci_ni_dllist_remove(ni, &e->ready_link);
     ci_ni_dllist_put(ni, &ni->state->unready_lists[eps->ep->ready_list],
-                     &epoll->e[eps->ep->ready_list].ready_link);
+                     &e->ready_link);
     ci_assert(eitem);
     ci_dllist_remove(&((struct citp_epoll_member*)eitem)->dllink);
     /* This means that we'll be processing sockets in the order that they got
@@ -1713,6 +1744,24 @@ citp_epoll_find_timeout(ci_int64* timeout_hr, ci_uint64* poll_start_frc)
   return ret < 0 ? -1 : ret;
 }
 
+#if CI_CFG_SPIN_ADAPT
+/* Learn from a wait of [wait] cycles by this set: see EF_SPIN_ADAPT.  The
+ * state lives with the set's ready list in its home stack, so caller must
+ * hold the ep lock.
+ */
+static void citp_epoll_spin_adapt_wait_done(struct citp_epoll_fd* ep,
+                                            ci_uint64 wait)
+{
+  struct oo_spin_adapt* sa;
+
+  if( ep->home_stack == NULL )
+    return;
+  sa = oo_spin_adapt_ready_list(ep->home_stack, ep->ready_list);
+  if( sa != NULL )
+    oo_spin_adapt_wait_done(ep->home_stack, sa, wait, citp.spin_cycles);
+}
+#endif
+
 /* Sanity check: we use ppoll() to implement epoll_pwait() */
 #if CI_LIBC_HAS_epoll_pwait && ! CI_LIBC_HAS_ppoll
 #error "Can not implement epoll_pwait() without ppoll()"
@@ -1726,6 +1775,11 @@ int citp_epoll_wait(citp_fdinfo* fdi, struct epoll_event*__restrict__ events,
   struct citp_epoll_fd* ep = fdi_to_epoll(fdi);
   struct oo_ul_epoll_state eps;
   ci_uint64 poll_start_frc;
+  ci_uint64 spin_cycles = citp.spin_cycles;
+#if CI_CFG_SPIN_ADAPT
+  ci_uint64 wait_start_frc;
+  int waited = 0;
+#endif
   ci_int64 timeout_hr = (ci_int64) (unsigned) timeout * citp.cpu_khz;
   int rc = 0, rc_os = 0;
 #if CI_LIBC_HAS_epoll_pwait
@@ -1788,6 +1842,9 @@ int citp_epoll_wait(citp_fdinfo* fdi, struct epoll_event*__restrict__ events,
 
   /* Set up epoll state */
   ci_frc64(&poll_start_frc);
+#if CI_CFG_SPIN_ADAPT
+  wait_start_frc = poll_start_frc;
+#endif
   eps.this_poll_frc = poll_start_frc;
   eps.ep = ep;
   eps.events = events;
@@ -1803,6 +1860,12 @@ int citp_epoll_wait(citp_fdinfo* fdi, struct epoll_event*__restrict__ events,
   if( eps.ul_epoll_spin ) {
     eps.ul_epoll_spin |=
       oo_per_thread_get()->spinstate & (1 << ONLOAD_SPIN_SO_BUSY_POLL);
+#if CI_CFG_SPIN_ADAPT
+    if( ep->home_stack != NULL )
+      spin_cycles = oo_spin_adapt_budget(
+                      oo_spin_adapt_ready_list(ep->home_stack, ep->ready_list),
+                      spin_cycles);
+#endif
   }
 
   if(CI_UNLIKELY( eps.phase )) {
@@ -1924,6 +1987,11 @@ int citp_epoll_wait(citp_fdinfo* fdi, struct epoll_event*__restrict__ events,
                                                        &poll_start_frc);
     }
 
+#if CI_CFG_SPIN_ADAPT
+    if( waited && eps.ul_epoll_spin )
+      citp_epoll_spin_adapt_wait_done(ep, eps.this_poll_frc - wait_start_frc);
+#endif
+
     Log_POLL(ci_log("%s(%d): return %d ul + %d kernel",
                     __FUNCTION__, fdi->fd, rc, rc_os));
     goto unlock_release_exit_ret;
@@ -1939,7 +2007,11 @@ no_events:
   }
 
   /* Blocking.  Shall we spin? */
-  if( KEEP_POLLING(eps.ul_epoll_spin, eps.this_poll_frc, poll_start_frc) ) {
+#if CI_CFG_SPIN_ADAPT
+  waited = 1;
+#endif
+  if( KEEP_POLLING_FOR(eps.ul_epoll_spin, eps.this_poll_frc, poll_start_frc,
+                       spin_cycles) ) {
 #if CI_LIBC_HAS_epoll_pwait
     if( !pwait_was_spinning && sigmask != NULL) {
       if( ep->avoid_spin_once ) {
@@ -2120,6 +2192,11 @@ no_events:
          * waiting. */
         if( eps.ep->home_stack )
           citp_epoll_poll_ul_home_stack(&eps);
+#if CI_CFG_SPIN_ADAPT
+        if( eps.events != events && eps.ul_epoll_spin )
+          citp_epoll_spin_adapt_wait_done(ep,
+                                          ci_frc64_get() - wait_start_frc);
+#endif
         CITP_EPOLL_EP_UNLOCK(ep, 0);
 
         citp_exit_lib(lib_context, FALSE);
@@ -2354,7 +2431,7 @@ void citp_epoll_on_close(citp_fdinfo* epoll_fdi, citp_fdinfo* fd_fdi,
   struct citp_epoll_member* eitem = NULL;
   struct citp_epoll_fd* ep = fdi_to_epoll(epoll_fdi);
   citp_socket* sock;
-  ci_sb_epoll_state* epoll;
+  oo_sb_epoll* e;
   ci_netif* ni;
 
   if( ! citp_fdinfo_is_socket(fd_fdi) )
@@ -2369,11 +2446,11 @@ void citp_epoll_on_close(citp_fdinfo* epoll_fdi, citp_fdinfo* fd_fdi,
   oo_wqlock_lock(&ep->dead_stack_lock);
   if( ni != ep->home_stack )
     goto unlock;
-  if( (sock->s->b.ready_lists_in_use & (1 << ep->ready_list)) == 0 )
+  if( (sock->s->b.ready_lists_in_use & (1u << ep->ready_list)) == 0 )
     goto unlock;
 
-  epoll = ci_ni_aux_p2epoll(ni, sock->s->b.epoll);
-  eitem = CI_USER_PTR_GET(epoll->e[ep->ready_list].eitem);
+  e = ci_sb_epoll_get(ni, &sock->s->b, ep->ready_list);
+  eitem = CI_USER_PTR_GET(e->eitem);
 
 
   /* Only remove home members from the set here, because this hook is only
@@ -2392,8 +2469,8 @@ void citp_epoll_on_close(citp_fdinfo* epoll_fdi, citp_fdinfo* fd_fdi,
     fd_fdi->epoll_fd = -1;
 
     ci_netif_lock(ni);
-    sock->s->b.ready_lists_in_use &=~ (1 << ep->ready_list);
-    ci_ni_dllist_remove_safe(ni, &epoll->e[ep->ready_list].ready_link);
+    sock->s->b.ready_lists_in_use &=~ (1u << ep->ready_list);
+    ci_ni_dllist_remove_safe(ni, &e->ready_link);
     ci_netif_unlock(ni);
 
     ci_dllist_push(&ep->dead_stack_sockets, &eitem->dead_stack_link);
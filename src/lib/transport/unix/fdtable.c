@@ -31,6 +31,7 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/vfs.h>
+#include <sys/syscall.h>
 #include <onload/ul.h>
 #include <onload/dup2_lock.h>
 #include <onload/ul/tcp_helper.h>
@@ -62,6 +63,10 @@ static void dup2_complete(citp_fdinfo* prev_newfdi,
 
 static void sighandler_do_nothing(int sig) { }
 
+static void citp_fdtable_hazard_ctor(void);
+static void citp_fdinfo_ref_count_zero_now(citp_fdinfo* fdi, int fdt_locked);
+static void citp_fdinfo_close_fd(citp_fdinfo* fdi, int fdt_locked);
+
 /*! Block until fdtable entry is neither closing nor busy, and return the
 ** new (non-closing-or-busy) fdip. */
 static citp_fdinfo_p citp_fdtable_closing_wait(unsigned fd, int fdt_locked);
@@ -131,6 +136,8 @@ int citp_fdtable_ctor()
     return -1;
   }
 
+  citp_fdtable_hazard_ctor();
+
   /* Install SIGONLOAD handler */
   {
     struct sigaction sa;
@@ -552,6 +559,295 @@ citp_fdtable_probe(unsigned fd)
   return fdi;
 }
 
+/**********************************************************************
+ * Hazard slots for lock-free lookups.
+ *
+ * citp_fdtable_lookup_fast() publishes the fdinfo it returns in the
+ * calling thread's slot and then re-reads the fdtable entry, with only a
+ * compiler barrier between the two.  When the last reference to an
+ * fdinfo is dropped, it is put on [citp_fdtable_retired] and the slots
+ * are scanned after a membarrier(), which makes each thread execute a
+ * full barrier.  So either the scan sees the slot, or the lookup sees the
+ * entry has changed and backs off.  An fdinfo that is still held has its
+ * holder's [deferred] flag set, and is released by the holder when it
+ * clears its slot.
+ *
+ * A close would otherwise cost a membarrier() each.  If no slot is seen to
+ * hold the fdinfo, its fd is closed and it is destroyed at once, but it is
+ * not freed until a scan, which is made once CITP_FDTABLE_RETIRE_BATCH
+ * are waiting.  So a lookup that raced with the close, which only an
+ * application closing an fd that it is using can cause, reads a closed
+ * fdinfo rather than freed memory.
+ *
+ * If membarrier() fails, lookups go back to taking references, and what
+ * is retired is released once no thread is using its slot.
+ */
+
+#ifndef MEMBARRIER_CMD_PRIVATE_EXPEDITED
+# define MEMBARRIER_CMD_PRIVATE_EXPEDITED           (1 << 3)
+# define MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED  (1 << 4)
+#endif
+
+#define CITP_FDTABLE_RETIRE_BATCH  32
+
+/* Protects the slot list and the retired list. */
+static pthread_mutex_t citp_fdtable_hazard_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t citp_fdtable_hazard_key;
+static struct citp_fdtable_hazard* citp_fdtable_hazards;
+static citp_fdinfo* citp_fdtable_retired;
+static int citp_fdtable_n_retired;
+
+
+static int citp_membarrier(int cmd)
+{
+#ifdef __NR_membarrier
+  return ci_sys_syscall(__NR_membarrier, cmd, 0);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+
+/* Moves each retired fdinfo that no slot holds onto [*ready], and flags
+ * the holders of the others.  Returns true if any were held.  Caller must
+ * hold [citp_fdtable_hazard_lock].
+ */
+static int citp_fdtable_hazard_scan(citp_fdinfo** ready)
+{
+  struct citp_fdtable_hazard* h;
+  citp_fdinfo* fdi;
+  citp_fdinfo** p_fdi;
+  int held = 0;
+
+  if( citp_membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED) < 0 ) {
+    Log_E(log("%s: membarrier failed (errno=%d); fdtable lookups will use "
+              "atomic ops", __FUNCTION__, errno));
+    citp_fdtable.hazards = 0;
+    return 0;
+  }
+
+  p_fdi = &citp_fdtable_retired;
+  while( (fdi = *p_fdi) != NULL ) {
+    for( h = citp_fdtable_hazards; h != NULL; h = h->next )
+      if( h->fdi == fdi )
+        break;
+    if( h == NULL ) {
+      *p_fdi = fdi->hazard_next;
+      fdi->hazard_next = *ready;
+      *ready = fdi;
+      --citp_fdtable_n_retired;
+    }
+    else {
+      h->deferred = 1;
+      held = 1;
+      p_fdi = &fdi->hazard_next;
+    }
+  }
+  return held;
+}
+
+
+/* Returns the retired fdinfos that can now be released.  Anything still
+ * held after the second scan is guaranteed to be seen by its holder when
+ * it clears its slot, because the holder will find [deferred] set.
+ *
+ * Without membarrier() nothing can be released while any thread still
+ * owns a slot.  Each gives its slot up at its next lookup; see
+ * citp_fdtable_hazard_quiesce().
+ */
+static citp_fdinfo* citp_fdtable_hazard_collect(void)
+{
+  struct citp_fdtable_hazard* h;
+  citp_fdinfo* ready = NULL;
+  citp_fdinfo* fdi;
+
+  if( citp_fdtable.hazards && citp_fdtable_hazard_scan(&ready) )
+    citp_fdtable_hazard_scan(&ready);
+
+  if( ! citp_fdtable.hazards ) {
+    for( h = citp_fdtable_hazards; h != NULL; h = h->next )
+      if( h->in_use )
+        return ready;
+    while( (fdi = citp_fdtable_retired) != NULL ) {
+      citp_fdtable_retired = fdi->hazard_next;
+      fdi->hazard_next = ready;
+      ready = fdi;
+    }
+    citp_fdtable_n_retired = 0;
+  }
+  return ready;
+}
+
+
+static void citp_fdtable_hazard_release(citp_fdinfo* ready, int fdt_locked)
+{
+  citp_fdinfo* fdi;
+  while( (fdi = ready) != NULL ) {
+    ready = fdi->hazard_next;
+    citp_fdinfo_ref_count_zero_now(fdi, fdt_locked);
+  }
+}
+
+
+static void citp_fdtable_hazard_drain(int fdt_locked)
+{
+  citp_fdinfo* ready;
+
+  pthread_mutex_lock(&citp_fdtable_hazard_lock);
+  ready = citp_fdtable_hazard_collect();
+  pthread_mutex_unlock(&citp_fdtable_hazard_lock);
+  citp_fdtable_hazard_release(ready, fdt_locked);
+}
+
+
+/* Called by citp_fdtable_hazard_clear() when a release is waiting for the
+ * fdinfo this thread has just finished with. */
+void citp_fdtable_hazard_reclaim(struct citp_fdtable_hazard* h,
+                                 int fdt_locked)
+{
+  ci_assert(h->fdi == NULL);
+  h->deferred = 0;
+  citp_fdtable_hazard_drain(fdt_locked);
+}
+
+
+static void citp_fdtable_hazard_dtor(void* arg)
+{
+  struct citp_fdtable_hazard* h = arg;
+  int was_held = h->fdi != NULL;
+
+  /* The thread may have been cancelled while using an fdinfo. */
+  h->fdi = NULL;
+  h->depth = 0;
+  __oo_per_thread_get()->fdtable_hazard = NULL;
+  pthread_mutex_lock(&citp_fdtable_hazard_lock);
+  h->deferred = 0;
+  h->in_use = 0;
+  pthread_mutex_unlock(&citp_fdtable_hazard_lock);
+
+  if( was_held || ! citp_fdtable.hazards ) {
+    citp_lib_context_t lib_context;
+    citp_enter_lib(&lib_context);
+    citp_fdtable_hazard_drain(0);
+    citp_exit_lib(&lib_context, CI_TRUE);
+  }
+}
+
+
+static struct citp_fdtable_hazard* citp_fdtable_hazard_register(void)
+{
+  struct citp_fdtable_hazard* h;
+  void* p;
+
+  pthread_mutex_lock(&citp_fdtable_hazard_lock);
+  for( h = citp_fdtable_hazards; h != NULL; h = h->next )
+    if( ! h->in_use )
+      break;
+  if( h == NULL ) {
+    if( posix_memalign(&p, CI_CACHE_LINE_SIZE, sizeof(*h)) != 0 ) {
+      pthread_mutex_unlock(&citp_fdtable_hazard_lock);
+      return NULL;
+    }
+    h = p;
+    memset(h, 0, sizeof(*h));
+    h->next = citp_fdtable_hazards;
+    citp_fdtable_hazards = h;
+  }
+  h->in_use = 1;
+  pthread_mutex_unlock(&citp_fdtable_hazard_lock);
+
+  pthread_setspecific(citp_fdtable_hazard_key, h);
+  __oo_per_thread_get()->fdtable_hazard = h;
+  return h;
+}
+
+
+/* Called by a thread that owns a slot once membarrier() has failed.  The
+ * slot is given up unless it is still holding an fdinfo; the mutex orders
+ * the thread's last store to it before citp_fdtable_hazard_collect().
+ */
+static struct citp_fdtable_hazard*
+citp_fdtable_hazard_quiesce(struct citp_fdtable_hazard* h)
+{
+  citp_fdinfo* ready;
+
+  if( h->fdi != NULL )
+    return h;
+
+  __oo_per_thread_get()->fdtable_hazard = NULL;
+  pthread_mutex_lock(&citp_fdtable_hazard_lock);
+  h->deferred = 0;
+  h->in_use = 0;
+  ready = citp_fdtable_hazard_collect();
+  pthread_mutex_unlock(&citp_fdtable_hazard_lock);
+  citp_fdtable_hazard_release(ready, 0);
+  return NULL;
+}
+
+
+ci_inline struct citp_fdtable_hazard* citp_fdtable_hazard_get(void)
+{
+  struct citp_fdtable_hazard* h = __oo_per_thread_get()->fdtable_hazard;
+  if(CI_UNLIKELY( h == NULL )) {
+    if( citp_fdtable.hazards )
+      h = citp_fdtable_hazard_register();
+  }
+  else if(CI_UNLIKELY( ! citp_fdtable.hazards )) {
+    h = citp_fdtable_hazard_quiesce(h);
+  }
+  return h;
+}
+
+
+static void citp_fdtable_hazard_ctor(void)
+{
+  citp_fdtable.hazards = 0;
+  if( ! CITP_OPTS.fdtable_lockless || CITP_OPTS.fds_mt_safe )
+    return;
+
+  if( citp_membarrier(MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED) < 0 ) {
+    Log_S(log("%s: membarrier not available (errno=%d); fdtable lookups "
+              "will use atomic ops", __FUNCTION__, errno));
+    return;
+  }
+  if( pthread_key_create(&citp_fdtable_hazard_key,
+                         citp_fdtable_hazard_dtor) != 0 ) {
+    Log_E(log("%s: pthread_key_create failed", __FUNCTION__));
+    return;
+  }
+  citp_fdtable.hazards = 1;
+}
+
+
+/* Called in the child after fork: only the calling thread survives. */
+static void citp_fdtable_hazard_fork_hook(void)
+{
+  struct citp_fdtable_hazard* self = __oo_per_thread_get()->fdtable_hazard;
+  struct citp_fdtable_hazard* h;
+
+  if( ! citp_fdtable.hazards )
+    return;
+
+  pthread_mutex_init(&citp_fdtable_hazard_lock, NULL);
+  for( h = citp_fdtable_hazards; h != NULL; h = h->next )
+    if( h != self ) {
+      h->fdi = NULL;
+      h->depth = 0;
+      h->deferred = 0;
+      h->in_use = 0;
+    }
+
+  /* Registration belongs to the address space.  If it fails, anything
+   * already retired is released once this thread gives up its slot. */
+  if( citp_membarrier(MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED) < 0 ) {
+    Log_E(log("%s: membarrier registration failed (errno=%d)",
+              __FUNCTION__, errno));
+    citp_fdtable.hazards = 0;
+  }
+}
+
+
 static int
 citp_fdinfo_is_consistent(citp_fdinfo* fdi)
 {
@@ -695,6 +991,35 @@ citp_fdtable_lookup_fast(citp_lib_context_t* ctx, unsigned fd)
 	return fdi;
       }
       else {
+        struct citp_fdtable_hazard* h = citp_fdtable_hazard_get();
+        fdi = fdip_to_fdi(fdip);
+        if( h != NULL && h->fdi == NULL ) {
+          /* Publish [fdi], then check that the table still refers to it.
+           * If it does, [fdi] can't be released until we clear the slot.
+           * See citp_fdtable_hazard_scan().
+           */
+          h->fdi = fdi;
+          ci_compiler_barrier();
+          if(CI_UNLIKELY( *p_fdip != fdip )) {
+            citp_fdtable_hazard_clear(h, 0);
+            goto again;
+          }
+          if(CI_LIKELY( citp_fdinfo_is_consistent(fdi) )) {
+            /* dup2() needs to know who to interrupt.  Avoid dirtying the
+             * cache line when it's the same thread as last time. */
+            if( ! pthread_equal(fdi->thread_id, pthread_self()) )
+              fdi->thread_id = pthread_self();
+            return fdi;
+          }
+          /* Re-probe with the busy marker held, below. */
+          citp_fdtable_hazard_clear(h, 0);
+        }
+        else if( h != NULL && h->fdi == fdi ) {
+          /* Nested lookup of the fdinfo this thread is already using. */
+          ++h->depth;
+          return fdi;
+        }
+
         /* Swap in the busy marker. */
 	if( fdip_cas_succeed(p_fdip, fdip, fdip_busy) ) {
 	  fdi = fdip_to_fdi(fdip);
@@ -984,11 +1309,102 @@ citp_uncache_fds_ul(ci_netif* netif)
 #endif
 
 
+/* Whether [fdi] is being closed and can be closed before the slots are
+ * scanned, leaving only freeing it to the scan.  Not an epoll set, as
+ * its dtor frees what a racing lookup would use.  Caller must hold
+ * [citp_fdtable_hazard_lock].
+ */
+static int citp_fdtable_hazard_may_close(citp_fdinfo* fdi)
+{
+  struct citp_fdtable_hazard* h;
+
+  if( fdi->on_ref_count_zero != FDI_ON_RCZ_CLOSE ||
+      fdi->protocol->type == CITP_EPOLL_FD ||
+      fdi->protocol->type == CITP_EPOLLB_FD || ! citp_fdtable.hazards )
+    return 0;
+  for( h = citp_fdtable_hazards; h != NULL; h = h->next )
+    if( h->fdi == fdi )
+      return 0;
+  return 1;
+}
+
+
 void __citp_fdinfo_ref_count_zero(citp_fdinfo* fdi, int fdt_locked)
+{
+  citp_fdinfo* ready = NULL;
+
+  /* Slots are registered under the mutex, and we get here after an
+   * atomic decrement of [ref_count], so a thread registering a slot
+   * concurrently is guaranteed to see the fdtable entry has changed. */
+  if( citp_fdtable_hazards == NULL ) {
+    citp_fdinfo_ref_count_zero_now(fdi, fdt_locked);
+    return;
+  }
+
+  pthread_mutex_lock(&citp_fdtable_hazard_lock);
+  if( citp_fdtable_hazard_may_close(fdi) ) {
+    pthread_mutex_unlock(&citp_fdtable_hazard_lock);
+    citp_fdinfo_close_fd(fdi, fdt_locked);
+    fdi->on_ref_count_zero = FDI_ON_RCZ_CLOSED;
+    pthread_mutex_lock(&citp_fdtable_hazard_lock);
+  }
+  fdi->hazard_next = citp_fdtable_retired;
+  citp_fdtable_retired = fdi;
+  if( ++citp_fdtable_n_retired >= CITP_FDTABLE_RETIRE_BATCH ||
+      fdi->on_ref_count_zero != FDI_ON_RCZ_CLOSED )
+    ready = citp_fdtable_hazard_collect();
+  pthread_mutex_unlock(&citp_fdtable_hazard_lock);
+  citp_fdtable_hazard_release(ready, fdt_locked);
+}
+
+
+/* Closes or caches the fd of [fdi] and destroys [fdi], but does not free
+ * it.  The fdtable entry must be closing.
+ */
+static void citp_fdinfo_close_fd(citp_fdinfo* fdi, int fdt_locked)
 {
 #if CI_CFG_FD_CACHING
-  int cached;
+  if( citp_fdinfo_get_ops(fdi)->cache(fdi) == 1 ) {
+    if( ! fdt_locked && fdtable_strict() )  CITP_FDTABLE_LOCK();
+    fdi_to_socket(fdi)->netif->cached_count++;
+    fdtable_swap(fdi->fd, fdip_closing, fdip_unknown,
+                 fdt_locked | fdtable_strict());
+    citp_fdinfo_get_ops(fdi)->dtor(fdi, fdt_locked | fdtable_strict());
+    if( ! fdt_locked && fdtable_strict() )  CITP_FDTABLE_UNLOCK();
+    return;
+  }
 #endif
+
+  /* We mark the fd as busy before closing it to avoid races.  This means
+   * that if this fd is looked up during this phase of the close the looker
+   * upper will have to wait.
+   *
+   * There are problems if we try and keep this safe just by swapping
+   * the unknown and closing fdi entries.  If we set to unknown before
+   * close that could result in things being re-probed in the gap between
+   * setting to uknown and actually closing the fd.  If we close before
+   * setting to unknown then the fd could be re-used by the kernel
+   * without onload seeing it, and lookups would still return the closing
+   * fdi until the unknown entry had been swapped in.
+   */
+  if( ! fdt_locked && fdtable_strict() )  CITP_FDTABLE_LOCK();
+
+  fdtable_swap(fdi->fd, fdip_closing, fdip_busy,
+               fdt_locked | fdtable_strict());
+  if( fdi->protocol->type == CITP_TCP_SOCKET )
+    SC_TO_EPS(fdi_to_socket(fdi)->netif,fdi_to_socket(fdi)->s)->fd = CI_FD_BAD;
+
+  ci_tcp_helper_close_no_trampoline(fdi->fd);
+
+  citp_fdtable_busy_clear(fdi->fd, fdip_unknown,
+                          fdt_locked | fdtable_strict());
+  citp_fdinfo_get_ops(fdi)->dtor(fdi, fdt_locked | fdtable_strict());
+  if( ! fdt_locked && fdtable_strict() )  CITP_FDTABLE_UNLOCK();
+}
+
+
+static void citp_fdinfo_ref_count_zero_now(citp_fdinfo* fdi, int fdt_locked)
+{
   Log_V(log("%s: fd=%d on_rcz=%d", __FUNCTION__, fdi->fd,
 	    fdi->on_ref_count_zero));
 
@@ -1000,49 +1416,12 @@ void __citp_fdinfo_ref_count_zero(citp_fdinfo* fdi, int fdt_locked)
 
   switch( fdi->on_ref_count_zero ) {
   case FDI_ON_RCZ_CLOSE:
-#if CI_CFG_FD_CACHING
-    cached = citp_fdinfo_get_ops(fdi)->cache(fdi);
-    if( cached == 1 ) {
-      if( ! fdt_locked && fdtable_strict() )  CITP_FDTABLE_LOCK();
-      fdi_to_socket(fdi)->netif->cached_count++;
-      fdtable_swap(fdi->fd, fdip_closing, fdip_unknown,
-                   fdt_locked | fdtable_strict());
-      citp_fdinfo_get_ops(fdi)->dtor(fdi, fdt_locked | fdtable_strict());
-      if( ! fdt_locked && fdtable_strict() )  CITP_FDTABLE_UNLOCK();
-      citp_fdinfo_free(fdi);
-      break;
-    }
-    else
-#endif
-    {
-      /* We mark the fd as busy before closing it to avoid races.  This means
-       * that if this fd is looked up during this phase of the close the looker
-       * upper will have to wait.
-       *
-       * There are problems if we try and keep this safe just by swapping
-       * the unknown and closing fdi entries.  If we set to unknown before
-       * close that could result in things being re-probed in the gap between
-       * setting to uknown and actually closing the fd.  If we close before
-       * setting to unknown then the fd could be re-used by the kernel
-       * without onload seeing it, and lookups would still return the closing
-       * fdi until the unknown entry had been swapped in.
-       */
-      if( ! fdt_locked && fdtable_strict() )  CITP_FDTABLE_LOCK();
-
-      fdtable_swap(fdi->fd, fdip_closing, fdip_busy,
-		   fdt_locked | fdtable_strict());
-      if( fdi->protocol->type == CITP_TCP_SOCKET )
-        SC_TO_EPS(fdi_to_socket(fdi)->netif,fdi_to_socket(fdi)->s)->fd = CI_FD_BAD;
-
-      ci_tcp_helper_close_no_trampoline(fdi->fd);
-
-      citp_fdtable_busy_clear(fdi->fd, fdip_unknown,
-                              fdt_locked | fdtable_strict());
-      citp_fdinfo_get_ops(fdi)->dtor(fdi, fdt_locked | fdtable_strict());
-      if( ! fdt_locked && fdtable_strict() )  CITP_FDTABLE_UNLOCK();
-      citp_fdinfo_free(fdi);
-      break;
-    }
+    citp_fdinfo_close_fd(fdi, fdt_locked);
+    citp_fdinfo_free(fdi);
+    break;
+  case FDI_ON_RCZ_CLOSED:
+    citp_fdinfo_free(fdi);
+    break;
   case FDI_ON_RCZ_DUP2:
     dup2_complete(fdi, fdi_to_fdip(fdi), fdt_locked);
     break;
@@ -1136,6 +1515,8 @@ void citp_fdtable_fork_hook(void)
       continue;
     }
   }
+
+  citp_fdtable_hazard_fork_hook();
 }
 
 
@@ -1895,7 +2276,7 @@ citp_fdinfo* citp_reprobe_moved(citp_fdinfo* fdinfo, int from_fast_lookup,
  done:
   /* One refcount from the caller */
   if( from_fast_lookup )
-    citp_fdinfo_release_ref_fast(fdinfo);
+    __citp_fdinfo_release_ref_fast(fdinfo, 1);
   else
     citp_fdinfo_release_ref(fdinfo, 1);
 
@@ -311,11 +311,16 @@ struct citp_fdinfo_s {
   /* thread id using this fdi */
   pthread_t            thread_id;
 
+  /* Link in the list of fdinfos whose release is waiting for lock-free
+   * lookups to finish with them.  See __citp_fdinfo_ref_count_zero(). */
+  struct citp_fdinfo_s* hazard_next;
+
   /* What to do when the ref count goes to zero. */
 # define FDI_ON_RCZ_NONE	0
 # define FDI_ON_RCZ_CLOSE	1
 # define FDI_ON_RCZ_DUP2	2
 # define FDI_ON_RCZ_HANDOVER	3
+# define FDI_ON_RCZ_CLOSED	4	/* fd closed, waiting to be freed */
 # define FDI_ON_RCZ_MOVED	5
 # define FDI_ON_RCZ_DONE	6
   volatile char        on_ref_count_zero;
@@ -433,10 +438,53 @@ ci_inline void citp_fdinfo_release_ref(citp_fdinfo* fdinfo,
     __citp_fdinfo_ref_count_zero(fdinfo, fdt_locked);
 }
 
+/* When the fdtable is not MT-safe, citp_fdtable_lookup_fast() does not
+ * take a reference.  Instead it publishes the fdinfo in a per-thread
+ * hazard slot with plain stores, and an fdinfo whose last reference is
+ * dropped is not released until no slot holds it.  The freeing side uses
+ * membarrier() to order itself against the slots, so the lookup side
+ * needs only a compiler barrier.
+ */
+struct citp_fdtable_hazard {
+  citp_fdinfo* volatile       fdi;       /* fdinfo in use, or NULL */
+  unsigned                    depth;     /* nested lookups of [fdi] */
+  volatile unsigned           deferred;  /* a release waits for [fdi] */
+  int                         in_use;    /* owned by a live thread */
+  struct citp_fdtable_hazard* next;
+} CI_ALIGN(CI_CACHE_LINE_SIZE);
+
+extern void citp_fdtable_hazard_reclaim(struct citp_fdtable_hazard*,
+                                        int fdt_locked);
+
+/* [fdt_locked] says whether the caller holds the fdtable lock, as
+ * reclaiming may drop the last reference to other fdinfos.
+ */
+ci_inline void citp_fdtable_hazard_clear(struct citp_fdtable_hazard* h,
+                                         int fdt_locked) {
+  if( h->depth != 0 ) {
+    --h->depth;
+    return;
+  }
+  h->fdi = NULL;
+  ci_compiler_barrier();
+  if(CI_UNLIKELY( h->deferred ))
+    citp_fdtable_hazard_reclaim(h, fdt_locked);
+}
+
+ci_inline void __citp_fdinfo_release_ref_fast(citp_fdinfo* fdinfo,
+                                              int fdt_locked) {
+  if( citp_fdtable_not_mt_safe() ) {
+    struct citp_fdtable_hazard* h = __oo_per_thread_get()->fdtable_hazard;
+    if( h != NULL && h->fdi == fdinfo )
+      citp_fdtable_hazard_clear(h, fdt_locked);
+    else
+      citp_fdinfo_release_ref(fdinfo, fdt_locked);
+  }
+}
+
 /*! Release reference obtained by calling citp_fdtable_lookup_fast(). */
 ci_inline void citp_fdinfo_release_ref_fast(citp_fdinfo* fdinfo) {
-  if( citp_fdtable_not_mt_safe() )
-    citp_fdinfo_release_ref(fdinfo, 0);
+  __citp_fdinfo_release_ref_fast(fdinfo, 0);
 }
 /*! Take the same number of references as with citp_fdtable_lookup_fast(). */
 ci_inline void citp_fdinfo_ref_fast(citp_fdinfo* fdinfo) {
@@ -582,6 +630,11 @@ extern int citp_init_trampoline(ci_fd_t fd) CI_HF;
 
 extern citp_fdinfo* citp_tcp_dup(citp_fdinfo* orig_fdi);
 
+struct onload_accept_entry;
+extern int citp_tcp_accept_batch(citp_fdinfo* fdinfo,
+                                 struct onload_accept_entry* ents, int n,
+                                 int flags, citp_lib_context_t*) CI_HF;
+
 /* Locking order:
  * - citp_pkt_map_lock is the innermost lock;
  * - citp_dup_lock should be taken before citp_ul_lock.
@@ -642,6 +695,8 @@ typedef struct {
   citp_fdtable_entry*	table;
   unsigned		size;
   unsigned		inited_count;
+  /* Non-zero if citp_fdtable_lookup_fast() uses hazard slots. */
+  int			hazards;
 } citp_fdtable_globals;
 
 
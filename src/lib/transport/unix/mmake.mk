@@ -24,6 +24,7 @@ LIB_SRCS	:=			\
 		onload_ext_intercept.c	\
 		zc_intercept.c          \
 		tmpl_intercept.c	\
+		ring_intercept.c	\
 		stackname.c		\
 		stackopt.c		\
 		fdtable.c		\
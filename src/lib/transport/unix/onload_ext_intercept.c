@@ -527,6 +527,55 @@ int onload_socket_nonaccel(int domain, int type, int protocol)
 }
 
 
+#if CI_LIBC_HAS_accept4
+extern int onload_accept4(int fd, struct sockaddr* sa, socklen_t* p_sa_len,
+                          int flags);
+#else
+extern int onload_accept(int fd, struct sockaddr* sa, socklen_t* p_sa_len);
+#endif
+int onload_accept_batch(int fd, struct onload_accept_entry* ents, int n,
+                        int flags)
+{
+  citp_lib_context_t lib_context;
+  citp_fdinfo* fdi;
+  int rc;
+
+  Log_CALL(ci_log("%s(%d, %p, %d, 0x%x)", __FUNCTION__, fd, ents, n, flags));
+
+  if( n <= 0 ) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  citp_enter_lib(&lib_context);
+  fdi = citp_fdtable_lookup(fd);
+  if( fdi != NULL && citp_fdinfo_get_type(fdi) == CITP_TCP_SOCKET ) {
+    rc = citp_tcp_accept_batch(fdi, ents, n, flags, &lib_context);
+    citp_fdinfo_release_ref(fdi, 0);
+    citp_exit_lib(&lib_context, rc >= 0);
+  }
+  else {
+    /* Not an Onload TCP socket: one connection per call. */
+    if( fdi != NULL )
+      citp_fdinfo_release_ref(fdi, 0);
+    citp_exit_lib(&lib_context, TRUE);
+#if CI_LIBC_HAS_accept4
+    rc = onload_accept4(fd, ents[0].addr, &ents[0].addrlen, flags);
+#else
+    rc = flags ? (errno = EINVAL, -1) :
+                 onload_accept(fd, ents[0].addr, &ents[0].addrlen);
+#endif
+    if( rc >= 0 ) {
+      ents[0].fd = rc;
+      rc = 1;
+    }
+  }
+
+  Log_CALL_RESULT(rc);
+  return rc;
+}
+
+
 extern int onload_socket(int domain, int type, int protocol);
 int onload_socket_unicast_nonaccel(int domain, int type, int protocol)
 {
@@ -33,6 +33,7 @@
 #include <onload/ul/tcp_helper.h>
 #include <onload/oo_pipe.h>
 #include <onload/tcp_poll.h>
+#include <limits.h>
 
 
 #define VERB(x) Log_VTC(x)
@@ -113,6 +114,26 @@ int citp_splice_pipe_pipe(citp_pipe_fdi* in_pipe_fdi,
 
 extern int onload_ioctl(int, unsigned long, ...);
 
+
+/* Returns the TCP connection behind [alien_fdi] if it is in the same stack
+ * as the pipe, so that splice() can move buffers between them rather than
+ * copy.
+ */
+static ci_tcp_state* citp_pipe_splice_tcp_peer(citp_pipe_fdi* epi,
+                                               citp_fdinfo* alien_fdi)
+{
+  citp_sock_fdi* sock_epi;
+
+  if( alien_fdi == NULL ||
+      citp_fdinfo_get_type(alien_fdi) != CITP_TCP_SOCKET )
+    return NULL;
+  sock_epi = fdi_to_sock_fdi(alien_fdi);
+  if( sock_epi->sock.netif != epi->ni ||
+      ! (sock_epi->sock.s->b.state & CI_TCP_STATE_TCP_CONN) )
+    return NULL;
+  return SOCK_TO_TCP(sock_epi->sock.s);
+}
+
 /* Copies data from an alien descriptor to pipe
  *
  * Some observations on kernel implementation behaviour:
@@ -132,11 +153,13 @@ extern int onload_ioctl(int, unsigned long, ...);
  * recvmsg and non-blocking flags.
  */
 #define CITP_PIPE_SPLICE_WRITE_STACK_IOV_LEN 64
-int citp_pipe_splice_write(citp_fdinfo* fdi, int alien_fd, loff_t* alien_off,
+int citp_pipe_splice_write(citp_fdinfo* fdi, int alien_fd,
+                           citp_fdinfo* alien_fdi, loff_t* alien_off,
                            size_t olen, int flags,
                            citp_lib_context_t* lib_context)
 {
   citp_pipe_fdi* epi = fdi_to_pipe_fdi(fdi);
+  ci_tcp_state* ts;
   struct iovec iov_on_stack[CITP_PIPE_SPLICE_WRITE_STACK_IOV_LEN];
   struct iovec* iov = iov_on_stack;
   int iov_num_allocated = CITP_PIPE_SPLICE_WRITE_STACK_IOV_LEN;
@@ -157,6 +180,13 @@ int citp_pipe_splice_write(citp_fdinfo* fdi, int alien_fd, loff_t* alien_off,
     return -1;
   }
 
+  if( (ts = citp_pipe_splice_tcp_peer(epi, alien_fdi)) != NULL ) {
+    rc = ci_pipe_zc_recv_tcp(epi->ni, epi->pipe, ts,
+                             CI_MIN(olen, (size_t) INT_MAX));
+    if( rc > 0 )
+      return rc;
+  }
+
   {
     /* Fixme
      * Should not use this code if alien_fd is not Onload fd.  For Onload fd,
@@ -310,11 +340,13 @@ static int oo_splice_read_cb(void* context, struct iovec* iov,
 }
 
 
-int citp_pipe_splice_read(citp_fdinfo* fdi, int alien_fd, loff_t* alien_off,
+int citp_pipe_splice_read(citp_fdinfo* fdi, int alien_fd,
+                          citp_fdinfo* alien_fdi, loff_t* alien_off,
                           size_t len, int flags,
                           citp_lib_context_t* lib_context)
 {
   citp_pipe_fdi* epi = fdi_to_pipe_fdi(fdi);
+  ci_tcp_state* ts;
   int rc;
   int read_len = 0;
   int non_block = flags & SPLICE_F_NONBLOCK;
@@ -329,6 +361,15 @@ int citp_pipe_splice_read(citp_fdinfo* fdi, int alien_fd, loff_t* alien_off,
   }
   if( len == 0 )
     return 0;
+  if( (ts = citp_pipe_splice_tcp_peer(epi, alien_fdi)) != NULL ) {
+    /* Falls back to copying only if nothing could be moved. */
+    rc = ci_pipe_zc_send_tcp(epi->ni, epi->pipe, ts,
+                             CI_MIN(len, (size_t) INT_MAX),
+                             (non_block ? MSG_DONTWAIT : 0) |
+                             ((flags & SPLICE_F_MORE) ? MSG_MORE : 0));
+    if( rc != 0 )
+      return rc;
+  }
   do {
     struct oo_splice_read_context ctx = {
       .alien_fd = alien_fd,
@@ -856,6 +897,8 @@ static int oo_pipe_init(ci_netif* ni, struct oo_pipe* p)
    * pipe_size bytes. This extra buffer is needed because the buffer
    * under read_ptr can be blocked */
   p->bufs_max = OO_PIPE_SIZE_TO_BUFS(CITP_OPTS.pipe_size) + 1;
+  p->buf_base = 0;
+  p->buf_end = OO_PIPE_BUF_MAX_SIZE;
 
   return 0;
 }
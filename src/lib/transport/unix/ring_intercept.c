@@ -0,0 +1,337 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Intercept of submission/completion ring API calls
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+#include "internal.h"
+
+#include <limits.h>
+#include <sys/socket.h>
+
+#include <onload/extensions.h>
+#include <onload/extensions_ring.h>
+
+
+/* accept() has no equivalent of MSG_DONTWAIT, so check that a blocking
+ * Onload listener has something to accept before calling into it.
+ */
+static int citp_ring_accept_would_block(citp_fdinfo* fdi)
+{
+  citp_sock_fdi* epi;
+  ci_tcp_socket_listen* listener;
+  ci_netif* ni;
+  ci_uint64 now_frc;
+
+  if( citp_fdinfo_get_type(fdi) != CITP_TCP_SOCKET )
+    return 0;
+  epi = fdi_to_sock_fdi(fdi);
+  if( epi->sock.s->b.state != CI_TCP_LISTEN ||
+      (epi->sock.s->b.sb_aflags & (CI_SB_AFLAG_O_NONBLOCK |
+                                   CI_SB_AFLAG_O_NDELAY)) )
+    return 0;
+  listener = SOCK_TO_TCP_LISTEN(epi->sock.s);
+  ni = epi->sock.netif;
+
+  if( ci_tcp_acceptq_n(listener) == 0 ) {
+    ci_frc64(&now_frc);
+    if( ci_netif_may_poll(ni) && ci_netif_need_poll_frc(ni, now_frc) &&
+        ci_netif_trylock(ni) ) {
+      ci_netif_poll(ni);
+      ci_netif_unlock(ni);
+    }
+  }
+  return ci_tcp_acceptq_n(listener) == 0 &&
+         ! (listener->s.os_sock_status & OO_OS_STATUS_RX);
+}
+
+
+/* Issue the operation described by [sqe] without blocking.  [fdi] is NULL
+ * if the fd is not one of ours.  Returns the result for the completion,
+ * or -EAGAIN if the operation should stay queued.
+ */
+static int citp_ring_do_op(citp_lib_context_t* lib_context,
+                           citp_fdinfo* fdi, const struct onload_ring_sqe* sqe)
+{
+  struct msghdr m;
+  struct iovec iov[1];
+  int flags = sqe->flags | MSG_DONTWAIT;
+  int rc;
+
+  switch( sqe->opcode ) {
+  case ONLOAD_RING_OP_NOP:
+    return 0;
+
+  case ONLOAD_RING_OP_SEND:
+  case ONLOAD_RING_OP_RECV:
+    if( fdi == NULL ) {
+      if( sqe->opcode == ONLOAD_RING_OP_SEND )
+        rc = ci_sys_send(sqe->fd, sqe->buf, sqe->len, flags);
+      else
+        rc = ci_sys_recv(sqe->fd, sqe->buf, sqe->len, flags);
+      break;
+    }
+    iov[0].iov_base = sqe->buf;
+    iov[0].iov_len = sqe->len;
+    m.msg_name = NULL;
+    m.msg_namelen = 0;
+    m.msg_iov = iov;
+    m.msg_iovlen = 1;
+    m.msg_control = NULL;
+    m.msg_controllen = 0;
+    m.msg_flags = 0;
+    if( sqe->opcode == ONLOAD_RING_OP_SEND )
+      rc = citp_fdinfo_get_ops(fdi)->send(fdi, &m, flags);
+    else
+      rc = citp_fdinfo_get_ops(fdi)->recv(fdi, &m, flags);
+    break;
+
+  case ONLOAD_RING_OP_ACCEPT:
+    if( fdi != NULL ) {
+      if( citp_ring_accept_would_block(fdi) )
+        return -EAGAIN;
+      rc = citp_fdinfo_get_ops(fdi)->accept(fdi, sqe->addr, sqe->addrlen,
+                                            sqe->flags, lib_context);
+      break;
+    }
+#if CI_LIBC_HAS_accept4
+    rc = ci_sys_accept4(sqe->fd, sqe->addr, sqe->addrlen, sqe->flags);
+#else
+    rc = ci_sys_accept(sqe->fd, sqe->addr, sqe->addrlen);
+#endif
+    if( rc >= 0 )
+      citp_fdtable_passthru(rc, 0);
+    break;
+
+  default:
+    return -EINVAL;
+  }
+
+  return rc >= 0 ? rc : -errno;
+}
+
+
+/* The operations in a batch that have had to wait, each identified by fd
+ * and type.  Later operations of the same type on the same fd wait behind
+ * them so that they complete in order, however the fds are interleaved.
+ * Once the set is full every further operation waits for the next call,
+ * which keeps the order at the cost of a retry.
+ */
+#define CITP_RING_STALLED_MAX  16
+
+struct citp_ring_stalled {
+  int n;
+  struct {
+    int      fd;
+    unsigned opcode;
+  } op[CITP_RING_STALLED_MAX];
+};
+
+
+static int citp_ring_is_stalled(const struct citp_ring_stalled* st,
+                                const struct onload_ring_sqe* sqe)
+{
+  int i;
+
+  if( st->n == CITP_RING_STALLED_MAX )
+    return 1;
+  for( i = 0; i < st->n; ++i )
+    if( st->op[i].fd == sqe->fd && st->op[i].opcode == sqe->opcode )
+      return 1;
+  return 0;
+}
+
+
+static void citp_ring_stall(struct citp_ring_stalled* st,
+                            const struct onload_ring_sqe* sqe)
+{
+  if( st->n < CITP_RING_STALLED_MAX && ! citp_ring_is_stalled(st, sqe) ) {
+    st->op[st->n].fd = sqe->fd;
+    st->op[st->n].opcode = sqe->opcode;
+    ++st->n;
+  }
+}
+
+
+/* A batch takes the lock of the stack its TCP sockets are in the first
+ * time it reaches one, polls the stack once, and serves sends and receives
+ * under that lock until it ends or moves to another stack.  Receives also
+ * need the socket lock, which is held for a run of operations on one fd.
+ * Anything else drops both locks and goes through citp_ring_do_op().
+ */
+struct citp_ring_locks {
+  ci_netif*     ni;
+  ci_tcp_state* ts;
+};
+
+
+static void citp_ring_sock_unlock(struct citp_ring_locks* lk)
+{
+  if( lk->ts != NULL ) {
+    ci_sock_unlock(lk->ni, &lk->ts->s.b);
+    lk->ts = NULL;
+  }
+}
+
+
+static void citp_ring_unlock(struct citp_ring_locks* lk)
+{
+  citp_ring_sock_unlock(lk);
+  if( lk->ni != NULL ) {
+    ci_netif_unlock(lk->ni);
+    lk->ni = NULL;
+  }
+}
+
+
+/* Issue a send or receive on an Onload TCP socket under the stack lock.
+ * Returns -EOPNOTSUPP if it needs citp_ring_do_op() instead.
+ */
+static int citp_ring_do_op_locked(struct citp_ring_locks* lk,
+                                  citp_fdinfo* fdi,
+                                  const struct onload_ring_sqe* sqe)
+{
+  citp_sock_fdi* epi;
+  ci_netif* ni;
+  ci_tcp_state* ts;
+  int len;
+
+  if( fdi == NULL || citp_fdinfo_get_type(fdi) != CITP_TCP_SOCKET ||
+      (sqe->opcode != ONLOAD_RING_OP_SEND &&
+       sqe->opcode != ONLOAD_RING_OP_RECV) )
+    return -EOPNOTSUPP;
+  epi = fdi_to_sock_fdi(fdi);
+  if( epi->sock.s->b.state == CI_TCP_LISTEN )
+    return -EOPNOTSUPP;
+  ni = epi->sock.netif;
+  ts = SOCK_TO_TCP(epi->sock.s);
+  len = CI_MIN(sqe->len, (size_t) INT_MAX);
+
+  if( lk->ni != ni ) {
+    citp_ring_unlock(lk);
+    ci_netif_lock(ni);
+    lk->ni = ni;
+    if( ci_netif_may_poll(ni) &&
+        ci_netif_need_poll_spinning(ni, ci_frc64_get()) )
+      ci_netif_poll(ni);
+  }
+
+  if( sqe->opcode == ONLOAD_RING_OP_SEND )
+    return ci_tcp_sendmsg_locked(ni, ts, sqe->buf, len, sqe->flags);
+
+  if( sqe->flags & ~MSG_DONTWAIT )
+    return -EOPNOTSUPP;
+  if( lk->ts != ts ) {
+    /* The socket lock is taken before the stack lock everywhere else, so
+     * do not wait for it here.  The receive stays queued instead.
+     */
+    citp_ring_sock_unlock(lk);
+    if( ! ci_sock_trylock(ni, &ts->s.b) )
+      return -EAGAIN;
+    lk->ts = ts;
+  }
+  return ci_tcp_recvmsg_locked(ni, ts, sqe->buf, len);
+}
+
+
+int onload_ring_submit(struct onload_ring* ring, unsigned flags)
+{
+  citp_lib_context_t lib_context;
+  citp_fdinfo* fdi = NULL;
+  struct onload_ring_sqe* sqe;
+  struct onload_ring_cqe* cqe;
+  struct citp_ring_stalled stalled;
+  struct citp_ring_locks locks;
+  unsigned head, tail, keep;
+  int last_fd = -1, n_cqes = 0, rc;
+
+  Log_CALL(ci_log("%s(%p, %x)", __FUNCTION__, ring, flags));
+
+  head = keep = ring->sq_head;
+  tail = ring->sq_tail;
+  if( flags != 0 || tail - head > ring->sq_mask + 1 ) {
+    Log_CALL_RESULT(-EINVAL);
+    return -EINVAL;
+  }
+
+  citp_enter_lib(&lib_context);
+
+  stalled.n = 0;
+  locks.ni = NULL;
+  locks.ts = NULL;
+  for( ; head != tail; ++head ) {
+    if( ring->cq_tail - ring->cq_head > ring->cq_mask )
+      break;
+    sqe = &ring->sqes[head & ring->sq_mask];
+
+    /* Consecutive operations on one fd share the fd table lookup and the
+     * socket lock.
+     */
+    if( sqe->fd != last_fd ) {
+      citp_ring_sock_unlock(&locks);
+      if( fdi != NULL )
+        citp_fdinfo_release_ref(fdi, 0);
+      fdi = citp_fdtable_lookup(sqe->fd);
+      last_fd = sqe->fd;
+    }
+
+    if( stalled.n != 0 && citp_ring_is_stalled(&stalled, sqe) ) {
+      rc = -EAGAIN;
+    }
+    else {
+      rc = citp_ring_do_op_locked(&locks, fdi, sqe);
+      if( rc == -EOPNOTSUPP ) {
+        citp_ring_unlock(&locks);
+        rc = citp_ring_do_op(&lib_context, fdi, sqe);
+      }
+    }
+
+    if( rc == -EAGAIN ) {
+      citp_ring_stall(&stalled, sqe);
+      if( keep != head )
+        ring->sqes[keep & ring->sq_mask] = *sqe;
+      ++keep;
+      continue;
+    }
+
+    cqe = &ring->cqes[ring->cq_tail & ring->cq_mask];
+    cqe->user_data = sqe->user_data;
+    cqe->res = rc;
+    cqe->flags = 0;
+    ++ring->cq_tail;
+    ++n_cqes;
+  }
+
+  citp_ring_unlock(&locks);
+  if( fdi != NULL )
+    citp_fdinfo_release_ref(fdi, 0);
+
+  /* The CQ filled up: keep whatever was not looked at behind the entries
+   * that are still waiting.
+   */
+  for( ; head != tail; ++head, ++keep )
+    if( keep != head )
+      ring->sqes[keep & ring->sq_mask] = ring->sqes[head & ring->sq_mask];
+  ring->sq_tail = keep;
+
+  citp_exit_lib(&lib_context, TRUE);
+  Log_CALL_RESULT(n_cqes);
+  return n_cqes;
+}
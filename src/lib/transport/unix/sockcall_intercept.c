@@ -1776,8 +1776,8 @@ OO_INTERCEPT(ci_splice_return_type, splice, (int in_fd, loff_t* in_off,
   }
   else if( in_fdi && citp_fdinfo_get_type(in_fdi) == CITP_PIPE_FD ) {
     if( in_off == NULL ) {
-      rc = citp_pipe_splice_read(in_fdi, out_fd, out_off, len, flags,
-                                 &lib_context);
+      rc = citp_pipe_splice_read(in_fdi, out_fd, out_fdi, out_off, len,
+                                 flags, &lib_context);
     }
     else {
       errno = ESPIPE;
@@ -1786,8 +1786,8 @@ OO_INTERCEPT(ci_splice_return_type, splice, (int in_fd, loff_t* in_off,
   }
   else if( out_fdi && citp_fdinfo_get_type(out_fdi) == CITP_PIPE_FD ) {
     if( out_off == NULL ) {
-      rc = citp_pipe_splice_write(out_fdi, in_fd, in_off, len, flags,
-                                  &lib_context);
+      rc = citp_pipe_splice_write(out_fdi, in_fd, in_fdi, in_off, len,
+                                  flags, &lib_context);
     }
     else {
       errno = ESPIPE;
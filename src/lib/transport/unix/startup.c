@@ -205,6 +205,7 @@ static void citp_dump_opts(citp_opts_t *o)
   DUMP_OPT_INT("EF_DONT_ACCELERATE",	dont_accelerate);
   DUMP_OPT_INT("EF_FDTABLE_STRICT",	fdtable_strict);
   DUMP_OPT_INT("EF_FDS_MT_SAFE",	fds_mt_safe);
+  DUMP_OPT_INT("EF_FDTABLE_LOCKLESS",	fdtable_lockless);
   DUMP_OPT_INT("EF_FORK_NETIF",		fork_netif);
   DUMP_OPT_INT("EF_NETIF_DTOR",		netif_dtor);
   DUMP_OPT_INT("EF_NO_FAIL",		no_fail);
@@ -484,6 +485,7 @@ static void citp_opts_getenv(citp_opts_t* opts)
   GET_ENV_OPT_INT("EF_DONT_ACCELERATE",	dont_accelerate);
   GET_ENV_OPT_INT("EF_FDTABLE_STRICT",	fdtable_strict);
   GET_ENV_OPT_INT("EF_FDS_MT_SAFE",	fds_mt_safe);
+  GET_ENV_OPT_INT("EF_FDTABLE_LOCKLESS",	fdtable_lockless);
   GET_ENV_OPT_INT("EF_NO_FAIL",		no_fail);
   GET_ENV_OPT_INT("EF_SA_ONSTACK_INTERCEPT",	sa_onstack_intercept);
   GET_ENV_OPT_INT("EF_ACCEPT_INHERIT_NONBLOCK",	accept_force_inherit_nonblock);
@@ -611,6 +611,16 @@ static int citp_tcp_accept_complete(ci_netif* ni,
   ts->s.uuid = listener->s.uuid;
   CI_DEBUG(ts->s.pid = getpid());
 
+  /* Replace the reserved endpoints that were used up by promotion.  This
+   * is done here, after the connection has been handed over, so that the
+   * promotion itself does not have to grow the stack.
+   */
+  if( ni->state->n_accept_prealloc < NI_OPTS(ni).tcp_accept_prealloc &&
+      ci_netif_trylock(ni) ) {
+    ci_tcp_accept_prealloc_fill(ni);
+    ci_netif_unlock(ni);
+  }
+
   return newfd;
 }
 
@@ -1058,6 +1068,187 @@ check_ul_accept_q:
   return rc;
 }
 
+
+/* Take up to [n] connections from the head of the accept queue and create
+ * their fds with a single call into the driver.  Connections that were
+ * cached or moved to another stack are left for citp_tcp_accept_ul().
+ * Returns the number accepted, which may be zero, or a negative error
+ * code if the fds could not be created.
+ */
+static int citp_tcp_accept_ul_batch(ci_netif* ni,
+                                    ci_tcp_socket_listen* listener,
+                                    struct onload_accept_entry* ents, int n,
+                                    int flags)
+{
+  citp_sock_fdi* newepis[OO_ACCEPT_BATCH_MAX];
+  ci_tcp_state* tss[OO_ACCEPT_BATCH_MAX];
+  oo_sp ep_ids[OO_ACCEPT_BATCH_MAX];
+  int fds[OO_ACCEPT_BATCH_MAX];
+  citp_fdinfo* newfdi;
+  ci_tcp_state* ts;
+  int i, n_ts = 0, n_fds;
+
+  ci_assert_le(n, OO_ACCEPT_BATCH_MAX);
+
+  /* Allocate the u/l state first, so there is nothing to undo if it
+   * fails.
+   */
+  for( i = 0; i < n; ++i )
+    if( (newepis[i] = CI_ALLOC_OBJ(citp_sock_fdi)) == NULL )
+      break;
+  if( (n = i) == 0 ) {
+    Log_E(ci_log(LPF "accept: newepi malloc failed"));
+    return -ENOMEM;
+  }
+
+  ci_sock_lock(ni, &listener->s.b);
+  while( n_ts < n && ci_tcp_acceptq_not_empty(listener) ) {
+    ts = ci_tcp_acceptq_peek(ni, listener);
+    if( ts->s.b.sb_aflags & CI_SB_AFLAG_MOVED_AWAY )
+      break;
+#if CI_CFG_FD_CACHING
+    if( ci_tcp_is_cached(ts) || S_TO_EPS(ni, ts)->fd != CI_FD_BAD )
+      break;
+#endif
+    ci_tcp_acceptq_get(ni, listener);
+    ci_assert(ts->s.b.state & CI_TCP_STATE_TCP);
+    ci_assert(ts->s.b.state != CI_TCP_LISTEN);
+    tss[n_ts] = ts;
+    ep_ids[n_ts] = S_SP(ts);
+    ++n_ts;
+  }
+  ci_sock_unlock(ni, &listener->s.b);
+
+  if( n_ts == 0 ) {
+    n_fds = 0;
+    goto out;
+  }
+
+  /* As in citp_tcp_ep_acquire_fd(), but with the fdtable lock taken once
+   * for the whole batch.
+   */
+  if( fdtable_strict() )  CITP_FDTABLE_LOCK();
+  n_fds = ci_tcp_helper_tcp_accept_sock_attach_batch(
+                               ci_netif_get_driver_handle(ni), ep_ids, fds,
+                               n_ts, flags);
+  for( i = 0; i < n_fds; ++i )
+    citp_fdtable_new_fd_set(fds[i], fdip_busy, fdtable_strict());
+  if( fdtable_strict() )  CITP_FDTABLE_UNLOCK();
+
+  if( n_fds < n_ts ) {
+    Log_E(ci_log(LPF "%s: attached %d of %d: %d", __FUNCTION__,
+                 CI_MAX(n_fds, 0), n_ts, n_fds));
+    /* Put back the connections that did not get an fd, last first so
+     * that they keep their places at the head of the queue.
+     */
+    ci_sock_lock(ni, &listener->s.b);
+    for( i = n_ts - 1; i >= CI_MAX(n_fds, 0); --i ) {
+      ci_assert(tss[i]->s.b.sb_aflags & CI_SB_AFLAG_TCP_IN_ACCEPTQ);
+      ci_tcp_acceptq_put_back(ni, listener, &tss[i]->s.b);
+    }
+    CITP_STATS_TCP_LISTEN(++listener->stats.n_accept_no_fd);
+    ci_sock_unlock(ni, &listener->s.b);
+    if( n_fds < 0 )
+      goto out;
+  }
+
+  for( i = 0; i < n_fds; ++i ) {
+    ts = tss[i];
+    ci_assert(!(ts->s.b.sb_aflags & CI_SB_AFLAG_ORPHAN));
+    ci_assert(!(ts->s.b.sb_aflags & CI_SB_AFLAG_TCP_IN_ACCEPTQ));
+
+    newfdi = &newepis[i]->fdinfo;
+    citp_fdinfo_init(newfdi, &citp_tcp_protocol_impl);
+#if CI_CFG_FD_CACHING
+    newfdi->can_cache = 1;
+#endif
+    newepis[i]->sock.s = &ts->s;
+    newepis[i]->sock.netif = ni;
+    citp_netif_add_ref(ni);
+
+    ci_assert(ts->s.b.sb_aflags & CI_SB_AFLAG_NOT_READY);
+    ci_atomic32_and(&ts->s.b.sb_aflags, ~CI_SB_AFLAG_NOT_READY);
+    citp_fdtable_insert(newfdi, fds[i], 0);
+
+    ents[i].fd = citp_tcp_accept_complete(ni, ents[i].addr, &ents[i].addrlen,
+                                          listener, ts, fds[i]);
+    CITP_STATS_NETIF(++ni->state->stats.accept_batch_attach);
+  }
+
+ out:
+  for( i = CI_MAX(n_fds, 0); i < n; ++i )
+    CI_FREE_OBJ(newepis[i]);
+  return n_fds;
+}
+
+
+int citp_tcp_accept_batch(citp_fdinfo* fdinfo,
+                          struct onload_accept_entry* ents, int n, int flags,
+                          citp_lib_context_t* lib_context)
+{
+  citp_sock_fdi* epi = fdi_to_sock_fdi(fdinfo);
+  ci_netif* ni = epi->sock.netif;
+  ci_tcp_socket_listen* listener;
+  int n_done = 0, rc;
+
+  while( n_done < n ) {
+    if( epi->sock.s->b.state != CI_TCP_LISTEN )
+      break;
+    listener = SOCK_TO_TCP_LISTEN(epi->sock.s);
+
+    if( ci_tcp_acceptq_n(listener) ) {
+      rc = citp_tcp_accept_ul_batch(ni, listener, ents + n_done,
+                                    CI_MIN(n - n_done, OO_ACCEPT_BATCH_MAX),
+                                    flags);
+      if( rc > 0 ) {
+        n_done += rc;
+        continue;
+      }
+      if( rc < 0 ) {
+        if( n_done == 0 )
+          RET_WITH_ERRNO(-rc);
+        break;
+      }
+
+      /* The connection at the head of the queue cannot be batched. */
+      ci_sock_lock(ni, &listener->s.b);
+      if( ci_tcp_acceptq_not_empty(listener) ) {
+        rc = citp_tcp_accept_ul(fdinfo, ni, listener, ents[n_done].addr,
+                                &ents[n_done].addrlen, flags);
+        if( rc < 0 ) {
+          if( n_done == 0 )
+            return rc;
+          break;
+        }
+        ents[n_done++].fd = rc;
+        continue;
+      }
+      ci_sock_unlock(ni, &listener->s.b);
+    }
+
+    /* Only the first connection is waited for.  accept() deals with
+     * blocking, spinning and the OS socket.
+     */
+    if( n_done > 0 )
+      break;
+    rc = citp_tcp_accept(fdinfo, ents[n_done].addr, &ents[n_done].addrlen,
+                         flags, lib_context);
+    if( rc < 0 ) {
+      if( n_done == 0 )
+        return rc;
+      break;
+    }
+    ents[n_done++].fd = rc;
+  }
+
+  if( n_done == 0 ) {
+    /* Not listening (any more). */
+    errno = EINVAL;
+    return -1;
+  }
+  return n_done;
+}
+
 static int citp_tcp_connect(citp_fdinfo* fdinfo,
                             const struct sockaddr* sa, socklen_t sa_len,
                             citp_lib_context_t* lib_context)
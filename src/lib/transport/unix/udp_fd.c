@@ -676,7 +676,14 @@ int citp_udp_tmpl_alloc(citp_fdinfo* fdi, const struct iovec* initial_msg,
                         int mlen, struct oo_msg_template** omt_pp,
                         unsigned flags)
 {
+#if CI_CFG_PIO
+  citp_sock_fdi* epi = fdi_to_sock_fdi(fdi);
+
+  return ci_udp_tmpl_alloc(epi->sock.netif, SOCK_TO_UDP(epi->sock.s),
+                           omt_pp, initial_msg, mlen, flags);
+#else
   return -EOPNOTSUPP;
+#endif
 }
 
 
@@ -684,13 +691,26 @@ int citp_udp_tmpl_update(citp_fdinfo* fdi, struct oo_msg_template* omt,
                          const struct onload_template_msg_update_iovec* updates,
                          int ulen, unsigned flags)
 {
+#if CI_CFG_PIO
+  citp_sock_fdi* epi = fdi_to_sock_fdi(fdi);
+
+  return ci_udp_tmpl_update(epi->sock.netif, SOCK_TO_UDP(epi->sock.s),
+                            omt, updates, ulen, flags);
+#else
   return -EOPNOTSUPP;
+#endif
 }
 
 
 int citp_udp_tmpl_abort(citp_fdinfo* fdi, struct oo_msg_template* omt)
 {
+#if CI_CFG_PIO
+  citp_sock_fdi* epi = fdi_to_sock_fdi(fdi);
+
+  return ci_udp_tmpl_abort(epi->sock.netif, SOCK_TO_UDP(epi->sock.s), omt);
+#else
   return -EOPNOTSUPP;
+#endif
 }
 
 
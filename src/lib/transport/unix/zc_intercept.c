@@ -148,6 +148,8 @@ int onload_zc_release_buffers(int fd, onload_zc_handle* bufs, int bufs_len)
   citp_sock_fdi* epi;
   ci_netif* ni;
   ci_ip_pkt_fmt* pkt;
+  ci_sock_cmn* s;
+  int sock_locked = 0;
 
   Log_CALL(ci_log("%s(%d, %p, %d)", __FUNCTION__, fd, bufs, bufs_len));
 
@@ -159,6 +161,16 @@ int onload_zc_release_buffers(int fd, onload_zc_handle* bufs, int bufs_len)
     case CITP_TCP_SOCKET:
       epi = fdi_to_sock_fdi(fdi);
       ni = epi->sock.netif;
+      s = epi->sock.s;
+      /* Buffers lent by onload_zc_recv_lend() are accounted to the
+       * socket's receive queue, which needs the socket lock.  They must
+       * be released whatever state the socket has reached since.
+       */
+      if( citp_fdinfo_get_type(fdi) == CITP_TCP_SOCKET ) {
+        if( (rc = ci_sock_lock(ni, &s->b)) != 0 )
+          break;
+        sock_locked = 1;
+      }
       ci_netif_lock(ni);
       for( i = 0; i < bufs_len; ++i ) {
         pkt = (ci_ip_pkt_fmt*)bufs[i];
@@ -168,10 +180,22 @@ int onload_zc_release_buffers(int fd, onload_zc_handle* bufs, int bufs_len)
           rc = -EINVAL;
           break;
         }
+        if( (pkt->rx_flags & CI_PKT_RX_FLAG_TCP_LENT) &&
+            (! sock_locked ||
+             ! OO_SP_EQ(pkt->pf.tcp_rx.lo.rx_sock, SC_SP(s))) ) {
+          LOG_U(log("%s: buffer %d was not lent by fd %d",
+                    __FUNCTION__, OO_PKT_FMT(pkt), fd));
+          rc = -EINVAL;
+          break;
+        }
       }
       if( rc == 0 ) {
         for( i = 0; i < bufs_len; ++i ) {
           pkt = (ci_ip_pkt_fmt*)bufs[i];
+          if( pkt->rx_flags & CI_PKT_RX_FLAG_TCP_LENT ) {
+            ci_tcp_zc_recv_unlend(ni, s, pkt);
+            continue;
+          }
           /* If we are releasing a packet without the RX_FLAG then the user
            * allocated and then freed the packet (without using it).
            * We detect this to decrement n_asyn_pkts.
@@ -188,6 +212,8 @@ int onload_zc_release_buffers(int fd, onload_zc_handle* bufs, int bufs_len)
         }
       }
       ci_netif_unlock(ni);
+      if( sock_locked )
+        ci_sock_unlock(ni, &s->b);
       break;
 #if CI_CFG_USERSPACE_EPOLL
     case CITP_EPOLL_FD:
@@ -243,6 +269,51 @@ int onload_zc_recv(int fd, struct onload_zc_recv_args* args)
 
 
 
+int onload_zc_recv_lend(int fd, struct onload_zc_iovec* iovecs,
+                        int iovecs_len, int flags)
+{
+  int rc;
+  citp_lib_context_t lib_context;
+  citp_fdinfo* fdi;
+  citp_sock_fdi* epi;
+
+  Log_CALL(ci_log("%s(%d, %p, %d, %x)", __FUNCTION__, fd, iovecs,
+                  iovecs_len, flags));
+
+  if( (fdi = citp_fdtable_lookup_fast(&lib_context, fd)) ) {
+    switch( citp_fdinfo_get_type(fdi) ) {
+    case CITP_TCP_SOCKET:
+      epi = fdi_to_sock_fdi(fdi);
+      if( epi->sock.s->b.sb_aflags &
+          (CI_SB_AFLAG_O_NONBLOCK | CI_SB_AFLAG_O_NDELAY) )
+        flags |= ONLOAD_MSG_DONTWAIT;
+      rc = ci_tcp_zc_recv_lend(epi->sock.netif, SOCK_TO_TCP(epi->sock.s),
+                               iovecs, iovecs_len,
+                               flags & ONLOAD_ZC_RECV_LEND_FLAGS_MASK);
+      break;
+    case CITP_UDP_SOCKET:
+      rc = -EOPNOTSUPP;
+      break;
+    case CITP_PASSTHROUGH_FD:
+      rc = -ESOCKTNOSUPPORT;
+      break;
+    default:
+      rc = -ENOTSOCK;
+      break;
+    }
+    citp_fdinfo_release_ref_fast(fdi);
+    citp_exit_lib(&lib_context, rc >= 0);
+  } else {
+    citp_exit_lib_if(&lib_context, TRUE);
+    rc = -ESOCKTNOSUPPORT;
+  }
+
+  Log_CALL_RESULT(rc);
+  return rc;
+}
+
+
+
 int onload_zc_send(struct onload_zc_mmsg* msgs, int mlen, int flags)
 {
   int done = 0, last_fd = -1, i;
@@ -0,0 +1,282 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Microbenchmark for the Internet checksum routines.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* Measures ci_ip_csum_copy_iovec() and ci_ip_csum_partial() with each of
+ * the implementations selectable by ci_ip_csum_isa_select() that this CPU
+ * supports, over a range of sizes and three source layouts:
+ *
+ *   aligned  - one segment, source and destination 64-byte aligned
+ *   unalign  - one segment, source and destination at odd addresses
+ *   iov4     - four segments of odd length at odd addresses
+ *
+ * Every result is checked against a simple reference checksum (and the
+ * copy against the source) before it is timed.  We report cycles per byte
+ * for copy+checksum and for checksum alone (single segments only).
+ *
+ * Usage: csum_bench [-n bytes_per_measurement] [-s size]
+ */
+
+#define _GNU_SOURCE
+#include <ci/tools.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define MAX_SIZE   65536
+#define N_SEGS     4
+
+enum { LAYOUT_ALIGNED, LAYOUT_UNALIGN, LAYOUT_IOV4, LAYOUT_N };
+static const char* layout_name[LAYOUT_N] = { "aligned", "unalign", "iov4" };
+static const char* isa_name[] = { "c", "avx2", "avx512" };
+
+static const int default_sizes[] = {
+  64, 128, 256, 512, 1024, 1460, 2048, 4096, 8192, 9000, 16384, 32768, 65536,
+};
+
+static char* src_mem;
+static char* dst_mem;
+
+
+static unsigned ref_csum(const ci_uint8* p, int n)
+{
+  ci_uint64 sum = 0;
+  int i;
+  for( i = 0; i + 1 < n; i += 2 )
+    sum += p[i] | (p[i + 1] << 8);
+  if( n & 1 )
+    sum += p[n - 1];
+  while( sum >> 16 )
+    sum = (sum & 0xffff) + (sum >> 16);
+  return sum;
+}
+
+
+/* Build the iovec for [layout] over [n] bytes of source. */
+static int make_iov(ci_iovec* iov, int layout, int n)
+{
+  int i, off, len, rem;
+
+  switch( layout ) {
+  case LAYOUT_ALIGNED:
+    CI_IOVEC_BASE(&iov[0]) = src_mem;
+    CI_IOVEC_LEN(&iov[0]) = n;
+    return 1;
+  case LAYOUT_UNALIGN:
+    CI_IOVEC_BASE(&iov[0]) = src_mem + 1;
+    CI_IOVEC_LEN(&iov[0]) = n;
+    return 1;
+  default:
+    /* Odd-length segments, each starting at an odd address. */
+    off = 1;
+    rem = n;
+    for( i = 0; i < N_SEGS; ++i ) {
+      len = i < N_SEGS - 1 ? (n / N_SEGS) | 1 : rem;
+      CI_IOVEC_BASE(&iov[i]) = src_mem + off;
+      CI_IOVEC_LEN(&iov[i]) = len;
+      off += len + 1;
+      rem -= len;
+    }
+    return N_SEGS;
+  }
+}
+
+
+static char* dst_for(int layout)
+{
+  return layout == LAYOUT_ALIGNED ? dst_mem : dst_mem + 3;
+}
+
+
+static unsigned do_copy(const ci_iovec* iov, int iovlen, char* dst, int n)
+{
+  ci_iovec_ptr piov;
+  unsigned sum = 0;
+  int rc;
+
+  ci_iovec_ptr_init_nz(&piov, iov, iovlen);
+  rc = ci_ip_csum_copy_iovec(dst, n, 0, &piov, &sum);
+  ci_assert_equal(rc, n);
+  (void) rc;
+  return sum;
+}
+
+
+/* Only for single segments: segments of odd length would misalign the
+ * checksum. */
+static unsigned do_csum(const ci_iovec* iov)
+{
+  return ci_ip_csum_partial(0, CI_IOVEC_BASE(iov), CI_IOVEC_LEN(iov));
+}
+
+
+static int check(int layout, int n)
+{
+  ci_iovec iov[N_SEGS];
+  int iovlen = make_iov(iov, layout, n);
+  char* dst = dst_for(layout);
+  unsigned want, got;
+  char expect[MAX_SIZE];
+  int i, off = 0;
+
+  for( i = 0; i < iovlen; ++i ) {
+    memcpy(expect + off, CI_IOVEC_BASE(&iov[i]), CI_IOVEC_LEN(&iov[i]));
+    off += CI_IOVEC_LEN(&iov[i]);
+  }
+  want = ref_csum((const ci_uint8*) expect, n);
+
+  memset(dst, 0, n);
+  got = ci_ip_hdr_csum_finish(do_copy(iov, iovlen, dst, n));
+  if( got != (~want & 0xffff) || memcmp(dst, expect, n) ) {
+    fprintf(stderr, "ERROR: %s copy n=%d: csum %04x expected %04x%s\n",
+            layout_name[layout], n, got, ~want & 0xffff,
+            memcmp(dst, expect, n) ? " (bad copy)" : "");
+    return 0;
+  }
+  if( iovlen == 1 ) {
+    got = ci_ip_hdr_csum_finish(do_csum(iov));
+    if( got != (~want & 0xffff) ) {
+      fprintf(stderr, "ERROR: %s csum n=%d: csum %04x expected %04x\n",
+              layout_name[layout], n, got, ~want & 0xffff);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+static double measure(int layout, int n, long bytes, int copy)
+{
+  ci_iovec iov[N_SEGS];
+  int iovlen = make_iov(iov, layout, n);
+  char* dst = dst_for(layout);
+  long i, iters = bytes / n + 1;
+  volatile unsigned sink = 0;
+  ci_uint64 start, end;
+
+  /* warm up */
+  for( i = 0; i < 16; ++i )
+    sink += copy ? do_copy(iov, iovlen, dst, n) : do_csum(iov);
+
+  ci_frc64(&start);
+  for( i = 0; i < iters; ++i )
+    sink += copy ? do_copy(iov, iovlen, dst, n) : do_csum(iov);
+  ci_frc64(&end);
+  (void) sink;
+
+  return (double) (end - start) / ((double) iters * n);
+}
+
+
+static void usage(void)
+{
+  fprintf(stderr, "usage:\n");
+  fprintf(stderr, "  csum_bench [options]\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "options:\n");
+  fprintf(stderr, "  -n BYTES  - bytes to process per measurement "
+          "(default 256M)\n");
+  fprintf(stderr, "  -s SIZE   - measure only this size (up to %d)\n",
+          MAX_SIZE);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+
+int main(int argc, char* argv[])
+{
+  long bytes = 256l << 20;
+  int sizes[sizeof(default_sizes) / sizeof(default_sizes[0])];
+  int n_sizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+  int isas[CI_IP_CSUM_ISA_MAX + 1], n_isas = 0;
+  int c, i, s, l, failed = 0;
+
+  memcpy(sizes, default_sizes, sizeof(sizes));
+  while( (c = getopt(argc, argv, "n:s:")) != -1 )
+    switch( c ) {
+    case 'n':
+      bytes = atol(optarg);
+      break;
+    case 's':
+      sizes[0] = atoi(optarg);
+      n_sizes = 1;
+      if( sizes[0] < 16 || sizes[0] > MAX_SIZE )
+        usage();
+      break;
+    default:
+      usage();
+    }
+  if( optind != argc || bytes <= 0 )
+    usage();
+
+  /* Room for the iov4 layout's gaps and misalignment. */
+  if( posix_memalign((void**) &src_mem, 64, MAX_SIZE + 64) ||
+      posix_memalign((void**) &dst_mem, 64, MAX_SIZE + 64) ) {
+    fprintf(stderr, "ERROR: out of memory\n");
+    return 1;
+  }
+  srandom(1);
+  for( i = 0; i < MAX_SIZE + 64; ++i )
+    src_mem[i] = random();
+
+  for( i = 0; i <= CI_IP_CSUM_ISA_MAX; ++i )
+    if( ci_ip_csum_isa_select(i) == i )
+      isas[n_isas++] = i;
+
+  for( i = 0; i < n_isas; ++i ) {
+    ci_ip_csum_isa_select(isas[i]);
+    for( s = 0; s < n_sizes; ++s )
+      for( l = 0; l < LAYOUT_N; ++l )
+        if( ! check(l, sizes[s]) ) {
+          fprintf(stderr, "  (isa=%s)\n", isa_name[isas[i]]);
+          failed = 1;
+        }
+  }
+  if( failed )
+    return 1;
+
+  printf("# bytes_per_measurement=%ld; cycles per byte\n", bytes);
+  printf("# %6s  %-8s", "size", "layout");
+  for( i = 0; i < n_isas; ++i )
+    printf(" %8s-copy %8s-csum", isa_name[isas[i]], isa_name[isas[i]]);
+  printf("\n");
+
+  for( s = 0; s < n_sizes; ++s )
+    for( l = 0; l < LAYOUT_N; ++l ) {
+      printf("  %6d  %-8s", sizes[s], layout_name[l]);
+      for( i = 0; i < n_isas; ++i ) {
+        ci_ip_csum_isa_select(isas[i]);
+        printf(" %13.3f", measure(l, sizes[s], bytes, 1));
+        if( l == LAYOUT_IOV4 )
+          printf(" %13s", "-");
+        else
+          printf(" %13.3f", measure(l, sizes[s], bytes, 0));
+      }
+      printf("\n");
+    }
+
+  ci_ip_csum_isa_select(-1);
+  return 0;
+}
@@ -0,0 +1,13 @@
+
+TEST_APPS	:= csum_bench
+TARGETS		:= $(TEST_APPS:%=$(AppPattern))
+
+
+all: $(TARGETS)
+
+clean:
+	@$(MakeClean)
+
+
+MMAKE_LIBS	:= $(LINK_CITOOLS_LIB)
+MMAKE_LIB_DEPS	:= $(CITOOLS_LIB_DEPEND)
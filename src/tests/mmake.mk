@@ -14,7 +14,8 @@ SUBDIRS		:= ciul \
 OTHER_SUBDIRS	:=
 
 ifeq ($(ONLOAD_ONLY),1)
-SUBDIRS		:= ef_vi \
+SUBDIRS		:= citools \
+                   ef_vi \
                    onload \
                    rtt \
                    trade_sim
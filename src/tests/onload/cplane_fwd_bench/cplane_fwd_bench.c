@@ -0,0 +1,320 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Microbenchmark for route lookup in the cplane fwd table.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* Builds a fwd table in ordinary memory, filled the way the cplane server
+ * fills it, with one row per route and routes of many different prefix
+ * lengths.  Then it times cp_fwd_find_match() against the plain search
+ * over every source x destination prefix pair that it used to do, and
+ * checks that both find the same rows.
+ *
+ * Lookups are for random addresses in either a small working set of
+ * routes ("hot", as when an application talks to a few peers) or in all
+ * of them ("cold", as for a connect storm to many destinations).
+ *
+ * Usage: cplane_fwd_bench [-r routes] [-s fwd_size_lg2] [-n lookups]
+ *                         [-w working_set]
+ */
+
+#define _GNU_SOURCE
+#include <ci/tools.h>
+#include <onload/hash_ipv6.h>
+#include <cplane/mib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <netinet/in.h>
+
+
+struct route {
+  ci_ip_addr_t      dst;
+  ci_ip_addr_t      src;
+  cicp_prefixlen_t  dst_prefix;
+  cicp_prefixlen_t  src_prefix;
+};
+
+
+static struct cp_mibs mibs[2];
+static struct route* routes;
+static struct cp_fwd_key* keys;
+static cicp_mac_rowid_t* expect;
+static unsigned long ref_probes;
+
+static unsigned n_routes = 16384;
+static unsigned fwd_ln2 = 15;
+static unsigned long n_lookups = 1000000;
+static unsigned working_set = 64;
+
+#define SRC_ADDR  CI_BSWAP_BE32(0xc0a80001)   /* 192.168.0.1 */
+
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: cplane_fwd_bench [-r routes] [-s fwd_size_lg2] "
+          "[-n lookups] [-w working_set]\n");
+  exit(1);
+}
+
+
+static double now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static void mib_alloc(void)
+{
+  struct cp_tables_dim dim;
+  size_t bytes;
+  void* mem;
+
+  memset(&dim, 0, sizeof(dim));
+  dim.hwport_max = dim.llap_max = dim.ipif_max = dim.ip6if_max = 1;
+  dim.fwd_ln2 = fwd_ln2;
+  dim.fwd_mask = (1u << fwd_ln2) - 1;
+
+  bytes = sizeof(dim) + (dim.fwd_mask + 1) * sizeof(struct cp_fwd_row) +
+          CI_PAGE_SIZE;
+  mem = calloc(1, bytes);
+  if( mem == NULL ) {
+    fprintf(stderr, "cplane_fwd_bench: out of memory\n");
+    exit(1);
+  }
+  memcpy(mem, &dim, sizeof(dim));
+  mibs[0].dim = mem;
+  if( cp_init_mibs(mem, mibs) > bytes ) {
+    fprintf(stderr, "cplane_fwd_bench: MIBs do not fit\n");
+    exit(1);
+  }
+}
+
+
+/* Insert a row as the server does: probe from hash1 in steps of hash2,
+ * counting the row into each probe sequence it passes through.
+ */
+static int fwd_insert(const struct route* r)
+{
+  struct cp_mibs* mib = &mibs[0];
+  struct cp_fwd_key key;
+  cicp_mac_rowid_t hash1, hash2, hash;
+  int iter = 0;
+
+  memset(&key, 0, sizeof(key));
+  key.dst = r->dst;
+  key.src = r->src;
+  key.ifindex = 0;
+  key.tos = 0;
+  hash1 = onload_hash1(AF_INET, mib->dim->fwd_mask, &key.dst, key.ifindex,
+                       &key.src, key.tos, 0);
+  hash2 = cplane_hash2(AF_INET, &key.dst, key.ifindex, &key.src, key.tos);
+  hash = hash1;
+  do {
+    struct cp_fwd_row* fwd = &mib->fwd[hash];
+    ++fwd->use;
+    if( ! (fwd->flags & CICP_FWD_FLAG_OCCUPIED) ) {
+      fwd->key = key;
+      fwd->key_ext.dst_prefix = r->dst_prefix;
+      fwd->key_ext.src_prefix = r->src_prefix;
+      fwd->flags = CICP_FWD_FLAG_OCCUPIED | CICP_FWD_FLAG_DATA_VALID;
+      mib->fwd_prefix[CP_FWD_PREFIX_DST] |= 1ull << r->dst_prefix;
+      mib->fwd_prefix[CP_FWD_PREFIX_SRC] |= 1ull << r->src_prefix;
+      return 0;
+    }
+    hash = (hash + hash2) & mib->dim->fwd_mask;
+  } while( ++iter < CP_REHASH_LIMIT(mib->dim->fwd_mask) );
+  return -1;
+}
+
+
+/* Each route is in its own /16, so no two routes overlap, as the fwd table
+ * requires.  Prefixes run from /16 to /31, with a /32 (as for a PMTU
+ * entry) every 64th route; every 8th route is specific to the source.
+ */
+static void routes_fill(void)
+{
+  unsigned i;
+
+  routes = calloc(n_routes, sizeof(routes[0]));
+  for( i = 0; i < n_routes; ++i ) {
+    struct route* r = &routes[i];
+    r->dst_prefix = i % 64 == 63 ? 32 : 16 + (i * 7) % 16;
+    r->dst = CI_BSWAP_BE32((i + 1) << 16) & cp_prefixlen2bitmask(r->dst_prefix);
+    r->src_prefix = i % 8 == 7 ? 32 : 0;
+    r->src = r->src_prefix ? SRC_ADDR : 0;
+    if( fwd_insert(r) < 0 ) {
+      fprintf(stderr, "cplane_fwd_bench: fwd table full at %u routes; "
+              "try a larger -s\n", i);
+      exit(1);
+    }
+  }
+}
+
+
+static void key_fill(struct cp_fwd_key* k, const struct route* r)
+{
+  memset(k, 0, sizeof(*k));
+  k->dst = r->dst | (random() & ~cp_prefixlen2bitmask(r->dst_prefix));
+  k->src = SRC_ADDR;
+}
+
+
+/* Hot: [n_peers] fixed destinations, one in each of the first routes.
+ * Cold: a new destination in a random route for every lookup.
+ */
+static void keys_fill(unsigned n_peers)
+{
+  unsigned long i;
+
+  if( n_peers == 0 ) {
+    for( i = 0; i < n_lookups; ++i )
+      key_fill(&keys[i], &routes[random() % n_routes]);
+    return;
+  }
+  for( i = 0; i < n_peers; ++i )
+    key_fill(&keys[i], &routes[i]);
+  for( ; i < n_lookups; ++i )
+    keys[i] = keys[random() % n_peers];
+}
+
+
+/* The search that cp_fwd_find_match() did before it used hints. */
+static cicp_mac_rowid_t
+ref_find_match(struct cp_mibs* mib, struct cp_fwd_key* key)
+{
+  ci_uint64 src_prefs_in = mib->fwd_prefix[CP_FWD_PREFIX_SRC];
+  ci_uint64 dst_prefs = mib->fwd_prefix[CP_FWD_PREFIX_DST];
+  ci_uint64 src_prefs;
+  ci_uint8 src_pref, dst_pref;
+  struct cp_fwd_key k = *key;
+
+  for( ; dst_prefs != 0; dst_prefs &= ~(1ull << dst_pref) ) {
+    dst_pref = cp_get_largest_prefix(dst_prefs);
+    k.dst = key->dst & cp_prefixlen2bitmask(dst_pref);
+
+    for( src_prefs = src_prefs_in;
+         src_prefs != 0;
+         src_prefs &= ~(1ull << src_pref) ) {
+      cicp_mac_rowid_t id;
+
+      src_pref = cp_get_largest_prefix(src_prefs);
+      k.src = key->src & cp_prefixlen2bitmask(src_pref);
+      ++ref_probes;
+      id = cp_fwd_find_row(mib, &k);
+      if( id != CICP_ROWID_BAD )
+        return id;
+    }
+  }
+  return CICP_ROWID_BAD;
+}
+
+
+static double time_ref(void)
+{
+  double t = now_ns();
+  unsigned long i;
+
+  ref_probes = 0;
+  for( i = 0; i < n_lookups; ++i )
+    expect[i] = ref_find_match(&mibs[0], &keys[i]);
+  return (now_ns() - t) / n_lookups;
+}
+
+
+static double time_new(unsigned long* n_bad)
+{
+  double t = now_ns();
+  unsigned long i;
+  cicp_mac_rowid_t id;
+
+  *n_bad = 0;
+  for( i = 0; i < n_lookups; ++i ) {
+    id = cp_fwd_find_match(&mibs[0], &keys[i]);
+    *n_bad += id != expect[i];
+  }
+  return (now_ns() - t) / n_lookups;
+}
+
+
+static void run(const char* name, unsigned n_peers)
+{
+  double ref_ns, new_ns;
+  unsigned long n_bad;
+
+  keys_fill(n_peers);
+  ref_ns = time_ref();
+  new_ns = time_new(&n_bad);
+  printf("%-5s %8u %10.1f %10.1f %10.1f %8lu\n", name, n_peers,
+         (double) ref_probes / n_lookups, ref_ns, new_ns, n_bad);
+  if( n_bad )
+    exit(1);
+}
+
+
+int main(int argc, char* argv[])
+{
+  int c;
+
+  while( (c = getopt(argc, argv, "r:s:n:w:")) != -1 )
+    switch( c ) {
+    case 'r':
+      n_routes = atoi(optarg);
+      break;
+    case 's':
+      fwd_ln2 = atoi(optarg);
+      break;
+    case 'n':
+      n_lookups = strtoul(optarg, NULL, 0);
+      break;
+    case 'w':
+      working_set = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  if( optind != argc || n_routes == 0 || n_routes > 65535 ||
+      fwd_ln2 < 4 || fwd_ln2 > 24 || working_set == 0 ||
+      n_lookups < working_set )
+    usage();
+  working_set = CI_MIN(working_set, n_routes);
+
+  keys = malloc(n_lookups * sizeof(keys[0]));
+  expect = malloc(n_lookups * sizeof(expect[0]));
+  if( keys == NULL || expect == NULL ) {
+    fprintf(stderr, "cplane_fwd_bench: out of memory\n");
+    exit(1);
+  }
+  mib_alloc();
+  routes_fill();
+
+  printf("# %u routes in %u rows, %lu lookups\n", n_routes,
+         1u << fwd_ln2, n_lookups);
+  printf("%-5s %8s %10s %10s %10s %8s\n",
+         "set", "peers", "ref_probes", "ref_ns", "new_ns", "mismatch");
+  run("hot", working_set);
+  run("cold", 0);
+  return 0;
+}
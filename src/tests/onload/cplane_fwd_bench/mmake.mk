@@ -0,0 +1,12 @@
+TEST_APPS	:= cplane_fwd_bench
+TARGETS		:= $(TEST_APPS:%=$(AppPattern))
+
+
+all: $(TARGETS)
+
+clean:
+	@$(MakeClean)
+
+
+MMAKE_LIBS	:= $(LINK_CPLANE_LIB) $(LINK_CITOOLS_LIB)
+MMAKE_LIB_DEPS	:= $(CPLANE_LIB_DEPEND) $(CITOOLS_LIB_DEPEND)
@@ -0,0 +1,172 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/*
+ * Build the file using the following command:
+ *   $ gcc -lonload_ext -o onload_accept_batch onload_accept_batch.c
+ *
+ * Test by running the following command:
+ *   $ onload ./onload_accept_batch
+ *
+ * Connects several clients over loopback to a non-blocking listener and
+ * accepts them with onload_accept_batch().  The first call is made with
+ * RLIMIT_NOFILE lowered so that only some of the fds can be created: it
+ * must return those it did create, and a further call must fail with
+ * EMFILE.  Once the limit is restored every connection must still be
+ * accepted, each exactly once.  Without Onload one connection is accepted
+ * per call, which the test allows for.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <onload/extensions.h>
+
+#include "../test_check.h"
+
+#define N_CONNS 8
+
+static struct sockaddr_in peers[N_CONNS];
+static struct onload_accept_entry ents[N_CONNS];
+static int clients[N_CONNS];
+static int accepted[N_CONNS];
+static int n_accepted;
+
+
+/* Match the entries returned by a call to the clients that connected. */
+static void record(int n)
+{
+  int i, j;
+
+  for( i = 0; i < n; ++i ) {
+    CHECK(ents[i].fd >= 0);
+    CHECK(ents[i].addrlen == sizeof(struct sockaddr_in));
+    for( j = 0; j < N_CONNS; ++j )
+      if( peers[j].sin_port ==
+          ((struct sockaddr_in*) ents[i].addr)->sin_port )
+        break;
+    CHECK(j < N_CONNS);
+    if( j < N_CONNS ) {
+      CHECK(accepted[j] < 0);
+      accepted[j] = ents[i].fd;
+    }
+    ++n_accepted;
+  }
+}
+
+
+static int accept_batch(int lfd, int n)
+{
+  static struct sockaddr_in addrs[N_CONNS];
+  int i;
+
+  for( i = 0; i < n; ++i ) {
+    ents[i].addr = (struct sockaddr*) &addrs[i];
+    ents[i].addrlen = sizeof(addrs[i]);
+    ents[i].fd = -1;
+  }
+  return onload_accept_batch(lfd, ents, n, 0);
+}
+
+
+int main(void)
+{
+  struct sockaddr_in sa;
+  socklen_t sa_len = sizeof(sa);
+  struct rlimit rl, rl_low;
+  struct pollfd pfd;
+  int lfd, fd, rc, i;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if( (lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+      bind(lfd, (struct sockaddr*) &sa, sizeof(sa)) < 0 ||
+      listen(lfd, N_CONNS) < 0 ||
+      getsockname(lfd, (struct sockaddr*) &sa, &sa_len) < 0 ||
+      fcntl(lfd, F_SETFL, O_NONBLOCK) < 0 ) {
+    perror("listener");
+    return 1;
+  }
+
+  for( i = 0; i < N_CONNS; ++i ) {
+    sa_len = sizeof(peers[i]);
+    if( (clients[i] = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+        connect(clients[i], (struct sockaddr*) &sa, sizeof(sa)) < 0 ||
+        getsockname(clients[i],
+                    (struct sockaddr*) &peers[i], &sa_len) < 0 ) {
+      perror("client");
+      return 1;
+    }
+    accepted[i] = -1;
+  }
+
+  pfd.fd = lfd;
+  pfd.events = POLLIN;
+  CHECK(poll(&pfd, 1, 1000) == 1);
+
+  /* Leave room for fewer fds than there are connections. */
+  if( (fd = dup(0)) < 0 || getrlimit(RLIMIT_NOFILE, &rl) < 0 ) {
+    perror("rlimit");
+    return 1;
+  }
+  close(fd);
+  rl_low = rl;
+  rl_low.rlim_cur = fd + N_CONNS / 2;
+  if( setrlimit(RLIMIT_NOFILE, &rl_low) < 0 ) {
+    perror("setrlimit");
+    return 1;
+  }
+  rc = accept_batch(lfd, N_CONNS);
+  CHECK(rc >= 1 && rc < N_CONNS);
+  if( rc > 0 )
+    record(rc);
+  /* Use up any room left, so the next call can create no fd at all. */
+  while( n_accepted < N_CONNS && (rc = accept_batch(lfd, N_CONNS)) > 0 )
+    record(rc);
+  CHECK(rc < 0 && errno == EMFILE);
+  CHECK(n_accepted < N_CONNS);
+  setrlimit(RLIMIT_NOFILE, &rl);
+
+  /* Nothing was lost by the failures. */
+  while( n_accepted < N_CONNS ) {
+    if( poll(&pfd, 1, 1000) != 1 )
+      break;
+    rc = accept_batch(lfd, N_CONNS);
+    CHECK(rc > 0);
+    if( rc <= 0 )
+      break;
+    record(rc);
+  }
+  CHECK(n_accepted == N_CONNS);
+  rc = accept_batch(lfd, N_CONNS);
+  CHECK(rc < 0 && errno == EAGAIN);
+
+  for( i = 0; i < N_CONNS; ++i ) {
+    if( accepted[i] >= 0 )
+      close(accepted[i]);
+    close(clients[i]);
+  }
+  close(lfd);
+  return test_check_result();
+}
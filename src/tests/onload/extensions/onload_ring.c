@@ -0,0 +1,143 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/*
+ * Build the file using the following command:
+ *   $ gcc -lonload_ext -o onload_ring onload_ring.c
+ *
+ * Test by running the following command:
+ *   $ onload ./onload_ring
+ *
+ * Checks that receives queued on one fd with onload_ring_submit() complete
+ * in the order they were queued when they are interleaved with operations
+ * on other fds, including a send that makes the data they wait for
+ * available part way through the batch.  Uses socketpairs, so does not
+ * need an Onload interface.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <onload/extensions_ring.h>
+
+#include "../test_check.h"
+
+#define SQ_ENTRIES 8
+#define CQ_ENTRIES 8
+
+static struct onload_ring_sqe sqes[SQ_ENTRIES];
+static struct onload_ring_cqe cqes[CQ_ENTRIES];
+static struct onload_ring ring;
+static char bufs[SQ_ENTRIES][16];
+
+
+
+static void queue(int opcode, int fd, uint64_t user_data,
+                  const char* data)
+{
+  struct onload_ring_sqe* sqe = onload_ring_get_sqe(&ring);
+
+  if( sqe == NULL ) {
+    fprintf(stderr, "ERROR: SQ full\n");
+    exit(1);
+  }
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->user_data = user_data;
+  sqe->buf = bufs[user_data];
+  sqe->len = sizeof(bufs[0]);
+  if( data != NULL ) {
+    strcpy(bufs[user_data], data);
+    sqe->len = strlen(data);
+  }
+  onload_ring_sqe_push(&ring);
+}
+
+
+/* Expect the next completion to be [user_data], with [data] received
+ * into it if non-NULL.
+ */
+static void expect(uint64_t user_data, const char* data)
+{
+  struct onload_ring_cqe* cqe = onload_ring_peek_cqe(&ring);
+
+  CHECK(cqe != NULL);
+  if( cqe == NULL )
+    return;
+  CHECK(cqe->user_data == user_data);
+  if( data != NULL ) {
+    CHECK(cqe->res == (int) strlen(data));
+    CHECK(cqe->res > 0 && ! memcmp(bufs[cqe->user_data], data, cqe->res));
+  }
+  else {
+    CHECK(cqe->res >= 0);
+  }
+  onload_ring_cqe_seen(&ring);
+}
+
+
+int main(void)
+{
+  int a[2], b[2], rc;
+
+  if( socketpair(AF_UNIX, SOCK_STREAM, 0, a) < 0 ||
+      socketpair(AF_UNIX, SOCK_STREAM, 0, b) < 0 ) {
+    perror("socketpair");
+    return 1;
+  }
+  onload_ring_init(&ring, sqes, SQ_ENTRIES, cqes, CQ_ENTRIES);
+
+  /* Receive 1 on a[0] waits.  The send on a[1] then gives a[0] data, but
+   * receive 4 must still wait behind receive 1 although another fd came
+   * between them.
+   */
+  send(b[1], "b", 1, 0);
+  queue(ONLOAD_RING_OP_RECV, a[0], 1, NULL);
+  queue(ONLOAD_RING_OP_RECV, b[0], 2, NULL);
+  queue(ONLOAD_RING_OP_SEND, a[1], 3, "x");
+  queue(ONLOAD_RING_OP_RECV, a[0], 4, NULL);
+
+  rc = onload_ring_submit(&ring, 0);
+  if( rc == -ENOSYS ) {
+    printf("Program running without Onload\n");
+    return 0;
+  }
+  CHECK(rc == 2);
+  expect(2, "b");
+  expect(3, NULL);
+  CHECK(ring.sq_tail - ring.sq_head == 2);
+
+  rc = onload_ring_submit(&ring, 0);
+  CHECK(rc == 1);
+  expect(1, "x");
+  CHECK(ring.sq_tail - ring.sq_head == 1);
+
+  send(a[1], "y", 1, 0);
+  rc = onload_ring_submit(&ring, 0);
+  CHECK(rc == 1);
+  expect(4, "y");
+  CHECK(ring.sq_tail == ring.sq_head);
+  CHECK(onload_ring_peek_cqe(&ring) == NULL);
+
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+  close(b[1]);
+  return test_check_result();
+}
@@ -0,0 +1,213 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Time send() on one descriptor from a growing number of threads.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* Each thread calls send() in a loop on a connected UDP socket, and we
+ * report the mean time per call and the aggregate call rate for 1, 2, 4,
+ * ... threads.  By default all threads share one socket, which is the
+ * case where the fdtable lookup in the send() interceptor contends on the
+ * socket's fdinfo.  With -p each thread has its own socket, for
+ * comparison.
+ *
+ * Run under onload with a destination routed via an accelerated
+ * interface, and compare EF_FDTABLE_LOCKLESS=0 with the default.  With
+ * -z the sends are zero-length, which keeps the time spent in the stack
+ * to a minimum.
+ *
+ * Usage: fd_lookup_bench [-t max_threads] [-n sends] [-a addr] [-P port]
+ *                        [-l len] [-p] [-z]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+#define MAX_THREADS  256
+
+
+static struct sockaddr_in dest;
+static unsigned long n_sends = 1000000;
+static size_t msg_len = 32;
+static int per_thread_socket;
+static int shared_sock = -1;
+
+static pthread_barrier_t start_barrier;
+
+struct thread_res {
+  pthread_t      thread;
+  int            sock;
+  double         elapsed_ns;
+  unsigned long  errors;
+};
+
+static struct thread_res res[MAX_THREADS];
+
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: fd_lookup_bench [-t max_threads] [-n sends] "
+          "[-a addr] [-P port] [-l len] [-p] [-z]\n");
+  exit(1);
+}
+
+
+static int udp_socket_connected(void)
+{
+  int s = socket(AF_INET, SOCK_DGRAM, 0);
+  if( s < 0 ) {
+    perror("socket");
+    exit(2);
+  }
+  if( connect(s, (struct sockaddr*) &dest, sizeof(dest)) < 0 ) {
+    perror("connect");
+    exit(2);
+  }
+  return s;
+}
+
+
+static double now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static void* sender(void* arg)
+{
+  struct thread_res* r = arg;
+  char buf[65536];
+  unsigned long i;
+  double start;
+
+  memset(buf, 0, msg_len);
+  pthread_barrier_wait(&start_barrier);
+  start = now_ns();
+  for( i = 0; i < n_sends; ++i )
+    /* EAGAIN and ECONNREFUSED (from ICMP) are fine: the lookup has been
+     * done by then. */
+    if( send(r->sock, buf, msg_len, MSG_DONTWAIT) < 0 &&
+        errno != EAGAIN && errno != ECONNREFUSED )
+      ++r->errors;
+  r->elapsed_ns = now_ns() - start;
+  return NULL;
+}
+
+
+static void run(int n_threads)
+{
+  double sum_ns = 0, max_ns = 0;
+  unsigned long errors = 0;
+  int i;
+
+  pthread_barrier_init(&start_barrier, NULL, n_threads);
+  for( i = 0; i < n_threads; ++i ) {
+    memset(&res[i], 0, sizeof(res[i]));
+    res[i].sock = per_thread_socket ? udp_socket_connected() : shared_sock;
+    if( pthread_create(&res[i].thread, NULL, sender, &res[i]) != 0 ) {
+      fprintf(stderr, "pthread_create failed\n");
+      exit(2);
+    }
+  }
+  for( i = 0; i < n_threads; ++i ) {
+    pthread_join(res[i].thread, NULL);
+    sum_ns += res[i].elapsed_ns;
+    if( res[i].elapsed_ns > max_ns )
+      max_ns = res[i].elapsed_ns;
+    errors += res[i].errors;
+    if( per_thread_socket )
+      close(res[i].sock);
+  }
+  pthread_barrier_destroy(&start_barrier);
+
+  printf("%8d %12.1f %14.2f %10lu\n", n_threads,
+         sum_ns / n_threads / n_sends,
+         (double) n_threads * n_sends / max_ns * 1e3, errors);
+}
+
+
+int main(int argc, char* argv[])
+{
+  int max_threads = 8;
+  int c, n;
+
+  dest.sin_family = AF_INET;
+  dest.sin_port = htons(9);
+  dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  while( (c = getopt(argc, argv, "t:n:a:P:l:pz")) != -1 )
+    switch( c ) {
+    case 't':
+      max_threads = atoi(optarg);
+      break;
+    case 'n':
+      n_sends = strtoul(optarg, NULL, 0);
+      break;
+    case 'a':
+      if( inet_aton(optarg, &dest.sin_addr) == 0 )
+        usage();
+      break;
+    case 'P':
+      dest.sin_port = htons(atoi(optarg));
+      break;
+    case 'l':
+      msg_len = strtoul(optarg, NULL, 0);
+      break;
+    case 'p':
+      per_thread_socket = 1;
+      break;
+    case 'z':
+      msg_len = 0;
+      break;
+    default:
+      usage();
+    }
+  if( optind != argc || max_threads < 1 || max_threads > MAX_THREADS ||
+      n_sends == 0 || msg_len > 65507 )
+    usage();
+
+  if( ! per_thread_socket )
+    shared_sock = udp_socket_connected();
+
+  printf("# dest=%s:%d len=%zu sends/thread=%lu %s\n",
+         inet_ntoa(dest.sin_addr), ntohs(dest.sin_port), msg_len, n_sends,
+         per_thread_socket ? "socket-per-thread" : "shared-socket");
+  printf("# %6s %12s %14s %10s\n", "threads", "ns/send", "Msends/s",
+         "errors");
+  for( n = 1; n < max_threads; n *= 2 )
+    run(n);
+  run(max_threads);
+
+  if( shared_sock >= 0 )
+    close(shared_sock);
+  return 0;
+}
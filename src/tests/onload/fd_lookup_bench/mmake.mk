@@ -0,0 +1,15 @@
+TEST_APPS	:= fd_lookup_bench
+TARGETS		:= $(TEST_APPS:%=$(AppPattern))
+
+fd_lookup_bench	:= $(patsubst %,$(AppPattern),fd_lookup_bench)
+
+
+all: $(TARGETS)
+
+clean:
+	@$(MakeClean)
+
+
+# Time send() from many threads.  Run it under onload.
+$(fd_lookup_bench): fd_lookup_bench.o
+	(libs="-lpthread"; $(MMakeLinkCApp))
@@ -0,0 +1,514 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Microbenchmark for the software filter table.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* Compares the bucketised cuckoo filter table in
+ * lib/transport/ip/netif_table.c with the double-hashed open-addressed
+ * table that it replaced.  The new table is the stack's own, in a stack
+ * built by tests/onload/pcap_replay/fake_netif.c; the old one is
+ * re-implemented here.
+ *
+ * Both tables are filled with synthetic TCP 4-tuples to a range of load
+ * factors, churned (each flow removed and a new one inserted, which is what
+ * leaves tombstones behind in the old table), and then looked up with a mix
+ * of present and absent keys.  For each load factor we report:
+ *
+ *   probes  - slots (old table) or buckets (new table) visited per
+ *             lookup
+ *   derefs  - socket states dereferenced to compare the full key
+ *   ns      - mean time per lookup
+ *
+ * and, for the new table, the insert statistics the stack keeps.
+ *
+ * The socket states are spread out in memory so that, as in the stack,
+ * each key comparison costs a separate cache line.
+ *
+ * Usage: filter_table_bench [-s size_lg2] [-n lookups] [-m miss_pct]
+ */
+
+#define _GNU_SOURCE
+#include "fake_netif.h"
+#include "netif_table.h"
+#include <onload/hash.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <netinet/in.h>
+
+
+/* EMPTY is shared with netif_table.h. */
+#define TOMBSTONE  -1
+
+
+/* Stand-in for the socket state that holds the rest of the key. */
+struct sock {
+  ci_uint32 raddr;
+  ci_uint16 lport;
+  ci_uint16 rport;
+  ci_uint32 protocol;
+  char      pad[256 - 12];
+};
+
+
+struct key {
+  ci_uint32 laddr, raddr;
+  ci_uint16 lport, rport;
+  int       id;
+};
+
+
+/**********************************************************************
+ * Double-hashed table with tombstones, as netif_table.c used to be.
+ */
+
+struct old_entry {
+  ci_int32  id;
+  ci_int32  route_count;
+  ci_uint32 laddr;
+};
+
+struct old_table {
+  unsigned          mask;
+  struct old_entry* table;
+};
+
+
+static void old_init(struct old_table* t, int size_lg2)
+{
+  unsigned i;
+  t->mask = (1u << size_lg2) - 1;
+  t->table = malloc(sizeof(t->table[0]) << size_lg2);
+  for( i = 0; i <= t->mask; ++i ) {
+    t->table[i].id = EMPTY;
+    t->table[i].route_count = 0;
+    t->table[i].laddr = 0;
+  }
+}
+
+
+static int old_insert(struct old_table* t, const struct key* k)
+{
+  unsigned hash1, hash2, first;
+  hash1 = onload_hash1(AF_INET, t->mask, &k->laddr, k->lport,
+                       &k->raddr, k->rport, IPPROTO_TCP);
+  hash2 = onload_hash2(AF_INET, &k->laddr, k->lport,
+                       &k->raddr, k->rport, IPPROTO_TCP);
+  first = hash1;
+  while( t->table[hash1].id >= 0 ) {
+    ++t->table[hash1].route_count;
+    hash1 = (hash1 + hash2) & t->mask;
+    if( hash1 == first )
+      return -ENOBUFS;
+  }
+  t->table[hash1].id = k->id;
+  t->table[hash1].laddr = k->laddr;
+  return 0;
+}
+
+
+static void old_remove(struct old_table* t, const struct key* k)
+{
+  unsigned hash1, hash2, i;
+  int hops = 0;
+  hash1 = onload_hash1(AF_INET, t->mask, &k->laddr, k->lport,
+                       &k->raddr, k->rport, IPPROTO_TCP);
+  hash2 = onload_hash2(AF_INET, &k->laddr, k->lport,
+                       &k->raddr, k->rport, IPPROTO_TCP);
+  for( i = hash1; ; i = (i + hash2) & t->mask, ++hops ) {
+    if( t->table[i].id == k->id && t->table[i].laddr == k->laddr )
+      break;
+    if( t->table[i].id == EMPTY )
+      return;
+  }
+  for( i = hash1; hops-- > 0; i = (i + hash2) & t->mask )
+    if( --t->table[i].route_count == 0 && t->table[i].id == TOMBSTONE )
+      t->table[i].id = EMPTY;
+  t->table[i].id = t->table[i].route_count == 0 ? EMPTY : TOMBSTONE;
+}
+
+
+static int old_lookup(struct old_table* t, const struct sock* socks,
+                      const struct key* k, unsigned* probes, unsigned* derefs)
+{
+  unsigned hash1, hash2 = 0, first;
+  hash1 = onload_hash1(AF_INET, t->mask, &k->laddr, k->lport,
+                       &k->raddr, k->rport, IPPROTO_TCP);
+  first = hash1;
+  while( 1 ) {
+    int id = t->table[hash1].id;
+    ++*probes;
+    if( id >= 0 ) {
+      const struct sock* s = &socks[id];
+      ++*derefs;
+      if( ((k->laddr   - t->table[hash1].laddr) |
+           (k->lport   - s->lport             ) |
+           (k->raddr   - s->raddr             ) |
+           (k->rport   - s->rport             ) |
+           (IPPROTO_TCP - s->protocol         )) == 0 )
+        return hash1;
+    }
+    if( id == EMPTY )
+      break;
+    if( hash1 == first )
+      hash2 = onload_hash2(AF_INET, &k->laddr, k->lport,
+                           &k->raddr, k->rport, IPPROTO_TCP);
+    hash1 = (hash1 + hash2) & t->mask;
+    if( hash1 == first )
+      break;
+  }
+  return -ENOENT;
+}
+
+
+/**********************************************************************
+ * The bucketised cuckoo table in lib/transport/ip/netif_table.c, in a
+ * stack built by tests/onload/pcap_replay/fake_netif.c.
+ */
+
+static struct fake_netif fn;
+static oo_sp* sock_id;
+
+
+/* One TCP socket for each of the stand-ins, with the same ports and remote
+ * address.  Keys differ from each other in the local address, which the
+ * filter table holds in the entry.
+ */
+static int new_init(const struct sock* socks, int n_socks)
+{
+  ci_netif* ni = &fn.ni;
+  ci_tcp_state* ts;
+  int i;
+
+  for( i = 0; i < n_socks; ++i ) {
+    if( (ts = ci_tcp_get_state_buf(ni)) == NULL )
+      return -ENOSPC;
+    TS_TCP(ts)->tcp_source_be16 = socks[i].lport;
+    ts->s.cp.lport_be16 = socks[i].lport;
+    ci_tcp_set_peer(ts, socks[i].raddr, socks[i].rport);
+    sock_id[i] = S_SP(ts);
+  }
+  return 0;
+}
+
+
+static int new_insert(const struct key* k)
+{
+  return ci_netif_filter_insert(&fn.ni, sock_id[k->id], AF_SPACE_FLAG_IP4,
+                                CI_ADDR_FROM_IP4(k->laddr), k->lport,
+                                CI_ADDR_FROM_IP4(k->raddr), k->rport,
+                                IPPROTO_TCP);
+}
+
+
+static void new_remove(const struct key* k)
+{
+  ci_netif_filter_remove(&fn.ni, sock_id[k->id], AF_SPACE_FLAG_IP4,
+                         CI_ADDR_FROM_IP4(k->laddr), k->lport,
+                         CI_ADDR_FROM_IP4(k->raddr), k->rport, IPPROTO_TCP);
+}
+
+
+static int new_lookup(const struct key* k)
+{
+  return ci_netif_filter_lookup(&fn.ni, k->laddr, k->lport, k->raddr,
+                                k->rport, IPPROTO_TCP);
+}
+
+
+/* Walks the table as ci_netif_filter_lookup() does, counting the buckets
+ * visited and the sockets dereferenced.  This is kept out of the timed
+ * loop, which uses the stack's own lookup.
+ */
+static int new_lookup_count(const struct key* k, unsigned* probes,
+                            unsigned* derefs)
+{
+  ci_netif* ni = &fn.ni;
+  ci_netif_filter_table* tbl = ni->filter_table;
+  unsigned bucket_mask = FILTER_BUCKET_MASK(tbl);
+  unsigned bucket_i, bucket2, hash2, tag;
+  ci_netif_filter_table_bucket* bucket;
+  ci_uint32 match;
+  int hops;
+
+  bucket_i = FILTER_BUCKET_FIRST(onload_hash1(AF_INET, tbl->table_size_mask,
+                                              &k->laddr, k->lport,
+                                              &k->raddr, k->rport,
+                                              IPPROTO_TCP));
+  hash2 = onload_hash2(AF_INET, &k->laddr, k->lport, &k->raddr, k->rport,
+                       IPPROTO_TCP);
+  tag = onload_hash_tag(hash2);
+  bucket2 = ci_netif_filter_alt_bucket(bucket_i, tag, bucket_mask);
+
+  for( hops = 0; ; ++hops ) {
+    bucket = &tbl->bucket[bucket_i];
+    ++*probes;
+    match = onload_hash_tag_match(bucket->hdr.tags, tag);
+    while( match ) {
+      int way = ci_netif_filter_next_way(&match);
+      ci_sock_cmn* s = ID_TO_SOCK(ni, bucket->entry[way].id);
+      ++*derefs;
+      if( ((k->laddr    - bucket->entry[way].laddr) |
+           (k->lport    - sock_lport_be16(s)      ) |
+           (k->raddr    - sock_raddr_be32(s)      ) |
+           (k->rport    - sock_rport_be16(s)      ) |
+           (IPPROTO_TCP - sock_protocol(s)        )) == 0 )
+        return FILTER_ID(bucket_i, way);
+    }
+    if( hops == 0 ) {
+      bucket_i = bucket2;
+      continue;
+    }
+    if( bucket->hdr.route_count == 0 )
+      break;
+    bucket_i = (bucket_i + hash2) & bucket_mask;
+    if( bucket_i == bucket2 )
+      return -ELOOP;
+  }
+  return -ENOENT;
+}
+
+
+static void new_reset_stats(void)
+{
+#if CI_CFG_STATS_NETIF
+  ci_netif_stats* st = &fn.ni.state->stats;
+  st->table_max_hops = 0;
+  st->table_mean_hops = 0;
+  st->sw_filter_insert_moves = 0;
+  st->sw_filter_insert_table_full = 0;
+#endif
+}
+
+
+/**********************************************************************
+ * Driver.
+ */
+
+static ci_uint32 rnd_state = 0x12345678;
+
+static ci_uint32 rnd(void)
+{
+  /* xorshift32: deterministic so that runs are comparable. */
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 17;
+  rnd_state ^= rnd_state << 5;
+  return rnd_state;
+}
+
+
+/* Connections from a handful of clients to one listening port, spread
+ * over many local addresses.  The stack's sockets hold the ports and the
+ * remote address, so each socket is shared by many keys.
+ */
+static void make_socks(struct sock* socks, int n_socks)
+{
+  int i;
+
+  for( i = 0; i < n_socks; ++i ) {
+    socks[i].raddr = htonl(0xc0a81000 | (rnd() & 0xff));
+    socks[i].lport = htons(8080);
+    socks[i].rport = htons(1024 + (rnd() % 64000));
+    socks[i].protocol = IPPROTO_TCP;
+  }
+}
+
+
+static void make_key(struct key* k, const struct sock* socks, int n_socks)
+{
+  k->id = rnd() % n_socks;
+  k->laddr = htonl(0x0a000000 | (rnd() & 0xffffff));
+  k->lport = socks[k->id].lport;
+  k->raddr = socks[k->id].raddr;
+  k->rport = socks[k->id].rport;
+}
+
+
+static double now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static void usage(void)
+{
+  fprintf(stderr, "usage:\n");
+  fprintf(stderr, "  filter_table_bench [options]\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "options:\n");
+  fprintf(stderr, "  -s SIZE_LG2  - log2 of number of table entries "
+          "(default 14)\n");
+  fprintf(stderr, "  -n LOOKUPS   - lookups per measurement "
+          "(default 1000000)\n");
+  fprintf(stderr, "  -m MISS_PCT  - percentage of lookups for absent keys "
+          "(default 10)\n");
+  exit(1);
+}
+
+
+int main(int argc, char* argv[])
+{
+  static const int load_pct[] = { 25, 50, 75, 90, 95 };
+  int size_lg2 = 14, n_lookups = 1000000, miss_pct = 10;
+  unsigned size, li;
+  struct sock* socks;
+  char buf[32];
+  int c, rc, n_socks;
+
+  while( (c = getopt(argc, argv, "s:n:m:")) != -1 )
+    switch( c ) {
+    case 's':
+      size_lg2 = atoi(optarg);
+      break;
+    case 'n':
+      n_lookups = atoi(optarg);
+      break;
+    case 'm':
+      miss_pct = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  if( optind != argc || size_lg2 < 4 || size_lg2 > 22 ||
+      n_lookups <= 0 || miss_pct < 0 || miss_pct > 100 )
+    usage();
+  size = 1u << size_lg2;
+
+  /* The stack's filter table has two entries per endpoint. */
+  snprintf(buf, sizeof(buf), "%u", size / 2);
+  setenv("EF_MAX_ENDPOINTS", buf, 1);
+  if( (rc = fake_netif_ctor(&fn, "filter_table_bench")) < 0 ) {
+    fprintf(stderr, "ERROR: failed to build stack (%d)\n", rc);
+    return 1;
+  }
+  if( fn.ni.filter_table->table_size_mask + 1 != size ) {
+    fprintf(stderr, "ERROR: stack has %u filter table entries, not %u\n",
+            fn.ni.filter_table->table_size_mask + 1, size);
+    fake_netif_dtor(&fn);
+    return 1;
+  }
+
+  n_socks = CI_MIN(size / 4, 4096);
+  socks = calloc(n_socks, sizeof(*socks));
+  sock_id = calloc(n_socks, sizeof(*sock_id));
+  make_socks(socks, n_socks);
+  if( new_init(socks, n_socks) < 0 ) {
+    fprintf(stderr, "ERROR: failed to create sockets\n");
+    fake_netif_dtor(&fn);
+    return 1;
+  }
+
+  printf("# entries=%u sockets=%d lookups=%d miss=%d%%\n", size, n_socks,
+         n_lookups, miss_pct);
+  printf("# %5s  %-6s %8s %8s %8s\n", "load", "table", "probes", "derefs",
+         "ns");
+
+  for( li = 0; li < sizeof(load_pct) / sizeof(load_pct[0]); ++li ) {
+    int n_flows = (int) ((ci_uint64) size * load_pct[li] / 100);
+    struct key* flows = calloc(n_flows, sizeof(*flows));
+    struct key* queries = calloc(n_lookups, sizeof(*queries));
+    struct old_table old;
+    unsigned old_probes = 0, old_derefs = 0;
+    unsigned new_probes = 0, new_derefs = 0;
+    double old_ns, new_ns, t0;
+    int i, found = 0, full = 0, miscounted = 0;
+
+    old_init(&old, size_lg2);
+    new_reset_stats();
+
+    rnd_state = 0x12345678 + li;
+    for( i = 0; i < n_flows; ++i ) {
+      make_key(&flows[i], socks, n_socks);
+      old_insert(&old, &flows[i]);
+      full += new_insert(&flows[i]) < 0;
+    }
+
+    /* Replace every flow once. */
+    for( i = 0; i < n_flows; ++i ) {
+      old_remove(&old, &flows[i]);
+      new_remove(&flows[i]);
+      make_key(&flows[i], socks, n_socks);
+      old_insert(&old, &flows[i]);
+      full += new_insert(&flows[i]) < 0;
+    }
+
+    for( i = 0; i < n_lookups; ++i ) {
+      if( (int) (rnd() % 100) < miss_pct )
+        make_key(&queries[i], socks, n_socks);
+      else
+        queries[i] = flows[rnd() % n_flows];
+    }
+
+    t0 = now_ns();
+    for( i = 0; i < n_lookups; ++i )
+      found += old_lookup(&old, socks, &queries[i],
+                          &old_probes, &old_derefs) >= 0;
+    old_ns = (now_ns() - t0) / n_lookups;
+
+    t0 = now_ns();
+    for( i = 0; i < n_lookups; ++i )
+      found -= new_lookup(&queries[i]) >= 0;
+    new_ns = (now_ns() - t0) / n_lookups;
+
+    for( i = 0; i < n_lookups; ++i )
+      if( new_lookup_count(&queries[i], &new_probes, &new_derefs) !=
+          new_lookup(&queries[i]) )
+        ++miscounted;
+
+    if( found != 0 )
+      fprintf(stderr, "WARNING: tables disagree on %d lookups\n", found);
+    if( miscounted != 0 )
+      fprintf(stderr, "WARNING: counted walk disagrees with the stack's "
+              "lookup on %d keys\n", miscounted);
+    if( full != 0 )
+      fprintf(stderr, "WARNING: %d inserts found the stack's table full\n",
+              full);
+
+    printf("  %4d%%  %-6s %8.2f %8.2f %8.1f\n", load_pct[li], "double",
+           (double) old_probes / n_lookups, (double) old_derefs / n_lookups,
+           old_ns);
+    printf("  %4d%%  %-6s %8.2f %8.2f %8.1f\n", load_pct[li], "bucket",
+           (double) new_probes / n_lookups, (double) new_derefs / n_lookups,
+           new_ns);
+#if CI_CFG_STATS_NETIF
+    printf("#        insert max_hops=%u moves=%u overflowed_buckets=%u\n",
+           fn.ni.state->stats.table_max_hops,
+           fn.ni.state->stats.sw_filter_insert_moves,
+           fn.ni.state->stats.table_n_overflowed);
+#endif
+
+    for( i = 0; i < n_flows; ++i )
+      new_remove(&flows[i]);
+    free(old.table);
+    free(queries);
+    free(flows);
+  }
+
+  free(sock_id);
+  free(socks);
+  fake_netif_dtor(&fn);
+  return 0;
+}
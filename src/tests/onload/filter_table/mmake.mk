@@ -0,0 +1,29 @@
+TEST_APPS	:= filter_table_bench
+TARGETS		:= $(TEST_APPS:%=$(AppPattern))
+
+filter_table_bench := $(patsubst %,$(AppPattern),filter_table_bench)
+
+
+all: $(TARGETS)
+
+clean:
+	@$(MakeClean)
+
+
+MMAKE_LIBS	:= $(LINK_CIIP_LIB) $(LINK_CIAPP_LIB) \
+		   $(LINK_CIUL_LIB) $(LINK_CITOOLS_LIB) \
+		   $(LINK_CPLANE_LIB)
+MMAKE_LIB_DEPS	:= $(CIIP_LIB_DEPEND) $(CIAPP_LIB_DEPEND) \
+		   $(CIUL_LIB_DEPEND) $(CITOOLS_LIB_DEPEND) \
+		   $(CPLANE_LIB_DEPEND)
+
+# The stack is built by the pcap_replay harness.  Lookups are counted
+# with the table's own helpers.
+MMAKE_INCLUDE	+= -I$(TOP)/src/tests/onload/pcap_replay \
+		   -I$(TOP)/src/lib/transport/ip
+
+$(MMAKE_OBJ_PREFIX)fake_netif.o: $(TOP)/src/tests/onload/pcap_replay/fake_netif.c
+	$(MMakeCompileC)
+
+$(filter_table_bench): filter_table_bench.o fake_netif.o $(MMAKE_LIB_DEPS)
+	(libs="$(MMAKE_LIBS)"; $(MMakeLinkCApp))
@@ -1,5 +1,6 @@
 SUBDIRS	:= wire_order tproxy_preload woda_preload hwtimestamping oof \
-           sync_preload l3xudp_preload onload_remote_monitor
+           sync_preload l3xudp_preload onload_remote_monitor filter_table \
+           pcap_replay fd_lookup_bench cplane_fwd_bench
 
 OTHER_SUBDIRS	:= titchy_proxy thttp cplane_unit cplane_sysunit
 
@@ -0,0 +1,25 @@
+TEST_APPS	:= oof_churn
+TARGETS		:= $(TEST_APPS:%=$(AppPattern))
+
+oof_churn	:= $(patsubst %,$(AppPattern),oof_churn)
+
+
+all: $(TARGETS)
+
+clean:
+	@$(MakeClean)
+
+
+MMAKE_LIBS	:= $(LINK_CITOOLS_LIB)
+MMAKE_LIB_DEPS	:= $(CITOOLS_LIB_DEPEND)
+
+# The filter manager is built from the driver's sources, finding the
+# user-level onload_kernel_compat.h here in place of the driver's.
+MMAKE_INCLUDE	+= -I$(TOP)/src/tests/onload/oof -I$(TOP)/src/lib/efthrm
+
+$(MMAKE_OBJ_PREFIX)oof_filters.o: $(TOP)/src/lib/efthrm/oof_filters.c
+	(cflags="-Wno-misleading-indentation"; $(MMakeCompileC))
+
+# Socket churn through the filter manager.
+$(oof_churn): oof_churn.o oof_filters.o $(MMAKE_LIB_DEPS)
+	(libs="$(MMAKE_LIBS)"; $(MMakeLinkCApp))
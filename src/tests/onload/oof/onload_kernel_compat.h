@@ -0,0 +1,112 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  User-level stand-ins for the kernel facilities used by oof.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* The filter manager (lib/efthrm/oof_filters.c) is built into the oof test
+ * harness unmodified.  This header is found in place of the driver's
+ * onload_kernel_compat.h, and provides just what oof_filters.c needs.
+ */
+
+#ifndef __OOF_TEST_ONLOAD_KERNEL_COMPAT_H__
+#define __OOF_TEST_ONLOAD_KERNEL_COMPAT_H__
+
+#include <ci/tools.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+
+typedef struct {
+  pthread_spinlock_t l;
+  volatile int       locked;
+} spinlock_t;
+
+static inline void spin_lock_init(spinlock_t* s)
+{
+  pthread_spin_init(&s->l, PTHREAD_PROCESS_PRIVATE);
+  s->locked = 0;
+}
+
+static inline void spin_lock_bh(spinlock_t* s)
+{
+  pthread_spin_lock(&s->l);
+  s->locked = 1;
+}
+
+static inline void spin_unlock_bh(spinlock_t* s)
+{
+  s->locked = 0;
+  pthread_spin_unlock(&s->l);
+}
+
+#define spin_is_locked(s)  ((s)->locked)
+
+
+struct mutex {
+  pthread_mutex_t m;
+  volatile int    locked;
+};
+
+static inline void mutex_init(struct mutex* m)
+{
+  pthread_mutex_init(&m->m, NULL);
+  m->locked = 0;
+}
+
+static inline void mutex_destroy(struct mutex* m)
+{
+  pthread_mutex_destroy(&m->m);
+}
+
+static inline void mutex_lock(struct mutex* m)
+{
+  pthread_mutex_lock(&m->m);
+  m->locked = 1;
+}
+
+static inline void mutex_unlock(struct mutex* m)
+{
+  m->locked = 0;
+  pthread_mutex_unlock(&m->m);
+}
+
+#define mutex_is_locked(m)  ((m)->locked)
+
+
+#define in_atomic()     0
+#define in_interrupt()  0
+
+#define BUG_ON(c)       ci_assert(! (c))
+
+
+#define CAP_NET_RAW     13
+#define capable(cap)    1
+#define ns_capable(ns, cap)  1
+#define ci_getgid()     getgid()
+
+
+/* Only used for /proc output, which the harness does not do. */
+struct seq_file;
+#define seq_printf(seq, ...)  do{ (void) (seq); }while(0)
+
+
+#endif  /* __OOF_TEST_ONLOAD_KERNEL_COMPAT_H__ */
@@ -0,0 +1,487 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Socket churn through the oof filter manager, at user level.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* Links the filter manager (lib/efthrm/oof_filters.c) against stand-ins for
+ * the stacks, the s/w filter tables and the h/w filters, and drives it with
+ * synthetic sockets from several threads:
+ *
+ *   accept:  A listening socket on port 80, and threads that add and remove
+ *            connected sockets sharing its filter, as when accepting.
+ *   connect: Threads that add and remove connected sockets, each with its
+ *            own ephemeral port and h/w filter, as when connecting out.
+ *   mixed:   Half the threads accepting and half connecting, so that
+ *            accepts contend with h/w filter operations.
+ *
+ * Each thread keeps [-l] sockets alive and replaces the oldest one on each
+ * iteration.  H/w filter operations take [-H] microseconds, as the real
+ * ones are not cheap.  Reports socket adds and removes per second.
+ *
+ * Usage: oof_churn [-t threads] [-n iterations] [-l live_per_thread]
+ *                  [-H hw_filter_usec] accept|connect|mixed
+ */
+
+#define _GNU_SOURCE
+#include "onload_kernel_compat.h"
+#include <onload/oof_interface.h>
+#include <onload/oof_hw_filter.h>
+#include <onload/oof_socket.h>
+#include "oo_hw_filter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <netinet/in.h>
+
+
+struct tcp_helper_resource_s {
+  int id;
+};
+
+
+struct churn_sock {
+  struct oof_socket             skf;
+  struct tcp_helper_resource_s* stack;
+  int                           id;
+};
+
+
+struct churn_thread {
+  pthread_t          tid;
+  int                index;
+  int                connect;
+  struct churn_sock* socks;
+  unsigned long      n_ops;
+  double             secs;
+};
+
+
+static unsigned cfg_threads = 4;
+static unsigned long cfg_iters = 200000;
+static unsigned cfg_live = 1000;
+static unsigned cfg_hw_usec = 10;
+static enum { MODE_ACCEPT, MODE_CONNECT, MODE_MIXED } cfg_mode;
+
+#define LOCAL_IP    CI_BSWAP_BE32(0x0a000001)   /* 10.0.0.1 */
+#define LISTEN_PORT CI_BSWAP_BE16(80)
+
+static struct oof_manager* fm;
+static struct tcp_helper_resource_s* stacks;
+static pthread_barrier_t barrier;
+static unsigned long n_hw_ops;
+
+int oo_debug_bits = 0;
+int oof_all_ports_required = 1;
+
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: oof_churn [-t threads] [-n iterations] "
+          "[-l live_per_thread] [-H hw_filter_usec] "
+          "accept|connect|mixed\n");
+  exit(1);
+}
+
+
+static void hw_delay(void)
+{
+  struct timespec start, now;
+  if( cfg_hw_usec == 0 )
+    return;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  do
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  while( (now.tv_sec - start.tv_sec) * 1000000 +
+         (now.tv_nsec - start.tv_nsec) / 1000 < cfg_hw_usec );
+}
+
+
+/**********************************************************************
+ * Stand-ins for the h/w filter module.  These are only called with
+ * [fm_outer_lock] held, which protects [n_hw_ops].
+ */
+
+void oo_hw_filter_init(struct oo_hw_filter* oofilter)
+{
+  oo_hw_filter_init2(oofilter, NULL, NULL);
+}
+
+void oo_hw_filter_init2(struct oo_hw_filter* oofilter,
+                        struct tcp_helper_resource_s* trs,
+                        struct tcp_helper_cluster_s* thc)
+{
+  int i;
+  oofilter->trs = trs;
+  oofilter->thc = thc;
+  oofilter->dlfilter_handle = 0;
+  for( i = 0; i < CI_CFG_MAX_HWPORTS; ++i )
+    oofilter->filter_id[i] = -1;
+}
+
+void oo_hw_filter_clear_hwports(struct oo_hw_filter* oofilter,
+                                unsigned hwport_mask, int redirect)
+{
+  int i, n = 0;
+  for( i = 0; i < CI_CFG_MAX_HWPORTS; ++i )
+    if( (hwport_mask & (1u << i)) && oofilter->filter_id[i] >= 0 ) {
+      oofilter->filter_id[i] = -1;
+      ++n;
+    }
+  if( n ) {
+    ++n_hw_ops;
+    hw_delay();
+  }
+}
+
+void oo_hw_filter_clear(struct oo_hw_filter* oofilter)
+{
+  oo_hw_filter_clear_hwports(oofilter, -1, 0);
+  oofilter->trs = NULL;
+  oofilter->thc = NULL;
+}
+
+int oo_hw_filter_set(struct oo_hw_filter* oofilter,
+                     const struct oo_hw_filter_spec* oo_filter_spec,
+                     unsigned set_vlan_mask, unsigned hwport_mask,
+                     unsigned drop_hwport_mask, unsigned src_flags)
+{
+  int i;
+  for( i = 0; i < CI_CFG_MAX_HWPORTS; ++i )
+    if( hwport_mask & (1u << i) )
+      oofilter->filter_id[i] = i;
+  ++n_hw_ops;
+  hw_delay();
+  return 0;
+}
+
+int oo_hw_filter_update(struct oo_hw_filter* oofilter,
+                        struct tcp_helper_resource_s* new_stack,
+                        const struct oo_hw_filter_spec* oo_filter_spec,
+                        unsigned set_vlan_mask, unsigned hwport_mask,
+                        unsigned drop_hwport_mask, unsigned src_flags)
+{
+  oofilter->trs = new_stack;
+  ++n_hw_ops;
+  hw_delay();
+  return 0;
+}
+
+void oo_hw_filter_transfer(struct oo_hw_filter* oofilter_old,
+                           struct oo_hw_filter* oofilter_new,
+                           unsigned hwport_mask)
+{
+}
+
+unsigned oo_hw_filter_hwports(struct oo_hw_filter* oofilter)
+{
+  unsigned mask = 0;
+  int i;
+  for( i = 0; i < CI_CFG_MAX_HWPORTS; ++i )
+    if( oofilter->filter_id[i] >= 0 )
+      mask |= 1u << i;
+  return mask;
+}
+
+
+/**********************************************************************
+ * Callbacks from the filter manager.
+ */
+
+struct tcp_helper_resource_s* oof_cb_socket_stack(struct oof_socket* skf)
+{
+  return CI_CONTAINER(struct churn_sock, skf, skf)->stack;
+}
+
+struct tcp_helper_cluster_s*
+oof_cb_stack_thc(struct tcp_helper_resource_s* skf_stack)
+{
+  return NULL;
+}
+
+void oof_cb_thc_ref(struct tcp_helper_cluster_s* thc)
+{
+}
+
+const char* oof_cb_thc_name(struct tcp_helper_cluster_s* thc)
+{
+  return "";
+}
+
+int oof_cb_socket_id(struct oof_socket* skf)
+{
+  return CI_CONTAINER(struct churn_sock, skf, skf)->id;
+}
+
+int oof_cb_stack_id(struct tcp_helper_resource_s* stack)
+{
+  return stack == NULL ? -1 : stack->id;
+}
+
+void oof_cb_callback_set_filter(struct oof_socket* skf)
+{
+}
+
+int oof_cb_sw_filter_insert(struct oof_socket* skf, int af,
+                            const ci_addr_t laddr, int lport,
+                            const ci_addr_t raddr, int rport,
+                            int protocol, int stack_locked)
+{
+  return 0;
+}
+
+void oof_cb_sw_filter_remove(struct oof_socket* skf, int af,
+                             const ci_addr_t laddr, int lport,
+                             const ci_addr_t raddr, int rport,
+                             int protocol, int stack_locked)
+{
+}
+
+void oof_dl_filter_set(struct oo_hw_filter* filter, int stack_id,
+                       int protocol, unsigned saddr, int sport,
+                       unsigned daddr, int dport)
+{
+}
+
+void oof_dl_filter_del(struct oo_hw_filter* filter)
+{
+}
+
+void oof_cb_defer_work(void* owner_private)
+{
+}
+
+int oof_cb_add_global_tproxy_filter(struct oo_hw_filter_spec* filter,
+                                    int proto, unsigned hwport_mask,
+                                    unsigned* installed_hwport_mask,
+                                    void* owner_priv)
+{
+  return 0;
+}
+
+int oof_cb_remove_global_tproxy_filter(int proto, unsigned hwport_mask,
+                                       unsigned* installed_hwport_mask,
+                                       void* owner_priv)
+{
+  return 0;
+}
+
+
+/**********************************************************************
+ * The churn.
+ */
+
+static void sock_add(struct churn_thread* t, unsigned i, unsigned long gen)
+{
+  struct churn_sock* cs = &t->socks[i];
+  ci_addr_t laddr = CI_ADDR_FROM_IP4(LOCAL_IP);
+  ci_addr_t raddr;
+  int lport, rport, rc;
+
+  /* Remote addresses differ between threads and between the generations
+   * of each slot, so that no two live sockets have the same 4-tuple.
+   */
+  raddr = CI_ADDR_FROM_IP4(CI_BSWAP_BE32(0x0b000000 | (t->index << 16) |
+                                         (gen & 0xffff)));
+  rport = CI_BSWAP_BE16(1024 + i);
+  if( t->connect )
+    lport = CI_BSWAP_BE16(1024 + t->index * cfg_live + i);
+  else
+    lport = LISTEN_PORT;
+
+  rc = oof_socket_add(fm, &cs->skf, 0, IPPROTO_TCP, AF_SPACE_FLAG_IP4,
+                      laddr, lport, raddr, rport, NULL);
+  if( rc != 0 ) {
+    fprintf(stderr, "oof_churn: thread %d: oof_socket_add failed (%d)\n",
+            t->index, rc);
+    exit(1);
+  }
+}
+
+
+static void sock_del(struct churn_thread* t, unsigned i)
+{
+  oof_socket_del(fm, &t->socks[i].skf);
+}
+
+
+static double timespec_secs(const struct timespec* a, const struct timespec* b)
+{
+  return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+
+static void* churn_thread_fn(void* arg)
+{
+  struct churn_thread* t = arg;
+  struct timespec start, end;
+  unsigned long n;
+  unsigned i;
+
+  for( i = 0; i < cfg_live; ++i )
+    sock_add(t, i, 0);
+  /* Let main() take its measurements before and after the churn. */
+  pthread_barrier_wait(&barrier);
+  pthread_barrier_wait(&barrier);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for( n = 0; n < cfg_iters; ++n ) {
+    i = n % cfg_live;
+    sock_del(t, i);
+    sock_add(t, i, n / cfg_live + 1);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  t->n_ops = cfg_iters * 2;
+  t->secs = timespec_secs(&start, &end);
+
+  pthread_barrier_wait(&barrier);
+  pthread_barrier_wait(&barrier);
+  for( i = 0; i < cfg_live; ++i )
+    sock_del(t, i);
+  return NULL;
+}
+
+
+static void report(struct churn_thread* threads, int connect)
+{
+  unsigned long n_ops = 0;
+  double secs = 0;
+  unsigned i, n = 0;
+
+  for( i = 0; i < cfg_threads; ++i )
+    if( threads[i].connect == connect ) {
+      n_ops += threads[i].n_ops;
+      secs = CI_MAX(secs, threads[i].secs);
+      ++n;
+    }
+  if( n == 0 )
+    return;
+  printf("  %s: %u threads, %lu socket adds+removes in %.3fs: "
+         "%.0f ops/sec\n", connect ? "connect" : "accept", n, n_ops, secs,
+         n_ops / secs);
+}
+
+
+int main(int argc, char* argv[])
+{
+  struct churn_thread* threads;
+  struct churn_sock listener;
+  ci_mac_addr_t mac = { 0 };
+  unsigned long hw_ops_start, hw_ops_end;
+  const char* mode;
+  unsigned i, j;
+  int c, rc;
+
+  while( (c = getopt(argc, argv, "t:n:l:H:")) != -1 )
+    switch( c ) {
+    case 't':  cfg_threads = atoi(optarg);  break;
+    case 'n':  cfg_iters = strtoul(optarg, NULL, 0);  break;
+    case 'l':  cfg_live = atoi(optarg);  break;
+    case 'H':  cfg_hw_usec = atoi(optarg);  break;
+    default:   usage();
+    }
+  if( optind != argc - 1 || cfg_threads == 0 || cfg_live == 0 )
+    usage();
+  mode = argv[optind];
+  if( ! strcmp(mode, "accept") )
+    cfg_mode = MODE_ACCEPT;
+  else if( ! strcmp(mode, "connect") )
+    cfg_mode = MODE_CONNECT;
+  else if( ! strcmp(mode, "mixed") )
+    cfg_mode = MODE_MIXED;
+  else
+    usage();
+  if( 1024 + cfg_threads * cfg_live > 65535 )
+    usage();
+
+  CI_TEST(fm = oof_manager_alloc(4, NULL));
+  oof_mcast_update_interface(1, 1, 1, 0, mac, fm);
+  oof_hwport_up_down(fm, 0, 1, 0, 0, 1);
+  oof_manager_addr_add(fm, AF_INET, CI_ADDR_FROM_IP4(LOCAL_IP), 1);
+
+  /* Accepting threads all use the listener's stack, stack 0.  Connecting
+   * threads each have a stack of their own.
+   */
+  CI_TEST(stacks = calloc(cfg_threads, sizeof(stacks[0])));
+  for( i = 0; i < cfg_threads; ++i )
+    stacks[i].id = i;
+
+  memset(&listener, 0, sizeof(listener));
+  oof_socket_ctor(&listener.skf);
+  listener.stack = &stacks[0];
+  if( cfg_mode != MODE_CONNECT ) {
+    rc = oof_socket_add(fm, &listener.skf, 0, IPPROTO_TCP, AF_SPACE_FLAG_IP4,
+                        addr_any, LISTEN_PORT, addr_any, 0, NULL);
+    if( rc != 0 ) {
+      fprintf(stderr, "oof_churn: listen failed (%d)\n", rc);
+      return 1;
+    }
+  }
+
+  CI_TEST(threads = calloc(cfg_threads, sizeof(threads[0])));
+  for( i = 0; i < cfg_threads; ++i ) {
+    struct churn_thread* t = &threads[i];
+    t->index = i;
+    t->connect = cfg_mode == MODE_CONNECT ||
+                 (cfg_mode == MODE_MIXED && (i & 1));
+    CI_TEST(t->socks = calloc(cfg_live, sizeof(struct churn_sock)));
+    for( j = 0; j < cfg_live; ++j ) {
+      oof_socket_ctor(&t->socks[j].skf);
+      t->socks[j].stack = &stacks[t->connect ? i : 0];
+      t->socks[j].id = j;
+    }
+  }
+
+  pthread_barrier_init(&barrier, NULL, cfg_threads + 1);
+  for( i = 0; i < cfg_threads; ++i )
+    CI_TRY(pthread_create(&threads[i].tid, NULL, churn_thread_fn,
+                          &threads[i]));
+  pthread_barrier_wait(&barrier);
+  hw_ops_start = n_hw_ops;
+  pthread_barrier_wait(&barrier);
+  pthread_barrier_wait(&barrier);
+  hw_ops_end = n_hw_ops;
+  pthread_barrier_wait(&barrier);
+  for( i = 0; i < cfg_threads; ++i )
+    pthread_join(threads[i].tid, NULL);
+
+  printf("%s: threads=%u live=%u hw_filter_usec=%u\n",
+         mode, cfg_threads, cfg_threads * cfg_live, cfg_hw_usec);
+  report(threads, 0);
+  report(threads, 1);
+  printf("  %lu h/w filter operations\n", hw_ops_end - hw_ops_start);
+
+  if( cfg_mode != MODE_CONNECT )
+    oof_socket_del(fm, &listener.skf);
+  for( i = 0; i < cfg_threads; ++i ) {
+    for( j = 0; j < cfg_live; ++j )
+      oof_socket_dtor(&threads[i].socks[j].skf);
+    free(threads[i].socks);
+  }
+  oof_socket_dtor(&listener.skf);
+  oof_manager_addr_del(fm, AF_INET, CI_ADDR_FROM_IP4(LOCAL_IP), 1);
+  oof_manager_free(fm);
+  free(threads);
+  free(stacks);
+  return 0;
+}
@@ -0,0 +1,172 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Check the chain of epoll state behind a socket's ready lists.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* A socket's state for each ready list it is in lives in a chain of epoll
+ * aux buffers, walked by ci_sb_epoll_seek().  We give a socket a chain
+ * covering every ready list, then:
+ *
+ *  - put it on every ready list, and check that each list holds the link
+ *    for that list from that socket's state;
+ *  - cut the chain short, as the kernel might find it in shared state,
+ *    and check that the lists beyond the cut are reported as an error and
+ *    skipped rather than followed through a NULL link;
+ *  - remove the socket from epoll and check that the whole chain is freed.
+ */
+
+#define _GNU_SOURCE
+#include "fake_netif.h"
+#include "../test_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define N_AUX  (CI_CFG_N_READY_LISTS / CI_EPOLL_SETS_PER_AUX_BUF)
+
+static struct fake_netif fn;
+
+
+
+/* As citp_epoll_sb_state_alloc() does, one aux buffer at a time. */
+static int chain_build(ci_netif* ni, citp_waitable* w)
+{
+  ci_sb_epoll_state* epoll;
+  oo_p* slot = &w->epoll;
+  oo_p sp;
+  int i, j;
+
+  for( i = 0; i < N_AUX; ++i ) {
+    sp = ci_ni_aux_alloc(ni, CI_TCP_AUX_TYPE_EPOLL);
+    if( OO_P_IS_NULL(sp) )
+      return -ENOMEM;
+    epoll = ci_ni_aux_p2epoll(ni, sp);
+    epoll->sock_id = w->bufid;
+    epoll->next = OO_P_NULL;
+    *slot = sp;
+    slot = &epoll->next;
+    OO_P_ADD(sp, CI_MEMBER_OFFSET(ci_ni_aux_mem, u.epoll));
+    for( j = 0; j < CI_EPOLL_SETS_PER_AUX_BUF; ++j ) {
+      ci_ni_dllist_link_init(ni, &epoll->e[j].ready_link, sp, "rll");
+      ci_ni_dllist_self_link(ni, &epoll->e[j].ready_link);
+      OO_P_ADD(sp, sizeof(oo_sb_epoll));
+    }
+  }
+  return 0;
+}
+
+
+static int on_ready_list(ci_netif* ni, citp_waitable* w, unsigned id)
+{
+  ci_ni_dllist_t* list = &ni->state->ready_lists[id];
+  ci_ni_dllist_link* lnk;
+
+  if( ci_ni_dllist_is_empty(ni, list) )
+    return 0;
+  lnk = ci_ni_dllist_head(ni, list);
+  return lnk == &ci_sb_epoll_get(ni, w, id)->ready_link &&
+    ci_sb_epoll_link2state(lnk, id)->sock_id == w->bufid;
+}
+
+
+static void test_all_lists(ci_netif* ni, citp_waitable* w)
+{
+  unsigned id;
+
+  w->ready_lists_in_use = CI_READY_LISTS_MASK;
+  ci_netif_put_on_post_poll_epoll(ni, w);
+  for( id = 0; id < CI_CFG_N_READY_LISTS; ++id )
+    CHECK(on_ready_list(ni, w, id));
+
+  citp_waitable_remove_from_epoll(ni, w, 0);
+  CHECK(w->ready_lists_in_use == 0);
+  for( id = 0; id < CI_CFG_N_READY_LISTS; ++id )
+    CHECK(ci_ni_dllist_is_empty(ni, &ni->state->ready_lists[id]));
+  CHECK((ni->state->error_flags & CI_NETIF_ERROR_EPOLL_CHAIN) == 0);
+}
+
+
+static void test_short_chain(ci_netif* ni, citp_waitable* w)
+{
+  ci_sb_epoll_state* cut = ci_ni_aux_p2epoll(ni, w->epoll);
+  ci_sb_epoll_state* epoll;
+  unsigned base = 0, last = CI_CFG_N_READY_LISTS - 1;
+  oo_p rest;
+
+  /* Keep only the first aux buffer. */
+  rest = cut->next;
+  cut->next = OO_P_NULL;
+
+  w->ready_lists_in_use = 1u | 1u << last;
+  ci_netif_put_on_post_poll_epoll(ni, w);
+  CHECK(on_ready_list(ni, w, 0));
+  CHECK(ci_ni_dllist_is_empty(ni, &ni->state->ready_lists[last]));
+  CHECK(ni->state->error_flags & CI_NETIF_ERROR_EPOLL_CHAIN);
+
+  epoll = cut;
+  CHECK(ci_sb_epoll_seek(ni, &epoll, &base, CI_EPOLL_SETS_PER_AUX_BUF - 1)
+        != NULL);
+  CHECK(ci_sb_epoll_seek(ni, &epoll, &base, CI_EPOLL_SETS_PER_AUX_BUF)
+        == NULL);
+
+  citp_waitable_remove_from_epoll(ni, w, 0);
+  CHECK(ci_ni_dllist_is_empty(ni, &ni->state->ready_lists[0]));
+  cut->next = rest;
+}
+
+
+int main(int argc, char* argv[])
+{
+  ci_netif* ni;
+  ci_tcp_state* ts;
+  citp_waitable* w;
+  int rc;
+
+  if( (rc = fake_netif_ctor(&fn, "epoll_chain_test")) < 0 ) {
+    fprintf(stderr, "ERROR: failed to build stack (%d)\n", rc);
+    return 1;
+  }
+  ni = &fn.ni;
+  if( (ts = ci_tcp_get_state_buf(ni)) == NULL ) {
+    fprintf(stderr, "ERROR: failed to allocate socket\n");
+    fake_netif_dtor(&fn);
+    return 1;
+  }
+  w = &ts->s.b;
+  if( (rc = chain_build(ni, w)) < 0 ) {
+    fprintf(stderr, "ERROR: failed to allocate epoll state (%d)\n", rc);
+    fake_netif_dtor(&fn);
+    return 1;
+  }
+  CHECK(ni->state->n_aux_bufs[CI_TCP_AUX_TYPE_EPOLL] == N_AUX);
+
+  test_all_lists(ni, w);
+  /* This one logs the runtime error that it provokes. */
+  test_short_chain(ni, w);
+
+  citp_waitable_remove_from_epoll(ni, w, 1);
+  CHECK(OO_PP_IS_NULL(w->epoll));
+  CHECK(ni->state->n_aux_bufs[CI_TCP_AUX_TYPE_EPOLL] == 0);
+
+  fake_netif_dtor(&fn);
+  return test_check_result();
+}
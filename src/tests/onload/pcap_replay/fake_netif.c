@@ -0,0 +1,835 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  A user-level stack with no driver, for offline testing.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* We play the part of the driver, so need to write fields of the shared
+ * state that are otherwise read-only at user level.
+ */
+#define CI_ULCONST
+
+#include "fake_netif.h"
+#include <onload/cplane_ops.h>
+#include <etherfabric/ef_vi.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+#define PEER_BUF_SIZE    2048
+
+/* As EMPTY in lib/transport/ip/netif_table.h. */
+#define FILTER_ID_EMPTY  -2
+
+
+/* Options that need the driver, or that we have not laid out space for,
+ * are turned off.
+ */
+static void fake_netif_opts(ci_netif_config_opts* opts)
+{
+  ci_netif_config_opts_defaults(opts);
+  ci_netif_config_opts_getenv(opts);
+  ci_netif_config_opts_rangecheck(opts);
+
+  opts->int_driven = 0;
+  opts->tcp_shared_local_ports = 0;
+  opts->tcp_shared_local_ports_max = 0;
+  opts->scalable_filter_enable = 0;
+#if CI_CFG_UDP
+  opts->udp_tx_stage_ring = 0;
+#endif
+#if CI_CFG_LAT_HIST
+  opts->latency_hist = 0;
+#endif
+#if CI_CFG_PIO
+  opts->pio = 0;
+#endif
+#if CI_CFG_CTPIO
+  opts->ctpio = 0;
+#endif
+#if CI_CFG_SEPARATE_UDP_RXQ
+  opts->separate_udp_rxq = 0;
+#endif
+}
+
+
+static void* fake_netif_mmap(size_t bytes)
+{
+  void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return p == MAP_FAILED ? NULL : p;
+}
+
+
+/* Lay out the shared state as allocate_netif_resources() does in the
+ * driver, with the endpoint buffers immediately after.
+ */
+static int fake_netif_alloc_state(struct fake_netif* fn,
+                                  const ci_netif_config_opts* opts)
+{
+  ci_netif* ni = &fn->ni;
+  ci_netif_state* ns;
+  int no_table_entries, no_table_buckets, no_seq_table_entries;
+  unsigned vi_state_bytes, pkt_sets_max;
+  size_t filter_table_size, synrecv_table_size, sz;
+#if CI_CFG_IPV6
+  size_t ip6_filter_table_size;
+#endif
+
+  no_table_entries = opts->max_ep_bufs * 2;
+  if( opts->tcp_isn_mode == 1 )
+    no_seq_table_entries = 1u << ci_log2_ge(opts->tcp_isn_cache_size ?
+                                            opts->tcp_isn_cache_size :
+                                            opts->max_ep_bufs * 2, 1);
+  else
+    no_seq_table_entries = 0;
+  pkt_sets_max = (opts->max_packets + PKTS_PER_SET - 1) >>
+                 CI_CFG_PKTS_PER_SET_S;
+  vi_state_bytes = ef_vi_calc_state_bytes(opts->rxq_size, opts->txq_size);
+
+  no_table_buckets = CI_MAX(CI_ROUND_UP(no_table_entries,
+                                        CI_NETIF_FILTER_BUCKET_WAYS) >>
+                            CI_NETIF_FILTER_BUCKET_SHIFT, 2);
+  filter_table_size = sizeof(ci_netif_filter_table) +
+    sizeof(ci_netif_filter_table_bucket) * (no_table_buckets - 1);
+#if CI_CFG_IPV6
+  ip6_filter_table_size = sizeof(ci_ip6_netif_filter_table) +
+    sizeof(ci_ip6_netif_filter_table_bucket) * (no_table_buckets - 1);
+#endif
+
+  sz = sizeof(ci_netif_state) + vi_state_bytes +
+    sizeof(oo_pktbuf_manager) + sizeof(oo_pktbuf_set) * pkt_sets_max +
+    sizeof(ci_tcp_prev_seq_t) * no_seq_table_entries +
+    CI_CACHE_LINE_SIZE + filter_table_size;
+#if CI_CFG_IPV6
+  sz += ip6_filter_table_size;
+#endif
+  synrecv_table_size = ci_tcp_synrecv_table_bytes(
+                         ci_tcp_synrecv_table_buckets(opts->tcp_synrecv_max));
+  sz += CI_CACHE_LINE_SIZE + synrecv_table_size;
+  sz = CI_ROUND_UP(sz, CI_PAGE_SIZE);
+
+  fn->state_bytes = sz + CI_ROUND_UP(opts->max_ep_bufs * EP_BUF_SIZE,
+                                     CI_PAGE_SIZE);
+  fn->state_mem = fake_netif_mmap(fn->state_bytes);
+  if( fn->state_mem == NULL )
+    return -ENOMEM;
+
+  ns = ni->state = fn->state_mem;
+  ns->opts = *opts;
+  ns->netif_mmap_bytes = fn->state_bytes;
+  ns->ep_ofs = sz;
+  ns->nic_n = 1;
+  ns->vi_state_bytes = vi_state_bytes;
+  ns->buf_ofs = sizeof(ci_netif_state) + vi_state_bytes;
+  ns->active_wild_ofs = ns->buf_ofs + sizeof(oo_pktbuf_manager) +
+                        sizeof(oo_pktbuf_set) * pkt_sets_max;
+  ns->seq_table_ofs = ns->active_wild_ofs;
+  ns->seq_table_entries_n = no_seq_table_entries;
+  ns->table_ofs = CI_ROUND_UP(ns->seq_table_ofs +
+                              sizeof(ci_tcp_prev_seq_t) * no_seq_table_entries,
+                              CI_CACHE_LINE_SIZE);
+#if CI_CFG_IPV6
+  ns->ip6_table_ofs = ns->table_ofs + filter_table_size;
+  ns->synrecv_table_ofs = CI_ROUND_UP(ns->ip6_table_ofs +
+                                      ip6_filter_table_size,
+                                      CI_CACHE_LINE_SIZE);
+#else
+  ns->synrecv_table_ofs = CI_ROUND_UP(ns->table_ofs + filter_table_size,
+                                      CI_CACHE_LINE_SIZE);
+#endif
+
+  ni->packets = (void*) ((char*) ns + ns->buf_ofs);
+  ni->active_wild_table = (void*) ((char*) ns + ns->active_wild_ofs);
+  ni->seq_table = (void*) ((char*) ns + ns->seq_table_ofs);
+  ni->filter_table = (void*) ((char*) ns + ns->table_ofs);
+#if CI_CFG_IPV6
+  ni->ip6_filter_table = (void*) ((char*) ns + ns->ip6_table_ofs);
+#endif
+  ni->synrecv_table = (void*) ((char*) ns + ns->synrecv_table_ofs);
+  ni->packets->sets_max = pkt_sets_max;
+
+  ns->free_aux_mem = OO_P_NULL;
+  ns->max_aux_bufs[CI_TCP_AUX_TYPE_SYNRECV] = opts->tcp_synrecv_max;
+  ns->max_aux_bufs[CI_TCP_AUX_TYPE_EPOLL] =
+    opts->max_ep_bufs * CI_EPOLL_AUX_BUFS_PER_SOCK;
+
+  memset(ns->hwport_to_intf_i, -1, sizeof(ns->hwport_to_intf_i));
+  ns->hwport_to_intf_i[0] = 0;
+  ns->intf_i_to_hwport[0] = 0;
+  ns->hwport_mask = 1;
+  CI_DEBUG(ns->flags |= CI_NETIF_FLAG_DEBUG);
+  return 0;
+}
+
+
+/* As ci_netif_filter_init(), ci_ip6_netif_filter_init() and
+ * ci_tcp_synrecv_table_init(), which are built only into the driver.
+ */
+static void fake_netif_filter_init(ci_netif* ni, int size_lg2)
+{
+  unsigned size = ci_pow2(size_lg2);
+  unsigned i, way;
+
+  ni->filter_table->table_size_mask = size - 1;
+  for( i = 0; i < (size >> CI_NETIF_FILTER_BUCKET_SHIFT); ++i ) {
+    memset(&ni->filter_table->bucket[i].hdr, 0,
+           sizeof(ni->filter_table->bucket[i].hdr));
+    for( way = 0; way < CI_NETIF_FILTER_BUCKET_WAYS; ++way ) {
+      ni->filter_table->bucket[i].entry[way].id = FILTER_ID_EMPTY;
+      ni->filter_table->bucket[i].entry[way].laddr = 0;
+    }
+  }
+#if CI_CFG_IPV6
+  ni->ip6_filter_table->table_size_mask = size - 1;
+  for( i = 0; i < (size >> CI_NETIF_FILTER_BUCKET_SHIFT); ++i ) {
+    memset(&ni->ip6_filter_table->bucket[i].hdr, 0,
+           sizeof(ni->ip6_filter_table->bucket[i].hdr));
+    for( way = 0; way < CI_NETIF_FILTER_BUCKET_WAYS; ++way ) {
+      ni->ip6_filter_table->bucket[i].entry[way].id = FILTER_ID_EMPTY;
+      memset(ni->ip6_filter_table->bucket[i].entry[way].laddr, 0,
+             sizeof(ni->ip6_filter_table->bucket[i].entry[way].laddr));
+    }
+  }
+#endif
+
+  ni->synrecv_table->max_buckets =
+    ci_tcp_synrecv_table_buckets(NI_OPTS(ni).tcp_synrecv_max);
+  ni->synrecv_table->mask = CI_TCP_SYNRECV_TABLE_MIN_BUCKETS - 1;
+  ni->synrecv_table->split = 0;
+  ni->synrecv_table->n_entries = 0;
+  for( i = 0; i < ni->synrecv_table->max_buckets; ++i ) {
+    memset(ni->synrecv_table->bucket[i].tags, 0,
+           sizeof(ni->synrecv_table->bucket[i].tags));
+    ni->synrecv_table->bucket[i].overflow = OO_P_NULL;
+  }
+}
+
+
+/* The user-level equivalent of ci_netif_state_init(). */
+static void fake_netif_state_init(struct fake_netif* fn, const char* name)
+{
+  ci_netif* ni = &fn->ni;
+  ci_netif_state* ns = ni->state;
+  ci_netif_state_nic_t* nn = &ns->nic[0];
+  ef_vi* vi = &ni->nic_hw[0].vi;
+  unsigned cpu_khz;
+  int i;
+
+  ci_get_cpu_khz(&cpu_khz);
+
+  nn->vi_instance = vi->vi_i;
+  nn->vi_rxq_size = ef_vi_receive_capacity(vi);
+  nn->vi_txq_size = ef_vi_transmit_capacity(vi);
+  nn->vi_flags = vi->vi_flags;
+  nn->rx_prefix_len = ef_vi_receive_prefix_len(vi);
+  oo_pktq_init(&nn->dmaq);
+  ci_ni_dllist_init(ni, &nn->tx_ready_list,
+                    oo_ptr_to_statep(ni, &nn->tx_ready_list), "txrd");
+  nn->rx_frags = OO_PP_NULL;
+
+  ns->mem_pressure_pkt_pool = OO_PP_NULL;
+  ns->looppkts = OO_PP_NULL;
+  ns->nonb_pkt_pool = CI_ILL_END;
+  ns->nic_numa_node = -1;
+  for( i = 0; i < CI_CFG_PKT_NONB_MAGAZINES; ++i )
+    ns->nonb_magazine[i].link = CI_ILL_END;
+
+  fake_netif_filter_init(ni,
+                         CI_MAX(ci_log2_le(NI_OPTS(ni).max_ep_bufs) + 1,
+                                CI_NETIF_FILTER_BUCKET_SHIFT + 1));
+
+  ci_ni_dllist_init(ni, &ns->timeout_q[OO_TIMEOUT_Q_TIMEWAIT],
+                    oo_ptr_to_statep(ni, &ns->timeout_q[OO_TIMEOUT_Q_TIMEWAIT]),
+                    "twtq");
+  ci_ni_dllist_init(ni, &ns->timeout_q[OO_TIMEOUT_Q_FINWAIT],
+                    oo_ptr_to_statep(ni, &ns->timeout_q[OO_TIMEOUT_Q_FINWAIT]),
+                    "fwtq");
+  ci_ip_timer_init(ni, &ns->timeout_tid,
+                   oo_ptr_to_statep(ni, &ns->timeout_tid), "ttid");
+  ns->timeout_tid.param1 = OO_SP_NULL;
+  ns->timeout_tid.fn = CI_IP_TIMER_NETIF_TIMEOUT;
+#if CI_CFG_SUPPORT_STATS_COLLECTION
+  ci_ip_timer_init(ni, &ns->stats_tid,
+                   oo_ptr_to_statep(ni, &ns->stats_tid), "stat");
+  ns->stats_tid.param1 = OO_SP_NULL;
+  ns->stats_tid.fn = CI_IP_TIMER_NETIF_STATS;
+#endif
+
+  ci_ni_dllist_init(ni, &ns->reap_list,
+                    oo_ptr_to_statep(ni, &ns->reap_list), "reap");
+  ns->free_eps_head = OO_SP_NULL;
+  ns->deferred_free_eps_head = CI_ILL_END;
+  ns->accept_prealloc_head = OO_SP_NULL;
+  ns->max_ep_bufs = NI_OPTS(ni).max_ep_bufs;
+  ns->rx_defrag_head = OO_PP_NULL;
+  ns->rx_defrag_tail = OO_PP_NULL;
+
+  strncpy(ns->name, name, CI_CFG_STACK_NAME_LEN);
+  ns->name[CI_CFG_STACK_NAME_LEN] = '\0';
+  snprintf(ns->pretty_name, sizeof(ns->pretty_name), "%s", name);
+  ns->pid = getpid();
+
+  ci_ni_dllist_init(ni, &ns->post_poll_list,
+                    oo_ptr_to_statep(ni, &ns->post_poll_list), "pstp");
+
+  ns->sock_spin_cycles = __oo_usec_to_cycles64(cpu_khz,
+                                               NI_OPTS(ni).spin_usec);
+  ns->buzz_cycles = __oo_usec_to_cycles64(cpu_khz, NI_OPTS(ni).buzz_usec);
+  ns->timer_prime_cycles =
+    __oo_usec_to_cycles64(cpu_khz, NI_OPTS(ni).timer_prime_usec);
+  ns->kernel_packets_cycles =
+    __oo_usec_to_cycles64(cpu_khz, NI_OPTS(ni).kernel_packets_timer_usec);
+
+  ci_ip_timer_state_init(ni, cpu_khz);
+  ns->last_spin_poll_frc = IPTIMER_STATE(ni)->frc;
+  ns->last_sleep_frc = IPTIMER_STATE(ni)->frc;
+
+  /* As tcp_helper_init_max_mss(), allowing for the largest prefix. */
+  ns->max_mss = ef_vi_receive_buffer_len(vi) - 16 - ETH_HLEN -
+    ETH_VLAN_HLEN - sizeof(ci_ip4_hdr) - sizeof(ci_tcp_hdr);
+
+  for( i = 0; i < CI_CFG_N_READY_LISTS; i++ ) {
+    ci_ni_dllist_init(ni, &ns->ready_lists[i],
+                      oo_ptr_to_statep(ni, &ns->ready_lists[i]),
+                      "ready_list");
+    ci_ni_dllist_init(ni, &ns->unready_lists[i],
+                      oo_ptr_to_statep(ni, &ns->unready_lists[i]),
+                      "unready_list");
+  }
+
+#if CI_CFG_FD_CACHING
+  ci_ni_dllist_init(ni, &ns->active_cache.cache,
+                    oo_ptr_to_statep(ni, &ns->active_cache.cache), "ach");
+  ci_ni_dllist_init(ni, &ns->active_cache.pending,
+                    oo_ptr_to_statep(ni, &ns->active_cache.pending), "apd");
+  ci_ni_dllist_init(ni, &ns->active_cache.fd_states,
+                    oo_ptr_to_statep(ni, &ns->active_cache.fd_states), "afd");
+  ns->active_cache.avail_stack =
+    oo_ptr_to_statep(ni, &ns->active_cache_avail_stack);
+  ns->active_cache_avail_stack = ns->opts.sock_cache_max;
+  ci_ni_dllist_init(ni, &ns->passive_scalable_cache.cache,
+                    oo_ptr_to_statep(ni, &ns->passive_scalable_cache.cache),
+                    "psch");
+  ci_ni_dllist_init(ni, &ns->passive_scalable_cache.pending,
+                    oo_ptr_to_statep(ni, &ns->passive_scalable_cache.pending),
+                    "pspd");
+  ci_ni_dllist_init(ni, &ns->passive_scalable_cache.fd_states,
+                    oo_ptr_to_statep(ni,
+                                     &ns->passive_scalable_cache.fd_states),
+                    "psfd");
+  ns->passive_scalable_cache.avail_stack =
+    oo_ptr_to_statep(ni, &ns->passive_cache_avail_stack);
+  ns->passive_cache_avail_stack = ns->opts.sock_cache_max;
+#endif
+
+  ns->kernel_packets_head = ns->kernel_packets_tail = OO_PP_NULL;
+}
+
+
+/* Allocate every packet set up front, as there is no driver to ask for
+ * more later.
+ */
+static int fake_netif_alloc_pkts(struct fake_netif* fn)
+{
+  ci_netif* ni = &fn->ni;
+  oo_pktbuf_manager* pm = ni->packets;
+  unsigned set_bytes = PKTS_PER_SET * CI_CFG_PKT_BUF_SIZE;
+  ci_ip_pkt_fmt* pkt;
+  unsigned set, i;
+  int id;
+
+  ni->pkt_bufs = calloc(pm->sets_max, sizeof(ni->pkt_bufs[0]));
+  fn->pkt_bytes = (size_t) pm->sets_max * set_bytes;
+  fn->pkt_mem = fake_netif_mmap(fn->pkt_bytes);
+  if( ni->pkt_bufs == NULL || fn->pkt_mem == NULL )
+    return -ENOMEM;
+
+  for( set = 0; set < pm->sets_max; ++set ) {
+    ni->pkt_bufs[set] = (char*) fn->pkt_mem + (size_t) set * set_bytes;
+    pm->set[set].free = OO_PP_NULL;
+    pm->set[set].n_free = PKTS_PER_SET;
+#if defined(CI_CFG_PKTS_AS_HUGE_PAGES)
+    pm->set[set].shm_id = -1;
+#endif
+    pm->set[set].numa_node = -1;
+    for( i = 0; i < PKTS_PER_SET; ++i ) {
+      oo_pkt_p pp;
+      id = set * PKTS_PER_SET + i;
+      OO_PP_INIT(ni, pp, id);
+      pkt = __PKT(ni, pp);
+      OO_PKT_PP_INIT(pkt, id);
+      pkt->flags = 0;
+      __ci_netif_pkt_clean(pkt);
+      pkt->refcount = 0;
+      pkt->stack_id = ni->state->stack_id;
+      pkt->pio_addr = -1;
+      /* The ef_addr of a soft VI buffer is its virtual address. */
+      pkt->dma_addr[0] = (ef_addr) (uintptr_t) pkt +
+                         CI_MEMBER_OFFSET(ci_ip_pkt_fmt, dma_start);
+      pkt->next = pm->set[set].free;
+      pm->set[set].free = OO_PKT_P(pkt);
+    }
+    pm->n_free += PKTS_PER_SET;
+  }
+  pm->sets_n = pm->sets_max;
+  pm->n_pkts_allocated = pm->sets_n << CI_CFG_PKTS_PER_SET_S;
+  pm->id = 0;
+  return 0;
+}
+
+
+/* Install every endpoint buffer on the free list, as there is no driver
+ * to ask for more later.
+ */
+static int fake_netif_alloc_eps(struct fake_netif* fn)
+{
+  ci_netif* ni = &fn->ni;
+  struct ci_extra_ep ref = { CI_FD_BAD };
+  citp_waitable_obj* wo;
+  int id;
+
+  ni->eps = CI_ALLOC_ARRAY(typeof(*ni->eps), ni->state->max_ep_bufs);
+  if( ni->eps == NULL )
+    return -ENOMEM;
+  for( id = 0; id < (int) ni->state->max_ep_bufs; ++id )
+    ni->eps[id] = ref;
+
+  ni->state->n_ep_bufs = ni->state->max_ep_bufs;
+  /* Push in reverse so that sockets are allocated in id order. */
+  for( id = ni->state->max_ep_bufs - 1; id >= 0; --id ) {
+    wo = SP_TO_WAITABLE_OBJ(ni, OO_SP_FROM_INT(ni, id));
+    memset(wo, 0, sizeof(*wo));
+    citp_waitable_init(ni, &wo->waitable, id);
+    citp_waitable_obj_free(ni, &wo->waitable);
+  }
+  return 0;
+}
+
+
+/* A control plane with one valid forwarding row.  Sockets point their
+ * ipcache at it, so it is always valid and never re-resolved.  Anything
+ * else (such as replying to a packet that matches no socket) finds no
+ * route and gives up, as the request to the server fails.
+ */
+static void fake_netif_cplane_init(struct fake_netif* fn)
+{
+  struct cp_mibs* mib = &fn->cp.mib[0];
+
+  fn->cp_dim.fwd_ln2 = 0;
+  fn->cp_dim.fwd_mask = 0;
+  fn->cp_fwd.flags = CICP_FWD_FLAG_DATA_VALID;
+  fn->cp_fwd.version = 0;
+
+  mib->dim = &fn->cp_dim;
+  mib->version = &fn->cp_version;
+  mib->llap_version = &fn->cp_version;
+  mib->dump_version = &fn->cp_version;
+  mib->idle_version = &fn->cp_version;
+  mib->oof_version = &fn->cp_version;
+  mib->fwd_prefix = fn->cp_fwd_prefix;
+  mib->fwd = &fn->cp_fwd;
+  mib->fwd_rw = &fn->cp_fwd_rw;
+  fn->cp.mib[1] = *mib;
+  fn->cp.fd = -1;
+  fn->ni.cplane = &fn->cp;
+}
+
+
+static void fake_netif_ipcache_init(struct fake_netif* fn,
+                                    ci_ip_cached_hdrs* ipcache)
+{
+  ipcache->mac_integrity.id = 0;
+  ipcache->mac_integrity.version = fn->cp_fwd.version;
+  ipcache->status = retrrc_success;
+  ipcache->flags = 0;
+  ipcache->ip_saddr.ip4 = ipcache->ip.ip_saddr_be32;
+  ipcache->nexthop.ip4 = ipcache->ip.ip_daddr_be32;
+  ipcache->mtu = 1500;
+  ipcache->ifindex = 1;
+  ipcache->encap.type = CICP_LLAP_TYPE_NONE;
+  ipcache->intf_i = 0;
+  ipcache->hwport = 0;
+  cicp_ipcache_vlan_set(ipcache);
+  memcpy(ci_ip_cache_ether_shost(ipcache), fn->mac, ETH_ALEN);
+  memcpy(ci_ip_cache_ether_dhost(ipcache), fn->peer_mac, ETH_ALEN);
+  ipcache->ip.ip_ttl = 64;
+}
+
+
+static int fake_netif_peer_init(struct fake_netif* fn)
+{
+  ef_vi* vi = &fn->peer_vi;
+  char* bufs;
+  int rc, i, n_rx, n_tx;
+
+  rc = ef_pd_alloc(&fn->peer_pd, fn->dh, -1, EF_PD_DEFAULT);
+  if( rc < 0 )
+    return rc;
+  rc = ef_vi_alloc_from_pd(vi, fn->dh, &fn->peer_pd, fn->dh,
+                           -1, -1, -1, NULL, -1, EF_VI_FLAGS_DEFAULT);
+  if( rc < 0 )
+    return rc;
+  ef_vi_get_mac(vi, fn->dh, fn->peer_mac);
+
+  n_rx = ef_vi_receive_capacity(vi);
+  n_tx = ef_vi_transmit_capacity(vi) + 1;
+  bufs = fake_netif_mmap((size_t) (n_rx + n_tx) * PEER_BUF_SIZE);
+  if( bufs == NULL )
+    return -ENOMEM;
+  fn->peer_bufs = bufs;
+  fn->peer_n_rx = n_rx;
+  fn->peer_n_tx = n_tx;
+  for( i = 0; i < n_rx; ++i )
+    ef_vi_receive_init(vi, (ef_addr) (uintptr_t) (bufs + i * PEER_BUF_SIZE),
+                       i);
+  ef_vi_receive_push(vi);
+  return 0;
+}
+
+
+int fake_netif_ctor(struct fake_netif* fn, const char* name)
+{
+  ci_netif* ni = &fn->ni;
+  ci_netif_config_opts opts;
+  ef_vi* vi = &ni->nic_hw[0].vi;
+  int rc;
+
+  memset(fn, 0, sizeof(*fn));
+  CI_BUILD_ASSERT(CI_CFG_PKT_BUF_SIZE <= PEER_BUF_SIZE);
+
+  /* A link of our own, with the stack on port 0 and the peer on 1. */
+  snprintf(fn->link_name, sizeof(fn->link_name), "fake_netif_%d",
+           (int) getpid());
+  setenv("EF_VI_SOFT", fn->link_name, 1);
+  unsetenv("EF_VI_SOFT_PORT");
+
+  fake_netif_opts(&opts);
+  if( (rc = fake_netif_alloc_state(fn, &opts)) < 0 )
+    goto fail;
+
+  CI_MAGIC_SET(ni, NETIF_MAGIC);
+  ni->nic_n = 1;
+  ni->flags = 0;
+  ni->error_flags = 0;
+  /* The stack is born locked, and stays that way. */
+  ni->state->lock.lock = CI_EPLOCK_LOCKED;
+
+  if( (rc = ef_driver_open(&fn->dh)) < 0 ||
+      (rc = ef_pd_alloc(&fn->pd, fn->dh, -1, EF_PD_DEFAULT)) < 0 ||
+      (rc = ef_vi_alloc_from_pd(vi, fn->dh, &fn->pd, fn->dh, -1,
+                                opts.rxq_size, opts.txq_size, NULL, -1,
+                                EF_VI_FLAGS_DEFAULT)) < 0 )
+    goto fail;
+  ni->driver_handle = fn->dh;
+  ef_vi_get_mac(vi, fn->dh, fn->mac);
+  if( (rc = fake_netif_peer_init(fn)) < 0 )
+    goto fail;
+
+  fake_netif_state_init(fn, name);
+  fake_netif_cplane_init(fn);
+  if( (rc = fake_netif_alloc_pkts(fn)) < 0 ||
+      (rc = fake_netif_alloc_eps(fn)) < 0 )
+    goto fail;
+
+  /* As ci_netif_set_rxq_limit(), then fill the RX ring. */
+  NI_OPTS(ni).rxq_limit = CI_MIN(NI_OPTS(ni).rxq_limit,
+                                 ef_vi_receive_capacity(vi));
+  NI_OPTS(ni).rxq_limit = CI_MIN(NI_OPTS(ni).rxq_limit,
+                                 NI_OPTS(ni).max_rx_packets * 4 / 5);
+  ni->state->rxq_limit = NI_OPTS(ni).rxq_limit;
+  ci_netif_mem_pressure_pkt_pool_fill(ni);
+  ci_netif_rx_post(ni, 0);
+  return 0;
+
+ fail:
+  fake_netif_dtor(fn);
+  return rc;
+}
+
+
+void fake_netif_dtor(struct fake_netif* fn)
+{
+  ci_netif* ni = &fn->ni;
+
+  if( fn->peer_vi.vi_qs_n )
+    ef_vi_free(&fn->peer_vi, fn->dh);
+  if( ni->nic_hw[0].vi.vi_qs_n )
+    ef_vi_free(&ni->nic_hw[0].vi, fn->dh);
+  if( fn->peer_bufs != NULL )
+    munmap(fn->peer_bufs, (size_t) (fn->peer_n_rx + fn->peer_n_tx) *
+           PEER_BUF_SIZE);
+  if( fn->pkt_mem != NULL )
+    munmap(fn->pkt_mem, fn->pkt_bytes);
+  if( fn->state_mem != NULL )
+    munmap(fn->state_mem, fn->state_bytes);
+  free(ni->pkt_bufs);
+  free(ni->eps);
+  if( fn->dh > 0 )
+    ef_driver_close(fn->dh);
+  memset(fn, 0, sizeof(*fn));
+}
+
+
+/* Follows ci_tcp_listenq_try_promote(), with the s/w filter standing in
+ * for ci_tcp_ep_set_filters(), and our one route for the ipcache.
+ */
+ci_tcp_state* fake_netif_tcp_established(struct fake_netif* fn,
+                                         const struct fake_tcp_conn* c)
+{
+  ci_netif* ni = &fn->ni;
+  ci_tcp_state* ts;
+  ci_uint32 snd_nxt = c->snd_nxt;
+  int rc;
+
+  if( (ts = ci_tcp_get_state_buf(ni)) == NULL )
+    return NULL;
+
+  ts->s.pkt.ip.ip_saddr_be32 = c->laddr_be32;
+  TS_TCP(ts)->tcp_source_be16 = c->lport_be16;
+  ts->s.cp.ip_laddr_be32 = c->laddr_be32;
+  ts->s.cp.lport_be16 = c->lport_be16;
+  ci_tcp_set_peer(ts, c->raddr_be32, c->rport_be16);
+
+  rc = ci_netif_filter_insert(ni, S_SP(ts), AF_SPACE_FLAG_IP4,
+                              CI_ADDR_FROM_IP4(c->laddr_be32), c->lport_be16,
+                              CI_ADDR_FROM_IP4(c->raddr_be32), c->rport_be16,
+                              IPPROTO_TCP);
+  if( rc < 0 ) {
+    ci_tcp_state_free(ni, ts);
+    return NULL;
+  }
+
+  fake_netif_ipcache_init(fn, &ts->s.pkt);
+  ci_pmtu_state_init(ni, &ts->s, &ts->pmtus, CI_IP_TIMER_PMTU_DISCOVER);
+  ci_pmtu_set(ni, &ts->pmtus, ts->s.pkt.mtu);
+  ts->amss = ts->s.pkt.mtu - sizeof(ci_ip4_hdr) - sizeof(ci_tcp_hdr);
+
+  ts->tcpflags = 0;
+  ts->outgoing_hdrs_len = sizeof(ci_ip4_hdr) + sizeof(ci_tcp_hdr);
+  if( c->snd_wscl >= 0 && c->rcv_wscl >= 0 ) {
+    ts->tcpflags |= CI_TCPT_FLAG_WSCL;
+    ts->snd_wscl = c->snd_wscl;
+    ts->rcv_wscl = c->rcv_wscl;
+  }
+  else {
+    ts->snd_wscl = ts->rcv_wscl = 0u;
+  }
+
+  tcp_snd_una(ts) = tcp_snd_nxt(ts) = tcp_enq_nxt(ts) = tcp_snd_up(ts) =
+    snd_nxt;
+  /* As ci_tcp_set_snd_max() and ci_tcp_rx_set_isn(). */
+#if CI_CFG_NOTICE_WINDOW_SHRINKAGE
+  ts->snd_wl1 = c->rcv_nxt;
+#endif
+  ts->snd_max = snd_nxt + c->snd_wnd;
+  ts->stats.rx_isn = c->rcv_nxt;
+  tcp_rcv_nxt(ts) = c->rcv_nxt;
+  ts->rcv_added = ts->rcv_delivered = c->rcv_nxt;
+  tcp_rcv_up(ts) = SEQ_SUB(tcp_rcv_nxt(ts), 1);
+  ci_tcp_set_rcvbuf(ni, ts);      /* needs amss and rcv_wscl */
+  ci_tcp_init_rcv_wnd(ts, "fake_netif");
+
+  if( c->tso ) {
+    ts->tcpflags |= CI_TCPT_FLAG_TSO;
+    ts->incoming_tcp_hdr_len += 12;
+    ts->outgoing_hdrs_len += 12;
+    ts->tspaws = ci_tcp_time_now(ni);
+    ts->tsrecent = c->tsrecent;
+    ts->tslastack = c->rcv_nxt;
+  }
+  else {
+    ci_tcp_clear_rtt_timing(ts);
+  }
+  ci_tcp_set_hdr_len(ts, ts->outgoing_hdrs_len - sizeof(ci_ip4_hdr));
+
+  ts->smss = c->smss > 0 ? c->smss : CI_CFG_TCP_DEFAULT_MSS;
+  ts->smss = CI_MIN(ts->smss, ts->amss);
+  ci_tcp_set_eff_mss(ni, ts);
+  ci_tcp_set_initialcwnd(ni, ts);
+
+  ci_tcp_set_established_state(ni, ts);
+  ci_tcp_kalive_restart(ni, ts, ci_tcp_kalive_idle_get(ts));
+  ci_tcp_set_flags(ts, CI_TCP_FLAG_ACK);
+
+  /* Owned by the (imaginary) application, as after accept(). */
+  ci_bit_clear(&ts->s.b.sb_aflags, CI_SB_AFLAG_ORPHAN_BIT);
+  return ts;
+}
+
+
+/* Follows ci_tcp_listen(), with the s/w filter standing in for
+ * ci_tcp_ep_set_filters().
+ */
+ci_tcp_socket_listen* fake_netif_tcp_listen(struct fake_netif* fn,
+                                            ci_uint32 laddr_be32,
+                                            ci_uint16 lport_be16,
+                                            int backlog)
+{
+  ci_netif* ni = &fn->ni;
+  ci_tcp_socket_listen* tls;
+  ci_tcp_state* ts;
+  oo_p sp;
+  int rc;
+
+  if( (ts = ci_tcp_get_state_buf(ni)) == NULL )
+    return NULL;
+
+  ts->s.pkt.ip.ip_saddr_be32 = laddr_be32;
+  TS_TCP(ts)->tcp_source_be16 = lport_be16;
+  ts->s.cp.ip_laddr_be32 = laddr_be32;
+  ts->s.cp.lport_be16 = lport_be16;
+
+  rc = ci_netif_filter_insert(ni, S_SP(ts), AF_SPACE_FLAG_IP4,
+                              CI_ADDR_FROM_IP4(laddr_be32), lport_be16,
+                              CI_ADDR_FROM_IP4(0), 0, IPPROTO_TCP);
+  if( rc < 0 ) {
+    ci_tcp_state_free(ni, ts);
+    return NULL;
+  }
+
+  ci_tcp_set_slow_state(ni, ts, CI_TCP_LISTEN);
+  tls = SOCK_TO_TCP_LISTEN(&ts->s);
+  ++ni->state->n_listeners;
+  tcp_raddr_be32(tls) = 0u;
+  tcp_rport_be16(tls) = 0u;
+
+  sp = TS_OFF(ni, tls);
+  OO_P_ADD(sp, CI_MEMBER_OFFSET(ci_tcp_socket_listen, listenq_tid));
+  ci_ip_timer_init(ni, &tls->listenq_tid, sp, "lstq");
+  tls->listenq_tid.param1 = S_SP(tls);
+  tls->listenq_tid.fn = CI_IP_TIMER_TCP_LISTEN;
+
+  ci_tcp_listen_init(ni, tls);
+  tls->acceptq_max = backlog;
+  CITP_STATS_TCP_LISTEN(CI_ZERO(&tls->stats));
+
+  /* Owned by the (imaginary) application. */
+  ci_bit_clear(&tls->s.b.sb_aflags, CI_SB_AFLAG_ORPHAN_BIT);
+  return tls;
+}
+
+
+void fake_netif_route(struct fake_netif* fn, ci_ip_cached_hdrs* ipcache,
+                      const struct oo_sock_cplane* sock_cp)
+{
+  ipcache->ip.ip_saddr_be32 = sock_cp->ip_laddr_be32;
+  fake_netif_ipcache_init(fn, ipcache);
+}
+
+
+/* Follows ci_tcp_recvmsg_get() and ci_tcp_recvmsg_send_wnd_update(),
+ * without copying the data anywhere.
+ */
+int fake_netif_tcp_drain(struct fake_netif* fn, ci_tcp_state* ts)
+{
+  ci_netif* ni = &fn->ni;
+  ci_ip_pkt_fmt* pkt;
+  int n, total = 0;
+
+  while( tcp_rcv_usr(ts) > 0 && OO_PP_NOT_NULL(ts->recv1_extract) ) {
+    pkt = PKT_CHK_NNL(ni, ts->recv1_extract);
+    n = oo_offbuf_left(&pkt->buf);
+    oo_offbuf_advance(&pkt->buf, n);
+    ts->rcv_delivered += n;
+    total += n;
+    if( OO_PP_IS_NULL(pkt->next) )
+      break;
+    ts->recv1_extract = pkt->next;
+  }
+  if( total == 0 )
+    return 0;
+
+  ci_tcp_rx_reap_rxq_bufs(ni, ts);
+  if( SEQ_LE(ts->ack_trigger, ts->rcv_delivered) &&
+      ! ci_tcp_send_wnd_update(ni, ts, CI_TRUE) )
+    ts->ack_trigger = ts->rcv_delivered
+      + ci_tcp_ack_trigger_delta(ts)
+      - SEQ_SUB(ts->rcv_delivered + ts->rcv_window_max,
+                tcp_rcv_wnd_right_edge_sent(ts));
+  return total;
+}
+
+
+int fake_netif_peer_send(struct fake_netif* fn, const void* frame, int len)
+{
+  ef_vi* vi = &fn->peer_vi;
+  char* buf;
+  int i;
+
+  if( len > PEER_BUF_SIZE )
+    return -EMSGSIZE;
+  if( ef_vi_transmit_space(vi) < 1 )
+    return -EAGAIN;
+
+  /* A buffer is reused only once its descriptor has completed, as there
+   * are more buffers than descriptors.
+   */
+  i = fn->peer_tx_i++ % fn->peer_n_tx;
+  buf = fn->peer_bufs + (size_t) (fn->peer_n_rx + i) * PEER_BUF_SIZE;
+  memcpy(buf, frame, len);
+  return ef_vi_transmit(vi, (ef_addr) (uintptr_t) buf, len, i);
+}
+
+
+int fake_netif_peer_poll(struct fake_netif* fn,
+                         void (*fn_rx)(void* arg, const void* frame, int len),
+                         void* arg)
+{
+  ef_vi* vi = &fn->peer_vi;
+  ef_event evs[EF_VI_EVENT_POLL_MIN_EVS];
+  ef_request_id ids[EF_VI_TRANSMIT_BATCH];
+  int i, n_ev, id, n_rx = 0, n_post = 0;
+  char* buf;
+
+  while( (n_ev = ef_eventq_poll(vi, evs, EF_VI_EVENT_POLL_MIN_EVS)) > 0 ) {
+    for( i = 0; i < n_ev; ++i )
+      switch( EF_EVENT_TYPE(evs[i]) ) {
+      case EF_EVENT_TYPE_RX:
+        id = EF_EVENT_RX_RQ_ID(evs[i]);
+        buf = fn->peer_bufs + (size_t) id * PEER_BUF_SIZE;
+        if( fn_rx != NULL )
+          fn_rx(arg, buf + ef_vi_receive_prefix_len(vi),
+                EF_EVENT_RX_BYTES(evs[i]) - ef_vi_receive_prefix_len(vi));
+        ++n_rx;
+        ef_vi_receive_init(vi, (ef_addr) (uintptr_t) buf, id);
+        ++n_post;
+        break;
+      case EF_EVENT_TYPE_RX_DISCARD:
+        id = EF_EVENT_RX_DISCARD_RQ_ID(evs[i]);
+        buf = fn->peer_bufs + (size_t) id * PEER_BUF_SIZE;
+        ef_vi_receive_init(vi, (ef_addr) (uintptr_t) buf, id);
+        ++n_post;
+        break;
+      case EF_EVENT_TYPE_TX:
+        ef_vi_transmit_unbundle(vi, &evs[i], ids);
+        break;
+      default:
+        break;
+      }
+  }
+  if( n_post )
+    ef_vi_receive_push(vi);
+  return n_rx;
+}
@@ -0,0 +1,143 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  A user-level stack with no driver, for offline testing.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+#ifndef __FAKE_NETIF_H__
+#define __FAKE_NETIF_H__
+
+#include <ci/internal/ip.h>
+#include <etherfabric/vi.h>
+#include <etherfabric/pd.h>
+
+
+/* A fake_netif is a ci_netif whose shared state lives in ordinary memory,
+ * laid out as the driver would lay it out, and whose one interface is a
+ * soft VI (see lib/ciul/soft_vi.c).  A second soft VI on the same link is
+ * the "peer": frames it transmits arrive on the stack's RX ring, and
+ * frames the stack transmits can be received from it.
+ *
+ * There is no driver, so anything that needs one (hardware filters, more
+ * packet buffers or sockets, the control plane server, blocking) fails.
+ * The stack is created locked, as the driver creates it, and stays locked
+ * for the lifetime of the fake_netif (unlocking would need the driver), so
+ * the caller calls ci_netif_poll() directly.  Sockets are created in the
+ * established state with fake_netif_tcp_established(), or listening with
+ * fake_netif_tcp_listen().
+ */
+struct fake_netif {
+  ci_netif                 ni;
+  ef_driver_handle         dh;
+  ef_pd                    pd;
+  ef_pd                    peer_pd;
+  ef_vi                    peer_vi;
+  ci_uint8                 mac[ETH_ALEN];
+  ci_uint8                 peer_mac[ETH_ALEN];
+  /* Peer's RX buffers, then its TX buffers (one more than the TXQ). */
+  char*                    peer_bufs;
+  int                      peer_n_rx;
+  int                      peer_n_tx;
+  unsigned                 peer_tx_i;
+
+  /* Control plane with a single valid forwarding row, which every socket
+   * uses for its ipcache.
+   */
+  struct oo_cplane_handle  cp;
+  struct cp_tables_dim     cp_dim;
+  struct cp_fwd_row        cp_fwd;
+  struct cp_fwd_rw_row     cp_fwd_rw;
+  ci_uint64                cp_fwd_prefix[2];
+  cp_version_t             cp_version;
+
+  void*                    state_mem;
+  size_t                   state_bytes;
+  void*                    pkt_mem;
+  size_t                   pkt_bytes;
+  char                     link_name[32];
+};
+
+
+/* Parameters of a synthesised established connection.  Addresses and
+ * ports are in network byte order.
+ */
+struct fake_tcp_conn {
+  ci_uint32  laddr_be32;
+  ci_uint16  lport_be16;
+  ci_uint32  raddr_be32;
+  ci_uint16  rport_be16;
+  ci_uint32  snd_nxt;       /* next sequence number we will send */
+  ci_uint32  rcv_nxt;       /* next sequence number we expect */
+  ci_uint32  snd_wnd;       /* peer's window, already scaled */
+  int        smss;          /* peer's MSS, or 0 for the default */
+  int        snd_wscl;      /* peer's window scale, or -1 if none */
+  int        rcv_wscl;      /* our window scale, or -1 if none */
+  int        tso;           /* timestamps in use */
+  ci_uint32  tsrecent;      /* last timestamp from the peer */
+};
+
+
+/* Build a stack named [name].  Options come from the EF_* environment
+ * variables, as for a real stack, except those features that need the
+ * driver, which are disabled.
+ */
+extern int fake_netif_ctor(struct fake_netif* fn, const char* name);
+extern void fake_netif_dtor(struct fake_netif* fn);
+
+/* Create a TCP socket in the established state, with a s/w filter. */
+extern ci_tcp_state* fake_netif_tcp_established(struct fake_netif* fn,
+                                                const struct fake_tcp_conn*);
+
+/* Create a TCP socket listening on [laddr_be32]:[lport_be16], with a s/w
+ * filter, as listen() would with a backlog of [backlog].
+ */
+extern ci_tcp_socket_listen* fake_netif_tcp_listen(struct fake_netif* fn,
+                                                   ci_uint32 laddr_be32,
+                                                   ci_uint16 lport_be16,
+                                                   int backlog);
+
+/* Fill in [ipcache] from our one route, as cicp_user_retrieve() would.
+ * The destination address and port must already be set.
+ */
+extern void fake_netif_route(struct fake_netif* fn,
+                             ci_ip_cached_hdrs* ipcache,
+                             const struct oo_sock_cplane* sock_cp);
+
+/* Consume everything on the socket's receive queue as recv() would,
+ * sending a window update if one is due.  Returns the number of bytes
+ * consumed.
+ */
+extern int fake_netif_tcp_drain(struct fake_netif* fn, ci_tcp_state* ts);
+
+/* Transmit a frame from the peer to the stack.  Returns -EAGAIN if the
+ * link is full; call fake_netif_peer_poll() and ci_netif_poll() to drain.
+ */
+extern int fake_netif_peer_send(struct fake_netif* fn,
+                                const void* frame, int len);
+
+/* Reap the peer's TX completions and hand each frame the stack has sent to
+ * [fn_rx].  Returns the number of frames received.
+ */
+extern int fake_netif_peer_poll(struct fake_netif* fn,
+                                void (*fn_rx)(void* arg, const void* frame,
+                                              int len),
+                                void* arg);
+
+#endif  /* __FAKE_NETIF_H__ */
@@ -0,0 +1,192 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Check direct delivery of TCP loopback data within a stack.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* With EF_TCP_LOOPBACK_DIRECT, data sent on a loopback connection is put
+ * straight on the peer's receive queue (ci_tcp_rx_loopback_direct()).  We
+ * join two established sockets as loopback peers, as connect() and
+ * accept() would, then:
+ *
+ *  - send from one to the other, and check that the data arrives in order
+ *    by the direct path, and that the receiver records the time of the
+ *    payload (for keepalives) and the sender's timestamp (to echo);
+ *  - send urgent data, which needs full receive processing, and check
+ *    that each of its segments is counted as falling back.
+ */
+
+#define _GNU_SOURCE
+#include "fake_netif.h"
+#include "../test_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+
+#define MSG_LEN     100
+#define N_MSGS      3
+
+static struct fake_netif fn;
+
+
+
+static ci_tcp_state* loopback_sock(ci_uint16 lport, ci_uint16 rport,
+                                   ci_uint32 snd_nxt, ci_uint32 rcv_nxt)
+{
+  struct fake_tcp_conn c;
+  ci_tcp_state* ts;
+
+  memset(&c, 0, sizeof(c));
+  c.laddr_be32 = c.raddr_be32 = htonl(INADDR_LOOPBACK);
+  c.lport_be16 = htons(lport);
+  c.rport_be16 = htons(rport);
+  c.snd_nxt = snd_nxt;
+  c.rcv_nxt = rcv_nxt;
+  c.snd_wnd = 1u << 20;
+  c.snd_wscl = c.rcv_wscl = 7;
+  c.tso = 1;
+  if( (ts = fake_netif_tcp_established(&fn, &c)) != NULL )
+    ts->s.pkt.flags |= CI_IP_CACHE_IS_LOCALROUTE;
+  return ts;
+}
+
+
+static int send_msg(ci_tcp_state* ts, const char* buf, int len, int flags)
+{
+  ci_iovec iov;
+  int rc;
+
+  CI_IOVEC_BASE(&iov) = (void*) buf;
+  CI_IOVEC_LEN(&iov) = len;
+  /* ci_tcp_sendmsg() takes the lock itself.  Nothing is left for the
+   * unlock hooks to do, so this doesn't need the driver.
+   */
+  ci_netif_unlock(&fn.ni);
+  rc = ci_tcp_sendmsg(&fn.ni, ts, &iov, 1, flags | MSG_DONTWAIT);
+  ci_netif_lock(&fn.ni);
+  return rc;
+}
+
+
+/* Consume up to [len] bytes from the receive queue of [ts] into [buf]. */
+static int recv_msg(ci_tcp_state* ts, char* buf, int len)
+{
+  ci_netif* ni = &fn.ni;
+  ci_ip_pkt_fmt* pkt;
+  int n, total = 0;
+
+  while( total < len && tcp_rcv_usr(ts) > 0 &&
+         OO_PP_NOT_NULL(ts->recv1_extract) ) {
+    pkt = PKT_CHK_NNL(ni, ts->recv1_extract);
+    n = CI_MIN(oo_offbuf_left(&pkt->buf), len - total);
+    memcpy(buf + total, oo_offbuf_ptr(&pkt->buf), n);
+    oo_offbuf_advance(&pkt->buf, n);
+    ts->rcv_delivered += n;
+    total += n;
+    if( oo_offbuf_left(&pkt->buf) != 0 || OO_PP_IS_NULL(pkt->next) )
+      break;
+    ts->recv1_extract = pkt->next;
+  }
+  ci_tcp_rx_reap_rxq_bufs(ni, ts);
+  return total;
+}
+
+
+static void test_direct(ci_netif* ni, ci_tcp_state* a, ci_tcp_state* b)
+{
+  char sent[MSG_LEN * N_MSGS], got[sizeof(sent)];
+  ci_iptime_t before = ci_tcp_time_now(ni);
+  int i;
+
+  b->t_last_recv_payload = before - 1000;
+  b->tsrecent = before - 1000;
+
+  for( i = 0; i < sizeof(sent); ++i )
+    sent[i] = (char) i;
+  for( i = 0; i < N_MSGS; ++i )
+    CHECK(send_msg(a, sent + i * MSG_LEN, MSG_LEN, 0) == MSG_LEN);
+
+#if CI_CFG_STATS_NETIF
+  CHECK(ni->state->stats.tcp_loopback_direct == N_MSGS);
+  CHECK(ni->state->stats.tcp_loopback_direct_fallback == 0);
+#endif
+  CHECK(OO_PP_IS_NULL(ni->state->looppkts));
+  CHECK(tcp_rcv_usr(b) == sizeof(sent));
+  CHECK(recv_msg(b, got, sizeof(got)) == sizeof(sent));
+  CHECK(! memcmp(got, sent, sizeof(sent)));
+  /* Acked at once. */
+  CHECK(SEQ_EQ(tcp_snd_una(a), tcp_rcv_nxt(b)));
+
+  CHECK(TIME_GE(b->t_last_recv_payload, before));
+  CHECK(TIME_GE(b->tsrecent, before));
+}
+
+
+static void test_fallback(ci_netif* ni, ci_tcp_state* a, ci_tcp_state* b)
+{
+  int len = 2 * tcp_eff_mss(a) + 10;
+  char* buf = calloc(1, len);
+#if CI_CFG_STATS_NETIF
+  ci_uint32 direct = ni->state->stats.tcp_loopback_direct;
+#endif
+
+  /* Every segment before the urgent pointer is flagged URG. */
+  CHECK(send_msg(a, buf, len, MSG_OOB) == len);
+#if CI_CFG_STATS_NETIF
+  CHECK(ni->state->stats.tcp_loopback_direct == direct);
+  CHECK(ni->state->stats.tcp_loopback_direct_fallback == 3);
+#endif
+  CHECK(SEQ_EQ(tcp_rcv_nxt(b), tcp_snd_nxt(a)));
+  free(buf);
+}
+
+
+int main(int argc, char* argv[])
+{
+  ci_netif* ni;
+  ci_tcp_state *a, *b;
+  int rc;
+
+  setenv("EF_TCP_LOOPBACK_DIRECT", "1", 1);
+  if( (rc = fake_netif_ctor(&fn, "loopback_direct_test")) < 0 ) {
+    fprintf(stderr, "ERROR: failed to build stack (%d)\n", rc);
+    return 1;
+  }
+  ni = &fn.ni;
+
+  a = loopback_sock(40000, 5001, 0x10000000, 0x20000000);
+  b = loopback_sock(5001, 40000, 0x20000000, 0x10000000);
+  if( a == NULL || b == NULL ) {
+    fprintf(stderr, "ERROR: failed to create sockets\n");
+    fake_netif_dtor(&fn);
+    return 1;
+  }
+  a->local_peer = S_SP(b);
+  b->local_peer = S_SP(a);
+
+  test_direct(ni, a, b);
+  test_fallback(ni, a, b);
+
+  fake_netif_dtor(&fn);
+  return test_check_result();
+}
@@ -0,0 +1,69 @@
+TEST_APPS	:= pcap_replay tcp_send_bench syn_flood_bench epoll_chain_test \
+		   splice_zc_test loopback_direct_test synrecv_table_test \
+		   tcp_locked_io_test tcp_accept_test
+TARGETS		:= $(TEST_APPS:%=$(AppPattern))
+
+pcap_replay	:= $(patsubst %,$(AppPattern),pcap_replay)
+tcp_send_bench	:= $(patsubst %,$(AppPattern),tcp_send_bench)
+syn_flood_bench	:= $(patsubst %,$(AppPattern),syn_flood_bench)
+epoll_chain_test	:= $(patsubst %,$(AppPattern),epoll_chain_test)
+splice_zc_test	:= $(patsubst %,$(AppPattern),splice_zc_test)
+loopback_direct_test	:= $(patsubst %,$(AppPattern),loopback_direct_test)
+synrecv_table_test	:= $(patsubst %,$(AppPattern),synrecv_table_test)
+tcp_locked_io_test	:= $(patsubst %,$(AppPattern),tcp_locked_io_test)
+tcp_accept_test	:= $(patsubst %,$(AppPattern),tcp_accept_test)
+
+
+all: $(TARGETS)
+
+clean:
+	@$(MakeClean)
+
+
+MMAKE_LIBS	:= $(LINK_CIIP_LIB) $(LINK_CIAPP_LIB) \
+		   $(LINK_CIUL_LIB) $(LINK_CITOOLS_LIB) \
+		   $(LINK_CPLANE_LIB)
+MMAKE_LIB_DEPS	:= $(CIIP_LIB_DEPEND) $(CIAPP_LIB_DEPEND) \
+		   $(CIUL_LIB_DEPEND) $(CITOOLS_LIB_DEPEND) \
+		   $(CPLANE_LIB_DEPEND)
+
+# Time ci_tcp_handle_rx() without touching the stack.
+$(pcap_replay): pcap_replay.o fake_netif.o $(MMAKE_LIB_DEPS)
+	(libs="$(MMAKE_LIBS) -Wl,--wrap=ci_tcp_handle_rx"; $(MMakeLinkCApp))
+
+# Time ci_tcp_sendmsg() for bulk sends.
+$(tcp_send_bench): tcp_send_bench.o fake_netif.o $(MMAKE_LIB_DEPS)
+	(libs="$(MMAKE_LIBS)"; $(MMakeLinkCApp))
+
+# Time passive opens under a SYN flood, standing in for the driver's routes
+# and filters.
+$(syn_flood_bench): syn_flood_bench.o fake_netif.o $(MMAKE_LIB_DEPS)
+	(libs="$(MMAKE_LIBS) -Wl,--wrap=cicp_user_retrieve \
+	  -Wl,--wrap=ci_tcp_helper_ep_set_filters \
+	  -Wl,--wrap=ci_tcp_listenq_lookup"; $(MMakeLinkCApp))
+
+# Check the walk of a socket's epoll state chain, including a broken one.
+$(epoll_chain_test): epoll_chain_test.o fake_netif.o $(MMAKE_LIB_DEPS)
+	(libs="$(MMAKE_LIBS)"; $(MMakeLinkCApp))
+
+# Check splice() moving buffers between a pipe and a TCP socket.
+$(splice_zc_test): splice_zc_test.o fake_netif.o $(MMAKE_LIB_DEPS)
+	(libs="$(MMAKE_LIBS)"; $(MMakeLinkCApp))
+
+# Check direct delivery of TCP loopback data, and its fallback.
+$(loopback_direct_test): loopback_direct_test.o fake_netif.o $(MMAKE_LIB_DEPS)
+	(libs="$(MMAKE_LIBS)"; $(MMakeLinkCApp))
+
+# Check the SYN-RECV table shared by two listeners, and closing one.
+$(synrecv_table_test): synrecv_table_test.o fake_netif.o $(MMAKE_LIB_DEPS)
+	(libs="$(MMAKE_LIBS)"; $(MMakeLinkCApp))
+
+# Check the TCP sends and receives that onload_ring_submit() makes with the
+# stack lock held.
+$(tcp_locked_io_test): tcp_locked_io_test.o fake_netif.o $(MMAKE_LIB_DEPS)
+	(libs="$(MMAKE_LIBS)"; $(MMakeLinkCApp))
+
+# Check the accept reserve shared by two listeners, and attaching fds to
+# accepted sockets in batches.
+$(tcp_accept_test): tcp_accept_test.o fake_netif.o $(MMAKE_LIB_DEPS)
+	(libs="$(MMAKE_LIBS)"; $(MMakeLinkCApp))
@@ -0,0 +1,787 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Replay a packet capture through the TCP receive path.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* Feeds the TCP segments in a capture into a stack built by fake_netif.c,
+ * with no NIC or driver, and records whatever the stack transmits in
+ * response (ACKs, window updates, RSTs).
+ *
+ * One end of each connection in the capture is "local" (the stack) and the
+ * other is the peer.  Only segments from the peer are replayed.  SYNs in
+ * either direction are used to learn the initial sequence numbers and
+ * options; connections whose handshake was not captured are picked up from
+ * the first segment from the peer.  Each connection is created directly in
+ * the ESTABLISHED state.
+ *
+ * We do not replay what the local application sent, so the peer's ACKs are
+ * clamped to what the stack has sent (with the TCP checksum patched up).
+ * With -r the capture is replayed repeatedly, advancing each connection's
+ * sequence numbers and timestamps so that each repetition is new data; FIN
+ * and RST are replayed only in the last repetition.
+ *
+ * We report packets per second and cycles per packet both for the whole of
+ * ci_netif_poll() and for ci_tcp_handle_rx() alone.  The stack leaves the
+ * checksums of frames it sends to the NIC, so they are not filled in in the
+ * output capture.
+ *
+ * Usage: pcap_replay -i in.pcap [-o out.pcap] [-l local_ip] [-r repeat]
+ *                    [-b batch]
+ */
+
+#define _GNU_SOURCE
+#include "fake_netif.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+
+#define PCAP_MAGIC_US       0xa1b2c3d4u
+#define PCAP_MAGIC_NS       0xa1b23c4du
+#define PCAP_LINKTYPE_ETH   1
+#define PCAP_LINKTYPE_SLL   113
+#define SLL_HDR_LEN         16
+
+#define FRAME_MAX           (ETH_HLEN + ETH_VLAN_HLEN + 1792)
+
+struct pcap_file_hdr {
+  ci_uint32  magic;
+  ci_uint16  version_major;
+  ci_uint16  version_minor;
+  ci_int32   thiszone;
+  ci_uint32  sigfigs;
+  ci_uint32  snaplen;
+  ci_uint32  linktype;
+};
+
+struct pcap_rec_hdr {
+  ci_uint32  ts_sec;
+  ci_uint32  ts_frac;
+  ci_uint32  caplen;
+  ci_uint32  len;
+};
+
+
+/* A connection in the capture. */
+struct flow {
+  ci_uint32       raddr_be32;
+  ci_uint16       rport_be16;
+  ci_uint16       lport_be16;
+  ci_tcp_state*   ts;
+  struct fake_tcp_conn  conn;
+  unsigned        have_rsyn : 1;    /* seen peer's SYN */
+  unsigned        have_lsyn : 1;    /* seen our SYN */
+  unsigned        touched : 1;
+  /* Sequence space and timestamps covered by the peer's segments, so
+   * that each repetition can follow on from the last.
+   */
+  ci_uint32       seq_lo, seq_hi;
+  ci_uint32       ts_lo, ts_hi;
+  unsigned        have_seq : 1;
+  unsigned        have_ts : 1;
+};
+
+/* A segment from the peer, ready to replay. */
+struct seg {
+  char*           frame;
+  int             len;
+  int             flow;
+  ci_uint32       ts_sec, ts_usec;
+};
+
+
+static struct fake_netif fn;
+
+static struct flow* flows;
+static int n_flows, max_flows;
+static struct seg* segs;
+static int n_segs;
+
+static ci_uint32 local_be32;
+static FILE* out_fp;
+static ci_uint32 out_ts_sec, out_ts_usec;
+
+static struct {
+  unsigned long  frames;
+  unsigned long  not_tcp;
+  unsigned long  truncated;
+  unsigned long  too_big;
+  unsigned long  not_local;
+  unsigned long  syns;
+  unsigned long  from_local;
+  unsigned long  no_flow;
+  unsigned long  replayed;
+  unsigned long  send_again;
+  unsigned long  tx_frames;
+  unsigned long  rx_bytes;
+  ci_uint64      poll_cycles;
+  ci_uint64      handle_rx_cycles;
+  unsigned long  handle_rx_calls;
+} stats;
+
+
+/**********************************************************************
+ * Timing of ci_tcp_handle_rx(), via the linker's --wrap.
+ */
+
+extern void __real_ci_tcp_handle_rx(ci_netif*, struct ci_netif_poll_state*,
+                                    ci_ip_pkt_fmt*, ci_tcp_hdr*, int);
+extern void __wrap_ci_tcp_handle_rx(ci_netif*, struct ci_netif_poll_state*,
+                                    ci_ip_pkt_fmt*, ci_tcp_hdr*, int);
+
+void __wrap_ci_tcp_handle_rx(ci_netif* ni, struct ci_netif_poll_state* ps,
+                             ci_ip_pkt_fmt* pkt, ci_tcp_hdr* tcp,
+                             int ip_paylen)
+{
+  ci_uint64 start, end;
+  ci_frc64(&start);
+  __real_ci_tcp_handle_rx(ni, ps, pkt, tcp, ip_paylen);
+  ci_frc64(&end);
+  stats.handle_rx_cycles += end - start;
+  ++stats.handle_rx_calls;
+}
+
+
+/**********************************************************************
+ * Packet helpers.
+ */
+
+/* Adjust a checksum for a 32-bit word changing from [from] to [to]
+ * (RFC 1624).
+ */
+static ci_uint16 csum_replace4(ci_uint16 check, ci_uint32 from, ci_uint32 to)
+{
+  ci_uint32 sum = (~check & 0xffff);
+  sum += (~from & 0xffff) + (~from >> 16);
+  sum += (to & 0xffff) + (to >> 16);
+  while( sum >> 16 )
+    sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum & 0xffff;
+}
+
+
+static void tcp_set_word(ci_tcp_hdr* tcp, ci_uint32* p, ci_uint32 v_be32)
+{
+  tcp->tcp_check_be16 = csum_replace4(tcp->tcp_check_be16, *p, v_be32);
+  *p = v_be32;
+}
+
+
+/* Find the timestamp option, returning a pointer to TSval, or NULL. */
+static ci_uint32* tcp_tsval(ci_tcp_hdr* tcp)
+{
+  ci_uint8* opt = (ci_uint8*) (tcp + 1);
+  ci_uint8* end = (ci_uint8*) tcp + CI_TCP_HDR_LEN(tcp);
+
+  while( opt < end ) {
+    if( opt[0] == CI_TCP_OPT_END )
+      break;
+    if( opt[0] == CI_TCP_OPT_NOP ) {
+      ++opt;
+      continue;
+    }
+    if( opt + 1 >= end || opt[1] < 2 || opt + opt[1] > end )
+      break;
+    if( opt[0] == CI_TCP_OPT_TIMESTAMP && opt[1] == 10 )
+      return (ci_uint32*) (opt + 2);
+    opt += opt[1];
+  }
+  return NULL;
+}
+
+
+/* Options from a SYN. */
+static void tcp_syn_opts(ci_tcp_hdr* tcp, int* mss, int* wscl, int* tso,
+                         ci_uint32* tsval)
+{
+  ci_uint8* opt = (ci_uint8*) (tcp + 1);
+  ci_uint8* end = (ci_uint8*) tcp + CI_TCP_HDR_LEN(tcp);
+
+  *mss = 0;
+  *wscl = -1;
+  *tso = 0;
+  while( opt < end ) {
+    if( opt[0] == CI_TCP_OPT_END )
+      break;
+    if( opt[0] == CI_TCP_OPT_NOP ) {
+      ++opt;
+      continue;
+    }
+    if( opt + 1 >= end || opt[1] < 2 || opt + opt[1] > end )
+      break;
+    switch( opt[0] ) {
+    case CI_TCP_OPT_MSS:
+      if( opt[1] == 4 )
+        *mss = (opt[2] << 8) | opt[3];
+      break;
+    case CI_TCP_OPT_WINSCALE:
+      if( opt[1] == 3 )
+        *wscl = CI_MIN(opt[2], CI_TCP_WSCL_MAX);
+      break;
+    case CI_TCP_OPT_TIMESTAMP:
+      if( opt[1] == 10 ) {
+        *tso = 1;
+        *tsval = CI_BSWAP_BE32(*(ci_uint32*) (opt + 2));
+      }
+      break;
+    }
+    opt += opt[1];
+  }
+}
+
+
+/**********************************************************************
+ * Reading and writing captures.
+ */
+
+struct pcap_reader {
+  FILE*     fp;
+  int       swap;
+  int       nsec;
+  unsigned  linktype;
+};
+
+
+static ci_uint32 pcap_u32(const struct pcap_reader* r, ci_uint32 v)
+{
+  return r->swap ? CI_BSWAP_32(v) : v;
+}
+
+
+static int pcap_open(struct pcap_reader* r, const char* path)
+{
+  struct pcap_file_hdr fh;
+
+  if( (r->fp = fopen(path, "r")) == NULL ) {
+    fprintf(stderr, "ERROR: %s: %s\n", path, strerror(errno));
+    return -errno;
+  }
+  if( fread(&fh, sizeof(fh), 1, r->fp) != 1 )
+    goto bad;
+  r->swap = fh.magic == CI_BSWAP_32(PCAP_MAGIC_US) ||
+            fh.magic == CI_BSWAP_32(PCAP_MAGIC_NS);
+  fh.magic = pcap_u32(r, fh.magic);
+  if( fh.magic != PCAP_MAGIC_US && fh.magic != PCAP_MAGIC_NS )
+    goto bad;
+  r->nsec = fh.magic == PCAP_MAGIC_NS;
+  r->linktype = pcap_u32(r, fh.linktype);
+  if( r->linktype != PCAP_LINKTYPE_ETH && r->linktype != PCAP_LINKTYPE_SLL ) {
+    fprintf(stderr, "ERROR: %s: unsupported link type %u\n",
+            path, r->linktype);
+    fclose(r->fp);
+    return -EINVAL;
+  }
+  return 0;
+
+ bad:
+  fprintf(stderr, "ERROR: %s: not a pcap file\n", path);
+  fclose(r->fp);
+  return -EINVAL;
+}
+
+
+/* Read the next record, converted to an Ethernet frame.  Returns the
+ * length of the frame, 0 at the end of the file, or -EMSGSIZE if the
+ * record is truncated or too big.
+ */
+static int pcap_next(struct pcap_reader* r, char* frame,
+                     ci_uint32* ts_sec, ci_uint32* ts_usec)
+{
+  struct pcap_rec_hdr rh;
+  char buf[65536 + SLL_HDR_LEN];
+  ci_uint32 caplen, len;
+  ci_uint16 proto;
+
+  if( fread(&rh, sizeof(rh), 1, r->fp) != 1 )
+    return 0;
+  caplen = pcap_u32(r, rh.caplen);
+  len = pcap_u32(r, rh.len);
+  if( caplen > sizeof(buf) || fread(buf, caplen, 1, r->fp) != 1 )
+    return 0;
+  *ts_sec = pcap_u32(r, rh.ts_sec);
+  *ts_usec = pcap_u32(r, rh.ts_frac) / (r->nsec ? 1000 : 1);
+
+  if( caplen < len ) {
+    ++stats.truncated;
+    return -EMSGSIZE;
+  }
+  if( r->linktype == PCAP_LINKTYPE_SLL ) {
+    /* Linux "cooked" capture: keep the protocol, make up the MACs. */
+    if( caplen < SLL_HDR_LEN )
+      return -EMSGSIZE;
+    caplen -= SLL_HDR_LEN - ETH_HLEN;
+    if( caplen > FRAME_MAX )
+      goto too_big;
+    memcpy(&proto, buf + 14, 2);
+    memset(frame, 0, 12);
+    memcpy(frame + 12, &proto, 2);
+    memcpy(frame + ETH_HLEN, buf + SLL_HDR_LEN, caplen - ETH_HLEN);
+    return caplen;
+  }
+  if( caplen > FRAME_MAX )
+    goto too_big;
+  memcpy(frame, buf, caplen);
+  return caplen;
+
+ too_big:
+  /* Probably coalesced by GRO before capture. */
+  ++stats.too_big;
+  return -EMSGSIZE;
+}
+
+
+static int pcap_create(const char* path)
+{
+  struct pcap_file_hdr fh = {
+    PCAP_MAGIC_US, 2, 4, 0, 0, 65535, PCAP_LINKTYPE_ETH,
+  };
+
+  if( (out_fp = fopen(path, "w")) == NULL ) {
+    fprintf(stderr, "ERROR: %s: %s\n", path, strerror(errno));
+    return -errno;
+  }
+  if( fwrite(&fh, sizeof(fh), 1, out_fp) != 1 )
+    return -EIO;
+  return 0;
+}
+
+
+static void pcap_write(void* arg, const void* frame, int len)
+{
+  struct pcap_rec_hdr rh;
+
+  ++stats.tx_frames;
+  if( out_fp == NULL )
+    return;
+  rh.ts_sec = out_ts_sec;
+  rh.ts_frac = out_ts_usec;
+  rh.caplen = rh.len = len;
+  fwrite(&rh, sizeof(rh), 1, out_fp);
+  fwrite(frame, len, 1, out_fp);
+}
+
+
+/**********************************************************************
+ * Loading the capture.
+ */
+
+static int flow_find(ci_uint32 raddr_be32, ci_uint16 rport_be16,
+                     ci_uint16 lport_be16)
+{
+  int i;
+
+  /* Captures with very many connections would want a hash table, but
+   * this is not on the timed path.
+   */
+  for( i = n_flows - 1; i >= 0; --i )
+    if( flows[i].raddr_be32 == raddr_be32 &&
+        flows[i].rport_be16 == rport_be16 &&
+        flows[i].lport_be16 == lport_be16 )
+      return i;
+  if( n_flows == max_flows )
+    return -ENOSPC;
+
+  i = n_flows++;
+  memset(&flows[i], 0, sizeof(flows[i]));
+  flows[i].raddr_be32 = raddr_be32;
+  flows[i].rport_be16 = rport_be16;
+  flows[i].lport_be16 = lport_be16;
+  flows[i].conn.laddr_be32 = local_be32;
+  flows[i].conn.lport_be16 = lport_be16;
+  flows[i].conn.raddr_be32 = raddr_be32;
+  flows[i].conn.rport_be16 = rport_be16;
+  flows[i].conn.snd_wscl = -1;
+  flows[i].conn.rcv_wscl = -1;
+  return i;
+}
+
+
+/* Find the IP header of an IPv4 frame, stripping one VLAN tag. */
+static ci_ip4_hdr* frame_ip(char* frame, int* len)
+{
+  ci_ether_hdr* eth = (ci_ether_hdr*) frame;
+  ci_ip4_hdr* ip;
+
+  if( *len < ETH_HLEN )
+    return NULL;
+  if( eth->ether_type == CI_ETHERTYPE_8021Q ) {
+    if( *len < ETH_HLEN + ETH_VLAN_HLEN )
+      return NULL;
+    memmove(frame + ETH_VLAN_HLEN, frame, 12);
+    frame += ETH_VLAN_HLEN;
+    *len -= ETH_VLAN_HLEN;
+    eth = (ci_ether_hdr*) frame;
+  }
+  if( eth->ether_type != CI_ETHERTYPE_IP ||
+      *len < ETH_HLEN + (int) (sizeof(ci_ip4_hdr) + sizeof(ci_tcp_hdr)) )
+    return NULL;
+  ip = (ci_ip4_hdr*) (frame + ETH_HLEN);
+  if( CI_IP4_IHL(ip) < sizeof(ci_ip4_hdr) || ip->ip_protocol != IPPROTO_TCP ||
+      (ip->ip_frag_off_be16 & (CI_IP4_OFFSET_MASK | CI_IP4_FRAG_MORE)) ||
+      *len < ETH_HLEN + CI_BSWAP_BE16(ip->ip_tot_len_be16) )
+    return NULL;
+  return ip;
+}
+
+
+static int load_capture(const char* path)
+{
+  struct pcap_reader r;
+  char frame[FRAME_MAX];
+  struct flow* f;
+  ci_ip4_hdr* ip;
+  ci_tcp_hdr* tcp;
+  ci_uint32 ts_sec, ts_usec, seq, tsval = 0;
+  int rc, len, i, from_peer, mss, wscl, tso, paylen;
+  char* start;
+
+  if( (rc = pcap_open(&r, path)) < 0 )
+    return rc;
+
+  while( (len = pcap_next(&r, frame, &ts_sec, &ts_usec)) != 0 ) {
+    ++stats.frames;
+    if( len < 0 )
+      continue;
+    if( (ip = frame_ip(frame, &len)) == NULL ) {
+      ++stats.not_tcp;
+      continue;
+    }
+    start = (char*) ip - ETH_HLEN;
+    tcp = (ci_tcp_hdr*) ((char*) ip + CI_IP4_IHL(ip));
+    if( local_be32 == 0 )
+      local_be32 = ip->ip_daddr_be32;
+
+    if( ip->ip_daddr_be32 == local_be32 )
+      from_peer = 1;
+    else if( ip->ip_saddr_be32 == local_be32 )
+      from_peer = 0;
+    else {
+      ++stats.not_local;
+      continue;
+    }
+    i = from_peer ?
+      flow_find(ip->ip_saddr_be32, tcp->tcp_source_be16, tcp->tcp_dest_be16):
+      flow_find(ip->ip_daddr_be32, tcp->tcp_dest_be16, tcp->tcp_source_be16);
+    if( i < 0 ) {
+      ++stats.no_flow;
+      continue;
+    }
+    f = &flows[i];
+    seq = CI_BSWAP_BE32(tcp->tcp_seq_be32);
+
+    if( tcp->tcp_flags & CI_TCP_FLAG_SYN ) {
+      ++stats.syns;
+      tcp_syn_opts(tcp, &mss, &wscl, &tso, &tsval);
+      if( from_peer ) {
+        f->have_rsyn = 1;
+        f->conn.rcv_nxt = seq + 1;
+        f->conn.smss = mss;
+        f->conn.snd_wscl = wscl;
+        f->conn.tso = tso;
+        f->conn.tsrecent = tsval;
+      }
+      else {
+        f->have_lsyn = 1;
+        f->conn.snd_nxt = seq + 1;
+        f->conn.rcv_wscl = wscl;
+      }
+      continue;
+    }
+    if( ! from_peer ) {
+      ++stats.from_local;
+      continue;
+    }
+    if( tcp->tcp_flags & CI_TCP_FLAG_RST && f->ts == NULL && ! f->have_seq )
+      /* Nothing to reset. */
+      continue;
+
+    /* First segment from the peer fills in anything the handshake did
+     * not tell us.
+     */
+    if( ! f->have_seq ) {
+      if( ! f->have_rsyn )
+        f->conn.rcv_nxt = seq;
+      if( ! f->have_lsyn )
+        f->conn.snd_nxt = CI_BSWAP_BE32(tcp->tcp_ack_be32);
+      if( ! (f->have_rsyn && f->have_lsyn) ) {
+        f->conn.snd_wscl = f->conn.rcv_wscl = -1;
+        f->conn.tso = tcp_tsval(tcp) != NULL;
+      }
+      f->conn.snd_wnd = CI_BSWAP_BE16(tcp->tcp_window_be16) <<
+                        CI_MAX(f->conn.snd_wscl, 0);
+      f->seq_lo = f->seq_hi = seq;
+      f->have_seq = 1;
+    }
+    paylen = CI_BSWAP_BE16(ip->ip_tot_len_be16) - CI_IP4_IHL(ip) -
+             CI_TCP_HDR_LEN(tcp);
+    if( SEQ_GT(seq + paylen, f->seq_hi) )
+      f->seq_hi = seq + paylen;
+    if( f->conn.tso && tcp_tsval(tcp) != NULL ) {
+      tsval = CI_BSWAP_BE32(*tcp_tsval(tcp));
+      if( ! f->have_ts ) {
+        f->ts_lo = f->ts_hi = tsval;
+        if( ! f->have_rsyn )
+          f->conn.tsrecent = tsval;
+        f->have_ts = 1;
+      }
+      else if( SEQ_GT(tsval, f->ts_hi) ) {
+        f->ts_hi = tsval;
+      }
+    }
+
+    if( (n_segs & (n_segs - 1)) == 0 &&
+        (segs = realloc(segs, sizeof(*segs) * (n_segs ? n_segs * 2 : 1024)))
+        == NULL )
+      return -ENOMEM;
+    segs[n_segs].len = len;
+    segs[n_segs].frame = malloc(len);
+    segs[n_segs].flow = i;
+    segs[n_segs].ts_sec = ts_sec;
+    segs[n_segs].ts_usec = ts_usec;
+    if( segs[n_segs].frame == NULL )
+      return -ENOMEM;
+    memcpy(segs[n_segs].frame, start, len);
+    ++n_segs;
+  }
+  fclose(r.fp);
+  return 0;
+}
+
+
+/**********************************************************************
+ * Replay.
+ */
+
+static int create_sockets(void)
+{
+  struct flow* f;
+  int i;
+
+  for( i = 0; i < n_flows; ++i ) {
+    f = &flows[i];
+    if( ! f->have_seq )
+      continue;
+    if( f->conn.rcv_wscl < 0 || f->conn.snd_wscl < 0 )
+      f->conn.rcv_wscl = f->conn.snd_wscl = -1;
+    if( (f->ts = fake_netif_tcp_established(&fn, &f->conn)) == NULL ) {
+      fprintf(stderr, "ERROR: failed to create socket %d of %d\n",
+              i, n_flows);
+      return -ENOSPC;
+    }
+  }
+  return 0;
+}
+
+
+/* Rewrite a segment for the [rep]th repetition, and the stack as it is
+ * now.  Returns 0 if the segment should be skipped.
+ */
+static int seg_prepare(const struct seg* s, char* frame, int rep, int last)
+{
+  struct flow* f = &flows[s->flow];
+  ci_ether_hdr* eth = (ci_ether_hdr*) frame;
+  ci_ip4_hdr* ip = (ci_ip4_hdr*) (frame + ETH_HLEN);
+  ci_tcp_hdr* tcp = (ci_tcp_hdr*) ((char*) ip + CI_IP4_IHL(ip));
+  ci_uint32* tsval;
+  ci_uint32 v;
+
+  memcpy(frame, s->frame, s->len);
+  if( ! last && (tcp->tcp_flags & (CI_TCP_FLAG_FIN | CI_TCP_FLAG_RST)) )
+    return 0;
+
+  memcpy(eth->ether_dhost, fn.mac, ETH_ALEN);
+  memcpy(eth->ether_shost, fn.peer_mac, ETH_ALEN);
+
+  if( rep ) {
+    v = CI_BSWAP_BE32(tcp->tcp_seq_be32) + rep * (f->seq_hi - f->seq_lo);
+    tcp_set_word(tcp, &tcp->tcp_seq_be32, CI_BSWAP_BE32(v));
+    if( f->have_ts && (tsval = tcp_tsval(tcp)) != NULL ) {
+      v = CI_BSWAP_BE32(*tsval) + rep * (f->ts_hi - f->ts_lo + 1);
+      tcp_set_word(tcp, tsval, CI_BSWAP_BE32(v));
+    }
+  }
+  if( (tcp->tcp_flags & CI_TCP_FLAG_ACK) &&
+      SEQ_GT(CI_BSWAP_BE32(tcp->tcp_ack_be32), tcp_snd_nxt(f->ts)) )
+    tcp_set_word(tcp, &tcp->tcp_ack_be32, CI_BSWAP_BE32(tcp_snd_nxt(f->ts)));
+  f->touched = 1;
+  return 1;
+}
+
+
+/* Poll the stack, and let the application and the peer catch up. */
+static void poll_stack(void)
+{
+  ci_netif* ni = &fn.ni;
+  ci_uint64 start, end;
+  int i;
+
+  do {
+    ci_frc64(&start);
+    ci_netif_poll(ni);
+    ci_frc64(&end);
+    stats.poll_cycles += end - start;
+
+    for( i = 0; i < n_flows; ++i )
+      if( flows[i].touched ) {
+        flows[i].touched = 0;
+        stats.rx_bytes += fake_netif_tcp_drain(&fn, flows[i].ts);
+      }
+  } while( fake_netif_peer_poll(&fn, pcap_write, NULL) > 0 ||
+           ci_netif_has_event(ni) );
+}
+
+
+static void replay(int repeat, int batch)
+{
+  char frame[FRAME_MAX];
+  int rep, i, n, rc;
+
+  for( rep = 0; rep < repeat; ++rep )
+    for( i = 0; i < n_segs; ) {
+      out_ts_sec = segs[i].ts_sec;
+      out_ts_usec = segs[i].ts_usec;
+      for( n = 0; n < batch && i < n_segs; ++i ) {
+        if( flows[segs[i].flow].ts == NULL ||
+            ! seg_prepare(&segs[i], frame, rep, rep == repeat - 1) )
+          continue;
+        while( (rc = fake_netif_peer_send(&fn, frame, segs[i].len)) ==
+               -EAGAIN ) {
+          ++stats.send_again;
+          poll_stack();
+        }
+        if( rc == 0 ) {
+          ++stats.replayed;
+          ++n;
+        }
+      }
+      poll_stack();
+    }
+}
+
+
+static void report(int repeat)
+{
+  double poll_s = (double) stats.poll_cycles / ((double) ci_cpu_khz * 1e3);
+  unsigned long n = stats.replayed;
+
+  printf("# frames in capture:     %lu\n", stats.frames);
+  printf("#   not IPv4/TCP:        %lu\n", stats.not_tcp);
+  printf("#   truncated:           %lu\n", stats.truncated);
+  printf("#   too big:             %lu\n", stats.too_big);
+  printf("#   not to/from local:   %lu\n", stats.not_local);
+  printf("#   SYN:                 %lu\n", stats.syns);
+  printf("#   from local:          %lu\n", stats.from_local);
+  printf("#   too many flows:      %lu\n", stats.no_flow);
+  printf("# connections:           %d\n", n_flows);
+  printf("# repetitions:           %d\n", repeat);
+  printf("# segments replayed:     %lu\n", n);
+  printf("# bytes delivered:       %lu\n", stats.rx_bytes);
+  printf("# frames sent by stack:  %lu\n", stats.tx_frames);
+  printf("# link full:             %lu\n", stats.send_again);
+  if( n == 0 )
+    return;
+  printf("poll_pkts_per_sec:       %.0f\n", n / poll_s);
+  printf("poll_cycles_per_pkt:     %.1f\n",
+         (double) stats.poll_cycles / n);
+  printf("handle_rx_calls:         %lu\n", stats.handle_rx_calls);
+  if( stats.handle_rx_calls ) {
+    printf("handle_rx_pkts_per_sec:  %.0f\n", stats.handle_rx_calls /
+           ((double) stats.handle_rx_cycles / ((double) ci_cpu_khz * 1e3)));
+    printf("handle_rx_cycles_per_pkt:%.1f\n",
+           (double) stats.handle_rx_cycles / stats.handle_rx_calls);
+  }
+}
+
+
+static void usage(void)
+{
+  fprintf(stderr, "usage:\n");
+  fprintf(stderr, "  pcap_replay [options] -i in.pcap\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "options:\n");
+  fprintf(stderr, "  -o FILE   - write frames sent by the stack to FILE\n");
+  fprintf(stderr, "  -l IP     - local address (default: destination of "
+          "first TCP segment)\n");
+  fprintf(stderr, "  -r N      - replay N times (default 1)\n");
+  fprintf(stderr, "  -b N      - segments per poll (default 32)\n");
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+
+int main(int argc, char* argv[])
+{
+  const char* in_path = NULL;
+  const char* out_path = NULL;
+  int repeat = 1, batch = 32;
+  struct in_addr a;
+  int c, rc;
+
+  while( (c = getopt(argc, argv, "i:o:l:r:b:")) != -1 )
+    switch( c ) {
+    case 'i':
+      in_path = optarg;
+      break;
+    case 'o':
+      out_path = optarg;
+      break;
+    case 'l':
+      if( ! inet_aton(optarg, &a) )
+        usage();
+      local_be32 = a.s_addr;
+      break;
+    case 'r':
+      repeat = atoi(optarg);
+      break;
+    case 'b':
+      batch = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  if( optind != argc || in_path == NULL || repeat < 1 || batch < 1 )
+    usage();
+
+  if( (rc = fake_netif_ctor(&fn, "pcap_replay")) < 0 ) {
+    fprintf(stderr, "ERROR: failed to build stack (%d)\n", rc);
+    return 1;
+  }
+  /* Each connection needs an endpoint. */
+  max_flows = NI_OPTS(&fn.ni).max_ep_bufs;
+  flows = calloc(max_flows, sizeof(*flows));
+  if( flows == NULL ||
+      load_capture(in_path) < 0 || create_sockets() < 0 ||
+      (out_path != NULL && pcap_create(out_path) < 0) ) {
+    fake_netif_dtor(&fn);
+    return 1;
+  }
+
+  replay(repeat, batch);
+  report(repeat);
+
+  if( out_fp != NULL )
+    fclose(out_fp);
+  fake_netif_dtor(&fn);
+  return 0;
+}
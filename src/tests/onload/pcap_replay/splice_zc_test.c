@@ -0,0 +1,305 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Check that splice() between a pipe and a TCP socket moves
+**          buffers without losing or reordering data.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* With an established connection and a pipe in the same stack:
+ *
+ *  - the peer sends some segments, which ci_pipe_zc_recv_tcp() moves from
+ *    the receive queue into the pipe, first limited to fewer bytes than
+ *    the second buffer holds; reading the pipe gives back what was sent;
+ *  - data written to the pipe is moved onto the send queue by
+ *    ci_pipe_zc_send_tcp(), which leaves a buffer alone if asked for less
+ *    than it holds; the peer receives what was written.
+ *
+ * Both calls take the stack lock themselves.  Nothing is left for the
+ * unlock hooks to do, so we drop the lock around them without needing the
+ * driver.
+ */
+
+#define _GNU_SOURCE
+#include "fake_netif.h"
+#include <onload/oo_pipe.h>
+#include <ci/tools/ipcsum.h>
+#include "../test_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <arpa/inet.h>
+
+
+#define FRAME_MAX    (ETH_HLEN + ETH_VLAN_HLEN + 1792)
+#define PEER_WSCL    7
+#define PEER_WND     (1u << 22)
+#define RX_SEG       1000
+#define RX_N_SEGS    3
+#define DATA_MAX     (1u << 16)
+
+static struct fake_netif fn;
+static struct fake_tcp_conn conn;
+static ci_tcp_state* ts;
+static struct oo_pipe* p;
+
+/* What the peer has received, by offset from conn.snd_nxt. */
+static char peer_data[DATA_MAX];
+static unsigned peer_bytes;
+
+
+
+static void fill(char* buf, int len, unsigned seed)
+{
+  int i;
+  for( i = 0; i < len; ++i )
+    buf[i] = (char) (seed + i * 7);
+}
+
+
+static void peer_rx(void* arg, const void* frame, int len)
+{
+  const ci_ether_hdr* eth = frame;
+  const ci_ip4_hdr* ip = (const ci_ip4_hdr*) (eth + 1);
+  const ci_tcp_hdr* tcp;
+  unsigned off;
+  int paylen;
+
+  if( len < ETH_HLEN + sizeof(*ip) ||
+      eth->ether_type != CI_ETHERTYPE_IP ||
+      ip->ip_protocol != IPPROTO_TCP )
+    return;
+  tcp = (const ci_tcp_hdr*) ((const char*) ip + CI_IP4_IHL(ip));
+  paylen = CI_BSWAP_BE16(ip->ip_tot_len_be16) - CI_IP4_IHL(ip) -
+           CI_TCP_HDR_LEN(tcp);
+  off = CI_BSWAP_BE32(tcp->tcp_seq_be32) - conn.snd_nxt;
+  if( paylen <= 0 || off + paylen > DATA_MAX )
+    return;
+  memcpy(peer_data + off, (const char*) tcp + CI_TCP_HDR_LEN(tcp), paylen);
+  peer_bytes = CI_MAX(peer_bytes, off + paylen);
+}
+
+
+/* Send [len] bytes of [data] from the peer at [seq]. */
+static int peer_send(ci_uint32 seq, const char* data, int len)
+{
+  char frame[FRAME_MAX];
+  ci_ether_hdr* eth = (ci_ether_hdr*) frame;
+  ci_ip4_hdr* ip = (ci_ip4_hdr*) (eth + 1);
+  ci_tcp_hdr* tcp = (ci_tcp_hdr*) (ip + 1);
+  int rc;
+
+  memset(frame, 0, ETH_HLEN + sizeof(*ip) + sizeof(*tcp));
+  memcpy(eth->ether_dhost, fn.mac, ETH_ALEN);
+  memcpy(eth->ether_shost, fn.peer_mac, ETH_ALEN);
+  eth->ether_type = CI_ETHERTYPE_IP;
+
+  ci_ip_hdr_init_fixed(ip, IPPROTO_TCP, 64, 0);
+  ip->ip_tot_len_be16 = CI_BSWAP_BE16(sizeof(*ip) + sizeof(*tcp) + len);
+  ip->ip_saddr_be32 = conn.raddr_be32;
+  ip->ip_daddr_be32 = conn.laddr_be32;
+  ip->ip_check_be16 = ci_ip_checksum(ip);
+
+  tcp->tcp_source_be16 = conn.rport_be16;
+  tcp->tcp_dest_be16 = conn.lport_be16;
+  tcp->tcp_seq_be32 = CI_BSWAP_BE32(seq);
+  tcp->tcp_ack_be32 = CI_BSWAP_BE32(conn.snd_nxt);
+  CI_TCP_HDR_SET_LEN(tcp, sizeof(*tcp));
+  tcp->tcp_flags = CI_TCP_FLAG_ACK | CI_TCP_FLAG_PSH;
+  tcp->tcp_window_be16 = CI_BSWAP_BE16(PEER_WND >> PEER_WSCL);
+  memcpy(tcp + 1, data, len);
+  tcp->tcp_check_be16 = ci_tcp_checksum(ip, tcp, tcp + 1);
+
+  while( (rc = fake_netif_peer_send(&fn, frame, ETH_HLEN + sizeof(*ip) +
+                                    sizeof(*tcp) + len)) == -EAGAIN ) {
+    fake_netif_peer_poll(&fn, peer_rx, NULL);
+    ci_netif_poll(&fn.ni);
+  }
+  return rc;
+}
+
+
+static void settle(void)
+{
+  while( fake_netif_peer_poll(&fn, peer_rx, NULL) > 0 ||
+         ci_netif_has_event(&fn.ni) )
+    ci_netif_poll(&fn.ni);
+}
+
+
+/* As oo_pipe_init() does, with both ends non-blocking. */
+static struct oo_pipe* pipe_alloc(ci_netif* ni)
+{
+  citp_waitable_obj* wo = citp_waitable_obj_alloc(ni);
+  struct oo_pipe* pipe;
+
+  if( wo == NULL )
+    return NULL;
+  pipe = &wo->pipe;
+  citp_waitable_reinit(ni, &pipe->b);
+  pipe->b.state = CI_TCP_STATE_PIPE;
+  pipe->bytes_added = 0;
+  pipe->bytes_removed = 0;
+  pipe->aflags = (CI_PFD_AFLAG_NONBLOCK << CI_PFD_AFLAG_READER_SHIFT) |
+                 (CI_PFD_AFLAG_NONBLOCK << CI_PFD_AFLAG_WRITER_SHIFT);
+  oo_pipe_buf_clear_state(ni, pipe);
+  pipe->bufs_num = 0;
+  pipe->bufs_max = 16 + 1;
+  pipe->buf_base = 0;
+  pipe->buf_end = OO_PIPE_BUF_MAX_SIZE;
+  return pipe;
+}
+
+
+static int zc_recv(int len)
+{
+  int rc;
+  ci_netif_unlock(&fn.ni);
+  rc = ci_pipe_zc_recv_tcp(&fn.ni, p, ts, len);
+  ci_netif_lock(&fn.ni);
+  return rc;
+}
+
+
+static int zc_send(int len)
+{
+  int rc;
+  ci_netif_unlock(&fn.ni);
+  rc = ci_pipe_zc_send_tcp(&fn.ni, p, ts, len, MSG_DONTWAIT);
+  ci_netif_lock(&fn.ni);
+  return rc;
+}
+
+
+static void test_sock_to_pipe(ci_netif* ni)
+{
+  char sent[RX_SEG * RX_N_SEGS], got[sizeof(sent)];
+  struct iovec iov = { got, sizeof(got) };
+  int i, rc;
+
+  fill(sent, sizeof(sent), 1);
+  for( i = 0; i < RX_N_SEGS; ++i )
+    CHECK(peer_send(conn.rcv_nxt + i * RX_SEG, sent + i * RX_SEG,
+                    RX_SEG) == 0);
+  settle();
+  CHECK(tcp_rcv_usr(ts) == sizeof(sent));
+
+  /* Only whole buffers are moved. */
+  CHECK(zc_recv(RX_SEG + RX_SEG / 2) == RX_SEG);
+  CHECK(tcp_rcv_usr(ts) == sizeof(sent) - RX_SEG);
+  CHECK(zc_recv(INT_MAX) == sizeof(sent) - RX_SEG);
+  CHECK(tcp_rcv_usr(ts) == 0);
+  CHECK(oo_pipe_data_len(p) == sizeof(sent));
+#if CI_CFG_STATS_NETIF
+  CHECK(ni->state->stats.tcp_splice_rx_pkts == RX_N_SEGS);
+#endif
+
+  rc = ci_pipe_read(ni, p, &iov, 1);
+  CHECK(rc == sizeof(sent));
+  CHECK(rc == sizeof(sent) && ! memcmp(got, sent, sizeof(sent)));
+  CHECK(oo_pipe_data_len(p) == 0);
+}
+
+
+static void test_pipe_to_sock(ci_netif* ni)
+{
+  int mss = tcp_eff_mss(ts);
+  int len = 3 * mss + 100;
+  char* sent = malloc(len + mss);
+  struct iovec iov = { sent, len };
+  int rc;
+
+  /* The first splice from an empty pipe finds nothing to send, but lays
+   * out the buffers written after it for the socket.
+   */
+  rc = zc_send(INT_MAX);
+  CHECK(rc < 0 && errno == EAGAIN);
+  CHECK(p->buf_base == ETH_HLEN + ts->outgoing_hdrs_len);
+  CHECK(p->buf_end == p->buf_base + mss);
+
+  fill(sent, len + mss, 2);
+  ci_netif_unlock(ni);
+  rc = ci_pipe_write(ni, p, &iov, 1);
+  ci_netif_lock(ni);
+  CHECK(rc == len);
+
+  /* Asked for less than the first buffer holds, nothing is moved. */
+  CHECK(zc_send(mss - 1) == 0);
+  CHECK(oo_pipe_data_len(p) == len);
+  CHECK(zc_send(INT_MAX) == len);
+  CHECK(oo_pipe_data_len(p) == 0);
+#if CI_CFG_STATS_NETIF
+  CHECK(ni->state->stats.tcp_splice_tx_pkts == 4);
+#endif
+
+  /* A second round reuses the pipe's layout. */
+  iov.iov_base = sent + len;
+  iov.iov_len = mss;
+  ci_netif_unlock(ni);
+  rc = ci_pipe_write(ni, p, &iov, 1);
+  ci_netif_lock(ni);
+  CHECK(rc == mss);
+  CHECK(zc_send(INT_MAX) == mss);
+
+  settle();
+  CHECK(peer_bytes == len + mss);
+  CHECK(peer_bytes == len + mss && ! memcmp(peer_data, sent, len + mss));
+  free(sent);
+}
+
+
+int main(int argc, char* argv[])
+{
+  ci_netif* ni;
+  int rc;
+
+  if( (rc = fake_netif_ctor(&fn, "splice_zc_test")) < 0 ) {
+    fprintf(stderr, "ERROR: failed to build stack (%d)\n", rc);
+    return 1;
+  }
+  ni = &fn.ni;
+
+  conn.laddr_be32 = htonl(0x0a000001);
+  conn.lport_be16 = htons(5001);
+  conn.raddr_be32 = htonl(0x0a000002);
+  conn.rport_be16 = htons(40000);
+  conn.snd_nxt = 0x10000000;
+  conn.rcv_nxt = 0x20000000;
+  conn.snd_wnd = PEER_WND;
+  conn.smss = 0;
+  conn.snd_wscl = PEER_WSCL;
+  conn.rcv_wscl = PEER_WSCL;
+  conn.tso = 0;
+  conn.tsrecent = 0;
+  if( (ts = fake_netif_tcp_established(&fn, &conn)) == NULL ||
+      (p = pipe_alloc(ni)) == NULL ) {
+    fprintf(stderr, "ERROR: failed to create socket or pipe\n");
+    fake_netif_dtor(&fn);
+    return 1;
+  }
+  ts->cwnd = ts->ssthresh = PEER_WND;
+
+  test_sock_to_pipe(ni);
+  test_pipe_to_sock(ni);
+
+  fake_netif_dtor(&fn);
+  return test_check_result();
+}
@@ -0,0 +1,444 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Time passive opens on a listening socket under a SYN flood.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* Builds a stack with fake_netif.c and a socket listening on it, then:
+ *
+ *  - floods the listener with SYNs from distinct sources which never
+ *    complete the handshake, leaving that many half-open connections in
+ *    the stack's SYN-RECV table;
+ *  - completes a number of handshakes (SYN, SYN-ACK, ACK) one at a time,
+ *    each promoted to the accept queue.
+ *
+ * We report the rate of each, and the cycles spent in each
+ * ci_tcp_listenq_lookup() call (timed via the linker's --wrap), separately
+ * for those that find a half-open connection and those that miss.  Every
+ * SYN misses; each handshake's ACK hits, unless it carries a syncookie.
+ *
+ * With -c syncookies are enabled and the listen queue is sized to be
+ * filled by the flood, so that every handshake is completed from a
+ * syncookie.  Each ACK then misses in a full table.
+ *
+ * The listen queue, EF_TCP_SYNRECV_MAX and EF_MAX_ENDPOINTS are sized for
+ * the flood and the handshakes unless set in the environment.  Accepted
+ * connections are left on the accept queue.
+ *
+ * Routes and filters for accepted connections come from the driver, so
+ * here cicp_user_retrieve() and ci_tcp_helper_ep_set_filters() are wrapped
+ * to use fake_netif's one route and the s/w filter table.
+ *
+ * Usage: syn_flood_bench [-f flood] [-n handshakes] [-c]
+ */
+
+#define _GNU_SOURCE
+#include "fake_netif.h"
+#include <onload/ul/tcp_helper.h>
+#include <ci/tools/ipcsum.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+
+#define FRAME_MAX           (ETH_HLEN + ETH_VLAN_HLEN + 128)
+#define LOCAL_ADDR          0x0a000001
+#define LOCAL_PORT          5001
+/* Flood sources are 10.1.x.x and handshake sources 10.2.x.x. */
+#define FLOOD_ADDR          0x0a010000
+#define CONN_ADDR           0x0a020000
+#define PEER_ISN            0x10000000
+#define PEER_MSS            1460
+#define POLL_BATCH          32
+#define POLL_MAX            1000
+
+
+static struct fake_netif fn;
+static ci_tcp_socket_listen* tls;
+
+/* The handshake in progress, and the SYN-ACK the peer has received. */
+static ci_uint32 want_raddr_be32;
+static ci_uint16 want_rport_be16;
+static int       got_synack;
+static ci_uint32 synack_seq;
+
+enum { LOOKUP_FLOOD, LOOKUP_CONN, LOOKUP_N };
+
+static int lookup_phase;
+
+static struct {
+  unsigned long  hits[LOOKUP_N];
+  unsigned long  misses[LOOKUP_N];
+  ci_uint64      hit_cycles[LOOKUP_N];
+  ci_uint64      miss_cycles[LOOKUP_N];
+  unsigned long  synacks;
+  unsigned long  flood_sent;
+  unsigned long  conns;
+  unsigned long  conn_fails;
+  ci_uint64      flood_cycles;
+  ci_uint64      conn_cycles;
+} stats;
+
+
+/**********************************************************************
+ * Stand-ins for the driver and control plane, and timing of
+ * ci_tcp_listenq_lookup(), via the linker's --wrap.
+ */
+
+extern void __wrap_cicp_user_retrieve(ci_netif*, ci_ip_cached_hdrs*,
+                                      const struct oo_sock_cplane*);
+extern int __wrap_ci_tcp_helper_ep_set_filters(ci_fd_t, oo_sp, ci_ifid_t,
+                                               oo_sp);
+extern ci_tcp_state_synrecv*
+__real_ci_tcp_listenq_lookup(ci_netif*, ci_tcp_socket_listen*,
+                             ciip_tcp_rx_pkt*);
+extern ci_tcp_state_synrecv*
+__wrap_ci_tcp_listenq_lookup(ci_netif*, ci_tcp_socket_listen*,
+                             ciip_tcp_rx_pkt*);
+
+void __wrap_cicp_user_retrieve(ci_netif* ni, ci_ip_cached_hdrs* ipcache,
+                               const struct oo_sock_cplane* sock_cp)
+{
+  fake_netif_route(&fn, ipcache, sock_cp);
+}
+
+
+int __wrap_ci_tcp_helper_ep_set_filters(ci_fd_t fd, oo_sp ep,
+                                        ci_ifid_t bindto_ifindex,
+                                        oo_sp from_tcp_id)
+{
+  ci_netif* ni = &fn.ni;
+  ci_sock_cmn* s = SP_TO_SOCK(ni, ep);
+
+  return ci_netif_filter_insert(ni, ep, AF_SPACE_FLAG_IP4,
+                                CI_ADDR_FROM_IP4(sock_laddr_be32(s)),
+                                sock_lport_be16(s),
+                                CI_ADDR_FROM_IP4(sock_raddr_be32(s)),
+                                sock_rport_be16(s), IPPROTO_TCP);
+}
+
+
+ci_tcp_state_synrecv*
+__wrap_ci_tcp_listenq_lookup(ci_netif* ni, ci_tcp_socket_listen* tls,
+                             ciip_tcp_rx_pkt* rxp)
+{
+  ci_tcp_state_synrecv* tsr;
+  ci_uint64 start, end;
+
+  ci_frc64(&start);
+  tsr = __real_ci_tcp_listenq_lookup(ni, tls, rxp);
+  ci_frc64(&end);
+  if( tsr != NULL ) {
+    ++stats.hits[lookup_phase];
+    stats.hit_cycles[lookup_phase] += end - start;
+  }
+  else {
+    ++stats.misses[lookup_phase];
+    stats.miss_cycles[lookup_phase] += end - start;
+  }
+  return tsr;
+}
+
+
+/**********************************************************************
+ * The peer.
+ */
+
+static void peer_rx(void* arg, const void* frame, int len)
+{
+  const ci_ether_hdr* eth = frame;
+  const ci_ip4_hdr* ip = (const ci_ip4_hdr*) (eth + 1);
+  const ci_tcp_hdr* tcp;
+
+  if( len < ETH_HLEN + sizeof(*ip) + sizeof(*tcp) ||
+      eth->ether_type != CI_ETHERTYPE_IP ||
+      ip->ip_protocol != IPPROTO_TCP )
+    return;
+  tcp = (const ci_tcp_hdr*) ((const char*) ip + CI_IP4_IHL(ip));
+  if( (tcp->tcp_flags & (CI_TCP_FLAG_SYN | CI_TCP_FLAG_ACK)) !=
+      (CI_TCP_FLAG_SYN | CI_TCP_FLAG_ACK) )
+    return;
+  ++stats.synacks;
+  if( ip->ip_daddr_be32 == want_raddr_be32 &&
+      tcp->tcp_dest_be16 == want_rport_be16 ) {
+    synack_seq = CI_BSWAP_BE32(tcp->tcp_seq_be32);
+    got_synack = 1;
+  }
+}
+
+
+static void poll_all(void)
+{
+  ci_netif* ni = &fn.ni;
+
+  do
+    ci_netif_poll(ni);
+  while( fake_netif_peer_poll(&fn, peer_rx, NULL) > 0 ||
+         ci_netif_has_event(ni) );
+}
+
+
+/* Send a SYN (with an MSS option) or a bare ACK from the peer. */
+static int peer_send(ci_uint32 raddr_be32, ci_uint16 rport_be16,
+                     ci_uint8 flags, ci_uint32 seq, ci_uint32 ack)
+{
+  char frame[FRAME_MAX];
+  ci_ether_hdr* eth = (ci_ether_hdr*) frame;
+  ci_ip4_hdr* ip = (ci_ip4_hdr*) (eth + 1);
+  ci_tcp_hdr* tcp = (ci_tcp_hdr*) (ip + 1);
+  ci_uint8* opt = CI_TCP_HDR_OPTS(tcp);
+  int tcp_len = sizeof(*tcp) + ((flags & CI_TCP_FLAG_SYN) ? 4 : 0);
+  int rc;
+
+  memset(frame, 0, ETH_HLEN + sizeof(*ip) + tcp_len);
+  memcpy(eth->ether_dhost, fn.mac, ETH_ALEN);
+  memcpy(eth->ether_shost, fn.peer_mac, ETH_ALEN);
+  eth->ether_type = CI_ETHERTYPE_IP;
+
+  ci_ip_hdr_init_fixed(ip, IPPROTO_TCP, 64, 0);
+  ip->ip_tot_len_be16 = CI_BSWAP_BE16(sizeof(*ip) + tcp_len);
+  ip->ip_saddr_be32 = raddr_be32;
+  ip->ip_daddr_be32 = htonl(LOCAL_ADDR);
+  ip->ip_check_be16 = ci_ip_checksum(ip);
+
+  tcp->tcp_source_be16 = rport_be16;
+  tcp->tcp_dest_be16 = htons(LOCAL_PORT);
+  tcp->tcp_seq_be32 = CI_BSWAP_BE32(seq);
+  tcp->tcp_ack_be32 = CI_BSWAP_BE32(ack);
+  CI_TCP_HDR_SET_LEN(tcp, tcp_len);
+  tcp->tcp_flags = flags;
+  tcp->tcp_window_be16 = CI_BSWAP_BE16(65535);
+  if( flags & CI_TCP_FLAG_SYN ) {
+    opt[0] = CI_TCP_OPT_MSS;
+    opt[1] = 4;
+    *(ci_uint16*) (opt + 2) = CI_BSWAP_BE16(PEER_MSS);
+  }
+  tcp->tcp_check_be16 = ci_tcp_checksum(ip, tcp, NULL);
+
+  while( (rc = fake_netif_peer_send(&fn, frame, ETH_HLEN + sizeof(*ip) +
+                                    tcp_len)) == -EAGAIN )
+    poll_all();
+  return rc;
+}
+
+
+/**********************************************************************
+ * The benchmark.
+ */
+
+static void flood(int n_flood)
+{
+  ci_uint64 start, end;
+  int i;
+
+  lookup_phase = LOOKUP_FLOOD;
+  ci_frc64(&start);
+  for( i = 0; i < n_flood; ++i ) {
+    if( peer_send(htonl(FLOOD_ADDR + (i & 0xffff)), htons(10000 + (i >> 16)),
+                  CI_TCP_FLAG_SYN, PEER_ISN, 0) < 0 )
+      break;
+    ++stats.flood_sent;
+    if( (i + 1) % POLL_BATCH == 0 )
+      poll_all();
+  }
+  poll_all();
+  ci_frc64(&end);
+  stats.flood_cycles = end - start;
+}
+
+
+static int handshake(int i)
+{
+  ci_netif* ni = &fn.ni;
+  unsigned accepted = ci_tcp_acceptq_n(tls);
+  int n;
+
+  want_raddr_be32 = htonl(CONN_ADDR + (i & 0xffff));
+  want_rport_be16 = htons(20000 + (i >> 16));
+  got_synack = 0;
+
+  if( peer_send(want_raddr_be32, want_rport_be16, CI_TCP_FLAG_SYN,
+                PEER_ISN, 0) < 0 )
+    return -1;
+  for( n = 0; ! got_synack && n < POLL_MAX; ++n )
+    poll_all();
+  if( ! got_synack )
+    return -1;
+
+  if( peer_send(want_raddr_be32, want_rport_be16, CI_TCP_FLAG_ACK,
+                PEER_ISN + 1, synack_seq + 1) < 0 )
+    return -1;
+  for( n = 0; ci_tcp_acceptq_n(tls) == accepted && n < POLL_MAX; ++n )
+    ci_netif_poll(ni);
+  return ci_tcp_acceptq_n(tls) == accepted ? -1 : 0;
+}
+
+
+static void run(int n_conns)
+{
+  ci_uint64 start, end;
+  int i;
+
+  lookup_phase = LOOKUP_CONN;
+  ci_frc64(&start);
+  for( i = 0; i < n_conns; ++i )
+    if( handshake(i) == 0 )
+      ++stats.conns;
+    else
+      ++stats.conn_fails;
+  ci_frc64(&end);
+  stats.conn_cycles = end - start;
+}
+
+
+static void report_lookups(const char* label, int phase)
+{
+  if( stats.hits[phase] )
+    printf("%s_lookup_hit_cycles:%*s%.0f\n", label,
+           (int) (8 - strlen(label)), "",
+           (double) stats.hit_cycles[phase] / stats.hits[phase]);
+  if( stats.misses[phase] )
+    printf("%s_lookup_miss_cycles:%*s%.0f\n", label,
+           (int) (7 - strlen(label)), "",
+           (double) stats.miss_cycles[phase] / stats.misses[phase]);
+}
+
+
+static void report(void)
+{
+  ci_netif* ni = &fn.ni;
+  ci_tcp_synrecv_table* tbl = ni->synrecv_table;
+  unsigned cpu_khz;
+
+  ci_get_cpu_khz(&cpu_khz);
+
+  printf("# EF_TCP_SYNCOOKIES:     %u\n", NI_OPTS(ni).tcp_syncookies);
+  printf("# EF_TCP_BACKLOG_MAX:    %u\n", NI_OPTS(ni).tcp_backlog_max);
+  printf("# EF_TCP_SYNRECV_MAX:    %u\n", NI_OPTS(ni).tcp_synrecv_max);
+  printf("# EF_MAX_ENDPOINTS:      %u\n", NI_OPTS(ni).max_ep_bufs);
+  printf("# flood SYNs sent:       %lu\n", stats.flood_sent);
+  printf("# half-open:             %u\n", tls->n_listenq);
+  printf("# handshakes:            %lu\n", stats.conns);
+  printf("# handshakes failed:     %lu\n", stats.conn_fails);
+  printf("# SYN-ACKs received:     %lu\n", stats.synacks);
+  printf("# table entries:         %u\n", tbl->n_entries);
+  printf("# table buckets:         %u (max %u)\n",
+         tbl->mask + 1 + tbl->split, tbl->max_buckets);
+#if CI_CFG_STATS_NETIF
+  printf("# table splits:          %u\n",
+         ni->state->stats.synrecv_table_splits);
+  printf("# table overflows:       %u\n",
+         ni->state->stats.synrecv_table_overflow);
+#endif
+  if( stats.flood_cycles && stats.flood_sent )
+    printf("flood_syns_per_sec:      %.0f\n",
+           stats.flood_sent * 1000.0 * cpu_khz / stats.flood_cycles);
+  if( stats.conn_cycles && stats.conns )
+    printf("handshakes_per_sec:      %.0f\n",
+           stats.conns * 1000.0 * cpu_khz / stats.conn_cycles);
+  report_lookups("flood", LOOKUP_FLOOD);
+  report_lookups("conn", LOOKUP_CONN);
+}
+
+
+/* Size the stack for the run, leaving alone anything the user has set. */
+static void set_opts(int n_flood, int n_conns, int syncookies)
+{
+  char buf[32];
+  unsigned synrecv_max, eps;
+
+  /* With syncookies the flood fills the listen queue, so the handshakes
+   * all use cookies.
+   */
+  synrecv_max = syncookies ? n_flood : n_flood + n_conns;
+  synrecv_max = CI_MAX(synrecv_max, 1);
+  eps = (synrecv_max + 6) / 7 + n_conns + 16;
+
+  snprintf(buf, sizeof(buf), "%u", synrecv_max);
+  setenv("EF_TCP_BACKLOG_MAX", buf, 0);
+  setenv("EF_TCP_SYNRECV_MAX", buf, 0);
+  snprintf(buf, sizeof(buf), "%u", 1u << ci_log2_ge(eps, 2));
+  setenv("EF_MAX_ENDPOINTS", buf, 0);
+  if( syncookies )
+    setenv("EF_TCP_SYNCOOKIES", "1", 1);
+}
+
+
+static void usage(void)
+{
+  fprintf(stderr, "usage:\n");
+  fprintf(stderr, "  syn_flood_bench [options]\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "options:\n");
+  fprintf(stderr, "  -f N      - half-open connections to flood with "
+          "(default 16384)\n");
+  fprintf(stderr, "  -n N      - handshakes to complete (default 2048)\n");
+  fprintf(stderr, "  -c        - complete handshakes with syncookies\n");
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+
+int main(int argc, char* argv[])
+{
+  int n_flood = 16384, n_conns = 2048, syncookies = 0;
+  int c, rc;
+
+  while( (c = getopt(argc, argv, "f:n:c")) != -1 )
+    switch( c ) {
+    case 'f':
+      n_flood = atoi(optarg);
+      break;
+    case 'n':
+      n_conns = atoi(optarg);
+      break;
+    case 'c':
+      syncookies = 1;
+      break;
+    default:
+      usage();
+    }
+  if( optind != argc || n_flood < 0 || n_conns < 1 ||
+      n_flood > (1 << 24) || n_conns > (1 << 24) )
+    usage();
+
+  set_opts(n_flood, n_conns, syncookies);
+  if( (rc = fake_netif_ctor(&fn, "syn_flood_bench")) < 0 ) {
+    fprintf(stderr, "ERROR: failed to build stack (%d)\n", rc);
+    return 1;
+  }
+  tls = fake_netif_tcp_listen(&fn, htonl(LOCAL_ADDR), htons(LOCAL_PORT),
+                              n_conns + 1);
+  if( tls == NULL ) {
+    fprintf(stderr, "ERROR: failed to create listening socket\n");
+    fake_netif_dtor(&fn);
+    return 1;
+  }
+
+  flood(n_flood);
+  run(n_conns);
+  report();
+
+  fake_netif_dtor(&fn);
+  return 0;
+}
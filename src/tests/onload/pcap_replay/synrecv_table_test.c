@@ -0,0 +1,207 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Check the SYN-RECV table shared by a stack's listening sockets.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* All the half-open connections in a stack are kept in one table, which
+ * grows a bucket at a time as it fills.  We give two listening sockets a
+ * half-open connection from each of the same set of peers, a third of them
+ * with hashes that collide so as to build overflow chains, then:
+ *
+ *  - check that each listener's lookup finds its own entry for a peer;
+ *  - remove some entries and add more, several times over, so that the
+ *    table splits between removals, and check that every entry left is
+ *    still found and no removed one is;
+ *  - close one listener, and check that only its entries are dropped.
+ */
+
+#define _GNU_SOURCE
+#include "fake_netif.h"
+#include "../test_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+
+#define LOCAL_ADDR    0x0a000001
+#define PEER_ADDR     0x0a010000
+#define N_PEERS       192
+#define N_ROUNDS      4
+#define PEERS_PER_ROUND  (N_PEERS / N_ROUNDS)
+
+static struct fake_netif fn;
+static ci_tcp_socket_listen* tls[2];
+static ci_tcp_state_synrecv* tsrs[2][N_PEERS];
+static ci_ip_pkt_fmt* pkt;
+
+
+
+/* Every third peer lands in the same bucket until the table is larger
+ * than it can grow here.
+ */
+static ci_uint32 peer_hash(int i)
+{
+  return i % 3 ? i * 0x01000193u : (i << 12) | 3;
+}
+
+
+static ci_tcp_state_synrecv* synrecv_add(int l, int i)
+{
+  ci_netif* ni = &fn.ni;
+  ci_tcp_state_synrecv* tsr;
+  oo_p sp;
+
+  sp = ci_ni_aux_alloc(ni, CI_TCP_AUX_TYPE_SYNRECV);
+  if( OO_P_IS_NULL(sp) )
+    return NULL;
+  tsr = ci_ni_aux_p2synrecv(ni, sp);
+  memset(tsr, 0, sizeof(*tsr));
+  tsr->bucket_link = OO_P_NULL;
+  tsr->local_peer = OO_SP_NULL;
+  tsr->hash = peer_hash(i);
+  tsr->l_addr = htonl(LOCAL_ADDR);
+  tsr->r_addr = htonl(PEER_ADDR + i);
+  tsr->r_port = htons(10000 + i);
+  ci_tcp_listenq_insert(ni, tls[l], tsr);
+  return tsr;
+}
+
+
+static void synrecv_remove(int l, int i)
+{
+  ci_tcp_listenq_remove(&fn.ni, tls[l], tsrs[l][i]);
+  ci_tcp_synrecv_free(&fn.ni, tsrs[l][i]);
+  tsrs[l][i] = NULL;
+}
+
+
+/* As ci_tcp_handle_rx() would look up a segment from peer [i]. */
+static ci_tcp_state_synrecv* synrecv_lookup(int l, int i)
+{
+  ciip_tcp_rx_pkt rxp;
+  ci_ip4_hdr* ip = oo_ip_hdr(pkt);
+
+  memset(&rxp, 0, sizeof(rxp));
+  ip->ip_saddr_be32 = htonl(PEER_ADDR + i);
+  ip->ip_daddr_be32 = htonl(LOCAL_ADDR);
+  rxp.ni = &fn.ni;
+  rxp.pkt = pkt;
+  rxp.tcp = (ci_tcp_hdr*) (ip + 1);
+  rxp.tcp->tcp_source_be16 = htons(10000 + i);
+  rxp.hash = peer_hash(i);
+  return ci_tcp_listenq_lookup(&fn.ni, tls[l], &rxp);
+}
+
+
+static void check_all(int n_peers)
+{
+  int l, i;
+
+  for( l = 0; l < 2; ++l )
+    for( i = 0; i < n_peers; ++i )
+      CHECK(synrecv_lookup(l, i) == tsrs[l][i]);
+}
+
+
+static void test_remove_split(ci_netif* ni)
+{
+  ci_tcp_synrecv_table* tbl = ni->synrecv_table;
+  unsigned n_buckets;
+  int round, l, i;
+
+  for( round = 0; round < N_ROUNDS; ++round ) {
+    n_buckets = tbl->mask + 1 + tbl->split;
+    for( i = round * PEERS_PER_ROUND; i < (round + 1) * PEERS_PER_ROUND; ++i )
+      for( l = 0; l < 2; ++l )
+        CHECK((tsrs[l][i] = synrecv_add(l, i)) != NULL);
+    CHECK(tbl->mask + 1 + tbl->split > n_buckets);
+    check_all((round + 1) * PEERS_PER_ROUND);
+
+    /* Each listener loses different peers, some of them from earlier
+     * rounds.
+     */
+    for( i = round; i < (round + 1) * PEERS_PER_ROUND; i += 5 )
+      synrecv_remove(i & 1, i);
+    check_all((round + 1) * PEERS_PER_ROUND);
+  }
+  CHECK((int) tbl->n_entries == tls[0]->n_listenq + tls[1]->n_listenq);
+}
+
+
+static void test_drop_all(ci_netif* ni)
+{
+  ci_tcp_synrecv_table* tbl = ni->synrecv_table;
+  int n_listenq = tls[0]->n_listenq;
+  int i;
+
+  /* As ci_tcp_listen_shutdown_queues() does when listener 0 closes. */
+  if( ci_tcp_listen_has_timer(tls[0]) )
+    ci_ip_timer_clear(ni, &tls[0]->listenq_tid);
+  CHECK(ci_tcp_listenq_drop_all(ni, tls[0]) == n_listenq);
+  tls[0]->n_listenq = 0;
+  tls[0]->n_listenq_new = 0;
+  for( i = 0; i < N_PEERS; ++i )
+    tsrs[0][i] = NULL;
+
+  CHECK((int) tbl->n_entries == tls[1]->n_listenq);
+  CHECK((int) ni->state->n_aux_bufs[CI_TCP_AUX_TYPE_SYNRECV] ==
+        tls[1]->n_listenq);
+  check_all(N_PEERS);
+}
+
+
+int main(int argc, char* argv[])
+{
+  ci_netif* ni;
+  int rc;
+
+  setenv("EF_TCP_SYNRECV_MAX", "1024", 0);
+  setenv("EF_TCP_BACKLOG_MAX", "1024", 0);
+  if( (rc = fake_netif_ctor(&fn, "synrecv_table_test")) < 0 ) {
+    fprintf(stderr, "ERROR: failed to build stack (%d)\n", rc);
+    return 1;
+  }
+  ni = &fn.ni;
+  tls[0] = fake_netif_tcp_listen(&fn, htonl(LOCAL_ADDR), htons(5001),
+                                 N_PEERS);
+  tls[1] = fake_netif_tcp_listen(&fn, htonl(LOCAL_ADDR), htons(5002),
+                                 N_PEERS);
+  if( tls[0] == NULL || tls[1] == NULL ||
+      (pkt = ci_netif_pkt_alloc(ni, 0)) == NULL ) {
+    fprintf(stderr, "ERROR: failed to create listening sockets\n");
+    fake_netif_dtor(&fn);
+    return 1;
+  }
+  oo_tx_pkt_layout_init(pkt);
+
+  test_remove_split(ni);
+#if CI_CFG_STATS_NETIF
+  CHECK(ni->state->stats.synrecv_table_splits > 0);
+  CHECK(ni->state->stats.synrecv_table_overflow > 0);
+#endif
+  test_drop_all(ni);
+
+  ci_netif_pkt_release(ni, pkt);
+  fake_netif_dtor(&fn);
+  return test_check_result();
+}
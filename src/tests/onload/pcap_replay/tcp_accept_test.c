@@ -0,0 +1,214 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Check the accept reserve and the batched attach of accepted
+**          sockets.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* A stack keeps EF_TCP_ACCEPT_PREALLOC free endpoints for the connections
+ * its listeners promote.  With two listeners:
+ *
+ *  - closing one keeps the reserve, and closing the other gives it back
+ *    to the free list; a new listener fills it again.
+ *
+ * onload_accept_batch() gives the accepted sockets their fds with
+ * ci_tcp_helper_tcp_accept_sock_attach_batch().  With the driver's ioctl
+ * stood in for, and a limit on the fds it will create:
+ *
+ *  - a batch within the limit gets an fd for each endpoint, in order;
+ *  - a batch that reaches the limit gets the fds created before it;
+ *  - a batch that creates none gets the error.
+ */
+
+#define _GNU_SOURCE
+#include "fake_netif.h"
+#include <onload/common.h>
+#include <onload/ioctl.h>
+#include <onload/syscall_unix.h>
+#include <onload/dup2_lock.h>
+#include <onload/ul/tcp_helper.h>
+#include "../test_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <arpa/inet.h>
+
+
+#define LOCAL_ADDR    0x0a000001
+#define N_PREALLOC    8
+#define FAKE_FD_BASE  1000
+
+static struct fake_netif fn;
+
+/* What the stand-in for the driver has been asked to attach. */
+static oo_sp attached[OO_ACCEPT_BATCH_MAX];
+static int n_attached;
+static int fd_limit;
+
+
+
+static int n_free_eps(ci_netif* ni)
+{
+  oo_sp sp = ni->state->free_eps_head;
+  int n = 0;
+
+  for( ; OO_SP_NOT_NULL(sp); sp = SP_TO_WAITABLE(ni, sp)->wt_next )
+    ++n;
+  return n;
+}
+
+
+static void test_reserve(ci_netif* ni)
+{
+  ci_tcp_socket_listen* tls[2];
+  int n_free;
+
+  tls[0] = fake_netif_tcp_listen(&fn, htonl(LOCAL_ADDR), htons(5001), 16);
+  tls[1] = fake_netif_tcp_listen(&fn, htonl(LOCAL_ADDR), htons(5002), 16);
+  CHECK(tls[0] != NULL && tls[1] != NULL);
+  if( tls[0] == NULL || tls[1] == NULL )
+    return;
+  CHECK(ni->state->n_listeners == 2);
+
+  /* As ci_tcp_listen() does. */
+  ci_tcp_accept_prealloc_fill(ni);
+  CHECK(ni->state->n_accept_prealloc == N_PREALLOC);
+  n_free = n_free_eps(ni);
+
+  __ci_tcp_listen_to_normal(ni, tls[0]);
+  CHECK(ni->state->n_listeners == 1);
+  CHECK(ni->state->n_accept_prealloc == N_PREALLOC);
+  CHECK(n_free_eps(ni) == n_free);
+
+  __ci_tcp_listen_to_normal(ni, tls[1]);
+  CHECK(ni->state->n_listeners == 0);
+  CHECK(ni->state->n_accept_prealloc == 0);
+  CHECK(OO_SP_IS_NULL(ni->state->accept_prealloc_head));
+  CHECK(n_free_eps(ni) == n_free + N_PREALLOC);
+
+  tls[0] = fake_netif_tcp_listen(&fn, htonl(LOCAL_ADDR), htons(5003), 16);
+  CHECK(tls[0] != NULL);
+  ci_tcp_accept_prealloc_fill(ni);
+  CHECK(ni->state->n_accept_prealloc == N_PREALLOC);
+  CHECK(n_free_eps(ni) == n_free - 1);
+}
+
+
+/* Stands in for OO_IOC_TCP_ACCEPT_SOCK_ATTACH on the stack's fd, failing
+ * with EMFILE once [fd_limit] fds have been created.
+ */
+static int fake_ioctl(int fd, unsigned long request, ...)
+{
+  oo_tcp_accept_sock_attach_t* op;
+  va_list va;
+
+  va_start(va, request);
+  op = va_arg(va, oo_tcp_accept_sock_attach_t*);
+  va_end(va);
+
+  if( fd != ci_netif_get_driver_handle(&fn.ni) ||
+      request != OO_IOC_TCP_ACCEPT_SOCK_ATTACH ||
+      op->type != SOCK_STREAM ) {
+    errno = EINVAL;
+    return -1;
+  }
+  if( n_attached >= fd_limit ) {
+    errno = EMFILE;
+    return -1;
+  }
+  attached[n_attached] = op->ep_id;
+  op->fd = FAKE_FD_BASE + n_attached++;
+  return 0;
+}
+
+
+static int attach_batch(int n, int limit, int* fds)
+{
+  oo_sp ep_ids[OO_ACCEPT_BATCH_MAX];
+  int i;
+
+  for( i = 0; i < n; ++i ) {
+    ep_ids[i] = OO_SP_FROM_INT(&fn.ni, i + 1);
+    fds[i] = -1;
+  }
+  n_attached = 0;
+  fd_limit = limit;
+  return ci_tcp_helper_tcp_accept_sock_attach_batch(
+                                    ci_netif_get_driver_handle(&fn.ni),
+                                    ep_ids, fds, n, SOCK_STREAM);
+}
+
+
+static void test_attach_batch(void)
+{
+  int (*sys_ioctl)(int, long unsigned int, ...) = ci_sys_ioctl;
+  int fds[OO_ACCEPT_BATCH_MAX];
+  int i, rc, saved_errno;
+
+  /* As citp_fdtable_ctor() does. */
+  CI_TRY(oo_rwlock_ctor(&citp_dup2_lock));
+  ci_sys_ioctl = fake_ioctl;
+
+  rc = attach_batch(OO_ACCEPT_BATCH_MAX, OO_ACCEPT_BATCH_MAX, fds);
+  CHECK(rc == OO_ACCEPT_BATCH_MAX);
+  for( i = 0; i < OO_ACCEPT_BATCH_MAX; ++i ) {
+    CHECK(OO_SP_TO_INT(attached[i]) == i + 1);
+    CHECK(fds[i] == FAKE_FD_BASE + i);
+  }
+
+  rc = attach_batch(5, 3, fds);
+  CHECK(rc == 3);
+  CHECK(n_attached == 3);
+  CHECK(fds[2] == FAKE_FD_BASE + 2 && fds[3] == -1);
+
+  saved_errno = errno = 0;
+  rc = attach_batch(5, 0, fds);
+  CHECK(rc == -EMFILE);
+  CHECK(fds[0] == -1);
+  /* oo_resource_op() gives back the error without touching errno. */
+  CHECK(errno == saved_errno);
+
+  ci_sys_ioctl = sys_ioctl;
+  oo_rwlock_dtor(&citp_dup2_lock);
+}
+
+
+int main(int argc, char* argv[])
+{
+  ci_netif* ni;
+  char n_prealloc[16];
+  int rc;
+
+  snprintf(n_prealloc, sizeof(n_prealloc), "%d", N_PREALLOC);
+  setenv("EF_TCP_ACCEPT_PREALLOC", n_prealloc, 1);
+  if( (rc = fake_netif_ctor(&fn, "tcp_accept_test")) < 0 ) {
+    fprintf(stderr, "ERROR: failed to build stack (%d)\n", rc);
+    return 1;
+  }
+  ni = &fn.ni;
+
+  test_reserve(ni);
+  test_attach_batch();
+
+  fake_netif_dtor(&fn);
+  return test_check_result();
+}
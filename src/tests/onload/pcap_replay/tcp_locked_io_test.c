@@ -0,0 +1,233 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Check TCP sends and receives made with the stack lock held.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* onload_ring_submit() serves a batch of sends and receives under one hold
+ * of the stack lock, with ci_tcp_sendmsg_locked() and
+ * ci_tcp_recvmsg_locked().  With an established connection:
+ *
+ *  - the peer sends some segments, which are read back in pieces smaller
+ *    and larger than a segment, until the queue is empty and the receive
+ *    would block; then a FIN, after which the receive gives end of stream;
+ *  - a send of several segments reaches the peer intact, a send with no
+ *    room in the send buffer would block, and a send the function does not
+ *    handle is left for ci_tcp_sendmsg().
+ */
+
+#define _GNU_SOURCE
+#include "fake_netif.h"
+#include <ci/tools/ipcsum.h>
+#include "../test_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+
+#define FRAME_MAX    (ETH_HLEN + ETH_VLAN_HLEN + 1792)
+#define PEER_WSCL    7
+#define PEER_WND     (1u << 22)
+#define RX_SEG       1000
+#define RX_N_SEGS    3
+#define DATA_MAX     (1u << 16)
+
+static struct fake_netif fn;
+static struct fake_tcp_conn conn;
+static ci_tcp_state* ts;
+
+/* What the peer has received, by offset from conn.snd_nxt. */
+static char peer_data[DATA_MAX];
+static unsigned peer_bytes;
+
+
+
+static void fill(char* buf, int len, unsigned seed)
+{
+  int i;
+  for( i = 0; i < len; ++i )
+    buf[i] = (char) (seed + i * 7);
+}
+
+
+static void peer_rx(void* arg, const void* frame, int len)
+{
+  const ci_ether_hdr* eth = frame;
+  const ci_ip4_hdr* ip = (const ci_ip4_hdr*) (eth + 1);
+  const ci_tcp_hdr* tcp;
+  unsigned off;
+  int paylen;
+
+  if( len < ETH_HLEN + sizeof(*ip) ||
+      eth->ether_type != CI_ETHERTYPE_IP ||
+      ip->ip_protocol != IPPROTO_TCP )
+    return;
+  tcp = (const ci_tcp_hdr*) ((const char*) ip + CI_IP4_IHL(ip));
+  paylen = CI_BSWAP_BE16(ip->ip_tot_len_be16) - CI_IP4_IHL(ip) -
+           CI_TCP_HDR_LEN(tcp);
+  off = CI_BSWAP_BE32(tcp->tcp_seq_be32) - conn.snd_nxt;
+  if( paylen <= 0 || off + paylen > DATA_MAX )
+    return;
+  memcpy(peer_data + off, (const char*) tcp + CI_TCP_HDR_LEN(tcp), paylen);
+  peer_bytes = CI_MAX(peer_bytes, off + paylen);
+}
+
+
+/* Send [len] bytes of [data] from the peer at [seq], with [tcp_flags]. */
+static int peer_send(ci_uint32 seq, const char* data, int len,
+                     int tcp_flags)
+{
+  char frame[FRAME_MAX];
+  ci_ether_hdr* eth = (ci_ether_hdr*) frame;
+  ci_ip4_hdr* ip = (ci_ip4_hdr*) (eth + 1);
+  ci_tcp_hdr* tcp = (ci_tcp_hdr*) (ip + 1);
+  int rc;
+
+  memset(frame, 0, ETH_HLEN + sizeof(*ip) + sizeof(*tcp));
+  memcpy(eth->ether_dhost, fn.mac, ETH_ALEN);
+  memcpy(eth->ether_shost, fn.peer_mac, ETH_ALEN);
+  eth->ether_type = CI_ETHERTYPE_IP;
+
+  ci_ip_hdr_init_fixed(ip, IPPROTO_TCP, 64, 0);
+  ip->ip_tot_len_be16 = CI_BSWAP_BE16(sizeof(*ip) + sizeof(*tcp) + len);
+  ip->ip_saddr_be32 = conn.raddr_be32;
+  ip->ip_daddr_be32 = conn.laddr_be32;
+  ip->ip_check_be16 = ci_ip_checksum(ip);
+
+  tcp->tcp_source_be16 = conn.rport_be16;
+  tcp->tcp_dest_be16 = conn.lport_be16;
+  tcp->tcp_seq_be32 = CI_BSWAP_BE32(seq);
+  tcp->tcp_ack_be32 = CI_BSWAP_BE32(conn.snd_nxt);
+  CI_TCP_HDR_SET_LEN(tcp, sizeof(*tcp));
+  tcp->tcp_flags = CI_TCP_FLAG_ACK | tcp_flags;
+  tcp->tcp_window_be16 = CI_BSWAP_BE16(PEER_WND >> PEER_WSCL);
+  memcpy(tcp + 1, data, len);
+  tcp->tcp_check_be16 = ci_tcp_checksum(ip, tcp, tcp + 1);
+
+  while( (rc = fake_netif_peer_send(&fn, frame, ETH_HLEN + sizeof(*ip) +
+                                    sizeof(*tcp) + len)) == -EAGAIN ) {
+    fake_netif_peer_poll(&fn, peer_rx, NULL);
+    ci_netif_poll(&fn.ni);
+  }
+  return rc;
+}
+
+
+static void settle(void)
+{
+  while( fake_netif_peer_poll(&fn, peer_rx, NULL) > 0 ||
+         ci_netif_has_event(&fn.ni) )
+    ci_netif_poll(&fn.ni);
+}
+
+
+static void test_recv(ci_netif* ni)
+{
+  char sent[RX_SEG * RX_N_SEGS], got[sizeof(sent)];
+  int i, n = 0, rc;
+
+  fill(sent, sizeof(sent), 1);
+  for( i = 0; i < RX_N_SEGS; ++i )
+    CHECK(peer_send(conn.rcv_nxt + i * RX_SEG, sent + i * RX_SEG,
+                    RX_SEG, CI_TCP_FLAG_PSH) == 0);
+  settle();
+  CHECK(tcp_rcv_usr(ts) == sizeof(sent));
+
+  CHECK(ci_sock_trylock(ni, &ts->s.b));
+  /* Part of a segment, then the rest of it and part of the next. */
+  while( n < (int) sizeof(sent) ) {
+    rc = ci_tcp_recvmsg_locked(ni, ts, got + n,
+                               n == 0 ? RX_SEG / 2 : RX_SEG + RX_SEG / 4);
+    CHECK(rc > 0);
+    if( rc <= 0 )
+      break;
+    n += rc;
+  }
+  CHECK(n == sizeof(sent) && ! memcmp(got, sent, sizeof(sent)));
+  CHECK(ci_tcp_recvmsg_locked(ni, ts, got, sizeof(got)) == -EAGAIN);
+  ci_sock_unlock(ni, &ts->s.b);
+
+  CHECK(peer_send(conn.rcv_nxt + sizeof(sent), "", 0,
+                  CI_TCP_FLAG_FIN) == 0);
+  settle();
+  CHECK(ci_sock_trylock(ni, &ts->s.b));
+  CHECK(ci_tcp_recvmsg_locked(ni, ts, got, sizeof(got)) == 0);
+  ci_sock_unlock(ni, &ts->s.b);
+}
+
+
+static void test_send(ci_netif* ni)
+{
+  int mss = tcp_eff_mss(ts);
+  int len = 3 * mss + 100;
+  char* sent = malloc(len);
+  ci_int32 sndbuf_pkts = ts->so_sndbuf_pkts;
+
+  fill(sent, len, 2);
+  CHECK(ci_tcp_sendmsg_locked(ni, ts, sent, len, MSG_DONTWAIT) == len);
+  settle();
+  CHECK(peer_bytes == len && ! memcmp(peer_data, sent, len));
+
+  ts->so_sndbuf_pkts = ci_tcp_sendq_n_pkts(ts);
+  CHECK(ci_tcp_sendmsg_locked(ni, ts, sent, len, 0) == -EAGAIN);
+  ts->so_sndbuf_pkts = sndbuf_pkts;
+  CHECK(ci_tcp_sendmsg_locked(ni, ts, sent, len, MSG_OOB) == -EOPNOTSUPP);
+  free(sent);
+}
+
+
+int main(int argc, char* argv[])
+{
+  ci_netif* ni;
+  int rc;
+
+  if( (rc = fake_netif_ctor(&fn, "tcp_locked_io_test")) < 0 ) {
+    fprintf(stderr, "ERROR: failed to build stack (%d)\n", rc);
+    return 1;
+  }
+  ni = &fn.ni;
+
+  conn.laddr_be32 = htonl(0x0a000001);
+  conn.lport_be16 = htons(5001);
+  conn.raddr_be32 = htonl(0x0a000002);
+  conn.rport_be16 = htons(40000);
+  conn.snd_nxt = 0x10000000;
+  conn.rcv_nxt = 0x20000000;
+  conn.snd_wnd = PEER_WND;
+  conn.smss = 0;
+  conn.snd_wscl = PEER_WSCL;
+  conn.rcv_wscl = PEER_WSCL;
+  conn.tso = 0;
+  conn.tsrecent = 0;
+  if( (ts = fake_netif_tcp_established(&fn, &conn)) == NULL ) {
+    fprintf(stderr, "ERROR: failed to create socket\n");
+    fake_netif_dtor(&fn);
+    return 1;
+  }
+  ts->cwnd = ts->ssthresh = PEER_WND;
+
+  test_send(ni);
+  test_recv(ni);
+
+  fake_netif_dtor(&fn);
+  return test_check_result();
+}
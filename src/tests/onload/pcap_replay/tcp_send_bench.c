@@ -0,0 +1,343 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Time bulk TCP sends through a stack with no NIC.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* Calls ci_tcp_sendmsg() repeatedly on an established connection in a
+ * stack built by fake_netif.c, and reports the cycles spent in each call.
+ * Between sends the peer receives everything the stack sent and ACKs it,
+ * so that every send starts with an empty send and retransmit queue and a
+ * window large enough to send the whole message at once.
+ *
+ * The soft VI copies frames onto the link when the doorbell is rung, which
+ * a NIC would do by DMA, so we also report the cycles spent in the send
+ * call excluding ef_vi_transmit_push().  On real hardware each doorbell
+ * is instead an uncached write to the NIC.
+ *
+ * Run with EF_TCP_SEND_GSO_MAX=0 and without to compare filling packets
+ * in small batches with segmenting the whole send in one go.
+ *
+ * Usage: tcp_send_bench [-s msg_size] [-n iterations] [-m mss] [-t]
+ */
+
+#define _GNU_SOURCE
+#include "fake_netif.h"
+#include <ci/tools/ipcsum.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+
+#define FRAME_MAX           (ETH_HLEN + ETH_VLAN_HLEN + 1792)
+#define PEER_WSCL           7
+#define PEER_WND            (1u << 22)
+
+
+static struct fake_netif fn;
+static ci_tcp_state* ts;
+static struct fake_tcp_conn conn;
+
+/* What the peer has received. */
+static ci_uint32 peer_rcv_nxt;
+static ci_uint32 peer_tsecr;
+static ci_uint32 peer_tsval;
+
+static struct {
+  unsigned long  sends;
+  unsigned long  short_sends;
+  unsigned long  bytes;
+  unsigned long  frames;
+  unsigned long  doorbells;
+  ci_uint64      send_cycles;
+  ci_uint64      send_cycles_min;
+  ci_uint64      push_cycles;
+} stats;
+
+static void (*soft_transmit_push)(ef_vi*);
+
+
+static void timed_transmit_push(ef_vi* vi)
+{
+  ci_uint64 start, end;
+  ++stats.doorbells;
+  ci_frc64(&start);
+  soft_transmit_push(vi);
+  ci_frc64(&end);
+  stats.push_cycles += end - start;
+}
+
+
+static void peer_rx(void* arg, const void* frame, int len)
+{
+  const ci_ether_hdr* eth = frame;
+  const ci_ip4_hdr* ip = (const ci_ip4_hdr*) (eth + 1);
+  const ci_tcp_hdr* tcp;
+  const ci_uint8* opt;
+  ci_uint32 end;
+
+  if( len < ETH_HLEN + sizeof(*ip) ||
+      eth->ether_type != CI_ETHERTYPE_IP ||
+      ip->ip_protocol != IPPROTO_TCP )
+    return;
+  tcp = (const ci_tcp_hdr*) ((const char*) ip + CI_IP4_IHL(ip));
+  end = CI_BSWAP_BE32(tcp->tcp_seq_be32) +
+        CI_BSWAP_BE16(ip->ip_tot_len_be16) - CI_IP4_IHL(ip) -
+        CI_TCP_HDR_LEN(tcp);
+  if( SEQ_GT(end, peer_rcv_nxt) )
+    peer_rcv_nxt = end;
+  /* Data segments carry the timestamp option first, if at all. */
+  opt = CI_TCP_HDR_OPTS(tcp);
+  if( CI_TCP_HDR_OPT_LEN(tcp) >= 12 &&
+      *(const ci_uint32*) opt == CI_TCP_TSO_WORD )
+    peer_tsecr = *(const ci_uint32*) (opt + 4);
+  ++stats.frames;
+}
+
+
+/* ACK everything the peer has received, with a window that lets the whole
+ * of the next send go out.
+ */
+static int peer_ack(void)
+{
+  char frame[FRAME_MAX];
+  ci_ether_hdr* eth = (ci_ether_hdr*) frame;
+  ci_ip4_hdr* ip = (ci_ip4_hdr*) (eth + 1);
+  ci_tcp_hdr* tcp = (ci_tcp_hdr*) (ip + 1);
+  ci_uint8* opt = CI_TCP_HDR_OPTS(tcp);
+  int tcp_len = sizeof(*tcp) + (conn.tso ? 12 : 0);
+  int rc;
+
+  memset(frame, 0, ETH_HLEN + sizeof(*ip) + tcp_len);
+  memcpy(eth->ether_dhost, fn.mac, ETH_ALEN);
+  memcpy(eth->ether_shost, fn.peer_mac, ETH_ALEN);
+  eth->ether_type = CI_ETHERTYPE_IP;
+
+  ci_ip_hdr_init_fixed(ip, IPPROTO_TCP, 64, 0);
+  ip->ip_tot_len_be16 = CI_BSWAP_BE16(sizeof(*ip) + tcp_len);
+  ip->ip_saddr_be32 = conn.raddr_be32;
+  ip->ip_daddr_be32 = conn.laddr_be32;
+  ip->ip_check_be16 = ci_ip_checksum(ip);
+
+  tcp->tcp_source_be16 = conn.rport_be16;
+  tcp->tcp_dest_be16 = conn.lport_be16;
+  tcp->tcp_seq_be32 = CI_BSWAP_BE32(conn.rcv_nxt);
+  tcp->tcp_ack_be32 = CI_BSWAP_BE32(peer_rcv_nxt);
+  CI_TCP_HDR_SET_LEN(tcp, tcp_len);
+  tcp->tcp_flags = CI_TCP_FLAG_ACK;
+  tcp->tcp_window_be16 = CI_BSWAP_BE16(PEER_WND >> PEER_WSCL);
+  if( conn.tso ) {
+    *(ci_uint32*) opt = CI_TCP_TSO_WORD;
+    *(ci_uint32*) (opt + 4) = CI_BSWAP_BE32(++peer_tsval);
+    *(ci_uint32*) (opt + 8) = peer_tsecr;
+  }
+  tcp->tcp_check_be16 = ci_tcp_checksum(ip, tcp, NULL);
+
+  while( (rc = fake_netif_peer_send(&fn, frame, ETH_HLEN + sizeof(*ip) +
+                                    tcp_len)) == -EAGAIN ) {
+    fake_netif_peer_poll(&fn, peer_rx, NULL);
+    ci_netif_poll(&fn.ni);
+  }
+  return rc;
+}
+
+
+/* Let the peer receive what the stack has sent, and the stack process the
+ * peer's ACK and its TX completions.
+ */
+static void settle(void)
+{
+  ci_netif* ni = &fn.ni;
+  int i;
+
+  for( i = 0; i < 100; ++i ) {
+    while( fake_netif_peer_poll(&fn, peer_rx, NULL) > 0 ||
+           ci_netif_has_event(ni) )
+      ci_netif_poll(ni);
+    if( ci_ip_queue_is_empty(&ts->retrans) &&
+        ci_ip_queue_is_empty(&ts->send) )
+      return;
+    if( SEQ_LT(tcp_snd_una(ts), peer_rcv_nxt) )
+      peer_ack();
+    ci_netif_poll(ni);
+  }
+}
+
+
+static int create_socket(int mss, int tso)
+{
+  ci_netif* ni = &fn.ni;
+
+  conn.laddr_be32 = htonl(0x0a000001);
+  conn.lport_be16 = htons(5001);
+  conn.raddr_be32 = htonl(0x0a000002);
+  conn.rport_be16 = htons(40000);
+  conn.snd_nxt = 0x10000000;
+  conn.rcv_nxt = 0x20000000;
+  conn.snd_wnd = PEER_WND;
+  conn.smss = mss;
+  conn.snd_wscl = PEER_WSCL;
+  conn.rcv_wscl = PEER_WSCL;
+  conn.tso = tso;
+  conn.tsrecent = 0;
+  peer_rcv_nxt = conn.snd_nxt;
+
+  if( (ts = fake_netif_tcp_established(&fn, &conn)) == NULL )
+    return -ENOSPC;
+
+  /* Only the cost of the send path is of interest, so don't let
+   * congestion control or SO_SNDBUF limit the size of a burst.
+   */
+  ts->s.so.sndbuf = NI_OPTS(ni).tcp_sndbuf_max;
+  ci_tcp_set_sndbuf(ni, ts);
+  ts->cwnd = ts->ssthresh = PEER_WND;
+  return 0;
+}
+
+
+static void run(int msg_size, int iters)
+{
+  ci_netif* ni = &fn.ni;
+  ci_iovec iov;
+  char* buf;
+  ci_uint64 start, end;
+  int i, rc;
+
+  buf = calloc(1, msg_size);
+  CI_IOVEC_BASE(&iov) = buf;
+  CI_IOVEC_LEN(&iov) = msg_size;
+  stats.send_cycles_min = ~0ull;
+  soft_transmit_push = ni->nic_hw[0].vi.ops.transmit_push;
+  ni->nic_hw[0].vi.ops.transmit_push = timed_transmit_push;
+
+  for( i = 0; i < iters; ++i ) {
+    /* ci_tcp_sendmsg() takes the lock itself.  Nothing is left for the
+     * unlock hooks to do, so this doesn't need the driver.
+     */
+    ci_netif_unlock(ni);
+    ci_frc64(&start);
+    rc = ci_tcp_sendmsg(ni, ts, &iov, 1, MSG_DONTWAIT);
+    ci_frc64(&end);
+    ci_netif_lock(ni);
+
+    if( rc < 0 ) {
+      fprintf(stderr, "ERROR: ci_tcp_sendmsg() failed (%d)\n", rc);
+      break;
+    }
+    ++stats.sends;
+    stats.bytes += rc;
+    if( rc != msg_size )
+      ++stats.short_sends;
+    stats.send_cycles += end - start;
+    stats.send_cycles_min = CI_MIN(stats.send_cycles_min, end - start);
+    /* Don't count pushes made while settling. */
+    ni->nic_hw[0].vi.ops.transmit_push = soft_transmit_push;
+    settle();
+    ni->nic_hw[0].vi.ops.transmit_push = timed_transmit_push;
+  }
+  free(buf);
+}
+
+
+static void report(int msg_size)
+{
+  unsigned long n = stats.sends;
+
+  printf("# msg_size:              %d\n", msg_size);
+  printf("# eff_mss:               %d\n", tcp_eff_mss(ts));
+  printf("# EF_TCP_SEND_GSO_MAX:   %u\n", NI_OPTS(&fn.ni).tcp_send_gso_max);
+  printf("# sends:                 %lu\n", n);
+  printf("# short sends:           %lu\n", stats.short_sends);
+  printf("# bytes:                 %lu\n", stats.bytes);
+  printf("# frames received:       %lu\n", stats.frames);
+  if( n == 0 )
+    return;
+  printf("frames_per_send:         %.1f\n", (double) stats.frames / n);
+  printf("doorbells_per_send:      %.2f\n", (double) stats.doorbells / n);
+  printf("send_cycles_min:         %llu\n",
+         (unsigned long long) stats.send_cycles_min);
+  printf("send_cycles_mean:        %.0f\n", (double) stats.send_cycles / n);
+  printf("send_cycles_mean_no_push:%.0f\n",
+         (double) (stats.send_cycles - stats.push_cycles) / n);
+  if( stats.frames )
+    printf("send_cycles_per_frame:   %.1f\n",
+           (double) (stats.send_cycles - stats.push_cycles) / stats.frames);
+}
+
+
+static void usage(void)
+{
+  fprintf(stderr, "usage:\n");
+  fprintf(stderr, "  tcp_send_bench [options]\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "options:\n");
+  fprintf(stderr, "  -s N      - bytes per send (default 65536)\n");
+  fprintf(stderr, "  -n N      - number of sends (default 10000)\n");
+  fprintf(stderr, "  -m N      - peer's MSS (default 1460)\n");
+  fprintf(stderr, "  -t        - don't use TCP timestamps\n");
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+
+int main(int argc, char* argv[])
+{
+  int msg_size = 65536, iters = 10000, mss = 1460, tso = 1;
+  int c, rc;
+
+  while( (c = getopt(argc, argv, "s:n:m:t")) != -1 )
+    switch( c ) {
+    case 's':
+      msg_size = atoi(optarg);
+      break;
+    case 'n':
+      iters = atoi(optarg);
+      break;
+    case 'm':
+      mss = atoi(optarg);
+      break;
+    case 't':
+      tso = 0;
+      break;
+    default:
+      usage();
+    }
+  if( optind != argc || msg_size < 1 || iters < 1 || mss < 64 )
+    usage();
+
+  if( (rc = fake_netif_ctor(&fn, "tcp_send_bench")) < 0 ) {
+    fprintf(stderr, "ERROR: failed to build stack (%d)\n", rc);
+    return 1;
+  }
+  if( create_socket(mss, tso) < 0 ) {
+    fprintf(stderr, "ERROR: failed to create socket\n");
+    fake_netif_dtor(&fn);
+    return 1;
+  }
+
+  run(msg_size, iters);
+  report(msg_size);
+
+  fake_netif_dtor(&fn);
+  return 0;
+}
@@ -0,0 +1,57 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Checks for the self-checking Onload tests.
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/* A test reports each failed CHECK() on stderr and carries on, so that
+ * one run shows every failure.  It ends with
+ *
+ *   return test_check_result();
+ *
+ * which prints PASSED or FAILED and gives the exit status, non-zero if
+ * any check failed.  Include this from the test's own source file only.
+ */
+
+#ifndef __ONLOAD_TEST_CHECK_H__
+#define __ONLOAD_TEST_CHECK_H__
+
+#include <stdio.h>
+
+
+static int test_check_n_fail;
+
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if( ! (cond) ) {                                                    \
+      fprintf(stderr, "FAIL: %s:%d: %s\n", __FILE__, __LINE__, #cond);  \
+      ++test_check_n_fail;                                              \
+    }                                                                   \
+  } while( 0 )
+
+
+static inline int test_check_result(void)
+{
+  printf("%s\n", test_check_n_fail ? "FAILED" : "PASSED");
+  return test_check_n_fail ? 1 : 0;
+}
+
+#endif  /* __ONLOAD_TEST_CHECK_H__ */
@@ -0,0 +1,83 @@
+#!/bin/bash
+#
+# Compare TCP loopback round-trip times: kernel, Onload, and Onload with
+# EF_TCP_LOOPBACK_DIRECT.  Both ends are given the same EF_NAME so that
+# they share a stack, which Onload loopback requires.
+#
+# usage: rtt_loopback.sh [-i iters] [-w warmups] [-f frame_len] [-p port]
+#
+# The rtt binary is taken from $RTT, or else found next to this script or
+# on the PATH.
+
+bin=$(cd "$(dirname "$0")" && /bin/pwd)
+
+iters=100000
+warmups=10000
+frame_len=64
+port=18765
+
+err()  { echo >&2 "$*"; }
+fail() { err "$*"; exit 1; }
+
+while getopts "i:w:f:p:" opt; do
+  case "$opt" in
+    i) iters="$OPTARG";;
+    w) warmups="$OPTARG";;
+    f) frame_len="$OPTARG";;
+    p) port="$OPTARG";;
+    *) fail "usage: $0 [-i iters] [-w warmups] [-f frame_len] [-p port]";;
+  esac
+done
+
+rtt="${RTT:-$bin/rtt}"
+[ -x "$rtt" ] || rtt=$(type -P rtt) || \
+  fail "ERROR: rtt not found; build tests/rtt or set RTT"
+type onload >/dev/null 2>&1 || fail "ERROR: onload not found on PATH"
+
+rtt_args="-i $iters -w $warmups -f $frame_len"
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+# Print min, median, 99th and 99.9th percentiles of the results in $1.
+summarise() {
+  grep -v '^#' "$1" | sort -n | awk '
+    { v[NR] = $1 }
+    END {
+      if( NR == 0 ) { print "no results"; exit }
+      printf "min=%d median=%d 99%%=%d 99.9%%=%d (ns)\n",
+             v[1], v[int(NR*0.5)+1], v[int(NR*0.99)+1], v[int(NR*0.999)+1]
+    }'
+}
+
+# run <label> <launcher...>
+run() {
+  local label="$1"; shift
+  local out="$tmp/$label"
+  "$@" "$rtt" $rtt_args pong "tcp:bind_host=127.0.0.1,bind_port=$port" \
+    >/dev/null 2>"$tmp/$label.pong" &
+  local pong=$!
+  sleep 1
+  if ! "$@" "$rtt" $rtt_args ping \
+       "tcp:connect_host=127.0.0.1,connect_port=$port" >"$out"; then
+    kill $pong 2>/dev/null
+    wait $pong 2>/dev/null
+    cat >&2 "$tmp/$label.pong"
+    fail "ERROR: $label run failed"
+  fi
+  wait $pong
+  printf "%-10s %s\n" "$label:" "$(summarise "$out")"
+  port=$((port + 1))
+}
+
+onload_lo() {
+  EF_NAME=rtt_lo EF_TCP_SERVER_LOOPBACK=2 EF_TCP_CLIENT_LOOPBACK=4 \
+    onload "$@"
+}
+
+onload_direct() {
+  EF_TCP_LOOPBACK_DIRECT=1 onload_lo "$@"
+}
+
+run kernel env
+run onload onload_lo
+run direct onload_direct
@@ -1636,6 +1636,13 @@ static void stack_time_init(ci_netif* ni)
 }
 
 static void stack_timers(ci_netif* ni)
+{
+  if( ! cfg_lock )  libstack_netif_lock(ni);
+  ci_ip_timer_state_dump_summary(ni);
+  if( ! cfg_lock )  libstack_netif_unlock(ni);
+}
+
+static void stack_timers_all(ci_netif* ni)
 {
   ci_ip_timer_state_dump(ni);
 }
@@ -1816,6 +1823,7 @@ static void stack_sizeof(ci_netif* ni)
   log_sizeof(ci_netif_config_opts);
   log_sizeof(ci_netif_ipid_cb_t);
   log_sizeof(ci_netif_filter_table_entry);
+  log_sizeof(ci_netif_filter_table_bucket);
   log_sizeof(ci_netif_filter_table);
   log_sizeof(ci_ip_cached_hdrs);
   log_sizeof(ci_ip_timer);
@@ -1943,39 +1951,48 @@ static void stack_alloc_pkts_block(ci_netif* ni)
     libstack_netif_unlock(ni);
 }
 
-static void stack_nonb_pkt_pool_n(ci_netif* ni)
+/* Count the packets on a non-blocking list by grabbing the whole list and
+ * putting it back.
+ */
+static unsigned nonb_list_n(ci_netif* ni, volatile ci_uint64* pool)
 {
-  volatile ci_uint64 *nonb_pkt_pool_ptr;
   ci_uint64 link;
-  unsigned id, n, n_async_pkts;
+  unsigned id, n;
   ci_ip_pkt_fmt* pkt;
   oo_pkt_p pp;
 
-  nonb_pkt_pool_ptr = &(ni->state->nonb_pkt_pool);
  again:
-  n_async_pkts = ni->state->n_async_pkts;
-  link = *nonb_pkt_pool_ptr;
+  link = *pool;
   id = link & 0xffffffff;
-  if( id != 0xffffffff ) {
-    if( ci_cas64u_fail(nonb_pkt_pool_ptr, link,
-                       0x00000000ffffffffllu | (link & 0xffffffff00000000llu)) )
-      goto again;
-    OO_PP_INIT(ni, pp, id);
-    pkt = PKT(ni, pp);
-    n = 0;
-    while( 1 ) {
-      ++n;
-      if( OO_PP_IS_NULL(pkt->next) )
-        break;
-      pkt = PKT(ni, pkt->next);
-    }
-    ci_netif_pkt_free_nonb_list(ni, id, pkt);
-  }
-  else {
-    n = 0;
+  if( id == 0xffffffff )
+    return 0;
+  if( ci_cas64u_fail(pool, link,
+                     0x00000000ffffffffllu | (link & 0xffffffff00000000llu)) )
+    goto again;
+  OO_PP_INIT(ni, pp, id);
+  pkt = PKT(ni, pp);
+  n = 0;
+  while( 1 ) {
+    ++n;
+    if( OO_PP_IS_NULL(pkt->next) )
+      break;
+    pkt = PKT(ni, pkt->next);
   }
-  ci_log("%s: [%d] n_async_pkts=%d nonb_pkt_pool_n=%d", __FUNCTION__,
-         NI_ID(ni), n_async_pkts, n);
+  __ci_netif_pkt_nonb_push(ni, pool, pp, pkt);
+  return n;
+}
+
+static void stack_nonb_pkt_pool_n(ci_netif* ni)
+{
+  unsigned i, n, n_mag, n_async_pkts;
+
+  n_async_pkts = ni->state->n_async_pkts;
+  n = nonb_list_n(ni, &ni->state->nonb_pkt_pool);
+  n_mag = 0;
+  for( i = 0; i < CI_CFG_PKT_NONB_MAGAZINES; ++i )
+    n_mag += nonb_list_n(ni, &ni->state->nonb_magazine[i].link);
+  ci_log("%s: [%d] n_async_pkts=%d nonb_pkt_pool_n=%d nonb_magazines_n=%d",
+         __FUNCTION__, NI_ID(ni), n_async_pkts, n, n_mag);
 }
 
 static void stack_alloc_nonb_pkts(ci_netif* ni)
@@ -2328,6 +2345,85 @@ static void stack_proc_delay_reset(ci_netif* ni)
 }
 #endif
 
+#if CI_CFG_LAT_HIST
+static const char* const lat_hist_names[CI_LAT_HIST_N] = {
+  "rx_app", "tx_doorbell", "tx_complete",
+};
+
+
+/* Upper bound of the bucket containing the [permille]th value. */
+static unsigned lat_hist_pctl(const ci_lat_hist* h, unsigned permille)
+{
+  ci_uint64 target = ((ci_uint64) h->n * permille + 999) / 1000;
+  ci_uint64 sum = 0;
+  unsigned b;
+  for( b = 0; b < CI_LAT_HIST_BUCKETS - 1; ++b )
+    if( (sum += h->bucket[b]) >= target )
+      return CI_MIN(ci_lat_hist_bucket_lo(b + 1) - 1, h->max_ns);
+  return h->max_ns;
+}
+
+
+static void lat_hist_summary(const char* pf, const ci_lat_hist* h,
+                             const char* name)
+{
+  if( h->n == 0 )
+    return;
+  ci_log("%s%-12s n=%u mean=%lluns p50=%uns p90=%uns p99=%uns p99.9=%uns "
+         "max=%uns", pf, name, h->n, (unsigned long long) (h->sum_ns / h->n),
+         lat_hist_pctl(h, 500), lat_hist_pctl(h, 900), lat_hist_pctl(h, 990),
+         lat_hist_pctl(h, 999), h->max_ns);
+}
+
+
+static void stack_latency_hist(ci_netif* ni)
+{
+  const ci_lat_hists* lh = &ni->state->lat_hist;
+  unsigned id, b;
+  int i;
+
+  ci_log("latency_hist: stack=%d,%s", NI_ID(ni), ni->state->name);
+  if( ! NI_OPTS(ni).latency_hist ) {
+    ci_log("  disabled (EF_LATENCY_HIST=0)");
+    return;
+  }
+  for( i = 0; i < CI_LAT_HIST_N; ++i ) {
+    lat_hist_summary("  ", &lh->h[i], lat_hist_names[i]);
+    for( b = 0; b < CI_LAT_HIST_BUCKETS; ++b )
+      if( lh->h[i].bucket[b] )
+        ci_log("    %s_ge_%uns=%u", lat_hist_names[i],
+               ci_lat_hist_bucket_lo(b), lh->h[i].bucket[b]);
+  }
+  for( id = 0; id < ni->state->lat_hist_n_socks &&
+                 id < ni->state->n_ep_bufs; ++id ) {
+    citp_waitable* w = ID_TO_WAITABLE(ni, id);
+    if( w->state == CI_TCP_STATE_FREE )
+      continue;
+    lh = &ni->lat_hist_socks[id];
+    if( lh->h[CI_LAT_HIST_RX_APP].n == 0 &&
+        lh->h[CI_LAT_HIST_TX_DOORBELL].n == 0 &&
+        lh->h[CI_LAT_HIST_TX_COMPLETE].n == 0 )
+      continue;
+    ci_log("  socket %d:%d", NI_ID(ni), id);
+    for( i = 0; i < CI_LAT_HIST_N; ++i )
+      lat_hist_summary("    ", &lh->h[i], lat_hist_names[i]);
+  }
+}
+
+
+static void stack_latency_hist_reset(ci_netif* ni)
+{
+  if( ! cfg_lock )
+    libstack_netif_lock(ni);
+  memset(&ni->state->lat_hist, 0, sizeof(ni->state->lat_hist));
+  if( ni->lat_hist_socks != NULL )
+    memset(ni->lat_hist_socks, 0,
+           sizeof(ni->lat_hist_socks[0]) * ni->state->lat_hist_n_socks);
+  if( ! cfg_lock )
+    libstack_netif_unlock(ni);
+}
+#endif
+
 /**********************************************************************
 ***********************************************************************
 **********************************************************************/
@@ -2378,7 +2474,8 @@ static const stack_op_t stack_ops[] = {
   STACK_OP(packets,            "show packets queued on netif"),
   STACK_OP(time,               "show stack timers"),
   STACK_OP(time_init,          "(re-)initialize stack timers"),
-  STACK_OP(timers,             "dump state of stack timers"),
+  STACK_OP(timers,             "show timer engine and expiry distribution"),
+  STACK_OP(timers_all,         "dump state of all stack timers"),
   STACK_OP(filter_table,       "show stack software filter table"),
   STACK_OP_F(filters,          "show stack hardware filters", FL_ONCE),
   STACK_OP_F(clusters,         "show clusters", FL_ONCE),
@@ -2438,6 +2535,10 @@ static const stack_op_t stack_ops[] = {
   STACK_OP(proc_delay_hist,    "dump processing delay histogram"),
   STACK_OP(proc_delay_reset,   "reset processing delay stats"),
 #endif
+#if CI_CFG_LAT_HIST
+  STACK_OP(latency_hist,       "dump latency histograms (EF_LATENCY_HIST)"),
+  STACK_OP(latency_hist_reset, "reset latency histograms"),
+#endif
 };
 #define N_STACK_OPS	(sizeof(stack_ops) / sizeof(stack_ops[0]))
 
@@ -1,7 +1,8 @@
 APPS	:= onload_stackdump \
            onload_tcpdump.bin \
            onload_fuser \
-           onload_metrics_record
+           onload_metrics_record \
+           onload_stats_collect
 
 ifdef OFE_TREE
 APPS	+= onload_fe
@@ -28,6 +29,7 @@ onload_stackdump:= $(patsubst %,$(AppPattern),onload_stackdump)
 onload_tcpdump.bin := $(patsubst %,$(AppPattern),onload_tcpdump.bin)
 onload_fuser	:= $(patsubst %,$(AppPattern),onload_fuser)
 onload_metrics_record	:= $(patsubst %,$(AppPattern),onload_metrics_record)
+onload_stats_collect	:= $(patsubst %,$(AppPattern),onload_stats_collect)
 pio_buddy_test	:= $(patsubst %,$(AppPattern),pio_buddy_test)
 ifdef OFE_TREE
 onload_fe	:= $(patsubst %,$(AppPattern),onload_fe)
@@ -70,6 +72,9 @@ $(onload_fuser): fuser.o $(MMAKE_LIB_DEPS)
 $(onload_metrics_record): onload_metrics_record.o libstack.o $(MMAKE_LIB_DEPS)
 	(libs="$(MMAKE_LIBS)"; $(MMakeLinkCApp))
 
+$(onload_stats_collect): onload_stats_collect.o libstack.o $(MMAKE_LIB_DEPS)
+	(libs="$(MMAKE_LIBS)"; $(MMakeLinkCApp))
+
 $(pio_buddy_test): pio_buddy_test.o libstack.o $(MMAKE_LIB_DEPS)
 	(libs="$(MMAKE_LIBS)"; $(MMakeLinkCApp))
 
@@ -0,0 +1,378 @@
+/*
+** Copyright 2005-2019  Solarflare Communications Inc.
+**                      7505 Irvine Center Drive, Irvine, CA 92618, USA
+** Copyright 2002-2005  Level 5 Networks Inc.
+**
+** This program is free software; you can redistribute it and/or modify it
+** under the terms of version 2 of the GNU General Public License as
+** published by the Free Software Foundation.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+*/
+
+/**************************************************************************\
+*//*! \file
+** <L5_PRIVATE L5_SOURCE>
+**  \brief  Collect statistics from the stacks' statistics rings
+** </L5_PRIVATE>
+*//*
+\**************************************************************************/
+
+/*! \cidoxg_tests_ef */
+
+#include <ci/internal/ip.h>
+
+#if CI_CFG_STATS_RING
+
+#include <ci/app.h>
+#include <onload/ioctl.h>
+#include "libstack.h"
+#include <fnmatch.h>
+
+
+/* Binary output: a stream header, the field names, then for each record
+ * taken from a stack an oo_stats_collect_rec followed by the oo_stats_rec
+ * and its data exactly as found in the stack's ring.  Deltas in a stack's
+ * records apply to that stack's previous record; a key record restarts
+ * the stack's values, and follows any records that were lost.
+ */
+#define OO_STATS_COLLECT_MAGIC  0x4f534331   /* "OSC1" */
+
+struct oo_stats_collect_hdr {
+  ci_uint32 magic;
+  ci_uint32 version;        /* OO_STATS_RING_VERSION */
+  ci_uint32 schema_hash;
+  ci_uint32 n_fields;
+  ci_uint32 khz;
+  ci_uint32 names_len;      /* NUL-separated field names follow */
+};
+
+struct oo_stats_collect_rec {
+  ci_uint32 stack_id;
+  ci_uint32 len;            /* of the oo_stats_rec that follows */
+};
+
+
+static int cfg_interval = 10;
+static int cfg_binary;
+static int cfg_all;
+
+static ci_cfg_desc cfg_opts[] = {
+  {'i', "interval", CI_CFG_UINT, &cfg_interval,
+                                  "milliseconds between reads of the rings"},
+  {'b', "binary",   CI_CFG_FLAG, &cfg_binary,
+                                  "write the binary record stream to stdout"},
+  {'a', "all",      CI_CFG_FLAG, &cfg_all,
+                                  "print all counters, not just changes"},
+};
+#define N_CFG_OPTS (sizeof(cfg_opts) / sizeof(cfg_opts[0]))
+
+#define USAGE_STR  "[stack_id|stack_name ...]"
+
+
+/* Data for dynamic update of the stack list */
+static oo_fd onload_fd;
+static volatile int stacklist_has_update = 0;
+
+/* Filter stack names */
+#define MAX_PATTERNS 10
+static const char *filter_patterns[MAX_PATTERNS];
+static int filter_patterns_n = 0;
+
+/* Per stack readers, indexed by stack id. */
+static struct oo_stats_reader** readers;
+static int readers_n;
+
+/* Totals over all stacks. */
+static ci_uint64* agg;
+static ci_uint64* agg_prev;
+static ci_uint64 agg_frc;
+static unsigned agg_khz;
+
+static volatile int killed;
+
+
+static void usage(const char* msg)
+{
+  if( msg ) {
+    ci_log(" ");
+    ci_log("%s", msg);
+  }
+
+  ci_log(" ");
+  ci_log("usage:");
+  ci_log("  %s [options] " USAGE_STR, ci_appname);
+
+  ci_log(" ");
+  ci_log("options:");
+  ci_app_opt_usage(cfg_opts, N_CFG_OPTS);
+  ci_log(" ");
+  exit(-1);
+}
+
+
+static void out_write(const void* p, size_t len)
+{
+  if( fwrite(p, len, 1, stdout) != 1 ) {
+    ci_log("Failed to write to stdout");
+    exit(1);
+  }
+}
+
+
+static void out_flush(void)
+{
+  if( fflush(stdout) == EOF ) {
+    ci_log("Failed to flush stdout");
+    exit(1);
+  }
+}
+
+
+static void binary_hdr(unsigned khz)
+{
+  struct oo_stats_collect_hdr hdr;
+  unsigned i;
+
+  hdr.magic = OO_STATS_COLLECT_MAGIC;
+  hdr.version = OO_STATS_RING_VERSION;
+  hdr.schema_hash = oo_stats_schema_hash();
+  hdr.n_fields = oo_stats_n_fields;
+  hdr.khz = khz;
+  hdr.names_len = 0;
+  for( i = 0; i < oo_stats_n_fields; ++i )
+    hdr.names_len += strlen(oo_stats_fields[i].name) + 1;
+  out_write(&hdr, sizeof(hdr));
+  for( i = 0; i < oo_stats_n_fields; ++i )
+    out_write(oo_stats_fields[i].name, strlen(oo_stats_fields[i].name) + 1);
+}
+
+
+static void stack_on(ci_netif* ni)
+{
+  int id = NI_ID(ni);
+  struct oo_stats_reader* r;
+  int rc;
+
+  if( ni->stats_ring == NULL ) {
+    ci_log("[%d,%s]: no statistics ring (EF_STATS_RING_SIZE=0)",
+           id, ni->state->name);
+    return;
+  }
+  if( id >= readers_n ) {
+    int n = CI_MAX(readers_n * 2, id + 8);
+    CI_TEST(readers = realloc(readers, n * sizeof(readers[0])));
+    memset(readers + readers_n, 0, (n - readers_n) * sizeof(readers[0]));
+    readers_n = n;
+  }
+  ci_assert(readers[id] == NULL);
+  CI_TEST(r = malloc(sizeof(*r)));
+  rc = oo_stats_reader_init(r, ni->stats_ring);
+  if( rc < 0 ) {
+    ci_log("[%d,%s]: statistics ring not understood (%d); is this tool "
+           "from the same build as the stack?", id, ni->state->name, rc);
+    free(r);
+    return;
+  }
+  readers[id] = r;
+  if( cfg_binary && agg_khz == 0 )
+    binary_hdr(ni->stats_ring->khz);
+  agg_khz = ni->stats_ring->khz;
+  ci_log("[%d,%s]: collecting every %ums", id, ni->state->name,
+         ni->stats_ring->interval_ms);
+}
+
+
+static void stack_off(ci_netif* ni)
+{
+  int id = NI_ID(ni);
+  if( id >= readers_n || readers[id] == NULL )
+    return;
+  ci_log("[%d,%s]: now unused; stop collecting (%u overruns)",
+         id, ni->state->name, readers[id]->n_overruns);
+  oo_stats_reader_fini(readers[id]);
+  free(readers[id]);
+  readers[id] = NULL;
+}
+
+
+static void stack_collect(ci_netif* ni)
+{
+  int id = NI_ID(ni);
+  struct oo_stats_reader* r;
+  unsigned i;
+
+  if( id >= readers_n || (r = readers[id]) == NULL )
+    return;
+  while( oo_stats_reader_next(r) ) {
+    if( cfg_binary ) {
+      const struct oo_stats_rec* rec = r->buf;
+      struct oo_stats_collect_rec crec;
+      crec.stack_id = id;
+      crec.len = sizeof(*rec) + rec->data_len;
+      out_write(&crec, sizeof(crec));
+      out_write(rec, crec.len);
+    }
+  }
+  if( r->seq == 0 && r->frc == 0 )
+    return;
+  for( i = 0; i < oo_stats_n_fields; ++i )
+    agg[i] += r->values[i];
+  agg_frc = CI_MAX(agg_frc, r->frc);
+}
+
+
+static void text_report(void)
+{
+  unsigned i;
+  int n = 0;
+
+  for( i = 0; i < oo_stats_n_fields; ++i ) {
+    if( ! cfg_all && agg[i] == agg_prev[i] )
+      continue;
+    if( n++ == 0 )
+      printf("time: %"CI_PRIu64".%03u\n", agg_frc / agg_khz / 1000,
+             (unsigned) (agg_frc / agg_khz % 1000));
+    if( oo_stats_fields[i].is_count )
+      printf("  %s: %"CI_PRIu64" (+%"CI_PRId64")\n", oo_stats_fields[i].name,
+             agg[i], (ci_int64) (agg[i] - agg_prev[i]));
+    else
+      printf("  %s: %"CI_PRIu64"\n", oo_stats_fields[i].name, agg[i]);
+  }
+  memcpy(agg_prev, agg, oo_stats_n_fields * sizeof(agg[0]));
+}
+
+
+static int stackfilter_match_name(ci_netif_info_t *info)
+{
+  int i;
+  for( i = 0; i < filter_patterns_n; i++ ) {
+    if( fnmatch(filter_patterns[i], info->ni_name, 0) == 0)
+      return 1;
+  }
+  return 0; /* Not interested */
+}
+
+
+static void sighandler_fn(int sig, siginfo_t *info, void *context)
+{
+  if( ! killed ) {
+    killed = 1;
+    return;
+  }
+  exit(0);
+}
+
+
+static sa_sigaction_t sighandlers[OO_SIGHANGLER_DFL_MAX+1] =
+  { sighandler_fn, NULL, NULL };
+
+
+/* See onload_metrics_record: libstack is not thread-safe, so just flag
+ * the update for the main thread.
+ */
+static void *update_stack_list_thread(void *arg)
+{
+  struct oo_stacklist_update param;
+
+  param.timeout = -1;
+  param.seq = *(ci_uint32 *)arg;
+  pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+  while(1) {
+    CI_TRY(oo_ioctl(onload_fd, OO_IOC_DBG_WAIT_STACKLIST_UPDATE, &param));
+    stacklist_has_update = 1;
+  }
+
+  /* Unreachable */
+  return NULL;
+}
+
+
+int main(int argc, char* argv[])
+{
+  int attach_new_stacks = 0;
+  stackfilter_t *stackfilter = NULL;
+  struct oo_stacklist_update param;
+  pthread_t update_thread;
+
+  ci_app_usage = usage;
+  cfg_lock = 0;    /* don't take the stack lock when attaching */
+  cfg_nopids = 1;  /* pids are not needed, and can cause excessive delay */
+
+  ci_app_getopt(USAGE_STR, &argc, argv, cfg_opts, N_CFG_OPTS);
+  --argc; ++argv;
+  if( cfg_interval == 0 )
+    usage("--interval must be at least 1ms");
+
+  CI_TRY(libstack_init(sighandlers));
+  CI_TEST(agg = calloc(oo_stats_n_fields, sizeof(agg[0])));
+  CI_TEST(agg_prev = calloc(oo_stats_n_fields, sizeof(agg[0])));
+
+  CI_TRY(oo_fd_open(&onload_fd));
+  param.timeout = 0;
+  CI_TRY(oo_ioctl(onload_fd, OO_IOC_DBG_WAIT_STACKLIST_UPDATE, &param));
+
+  if( argc == 0 ) {
+    attach_new_stacks = 1;
+    list_all_stacks2(NULL, stack_on, NULL, &onload_fd);
+  }
+  else {
+    for( ; argc > 0 ; --argc, ++argv ) {
+      unsigned stack_id;
+      char dummy;
+
+      if( sscanf(argv[0], " %u %c", &stack_id, &dummy) != 1 ) {
+        if( filter_patterns_n == MAX_PATTERNS ) {
+          ci_log("Too many stack name patterns: ignore '%s'", argv[0]);
+          continue;
+        }
+        filter_patterns[filter_patterns_n++] = argv[0];
+        attach_new_stacks = 1;
+        continue;
+      }
+      if( ! stack_attach(stack_id) ) {
+        ci_log("No such stack id: %d", stack_id);
+        continue;
+      }
+      stack_on(&stack_attached(stack_id)->ni);
+    }
+    if( attach_new_stacks ) {
+      stackfilter = stackfilter_match_name;
+      list_all_stacks2(stackfilter, stack_on, NULL, &onload_fd);
+    }
+  }
+
+  pthread_create(&update_thread, NULL, update_stack_list_thread, &param.seq);
+
+  while( ! killed ) {
+    memset(agg, 0, oo_stats_n_fields * sizeof(agg[0]));
+    for_each_stack(stack_collect, 0);
+    if( ! cfg_binary && agg_khz != 0 )
+      text_report();
+    out_flush();
+
+    if( stacklist_has_update ) {
+      stacklist_has_update = 0; /* drop flag before updating the list */
+      if( attach_new_stacks )
+        list_all_stacks2(stackfilter, stack_on, stack_off, &onload_fd);
+    }
+    usleep(cfg_interval * 1000);
+  }
+
+  for_each_stack(stack_off, 0);
+  return 0;
+}
+
+#else /* CI_CFG_STATS_RING */
+
+int main(int argc, char* argv[])
+{
+  ci_log("Onload was compiled without statistics ring support.  "
+         "Please turn CI_CFG_STATS_RING on.");
+  return 1;
+}
+
+#endif /* CI_CFG_STATS_RING */
@@ -58,6 +58,13 @@ static int cfg_dump_os = 1;
 static int cfg_if_is_loop = 0;
 static int cfg_dump_no_match_only = 0;
 
+/* Filter to run in the stack, when the stack has a capture ring */
+static const char *cfg_filter = NULL;
+#if CI_CFG_TCPDUMP_RING
+static struct bpf_program filter_prog;
+static int filter_compiled = 0;
+#endif
+
 /* capture precision */
 static const char *cfg_precision = "micro";
 static int do_nano = 0;
@@ -95,6 +102,9 @@ static ci_cfg_desc cfg_opts[] = {
                            "dump only packets not matching onload sockets"},
   {  2, "time-stamp-precision", CI_CFG_STR, &cfg_precision,
                  "set the timestamp precision, default to \"micro\", man tcpdump"},
+  {  3, "filter",    CI_CFG_STR,  &cfg_filter,
+                "pcap expression run in the stack to select packets to "
+                "capture (needs EF_TCPDUMP_RING_SIZE)"},
 };
 #define N_CFG_OPTS (sizeof(cfg_opts) / sizeof(cfg_opts[0]))
 
@@ -158,15 +168,15 @@ static void frc_resync(struct frc_sync* fs)
 }
 
 
-static void pkt_tstamp(const ci_ip_pkt_fmt* pkt, struct timespec* ts_out)
+static void frc_tstamp(ci_uint64 frc, struct timespec* ts_out)
 {
   static struct frc_sync fs;
-  int64_t ns, frc_diff = pkt->tstamp_frc - fs.sync_frc;
+  int64_t ns, frc_diff = frc - fs.sync_frc;
 
   /* This if() triggers on the first call. */
   if( frc_diff > fs.max_frc_diff ) {
     frc_resync(&fs);
-    frc_diff = pkt->tstamp_frc - fs.sync_frc;
+    frc_diff = frc - fs.sync_frc;
   }
 
   *ts_out = fs.sync_ts;
@@ -251,6 +261,82 @@ suicide:
   exit(1);
 }
 
+#if CI_CFG_TCPDUMP_RING
+/* Compile cfg_filter for the stacks' capture rings. */
+static int filter_compile(void)
+{
+  char* expr = NULL;
+  pcap_t* pcap;
+  int rc;
+
+  /* The stack runs the filter over frames with their VLAN tag. */
+  if( (cfg_encap.type & CICP_LLAP_TYPE_VLAN) &&
+      asprintf(&expr, "vlan %d and (%s)", cfg_encap.vlan_id, cfg_filter) < 0 )
+    return -ENOMEM;
+
+  pcap = pcap_open_dead(DLT_EN10MB, cfg_snaplen);
+  if( pcap == NULL ) {
+    free(expr);
+    return -ENOMEM;
+  }
+  rc = pcap_compile(pcap, &filter_prog, expr != NULL ? expr : cfg_filter,
+                    1, PCAP_NETMASK_UNKNOWN);
+  if( rc != 0 ) {
+    ci_log("Error: bad filter '%s': %s", cfg_filter, pcap_geterr(pcap));
+    rc = -EINVAL;
+  }
+  else if( filter_prog.bf_len > CI_CFG_TCPDUMP_BPF_MAX_INSNS ) {
+    ci_log("Error: filter '%s' is too long (%u instructions, max %d)",
+           cfg_filter, filter_prog.bf_len, CI_CFG_TCPDUMP_BPF_MAX_INSNS);
+    pcap_freecode(&filter_prog);
+    rc = -E2BIG;
+  }
+  else {
+    filter_compiled = 1;
+  }
+  pcap_close(pcap);
+  free(expr);
+  return rc;
+}
+
+/* Take ownership of the stack's capture ring: discard anything left by an
+ * earlier reader and install our snaplen and filter.
+ */
+static void capture_ring_on(ci_netif *ni)
+{
+  struct oo_capture_ring* ring = ni->capture_ring;
+  int i;
+
+  ci_assert(ci_netif_is_locked(ni));
+
+  ring->read_pos = ring->write_pos;
+  ring->n_captured = ring->n_filtered = ring->n_dropped = 0;
+  /* Leave room for a VLAN tag that we will strip. */
+  ring->snaplen = cfg_snaplen + ETH_VLAN_HLEN;
+  ring->bpf_len = 0;
+  if( cfg_filter != NULL ) {
+    for( i = 0; i < filter_prog.bf_len; ++i ) {
+      ring->bpf[i].code = filter_prog.bf_insns[i].code;
+      ring->bpf[i].jt = filter_prog.bf_insns[i].jt;
+      ring->bpf[i].jf = filter_prog.bf_insns[i].jf;
+      ring->bpf[i].k = filter_prog.bf_insns[i].k;
+    }
+    ci_wmb();
+    ring->bpf_len = filter_prog.bf_len;
+  }
+}
+
+static void capture_ring_report(ci_netif *ni)
+{
+  struct oo_capture_ring* ring = ni->capture_ring;
+
+  ci_log("Onload stack [%d,%s]: %"CI_PRIu64" packets captured, "
+         "%"CI_PRIu64" filtered, %"CI_PRIu64" dropped",
+         ni->state->stack_id, ni->state->name, ring->n_captured,
+         ring->n_filtered, ring->n_dropped);
+}
+#endif
+
 /* Turn dumping on */
 static void stack_dump_on(ci_netif *ni)
 {
@@ -290,6 +376,20 @@ static void stack_dump_on(ci_netif *ni)
   if( dump_hwports[0] == -1 )
     ifindex_to_intf_i(ni);
 
+#if CI_CFG_TCPDUMP_RING
+  if( cfg_filter != NULL && ! filter_compiled && filter_compile() != 0 ) {
+    libstack_netif_unlock(ni);
+    exit(1);
+  }
+  if( ni->capture_ring != NULL )
+    capture_ring_on(ni);
+  else
+#endif
+  if( cfg_filter != NULL )
+    ci_log("Onload stack [%d,%s]: EF_TCPDUMP_RING_SIZE is not set, so the "
+           "filter is not applied in the stack",
+           ni->state->stack_id, ni->state->name);
+
   /* Set up dumping */
   ci_log("Onload stack [%d,%s]: start packet dump",
          ni->state->stack_id, ni->state->name);
@@ -317,6 +417,12 @@ static void stack_dump_off(ci_netif *ni)
   libstack_netif_lock(ni);
   oo_tcpdump_free_pkts(ni, ni->state->dump_read_i);
   ni->state->dump_read_i = ni->state->dump_write_i;
+#if CI_CFG_TCPDUMP_RING
+  if( ni->capture_ring != NULL ) {
+    capture_ring_report(ni);
+    ni->capture_ring->bpf_len = 0;
+  }
+#endif
   ci_log("Onload stack [%d,%s]: stop packet dump",
          ni->state->stack_id, ni->state->name);
 }
@@ -337,6 +443,112 @@ static void dump_flush(void)
   }
 }
 
+#if CI_CFG_TCPDUMP_RING
+/* Dump from the stack's capture ring */
+static void stack_dump_ring(ci_netif *ni)
+{
+  struct oo_capture_ring* ring = ni->capture_ring;
+  int strip_vlan = cfg_encap.type & CICP_LLAP_TYPE_VLAN;
+  int do_strip_vlan = strip_vlan;
+  ci_uint64 read_pos = ring->read_pos;
+  ci_uint64 end_pos = ring->write_pos;
+  sigset_t sigset;
+
+  if( end_pos == read_pos )
+    return;
+
+  sigemptyset(&sigset);
+  sigaddset(&sigset, SIGINT);
+
+  /* As for the queue, release space in batches to avoid dirtying the
+   * cache line that the stack reads on every capture.
+   */
+  if( end_pos - read_pos > ring->size / 4 )
+    end_pos = read_pos + ring->size / 4;
+
+  /* Barrier to ensure records are written. */
+  ci_rmb();
+
+  CI_TEST( pthread_sigmask(SIG_BLOCK, &sigset, NULL) == 0 );
+
+  while( read_pos < end_pos ) {
+    struct oo_capture_rec* rec;
+    struct oo_pcap_pkthdr hdr;
+    struct timespec ts;
+    ci_uint8* frame;
+    int paylen, caplen;
+
+    rec = (struct oo_capture_rec*)
+      (OO_CAPTURE_RING_DATA(ring) + (read_pos & (ring->size - 1)));
+    read_pos += rec->rec_len;
+    if( rec->flags & OO_CAPTURE_REC_F_PAD )
+      continue;
+    frame = (ci_uint8*) (rec + 1);
+    paylen = rec->len;
+    caplen = rec->caplen;
+
+    if( strip_vlan ) {
+      if( rec->vlan != cfg_encap.vlan_id ) {
+        /* The stack does not set the VLAN on the TX path, so check the
+         * frame itself.
+         */
+        if( rec->vlan == 0 ) {
+          uint16_t* p_ether_type = (uint16_t*) (frame + 2 * ETH_ALEN);
+          if( caplen < 2 * ETH_ALEN + ETH_VLAN_HLEN ||
+              p_ether_type[0] != CI_ETHERTYPE_8021Q ||
+              (CI_BSWAP_BE16(p_ether_type[1]) & 0xfff) != cfg_encap.vlan_id )
+            continue;
+        }
+        else
+          continue;
+      }
+      do_strip_vlan = rec->intf_i != OO_INTF_I_SEND_VIA_OS &&
+                      caplen >= 2 * ETH_ALEN + ETH_VLAN_HLEN;
+    }
+
+    /* For loopback, ensure that ethernet header is correct */
+    if( rec->intf_i == OO_INTF_I_LOOPBACK && caplen >= 2 * ETH_ALEN )
+      memset(frame, 0, 2 * ETH_ALEN);
+
+    if( do_strip_vlan ) {
+      paylen -= ETH_VLAN_HLEN;
+      caplen -= ETH_VLAN_HLEN;
+    }
+    hdr.caplen = CI_MIN(cfg_snaplen, caplen);
+    hdr.len = paylen;
+    if( rec->flags & OO_CAPTURE_REC_F_HW_TS ) {
+      ts.tv_sec = rec->hw_ts_ns / 1000000000;
+      ts.tv_nsec = rec->hw_ts_ns % 1000000000;
+    }
+    else {
+      frc_tstamp(rec->frc, &ts);
+    }
+    hdr.t.ts.tv_sec = ts.tv_sec;
+    if( do_nano )
+      hdr.t.ts.tv_nsec = ts.tv_nsec;
+    else
+      hdr.t.tv.tv_usec = ts.tv_nsec / 1000;
+
+    dump_data(&hdr, sizeof(hdr));
+    if( do_strip_vlan ) {
+      dump_data(frame, 2 * ETH_ALEN);
+      dump_data(frame + 2 * ETH_ALEN + ETH_VLAN_HLEN,
+                hdr.caplen - 2 * ETH_ALEN);
+    }
+    else if( hdr.caplen > 0 ) {
+      dump_data(frame, hdr.caplen);
+    }
+  }
+
+  /* Ensure we've finished reading before we release. */
+  ci_mb();
+  ring->read_pos = read_pos;
+
+  dump_flush();
+  CI_TEST( pthread_sigmask(SIG_UNBLOCK, &sigset, NULL) == 0 );
+}
+#endif
+
 /* Do dump */
 static void stack_dump(ci_netif *ni)
 {
@@ -346,6 +558,13 @@ static void stack_dump(ci_netif *ni)
   ci_uint16 i, fill_level = ni->state->dump_write_i - read_i;
   sigset_t sigset;
 
+#if CI_CFG_TCPDUMP_RING
+  if( ni->capture_ring != NULL ) {
+    stack_dump_ring(ni);
+    return;
+  }
+#endif
+
   if( fill_level == 0 )
     return;
 
@@ -414,7 +633,7 @@ static void stack_dump(ci_netif *ni)
       paylen -= ETH_VLAN_HLEN;
     hdr.caplen = CI_MIN(cfg_snaplen, paylen);
     hdr.len = paylen;
-    pkt_tstamp(pkt, &ts);
+    frc_tstamp(pkt->tstamp_frc, &ts);
     hdr.t.ts.tv_sec = ts.tv_sec;
     if( do_nano )
       hdr.t.ts.tv_nsec = ts.tv_nsec;
@@ -478,6 +697,10 @@ static void stack_pre_detach(ci_netif *ni)
   libstack_netif_unlock(ni);
 #endif
 
+#if CI_CFG_TCPDUMP_RING
+  if( ni->capture_ring != NULL )
+    capture_ring_report(ni);
+#endif
   ci_log("Onload stack [%d,%s] is now unused: stop dumping",
          ni->state->stack_id, ni->state->name);
 }
@@ -41,6 +41,10 @@ FTL_DECLARE(STRUCT_NETIF_DBG_MAX)
 FTL_DECLARE(STRUCT_NETIF_THRD_INFO)
 FTL_DECLARE(STRUCT_EF_VI_STATS)
 FTL_DECLARE(STRUCT_SOCKET_CACHE)
+#if CI_CFG_LAT_HIST
+FTL_DECLARE(STRUCT_LAT_HIST)
+FTL_DECLARE(STRUCT_LAT_HISTS)
+#endif
 FTL_DECLARE(STRUCT_NETIF_STATE)
 FTL_DECLARE(STRUCT_USER_PTR)
 FTL_DECLARE(UNION_SLEEP_SEQ)
@@ -71,6 +75,8 @@ FTL_DECLARE(STRUCT_TCP_SOCKET_LISTEN_STATS)
 FTL_DECLARE(STRUCT_TCP_LISTEN)
 FTL_DECLARE(STRUCT_WAITABLE_OBJ)
 FTL_DECLARE(STRUCT_FILTER_TABLE_ENTRY)
+FTL_DECLARE(STRUCT_FILTER_BUCKET_HDR)
+FTL_DECLARE(STRUCT_FILTER_TABLE_BUCKET)
 FTL_DECLARE(STRUCT_FILTER_TABLE)
 #if CI_CFG_USERSPACE_PIPE
 FTL_DECLARE(STRUCT_OO_PIPE_BUF_LIST_T)
@@ -198,6 +198,30 @@
 #define ON_CI_CFG_PROC_DELAY IGNORE
 #endif
 
+#if CI_CFG_LAT_HIST
+#define ON_CI_CFG_LAT_HIST DO
+#else
+#define ON_CI_CFG_LAT_HIST IGNORE
+#endif
+
+#if CI_CFG_TCPDUMP_RING
+#define ON_CI_CFG_TCPDUMP_RING DO
+#else
+#define ON_CI_CFG_TCPDUMP_RING IGNORE
+#endif
+
+#if CI_CFG_STATS_RING
+#define ON_CI_CFG_STATS_RING DO
+#else
+#define ON_CI_CFG_STATS_RING IGNORE
+#endif
+
+#if CI_CFG_SPIN_ADAPT
+#define ON_CI_CFG_SPIN_ADAPT DO
+#else
+#define ON_CI_CFG_SPIN_ADAPT IGNORE
+#endif
+
 #define ON_CI_CFG_L3XUDP IGNORE
 
 #if CI_CFG_USERSPACE_PIPE
@@ -389,6 +413,9 @@
     FTL_TFIELD_STRUCT(ctx, ci_ni_dllist_t, fire_list, ORM_OUTPUT_EXTRA)      \
     FTL_TFIELD_ARRAYOFSTRUCT(ctx, \
                              ci_ni_dllist_t, warray, CI_IPTIME_WHEELSIZE, ORM_OUTPUT_EXTRA, 1)   \
+    FTL_TFIELD_ARRAYOFSTRUCT(ctx, \
+                             ci_ni_dllist_t, wnext, CI_IPTIME_WNEXTSIZE, ORM_OUTPUT_EXTRA, 1)   \
+    FTL_TFIELD_INT(ctx, ci_uint32, coalesce_mask, ORM_OUTPUT_STACK)          \
     FTL_TSTRUCT_END(ctx)                                                 
 
 #define STRUCT_IP_TIMER(ctx) \
@@ -572,6 +599,21 @@
   FTL_TFIELD_INT(ctx, ci_int32, avail_stack, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))         \
   FTL_TSTRUCT_END(ctx)
 
+#define STRUCT_LAT_HIST(ctx)                                            \
+  FTL_TSTRUCT_BEGIN(ctx, ci_lat_hist, )                                 \
+  FTL_TFIELD_INT(ctx, ci_uint32, n, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS)) \
+  FTL_TFIELD_INT(ctx, ci_uint32, max_ns, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS)) \
+  FTL_TFIELD_INT(ctx, ci_uint64, sum_ns, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS)) \
+  FTL_TFIELD_ARRAYOFINT(ctx, ci_uint32, bucket, CI_LAT_HIST_BUCKETS,    \
+                        (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))        \
+  FTL_TSTRUCT_END(ctx)
+
+#define STRUCT_LAT_HISTS(ctx)                                           \
+  FTL_TSTRUCT_BEGIN(ctx, ci_lat_hists, )                                \
+  FTL_TFIELD_ARRAYOFSTRUCT(ctx, ci_lat_hist, h, CI_LAT_HIST_N,          \
+                           (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS), 1)  \
+  FTL_TSTRUCT_END(ctx)
+
 #define STRUCT_NETIF_STATE(ctx)                                         \
   FTL_TSTRUCT_BEGIN(ctx, ci_netif_state, )                              \
   FTL_TFIELD_ARRAYOFSTRUCT(ctx, ci_netif_state_nic_t, nic, CI_CFG_MAX_INTERFACES, \
@@ -611,11 +653,19 @@
   FTL_TFIELD_INT(ctx, ci_int32, n_async_pkts, ORM_OUTPUT_STACK)           \
   FTL_TFIELD_INT(ctx, ci_int32, reserved_pktbufs, ORM_OUTPUT_STACK)       \
   FTL_TFIELD_INT(ctx, ci_uint64, nonb_pkt_pool, ORM_OUTPUT_STACK)         \
+  FTL_TFIELD_ANON_ARRAYOFSTRUCT_BEGIN(ctx, nonb_magazine,                \
+                                      CI_CFG_PKT_NONB_MAGAZINES,            \
+                                      ORM_OUTPUT_STACK)                     \
+  FTL_TFIELD_ANON_ARRAYOFSTRUCT(ctx, ci_uint64, nonb_magazine, link,      \
+                                CI_CFG_PKT_NONB_MAGAZINES)                \
+  FTL_TFIELD_ANON_ARRAYOFSTRUCT_END(ctx, nonb_magazine,                  \
+                                    CI_CFG_PKT_NONB_MAGAZINES)            \
   FTL_TFIELD_STRUCT(ctx, ci_netif_ipid_cb_t, ipid, ORM_OUTPUT_EXTRA) \
   FTL_TFIELD_INT(ctx, ci_uint32, vi_ofs, ORM_OUTPUT_STACK)                \
   FTL_TFIELD_INT(ctx, ci_uint32, active_wild_ofs, ORM_OUTPUT_STACK)             \
   FTL_TFIELD_INT(ctx, ci_uint16, active_wild_pools_n, ORM_OUTPUT_STACK)             \
   FTL_TFIELD_INT(ctx, ci_uint32, table_ofs, ORM_OUTPUT_STACK)             \
+  FTL_TFIELD_INT(ctx, ci_uint32, synrecv_table_ofs, ORM_OUTPUT_STACK)     \
   FTL_TFIELD_INT(ctx, ci_uint32, buf_ofs, ORM_OUTPUT_STACK)               \
   FTL_TFIELD_STRUCT(ctx, ci_ip_timer_state, iptimer_state, ORM_OUTPUT_STACK) \
   FTL_TFIELD_STRUCT(ctx, ci_ip_timer, timeout_tid, ORM_OUTPUT_STACK)      \
@@ -694,6 +744,7 @@
   )                                                                     \
   FTL_TFIELD_INT(ctx, ci_int32, creation_numa_node, ORM_OUTPUT_STACK)     \
   FTL_TFIELD_INT(ctx, ci_int32, load_numa_node, ORM_OUTPUT_STACK)         \
+  FTL_TFIELD_INT(ctx, ci_int32, nic_numa_node, ORM_OUTPUT_STACK)          \
   FTL_TFIELD_INT(ctx, ci_uint32, packet_alloc_numa_nodes, ORM_OUTPUT_STACK)\
   FTL_TFIELD_INT(ctx, ci_uint32, sock_alloc_numa_nodes, ORM_OUTPUT_STACK) \
   FTL_TFIELD_INT(ctx, ci_uint32, interrupt_numa_nodes, ORM_OUTPUT_STACK)  \
@@ -721,6 +772,20 @@
                           CI_CFG_PROC_DELAY_BUCKETS, ORM_OUTPUT_STACK)    \
     FTL_TFIELD_INT(ctx, ci_uint32, proc_delay_negative, ORM_OUTPUT_STACK) \
   )                                                                       \
+  ON_CI_CFG_LAT_HIST(                                                     \
+    FTL_TFIELD_INT(ctx, ci_uint32, lat_hist_n_socks, ORM_OUTPUT_STACK)    \
+    FTL_TFIELD_INT(ctx, ci_uint32, lat_hist_ns_mult, ORM_OUTPUT_STACK)    \
+    FTL_TFIELD_STRUCT(ctx, ci_lat_hists, lat_hist, ORM_OUTPUT_STACK)      \
+  )                                                                       \
+  ON_CI_CFG_TCPDUMP_RING(                                                 \
+    FTL_TFIELD_INT(ctx, ci_uint32, capture_ring_ofs, ORM_OUTPUT_EXTRA)    \
+  )                                                                       \
+  ON_CI_CFG_STATS_RING(                                                   \
+    FTL_TFIELD_INT(ctx, ci_uint32, stats_ring_ofs, ORM_OUTPUT_EXTRA)      \
+  )                                                                       \
+  ON_CI_CFG_SPIN_ADAPT(                                                   \
+    FTL_TFIELD_INT(ctx, ci_uint32, spin_adapt_ofs, ORM_OUTPUT_EXTRA)      \
+  )                                                                       \
   FTL_TSTRUCT_END(ctx)
 
 
@@ -963,6 +1028,7 @@ typedef struct oo_sock_cplane oo_sock_cplane_t;
   FTL_TFIELD_INT(ctx, ci_uint32, n_tx_lock_snd, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))    \
   FTL_TFIELD_INT(ctx, ci_uint32, n_tx_lock_cp, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))     \
   FTL_TFIELD_INT(ctx, ci_uint32, n_tx_lock_defer, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))  \
+  FTL_TFIELD_INT(ctx, ci_uint32, n_tx_lock_staged, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS)) \
   FTL_TFIELD_INT(ctx, ci_uint32, n_tx_eagain, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))      \
   FTL_TFIELD_INT(ctx, ci_uint32, n_tx_spin, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))        \
   FTL_TFIELD_INT(ctx, ci_uint32, n_tx_block, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))       \
@@ -971,6 +1037,9 @@ typedef struct oo_sock_cplane oo_sock_cplane_t;
   FTL_TFIELD_INT(ctx, ci_uint32, n_tx_msg_confirm, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS)) \
   FTL_TFIELD_INT(ctx, ci_uint32, n_tx_os_late, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))     \
   FTL_TFIELD_INT(ctx, ci_uint32, n_tx_unconnect_late, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS)) \
+  FTL_TFIELD_INT(ctx, ci_uint32, n_tx_tmpl_fast, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))   \
+  FTL_TFIELD_INT(ctx, ci_uint32, n_tx_tmpl_slow, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))   \
+  FTL_TFIELD_INT(ctx, ci_uint32, n_tx_tmpl_active, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS)) \
   FTL_TSTRUCT_END(ctx)
 
 typedef struct oo_tcp_socket_stats oo_tcp_socket_stats;
@@ -1034,6 +1103,7 @@ typedef struct oo_tcp_socket_stats oo_tcp_socket_stats;
   FTL_TFIELD_INT(ctx, ci_int32, tx_async_q, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))               \
   FTL_TFIELD_INT(ctx, oo_atomic_t, tx_async_q_level, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))        \
   FTL_TFIELD_INT(ctx, ci_uint32, tx_count, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))                \
+  FTL_TFIELD_INT(ctx, ci_int32, tmpl_head, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))                \
   FTL_TFIELD_STRUCT(ctx, ci_udp_socket_stats, stats, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))      \
   FTL_TSTRUCT_END(ctx)
 
@@ -1107,6 +1177,7 @@ typedef struct oo_tcp_socket_stats oo_tcp_socket_stats;
     FTL_TFIELD_INT(ctx, ci_iptime_t, t_ka_intvl_in_secs, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS)) \
     FTL_TFIELD_INT(ctx, ci_uint16, user_mss, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))               \
     FTL_TFIELD_INT(ctx, ci_uint8, tcp_defer_accept, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))	      \
+    FTL_TFIELD_INT(ctx, ci_uint8, cc_algo, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))                 \
     FTL_TSTRUCT_END(ctx)
 
 #define STRUCT_TCP(ctx) \
@@ -1155,6 +1226,7 @@ typedef struct oo_tcp_socket_stats oo_tcp_socket_stats;
     FTL_TFIELD_INT(ctx, ci_uint32, rcv_wnd_right_edge_sent, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))     \
     FTL_TFIELD_INT(ctx, ci_uint32, rcv_added, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))                   \
     FTL_TFIELD_INT(ctx, ci_uint32, rcv_delivered, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))               \
+    FTL_TFIELD_INT(ctx, ci_uint32, rcv_lent, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))                    \
     FTL_TFIELD_INT(ctx, ci_uint32, ack_trigger, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))                 \
     ON_CI_CFG_BURST_CONTROL(                                            \
       FTL_TFIELD_INT(ctx, ci_uint32, burst_window, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))              \
@@ -1284,8 +1356,6 @@ typedef struct oo_tcp_socket_stats oo_tcp_socket_stats;
     FTL_TFIELD_INT(ctx, ci_int32, n_listenq_new, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))        \
     FTL_TFIELD_ARRAYOFSTRUCT(ctx, ci_ni_dllist_t,       \
 			     listenq, CI_CFG_TCP_SYNACK_RETRANS_MAX + 1, ORM_OUTPUT_EXTRA, 1)    \
-    FTL_TFIELD_INT(ctx, ci_int32, bucket, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))               \
-    FTL_TFIELD_INT(ctx, ci_uint32, n_buckets, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))           \
     ON_CI_CFG_FD_CACHING(                                                     \
       FTL_TFIELD_STRUCT(ctx, ci_socket_cache_t, epcache, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))\
       FTL_TFIELD_STRUCT(ctx, ci_ni_dllist_t,            \
@@ -1310,16 +1380,31 @@ typedef struct oo_tcp_socket_stats oo_tcp_socket_stats;
 #define STRUCT_FILTER_TABLE_ENTRY(ctx)                                        \
     FTL_TSTRUCT_BEGIN(ctx, ci_netif_filter_table_entry, )                     \
     FTL_TFIELD_INT(ctx, ci_int32, id, ORM_OUTPUT_STACK)            \
-    FTL_TFIELD_INT(ctx, ci_int32, route_count, ORM_OUTPUT_STACK)   \
     FTL_TFIELD_INT(ctx, ci_uint32, laddr, ORM_OUTPUT_STACK)        \
     FTL_TSTRUCT_END(ctx)
     
 
+#define STRUCT_FILTER_BUCKET_HDR(ctx)                                         \
+    FTL_TSTRUCT_BEGIN(ctx, ci_netif_filter_bucket_hdr, )                      \
+    FTL_TFIELD_INT(ctx, ci_uint32, tags, ORM_OUTPUT_STACK)         \
+    FTL_TFIELD_INT(ctx, ci_uint32, overflow, ORM_OUTPUT_STACK)     \
+    FTL_TFIELD_INT(ctx, ci_int32, route_count, ORM_OUTPUT_STACK)   \
+    FTL_TSTRUCT_END(ctx)
+    
+
+#define STRUCT_FILTER_TABLE_BUCKET(ctx)                                       \
+    FTL_TSTRUCT_BEGIN(ctx, ci_netif_filter_table_bucket, )                    \
+    FTL_TFIELD_STRUCT(ctx, ci_netif_filter_bucket_hdr, hdr, ORM_OUTPUT_STACK) \
+    FTL_TFIELD_ARRAYOFSTRUCT(ctx, ci_netif_filter_table_entry, entry, \
+                             CI_NETIF_FILTER_BUCKET_WAYS, ORM_OUTPUT_STACK, 1) \
+    FTL_TSTRUCT_END(ctx)
+    
+
 #define STRUCT_FILTER_TABLE(ctx)                                              \
     FTL_TSTRUCT_BEGIN(ctx, ci_netif_filter_table, )                           \
     FTL_TFIELD_INT(ctx, unsigned, table_size_mask, ORM_OUTPUT_STACK)    \
     FTL_TFIELD_ARRAYOFSTRUCT(ctx, \
-			     ci_netif_filter_table_entry, table, 1, ORM_OUTPUT_STACK, 1) \
+			     ci_netif_filter_table_bucket, bucket, 1, ORM_OUTPUT_STACK, 1) \
     FTL_TSTRUCT_END(ctx)
     
 #define STRUCT_OO_PIPE_BUF_LIST_T(ctx)                            \
@@ -1344,6 +1429,8 @@ typedef struct oo_pipe oo_pipe;
   FTL_TFIELD_INT(ctx, ci_uint32, aflags, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))                       \
   FTL_TFIELD_INT(ctx, ci_uint32, bufs_num, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))                     \
   FTL_TFIELD_INT(ctx, ci_uint32, bufs_max, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))                     \
+  FTL_TFIELD_INT(ctx, ci_uint32, buf_base, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))                     \
+  FTL_TFIELD_INT(ctx, ci_uint32, buf_end, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))                      \
   FTL_TFIELD_INT(ctx, ci_uint32, bytes_added, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))                  \
   FTL_TFIELD_INT(ctx, ci_uint32, bytes_removed, (ORM_OUTPUT_STACK | ORM_OUTPUT_SOCKETS))                \
   FTL_TSTRUCT_END(ctx)
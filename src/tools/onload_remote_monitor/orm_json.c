@@ -722,6 +722,19 @@ static void orm_dump_struct_ci_netif_config_opts(char* label, ci_netif_config_op
 
 #include "ftl_decls.h"
 
+#if CI_CFG_LAT_HIST
+static void orm_lat_hist_sock_dump(ci_netif* ni, unsigned id,
+                                   int output_flags)
+{
+  if( id < ni->state->lat_hist_n_socks )
+    orm_dump_struct_ci_lat_hists("latency_hist", &ni->lat_hist_socks[id],
+                                 output_flags);
+}
+#else
+# define orm_lat_hist_sock_dump(ni, id, output_flags)  do{}while(0)
+#endif
+
+
 static void orm_waitable_dump(ci_netif* ni, const char* sock_type, int output_flags)
 {
   ci_netif_state* ns = ni->state;
@@ -744,6 +757,7 @@ static void orm_waitable_dump(ci_netif* ni, const char* sock_type, int output_fl
                (w->state & CI_TCP_STATE_TCP) ) {
         dump_buf_cat("\"%d\": {", W_FMT(w));
         orm_dump_struct_ci_tcp_state("tcp_state", &wo->tcp, output_flags);
+        orm_lat_hist_sock_dump(ni, id, output_flags);
         dump_buf_cleanup();
         dump_buf_cat("}, ");
       }
@@ -752,6 +766,7 @@ static void orm_waitable_dump(ci_netif* ni, const char* sock_type, int output_fl
                (w->state == CI_TCP_STATE_UDP) ) {
         dump_buf_cat("\"%d\": {", W_FMT(w));
         orm_dump_struct_ci_udp_state("udp_state", &wo->udp, output_flags);
+        orm_lat_hist_sock_dump(ni, id, output_flags);
         dump_buf_cleanup();
         dump_buf_cat("}, ");
       }